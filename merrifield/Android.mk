@@ -16,6 +16,23 @@ LOCAL_PATH := $(call my-dir)
 
 LOCAL_ROOT_PATH := $(call my-dir)
 
+include $(LOCAL_PATH)/common/engine.mk
+
+# the engine, linked whole into the HAL module of the platform
+ifneq ($(filter true, $(INTEL_HWC_MERRIFIELD) $(INTEL_HWC_MOOREFIELD)),)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(HWC_ENGINE_SRC_FILES)
+LOCAL_C_INCLUDES := $(HWC_ENGINE_C_INCLUDES)
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_C_INCLUDES)
+LOCAL_CFLAGS += $(HWC_ENGINE_CFLAGS)
+
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := libhwcengine
+
+include $(BUILD_STATIC_LIBRARY)
+endif
+
 ifeq ($(INTEL_HWC_MERRIFIELD),true)
 include $(LOCAL_PATH)/platforms/merrifield/Android.mk
 endif
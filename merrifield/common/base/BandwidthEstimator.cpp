@@ -0,0 +1,246 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <Drm.h>
+#include <BufferManager.h>
+#include <DisplayQuery.h>
+#include <BandwidthEstimator.h>
+
+namespace android {
+namespace intel {
+
+BandwidthEstimator::BandwidthEstimator()
+    : mInitialized(false),
+      mDrm(0),
+      mBufferManager(0),
+      mScanoutRate(0),
+      mGlesRate(0),
+      mPeakRate(0),
+      mWindowStart(0),
+      mWindowBytes(0),
+      mTracedTotal(-1),
+      mTracedScanout(-1),
+      mTracedGles(-1),
+      mFrames(0)
+{
+    CTRACE();
+    memset(mLoads, 0, sizeof(mLoads));
+}
+
+BandwidthEstimator::~BandwidthEstimator()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool BandwidthEstimator::initialize(Drm *drm, BufferManager *bm)
+{
+    if (!drm || !bm) {
+        ETRACE("invalid drm or buffer manager");
+        return false;
+    }
+
+    mDrm = drm;
+    mBufferManager = bm;
+    mInitialized = true;
+    return true;
+}
+
+void BandwidthEstimator::deinitialize()
+{
+    mDrm = 0;
+    mBufferManager = 0;
+    mInitialized = false;
+}
+
+uint64_t BandwidthEstimator::getFetchBytes(uint32_t format, uint32_t width,
+                                           uint32_t height, bool compressed)
+{
+    uint64_t pixels = (uint64_t)width * height;
+    uint64_t bytes;
+
+    if (DisplayQuery::isVideoFormat(format)) {
+        return pixels * 3 / 2;
+    }
+
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGB_565:
+        bytes = pixels * 2;
+        break;
+    default:
+        bytes = pixels * 4;
+        break;
+    }
+
+    if (compressed) {
+        bytes /= COMPRESSION_RATIO;
+    }
+    return bytes;
+}
+
+uint64_t BandwidthEstimator::getLayerBytes(const hwc_layer_1_t& layer, bool *compressed)
+{
+    BufferAttributes attributes;
+    if (!layer.handle || !mBufferManager->getBufferAttributes(layer.handle, attributes)) {
+        *compressed = false;
+        return 0;
+    }
+
+    *compressed = attributes.isCompressed;
+    uint32_t width = (uint32_t)(layer.sourceCropf.right - layer.sourceCropf.left);
+    uint32_t height = (uint32_t)(layer.sourceCropf.bottom - layer.sourceCropf.top);
+    return getFetchBytes(attributes.format, width, height, attributes.isCompressed);
+}
+
+void BandwidthEstimator::estimate(int disp, hwc_display_contents_1_t *display,
+                                  DisplayLoad& load)
+{
+    memset(&load, 0, sizeof(load));
+    if (!display || !display->numHwLayers) {
+        return;
+    }
+
+    drmModeModeInfo mode;
+    load.refresh = 60;
+    if (disp != IDisplayDevice::DEVICE_VIRTUAL &&
+        mDrm->getModeInfo(disp, mode) && mode.vrefresh) {
+        load.refresh = mode.vrefresh;
+    }
+
+    // the frame buffer target is the last layer
+    const hwc_layer_1_t& target = display->hwLayers[display->numHwLayers - 1];
+    bool targetCompressed = false;
+    uint64_t targetBytes = 0;
+    if (target.compositionType == HWC_FRAMEBUFFER_TARGET) {
+        targetBytes = getLayerBytes(target, &targetCompressed);
+    }
+
+    for (size_t i = 0; i < display->numHwLayers; i++) {
+        const hwc_layer_1_t& layer = display->hwLayers[i];
+        if (layer.compositionType == HWC_FRAMEBUFFER_TARGET) {
+            continue;
+        }
+
+        bool compressed;
+        uint64_t bytes = getLayerBytes(layer, &compressed);
+        if (layer.compositionType == HWC_OVERLAY ||
+            layer.compositionType == HWC_CURSOR_OVERLAY) {
+            load.planeLayers++;
+            // a virtual display reads its inputs once per frame
+            if (disp == IDisplayDevice::DEVICE_VIRTUAL) {
+                load.glesBytes += bytes;
+            } else {
+                load.scanoutBytes += bytes;
+            }
+            continue;
+        }
+
+        // GLES reads the layer and writes its area of the target, reading
+        // that area back first unless the layer is opaque
+        load.glesLayers++;
+        uint32_t width = layer.displayFrame.right - layer.displayFrame.left;
+        uint32_t height = layer.displayFrame.bottom - layer.displayFrame.top;
+        uint64_t area = getFetchBytes(HAL_PIXEL_FORMAT_RGBA_8888, width, height,
+                                      targetCompressed);
+        load.glesBytes += bytes + area;
+        if (layer.blending != HWC_BLENDING_NONE) {
+            load.glesBytes += area;
+        }
+    }
+
+    // the target is only scanned out when something was composed to it
+    if (load.glesLayers && disp != IDisplayDevice::DEVICE_VIRTUAL) {
+        load.scanoutBytes += targetBytes;
+    }
+}
+
+void BandwidthEstimator::onCommit(size_t numDisplays, hwc_display_contents_1_t **displays)
+{
+    if (!mInitialized) {
+        return;
+    }
+
+    uint64_t scanoutRate = 0;
+    uint64_t glesBytes = 0;
+    for (size_t i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        DisplayLoad& load = mLoads[i];
+        estimate(i, i < numDisplays ? displays[i] : NULL, load);
+        scanoutRate += load.scanoutBytes * load.refresh;
+        glesBytes += load.glesBytes;
+    }
+    mScanoutRate = scanoutRate;
+    mFrames++;
+
+    // GLES composes once per commit, its rate comes from the commits of
+    // the last window
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (!mWindowStart) {
+        mWindowStart = now;
+    }
+    mWindowBytes += glesBytes;
+    nsecs_t elapsed = now - mWindowStart;
+    if (elapsed >= GLES_WINDOW) {
+        mGlesRate = mWindowBytes * 1000000000LL / elapsed;
+        mWindowStart = now;
+        mWindowBytes = 0;
+    }
+
+    if (getBandwidth() > mPeakRate) {
+        mPeakRate = getBandwidth();
+    }
+    traceCounters();
+}
+
+void BandwidthEstimator::traceCounters()
+{
+    int32_t scanout = (int32_t)(mScanoutRate >> 20);
+    int32_t gles = (int32_t)(mGlesRate >> 20);
+    int32_t total = scanout + gles;
+
+    if (total != mTracedTotal) {
+        atrace_int(ATRACE_TAG, "hwc_ddr_mbps", total);
+        mTracedTotal = total;
+    }
+    if (scanout != mTracedScanout) {
+        atrace_int(ATRACE_TAG, "hwc_ddr_scanout_mbps", scanout);
+        mTracedScanout = scanout;
+    }
+    if (gles != mTracedGles) {
+        atrace_int(ATRACE_TAG, "hwc_ddr_gles_mbps", gles);
+        mTracedGles = gles;
+    }
+}
+
+void BandwidthEstimator::dump(Dump& d)
+{
+    d.append("DDR bandwidth estimate: %llu MB/s (scanout %llu MB/s, GLES %llu MB/s), "
+             "peak %llu MB/s, %llu frames\n",
+             getBandwidth() >> 20, mScanoutRate >> 20, mGlesRate >> 20,
+             mPeakRate >> 20, mFrames);
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        const DisplayLoad& load = mLoads[i];
+        if (!load.planeLayers && !load.glesLayers) {
+            continue;
+        }
+        d.append("  display %d: %u plane layers, %u GLES layers, "
+                 "scanout %llu KB x %u Hz, GLES %llu KB per frame\n",
+                 i, load.planeLayers, load.glesLayers,
+                 load.scanoutBytes >> 10, load.refresh, load.glesBytes >> 10);
+    }
+}
+
+} // namespace intel
+} // namespace android
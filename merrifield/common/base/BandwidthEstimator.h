@@ -0,0 +1,104 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef BANDWIDTH_ESTIMATOR_H
+#define BANDWIDTH_ESTIMATOR_H
+
+#include <Dump.h>
+#include <hardware/hwcomposer.h>
+#include <utils/Timers.h>
+#include <IDisplayDevice.h>
+
+namespace android {
+namespace intel {
+
+class BufferManager;
+class Drm;
+
+// Estimated DDR traffic of the committed frames. Planes fetch their source
+// crop on every refresh; layers left to GLES are read once per composed
+// frame and written, and read back if blended, into the frame buffer
+// target, which a plane then scans out. The running total is traced as
+// the hwc_ddr_mbps counter, split in hwc_ddr_scanout_mbps and
+// hwc_ddr_gles_mbps.
+//
+// getFetchBytes() is the per layer cost the plane assignment and smart
+// composition work with, so these estimates and their choices agree.
+class BandwidthEstimator {
+public:
+    enum {
+        // assumed saving of render compressed buffers
+        COMPRESSION_RATIO = 2,
+    };
+
+public:
+    BandwidthEstimator();
+    ~BandwidthEstimator();
+
+public:
+    bool initialize(Drm *drm, BufferManager *bm);
+    void deinitialize();
+    // called after each commit with the displays just committed
+    void onCommit(size_t numDisplays, hwc_display_contents_1_t **displays);
+    // total estimate in bytes per second
+    uint64_t getBandwidth() const { return mScanoutRate + mGlesRate; }
+    void dump(Dump& d);
+
+    // bytes fetched to read width x height pixels of a buffer once
+    static uint64_t getFetchBytes(uint32_t format, uint32_t width,
+                                  uint32_t height, bool compressed);
+
+private:
+    struct DisplayLoad {
+        // per refresh, while the frame stays on screen
+        uint64_t scanoutBytes;
+        // per composed frame
+        uint64_t glesBytes;
+        uint32_t refresh;
+        uint32_t planeLayers;
+        uint32_t glesLayers;
+    };
+
+    void estimate(int disp, hwc_display_contents_1_t *display, DisplayLoad& load);
+    uint64_t getLayerBytes(const hwc_layer_1_t& layer, bool *compressed);
+    void traceCounters();
+
+private:
+    // GLES traffic is averaged over this window of commits
+    static const nsecs_t GLES_WINDOW = 1000000000LL;
+
+    bool mInitialized;
+    Drm *mDrm;
+    BufferManager *mBufferManager;
+    DisplayLoad mLoads[IDisplayDevice::DEVICE_COUNT];
+
+    // bytes per second
+    uint64_t mScanoutRate;
+    uint64_t mGlesRate;
+    uint64_t mPeakRate;
+    nsecs_t mWindowStart;
+    uint64_t mWindowBytes;
+
+    // last values traced, in MB/s
+    int32_t mTracedTotal;
+    int32_t mTracedScanout;
+    int32_t mTracedGles;
+    uint64_t mFrames;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* BANDWIDTH_ESTIMATOR_H */
@@ -0,0 +1,255 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <BufferManager.h>
+#include <MemoryAccounting.h>
+#include <BlitComposer.h>
+#include <hal_public.h>
+
+namespace android {
+namespace intel {
+
+volatile int32_t BlitComposer::sDisabled = -1;
+
+BlitComposer::BlitComposer(const char *name)
+    : mName(name),
+      mCurrent(0),
+      mActive(false),
+      mValid(false),
+      mSourceCount(0),
+      mCompositions(0),
+      mReuses(0),
+      mFailures(0)
+{
+    memset(mImages, 0, sizeof(mImages));
+    memset(mSources, 0, sizeof(mSources));
+}
+
+BlitComposer::~BlitComposer()
+{
+    clear();
+}
+
+bool BlitComposer::isEnabled()
+{
+    if (sDisabled < 0) {
+        char prop[PROPERTY_VALUE_MAX];
+        property_get("hwc.blit.compose", prop, "1");
+        android_atomic_release_store(atoi(prop) ? 0 : 1, &sDisabled);
+    }
+    return !sDisabled;
+}
+
+bool BlitComposer::isSupported(HwcLayer *hwcLayer, const hwc_rect_t& bounds)
+{
+    if (!isEnabled() || hwcLayer->isProtected() || hwcLayer->isCompressed() ||
+        !hwcLayer->getHandle()) {
+        return false;
+    }
+
+    hwc_layer_1_t *layer = hwcLayer->getLayer();
+    if ((layer->flags & HWC_SKIP_LAYER) || hwcLayer->getTransform() ||
+        layer->blending != HWC_BLENDING_NONE || layer->planeAlpha != 0xff) {
+        return false;
+    }
+
+    switch (hwcLayer->getFormat()) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+    case HAL_PIXEL_FORMAT_BGRX_8888:
+    case HAL_PIXEL_FORMAT_RGB_565:
+        break;
+    default:
+        return false;
+    }
+
+    // the whole buffer is copied, scaled to the display frame
+    const hwc_frect_t& crop = layer->sourceCropf;
+    if (crop.left != 0 || crop.top != 0 ||
+        (uint32_t)crop.right != hwcLayer->getBufferWidth() ||
+        (uint32_t)crop.bottom != hwcLayer->getBufferHeight()) {
+        return false;
+    }
+
+    const hwc_rect_t& frame = layer->displayFrame;
+    return frame.left >= bounds.left && frame.top >= bounds.top &&
+           frame.right <= bounds.right && frame.bottom <= bounds.bottom &&
+           frame.right > frame.left && frame.bottom > frame.top;
+}
+
+bool BlitComposer::isComposed(hwc_layer_1_t **layers, size_t count) const
+{
+    if (!mValid || count != mSourceCount) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const hwc_rect_t& frame = layers[i]->displayFrame;
+        if (layers[i]->handle != mSources[i].handle ||
+            memcmp(&frame, &mSources[i].frame, sizeof(frame))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BlitComposer::allocImage(Image& image, int width, int height, uint32_t format)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    image.handle = bm->allocGrallocBuffer(width, height, format,
+                                          GRALLOC_USAGE_HW_RENDER |
+                                          GRALLOC_USAGE_HW_COMPOSER);
+    if (!image.handle) {
+        ETRACE("failed to allocate %dx%d blit buffer", width, height);
+        return false;
+    }
+
+    DataBuffer *buffer = bm->lockDataBuffer(image.handle);
+    if (buffer) {
+        image.mapper = bm->map(*buffer);
+        bm->unlockDataBuffer(buffer);
+    }
+
+    if (!image.mapper) {
+        ETRACE("failed to map blit buffer");
+        bm->freeGrallocBuffer(image.handle);
+        memset(&image, 0, sizeof(image));
+        return false;
+    }
+
+    MemoryAccounting::add(MemoryAccounting::FRAME_BUFFER,
+                          image.mapper->getStride().rgb.stride * image.mapper->getHeight());
+    image.width = width;
+    image.height = height;
+    image.format = format;
+    return true;
+}
+
+void BlitComposer::freeImage(Image& image)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    if (image.mapper) {
+        MemoryAccounting::remove(MemoryAccounting::FRAME_BUFFER,
+            image.mapper->getStride().rgb.stride * image.mapper->getHeight());
+        bm->unmap(image.mapper);
+    }
+    if (image.handle) {
+        bm->freeGrallocBuffer(image.handle);
+    }
+    memset(&image, 0, sizeof(image));
+}
+
+void BlitComposer::clear()
+{
+    for (int i = 0; i < BLIT_BUFFER_COUNT; i++) {
+        freeImage(mImages[i]);
+    }
+    mCurrent = 0;
+    mActive = false;
+    mValid = false;
+    mSourceCount = 0;
+}
+
+buffer_handle_t BlitComposer::compose(hwc_layer_1_t **layers, size_t count,
+                                      const hwc_rect_t& bounds, uint32_t format,
+                                      bool changed, int *fenceFd)
+{
+    int width = bounds.right - bounds.left;
+    int height = bounds.bottom - bounds.top;
+    *fenceFd = -1;
+    if (!count || count > BLIT_LAYERS_MAX) {
+        return NULL;
+    }
+
+    Image& last = mImages[mCurrent];
+    if (!changed && isComposed(layers, count) && last.width == width &&
+        last.height == height && last.format == format) {
+        mReuses++;
+        mActive = true;
+        return last.handle;
+    }
+
+    // the oldest buffer is off screen by now
+    int next = (mCurrent + 1) % BLIT_BUFFER_COUNT;
+    Image& image = mImages[next];
+    if (image.handle && (image.width != width || image.height != height ||
+                         image.format != format)) {
+        freeImage(image);
+    }
+    if (!image.handle && !allocImage(image, width, height, format)) {
+        mFailures++;
+        return NULL;
+    }
+
+    // queued in order on the blitter, each copy waits for its source
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    BufferManager::BlitRequest requests[BLIT_LAYERS_MAX];
+    for (size_t i = 0; i < count; i++) {
+        const hwc_rect_t& frame = layers[i]->displayFrame;
+        BufferManager::BlitRequest& request = requests[i];
+        request.srcHandle = layers[i]->handle;
+        request.destHandle = image.handle;
+        request.destRect.x = frame.left - bounds.left;
+        request.destRect.y = frame.top - bounds.top;
+        request.destRect.w = frame.right - frame.left;
+        request.destRect.h = frame.bottom - frame.top;
+        // only scaled copies are filtered
+        const hwc_frect_t& crop = layers[i]->sourceCropf;
+        request.filter = (int)(crop.right - crop.left) != (int)request.destRect.w ||
+                         (int)(crop.bottom - crop.top) != (int)request.destRect.h;
+        request.acquireFenceFd = layers[i]->acquireFenceFd;
+    }
+
+    int batchFenceFd = bm->blitBatch(requests, count);
+    if (batchFenceFd < 0) {
+        ETRACE("failed to blit %zu layers, disabling blit composition", count);
+        android_atomic_release_store(1, &sDisabled);
+        mValid = false;
+        mActive = false;
+        mFailures++;
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        mSources[i].handle = layers[i]->handle;
+        mSources[i].frame = layers[i]->displayFrame;
+    }
+    mSourceCount = count;
+    mCurrent = next;
+    mValid = true;
+    mActive = true;
+    mCompositions++;
+    *fenceFd = batchFenceFd;
+    return image.handle;
+}
+
+void BlitComposer::dump(Dump& d)
+{
+    d.append("%s: %s, compositions %u, reuses %u, failures %u\n",
+             mName, !isEnabled() ? "disabled" : (mActive ? "active" : "idle"),
+             mCompositions, mReuses, mFailures);
+}
+
+} // namespace intel
+} // namespace android
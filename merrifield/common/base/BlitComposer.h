@@ -0,0 +1,118 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef BLIT_COMPOSER_H
+#define BLIT_COMPOSER_H
+
+#include <hardware/hwcomposer.h>
+#include <Dump.h>
+#include <BufferMapper.h>
+#include <HwcLayer.h>
+
+namespace android {
+namespace intel {
+
+// Composes layers with the 2D blitter instead of GLES, into a buffer of
+// its own that a plane scans out: the layers left over by the plane
+// assignment for the frame buffer target plane, or a static group of
+// layers flattened for the plane of the bottom one. The blitter copies
+// whole buffers with no blending, so only opaque RGB layers qualify and
+// the bottom one must cover the buffer. The last composition is kept
+// while no layer changes.
+class BlitComposer {
+public:
+    // name is used by dump()
+    BlitComposer(const char *name = "Blit composition");
+    ~BlitComposer();
+
+public:
+    // blit composition is allowed and has not failed, read once from
+    // hwc.blit.compose
+    static bool isEnabled();
+    // the layer may be copied by the blitter into a buffer covering
+    // bounds, in display coordinates
+    static bool isSupported(HwcLayer *hwcLayer, const hwc_rect_t& bounds);
+
+    // the last frame was composed here, the frame buffer target of
+    // SurfaceFlinger doesn't show the layers
+    bool isActive() const { return mActive; }
+    void deactivate() { mActive = false; }
+    // the next compose() blits again, the sources changed in place
+    void invalidate() { mActive = false; mValid = false; }
+
+    // copies layers, bottom first, into the next buffer covering bounds
+    // and returns it, NULL on failure. *fenceFd signals once the buffer is
+    // written, -1 if it already is. If changed is not set and the same
+    // buffers are at the same place, the last buffer is returned as is.
+    buffer_handle_t compose(hwc_layer_1_t **layers, size_t count,
+                            const hwc_rect_t& bounds, uint32_t format,
+                            bool changed, int *fenceFd);
+    // frees the buffers
+    void clear();
+
+    void dump(Dump& d);
+
+public:
+    enum {
+        // status bar, application and navigation bar, and a dialog
+        BLIT_LAYERS_MAX = 4,
+    };
+
+private:
+    enum {
+        // one buffer on screen, one waiting for the flip, one being written
+        BLIT_BUFFER_COUNT = 3,
+    };
+
+    struct Image {
+        buffer_handle_t handle;
+        BufferMapper *mapper;
+        int width;
+        int height;
+        uint32_t format;
+    };
+
+    // what the last composition was made of
+    struct Source {
+        buffer_handle_t handle;
+        hwc_rect_t frame;
+    };
+
+    bool isComposed(hwc_layer_1_t **layers, size_t count) const;
+    bool allocImage(Image& image, int width, int height, uint32_t format);
+    void freeImage(Image& image);
+
+private:
+    static volatile int32_t sDisabled;
+
+    const char *mName;
+    Image mImages[BLIT_BUFFER_COUNT];
+    int mCurrent;
+    bool mActive;
+    // the buffer of mCurrent holds a composition
+    bool mValid;
+    Source mSources[BLIT_LAYERS_MAX];
+    size_t mSourceCount;
+
+    // statistics
+    uint32_t mCompositions;
+    uint32_t mReuses;
+    uint32_t mFailures;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* BLIT_COMPOSER_H */
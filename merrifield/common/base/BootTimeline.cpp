@@ -0,0 +1,122 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <utils/threads.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <HwcTrace.h>
+#include <BootTimeline.h>
+
+namespace android {
+namespace intel {
+
+static Mutex sLock;
+BootTimeline::Step BootTimeline::sSteps[MAX_STEPS];
+int BootTimeline::sCount = 0;
+volatile int32_t BootTimeline::sComplete = 0;
+
+void BootTimeline::record(const char *step)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < sCount; i++) {
+        if (!strcmp(sSteps[i].name, step)) {
+            return;
+        }
+    }
+    if (sCount >= MAX_STEPS) {
+        return;
+    }
+
+    Step& s = sSteps[sCount++];
+    strncpy(s.name, step, NAME_SIZE - 1);
+    s.name[NAME_SIZE - 1] = '\0';
+    s.time = now;
+}
+
+void BootTimeline::mark(const char *step)
+{
+    if (android_atomic_acquire_load(&sComplete)) {
+        return;
+    }
+
+    Mutex::Autolock _l(sLock);
+    if (!sComplete) {
+        record(step);
+    }
+}
+
+void BootTimeline::complete(const char *step)
+{
+    if (android_atomic_acquire_load(&sComplete)) {
+        return;
+    }
+
+    Mutex::Autolock _l(sLock);
+    if (sComplete) {
+        return;
+    }
+    record(step);
+    android_atomic_release_store(1, &sComplete);
+
+    ITRACE("%s after %lld ms", step,
+           ns2ms(sSteps[sCount - 1].time - sSteps[0].time));
+
+    char path[PROPERTY_VALUE_MAX];
+    if (property_get("hwc.boot.timeline", path, NULL) > 0) {
+        exportTo(path);
+    }
+}
+
+void BootTimeline::exportTo(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        WTRACE("failed to open %s", path);
+        return;
+    }
+
+    fprintf(fp, "step,offset_us,step_us\n");
+    for (int i = 0; i < sCount; i++) {
+        fprintf(fp, "%s,%lld,%lld\n", sSteps[i].name,
+                ns2us(sSteps[i].time - sSteps[0].time),
+                i ? ns2us(sSteps[i].time - sSteps[i - 1].time) : 0LL);
+    }
+    fclose(fp);
+}
+
+void BootTimeline::dump(Dump& d)
+{
+    Mutex::Autolock _l(sLock);
+    if (!sCount) {
+        return;
+    }
+
+    d.append("Boot timeline (%s):\n", sComplete ? "complete" : "in progress");
+    d.append("  STEP                            |   OFFSET ms |     STEP ms \n");
+    d.append("----------------------------------+-------------+-------------\n");
+    for (int i = 0; i < sCount; i++) {
+        nsecs_t offset = sSteps[i].time - sSteps[0].time;
+        nsecs_t step = i ? sSteps[i].time - sSteps[i - 1].time : 0;
+        d.append("  %-31s | %7lld.%03lld | %7lld.%03lld \n",
+                 sSteps[i].name,
+                 ns2ms(offset), ns2us(offset) % 1000,
+                 ns2ms(step), ns2us(step) % 1000);
+    }
+}
+
+} // namespace intel
+} // namespace android
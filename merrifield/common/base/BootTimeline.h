@@ -0,0 +1,58 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <Dump.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+// Monotonic timestamps of the HWC bring-up, from the module open to the
+// first post. Each mark ends a step, a name is only recorded once. Marks
+// after the first post are ignored, so marking costs nothing later on.
+// With hwc.boot.timeline set to a path the timeline is written there as
+// csv once it is complete.
+class BootTimeline {
+public:
+    static void mark(const char *step);
+    // the last mark, ends the timeline
+    static void complete(const char *step);
+    static void dump(Dump& d);
+
+private:
+    enum {
+        MAX_STEPS = 48,
+        NAME_SIZE = 32,
+    };
+
+    struct Step {
+        char name[NAME_SIZE];
+        nsecs_t time;
+    };
+
+    static void record(const char *step);
+    static void exportTo(const char *path);
+    static Step sSteps[MAX_STEPS];
+    static int sCount;
+    static volatile int32_t sComplete;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* BOOT_TIMELINE_H */
@@ -0,0 +1,141 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <HwcTrace.h>
+#include <FrameTiming.h>
+#include <VsyncManager.h>
+#include <CommitScheduler.h>
+#include <cutils/properties.h>
+
+namespace android {
+namespace intel {
+
+CommitScheduler::CommitScheduler()
+    : mInitialized(false),
+      mVsyncManager(0),
+      mTiming(0),
+      mMargin(DEFAULT_MARGIN),
+      mScheduled(0),
+      mLate(0),
+      mUnpredicted(0),
+      mTotalWait(0),
+      mLastCost(0)
+{
+    CTRACE();
+}
+
+CommitScheduler::~CommitScheduler()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool CommitScheduler::initialize(VsyncManager *vsyncManager, FrameTiming *timing)
+{
+    CTRACE();
+
+    if (!vsyncManager || !timing) {
+        ETRACE("invalid parameters");
+        return false;
+    }
+
+    // margin in micro seconds
+    char prop[PROPERTY_VALUE_MAX];
+    mMargin = DEFAULT_MARGIN;
+    if (property_get("hwc.commit.margin", prop, NULL) > 0) {
+        mMargin = (nsecs_t)atoi(prop) * 1000;
+        if (mMargin < 0) {
+            mMargin = 0;
+        }
+    }
+
+    mVsyncManager = vsyncManager;
+    mTiming = timing;
+    mScheduled = 0;
+    mLate = 0;
+    mUnpredicted = 0;
+    mTotalWait = 0;
+    mLastCost = 0;
+    mInitialized = true;
+    return true;
+}
+
+void CommitScheduler::deinitialize()
+{
+    mVsyncManager = 0;
+    mTiming = 0;
+    mInitialized = false;
+}
+
+void CommitScheduler::waitForDeadline()
+{
+    if (!mInitialized) {
+        return;
+    }
+
+    nsecs_t cost = mTiming->getPercentile(FrameTiming::DISPLAY_ALL,
+                                          FrameTiming::STAGE_COMMIT_END,
+                                          COST_PERCENTILE);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t vblank = mVsyncManager->getNextVsyncTime(now);
+
+    if (!vblank || vblank - now > MAX_WAIT) {
+        Mutex::Autolock _l(mLock);
+        mUnpredicted++;
+        return;
+    }
+
+    nsecs_t deadline = vblank - mMargin - cost;
+    if (deadline <= now) {
+        // too late to wait, posting right away may still make it
+        Mutex::Autolock _l(mLock);
+        mLate++;
+        mLastCost = cost;
+        return;
+    }
+
+    ATRACE("wait %lld us for vblank at %lld", (deadline - now) / 1000, vblank);
+    struct timespec spec;
+    spec.tv_sec  = deadline / 1000000000;
+    spec.tv_nsec = deadline % 1000000000;
+
+    int err;
+    do {
+        err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+    } while (err == EINTR);
+
+    Mutex::Autolock _l(mLock);
+    mScheduled++;
+    mTotalWait += deadline - now;
+    mLastCost = cost;
+}
+
+void CommitScheduler::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("Commit scheduler: margin %lld us, cost %lld us, scheduled %u, "
+             "late %u, unpredicted %u, avg wait %lld us\n",
+             mMargin / 1000,
+             mLastCost / 1000,
+             mScheduled,
+             mLate,
+             mUnpredicted,
+             mScheduled ? mTotalWait / mScheduled / 1000 : 0);
+}
+
+} // namespace intel
+} // namespace android
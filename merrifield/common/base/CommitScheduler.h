@@ -0,0 +1,72 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef COMMIT_SCHEDULER_H
+#define COMMIT_SCHEDULER_H
+
+#include <Dump.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+class FrameTiming;
+class VsyncManager;
+
+// Holds the post of a frame back until shortly before the predicted
+// vblank, so that cursor updates arriving meanwhile still make the frame.
+// The wait leaves the configured margin plus the usual cost of the post.
+class CommitScheduler {
+public:
+    CommitScheduler();
+    ~CommitScheduler();
+
+public:
+    bool initialize(VsyncManager *vsyncManager, FrameTiming *timing);
+    void deinitialize();
+    // blocks until the post of the frame should start
+    void waitForDeadline();
+    void dump(Dump& d);
+
+private:
+    enum {
+        // percentile of the post duration used as its cost
+        COST_PERCENTILE = 90,
+    };
+    // default margin kept before the vblank
+    static const nsecs_t DEFAULT_MARGIN = 2000000;
+    // never wait longer, a prediction that far out is not trusted
+    static const nsecs_t MAX_WAIT = 20000000;
+
+private:
+    bool mInitialized;
+    VsyncManager *mVsyncManager;
+    FrameTiming *mTiming;
+    nsecs_t mMargin;
+    Mutex mLock;
+
+    // statistics
+    uint32_t mScheduled;
+    uint32_t mLate;
+    uint32_t mUnpredicted;
+    nsecs_t mTotalWait;
+    nsecs_t mLastCost;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* COMMIT_SCHEDULER_H */
@@ -0,0 +1,155 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <HwcLayer.h>
+#include <CompositionLog.h>
+
+namespace android {
+namespace intel {
+
+static const char* sReasonNames[CompositionLog::REASON_COUNT] = {
+    "-",
+    "forced FB",
+    "skip layer",
+    "unprotected output",
+    "no handle",
+    "not composer",
+    "transform",
+    "rotation avoided",
+    "format",
+    "size",
+    "blending",
+    "scaling",
+    "overlay disallowed",
+    "not cursor",
+    "cursor z order",
+};
+
+static const char* sPlaneNames[DisplayPlane::PLANE_MAX] = {
+    "sprite",
+    "overlay",
+    "primary",
+    "cursor",
+};
+
+static const char* planeName(int type)
+{
+    if (type < 0 || type >= DisplayPlane::PLANE_MAX) {
+        return "none";
+    }
+    return sPlaneNames[type];
+}
+
+static const char* typeName(int type)
+{
+    switch (type) {
+    case HwcLayer::LAYER_FB:
+        return "FB";
+    case HwcLayer::LAYER_FORCE_FB:
+        return "FORCE_FB";
+    case HwcLayer::LAYER_OVERLAY:
+        return "OVERLAY";
+    case HwcLayer::LAYER_SKIPPED:
+        return "SKIPPED";
+    case HwcLayer::LAYER_FRAMEBUFFER_TARGET:
+        return "FB_TARGET";
+    case HwcLayer::LAYER_SIDEBAND:
+        return "SIDEBAND";
+    case HwcLayer::LAYER_CURSOR_OVERLAY:
+        return "CURSOR";
+    default:
+        return "unknown";
+    }
+}
+
+CompositionLog::CompositionLog()
+    : mNext(0),
+      mCount(0),
+      mTotal(0)
+{
+    memset(mRecords, 0, sizeof(mRecords));
+}
+
+CompositionLog::~CompositionLog()
+{
+}
+
+const char* CompositionLog::reasonName(int reason)
+{
+    if (reason < 0 || reason >= REASON_COUNT) {
+        return "unknown";
+    }
+    return sReasonNames[reason];
+}
+
+CompositionLog::Record& CompositionLog::next(uint32_t flags, uint32_t layerCount)
+{
+    Record& record = mRecords[mNext];
+    mNext = (mNext + 1) % RING_SIZE;
+    if (mCount < RING_SIZE) {
+        mCount++;
+    }
+    mTotal++;
+
+    memset(&record, 0, sizeof(record));
+    record.time = systemTime(SYSTEM_TIME_MONOTONIC);
+    record.flags = flags;
+    record.layerCount = layerCount;
+    return record;
+}
+
+void CompositionLog::clear()
+{
+    mNext = 0;
+    mCount = 0;
+}
+
+void CompositionLog::dump(Dump& d)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    d.append("Composition decisions: %u of %u records\n", mCount, mTotal);
+    if (!mCount) {
+        return;
+    }
+
+    d.append(" LAYER |   TYPE    |  PLANE  | CANDIDATE | FORMAT |   KB  | "
+             "REJECTED BY SPRITE / OVERLAY / CURSOR\n");
+    // oldest first
+    for (uint32_t i = 0; i < mCount; i++) {
+        const Record& record =
+                mRecords[(mNext + RING_SIZE - mCount + i) % RING_SIZE];
+        d.append("  %lld ms ago, %u layers%s%s\n",
+                 ns2ms(now - record.time), record.layerCount,
+                 (record.flags & RECORD_MERGED) ? ", merged" : "",
+                 (record.flags & RECORD_FALLBACK) ? ", fallback" : "");
+        uint32_t count = record.layerCount < MAX_LAYERS ?
+                record.layerCount : MAX_LAYERS;
+        for (uint32_t j = 0; j < count; j++) {
+            const Layer& layer = record.layers[j];
+            d.append("  %4u | %-9s | %-7s | %-9s | %#6x | %5u | %s / %s / %s\n",
+                     j, typeName(layer.type), planeName(layer.plane),
+                     planeName(layer.candidate), layer.format,
+                     layer.fetchKBytes,
+                     reasonName(layer.rejects[DisplayPlane::PLANE_SPRITE]),
+                     reasonName(layer.rejects[DisplayPlane::PLANE_OVERLAY]),
+                     reasonName(layer.rejects[DisplayPlane::PLANE_CURSOR]));
+        }
+    }
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,111 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef COMPOSITION_LOG_H
+#define COMPOSITION_LOG_H
+
+#include <Dump.h>
+#include <utils/Timers.h>
+#include <DisplayPlane.h>
+
+namespace android {
+namespace intel {
+
+// Why layers were or were not put on planes, kept in release builds. A
+// record is made whenever a layer list assigns its planes, on geometry
+// changes and on fallbacks to GLES: for each layer the reason each plane
+// type rejected it, the plane type it was a candidate for and where it
+// ended up. The last RING_SIZE records are kept and shown by dumpsys.
+// Guarded by the lock of the owning device.
+class CompositionLog {
+public:
+    enum {
+        // accepted, or not checked as a plane type was found before
+        REASON_NONE = 0,
+        REASON_FORCED_FB,
+        REASON_SKIP_LAYER,
+        REASON_UNPROTECTED_OUTPUT,
+        REASON_NO_HANDLE,
+        REASON_NOT_COMPOSER,
+        REASON_TRANSFORM,
+        REASON_ROTATION_AVOIDED,
+        REASON_FORMAT,
+        REASON_SIZE,
+        REASON_BLENDING,
+        REASON_SCALING,
+        REASON_OVERLAY_DISALLOWED,
+        REASON_NOT_CURSOR,
+        REASON_CURSOR_ZORDER,
+        REASON_COUNT,
+    };
+
+    enum {
+        // geometry change that kept the planes of the unchanged layers,
+        // no plane checks are recorded
+        RECORD_MERGED = 1 << 0,
+        // layers were moved to GLES after their planes were assigned
+        RECORD_FALLBACK = 1 << 1,
+    };
+
+    enum {
+        RING_SIZE = 32,
+        // layers recorded per frame, the others are only counted
+        MAX_LAYERS = 16,
+    };
+
+    struct Layer {
+        uint32_t format;
+        // fetched per refresh when on a plane, in KB
+        uint32_t fetchKBytes;
+        uint8_t rejects[DisplayPlane::PLANE_MAX];
+        // plane types, -1 for none
+        int8_t candidate;
+        int8_t plane;
+        // HwcLayer type
+        uint8_t type;
+        uint8_t reserved;
+    };
+
+    struct Record {
+        nsecs_t time;
+        uint32_t flags;
+        uint32_t layerCount;
+        Layer layers[MAX_LAYERS];
+    };
+
+public:
+    CompositionLog();
+    ~CompositionLog();
+
+public:
+    // the record to fill, overwriting the oldest one
+    Record& next(uint32_t flags, uint32_t layerCount);
+    void clear();
+    void dump(Dump& d);
+
+    static const char* reasonName(int reason);
+
+private:
+    Record mRecords[RING_SIZE];
+    uint32_t mNext;
+    uint32_t mCount;
+    // all records made
+    uint32_t mTotal;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* COMPOSITION_LOG_H */
@@ -0,0 +1,166 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <HwcTrace.h>
+#include <cutils/properties.h>
+#include <ContentStats.h>
+
+namespace android {
+namespace intel {
+
+ContentStats::ContentStats()
+{
+    reset(0);
+}
+
+ContentStats::~ContentStats()
+{
+}
+
+void ContentStats::reset(int disp)
+{
+    mDisplay = disp;
+    memset(&mCurrent, 0, sizeof(mCurrent));
+    memset(&mLast, 0, sizeof(mLast));
+    mTotalFrames = 0;
+    memset(mHandles, 0, sizeof(mHandles));
+}
+
+uint32_t ContentStats::percent(uint64_t part, uint64_t whole)
+{
+    if (!whole) {
+        return 0;
+    }
+    return (uint32_t)((part * 100 + whole / 2) / whole);
+}
+
+void ContentStats::addFrame(hwc_display_contents_1_t *display, bool video,
+                            bool protectedContent)
+{
+    // nothing to classify without layers besides the frame buffer target
+    if (!display || display->numHwLayers <= 1) {
+        return;
+    }
+
+    int count = (int)display->numHwLayers - 1;
+    uint32_t glesLayers = 0;
+    uint32_t planeLayers = 0;
+    uint32_t staticLayers = 0;
+    for (int i = 0; i < count; i++) {
+        hwc_layer_1_t& layer = display->hwLayers[i];
+        uint64_t w = layer.displayFrame.right - layer.displayFrame.left;
+        uint64_t h = layer.displayFrame.bottom - layer.displayFrame.top;
+        if (layer.displayFrame.right < layer.displayFrame.left ||
+            layer.displayFrame.bottom < layer.displayFrame.top) {
+            w = h = 0;
+        }
+
+        switch (layer.compositionType) {
+        case HWC_FRAMEBUFFER:
+            glesLayers++;
+            mCurrent.glesPixels += w * h;
+            break;
+        case HWC_OVERLAY:
+        case HWC_SIDEBAND:
+        case HWC_CURSOR_OVERLAY:
+            planeLayers++;
+            mCurrent.overlayPixels += w * h;
+            break;
+        default:
+            break;
+        }
+
+        if (i < TRACKED_LAYERS) {
+            // the handle of an index after a geometry change may be
+            // another layer's, that only costs accuracy
+            if (layer.handle && layer.handle == mHandles[i]) {
+                staticLayers++;
+            }
+            mHandles[i] = layer.handle;
+        }
+    }
+
+    mCurrent.frames++;
+    if (!planeLayers) {
+        mCurrent.glesFrames++;
+    } else if (glesLayers) {
+        mCurrent.mixedFrames++;
+    } else {
+        mCurrent.overlayFrames++;
+    }
+    if (video) {
+        mCurrent.videoFrames++;
+    }
+    if (protectedContent) {
+        mCurrent.protectedFrames++;
+    }
+    mCurrent.layers += count;
+    mCurrent.staticLayers += staticLayers;
+    mTotalFrames++;
+
+    if (mCurrent.frames >= WINDOW_FRAMES) {
+        mLast = mCurrent;
+        memset(&mCurrent, 0, sizeof(mCurrent));
+        publish();
+    }
+}
+
+void ContentStats::publish()
+{
+    const Window& w = mLast;
+    char name[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    snprintf(name, sizeof(name), "hwc.stats.disp%d", mDisplay);
+    snprintf(value, sizeof(value),
+             "v1 frames=%u gles=%u mixed=%u overlay=%u ovpix=%u layers=%u static=%u video=%u",
+             w.frames,
+             percent(w.glesFrames, w.frames),
+             percent(w.mixedFrames, w.frames),
+             percent(w.overlayFrames, w.frames),
+             percent(w.overlayPixels, w.overlayPixels + w.glesPixels),
+             w.frames ? (w.layers * 10 + w.frames / 2) / w.frames : 0,
+             percent(w.staticLayers, w.layers),
+             percent(w.videoFrames, w.frames));
+    if (property_set(name, value) != 0) {
+        VTRACE("failed to publish %s", name);
+    }
+}
+
+void ContentStats::dump(Dump& d)
+{
+    if (!mTotalFrames) {
+        return;
+    }
+
+    const Window& w = mLast.frames ? mLast : mCurrent;
+    uint32_t layers = w.frames ? (w.layers * 10 + w.frames / 2) / w.frames : 0;
+    d.append("  disp %d: %u frames (%llu total), gles %u%%, mixed %u%%, overlay %u%%, "
+             "overlay pixels %u%%\n",
+             mDisplay, w.frames, mTotalFrames,
+             percent(w.glesFrames, w.frames),
+             percent(w.mixedFrames, w.frames),
+             percent(w.overlayFrames, w.frames),
+             percent(w.overlayPixels, w.overlayPixels + w.glesPixels));
+    d.append("          layers %u.%u, static %u%%, video %u%%, protected %u%%\n",
+             layers / 10, layers % 10,
+             percent(w.staticLayers, w.layers),
+             percent(w.videoFrames, w.frames),
+             percent(w.protectedFrames, w.frames));
+}
+
+} // namespace intel
+} // namespace android
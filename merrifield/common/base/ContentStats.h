@@ -0,0 +1,83 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef CONTENT_STATS_H
+#define CONTENT_STATS_H
+
+#include <Dump.h>
+#include <hardware/hwcomposer.h>
+
+namespace android {
+namespace intel {
+
+// Rolling composition statistics of one display, over windows of frames.
+// At the end of each window the result is dumped and published as
+// hwc.stats.disp<N>, a "v1" followed by key=value pairs:
+//   frames   frames in the window
+//   gles     % of frames composed by GLES only
+//   mixed    % of frames split between GLES and planes
+//   overlay  % of frames on planes only
+//   ovpix    % of layer pixels scanned out by planes
+//   layers   average layer count, in tenths
+//   static   % of layers whose buffer didn't change from the last frame
+//   video    % of frames while a video session is active
+// New keys are only ever appended, existing ones keep their meaning.
+class ContentStats {
+public:
+    ContentStats();
+    ~ContentStats();
+
+public:
+    void reset(int disp);
+    void addFrame(hwc_display_contents_1_t *display, bool video,
+                  bool protectedContent);
+    void dump(Dump& d);
+
+private:
+    enum {
+        WINDOW_FRAMES = 300,
+        // layers of which the buffer is compared with the last frame
+        TRACKED_LAYERS = 32,
+    };
+
+    struct Window {
+        uint32_t frames;
+        uint32_t glesFrames;
+        uint32_t mixedFrames;
+        uint32_t overlayFrames;
+        uint32_t videoFrames;
+        uint32_t protectedFrames;
+        uint64_t overlayPixels;
+        uint64_t glesPixels;
+        uint32_t layers;
+        uint32_t staticLayers;
+    };
+
+    void publish();
+    static uint32_t percent(uint64_t part, uint64_t whole);
+
+private:
+    int mDisplay;
+    Window mCurrent;
+    // the last complete window
+    Window mLast;
+    uint64_t mTotalFrames;
+    buffer_handle_t mHandles[TRACKED_LAYERS];
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* CONTENT_STATS_H */
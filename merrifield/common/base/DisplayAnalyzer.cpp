@@ -14,6 +14,7 @@
 // limitations under the License.
 */
 
+#include <string.h>
 #include <HwcTrace.h>
 #include <IDisplayDevice.h>
 #include <DisplayQuery.h>
@@ -25,6 +26,7 @@
 #include <GraphicBuffer.h>
 #include <ExternalDevice.h>
 #include <VirtualDevice.h>
+#include <PrimaryDevice.h>
 
 namespace android {
 namespace intel {
@@ -37,13 +39,24 @@ DisplayAnalyzer::DisplayAnalyzer()
       mBlankDevice(false),
       mOverlayAllowed(true),
       mActiveInputState(true),
+      mIdleRefreshWanted(false),
+      mIdleRefresh(false),
       mIgnoreVideoSkipFlag(false),
       mProtectedVideoSession(false),
       mCachedNumDisplays(0),
       mCachedDisplays(0),
+      mVideoGeneration(0),
+      mGeometryGeneration(0),
+      mContentRateEnabled(true),
+      mPayloadManager(NULL),
+      mRotationPrewarm(ROTATION_PREWARM_LIKELY),
+      mRotationWarm(false),
+      mLastIdleCheck(0),
+      mDpmsLock(),
+      mDpmsTimer(-1),
+      mEventRing(),
       mPendingEvents(),
-      mEventMutex(),
-      mEventHandledCondition()
+      mDroppedEvents(0)
 {
 }
 
@@ -63,12 +76,43 @@ bool DisplayAnalyzer::initialize()
     mBlankDevice = false;
     mOverlayAllowed = true;
     mActiveInputState = true;
+    mIdleRefreshWanted = false;
+    mIdleRefresh = false;
     mIgnoreVideoSkipFlag = false;
     mProtectedVideoSession = false;
     mCachedNumDisplays = 0;
     mCachedDisplays = 0;
+    memset(&mVideoExtAnalysis, 0, sizeof(mVideoExtAnalysis));
+    mVideoGeneration = 0;
+    mGeometryGeneration = 0;
+    mEventRing.clear();
     mPendingEvents.clear();
+    mDroppedEvents = 0;
     mVideoStateMap.clear();
+
+    // HDMI follows the measured video rate unless told not to
+    if (property_get("hwc.video.adaptive_refresh", prop, "1") > 0) {
+        mContentRateEnabled = atoi(prop) ? true : false;
+    }
+    if (mContentRateEnabled) {
+        mPayloadManager = Hwcomposer::getInstance().getPlatFactory()->createVideoPayloadManager();
+        if (!mPayloadManager) {
+            WTRACE("no payload manager, content rate is not measured");
+            mContentRateEnabled = false;
+        }
+    }
+    memset(&mContentRate, 0, sizeof(mContentRate));
+
+    mRotationPrewarm = ROTATION_PREWARM_LIKELY;
+    if (property_get("hwc.video.rotation.prewarm", prop, NULL) > 0) {
+        mRotationPrewarm = atoi(prop);
+    }
+    mRotationWarm = false;
+    mLastIdleCheck = 0;
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        mStats[i].reset(i);
+    }
+
     mInitialized = true;
 
     return true;
@@ -76,8 +120,14 @@ bool DisplayAnalyzer::initialize()
 
 void DisplayAnalyzer::deinitialize()
 {
+    cancelDpmsOff();
+    mEventRing.clear();
     mPendingEvents.clear();
     mVideoStateMap.clear();
+    if (mPayloadManager) {
+        delete mPayloadManager;
+        mPayloadManager = NULL;
+    }
     mInitialized = false;
 }
 
@@ -90,10 +140,39 @@ void DisplayAnalyzer::analyzeContents(
 
     handlePendingEvents();
 
+    // an idle exit and entry handled together don't switch the panel
+    if (mIdleRefreshWanted != mIdleRefresh) {
+        mIdleRefresh = mIdleRefreshWanted;
+        setIdleRefresh(mIdleRefresh);
+    }
+
+    // idle rotation contexts are released from the prepare thread, which
+    // is the one using them
+    if (mRotationWarm || mVideoStateMap.size()) {
+        mRotationWarm = Hwcomposer::getInstance().getPlaneManager()->
+            releaseIdleRotation(systemTime(), mVideoStateMap.size() != 0);
+    }
+
+    // and so are the back buffers of overlays no display uses any more,
+    // which lets the overlay and VSP power down
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (now - mLastIdleCheck >= IDLE_CHECK_INTERVAL) {
+        Hwcomposer::getInstance().getPlaneManager()->updatePowerState(now);
+        mLastIdleCheck = now;
+    }
+
+    if (isVideoStarting()) {
+        premapVideoBuffers();
+    }
+
     if (mVideoExtModeEnabled) {
         handleVideoExtMode();
     }
 
+    if (mContentRateEnabled) {
+        updateContentRate();
+    }
+
     if (mBlankDevice) {
         // this will make sure device is blanked after geometry changes.
         // blank event is only processed once
@@ -126,7 +205,8 @@ void DisplayAnalyzer::handleVideoExtMode()
 
 void DisplayAnalyzer::checkVideoExtMode()
 {
-    if (mVideoStateMap.size() != 1) {
+    if (mVideoStateMap.size() == 0 ||
+        mVideoStateMap.size() > VIDEO_SESSION_MAX) {
         mVideoExtModeEligible = false;
         return;
     }
@@ -136,7 +216,9 @@ void DisplayAnalyzer::checkVideoExtMode()
     ExternalDevice *eDev = static_cast<ExternalDevice *>(hwc->getDisplayDevice(IDisplayDevice::DEVICE_EXTERNAL));
     VirtualDevice  *vDev = static_cast<VirtualDevice  *>(hwc->getDisplayDevice(IDisplayDevice::DEVICE_VIRTUAL));
 
-    if ((!eDev || !eDev->isConnected()) && (!vDev || !vDev->isFrameServerActive())) {
+    bool extConnected = eDev && eDev->isConnected();
+    bool frameServerActive = vDev && vDev->isFrameServerActive();
+    if (!extConnected && !frameServerActive) {
         mVideoExtModeEligible = false;
         return;
     }
@@ -161,71 +243,236 @@ void DisplayAnalyzer::checkVideoExtMode()
         return;
     }
 
-    // video state update event may come later than geometry change event.
-    // in that case, video extended mode is not detected properly.
-#if 0
-    if (geometryChanged == false) {
+    // video state update event may come later than geometry change event,
+    // the video generation makes sure the layers are scanned again then
+    if (geometryChanged) {
+        mGeometryGeneration++;
+    }
+    if (isVideoExtAnalysisValid(extConnected, frameServerActive, activeDisplays)) {
         // use previous analysis result
+        mVideoExtModeEligible = mVideoExtAnalysis.eligible;
         return;
     }
-#endif
-    // reset eligibility of video extended mode
-    mVideoExtModeEligible = false;
 
-    // check if there is video layer in the primary device
-    content = mCachedDisplays[0];
-    if (content == NULL) {
-        return;
+    VideoExtAnalysis& analysis = mVideoExtAnalysis;
+    analysis.valid = true;
+    analysis.videoGeneration = mVideoGeneration;
+    analysis.geometryGeneration = mGeometryGeneration;
+    analysis.activeDisplays = activeDisplays;
+    analysis.extConnected = extConnected;
+    analysis.frameServerActive = frameServerActive;
+    analysis.eligible = scanVideoExtMode(analysis);
+    mVideoExtModeEligible = analysis.eligible;
+}
+
+bool DisplayAnalyzer::isVideoExtAnalysisValid(bool extConnected,
+                                              bool frameServerActive,
+                                              int activeDisplays)
+{
+    const VideoExtAnalysis& analysis = mVideoExtAnalysis;
+    if (!analysis.valid ||
+        analysis.videoGeneration != mVideoGeneration ||
+        analysis.geometryGeneration != mGeometryGeneration ||
+        analysis.activeDisplays != activeDisplays ||
+        analysis.extConnected != extConnected ||
+        analysis.frameServerActive != frameServerActive) {
+        return false;
     }
 
-    buffer_handle_t videoHandle = 0;
-    bool videoLayerExist = false;
-    bool videoFullScreenOnPrimary = false;
-    bool isVideoLayerSkipped = false;
+    // video buffers are queued without a geometry change, each video must
+    // still be the same buffer on the primary and its secondary display
+    hwc_display_contents_1_t *primary = mCachedDisplays[0];
+    for (int i = 0; i < analysis.routeCount; i++) {
+        const VideoExtAnalysis::Route& route = analysis.routes[i];
+        if (route.display < 0) {
+            // the secondary display may pick the video up a frame later
+            return false;
+        }
+        if (route.display >= (int)mCachedNumDisplays) {
+            return false;
+        }
+        hwc_display_contents_1_t *secondary = mCachedDisplays[route.display];
+        if (!primary || !secondary ||
+            route.primaryIndex >= (int)primary->numHwLayers - 1 ||
+            route.index >= (int)secondary->numHwLayers - 1) {
+            return false;
+        }
+        if (primary->hwLayers[route.primaryIndex].handle !=
+            secondary->hwLayers[route.index].handle) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DisplayAnalyzer::scanVideoExtMode(VideoExtAnalysis& analysis)
+{
+    hwc_display_contents_1_t *primary = mCachedDisplays[0];
+    bool eligible = false;
+
+    analysis.routeCount = 0;
+
+    // check if there is video layer in the primary device
+    if (primary == NULL) {
+        return false;
+    }
 
     // exclude the frame buffer target layer
-    for (int j = 0; j < (int)content->numHwLayers - 1; j++) {
-        videoLayerExist = isVideoLayer(content->hwLayers[j]);
-        if (videoLayerExist) {
-            if ((content->hwLayers[j].flags & HWC_SKIP_LAYER)) {
-                isVideoLayerSkipped = true;
+    for (int j = 0; j < (int)primary->numHwLayers - 1; j++) {
+        hwc_layer_1_t& video = primary->hwLayers[j];
+        if (!isVideoLayer(video)) {
+            continue;
+        }
+        if (analysis.routeCount == VIDEO_SESSION_MAX) {
+            WTRACE("too many video layers");
+            return false;
+        }
+
+        VideoExtAnalysis::Route& route = analysis.routes[analysis.routeCount++];
+        route.sessionID = -1;
+        route.primaryIndex = j;
+        route.display = -1;
+        route.index = -1;
+
+        bool isVideoLayerSkipped = (video.flags & HWC_SKIP_LAYER) != 0;
+        bool videoFullScreen = isVideoFullScreen(0, video);
+
+        // check whether video layer exists in external device or virtual device
+        // TODO: video may exist in virtual device but no in external device or vice versa
+        for (int i = 1; i < (int)mCachedNumDisplays && route.display < 0; i++) {
+            hwc_display_contents_1_t *content = mCachedDisplays[i];
+            if (content == NULL) {
+                continue;
             }
-            videoHandle = content->hwLayers[j].handle;
-            videoFullScreenOnPrimary = isVideoFullScreen(0, content->hwLayers[j]);
-            break;
+
+            // exclude the frame buffer target layer
+            for (int k = 0; k < (int)content->numHwLayers - 1; k++) {
+                if (content->hwLayers[k].handle == video.handle) {
+                    VTRACE("video layer %d exists in device %d", j, i);
+                    isVideoLayerSkipped |= (content->hwLayers[k].flags & HWC_SKIP_LAYER);
+                    videoFullScreen |= isVideoFullScreen(i, content->hwLayers[k]);
+                    route.display = i;
+                    route.index = k;
+                    break;
+                }
+            }
+        }
+
+        if (route.display < 0) {
+            // blanking the primary would hide this video
+            VTRACE("video layer %d is on the primary only", j);
+            return false;
+        }
+
+        // one full screen video is enough, the others show along
+        if (isVideoLayerSkipped || videoFullScreen) {
+            VTRACE("Video ext mode eligible, %d, %d",
+                    isVideoLayerSkipped, videoFullScreen);
+            eligible = true;
         }
     }
 
-    if (videoLayerExist == false) {
-        // no video layer is found in the primary layer
+    if (eligible) {
+        routeVideoSessions(analysis);
+    }
+    return eligible;
+}
+
+void DisplayAnalyzer::routeVideoSessions(VideoExtAnalysis& analysis)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    MultiDisplayObserver *mds = Hwcomposer::getInstance().getMultiDisplayObserver();
+    hwc_display_contents_1_t *primary = mCachedDisplays[0];
+
+    if (analysis.routeCount == 1 && mVideoStateMap.size() == 1) {
+        analysis.routes[0].sessionID = mVideoStateMap.keyAt(0);
         return;
     }
 
-    // check whether video layer exists in external device or virtual device
-    // TODO: video may exist in virtual device but no in external device or vice versa
-    // TODO: multiple video layers are not addressed here
-    for (int i = 1; i < (int)mCachedNumDisplays; i++) {
-        content = mCachedDisplays[i];
+    // tell the sessions apart by the size of their buffers
+    for (size_t i = 0; i < mVideoStateMap.size(); i++) {
+        int sessionID = mVideoStateMap.keyAt(i);
+        VideoSourceInfo info;
+        if (mds->getVideoSourceInfo(sessionID, &info) != NO_ERROR) {
+            continue;
+        }
+
+        for (int j = 0; j < analysis.routeCount; j++) {
+            VideoExtAnalysis::Route& route = analysis.routes[j];
+            if (route.sessionID >= 0) {
+                continue;
+            }
+
+            DataBuffer *buffer = bm->lockDataBuffer(
+                    primary->hwLayers[route.primaryIndex].handle);
+            if (!buffer) {
+                continue;
+            }
+            int dw = (int)buffer->getWidth() - info.width;
+            int dh = (int)buffer->getHeight() - info.height;
+            bm->unlockDataBuffer(buffer);
+
+            if (dw >= 0 && dw < VIDEO_SIZE_SLACK &&
+                dh >= 0 && dh < VIDEO_SIZE_SLACK) {
+                route.sessionID = sessionID;
+                ITRACE("video session %d goes to device %d", sessionID, route.display);
+                break;
+            }
+        }
+    }
+}
+
+int DisplayAnalyzer::getVideoSessionOnDisplay(int device)
+{
+    if (!mVideoExtModeActive) {
+        return -1;
+    }
+
+    const VideoExtAnalysis& analysis = mVideoExtAnalysis;
+    for (int i = 0; i < analysis.routeCount; i++) {
+        if (analysis.routes[i].display == device) {
+            return analysis.routes[i].sessionID;
+        }
+    }
+    return -1;
+}
+
+bool DisplayAnalyzer::isVideoStarting()
+{
+    for (size_t i = 0; i < mVideoStateMap.size(); i++) {
+        if (mVideoStateMap.valueAt(i) == VIDEO_PLAYBACK_STARTING)
+            return true;
+    }
+    return false;
+}
+
+void DisplayAnalyzer::premapVideoBuffers()
+{
+    // video goes through GLES while the session is starting, map the decoder
+    // buffers it cycles through meanwhile so the first overlay flips are cheap
+    buffer_handle_t handles[PREMAP_LAYER_MAX];
+    size_t count = 0;
+
+    for (int i = 0; i < (int)mCachedNumDisplays; i++) {
+        hwc_display_contents_1_t *content = mCachedDisplays[i];
         if (content == NULL) {
             continue;
         }
 
         // exclude the frame buffer target layer
         for (int j = 0; j < (int)content->numHwLayers - 1; j++) {
-            if (content->hwLayers[j].handle == videoHandle) {
-                isVideoLayerSkipped |= (content->hwLayers[j].flags & HWC_SKIP_LAYER);
-                VTRACE("video layer exists in device %d", i);
-                if (isVideoLayerSkipped || videoFullScreenOnPrimary){
-                    VTRACE("Video ext mode eligible, %d, %d",
-                            isVideoLayerSkipped, videoFullScreenOnPrimary);
-                    mVideoExtModeEligible = true;
-                } else {
-                    mVideoExtModeEligible = isVideoFullScreen(i, content->hwLayers[j]);
-                }
-                return;
+            if (count >= PREMAP_LAYER_MAX) {
+                break;
+            }
+            if (isVideoLayer(content->hwLayers[j])) {
+                handles[count++] = content->hwLayers[j].handle;
             }
         }
     }
+
+    if (count) {
+        Hwcomposer::getInstance().getBufferManager()->premap(handles, count);
+    }
 }
 
 bool DisplayAnalyzer::isVideoExtModeActive()
@@ -307,6 +554,16 @@ int DisplayAnalyzer::getVideoInstances()
     return (int)mVideoStateMap.size();
 }
 
+bool DisplayAnalyzer::isVideoStarting()
+{
+    for (size_t i = 0; i < mVideoStateMap.size(); i++) {
+        if (mVideoStateMap.valueAt(i) == VIDEO_PLAYBACK_STARTING) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void DisplayAnalyzer::postHotplugEvent(bool connected)
 {
     if (!connected) {
@@ -319,7 +576,7 @@ void DisplayAnalyzer::postHotplugEvent(bool connected)
     e.type = HOTPLUG_EVENT;
     e.bValue = connected;
     postEvent(e);
-    Hwcomposer::getInstance().invalidate();
+    Hwcomposer::getInstance().invalidate(Hwcomposer::INVALIDATE_HOTPLUG);
 }
 
 void DisplayAnalyzer::postVideoEvent(int instanceID, int state)
@@ -331,7 +588,7 @@ void DisplayAnalyzer::postVideoEvent(int instanceID, int state)
     postEvent(e);
     if ((state == VIDEO_PLAYBACK_STARTING) ||
         (state == VIDEO_PLAYBACK_STOPPING && mProtectedVideoSession)) {
-        Hwcomposer::getInstance().invalidate();
+        Hwcomposer::getInstance().invalidate(Hwcomposer::INVALIDATE_VIDEO);
         mOverlayAllowed = false;
         hwc_display_contents_1_t *content = NULL;
         for (int i = 0; i < (int)mCachedNumDisplays; i++) {
@@ -356,7 +613,7 @@ void DisplayAnalyzer::postBlankEvent(bool blank)
     e.type = BLANK_EVENT;
     e.bValue = blank;
     postEvent(e);
-    Hwcomposer::getInstance().invalidate();
+    Hwcomposer::getInstance().invalidate(Hwcomposer::INVALIDATE_BLANK);
 }
 
 void DisplayAnalyzer::postInputEvent(bool active)
@@ -365,7 +622,7 @@ void DisplayAnalyzer::postInputEvent(bool active)
     e.type = INPUT_EVENT;
     e.bValue = active;
     postEvent(e);
-    Hwcomposer::getInstance().invalidate();
+    Hwcomposer::getInstance().invalidate(Hwcomposer::INVALIDATE_INPUT);
 }
 
 void DisplayAnalyzer::postIdleEntryEvent(void)
@@ -378,30 +635,66 @@ void DisplayAnalyzer::postIdleEntryEvent(void)
 
 void DisplayAnalyzer::postEvent(Event& e)
 {
-    Mutex::Autolock lock(mEventMutex);
-    mPendingEvents.add(e);
+    if (!mEventRing.push(e)) {
+        android_atomic_inc((int32_t*)&mDroppedEvents);
+        ETRACE("event queue is full, dropping event %d", e.type);
+    }
 }
 
-bool DisplayAnalyzer::getEvent(Event& e)
+void DisplayAnalyzer::collectEvents()
 {
-    Mutex::Autolock lock(mEventMutex);
-    if (mPendingEvents.size() == 0) {
-        return false;
+    Event e;
+    while (mEventRing.tryPop(e)) {
+        // only the latest state of these matters
+        if (e.type == INPUT_EVENT || e.type == BLANK_EVENT ||
+            e.type == VIDEO_CHECK_EVENT) {
+            for (size_t i = 0; i < mPendingEvents.size(); i++) {
+                if (mPendingEvents[i].type == e.type) {
+                    mPendingEvents.removeAt(i);
+                    break;
+                }
+            }
+        }
+        mPendingEvents.add(e);
     }
-    e = mPendingEvents[0];
-    mPendingEvents.removeAt(0);
-    return true;
 }
 
 void DisplayAnalyzer::handlePendingEvents()
 {
-    // handle one event per analysis to avoid blocking surface flinger
-    // some event may take lengthy time to process
-    Event e;
-    if (!getEvent(e)) {
+    // events posted while handling these, such as idle exit, are left
+    // for the next analysis
+    collectEvents();
+    if (mPendingEvents.size() == 0) {
         return;
     }
 
+    // hotplug, blank and video events may take lengthy time to process;
+    // once past the budget only the cheap ones are handled, the others
+    // wait for the next analysis to avoid blocking surface flinger
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    bool expired = false;
+    size_t i = 0;
+    while (i < mPendingEvents.size()) {
+        Event e = mPendingEvents[i];
+        bool cheap = (e.type != HOTPLUG_EVENT &&
+                      e.type != BLANK_EVENT &&
+                      e.type != VIDEO_EVENT);
+        if (expired && !cheap) {
+            i++;
+            continue;
+        }
+
+        mPendingEvents.removeAt(i);
+        handleEvent(e);
+        if (!expired &&
+            systemTime(SYSTEM_TIME_MONOTONIC) - start > EVENT_BUDGET) {
+            expired = true;
+        }
+    }
+}
+
+void DisplayAnalyzer::handleEvent(const Event& e)
+{
     switch (e.type) {
     case HOTPLUG_EVENT:
         handleHotplugEvent(e.bValue);
@@ -418,9 +711,6 @@ void DisplayAnalyzer::handlePendingEvents()
     case INPUT_EVENT:
         handleInputEvent(e.bValue);
         break;
-    case DPMS_EVENT:
-        handleDpmsEvent(e.nValue);
-        break;
     case IDLE_ENTRY_EVENT:
         handleIdleEntryEvent(e.nValue);
         break;
@@ -509,21 +799,168 @@ void DisplayAnalyzer::handleTimingEvent()
     }
 
     int hz = 0;
+    int instanceID = -1;
+    if (mContentRate.rate) {
+        // what the video really plays at beats what the stream claims
+        dev->setRefreshRate(getContentRefreshRate(mContentRate.rate));
+        return;
+    }
     if (mVideoStateMap.size() == 1) {
+        instanceID = mVideoStateMap.keyAt(0);
+    } else {
+        // with several sessions, the one extended to HDMI sets the rate
+        instanceID = getVideoSessionOnDisplay(IDisplayDevice::DEVICE_EXTERNAL);
+    }
+    if (instanceID >= 0) {
         VideoSourceInfo info;
-        int instanceID = mVideoStateMap.keyAt(0);
         status_t err = hwc->getMultiDisplayObserver()->getVideoSourceInfo(
                 instanceID, &info);
-        if (err == NO_ERROR) {
-            hz = info.frameRate;
+        if (err == NO_ERROR && info.frameRate > 0) {
+            hz = getContentRefreshRate(info.frameRate * 1000);
         }
     }
 
     dev->setRefreshRate(hz);
 }
 
+void DisplayAnalyzer::updateContentRate()
+{
+    hwc_display_contents_1_t *content = NULL;
+    if (mVideoStateMap.size() &&
+        (int)mCachedNumDisplays > IDisplayDevice::DEVICE_EXTERNAL) {
+        content = mCachedDisplays[IDisplayDevice::DEVICE_EXTERNAL];
+    }
+
+    // only a full screen video gets to pick the HDMI mode
+    hwc_layer_1_t *video = NULL;
+    if (content) {
+        // exclude the frame buffer target layer
+        for (int i = 0; i < (int)content->numHwLayers - 1; i++) {
+            hwc_layer_1_t& layer = content->hwLayers[i];
+            if (isVideoLayer(layer) &&
+                isVideoFullScreen(IDisplayDevice::DEVICE_EXTERNAL, layer)) {
+                video = &layer;
+                break;
+            }
+        }
+    }
+
+    if (!video) {
+        resetContentRate();
+        return;
+    }
+
+    // the decoder queues a new buffer for every frame
+    if (video->handle == mContentRate.handle) {
+        return;
+    }
+    mContentRate.handle = video->handle;
+
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    DataBufferLocker locker(bm, video->handle);
+    if (!locker.get()) {
+        return;
+    }
+    BufferMapper *mapper = bm->map(*locker.get(), BufferManager::MAPPING_OWNER_LAYER);
+    if (!mapper) {
+        return;
+    }
+    const IVideoPayloadManager::MetaData *metadata = mPayloadManager->getMetaData(mapper);
+    int64_t timestamp = metadata ? metadata->timestamp : -1;
+    bm->unmap(mapper, BufferManager::MAPPING_OWNER_LAYER);
+
+    if (timestamp >= 0) {
+        addContentTimestamp(timestamp);
+    }
+}
+
+void DisplayAnalyzer::addContentTimestamp(int64_t timestamp)
+{
+    static const int rates[] = {
+        23976, 24000, 25000, 29970, 30000, 50000, 59940, 60000,
+    };
+
+    ContentRate& cr = mContentRate;
+    int64_t interval = timestamp - cr.lastTimestamp;
+    bool restart = cr.lastTimestamp == 0 ||
+                   interval <= 0 || interval > CONTENT_MAX_INTERVAL;
+    cr.lastTimestamp = timestamp;
+    if (restart) {
+        // first frame, seek or pause, measure again but keep the mode
+        cr.interval = 0;
+        return;
+    }
+
+    // media timestamps are exact, the average only hides rounding and
+    // the occasional dropped frame
+    if (cr.interval == 0) {
+        cr.interval = interval;
+    } else {
+        cr.interval += (interval - cr.interval) / 8;
+    }
+
+    int measured = (int)(1000000000LL / cr.interval);
+    int candidate = 0;
+    int bestError = 0;
+    for (size_t i = 0; i < sizeof(rates)/sizeof(rates[0]); i++) {
+        int error = abs(measured - rates[i]);
+        if (error * 1000 > rates[i] * CONTENT_RATE_TOLERANCE) {
+            continue;
+        }
+        if (candidate == 0 || error < bestError) {
+            candidate = rates[i];
+            bestError = error;
+        }
+    }
+
+    if (candidate != cr.candidate) {
+        cr.candidate = candidate;
+        cr.candidateCount = 0;
+    }
+    if (cr.candidateCount < CONTENT_RATE_STABLE_FRAMES &&
+        ++cr.candidateCount == CONTENT_RATE_STABLE_FRAMES &&
+        candidate && candidate != cr.rate) {
+        ITRACE("video content rate %d.%03d fps", candidate / 1000, candidate % 1000);
+        cr.rate = candidate;
+        handleTimingEvent();
+    }
+}
+
+void DisplayAnalyzer::resetContentRate()
+{
+    bool adapted = mContentRate.rate != 0;
+    memset(&mContentRate, 0, sizeof(mContentRate));
+    if (adapted) {
+        // back to the rate of the stream, or the preferred mode
+        ITRACE("video content rate reset");
+        handleTimingEvent();
+    }
+}
+
+int DisplayAnalyzer::getContentRefreshRate(int frameRate)
+{
+    // vrefresh is whole Hz, a 23.976 mode reports 24. Take the lowest
+    // mode of the current resolution the content divides evenly so no
+    // frame is shown longer than the others.
+    int fps = (frameRate + 500) / 1000;
+    if (fps <= 0) {
+        return 0;
+    }
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    for (int hz = fps; hz <= 60; hz += fps) {
+        if (drm->hasRefreshRate(IDisplayDevice::DEVICE_EXTERNAL, hz)) {
+            return hz;
+        }
+    }
+    // no cadence free mode, stay on the preferred one
+    return 0;
+}
+
 void DisplayAnalyzer::handleVideoEvent(int instanceID, int state)
 {
+    // video extended mode is checked again even without geometry change
+    mVideoGeneration++;
     mVideoStateMap.removeItem(instanceID);
     if (state != VIDEO_PLAYBACK_STOPPED) {
         mVideoStateMap.add(instanceID, state);
@@ -543,7 +980,16 @@ void DisplayAnalyzer::handleVideoEvent(int instanceID, int state)
 
     // check if composition type needs to be reset
     bool reset = false;
-    if ((state == VIDEO_PLAYBACK_STARTING) ||
+    bool protectedStart = false;
+    if (state == VIDEO_PLAYBACK_STARTING) {
+        // the source info may not be published yet, assume protected then
+        VideoSourceInfo info;
+        status_t err = hwc->getMultiDisplayObserver()->getVideoSourceInfo(
+                instanceID, &info);
+        protectedStart = (err != NO_ERROR) || info.isProtected;
+    }
+
+    if (protectedStart ||
         (state == VIDEO_PLAYBACK_STOPPING && mProtectedVideoSession)) {
         // if video is in starting or stopping stage, overlay use is temporarily not allowed to
         // avoid scrambed RGB overlay if video is protected.
@@ -565,6 +1011,19 @@ void DisplayAnalyzer::handleVideoEvent(int instanceID, int state)
         // reset active input state after video playback stops.
         // MDS should update input state in 5 seconds after video playback starts
         mActiveInputState = true;
+        hwc->getBufferManager()->releasePremapped();
+        hwc->getPlaneManager()->releaseVideoCaches();
+    }
+
+    // the overlays come back up before the first video frame is assigned
+    if (state == VIDEO_PLAYBACK_STARTING) {
+        hwc->getPlaneManager()->wakeOverlays();
+    }
+
+    // VA bring-up would otherwise stall the first rotated frame
+    if (state == VIDEO_PLAYBACK_STARTING && isRotationLikely()) {
+        hwc->getPlaneManager()->prewarmRotation();
+        mRotationWarm = true;
     }
 
     mProtectedVideoSession = false;
@@ -581,6 +1040,38 @@ void DisplayAnalyzer::handleVideoEvent(int instanceID, int state)
     handleVideoCheckEvent();
 }
 
+bool DisplayAnalyzer::isRotationLikely()
+{
+    if (mRotationPrewarm == ROTATION_PREWARM_NEVER) {
+        return false;
+    }
+    if (mRotationPrewarm == ROTATION_PREWARM_ALWAYS) {
+        return true;
+    }
+
+    // a panel mounted upside down rotates every video
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    if (drm->getPanelOrientation(IDisplayDevice::DEVICE_PRIMARY) !=
+        PANEL_ORIENTATION_0) {
+        return true;
+    }
+
+    // the sensor turned the UI, the video is likely to follow
+    hwc_display_contents_1_t *content = NULL;
+    if (mCachedNumDisplays > IDisplayDevice::DEVICE_PRIMARY) {
+        content = mCachedDisplays[IDisplayDevice::DEVICE_PRIMARY];
+    }
+    if (content == NULL) {
+        return false;
+    }
+    for (int i = 0; i < (int)content->numHwLayers - 1; i++) {
+        if (content->hwLayers[i].transform & HAL_TRANSFORM_ROT_90) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void DisplayAnalyzer::blankSecondaryDevice()
 {
     hwc_display_contents_1_t *content = NULL;
@@ -617,6 +1108,11 @@ void DisplayAnalyzer::handleInputEvent(bool active)
         WTRACE("same input state: %d", active);
     }
     mActiveInputState = active;
+    Hwcomposer::getInstance().getInputBoost()->setActive(active);
+    if (active) {
+        // don't wait for the next frame to ramp the panel up
+        mIdleRefreshWanted = false;
+    }
     if (!mVideoExtModeEligible) {
         ITRACE("not eligible for video extended mode");
         return;
@@ -629,41 +1125,63 @@ void DisplayAnalyzer::handleInputEvent(bool active)
     }
 }
 
-void DisplayAnalyzer::handleDpmsEvent(int delayCount)
+void DisplayAnalyzer::scheduleDpmsOff()
 {
-    if (mActiveInputState || !mVideoExtModeEligible) {
-        ITRACE("aborting display power off in video extended mode");
+    Mutex::Autolock _l(mDpmsLock);
+    EventLoop *loop = Hwcomposer::getInstance().getEventLoop();
+    if (mDpmsTimer < 0) {
+        mDpmsTimer = loop->addTimer(DPMS_OFF_DELAY, 0, dpmsTimerExpired, this);
+        if (mDpmsTimer < 0) {
+            ETRACE("failed to create dpms timer");
+        }
         return;
     }
+    loop->setTimer(mDpmsTimer, DPMS_OFF_DELAY, 0);
+}
 
-    if (delayCount < DELAY_BEFORE_DPMS_OFF) {
-        Event e;
-        e.type = DPMS_EVENT;
-        e.nValue = delayCount + 1;
-        postEvent(e);
-        Hwcomposer::getInstance().invalidate();
+void DisplayAnalyzer::cancelDpmsOff()
+{
+    int timer;
+    {
+        Mutex::Autolock _l(mDpmsLock);
+        timer = mDpmsTimer;
+        mDpmsTimer = -1;
+    }
+    // waits for the callback, which takes mDpmsLock
+    if (timer >= 0) {
+        Hwcomposer::getInstance().getEventLoop()->removeTimer(timer);
+    }
+}
+
+void DisplayAnalyzer::dpmsTimerExpired(int timer, void *data)
+{
+    // runs on the event loop, video extended mode is left through
+    // cancelDpmsOff() so a live timer means the mode is still on
+    DisplayAnalyzer *analyzer = (DisplayAnalyzer *)data;
+    Mutex::Autolock _l(analyzer->mDpmsLock);
+    if (timer != analyzer->mDpmsTimer) {
+        ITRACE("aborting display power off in video extended mode");
         return;
     }
 
-    if (Hwcomposer::getInstance().getVsyncManager()->getVsyncSource() ==
+    Hwcomposer& hwc = Hwcomposer::getInstance();
+    if (hwc.getVsyncManager()->getVsyncSource() ==
         IDisplayDevice::DEVICE_PRIMARY) {
-            Hwcomposer::getInstance().getDrm()->setDpmsMode(
+        hwc.getDrm()->setDpmsMode(
             IDisplayDevice::DEVICE_PRIMARY,
-                IDisplayDevice::DEVICE_DISPLAY_STANDBY);
+            IDisplayDevice::DEVICE_DISPLAY_STANDBY);
         ETRACE("primary display is source of vsync, we only dim backlight");
         return;
     }
 
     // panel can't be powered off as touch panel shares the power supply with LCD.
     DTRACE("primary display coupled with touch on Saltbay, only dim backlight");
-    Hwcomposer::getInstance().getDrm()->setDpmsMode(
+    hwc.getDrm()->setDpmsMode(
                IDisplayDevice::DEVICE_PRIMARY,
                IDisplayDevice::DEVICE_DISPLAY_STANDBY);
                //IDisplayDevice::DEVICE_DISPLAY_OFF);
-    return;
 }
 
-
 void DisplayAnalyzer::handleIdleEntryEvent(int count)
 {
     DTRACE("handling idle entry event, count %d", count);
@@ -689,6 +1207,7 @@ void DisplayAnalyzer::handleIdleEntryEvent(int count)
     }
 
     setCompositionType(0, HWC_FORCE_FRAMEBUFFER, true);
+    mIdleRefreshWanted = true;
 
     // next prepare/set will exit idle state.
     Event e;
@@ -701,6 +1220,16 @@ void DisplayAnalyzer::handleIdleExitEvent()
     DTRACE("handling idle exit event");
 
     setCompositionType(0, HWC_FRAMEBUFFER, true);
+    mIdleRefreshWanted = false;
+}
+
+void DisplayAnalyzer::setIdleRefresh(bool idle)
+{
+    PrimaryDevice *primary = (PrimaryDevice *)Hwcomposer::getInstance().getDisplayDevice(
+            IDisplayDevice::DEVICE_PRIMARY);
+    if (primary) {
+        primary->setIdleRefresh(idle);
+    }
 }
 
 void DisplayAnalyzer::handleVideoCheckEvent()
@@ -761,12 +1290,13 @@ void DisplayAnalyzer::enterVideoExtMode()
 
     setCompositionType(0, HWC_OVERLAY, true);
 
+    // the session shown on HDMI is only known from now on
+    if (mVideoStateMap.size() > 1) {
+        handleTimingEvent();
+    }
+
     // Do not power off primary display immediately as flip is asynchronous
-    Event e;
-    e.type = DPMS_EVENT;
-    e.nValue = 0;
-    postEvent(e);
-    Hwcomposer::getInstance().invalidate();
+    scheduleDpmsOff();
 }
 
 void DisplayAnalyzer::exitVideoExtMode()
@@ -780,6 +1310,8 @@ void DisplayAnalyzer::exitVideoExtMode()
 
     mVideoExtModeActive = false;
 
+    // the timer won't fire once this returns
+    cancelDpmsOff();
     Hwcomposer::getInstance().getDrm()->setDpmsMode(
         IDisplayDevice::DEVICE_PRIMARY,
         IDisplayDevice::DEVICE_DISPLAY_ON);
@@ -813,24 +1345,18 @@ bool DisplayAnalyzer::isPresentationLayer(hwc_layer_1_t &layer)
 
 bool DisplayAnalyzer::hasProtectedLayer()
 {
-    DataBuffer * buffer = NULL;
-    hwc_display_contents_1_t *content = NULL;
-    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
-
-    if (bm == NULL){
-        return false;
-    }
-
     if (mCachedDisplays == NULL) {
         return false;
     }
-    // check if the given layer exists in the primary device
+
     for (int index = 0; index < (int)mCachedNumDisplays; index++) {
-        content = mCachedDisplays[index];
+        hwc_display_contents_1_t *content = mCachedDisplays[index];
         if (content == NULL) {
             continue;
         }
 
+        // the layer lists count theirs only when they are prepared, after
+        // the pending events; the attribute cache keeps this scan lock free
         for (size_t i = 0; i < content->numHwLayers - 1; i++) {
             if (isProtectedLayer(content->hwLayers[i]))
                 return true;
@@ -845,16 +1371,35 @@ bool DisplayAnalyzer::isProtectedLayer(hwc_layer_1_t &layer)
     if (!layer.handle) {
         return false;
     }
-    bool ret = false;
+
+    BufferAttributes attributes;
     BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
-    DataBuffer *buffer = bm->lockDataBuffer(layer.handle);
-    if (!buffer) {
+    if (!bm->getBufferAttributes(layer.handle, attributes)) {
         ETRACE("failed to get buffer");
-    } else {
-        ret = GraphicBuffer::isProtectedBuffer((GraphicBuffer*)buffer);
-        bm->unlockDataBuffer(buffer);
+        return false;
+    }
+    return attributes.isProtected;
+}
+
+void DisplayAnalyzer::updateStatistics(size_t numDisplays, hwc_display_contents_1_t** displays)
+{
+    if (!mInitialized || !displays) {
+        return;
+    }
+
+    bool video = mVideoStateMap.size() > 0;
+    for (size_t i = 0; i < numDisplays && i < IDisplayDevice::DEVICE_COUNT; i++) {
+        mStats[i].addFrame(displays[i], video,
+                           android_atomic_acquire_load(&mProtectedLayers[i]) > 0);
+    }
+}
+
+void DisplayAnalyzer::dump(Dump& d)
+{
+    d.append("Content statistics:\n");
+    for (int i = 0; i < IDisplayDevice::DEVICE_COUNT; i++) {
+        mStats[i].dump(d);
     }
-    return ret;
 }
 
 bool DisplayAnalyzer::ignoreVideoSkipFlag()
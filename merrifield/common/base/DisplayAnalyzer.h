@@ -18,6 +18,11 @@
 
 #include <utils/threads.h>
 #include <utils/Vector.h>
+#include <utils/Timers.h>
+#include <MpscRing.h>
+#include <IVideoPayloadManager.h>
+#include <IDisplayDevice.h>
+#include <ContentStats.h>
 
 
 namespace android {
@@ -39,6 +44,8 @@ public:
     bool isVideoFullScreen(int device, hwc_layer_1_t &layer);
     bool isOverlayAllowed();
     int  getVideoInstances();
+    // a video session is in VIDEO_PLAYBACK_STARTING
+    bool isVideoStarting();
     void postHotplugEvent(bool connected);
     void postVideoEvent(int instanceID, int state);
     void postInputEvent(bool active);
@@ -47,8 +54,14 @@ public:
     void postIdleEntryEvent();
     bool isPresentationLayer(hwc_layer_1_t &layer);
     bool isProtectedLayer(hwc_layer_1_t &layer);
+    // classifies the frames being committed, see ContentStats
+    void updateStatistics(size_t numDisplays, hwc_display_contents_1_t** displays);
+    void dump(Dump& d);
     bool ignoreVideoSkipFlag();
     int  getFirstVideoInstanceSessionID();
+    // session whose video extended mode output is the given display, -1
+    // if none is routed there
+    int  getVideoSessionOnDisplay(int device);
 
 private:
     enum DisplayEventType {
@@ -57,7 +70,6 @@ private:
         VIDEO_EVENT,
         TIMING_EVENT,
         INPUT_EVENT,
-        DPMS_EVENT,
         IDLE_ENTRY_EVENT,
         IDLE_EXIT_EVENT,
         VIDEO_CHECK_EVENT,
@@ -78,23 +90,39 @@ private:
         };
     };
     inline void postEvent(Event& e);
-    inline bool getEvent(Event& e);
+    void collectEvents();
+    void handleEvent(const Event& e);
     void handlePendingEvents();
     void handleHotplugEvent(bool connected);
     void handleBlankEvent(bool blank);
     void handleVideoEvent(int instanceID, int state);
     void handleTimingEvent();
     void handleInputEvent(bool active);
-    void handleDpmsEvent(int delayCount);
+    void scheduleDpmsOff();
+    void cancelDpmsOff();
+    static void dpmsTimerExpired(int timer, void *data);
     void handleIdleEntryEvent(int count);
     void handleIdleExitEvent();
     void handleVideoCheckEvent();
+    void setIdleRefresh(bool idle);
 
     void blankSecondaryDevice();
     void handleVideoExtMode();
+    bool isVideoStarting();
+    void premapVideoBuffers();
     void checkVideoExtMode();
+    struct VideoExtAnalysis;
+    bool isVideoExtAnalysisValid(bool extConnected, bool frameServerActive,
+                                 int activeDisplays);
+    bool scanVideoExtMode(VideoExtAnalysis& analysis);
+    void routeVideoSessions(VideoExtAnalysis& analysis);
     void enterVideoExtMode();
     void exitVideoExtMode();
+    bool isRotationLikely();
+    void updateContentRate();
+    void addContentTimestamp(int64_t timestamp);
+    void resetContentRate();
+    int  getContentRefreshRate(int frameRate);
     bool hasProtectedLayer();
     inline void setCompositionType(hwc_display_contents_1_t *content, int type);
     inline void setCompositionType(int device, int type, bool reset);
@@ -110,12 +138,41 @@ private:
         VIDEO_PLAYBACK_STOPPED,
     };
 
+    // hwc.video.rotation.prewarm
     enum
     {
-        // number of flips before display can be powered off in video extended mode
-        DELAY_BEFORE_DPMS_OFF = 0,
+        ROTATION_PREWARM_NEVER,
+        ROTATION_PREWARM_LIKELY,
+        ROTATION_PREWARM_ALWAYS,
     };
 
+    enum
+    {
+        // video layers collected per frame for premapping
+        PREMAP_LAYER_MAX = 4,
+        // events posted but not yet collected by prepare
+        EVENT_RING_SIZE = 64,
+        // video sessions taken to extended mode together
+        VIDEO_SESSION_MAX = 4,
+        // buffer dimensions are aligned, source sizes are not
+        VIDEO_SIZE_SLACK = 64,
+        // frames at the same measured rate before HDMI follows it
+        CONTENT_RATE_STABLE_FRAMES = 30,
+        // content rates are told apart within 0.5%, in 1/1000 Hz
+        CONTENT_RATE_TOLERANCE = 5,
+    };
+
+    // media timestamps are in microseconds, a longer gap is a pause or seek
+    static const int64_t CONTENT_MAX_INTERVAL = 200000;
+
+    // time given to events per prepare, cheap ones are always handled
+    static const nsecs_t EVENT_BUDGET = 1000000;
+    // the primary is powered off this long after video extended mode is
+    // entered, by then the last asynchronous flip has landed
+    static const nsecs_t DPMS_OFF_DELAY = 50000000;
+    // how often idle overlay back buffers are looked for
+    static const nsecs_t IDLE_CHECK_INTERVAL = 1000000000;
+
 private:
     bool mInitialized;
     bool mVideoExtModeEnabled;
@@ -124,6 +181,10 @@ private:
     bool mBlankDevice;
     bool mOverlayAllowed;
     bool mActiveInputState;
+    // idle refresh asked for by the events of an analysis, applied once
+    // they are all handled
+    bool mIdleRefreshWanted;
+    bool mIdleRefresh;
     // workaround HWC_SKIP_LAYER set during rotation for extended video mode
     // by default if layer has HWC_SKIP_LAYER flag it should not be processed by HWC
     bool mIgnoreVideoSkipFlag;
@@ -132,9 +193,59 @@ private:
     KeyedVector<int, int> mVideoStateMap;
     int mCachedNumDisplays;
     hwc_display_contents_1_t** mCachedDisplays;
+    // result of the last video extended mode scan and what it depends on;
+    // layers only move on a geometry change, the video state on an event
+    struct VideoExtAnalysis {
+        bool valid;
+        uint32_t videoGeneration;
+        uint32_t geometryGeneration;
+        int activeDisplays;
+        bool extConnected;
+        bool frameServerActive;
+        // every video layer of the primary and where it is shown instead
+        struct Route {
+            int sessionID;
+            int primaryIndex;
+            int display;
+            int index;
+        } routes[VIDEO_SESSION_MAX];
+        int routeCount;
+        bool eligible;
+    };
+    VideoExtAnalysis mVideoExtAnalysis;
+    uint32_t mVideoGeneration;
+    uint32_t mGeometryGeneration;
+
+    // frame rate of the full screen video on HDMI, measured from the
+    // media timestamps of its payload. Rates are in 1/1000 Hz.
+    struct ContentRate {
+        buffer_handle_t handle;
+        int64_t lastTimestamp;
+        int64_t interval;
+        int candidate;
+        uint32_t candidateCount;
+        int rate;
+    };
+    ContentStats mStats[IDisplayDevice::DEVICE_COUNT];
+
+    bool mContentRateEnabled;
+    IVideoPayloadManager *mPayloadManager;
+
+    int mRotationPrewarm;
+    // some overlay plane may hold video rotation resources
+    bool mRotationWarm;
+    // last look for overlay back buffers to release
+    nsecs_t mLastIdleCheck;
+    ContentRate mContentRate;
+
+    // one shot timer on the event loop, -1 if no power off is pending
+    Mutex mDpmsLock;
+    int mDpmsTimer;
+
+    // posted from any thread, collected into mPendingEvents by prepare
+    MpscRing<Event, EVENT_RING_SIZE> mEventRing;
     Vector<Event> mPendingEvents;
-    Mutex mEventMutex;
-    Condition mEventHandledCondition;
+    uint32_t mDroppedEvents;
 };
 
 } // namespace intel
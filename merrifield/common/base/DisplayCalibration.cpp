@@ -0,0 +1,195 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <cutils/properties.h>
+#include <HwcTrace.h>
+#include <DisplayCalibration.h>
+
+namespace android {
+namespace intel {
+
+Mutex DisplayCalibration::sLock;
+DisplayCalibration::Values DisplayCalibration::sValues[DISPLAY_COUNT];
+bool DisplayCalibration::sInitialized = false;
+
+static const char *sPathKeys[DisplayCalibration::DISPLAY_COUNT] = {
+    "hwc.calibration.primary",
+    "hwc.calibration.external",
+};
+
+void DisplayCalibration::setIdentity(Values& values)
+{
+    values.loaded = false;
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        values.gamma[i] = 1.0f;
+        values.gain[i] = 1.0f;
+    }
+    values.overlayBrightness = 0;
+    values.overlayContrast = UNITY_GAIN;
+    values.overlaySaturation = UNITY_GAIN;
+}
+
+bool DisplayCalibration::parse(const char *path, Values& values)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        WTRACE("failed to open calibration %s", path);
+        return false;
+    }
+
+    setIdentity(values);
+    bool ret = true;
+    char line[128];
+    int lineNumber = 0;
+    while (ret && fgets(line, sizeof(line), fp)) {
+        lineNumber++;
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char key[32];
+        if (sscanf(line, "%31s", key) != 1) {
+            // empty line
+            continue;
+        }
+
+        float v[CHANNEL_COUNT];
+        int n;
+        if (!strcmp(key, "gamma")) {
+            ret = sscanf(line, "%*s %f %f %f", &v[0], &v[1], &v[2]) == 3;
+            for (int i = 0; ret && i < CHANNEL_COUNT; i++) {
+                ret = v[i] >= 0.1f && v[i] <= 10.0f;
+                values.gamma[i] = v[i];
+            }
+        } else if (!strcmp(key, "gain")) {
+            ret = sscanf(line, "%*s %f %f %f", &v[0], &v[1], &v[2]) == 3;
+            for (int i = 0; ret && i < CHANNEL_COUNT; i++) {
+                ret = v[i] >= 0.0f && v[i] <= 1.0f;
+                values.gain[i] = v[i];
+            }
+        } else if (!strcmp(key, "overlay_brightness")) {
+            ret = sscanf(line, "%*s %d", &n) == 1 && n >= -128 && n <= 127;
+            values.overlayBrightness = n;
+        } else if (!strcmp(key, "overlay_contrast")) {
+            ret = sscanf(line, "%*s %d", &n) == 1 &&
+                  n >= 0 && n <= MAX_OVERLAY_GAIN;
+            values.overlayContrast = n;
+        } else if (!strcmp(key, "overlay_saturation")) {
+            ret = sscanf(line, "%*s %d", &n) == 1 &&
+                  n >= 0 && n <= MAX_OVERLAY_GAIN;
+            values.overlaySaturation = n;
+        } else {
+            ret = false;
+        }
+    }
+    fclose(fp);
+
+    if (!ret) {
+        ETRACE("invalid calibration %s at line %d", path, lineNumber);
+        setIdentity(values);
+        return false;
+    }
+    values.loaded = true;
+    return true;
+}
+
+bool DisplayCalibration::load(int device)
+{
+    if (device < 0 || device >= DISPLAY_COUNT) {
+        return false;
+    }
+
+    Values values;
+    setIdentity(values);
+    char path[PROPERTY_VALUE_MAX];
+    bool ret = property_get(sPathKeys[device], path, NULL) > 0 &&
+               parse(path, values);
+    if (ret) {
+        ITRACE("display %d calibrated from %s", device, path);
+    }
+
+    Mutex::Autolock _l(sLock);
+    if (!sInitialized) {
+        for (int i = 0; i < DISPLAY_COUNT; i++) {
+            setIdentity(sValues[i]);
+        }
+        sInitialized = true;
+    }
+    sValues[device] = values;
+    return ret;
+}
+
+void DisplayCalibration::get(int device, Values& values)
+{
+    Mutex::Autolock _l(sLock);
+    if (!sInitialized || device < 0 || device >= DISPLAY_COUNT) {
+        setIdentity(values);
+        return;
+    }
+    values = sValues[device];
+}
+
+bool DisplayCalibration::hasGamma(const Values& values)
+{
+    if (!values.loaded) {
+        return false;
+    }
+
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if (values.gamma[i] != 1.0f || values.gain[i] != 1.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void DisplayCalibration::buildGammaLut(const Values& values, int size,
+                                       uint16_t *red, uint16_t *green,
+                                       uint16_t *blue)
+{
+    uint16_t *luts[CHANNEL_COUNT] = { red, green, blue };
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+        for (int i = 0; i < size; i++) {
+            double x = (size > 1) ? (double)i / (size - 1) : 1.0;
+            double y = values.gain[c] * pow(x, values.gamma[c]);
+            luts[c][i] = (uint16_t)(y * 65535.0 + 0.5);
+        }
+    }
+}
+
+void DisplayCalibration::dump(Dump& d)
+{
+    Mutex::Autolock _l(sLock);
+    for (int i = 0; sInitialized && i < DISPLAY_COUNT; i++) {
+        const Values& v = sValues[i];
+        if (!v.loaded) {
+            continue;
+        }
+        d.append("Calibration of display %d: gamma %.2f/%.2f/%.2f, "
+                 "gain %.2f/%.2f/%.2f, overlay brightness %d, "
+                 "contrast %u, saturation %u\n", i,
+                 v.gamma[0], v.gamma[1], v.gamma[2],
+                 v.gain[0], v.gain[1], v.gain[2],
+                 v.overlayBrightness, v.overlayContrast,
+                 v.overlaySaturation);
+    }
+}
+
+} // namespace intel
+} // namespace android
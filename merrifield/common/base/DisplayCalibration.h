@@ -0,0 +1,80 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef DISPLAY_CALIBRATION_H
+#define DISPLAY_CALIBRATION_H
+
+#include <Dump.h>
+#include <utils/Mutex.h>
+
+namespace android {
+namespace intel {
+
+// Color calibration of each panel, read once from a text file given by
+// hwc.calibration.primary or hwc.calibration.external. Lines of the file,
+// '#' starts a comment:
+//     gamma <r> <g> <b>           exponent of each channel of the pipe
+//                                 gamma LUT, 1.0 is linear
+//     gain <r> <g> <b>            scale of each channel of the LUT, 0 to 1
+//     overlay_brightness <n>      offset added to the overlay brightness
+//     overlay_contrast <n>        overlay contrast gain, 128 is 1.0
+//     overlay_saturation <n>      overlay saturation gain, 128 is 1.0
+// The LUT is programmed on the pipe and the overlay color correction is
+// applied by the overlay planes, so calibrated output needs no GLES pass.
+class DisplayCalibration {
+public:
+    enum {
+        // primary and external display
+        DISPLAY_COUNT = 2,
+        CHANNEL_COUNT = 3,
+        // gain of the overlay values that leaves them unchanged
+        UNITY_GAIN = 128,
+        MAX_OVERLAY_GAIN = 4 * UNITY_GAIN,
+    };
+
+    struct Values {
+        bool loaded;
+        float gamma[CHANNEL_COUNT];
+        float gain[CHANNEL_COUNT];
+        int32_t overlayBrightness;
+        uint32_t overlayContrast;
+        uint32_t overlaySaturation;
+    };
+
+public:
+    // reads the calibration of device, returns false if it has none
+    static bool load(int device);
+    // the calibration of device, identity values if it has none
+    static void get(int device, Values& values);
+    // whether the pipe gamma LUT differs from the linear one
+    static bool hasGamma(const Values& values);
+    // LUT of size entries for each channel, from black to white
+    static void buildGammaLut(const Values& values, int size,
+                              uint16_t *red, uint16_t *green, uint16_t *blue);
+    static void dump(Dump& d);
+
+private:
+    static void setIdentity(Values& values);
+    static bool parse(const char *path, Values& values);
+
+    static Mutex sLock;
+    static Values sValues[DISPLAY_COUNT];
+    static bool sInitialized;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* DISPLAY_CALIBRATION_H */
@@ -19,7 +19,9 @@
 #include <IDisplayDevice.h>
 #include <DrmConfig.h>
 #include <Drm.h>
+#include <DisplayPlane.h>
 #include <Hwcomposer.h>
+#include <hal_public.h>
 
 namespace android {
 namespace intel {
@@ -27,9 +29,14 @@ namespace intel {
 Drm::Drm()
     : mDrmFd(0),
       mLock(),
-      mInitialized(false)
+      mInitialized(false),
+      mPlaneUpdateLock(),
+      mPlaneUpdates(),
+      mPlaneUpdatesOpen(false)
 {
     memset(&mOutputs, 0, sizeof(mOutputs));
+    memset(&mTopology, 0, sizeof(mTopology));
+    memset(&mPlaneUpdateStats, 0, sizeof(mPlaneUpdateStats));
 }
 
 Drm::~Drm()
@@ -53,15 +60,34 @@ bool Drm::initialize()
     DTRACE("mDrmFd = %d", mDrmFd);
 
     memset(&mOutputs, 0, sizeof(mOutputs));
+
+    mEdidCache.initialize();
+
+    // not fatal, detect() probes again for an output not found here
+    if (!probeTopology()) {
+        WTRACE("failed to probe drm topology");
+    }
+
     mInitialized = true;
     return true;
 }
 
 void Drm::deinitialize()
 {
+    {
+        Mutex::Autolock _l(mPlaneUpdateLock);
+        mPlaneUpdates.clear();
+        mDeferredPlaneUpdates.clear();
+        mPlaneUpdatesOpen = false;
+        memset(&mPlaneUpdateStats, 0, sizeof(mPlaneUpdateStats));
+    }
+
     for (int i = 0; i < OUTPUT_MAX; i++) {
         resetOutput(i);
     }
+    memset(&mTopology, 0, sizeof(mTopology));
+    mCrtcIds.clear();
+    mEdidCache.deinitialize();
 
     if (mDrmFd) {
         close(mDrmFd);
@@ -80,153 +106,268 @@ bool Drm::detect(int device)
         return false;
     }
 
+    DrmOutput *output = &mOutputs[outputIndex];
+    DrmTopology *topology = &mTopology[outputIndex];
+    drmModeConnectorPtr connector = NULL;
+
+    // getting the connector probes its status and modes again, the rest
+    // of the topology doesn't change with a hotplug
+    if (topology->valid) {
+        connector = drmModeGetConnector(mDrmFd, topology->connectorId);
+        if (!connector) {
+            WTRACE("failed to get connector %u, probing drm topology",
+                topology->connectorId);
+        }
+    }
+    if (!connector && probeTopology() && topology->valid) {
+        connector = drmModeGetConnector(mDrmFd, topology->connectorId);
+    }
+
+    if (!connector) {
+        resetOutput(outputIndex);
+        if (outputIndex != OUTPUT_PRIMARY) {
+            // a fatal failure on primary device
+            // non fatal on secondary device
+            WTRACE("device %d is disabled?", device);
+            return true;
+        }
+        ETRACE("failed to get drm connector of device %d", device);
+        return false;
+    }
+
+    if (connector->connection != DRM_MODE_CONNECTED) {
+        ITRACE("device %d is not connected", device);
+        drmModeFreeConnector(connector);
+        resetOutput(outputIndex);
+        return true;
+    }
+
+    // a repeated hotplug of the same sink keeps the output as it is
+    if (output->connected && isSameConnector(connector, output->connector)) {
+        ITRACE("device %d is unchanged", device);
+        drmModeFreeConnector(output->connector);
+        output->connector = connector;
+        return true;
+    }
+
     resetOutput(outputIndex);
+    output->connector = connector;
+    output->connected = true;
+    if (outputIndex != OUTPUT_PRIMARY) {
+        output->edidKey = getEdidKey(connector);
+    }
+
+    if (!attachOutput(outputIndex)) {
+        resetOutput(outputIndex);
+        return false;
+    }
 
-    // get drm resources
+    ITRACE("mode is: %dx%d@%dHz", output->mode.hdisplay, output->mode.vdisplay, output->mode.vrefresh);
+    return true;
+}
+
+bool Drm::probeTopology()
+{
     drmModeResPtr resources = drmModeGetResources(mDrmFd);
     if (!resources) {
         ETRACE("fail to get drm resources, error: %s", strerror(errno));
         return false;
     }
 
-    drmModeConnectorPtr connector = NULL;
-    DrmOutput *output = &mOutputs[outputIndex];
-    bool ret = false;
+    memset(&mTopology, 0, sizeof(mTopology));
+    mCrtcIds.clear();
+    for (int i = 0; i < resources->count_crtcs; i++) {
+        if (!resources->crtcs || !resources->crtcs[i]) {
+            ETRACE("fail to get drm resources crtcs, error: %s", strerror(errno));
+            continue;
+        }
+        mCrtcIds.push(resources->crtcs[i]);
+    }
 
-    // find connector for the given device
     for (int i = 0; i < resources->count_connectors; i++) {
         if (!resources->connectors || !resources->connectors[i]) {
             ETRACE("fail to get drm resources connectors, error: %s", strerror(errno));
             continue;
         }
 
-        connector = drmModeGetConnector(mDrmFd, resources->connectors[i]);
+        drmModeConnectorPtr connector = drmModeGetConnector(mDrmFd, resources->connectors[i]);
         if (!connector) {
             ETRACE("drmModeGetConnector failed");
             continue;
         }
 
-        if (connector->connector_type != DrmConfig::getDrmConnector(device)) {
-            drmModeFreeConnector(connector);
-            continue;
-        }
+        for (int j = 0; j < OUTPUT_MAX; j++) {
+            int device = getOutputDevice(j);
+            if (mTopology[j].valid ||
+                connector->connector_type != DrmConfig::getDrmConnector(device)) {
+                continue;
+            }
 
-        if (connector->connection != DRM_MODE_CONNECTED) {
-            ITRACE("device %d is not connected", device);
-            drmModeFreeConnector(connector);
-            ret = true;
+            uint32_t encoderId = findEncoder(device, connector, resources);
+            if (!encoderId) {
+                ETRACE("failed to get drm encoder of device %d", device);
+                break;
+            }
+
+            mTopology[j].connectorId = connector->connector_id;
+            mTopology[j].encoderId = encoderId;
+            mTopology[j].valid = true;
+            ITRACE("device %d: connector %u, encoder %u",
+                device, connector->connector_id, encoderId);
             break;
         }
+        drmModeFreeConnector(connector);
+    }
 
-        output->connector = connector;
-        output->connected = true;
-
-        // get proper encoder for the given connector
-        if (connector->encoder_id) {
-            ITRACE("Drm connector has encoder attached on device %d", device);
-            output->encoder = drmModeGetEncoder(mDrmFd, connector->encoder_id);
-            if (!output->encoder) {
-                ETRACE("failed to get encoder from a known encoder id");
-                // fall through to get an encoder
-            }
+    drmModeFreeResources(resources);
+    return true;
+}
+
+uint32_t Drm::findEncoder(int device, drmModeConnectorPtr connector,
+                          drmModeResPtr resources)
+{
+    // the attached encoder, or one of the right type
+    if (connector->encoder_id) {
+        return connector->encoder_id;
+    }
+
+    for (int i = 0; i < resources->count_encoders; i++) {
+        if (!resources->encoders || !resources->encoders[i]) {
+            ETRACE("fail to get drm resources encoders, error: %s", strerror(errno));
+            continue;
         }
-        if (!output->encoder) {
-            ITRACE("getting encoder for device %d", device);
-            drmModeEncoderPtr encoder;
-            for (int j = 0; j < resources->count_encoders; j++) {
-                if (!resources->encoders || !resources->encoders[j]) {
-                    ETRACE("fail to get drm resources encoders, error: %s", strerror(errno));
-                    continue;
-                }
 
-                encoder = drmModeGetEncoder(mDrmFd, resources->encoders[i]);
-                if (!encoder) {
-                    ETRACE("drmModeGetEncoder failed");
-                    continue;
-                }
-                if (encoder->encoder_type == DrmConfig::getDrmEncoder(device)) {
-                    output->encoder = encoder;
-                    break;
-                }
-                drmModeFreeEncoder(encoder);
-                encoder = NULL;
-            }
+        drmModeEncoderPtr encoder = drmModeGetEncoder(mDrmFd, resources->encoders[i]);
+        if (!encoder) {
+            ETRACE("drmModeGetEncoder failed");
+            continue;
         }
-        if (!output->encoder) {
-            ETRACE("failed to get drm encoder");
-            break;
+
+        uint32_t encoderId = 0;
+        if (encoder->encoder_type == DrmConfig::getDrmEncoder(device)) {
+            encoderId = encoder->encoder_id;
         }
+        drmModeFreeEncoder(encoder);
+        if (encoderId) {
+            return encoderId;
+        }
+    }
+    return 0;
+}
 
-        // get an attached crtc or spare crtc
-        if (output->encoder->crtc_id) {
-            ITRACE("Drm encoder has crtc attached on device %d", device);
-            output->crtc = drmModeGetCrtc(mDrmFd, output->encoder->crtc_id);
-            if (!output->crtc) {
-                ETRACE("failed to get crtc from a known crtc id");
-                // fall through to get a spare crtc
-            }
+bool Drm::attachOutput(int index)
+{
+    DrmOutput *output = &mOutputs[index];
+    int device = getOutputDevice(index);
+
+    output->encoder = drmModeGetEncoder(mDrmFd, mTopology[index].encoderId);
+    if (!output->encoder) {
+        ETRACE("failed to get drm encoder %u", mTopology[index].encoderId);
+        return false;
+    }
+
+    output->crtc = findCrtc(index);
+    if (!output->crtc) {
+        ETRACE("failed to get drm crtc");
+        return false;
+    }
+
+    if (index == OUTPUT_PRIMARY) {
+        if (!readIoctl(DRM_PSB_PANEL_ORIENTATION, &output->panelOrientation, sizeof(int))) {
+            ETRACE("failed to get device %d orientation", device);
+            output->panelOrientation = PANEL_ORIENTATION_0;
         }
-        if (!output->crtc) {
-            ITRACE("getting crtc for device %d", device);
-            drmModeCrtcPtr crtc;
-            for (int j = 0; j < resources->count_crtcs; j++) {
-                if (!resources->crtcs || !resources->crtcs[j]) {
-                    ETRACE("fail to get drm resources crtcs, error: %s", strerror(errno));
-                    continue;
-                }
+    } else {
+        output->panelOrientation = PANEL_ORIENTATION_0;
+    }
 
-                crtc = drmModeGetCrtc(mDrmFd, resources->crtcs[j]);
-                if (!crtc) {
-                    ETRACE("drmModeGetCrtc failed");
-                    continue;
-                }
-                if (crtc->buffer_id == 0) {
-                    output->crtc = crtc;
-                    break;
-                }
-                drmModeFreeCrtc(crtc);
-            }
+    // current mode
+    if (output->crtc->mode_valid) {
+        ITRACE("mode is valid, kernel mode settings");
+        memcpy(&output->mode, &output->crtc->mode, sizeof(drmModeModeInfo));
+        return true;
+    }
+
+    ITRACE("mode is invalid, setting preferred mode");
+    return initDrmMode(index);
+}
+
+drmModeCrtcPtr Drm::findCrtc(int index)
+{
+    DrmOutput *output = &mOutputs[index];
+    drmModeCrtcPtr crtc;
+
+    // get an attached crtc or spare crtc
+    if (output->encoder->crtc_id) {
+        ITRACE("Drm encoder has crtc attached on device %d", getOutputDevice(index));
+        crtc = drmModeGetCrtc(mDrmFd, output->encoder->crtc_id);
+        if (crtc) {
+            return crtc;
         }
-        if (!output->crtc) {
-            ETRACE("failed to get drm crtc");
-            break;
+        ETRACE("failed to get crtc from a known crtc id");
+        // fall through to get a spare crtc
+    }
+
+    for (size_t i = 0; i < mCrtcIds.size(); i++) {
+        crtc = drmModeGetCrtc(mDrmFd, mCrtcIds.itemAt(i));
+        if (!crtc) {
+            ETRACE("drmModeGetCrtc failed");
+            continue;
+        }
+        if (crtc->buffer_id == 0) {
+            return crtc;
         }
+        drmModeFreeCrtc(crtc);
+    }
+    return NULL;
+}
 
-        // current mode
-        if (output->crtc->mode_valid) {
-            ITRACE("mode is valid, kernel mode settings");
-            memcpy(&output->mode, &output->crtc->mode, sizeof(drmModeModeInfo));
-            ret = true;
-        } else {
-            ITRACE("mode is invalid, setting preferred mode");
-            ret = initDrmMode(outputIndex);
+uint32_t Drm::getEdidKey(drmModeConnectorPtr connector)
+{
+    uint32_t key = 0;
+    for (int i = 0; i < connector->count_props && !key; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(mDrmFd, connector->props[i]);
+        if (!prop) {
+            continue;
         }
 
-        if (outputIndex == OUTPUT_PRIMARY) {
-            if (!readIoctl(DRM_PSB_PANEL_ORIENTATION, &output->panelOrientation, sizeof(int))) {
-                ETRACE("failed to get device %d orientation", device);
-                output->panelOrientation = PANEL_ORIENTATION_0;
+        if ((prop->flags & DRM_MODE_PROP_BLOB) && !strcmp(prop->name, "EDID")) {
+            drmModePropertyBlobPtr blob =
+                drmModeGetPropertyBlob(mDrmFd, connector->prop_values[i]);
+            if (blob && blob->data && blob->length) {
+                key = EdidCache::hash(blob->data, blob->length);
+            }
+            if (blob) {
+                drmModeFreePropertyBlob(blob);
             }
-        } else {
-            output->panelOrientation = PANEL_ORIENTATION_0;
         }
-        break;
+        drmModeFreeProperty(prop);
     }
 
-    if (!ret) {
-        if (output->connector == NULL && outputIndex != OUTPUT_PRIMARY) {
-            // a fatal failure on primary device
-            // non fatal on secondary device
-            WTRACE("device %d is disabled?", device);
-            ret = true;
-        }
-         resetOutput(outputIndex);
-    } else if (output->connected) {
-        ITRACE("mode is: %dx%d@%dHz", output->mode.hdisplay, output->mode.vdisplay, output->mode.vrefresh);
+    if (!key) {
+        WTRACE("no EDID on connector %u", connector->connector_id);
     }
+    return key;
+}
 
-    drmModeFreeResources(resources);
-    return ret;
+bool Drm::isSameConnector(drmModeConnectorPtr a, drmModeConnectorPtr b) const
+{
+    if (!a || !b) {
+        return false;
+    }
+
+    if (a->connection != b->connection ||
+        a->mmWidth != b->mmWidth ||
+        a->mmHeight != b->mmHeight ||
+        a->count_modes != b->count_modes) {
+        return false;
+    }
+
+    if (a->count_modes > 0 &&
+        memcmp(a->modes, b->modes, a->count_modes * sizeof(drmModeModeInfo))) {
+        return false;
+    }
+    return true;
 }
 
 bool Drm::isSameDrmMode(drmModeModeInfoPtr value,
@@ -292,7 +433,9 @@ bool Drm::setRefreshRate(int device, int hz)
     RETURN_FALSE_IF_NOT_INIT();
     Mutex::Autolock _l(mLock);
 
-    if (device != IDisplayDevice::DEVICE_EXTERNAL) {
+    // the primary panel only switches between the rates of its mode list
+    if (device != IDisplayDevice::DEVICE_EXTERNAL &&
+        device != IDisplayDevice::DEVICE_PRIMARY) {
         WTRACE("Setting mode on invalid device %d", device);
         return false;
     }
@@ -333,6 +476,124 @@ bool Drm::setRefreshRate(int device, int hz)
     return setDrmMode(outputIndex, mode);
 }
 
+bool Drm::hasRefreshRate(int device, int hz)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        return false;
+    }
+
+    DrmOutput *output = &mOutputs[outputIndex];
+    if (!output->connected || !output->connector) {
+        return false;
+    }
+
+    for (int i = 0; i < output->connector->count_modes; i++) {
+        drmModeModeInfoPtr mode = &output->connector->modes[i];
+        if (mode->hdisplay == output->mode.hdisplay &&
+            mode->vdisplay == output->mode.vdisplay &&
+            mode->vrefresh == (uint32_t)hz) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Drm::queueRefreshRate(int device, int hz)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        ETRACE("invalid device");
+        return false;
+    }
+
+    DrmOutput *output = &mOutputs[outputIndex];
+    if (!output->connected || !output->connector) {
+        ETRACE("device is not connected");
+        return false;
+    }
+
+    for (int i = 0; i < output->connector->count_modes; i++) {
+        drmModeModeInfoPtr mode = &output->connector->modes[i];
+        if (mode->hdisplay != output->mode.hdisplay ||
+            mode->vdisplay != output->mode.vdisplay ||
+            mode->vrefresh != (uint32_t)hz) {
+            continue;
+        }
+
+        // a switch back before the commit cancels the queued one
+        output->modePending = !isSameDrmMode(mode, &output->mode);
+        memcpy(&output->pendingMode, mode, sizeof(drmModeModeInfo));
+        return true;
+    }
+    WTRACE("no %dHz mode on device %d", hz, device);
+    return false;
+}
+
+bool Drm::hasPendingMode(int device)
+{
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    return outputIndex >= 0 && mOutputs[outputIndex].modePending;
+}
+
+bool Drm::setPendingMode(int device, buffer_handle_t handle, int width,
+                         int height, int stride, int format)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        return false;
+    }
+
+    DrmOutput *output = &mOutputs[outputIndex];
+    if (!output->modePending || !output->connected || !output->crtc) {
+        output->modePending = false;
+        return false;
+    }
+
+    drmModeModeInfo mode;
+    memcpy(&mode, &output->pendingMode, sizeof(drmModeModeInfo));
+    if (!handle) {
+        return setDrmMode(outputIndex, &mode);
+    }
+
+    if (width != mode.hdisplay || height != mode.vdisplay) {
+        return false;
+    }
+
+    // the buffer stays in the async flip cache, the next post releases it
+    // as it does the buffer of the last flip
+    uint32_t fbId = getAsyncFb(outputIndex, handle, width, height, stride,
+                               format);
+    if (!fbId) {
+        return false;
+    }
+
+    ITRACE("mode switch: %dx%d@%dHz", mode.hdisplay, mode.vdisplay, mode.vrefresh);
+
+    int ret = drmModeSetCrtc(mDrmFd, output->crtc->crtc_id, fbId, 0, 0,
+                   &output->connector->connector_id, 1, &mode);
+    if (ret != 0) {
+        ETRACE("drmModeSetCrtc failed. error: %d", ret);
+        return false;
+    }
+
+    output->asyncFbId = fbId;
+    memcpy(&output->mode, &mode, sizeof(drmModeModeInfo));
+    output->modePending = false;
+    return true;
+}
+
 bool Drm::writeReadIoctl(unsigned long cmd, void *data,
                            unsigned long size)
 {
@@ -382,6 +643,132 @@ bool Drm::writeIoctl(unsigned long cmd, void *data,
 }
 
 
+void Drm::beginPlaneUpdates()
+{
+    // send whatever is left over from a frame that was never committed
+    submitPlaneUpdates();
+    submitDeferredPlaneUpdates();
+
+    Mutex::Autolock _l(mPlaneUpdateLock);
+    mPlaneUpdatesOpen = true;
+}
+
+bool Drm::updatePlane(const struct drm_psb_register_rw_arg& arg,
+                      DisplayPlane *plane)
+{
+    {
+        Mutex::Autolock _l(mPlaneUpdateLock);
+        if (mPlaneUpdatesOpen) {
+            // a later update of the plane replaces an earlier one with the
+            // same context, a different context (e.g. a pipe switch of the
+            // overlay) has to reach the kernel in order
+            for (size_t i = 0; i < mPlaneUpdates.size(); i++) {
+                const struct drm_psb_register_rw_arg& queued =
+                    mPlaneUpdates.itemAt(i).arg;
+                if (queued.plane.type == arg.plane.type &&
+                    queued.plane.index == arg.plane.index &&
+                    queued.plane.ctx == arg.plane.ctx) {
+                    VTRACE("merged update of plane %d:%d",
+                        arg.plane.type, arg.plane.index);
+                    mPlaneUpdates.removeAt(i);
+                    mPlaneUpdateStats.merged++;
+                    break;
+                }
+            }
+            PlaneUpdate update;
+            update.arg = arg;
+            update.plane = plane;
+            mPlaneUpdates.push_back(update);
+            return true;
+        }
+    }
+
+    struct drm_psb_register_rw_arg data = arg;
+    return writeReadIoctl(DRM_PSB_REGISTER_RW, &data, sizeof(data));
+}
+
+bool Drm::submitPlaneUpdates()
+{
+    Vector<PlaneUpdate> updates;
+    {
+        Mutex::Autolock _l(mPlaneUpdateLock);
+        mPlaneUpdatesOpen = false;
+        if (mPlaneUpdates.size() == 0) {
+            return true;
+        }
+        mPlaneUpdateStats.batches++;
+
+        // the content under a plane that goes away is only on the screen
+        // after the flip. A plane with other updates in the batch, e.g.
+        // moving to another pipe, keeps the order of its updates.
+        for (size_t i = 0; i < mPlaneUpdates.size(); i++) {
+            const struct drm_psb_register_rw_arg& arg = mPlaneUpdates.itemAt(i).arg;
+            bool deferred = arg.plane_disable_mask != 0;
+            for (size_t j = 0; deferred && j < mPlaneUpdates.size(); j++) {
+                const struct drm_psb_register_rw_arg& other = mPlaneUpdates.itemAt(j).arg;
+                if (j != i && other.plane.type == arg.plane.type &&
+                    other.plane.index == arg.plane.index) {
+                    deferred = false;
+                }
+            }
+            if (deferred) {
+                mDeferredPlaneUpdates.push_back(mPlaneUpdates.itemAt(i));
+                mPlaneUpdateStats.deferred++;
+            } else {
+                updates.push_back(mPlaneUpdates.itemAt(i));
+            }
+        }
+        mPlaneUpdates.clear();
+        mPlaneUpdateStats.ioctls += updates.size();
+    }
+
+    bool ret = true;
+    for (size_t i = 0; i < updates.size(); i++) {
+        PlaneUpdate& update = updates.editItemAt(i);
+        struct drm_psb_register_rw_arg& arg = update.arg;
+        bool enable = arg.plane_enable_mask != 0;
+        if (!writeReadIoctl(DRM_PSB_REGISTER_RW, &arg, sizeof(arg))) {
+            WTRACE("failed to update plane %d:%d",
+                arg.plane.type, arg.plane.index);
+            // the plane manager took the enable as done
+            if (enable && update.plane) {
+                update.plane->setUpdateFailed();
+            }
+            ret = false;
+        }
+    }
+
+    VTRACE("submitted %zu plane updates", updates.size());
+    return ret;
+}
+
+bool Drm::submitDeferredPlaneUpdates()
+{
+    Vector<PlaneUpdate> updates;
+    {
+        Mutex::Autolock _l(mPlaneUpdateLock);
+        if (mDeferredPlaneUpdates.size() == 0) {
+            return true;
+        }
+        updates = mDeferredPlaneUpdates;
+        mDeferredPlaneUpdates.clear();
+        mPlaneUpdateStats.ioctls += updates.size();
+    }
+
+    bool ret = true;
+    for (size_t i = 0; i < updates.size(); i++) {
+        struct drm_psb_register_rw_arg& arg = updates.editItemAt(i).arg;
+        if (!writeReadIoctl(DRM_PSB_REGISTER_RW, &arg, sizeof(arg))) {
+            WTRACE("failed to disable plane %d:%d",
+                arg.plane.type, arg.plane.index);
+            ret = false;
+        }
+    }
+
+    VTRACE("submitted %zu deferred plane updates", updates.size());
+    return ret;
+}
+
 bool Drm::readIoctl(unsigned long cmd, void *data,
                        unsigned long size)
 {
@@ -407,6 +794,20 @@ bool Drm::readIoctl(unsigned long cmd, void *data,
 }
 
 
+void Drm::dump(Dump& d)
+{
+    {
+        Mutex::Autolock _l(mPlaneUpdateLock);
+        d.append("Plane update batches: %u, ioctls %u, merged %u, "
+                 "disables after flip %u\n",
+                 mPlaneUpdateStats.batches, mPlaneUpdateStats.ioctls,
+                 mPlaneUpdateStats.merged, mPlaneUpdateStats.deferred);
+    }
+
+    Mutex::Autolock _l(mLock);
+    mEdidCache.dump(d);
+}
+
 int Drm::getDrmFd() const
 {
     return mDrmFd;
@@ -523,6 +924,8 @@ void Drm::resetOutput(int index)
     DrmOutput *output = &mOutputs[index];
 
     output->connected = false;
+    output->edidKey = 0;
+    output->modePending = false;
     memset(&output->mode, 0, sizeof(drmModeModeInfo));
 
     if (output->connector) {
@@ -537,6 +940,7 @@ void Drm::resetOutput(int index)
         drmModeFreeCrtc(output->crtc);
         output->crtc = 0;
     }
+    releaseAsyncFbs(index);
     if (output->fbId) {
         drmModeRmFB(mDrmFd, output->fbId);
         output->fbId = 0;
@@ -566,7 +970,45 @@ bool Drm::initDrmMode(int outputIndex)
         }
     }
 
-    return setDrmMode(outputIndex, &output->connector->modes[index]);
+    // a known sink gets the mode it was last used with
+    drmModeModeInfo lastMode;
+    if (output->edidKey &&
+        mEdidCache.getLastMode(output->edidKey, output->connector, lastMode)) {
+        for (int i = 0; i < output->connector->count_modes; i++) {
+            if (isSameDrmMode(&lastMode, &output->connector->modes[i])) {
+                ITRACE("restoring mode %dx%d@%dHz", lastMode.hdisplay,
+                    lastMode.vdisplay, lastMode.vrefresh);
+                index = i;
+                break;
+            }
+        }
+    }
+
+    if (!setDrmMode(outputIndex, &output->connector->modes[index])) {
+        return false;
+    }
+    rememberMode(outputIndex);
+    return true;
+}
+
+void Drm::rememberMode(int index)
+{
+    DrmOutput *output = &mOutputs[index];
+    if (output->edidKey) {
+        mEdidCache.setLastMode(output->edidKey, output->connector, output->mode);
+    }
+}
+
+void Drm::rememberActiveMode(int device)
+{
+    RETURN_VOID_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0 || !mOutputs[outputIndex].connected) {
+        return;
+    }
+    rememberMode(outputIndex);
 }
 
 bool Drm::setDrmMode(int index, drmModeModeInfoPtr mode)
@@ -579,10 +1021,12 @@ bool Drm::setDrmMode(int index, drmModeModeInfoPtr mode)
     drmModeModeInfo currentMode;
     memcpy(&currentMode, &output->mode, sizeof(drmModeModeInfo));
 
+    // a mode set supersedes a queued refresh switch
+    output->modePending = false;
+
     if (isSameDrmMode(mode, &currentMode))
         return true;
 
-
     if (output->fbId) {
         oldFbId = output->fbId;
         output->fbId = 0;
@@ -633,6 +1077,8 @@ bool Drm::setDrmMode(int index, drmModeModeInfoPtr mode)
     ret = drmModeSetCrtc(mDrmFd, output->crtc->crtc_id, output->fbId, 0, 0,
                    &output->connector->connector_id, 1, mode);
     if (ret == 0) {
+        // the pipe left the frame buffers of the async flips
+        releaseAsyncFbs(index);
         //save mode
         memcpy(&output->mode, mode, sizeof(drmModeModeInfo));
     } else {
@@ -665,6 +1111,20 @@ int Drm::getOutputIndex(int device)
     return -1;
 }
 
+int Drm::getOutputDevice(int index)
+{
+    switch (index) {
+    case OUTPUT_PRIMARY:
+        return IDisplayDevice::DEVICE_PRIMARY;
+    case OUTPUT_EXTERNAL:
+        return IDisplayDevice::DEVICE_EXTERNAL;
+    default:
+        break;
+    }
+
+    return -1;
+}
+
 int Drm::getPanelOrientation(int device)
 {
     int outputIndex = getOutputIndex(device);
@@ -682,6 +1142,245 @@ int Drm::getPanelOrientation(int device)
     return output->panelOrientation;
 }
 
+int Drm::getGammaSize(int device)
+{
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        return 0;
+    }
+
+    DrmOutput *output = &mOutputs[outputIndex];
+    if (!output->connected || !output->crtc) {
+        return 0;
+    }
+    return output->crtc->gamma_size;
+}
+
+bool Drm::setGamma(int device, uint16_t *red, uint16_t *green,
+                   uint16_t *blue, int size)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        return false;
+    }
+
+    DrmOutput *output = &mOutputs[outputIndex];
+    if (!output->connected || !output->crtc ||
+        size != output->crtc->gamma_size) {
+        ETRACE("no gamma LUT of %d entries on device %d", size, device);
+        return false;
+    }
+
+    int ret = drmModeCrtcSetGamma(mDrmFd, output->crtc->crtc_id, size,
+                                  red, green, blue);
+    if (ret != 0) {
+        ETRACE("failed to set gamma on device %d, error = %d", device, ret);
+        return false;
+    }
+    return true;
+}
+
+bool Drm::setConnectorProperty(int index, const char *name, uint64_t value)
+{
+    DrmOutput *output = &mOutputs[index];
+    for (int i = 0; i < output->connector->count_props; i++) {
+        drmModePropertyPtr prop = drmModeGetProperty(mDrmFd, output->connector->props[i]);
+        if (!prop) {
+            continue;
+        }
+        if (strcmp(prop->name, name)) {
+            drmModeFreeProperty(prop);
+            continue;
+        }
+
+        int ret = drmModeConnectorSetProperty(mDrmFd,
+            output->connector->connector_id, prop->prop_id, value);
+        drmModeFreeProperty(prop);
+        if (ret != 0) {
+            WTRACE("failed to set %s to %llu, error = %d", name,
+                   (unsigned long long)value, ret);
+            return false;
+        }
+        return true;
+    }
+
+    DTRACE("connector has no %s property", name);
+    return false;
+}
+
+bool Drm::setPanelFitter(int device, int scaling, int hBorder, int vBorder)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        return false;
+    }
+
+    DrmOutput *output = &mOutputs[outputIndex];
+    if (!output->connected || !output->connector) {
+        ETRACE("device %d is not connected", device);
+        return false;
+    }
+
+    if (!setConnectorProperty(outputIndex, "scaling mode", scaling)) {
+        return false;
+    }
+
+    // a kernel without underscan still fits without borders
+    bool underscan = hBorder || vBorder;
+    if (underscan &&
+        (!setConnectorProperty(outputIndex, "underscan hborder", hBorder) ||
+         !setConnectorProperty(outputIndex, "underscan vborder", vBorder))) {
+        return false;
+    }
+    if (!setConnectorProperty(outputIndex, "underscan", underscan ? 1 : 0) &&
+        underscan) {
+        return false;
+    }
+
+    ITRACE("panel fitter of device %d: scaling %d, borders %dx%d",
+           device, scaling, hBorder, vBorder);
+    return true;
+}
+
+bool Drm::flipAsync(int device, buffer_handle_t handle, int width,
+                    int height, int stride, int format)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+#ifdef DRM_MODE_PAGE_FLIP_ASYNC
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        return false;
+    }
+
+    DrmOutput *output = &mOutputs[outputIndex];
+    if (!output->connected || !output->crtc || output->asyncBroken ||
+        width != output->mode.hdisplay || height != output->mode.vdisplay) {
+        return false;
+    }
+
+    uint32_t fbId = getAsyncFb(outputIndex, handle, width, height, stride,
+                               format);
+    if (!fbId) {
+        return false;
+    }
+
+    int ret = drmModePageFlip(mDrmFd, output->crtc->crtc_id, fbId,
+                              DRM_MODE_PAGE_FLIP_ASYNC, NULL);
+    if (ret != 0) {
+        // busy with the previous flip is transient, anything else means
+        // the kernel does not do async flips on this pipe
+        if (errno != EBUSY) {
+            ETRACE("async flip failed on device %d, error = %d", device, ret);
+            output->asyncBroken = true;
+        }
+        return false;
+    }
+    output->asyncFbId = fbId;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Drm::endAsyncFlips(int device)
+{
+    Mutex::Autolock _l(mLock);
+
+    int outputIndex = getOutputIndex(device);
+    if (outputIndex < 0) {
+        return;
+    }
+    releaseAsyncFbs(outputIndex);
+}
+
+uint32_t Drm::getAsyncFb(int index, buffer_handle_t handle, int width,
+                         int height, int stride, int format)
+{
+    DrmOutput *output = &mOutputs[index];
+    AsyncFb *victim = NULL;
+    output->asyncUses++;
+
+    // a freed buffer handle may be reused by a new allocation, the stamp
+    // of the allocation is not
+    uint64_t stamp = ((const IMG_native_handle_t *)handle)->ui64Stamp;
+    for (int i = 0; i < ASYNC_FB_CACHE_SIZE; i++) {
+        AsyncFb& fb = output->asyncFbs[i];
+        if (fb.fbId && fb.stamp == stamp && fb.width == width &&
+            fb.height == height && fb.stride == stride &&
+            fb.format == format) {
+            fb.lastUse = output->asyncUses;
+            return fb.fbId;
+        }
+
+        // the frame buffer being scanned out is never removed
+        if (fb.fbId == output->asyncFbId && fb.fbId) {
+            continue;
+        }
+        if (!victim || !fb.fbId ||
+            (victim->fbId && fb.lastUse < victim->lastUse)) {
+            victim = &fb;
+        }
+    }
+
+    if (!victim) {
+        return 0;
+    }
+    if (victim->fbId) {
+        drmModeRmFB(mDrmFd, victim->fbId);
+        victim->fbId = 0;
+    }
+
+    // the buffer handle goes in bo_handles[0] and bo_handles[1], as for
+    // the frame buffer of the mode set
+    uint32_t bo_handles[4] = {0};
+    uint32_t pitches[4] = {0};
+    uint32_t offsets[4] = {0};
+    bo_handles[0] = ((unsigned long)(handle)) & 0xffffffff;
+    bo_handles[1] = ((unsigned long)(handle) >> 32) & 0xffffffff;
+    pitches[0] = stride;
+
+    uint32_t fbId = 0;
+    int ret = drmModeAddFB2(mDrmFd, width, height,
+                            DrmConfig::convertHalFormatToDrmFormat(format),
+                            bo_handles, pitches, offsets, &fbId, 0);
+    if (ret != 0) {
+        ETRACE("drmModeAddFB2 failed, error: %d", ret);
+        return 0;
+    }
+
+    victim->stamp = stamp;
+    victim->width = width;
+    victim->height = height;
+    victim->stride = stride;
+    victim->format = format;
+    victim->fbId = fbId;
+    victim->lastUse = output->asyncUses;
+    return fbId;
+}
+
+void Drm::releaseAsyncFbs(int index)
+{
+    DrmOutput *output = &mOutputs[index];
+    for (int i = 0; i < ASYNC_FB_CACHE_SIZE; i++) {
+        AsyncFb& fb = output->asyncFbs[i];
+        if (fb.fbId) {
+            drmModeRmFB(mDrmFd, fb.fbId);
+        }
+        memset(&fb, 0, sizeof(fb));
+    }
+    output->asyncFbId = 0;
+}
+
 // HWC 1.4 requires that we return all of the compatible configs in getDisplayConfigs
 // this is needed so getActiveConfig/setActiveConfig work correctly.  It is up to the
 // user space to decide what speed to send.
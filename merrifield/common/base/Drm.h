@@ -17,7 +17,10 @@
 #define __DRM_H__
 
 #include <utils/Mutex.h>
+#include <utils/Vector.h>
 #include <hardware/hwcomposer.h>
+#include <Dump.h>
+#include <EdidCache.h>
 
 // TODO: psb_drm.h is IP specific defintion
 #include <linux/psb_drm.h>
@@ -30,44 +33,119 @@ extern "C" {
 namespace android {
 namespace intel {
 
+class DisplayPlane;
+
 enum {
     PANEL_ORIENTATION_0 = 0,
     PANEL_ORIENTATION_180
 };
 
+// the kernel facing operations are virtual, a simulated device of the
+// mock platform (test/mock) overrides them
 class Drm {
 public:
     Drm();
     virtual ~Drm();
 public:
-    bool initialize();
-    void deinitialize();
-    bool detect(int device);
-    bool setDrmMode(int device, drmModeModeInfo& value);
-    bool setRefreshRate(int device, int hz);
-    bool writeReadIoctl(unsigned long cmd, void *data,
+    virtual bool initialize();
+    virtual void deinitialize();
+    virtual bool detect(int device);
+    virtual bool setDrmMode(int device, drmModeModeInfo& value);
+    virtual bool setRefreshRate(int device, int hz);
+    // the mode of the current size at hz is set with the next frame, by
+    // setPendingMode() from the commit; false if there is no such mode
+    virtual bool queueRefreshRate(int device, int hz);
+    virtual bool hasPendingMode(int device);
+    // sets the mode queued for device. Given a buffer of the screen size
+    // in a 32-bit RGB format, stride in bytes, the pipe switches scanning
+    // that buffer out, so the frame shows up in the new timings without a
+    // blank; false then leaves the mode queued. Without a buffer it is a
+    // full mode set, the pipe shows a blank frame buffer until the post.
+    virtual bool setPendingMode(int device, buffer_handle_t handle, int width,
+                                int height, int stride, int format);
+    // the current mode of device is restored the next time its sink is
+    // plugged. Only the modes picked on hotplug and by setActiveConfig are
+    // kept, not the refresh switches made for the content.
+    void rememberActiveMode(int device);
+    // whether the device has a mode of the current resolution at hz
+    virtual bool hasRefreshRate(int device, int hz);
+    virtual bool writeReadIoctl(unsigned long cmd, void *data,
                       unsigned long size);
-    bool writeIoctl(unsigned long cmd, void *data,
+    virtual bool writeIoctl(unsigned long cmd, void *data,
                       unsigned long size);
-    bool readIoctl(unsigned long cmd, void *data,
+    virtual bool readIoctl(unsigned long cmd, void *data,
                       unsigned long size);
 
-    bool isConnected(int device);
-    bool setDpmsMode(int device, int mode);
-    int getDrmFd() const;
-    bool getModeInfo(int device, drmModeModeInfo& mode);
-    bool getPhysicalSize(int device, uint32_t& width, uint32_t& height);
+    virtual bool isConnected(int device);
+    virtual bool setDpmsMode(int device, int mode);
+    virtual int getDrmFd() const;
+    virtual bool getModeInfo(int device, drmModeModeInfo& mode);
+    virtual bool getPhysicalSize(int device, uint32_t& width, uint32_t& height);
     bool isSameDrmMode(drmModeModeInfoPtr mode, drmModeModeInfoPtr base) const;
-    int getPanelOrientation(int device);
-    drmModeModeInfoPtr detectAllConfigs(int device, int *modeCount);
+    virtual int getPanelOrientation(int device);
+    // entries of each channel of the gamma LUT of the pipe of device, 0 if
+    // the pipe has none
+    virtual int getGammaSize(int device);
+    virtual bool setGamma(int device, uint16_t *red, uint16_t *green,
+                          uint16_t *blue, int size);
+    virtual drmModeModeInfoPtr detectAllConfigs(int device, int *modeCount);
+    // panel fitter of the pipe of device: scaling is a DRM_MODE_SCALE_*
+    // mode of the "scaling mode" connector property, hBorder and vBorder
+    // shrink the fitter output by that many pixels on each side through
+    // the "underscan" properties. Returns false if the kernel has no such
+    // property or refused the value, the frames then have to be composed
+    // scaled.
+    virtual bool setPanelFitter(int device, int scaling, int hBorder,
+                                int vBorder);
+    // immediate flip of the pipe of device to a buffer of the screen size
+    // in a 32-bit RGB format, stride in bytes; the flip may tear. Returns false if it was not
+    // done, the buffer then has to be posted.
+    virtual bool flipAsync(int device, buffer_handle_t handle, int width,
+                           int height, int stride, int format);
+    // the buffers of the async flips were replaced by a post, their frame
+    // buffers are removed
+    virtual void endAsyncFlips(int device);
+
+    // plane enable/disable updates issued between beginPlaneUpdates() and
+    // submitPlaneUpdates() are queued and sent together, updates of the
+    // same plane with the same context are merged. Outside of a batch
+    // updatePlane() issues the ioctl immediately.
+    void beginPlaneUpdates();
+    bool updatePlane(const struct drm_psb_register_rw_arg& arg,
+                     DisplayPlane *plane = NULL);
+    // sent before the flip. A plane that is only disabled keeps showing the
+    // last frame until submitDeferredPlaneUpdates() after the flip. A
+    // plane whose queued enable fails is marked, its layer goes to GLES
+    // with the next prepare.
+    bool submitPlaneUpdates();
+    bool submitDeferredPlaneUpdates();
+
+    virtual void dump(Dump& d);
 
 private:
     bool initDrmMode(int index);
     bool setDrmMode(int index, drmModeModeInfoPtr mode);
+    void rememberMode(int index);
     void resetOutput(int index);
+    bool probeTopology();
+    uint32_t findEncoder(int device, drmModeConnectorPtr connector,
+                         drmModeResPtr resources);
+    bool attachOutput(int index);
+    drmModeCrtcPtr findCrtc(int index);
+    bool isSameConnector(drmModeConnectorPtr a, drmModeConnectorPtr b) const;
+    // hash of the EDID of the sink, 0 if it has none
+    uint32_t getEdidKey(drmModeConnectorPtr connector);
 
     // map device type to output index, return -1 if not mapped
     inline int getOutputIndex(int device);
+    inline int getOutputDevice(int index);
+
+    // frame buffer of a buffer shown by async flips, 0 on failure
+    uint32_t getAsyncFb(int index, buffer_handle_t handle, int width,
+                        int height, int stride, int format);
+    void releaseAsyncFbs(int index);
+    // false if the connector has no property of that name
+    bool setConnectorProperty(int index, const char *name, uint64_t value);
 
 private:
     // DRM object index
@@ -77,6 +155,22 @@ private:
         OUTPUT_MAX,
     };
 
+    enum {
+        // swap chain of a game, plus a spare
+        ASYNC_FB_CACHE_SIZE = 4,
+    };
+
+    struct AsyncFb {
+        // of the gralloc allocation
+        uint64_t stamp;
+        int width;
+        int height;
+        int stride;
+        int format;
+        uint32_t fbId;
+        uint32_t lastUse;
+    };
+
     struct DrmOutput {
         drmModeConnectorPtr connector;
         drmModeEncoderPtr encoder;
@@ -86,11 +180,50 @@ private:
         uint32_t fbId;
         int connected;
         int panelOrientation;
+        uint32_t edidKey;
+        // frame buffers of the async flips, the one scanned out is
+        // asyncFbId; the cache is dropped once a post replaced them
+        AsyncFb asyncFbs[ASYNC_FB_CACHE_SIZE];
+        uint32_t asyncFbId;
+        uint32_t asyncUses;
+        // the kernel refused an async flip, not tried again
+        bool asyncBroken;
+        // queued by queueRefreshRate(), set by the next commit
+        drmModeModeInfo pendingMode;
+        bool modePending;
     } mOutputs[OUTPUT_MAX];
 
+    // DRM objects of each output, probed once so that a hotplug only has
+    // to get the status and modes of its connector
+    struct DrmTopology {
+        uint32_t connectorId;
+        uint32_t encoderId;
+        bool valid;
+    } mTopology[OUTPUT_MAX];
+    Vector<uint32_t> mCrtcIds;
+
+    // last mode of each HDMI sink, saved in the background
+    EdidCache mEdidCache;
+
     int mDrmFd;
     Mutex mLock;
     bool mInitialized;
+
+    // queued plane updates, protected by mPlaneUpdateLock
+    struct PlaneUpdate {
+        struct drm_psb_register_rw_arg arg;
+        DisplayPlane *plane;
+    };
+    Mutex mPlaneUpdateLock;
+    Vector<PlaneUpdate> mPlaneUpdates;
+    Vector<PlaneUpdate> mDeferredPlaneUpdates;
+    bool mPlaneUpdatesOpen;
+    struct {
+        uint32_t batches;
+        uint32_t ioctls;
+        uint32_t merged;
+        uint32_t deferred;
+    } mPlaneUpdateStats;
 };
 
 } // namespace intel
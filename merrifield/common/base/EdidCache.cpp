@@ -0,0 +1,317 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <TaskQueue.h>
+#include <EdidCache.h>
+
+namespace android {
+namespace intel {
+
+static const uint32_t EDID_CACHE_MAGIC = 0x43444548; // "HEDC"
+
+EdidCache::EdidCache()
+    : mLock(),
+      mEntries(),
+      mHits(0),
+      mMisses(0),
+      mDirty(false),
+      mSaveTask(-1)
+{
+    mPath[0] = '\0';
+}
+
+EdidCache::~EdidCache()
+{
+    deinitialize();
+}
+
+bool EdidCache::initialize()
+{
+    mHits = 0;
+    mMisses = 0;
+    if (property_get("hwc.edid.cache", mPath, "") <= 0) {
+        mPath[0] = '\0';
+        return true;
+    }
+
+    // not fatal, the cache starts out empty
+    if (!load()) {
+        WTRACE("failed to load edid cache from %s", mPath);
+    }
+    return true;
+}
+
+void EdidCache::deinitialize()
+{
+    // the task queue may be gone already, it drops its tasks then
+    int task;
+    {
+        Mutex::Autolock _l(mLock);
+        task = mSaveTask;
+        mSaveTask = -1;
+    }
+    TaskQueue *queue = Hwcomposer::getInstance().getTaskQueue();
+    if (task >= 0 && queue) {
+        queue->remove(task);
+    }
+    if (mPath[0] && !save()) {
+        WTRACE("failed to save edid cache to %s", mPath);
+    }
+
+    Mutex::Autolock _l(mLock);
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        delete mEntries.itemAt(i);
+    }
+    mEntries.clear();
+}
+
+uint32_t EdidCache::hash(const void *edid, size_t size)
+{
+    // FNV-1a over the EDID bytes
+    const uint8_t *p = (const uint8_t *)edid;
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 16777619UL;
+    }
+    // 0 stands for no EDID
+    return h ? h : 1;
+}
+
+int EdidCache::find(uint32_t key)
+{
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        if (mEntries.itemAt(i)->key == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool EdidCache::getLastMode(uint32_t key, drmModeConnectorPtr connector,
+                            drmModeModeInfo& mode)
+{
+    Mutex::Autolock _l(mLock);
+    int index = find(key);
+    if (index < 0) {
+        mMisses++;
+        return false;
+    }
+
+    Entry *entry = mEntries.itemAt(index);
+    for (int i = 0; i < connector->count_modes; i++) {
+        if (!memcmp(&connector->modes[i], &entry->lastMode, sizeof(drmModeModeInfo))) {
+            mode = entry->lastMode;
+            mHits++;
+            return true;
+        }
+    }
+
+    // the sink doesn't offer the mode any more
+    mMisses++;
+    return false;
+}
+
+void EdidCache::setLastMode(uint32_t key, drmModeConnectorPtr connector,
+                            const drmModeModeInfo& mode)
+{
+    Mutex::Autolock _l(mLock);
+    Entry *entry = NULL;
+    int index = find(key);
+    if (index >= 0) {
+        entry = mEntries.itemAt(index);
+        if (index == 0 &&
+            !memcmp(&entry->lastMode, &mode, sizeof(drmModeModeInfo))) {
+            return;
+        }
+        mEntries.removeAt(index);
+    } else if (mEntries.size() >= CACHE_CAPACITY) {
+        // evict the least recently used entry
+        entry = mEntries.top();
+        mEntries.pop();
+    } else {
+        entry = new Entry;
+    }
+
+    entry->key = key;
+    entry->preferred = -1;
+    entry->lastMode = mode;
+    entry->modes.clear();
+    for (int i = 0; i < connector->count_modes; i++) {
+        if (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            entry->preferred = i;
+        }
+        entry->modes.push_back(connector->modes[i]);
+    }
+    mEntries.insertAt(entry, 0);
+
+    mDirty = true;
+    scheduleSaveLocked();
+}
+
+void EdidCache::scheduleSaveLocked()
+{
+    if (!mPath[0] || mSaveTask >= 0) {
+        return;
+    }
+
+    // without the queue the change is saved with the next one, or on exit
+    TaskQueue *queue = Hwcomposer::getInstance().getTaskQueue();
+    if (queue) {
+        mSaveTask = queue->post(TaskQueue::LANE_BACKGROUND, saveTask, this,
+                                ms2ns(SAVE_DELAY_MS));
+    }
+}
+
+void EdidCache::saveTask(void *data)
+{
+    EdidCache *cache = static_cast<EdidCache*>(data);
+    {
+        Mutex::Autolock _l(cache->mLock);
+        cache->mSaveTask = -1;
+    }
+    if (!cache->save()) {
+        WTRACE("failed to save edid cache to %s", cache->mPath);
+    }
+}
+
+bool EdidCache::load()
+{
+    FILE *fp = fopen(mPath, "rb");
+    if (!fp) {
+        // nothing saved yet
+        return true;
+    }
+
+    bool ret = true;
+    uint32_t header[3];
+    if (fread(header, sizeof(header), 1, fp) != 1 ||
+        header[0] != EDID_CACHE_MAGIC ||
+        header[1] != FILE_VERSION ||
+        header[2] > CACHE_CAPACITY) {
+        WTRACE("invalid edid cache file");
+        fclose(fp);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header[2]; i++) {
+        Entry *entry = new Entry;
+        int32_t fields[3];
+        if (fread(fields, sizeof(fields), 1, fp) != 1 ||
+            fread(&entry->lastMode, sizeof(drmModeModeInfo), 1, fp) != 1 ||
+            fields[2] < 0 || fields[2] > 256) {
+            delete entry;
+            ret = false;
+            break;
+        }
+
+        entry->key = (uint32_t)fields[0];
+        entry->preferred = fields[1];
+        drmModeModeInfo mode;
+        for (int32_t j = 0; j < fields[2]; j++) {
+            if (fread(&mode, sizeof(mode), 1, fp) != 1) {
+                break;
+            }
+            entry->modes.push_back(mode);
+        }
+        if ((int32_t)entry->modes.size() != fields[2]) {
+            delete entry;
+            ret = false;
+            break;
+        }
+        mEntries.push_back(entry);
+    }
+
+    fclose(fp);
+    ITRACE("%zu sinks in edid cache", mEntries.size());
+    return ret;
+}
+
+static void append(Vector<uint8_t>& data, const void *p, size_t size)
+{
+    data.appendArray((const uint8_t *)p, size);
+}
+
+bool EdidCache::save()
+{
+    // the entries are copied out, the file is written unlocked
+    Vector<uint8_t> data;
+    {
+        Mutex::Autolock _l(mLock);
+        if (!mDirty) {
+            return true;
+        }
+        mDirty = false;
+
+        uint32_t header[3] = {EDID_CACHE_MAGIC, FILE_VERSION, (uint32_t)mEntries.size()};
+        append(data, header, sizeof(header));
+        for (size_t i = 0; i < mEntries.size(); i++) {
+            Entry *entry = mEntries.itemAt(i);
+            int32_t fields[3] = {(int32_t)entry->key, entry->preferred,
+                                 (int32_t)entry->modes.size()};
+            append(data, fields, sizeof(fields));
+            append(data, &entry->lastMode, sizeof(drmModeModeInfo));
+            if (!entry->modes.isEmpty()) {
+                append(data, entry->modes.array(),
+                       entry->modes.size() * sizeof(drmModeModeInfo));
+            }
+        }
+    }
+
+    // write a new file, sync it and move it over the old one, a crash in
+    // between leaves the old file intact
+    char path[PROPERTY_VALUE_MAX + 4];
+    snprintf(path, sizeof(path), "%s.tmp", mPath);
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+
+    bool ret = fwrite(data.array(), 1, data.size(), fp) == data.size() &&
+               fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) {
+        ret = false;
+    }
+    if (!ret || rename(path, mPath) != 0) {
+        remove(path);
+        // retried with the next change, or on exit
+        Mutex::Autolock _l(mLock);
+        mDirty = true;
+        return false;
+    }
+    return true;
+}
+
+void EdidCache::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("EDID cache: sinks %zu/%d, hits %u, misses %u\n",
+             mEntries.size(), CACHE_CAPACITY, mHits, mMisses);
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        Entry *entry = mEntries.itemAt(i);
+        d.append("  %08x: %zu modes, last %dx%d@%dHz\n",
+                 entry->key, entry->modes.size(),
+                 entry->lastMode.hdisplay, entry->lastMode.vdisplay,
+                 entry->lastMode.vrefresh);
+    }
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,97 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef EDID_CACHE_H
+#define EDID_CACHE_H
+
+#include <Dump.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <cutils/properties.h>
+
+extern "C" {
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+}
+
+namespace android {
+namespace intel {
+
+// Modes of the sinks seen on HDMI, keyed by a hash of their EDID, and the
+// mode last set on each of them. A known sink is given its last mode again
+// instead of the preferred one. With hwc.edid.cache set to a file path the
+// cache is kept across boots, written by a background task of the task
+// queue rather than on the mode set.
+class EdidCache {
+public:
+    EdidCache();
+    ~EdidCache();
+
+public:
+    bool initialize();
+    void deinitialize();
+
+    static uint32_t hash(const void *edid, size_t size);
+
+    // the last mode set on the sink if it is still one of its modes
+    bool getLastMode(uint32_t key, drmModeConnectorPtr connector,
+                     drmModeModeInfo& mode);
+    void setLastMode(uint32_t key, drmModeConnectorPtr connector,
+                     const drmModeModeInfo& mode);
+
+    // dump interface
+    void dump(Dump& d);
+
+private:
+    struct Entry {
+        uint32_t key;
+        int preferred;
+        drmModeModeInfo lastMode;
+        Vector<drmModeModeInfo> modes;
+    };
+
+    enum {
+        CACHE_CAPACITY = 8,
+        // bumped when the file layout changes
+        FILE_VERSION = 1,
+        // changes in a burst of mode sets are written once
+        SAVE_DELAY_MS = 1000,
+    };
+
+    int find(uint32_t key);
+    bool load();
+    bool save();
+    // posts the save task if there is none, with mLock held
+    void scheduleSaveLocked();
+    static void saveTask(void *data);
+
+private:
+    // the entries are read by the save task
+    Mutex mLock;
+    // most recently used entry is at the front
+    Vector<Entry*> mEntries;
+    char mPath[PROPERTY_VALUE_MAX];
+    uint32_t mHits;
+    uint32_t mMisses;
+    // changed since the last save
+    bool mDirty;
+    // the posted save task, -1 if none
+    int mSaveTask;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* EDID_CACHE_H */
@@ -0,0 +1,340 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <HwcTrace.h>
+#include <EventLoop.h>
+
+namespace android {
+namespace intel {
+
+EventLoop::EventLoop()
+    : mInitialized(false),
+      mExitThread(false),
+      mEpollFd(-1),
+      mWakeFd(-1),
+      mLock(),
+      mDispatchDone(),
+      mSources(),
+      mDispatching(-1),
+      mLoopTid(0),
+      mWakeups(0)
+{
+    CTRACE();
+}
+
+EventLoop::~EventLoop()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool EventLoop::initialize()
+{
+    CTRACE();
+
+    mExitThread = false;
+    mEpollFd = epoll_create(MAX_EVENTS);
+    if (mEpollFd < 0) {
+        DEINIT_AND_RETURN_FALSE("failed to create epoll fd, error %d", errno);
+    }
+
+    mWakeFd = eventfd(0, EFD_NONBLOCK);
+    if (mWakeFd < 0) {
+        DEINIT_AND_RETURN_FALSE("failed to create event fd, error %d", errno);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = mWakeFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &event) < 0) {
+        DEINIT_AND_RETURN_FALSE("failed to watch event fd, error %d", errno);
+    }
+
+    mThread = new EventLoopThread(this);
+    if (!mThread.get()) {
+        DEINIT_AND_RETURN_FALSE("failed to create event loop thread");
+    }
+
+    mInitialized = true;
+    return true;
+}
+
+void EventLoop::deinitialize()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThread = true;
+    }
+    wake();
+
+    if (mThread.get()) {
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+
+    for (size_t i = 0; i < mSources.size(); i++) {
+        if (mSources.valueAt(i).type == SOURCE_TIMER) {
+            close(mSources.keyAt(i));
+        } else {
+            WTRACE("fd %d is still watched", mSources.keyAt(i));
+        }
+    }
+    mSources.clear();
+
+    if (mWakeFd >= 0) {
+        close(mWakeFd);
+        mWakeFd = -1;
+    }
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+        mEpollFd = -1;
+    }
+    mInitialized = false;
+}
+
+void EventLoop::start()
+{
+    if (mThread.get()) {
+        mThread->run("HwcEventLoop", PRIORITY_URGENT_DISPLAY);
+    }
+}
+
+void EventLoop::wake()
+{
+    if (mWakeFd >= 0) {
+        uint64_t value = 1;
+        write(mWakeFd, &value, sizeof(value));
+    }
+}
+
+bool EventLoop::addSource(int fd, uint32_t events, const Source& source)
+{
+    Mutex::Autolock _l(mLock);
+    if (mEpollFd < 0) {
+        ETRACE("event loop is not initialized");
+        return false;
+    }
+    if (mSources.indexOfKey(fd) >= 0) {
+        ETRACE("fd %d is already watched", fd);
+        return false;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        ETRACE("failed to watch fd %d, error %d", fd, errno);
+        return false;
+    }
+
+    mSources.add(fd, source);
+    return true;
+}
+
+void EventLoop::removeSource(int fd)
+{
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mSources.indexOfKey(fd);
+    if (index < 0) {
+        return;
+    }
+
+    epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
+    mSources.removeItemsAt(index);
+
+    // a callback may remove its own source
+    if (isLoopThread()) {
+        return;
+    }
+    while (mDispatching == fd) {
+        mDispatchDone.wait(mLock);
+    }
+}
+
+bool EventLoop::addFd(int fd, uint32_t events, EventLoopFdFunc func, void *data)
+{
+    if (fd < 0 || !func) {
+        ETRACE("invalid fd or callback");
+        return false;
+    }
+
+    Source source;
+    memset(&source, 0, sizeof(source));
+    source.type = SOURCE_FD;
+    source.fdFunc = func;
+    source.data = data;
+    return addSource(fd, events, source);
+}
+
+void EventLoop::removeFd(int fd)
+{
+    removeSource(fd);
+}
+
+int EventLoop::addTimer(nsecs_t delay, nsecs_t interval, EventLoopTimerFunc func, void *data)
+{
+    if (!func) {
+        ETRACE("invalid callback");
+        return -1;
+    }
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd < 0) {
+        ETRACE("failed to create timer fd, error %d", errno);
+        return -1;
+    }
+
+    Source source;
+    memset(&source, 0, sizeof(source));
+    source.type = SOURCE_TIMER;
+    source.timerFunc = func;
+    source.data = data;
+    if (!addSource(fd, EPOLLIN, source)) {
+        close(fd);
+        return -1;
+    }
+
+    if (!setTimer(fd, delay, interval)) {
+        removeTimer(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool EventLoop::setTimer(int timer, nsecs_t delay, nsecs_t interval)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    // a zero value would disarm the timer
+    if (delay <= 0) {
+        delay = 1;
+    }
+    spec.it_value.tv_sec = delay / 1000000000;
+    spec.it_value.tv_nsec = delay % 1000000000;
+    spec.it_interval.tv_sec = interval / 1000000000;
+    spec.it_interval.tv_nsec = interval % 1000000000;
+    if (timerfd_settime(timer, 0, &spec, NULL) < 0) {
+        ETRACE("failed to arm timer %d, error %d", timer, errno);
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::cancelTimer(int timer)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (timerfd_settime(timer, 0, &spec, NULL) < 0) {
+        ETRACE("failed to disarm timer %d, error %d", timer, errno);
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::removeTimer(int timer)
+{
+    if (timer < 0) {
+        return;
+    }
+    removeSource(timer);
+    close(timer);
+}
+
+bool EventLoop::isLoopThread() const
+{
+    return mLoopTid == gettid();
+}
+
+void EventLoop::dispatch(int fd, uint32_t events)
+{
+    Source source;
+    {
+        Mutex::Autolock _l(mLock);
+        ssize_t index = mSources.indexOfKey(fd);
+        if (index < 0) {
+            // removed after epoll_wait returned
+            return;
+        }
+        Source& s = mSources.editValueAt(index);
+        s.dispatches++;
+        source = s;
+        mDispatching = fd;
+    }
+
+    if (source.type == SOURCE_TIMER) {
+        uint64_t expirations;
+        read(fd, &expirations, sizeof(expirations));
+        source.timerFunc(fd, source.data);
+    } else {
+        source.fdFunc(fd, events, source.data);
+    }
+
+    Mutex::Autolock _l(mLock);
+    mDispatching = -1;
+    mDispatchDone.broadcast();
+}
+
+bool EventLoop::threadLoop()
+{
+    mLoopTid = gettid();
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(mEpollFd, events, MAX_EVENTS, -1);
+    if (count < 0) {
+        if (errno != EINTR) {
+            ETRACE("epoll_wait failed, error %d", errno);
+        }
+        return true;
+    }
+
+    mWakeups++;
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == mWakeFd) {
+            uint64_t value;
+            read(mWakeFd, &value, sizeof(value));
+            Mutex::Autolock _l(mLock);
+            if (mExitThread) {
+                ITRACE("exiting thread loop");
+                return false;
+            }
+            continue;
+        }
+        dispatch(fd, events[i].events);
+    }
+    return true;
+}
+
+void EventLoop::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("Event loop: %d sources, %u wakeups\n", mSources.size(), mWakeups);
+    for (size_t i = 0; i < mSources.size(); i++) {
+        const Source& source = mSources.valueAt(i);
+        d.append("  %s %d: dispatched %u times\n",
+                 source.type == SOURCE_TIMER ? "timer" : "fd",
+                 mSources.keyAt(i), source.dispatches);
+    }
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,105 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <Dump.h>
+#include <SimpleThread.h>
+#include <utils/KeyedVector.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+typedef void (*EventLoopFdFunc)(int fd, uint32_t events, void *data);
+typedef void (*EventLoopTimerFunc)(int timer, void *data);
+
+// One thread waiting on the file descriptors and timers of the observers
+// that don't need a thread of their own. Callbacks run on the loop thread
+// and must not block for long, vsync keeps its dedicated threads.
+class EventLoop {
+public:
+    EventLoop();
+    virtual ~EventLoop();
+
+public:
+    bool initialize();
+    void deinitialize();
+    // starts dispatching, sources may be added before
+    void start();
+
+    // events are epoll events, returns false if fd can't be watched
+    bool addFd(int fd, uint32_t events, EventLoopFdFunc func, void *data);
+    // once this returns the callback of fd is not running and won't run
+    void removeFd(int fd);
+
+    // fires once after delay, then every interval if it's not 0. Returns
+    // the timer or -1, a timer stays until removed even if not rearmed.
+    int addTimer(nsecs_t delay, nsecs_t interval, EventLoopTimerFunc func, void *data);
+    bool setTimer(int timer, nsecs_t delay, nsecs_t interval);
+    // disarms the timer, unlike removeTimer() it doesn't wait for a
+    // callback in progress
+    bool cancelTimer(int timer);
+    void removeTimer(int timer);
+
+    bool isLoopThread() const;
+    void dump(Dump& d);
+
+private:
+    enum {
+        SOURCE_FD = 0,
+        SOURCE_TIMER,
+    };
+
+    enum {
+        MAX_EVENTS = 8,
+    };
+
+    struct Source {
+        int type;
+        EventLoopFdFunc fdFunc;
+        EventLoopTimerFunc timerFunc;
+        void *data;
+        uint32_t dispatches;
+    };
+
+    bool addSource(int fd, uint32_t events, const Source& source);
+    void removeSource(int fd);
+    void dispatch(int fd, uint32_t events);
+    void wake();
+
+private:
+    bool mInitialized;
+    bool mExitThread;
+    int mEpollFd;
+    int mWakeFd;
+    mutable Mutex mLock;
+    Condition mDispatchDone;
+    KeyedVector<int, Source> mSources;
+    // the fd whose callback is running, -1 if none
+    int mDispatching;
+    pid_t mLoopTid;
+    uint32_t mWakeups;
+
+private:
+    DECLARE_THREAD(EventLoopThread, EventLoop);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* EVENT_LOOP_H */
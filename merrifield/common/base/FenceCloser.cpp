@@ -0,0 +1,238 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <HwcTrace.h>
+#include <TaskQueue.h>
+#include <FenceCloser.h>
+
+namespace android {
+namespace intel {
+
+FenceCloser::FenceCloser()
+    : mInitialized(false),
+      mQueue(NULL),
+      mPending(),
+      mTask(-1)
+{
+    memset(&mStats, 0, sizeof(mStats));
+    mStats.baseFds = -1;
+    mStats.lastFds = -1;
+}
+
+FenceCloser::~FenceCloser()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool FenceCloser::initialize(TaskQueue *queue)
+{
+    if (!queue) {
+        ETRACE("invalid task queue");
+        return false;
+    }
+
+    mQueue = queue;
+    mPending.setCapacity(BATCH_SIZE * 2);
+    mStats.baseFds = countOpenFds();
+    mStats.lastFds = mStats.baseFds;
+    mStats.maxFds = mStats.baseFds;
+    mInitialized = true;
+    return true;
+}
+
+void FenceCloser::deinitialize()
+{
+    int task;
+    {
+        Mutex::Autolock _l(mLock);
+        task = mTask;
+        mInitialized = false;
+    }
+
+    // waits for a batch being closed, the rest is closed here
+    if (task >= 0) {
+        mQueue->remove(task);
+    }
+    {
+        Mutex::Autolock _l(mLock);
+        mTask = -1;
+    }
+    closeBatch();
+    mQueue = NULL;
+}
+
+void FenceCloser::close(int& fenceFd)
+{
+    if (fenceFd < 0) {
+        return;
+    }
+
+    {
+        Mutex::Autolock _l(mLock);
+        if (mInitialized) {
+            mPending.push_back(fenceFd);
+            mStats.queued++;
+            fenceFd = -1;
+            if (mPending.size() >= BATCH_SIZE) {
+                postLocked();
+            }
+            return;
+        }
+    }
+
+    if (::close(fenceFd) < 0) {
+        WTRACE("failed to close fence %d: %s", fenceFd, strerror(errno));
+    }
+    fenceFd = -1;
+}
+
+void FenceCloser::flush()
+{
+    Mutex::Autolock _l(mLock);
+    if (mInitialized && mPending.size()) {
+        postLocked();
+    }
+}
+
+void FenceCloser::postLocked()
+{
+    // one task takes all the fences queued until it runs
+    if (mTask >= 0) {
+        return;
+    }
+
+    mTask = mQueue->post(TaskQueue::LANE_BACKGROUND, closeTask, this);
+    if (mTask >= 0) {
+        return;
+    }
+
+    // the fences must not pile up, close them here
+    for (size_t i = 0; i < mPending.size(); i++) {
+        ::close(mPending.itemAt(i));
+    }
+    mStats.closed += mPending.size();
+    mStats.inlined += mPending.size();
+    mPending.clear();
+}
+
+void FenceCloser::closeTask(void *data)
+{
+    FenceCloser *closer = static_cast<FenceCloser*>(data);
+    {
+        Mutex::Autolock _l(closer->mLock);
+        closer->mTask = -1;
+    }
+    closer->closeBatch();
+}
+
+void FenceCloser::closeBatch()
+{
+    Vector<int> batch;
+    {
+        Mutex::Autolock _l(mLock);
+        if (mPending.isEmpty()) {
+            return;
+        }
+        batch = mPending;
+        mPending.clear();
+    }
+
+    uint32_t errors = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (::close(batch.itemAt(i)) < 0) {
+            errors++;
+        }
+    }
+    if (errors) {
+        WTRACE_LIMITED("failed to close %u fences", errors);
+    }
+
+    bool check;
+    {
+        Mutex::Autolock _l(mLock);
+        mStats.closed += batch.size();
+        mStats.errors += errors;
+        mStats.batches++;
+        if (batch.size() > mStats.largestBatch) {
+            mStats.largestBatch = batch.size();
+        }
+        check = (mStats.batches % FD_CHECK_INTERVAL) == 0;
+    }
+
+    if (check) {
+        checkOpenFds();
+    }
+}
+
+void FenceCloser::checkOpenFds()
+{
+    int fds = countOpenFds();
+    if (fds < 0) {
+        return;
+    }
+
+    int base;
+    {
+        Mutex::Autolock _l(mLock);
+        mStats.lastFds = fds;
+        if (fds > mStats.maxFds) {
+            mStats.maxFds = fds;
+        }
+        base = mStats.baseFds;
+    }
+
+    if (base >= 0 && fds > base + FD_LEAK_MARGIN) {
+        WTRACE_LIMITED("open fds grew from %d to %d, fences may leak",
+                       base, fds);
+    }
+}
+
+int FenceCloser::countOpenFds()
+{
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+    // not counting the fd of the directory itself
+    return count - 1;
+}
+
+void FenceCloser::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("Fence closer: %u queued, %u closed in %u batches (largest %u), "
+             "%u closed inline, %u errors, %d pending\n",
+             mStats.queued, mStats.closed, mStats.batches,
+             mStats.largestBatch, mStats.inlined, mStats.errors,
+             mPending.size());
+    d.append("  open fds: %d at start, %d last, %d max\n",
+             mStats.baseFds, mStats.lastFds, mStats.maxFds);
+}
+
+} // namespace intel
+} // namespace android
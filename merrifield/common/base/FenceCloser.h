@@ -0,0 +1,92 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef FENCE_CLOSER_H
+#define FENCE_CLOSER_H
+
+#include <Dump.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+namespace android {
+namespace intel {
+
+class TaskQueue;
+
+// Closes the fence fds HWC is done with in batches on a background worker
+// of the task queue, so the commit path doesn't pay for dropping the last
+// reference of a fence. The number of open fds of the process is sampled
+// now and then to catch fds that are never closed.
+class FenceCloser {
+public:
+    enum {
+        // queued fences that are handed to a worker without waiting for
+        // the end of the commit
+        BATCH_SIZE = 32,
+        // batches between two samples of the open fds
+        FD_CHECK_INTERVAL = 64,
+        // growth of the open fds over the first sample that is reported
+        FD_LEAK_MARGIN = 256,
+    };
+
+public:
+    FenceCloser();
+    ~FenceCloser();
+
+public:
+    bool initialize(TaskQueue *queue);
+    void deinitialize();
+    // takes over fenceFd and sets it to -1, it is closed with the next
+    // batch, or right away if the closer is not initialized
+    void close(int& fenceFd);
+    // hands the queued fences to a worker, at the end of each commit
+    void flush();
+    void dump(Dump& d);
+
+private:
+    static void closeTask(void *data);
+    void closeBatch();
+    void checkOpenFds();
+    // open fds of the process, -1 if they can't be counted
+    static int countOpenFds();
+    // queues the task for the fences, with mLock held
+    void postLocked();
+
+private:
+    bool mInitialized;
+    TaskQueue *mQueue;
+    Mutex mLock;
+    Vector<int> mPending;
+    // the posted batch task, -1 if none
+    int mTask;
+
+    struct {
+        uint32_t queued;
+        uint32_t closed;
+        uint32_t errors;
+        uint32_t batches;
+        uint32_t largestBatch;
+        // closed inline as no task could be posted
+        uint32_t inlined;
+        int baseFds;
+        int lastFds;
+        int maxFds;
+    } mStats;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* FENCE_CLOSER_H */
@@ -0,0 +1,304 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <HwcTrace.h>
+#include <VsyncManager.h>
+#include <FenceTracker.h>
+#include <sync/sync.h>
+
+namespace android {
+namespace intel {
+
+FenceTracker::FenceTracker()
+    : mInitialized(false),
+      mVsyncManager(0),
+      mExitThread(false),
+      mHead(0),
+      mCount(0),
+      mDropped(0)
+{
+    CTRACE();
+    memset(mStats, 0, sizeof(mStats));
+}
+
+FenceTracker::~FenceTracker()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool FenceTracker::initialize(VsyncManager *vsyncManager)
+{
+    CTRACE();
+
+    if (!vsyncManager) {
+        ETRACE("invalid vsync manager");
+        return false;
+    }
+
+    memset(mStats, 0, sizeof(mStats));
+    for (int i = 0; i < IDisplayDevice::DEVICE_VIRTUAL; i++) {
+        snprintf(mStats[i].rings[LATENCY_INPUT].counterName, COUNTER_NAME_SIZE,
+                 "hwc_input_to_scanout_us_%d", i);
+        snprintf(mStats[i].rings[LATENCY_COMMIT].counterName, COUNTER_NAME_SIZE,
+                 "hwc_commit_to_scanout_us_%d", i);
+        snprintf(mStats[i].missedName, COUNTER_NAME_SIZE,
+                 "hwc_missed_vblank_%d", i);
+    }
+
+    mVsyncManager = vsyncManager;
+    mHead = 0;
+    mCount = 0;
+    mDropped = 0;
+    mExitThread = false;
+
+    mThread = new FenceTrackerThread(this);
+    if (!mThread.get()) {
+        DEINIT_AND_RETURN_FALSE("failed to create fence tracker thread");
+    }
+    mThread->run("FenceTracker", PRIORITY_BACKGROUND);
+
+    mInitialized = true;
+    return true;
+}
+
+void FenceTracker::deinitialize()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThread = true;
+        mCondition.signal();
+    }
+
+    if (mThread.get()) {
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+
+    // fences nobody waits for any more
+    while (mCount) {
+        close(mQueue[mHead].fenceFd);
+        mHead = (mHead + 1) % QUEUE_SIZE;
+        mCount--;
+    }
+
+    mVsyncManager = 0;
+    mInitialized = false;
+}
+
+void FenceTracker::track(int fenceFd, uint32_t displays,
+                         nsecs_t prepareTime, nsecs_t commitTime)
+{
+    if (!mInitialized || fenceFd < 0 || !displays) {
+        return;
+    }
+
+    Pending pending;
+    pending.fenceFd = dup(fenceFd);
+    if (pending.fenceFd < 0) {
+        WTRACE("failed to dup fence %d", fenceFd);
+        return;
+    }
+    pending.displays = displays;
+    pending.prepareTime = prepareTime;
+    pending.commitTime = commitTime;
+
+    // the frame is meant for the first vblank after the post
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    pending.vblank = mVsyncManager->getNextVsyncTime(now);
+    pending.period = 0;
+    if (pending.vblank) {
+        nsecs_t next = mVsyncManager->getNextVsyncTime(pending.vblank + 1);
+        if (next > pending.vblank) {
+            pending.period = next - pending.vblank;
+        }
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (mCount == QUEUE_SIZE) {
+        close(mQueue[mHead].fenceFd);
+        mHead = (mHead + 1) % QUEUE_SIZE;
+        mCount--;
+        mDropped++;
+    }
+    mQueue[(mHead + mCount) % QUEUE_SIZE] = pending;
+    mCount++;
+    mCondition.signal();
+}
+
+nsecs_t FenceTracker::getSignalTime(int fenceFd)
+{
+    struct sync_fence_info_data *info = sync_fence_info(fenceFd);
+    if (!info) {
+        return 0;
+    }
+
+    // the fence is signaled by its last point
+    nsecs_t signalTime = 0;
+    struct sync_pt_info *pt = NULL;
+    while ((pt = sync_pt_info(info, pt)) != NULL) {
+        if (pt->status == 1 && (nsecs_t)pt->timestamp_ns > signalTime) {
+            signalTime = pt->timestamp_ns;
+        }
+    }
+    sync_fence_info_free(info);
+    return signalTime;
+}
+
+int FenceTracker::compareSample(const void *lhs, const void *rhs)
+{
+    nsecs_t l = *(const nsecs_t *)lhs;
+    nsecs_t r = *(const nsecs_t *)rhs;
+    return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+void FenceTracker::record(const Pending& pending, nsecs_t signalTime)
+{
+    nsecs_t latency[LATENCY_COUNT];
+    latency[LATENCY_INPUT] = signalTime - pending.prepareTime;
+    latency[LATENCY_COMMIT] = signalTime - pending.commitTime;
+
+    // vblanks passed between the one meant and the one that made it
+    uint32_t missed = 0;
+    if (pending.vblank && pending.period) {
+        nsecs_t late = signalTime - pending.vblank;
+        if (late > pending.period / 2) {
+            missed = (late + pending.period / 2) / pending.period;
+        }
+    }
+
+    Mutex::Autolock _l(mLock);
+    for (int i = 0; i < IDisplayDevice::DEVICE_VIRTUAL; i++) {
+        if (!(pending.displays & (1 << i))) {
+            continue;
+        }
+
+        Stats& stats = mStats[i];
+        for (int j = 0; j < LATENCY_COUNT; j++) {
+            Ring& ring = stats.rings[j];
+            ring.samples[ring.next] = latency[j];
+            ring.next = (ring.next + 1) % SAMPLE_COUNT;
+            if (ring.count < SAMPLE_COUNT) {
+                ring.count++;
+            }
+            atrace_int(ATRACE_TAG, ring.counterName,
+                       (int32_t)(latency[j] / 1000));
+        }
+        stats.frames++;
+        if (missed) {
+            stats.missed += missed;
+            atrace_int(ATRACE_TAG, stats.missedName, stats.missed);
+        }
+    }
+}
+
+bool FenceTracker::threadLoop()
+{
+    Pending pending;
+    { // scope for lock
+        Mutex::Autolock _l(mLock);
+        while (!mCount) {
+            if (mExitThread) {
+                return false;
+            }
+            mCondition.wait(mLock);
+        }
+        if (mExitThread) {
+            return false;
+        }
+        pending = mQueue[mHead];
+        mHead = (mHead + 1) % QUEUE_SIZE;
+        mCount--;
+    }
+
+    nsecs_t signalTime = 0;
+    if (sync_wait(pending.fenceFd, FENCE_WAIT_TIMEOUT_MS) == 0) {
+        signalTime = getSignalTime(pending.fenceFd);
+    }
+    close(pending.fenceFd);
+
+    if (!signalTime) {
+        Mutex::Autolock _l(mLock);
+        for (int i = 0; i < IDisplayDevice::DEVICE_VIRTUAL; i++) {
+            if (pending.displays & (1 << i)) {
+                mStats[i].timeouts++;
+            }
+        }
+        return true;
+    }
+
+    record(pending, signalTime);
+    return true;
+}
+
+uint32_t FenceTracker::getMissedVblanks()
+{
+    Mutex::Autolock _l(mLock);
+    uint32_t missed = 0;
+    for (int i = 0; i < IDisplayDevice::DEVICE_VIRTUAL; i++) {
+        missed += mStats[i].missed;
+    }
+    return missed;
+}
+
+void FenceTracker::dump(Dump& d)
+{
+    static const char *names[LATENCY_COUNT] = {
+        "input to scanout",
+        "commit to scanout",
+    };
+    nsecs_t sorted[SAMPLE_COUNT];
+
+    if (!mInitialized) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    d.append("Scan out latency (us, last %d frames), dropped %u:\n",
+             SAMPLE_COUNT, mDropped);
+    d.append("  DISP | LATENCY           | FRAMES | MISSED |    MIN |    P50 |    P99 \n");
+    d.append("-------+-------------------+--------+--------+--------+--------+--------\n");
+    for (int i = 0; i < IDisplayDevice::DEVICE_VIRTUAL; i++) {
+        const Stats& stats = mStats[i];
+        for (int j = 0; j < LATENCY_COUNT; j++) {
+            const Ring& ring = stats.rings[j];
+            if (!ring.count) {
+                continue;
+            }
+
+            memcpy(sorted, ring.samples, ring.count * sizeof(nsecs_t));
+            qsort(sorted, ring.count, sizeof(nsecs_t), compareSample);
+            uint32_t p50 = (ring.count * 50 + 99) / 100 - 1;
+            uint32_t p99 = (ring.count * 99 + 99) / 100 - 1;
+            d.append("  %4d | %-17s | %6u | %6u | %6lld | %6lld | %6lld \n",
+                     i,
+                     names[j],
+                     stats.frames,
+                     stats.missed,
+                     sorted[0] / 1000,
+                     sorted[p50] / 1000,
+                     sorted[p99] / 1000);
+        }
+        if (stats.timeouts) {
+            d.append("  %4d | fence timeouts %u\n", i, stats.timeouts);
+        }
+    }
+}
+
+} // namespace intel
+} // namespace android
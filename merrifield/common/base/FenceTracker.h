@@ -0,0 +1,111 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef FENCE_TRACKER_H
+#define FENCE_TRACKER_H
+
+#include <Dump.h>
+#include <IDisplayDevice.h>
+#include <SimpleThread.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+class VsyncManager;
+
+// Waits for the retire fence of every posted frame in the background and
+// keeps, per display, how long frames took from prepare and from commit
+// to scan out, and how many of them missed the vblank they were meant for.
+class FenceTracker {
+public:
+    FenceTracker();
+    ~FenceTracker();
+
+public:
+    bool initialize(VsyncManager *vsyncManager);
+    void deinitialize();
+    // takes a dup of fenceFd, displays is a mask of the displays it retires
+    void track(int fenceFd, uint32_t displays,
+               nsecs_t prepareTime, nsecs_t commitTime);
+    // missed vblanks of all displays so far
+    uint32_t getMissedVblanks();
+    void dump(Dump& d);
+
+private:
+    enum {
+        SAMPLE_COUNT = 128,
+        // fences still waited for, the oldest is dropped beyond that
+        QUEUE_SIZE = 8,
+        FENCE_WAIT_TIMEOUT_MS = 1000,
+        COUNTER_NAME_SIZE = 40,
+    };
+
+    enum {
+        LATENCY_INPUT = 0,
+        LATENCY_COMMIT,
+        LATENCY_COUNT,
+    };
+
+    struct Pending {
+        int fenceFd;
+        uint32_t displays;
+        nsecs_t prepareTime;
+        nsecs_t commitTime;
+        // vblank the frame was meant for
+        nsecs_t vblank;
+        nsecs_t period;
+    };
+
+    struct Ring {
+        nsecs_t samples[SAMPLE_COUNT];
+        uint32_t count;
+        uint32_t next;
+        char counterName[COUNTER_NAME_SIZE];
+    };
+
+    struct Stats {
+        Ring rings[LATENCY_COUNT];
+        uint32_t frames;
+        uint32_t missed;
+        uint32_t timeouts;
+        char missedName[COUNTER_NAME_SIZE];
+    };
+
+    static nsecs_t getSignalTime(int fenceFd);
+    static int compareSample(const void *lhs, const void *rhs);
+    void record(const Pending& pending, nsecs_t signalTime);
+
+private:
+    bool mInitialized;
+    VsyncManager *mVsyncManager;
+    Mutex mLock;
+    Condition mCondition;
+    bool mExitThread;
+    Pending mQueue[QUEUE_SIZE];
+    uint32_t mHead;
+    uint32_t mCount;
+    uint32_t mDropped;
+    Stats mStats[IDisplayDevice::DEVICE_VIRTUAL];
+
+private:
+    DECLARE_THREAD(FenceTrackerThread, FenceTracker);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* FENCE_TRACKER_H */
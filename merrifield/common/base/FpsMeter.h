@@ -0,0 +1,81 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef FPS_METER_H
+#define FPS_METER_H
+
+#include <stdint.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+// Frame rate from an exponentially weighted average of the intervals
+// between frames. It keeps no samples, so it is cheap enough to run for
+// every layer of every frame.
+class FpsMeter {
+public:
+    // frames further apart than this restart the average
+    static const nsecs_t IDLE_TIMEOUT = 1000000000LL;
+
+    enum {
+        // weight of the newest interval is 1 / (1 << AVERAGE_SHIFT)
+        AVERAGE_SHIFT = 3,
+    };
+
+public:
+    FpsMeter() : mLast(0), mInterval(0), mFrames(0) {}
+
+    void reset() {
+        mLast = 0;
+        mInterval = 0;
+        mFrames = 0;
+    }
+
+    void frame(nsecs_t now) {
+        nsecs_t interval = now - mLast;
+        if (mLast && interval > 0 && interval < IDLE_TIMEOUT) {
+            if (mInterval) {
+                mInterval += (interval - mInterval) >> AVERAGE_SHIFT;
+            } else {
+                mInterval = interval;
+            }
+        } else {
+            mInterval = 0;
+        }
+        mLast = now;
+        mFrames++;
+    }
+
+    // in tenths of a frame per second, 0 once the frames have stopped
+    uint32_t getFps10(nsecs_t now) const {
+        if (!mInterval || now - mLast > IDLE_TIMEOUT) {
+            return 0;
+        }
+        return (uint32_t)((10 * 1000000000LL + mInterval / 2) / mInterval);
+    }
+
+    uint32_t getFrames() const { return mFrames; }
+
+private:
+    nsecs_t mLast;
+    nsecs_t mInterval;
+    uint32_t mFrames;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* FPS_METER_H */
@@ -0,0 +1,185 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <HwcTrace.h>
+#include <FrameDumper.h>
+
+namespace android {
+namespace intel {
+
+FrameDumper::FrameDumper()
+    : mInitialized(false),
+      mInterval(0),
+      mFrame(0),
+      mHead(0),
+      mCount(0),
+      mExiting(false),
+      mCaptured(0),
+      mSkipped(0),
+      mWritten(0),
+      mRawBytes(0),
+      mFileBytes(0)
+{
+    mDir[0] = '\0';
+}
+
+FrameDumper::~FrameDumper()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool FrameDumper::initialize(const char *dir)
+{
+    if (!dir) {
+        ETRACE("invalid dump directory");
+        return false;
+    }
+
+    strncpy(mDir, dir, PATH_SIZE - 1);
+    mDir[PATH_SIZE - 1] = '\0';
+    mExiting = false;
+
+    mThread = new DumpThread(this);
+    if (!mThread.get()) {
+        DEINIT_AND_RETURN_FALSE("failed to create dump thread");
+    }
+    mThread->run("FrameDumper", PRIORITY_BACKGROUND);
+
+    mInitialized = true;
+    return true;
+}
+
+void FrameDumper::deinitialize()
+{
+    if (mThread.get()) {
+        {
+            Mutex::Autolock _l(mLock);
+            mExiting = true;
+            mCondition.signal();
+        }
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+
+    for (int i = 0; i < RING_SIZE; i++) {
+        mSlots[i].data.clear();
+    }
+    mHead = 0;
+    mCount = 0;
+    mInitialized = false;
+}
+
+bool FrameDumper::sample()
+{
+    if (!mInitialized || !mInterval)
+        return false;
+
+    return (++mFrame % mInterval) == 0;
+}
+
+bool FrameDumper::capture(const char *name, const void *data, size_t size)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    uint32_t index;
+    {
+        Mutex::Autolock _l(mLock);
+        if (mCount == RING_SIZE) {
+            mSkipped++;
+            return false;
+        }
+        index = (mHead + mCount) % RING_SIZE;
+    }
+
+    // the writer only touches the slots already counted
+    Slot& slot = mSlots[index];
+    if (slot.data.size() != size)
+        slot.data.resize(size);
+    memcpy(slot.data.editArray(), data, size);
+    strncpy(slot.name, name, NAME_SIZE - 1);
+    slot.name[NAME_SIZE - 1] = '\0';
+    slot.frame = mFrame;
+
+    Mutex::Autolock _l(mLock);
+    mCount++;
+    mCaptured++;
+    mCondition.signal();
+    return true;
+}
+
+bool FrameDumper::threadLoop()
+{
+    const Slot *slot;
+    {
+        Mutex::Autolock _l(mLock);
+        while (!mCount && !mExiting) {
+            mCondition.wait(mLock);
+        }
+        // captured frames are still written on exit
+        if (!mCount)
+            return false;
+        slot = &mSlots[mHead];
+    }
+
+    write(*slot);
+
+    Mutex::Autolock _l(mLock);
+    mHead = (mHead + 1) % RING_SIZE;
+    mCount--;
+    return true;
+}
+
+void FrameDumper::write(const Slot& slot)
+{
+    char path[PATH_SIZE + NAME_SIZE + 16];
+    snprintf(path, sizeof(path), "%s/%s_%05u.gz", mDir, slot.name, slot.frame);
+
+    // fastest level, the writer has to keep up with the sampling
+    gzFile file = gzopen(path, "wb1");
+    if (!file) {
+        ETRACE("failed to open %s", path);
+        return;
+    }
+    int written = gzwrite(file, slot.data.array(), slot.data.size());
+    gzclose(file);
+    if (written != (int)slot.data.size()) {
+        ETRACE("failed to write %s", path);
+        return;
+    }
+
+    struct stat st;
+    off_t fileBytes = stat(path, &st) ? 0 : st.st_size;
+    Mutex::Autolock _l(mLock);
+    mWritten++;
+    mRawBytes += slot.data.size();
+    mFileBytes += fileBytes;
+    ITRACE("Dumped %s", path);
+}
+
+void FrameDumper::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("Frame dumps: every %u frames to %s, captured %u, skipped %u, "
+             "written %u (%llu KB raw, %llu KB compressed), queued %u\n",
+             mInterval, mDir, mCaptured, mSkipped, mWritten,
+             mRawBytes / 1024, mFileBytes / 1024, mCount);
+}
+
+} // namespace intel
+} // namespace android
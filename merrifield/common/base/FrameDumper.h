@@ -0,0 +1,91 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef FRAME_DUMPER_H
+#define FRAME_DUMPER_H
+
+#include <Dump.h>
+#include <SimpleThread.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+
+namespace android {
+namespace intel {
+
+// Sampled frame dumps that leave the timing of the dumping thread alone.
+// capture() only copies the frame into a small ring, a background thread
+// compresses it with zlib and writes it out as <dir>/<name>_<frame>.gz.
+// A frame is skipped rather than waited for when the ring is full.
+// capture() must always be called from the same thread.
+class FrameDumper {
+public:
+    FrameDumper();
+    ~FrameDumper();
+
+public:
+    bool initialize(const char *dir);
+    void deinitialize();
+
+    // every interval-th frame is sampled, 0 stops sampling
+    void setInterval(uint32_t interval) { mInterval = interval; }
+    // counts a frame, true if it is to be dumped
+    bool sample();
+    bool capture(const char *name, const void *data, size_t size);
+    void dump(Dump& d);
+
+private:
+    enum {
+        RING_SIZE = 4,
+        NAME_SIZE = 32,
+        PATH_SIZE = 128,
+    };
+
+    struct Slot {
+        Vector<uint8_t> data;
+        char name[NAME_SIZE];
+        uint32_t frame;
+    };
+
+    void write(const Slot& slot);
+
+private:
+    bool mInitialized;
+    char mDir[PATH_SIZE];
+    uint32_t mInterval;
+    uint32_t mFrame;
+
+    Mutex mLock;
+    Condition mCondition;
+    Slot mSlots[RING_SIZE];
+    // slots captured and not yet written, from mHead on
+    uint32_t mHead;
+    uint32_t mCount;
+    bool mExiting;
+
+    // statistics
+    uint32_t mCaptured;
+    uint32_t mSkipped;
+    uint32_t mWritten;
+    uint64_t mRawBytes;
+    uint64_t mFileBytes;
+
+    DECLARE_THREAD(DumpThread, FrameDumper);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* FRAME_DUMPER_H */
@@ -0,0 +1,202 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <HwcTrace.h>
+#include <FrameTiming.h>
+#include <cutils/properties.h>
+
+namespace android {
+namespace intel {
+
+FrameTiming::FrameTiming()
+    : mInitialized(false),
+      mTraceCounters(false)
+{
+    CTRACE();
+    memset(mRings, 0, sizeof(mRings));
+}
+
+FrameTiming::~FrameTiming()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool FrameTiming::initialize()
+{
+    CTRACE();
+
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("debug.hwc.timing_trace.enable", prop, "0") > 0) {
+        mTraceCounters = atoi(prop);
+    }
+
+    memset(mRings, 0, sizeof(mRings));
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        for (int j = 0; j < STAGE_COUNT; j++) {
+            if (i == SLOT_COUNT - 1) {
+                snprintf(mRings[i][j].counterName, COUNTER_NAME_SIZE,
+                         "hwc_%s_us", stageName(j));
+            } else {
+                snprintf(mRings[i][j].counterName, COUNTER_NAME_SIZE,
+                         "hwc_%s_us_%d", stageName(j), i);
+            }
+        }
+    }
+
+    mInitialized = true;
+    return true;
+}
+
+void FrameTiming::deinitialize()
+{
+    mTraceCounters = false;
+    mInitialized = false;
+}
+
+const char* FrameTiming::stageName(int stage)
+{
+    switch (stage) {
+    case STAGE_PREPARE:
+        return "prepare";
+    case STAGE_COMMIT:
+        return "commit";
+    case STAGE_DEVICE_PREPARE:
+        return "device_prepare";
+    case STAGE_LAYER_LIST_UPDATE:
+        return "layer_list_update";
+    case STAGE_COMMIT_END:
+        return "commit_end";
+    default:
+        return "unknown";
+    }
+}
+
+int FrameTiming::slotIndex(int disp) const
+{
+    if (disp < 0 || disp >= IDisplayDevice::DEVICE_COUNT) {
+        return SLOT_COUNT - 1;
+    }
+    return disp;
+}
+
+int FrameTiming::compareSample(const void *lhs, const void *rhs)
+{
+    nsecs_t l = *(const nsecs_t *)lhs;
+    nsecs_t r = *(const nsecs_t *)rhs;
+    return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+void FrameTiming::record(int disp, int stage, nsecs_t duration)
+{
+    if (!mInitialized || stage < 0 || stage >= STAGE_COUNT) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    Ring& ring = mRings[slotIndex(disp)][stage];
+    ring.samples[ring.next] = duration;
+    ring.next = (ring.next + 1) % SAMPLE_COUNT;
+    if (ring.count < SAMPLE_COUNT) {
+        ring.count++;
+    }
+
+    if (mTraceCounters) {
+        atrace_int(ATRACE_TAG, ring.counterName, (int32_t)(duration / 1000));
+    }
+}
+
+nsecs_t FrameTiming::getPercentile(int disp, int stage, int percent)
+{
+    nsecs_t duration;
+    getPercentiles(disp, stage, &percent, &duration, 1);
+    return duration;
+}
+
+void FrameTiming::getPercentiles(int disp, int stage, const int *percents,
+                                 nsecs_t *durations, size_t count)
+{
+    nsecs_t sorted[SAMPLE_COUNT];
+
+    memset(durations, 0, count * sizeof(nsecs_t));
+    if (!mInitialized || stage < 0 || stage >= STAGE_COUNT) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    const Ring& ring = mRings[slotIndex(disp)][stage];
+    if (!ring.count) {
+        return;
+    }
+
+    memcpy(sorted, ring.samples, ring.count * sizeof(nsecs_t));
+    qsort(sorted, ring.count, sizeof(nsecs_t), compareSample);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t index = (ring.count * percents[i] + 99) / 100;
+        if (index > 0) {
+            index--;
+        }
+        durations[i] = sorted[index];
+    }
+}
+
+void FrameTiming::dump(Dump& d)
+{
+    nsecs_t sorted[SAMPLE_COUNT];
+    char disp[8];
+
+    if (!mInitialized) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    d.append("Frame timing (us, last %d samples):\n", SAMPLE_COUNT);
+    d.append("  DISP | STAGE             | COUNT |    MIN |    AVG |    P99 \n");
+    d.append("-------+-------------------+-------+--------+--------+--------\n");
+    for (int i = 0; i < SLOT_COUNT; i++) {
+        for (int j = 0; j < STAGE_COUNT; j++) {
+            const Ring& ring = mRings[i][j];
+            if (!ring.count) {
+                continue;
+            }
+
+            nsecs_t sum = 0;
+            memcpy(sorted, ring.samples, ring.count * sizeof(nsecs_t));
+            for (uint32_t k = 0; k < ring.count; k++) {
+                sum += sorted[k];
+            }
+            qsort(sorted, ring.count, sizeof(nsecs_t), compareSample);
+            uint32_t p99 = (ring.count * 99 + 99) / 100 - 1;
+
+            if (i == SLOT_COUNT - 1) {
+                snprintf(disp, sizeof(disp), "all");
+            } else {
+                snprintf(disp, sizeof(disp), "%d", i);
+            }
+            d.append("  %4s | %-17s | %5d | %6lld | %6lld | %6lld \n",
+                     disp,
+                     stageName(j),
+                     ring.count,
+                     sorted[0] / 1000,
+                     sum / ring.count / 1000,
+                     sorted[p99] / 1000);
+        }
+    }
+}
+
+} // namespace intel
+} // namespace android
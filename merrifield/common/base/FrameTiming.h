@@ -0,0 +1,111 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef FRAME_TIMING_H
+#define FRAME_TIMING_H
+
+#include <Dump.h>
+#include <IDisplayDevice.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+// Keeps the most recent durations of each prepare/commit stage, per
+// display, so that dumpsys can tell where a frame spent its time.
+class FrameTiming {
+public:
+    enum {
+        STAGE_PREPARE = 0,
+        STAGE_COMMIT,
+        STAGE_DEVICE_PREPARE,
+        STAGE_LAYER_LIST_UPDATE,
+        STAGE_COMMIT_END,
+        STAGE_COUNT,
+    };
+
+    enum {
+        // stages not bound to a single display
+        DISPLAY_ALL = -1,
+    };
+
+public:
+    FrameTiming();
+    ~FrameTiming();
+
+public:
+    bool initialize();
+    void deinitialize();
+    void record(int disp, int stage, nsecs_t duration);
+    // duration not exceeded by percent of the recent samples, 0 if none
+    nsecs_t getPercentile(int disp, int stage, int percent);
+    // several percentiles of the same samples, sorted once
+    void getPercentiles(int disp, int stage, const int *percents,
+                        nsecs_t *durations, size_t count);
+    void dump(Dump& d);
+
+private:
+    enum {
+        SAMPLE_COUNT = 128,
+        SLOT_COUNT = IDisplayDevice::DEVICE_COUNT + 1,
+        COUNTER_NAME_SIZE = 40,
+    };
+
+    struct Ring {
+        nsecs_t samples[SAMPLE_COUNT];
+        uint32_t count;
+        uint32_t next;
+        char counterName[COUNTER_NAME_SIZE];
+    };
+
+    static const char* stageName(int stage);
+    static int compareSample(const void *lhs, const void *rhs);
+    inline int slotIndex(int disp) const;
+
+private:
+    bool mInitialized;
+    bool mTraceCounters;
+    Mutex mLock;
+    Ring mRings[SLOT_COUNT][STAGE_COUNT];
+};
+
+// Records the lifetime of the scope as one sample, nothing if timing is NULL.
+class FrameTimingScope {
+public:
+    FrameTimingScope(FrameTiming *timing, int disp, int stage)
+        : mTiming(timing),
+          mDisp(disp),
+          mStage(stage),
+          mStart(timing ? systemTime(CLOCK_MONOTONIC) : 0) {
+    }
+    ~FrameTimingScope() {
+        if (mTiming) {
+            mTiming->record(mDisp, mStage,
+                            systemTime(CLOCK_MONOTONIC) - mStart);
+        }
+    }
+
+private:
+    FrameTiming *mTiming;
+    int mDisp;
+    int mStage;
+    nsecs_t mStart;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* FRAME_TIMING_H */
@@ -13,6 +13,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <stdlib.h>
 #include <HwcTrace.h>
 #include <Drm.h>
 #include <HwcLayer.h>
@@ -27,6 +28,9 @@
 namespace android {
 namespace intel {
 
+static bool isContentHashEnabled();
+static int getFpsTraceLevel();
+
 inline bool operator==(const hwc_rect_t& x, const hwc_rect_t& y)
 {
     return (x.top == y.top &&
@@ -53,44 +57,42 @@ inline bool operator !=(const hwc_frect_t& x, const hwc_frect_t& y)
     return !operator==(x, y);
 }
 
-HwcLayer::HwcLayer(int index, hwc_layer_1_t *layer)
-    : mIndex(index),
+HwcLayer::HwcLayer(int index, hwc_layer_1_t *layer, const HwcLayer *clone)
+    : mLayer(layer),
+      mPlane(0),
+      mHandle(0),
+      mIndex(index),
       mZOrder(index + 1),  // 0 is reserved for frame buffer target
       mDevice(0),
-      mLayer(layer),
-      mPlane(0),
+      mType(LAYER_FB),
       mFormat(DataBuffer::FORMAT_INVALID),
+      mTransform(0),
+      mBlending(0),
+      mStaticCount(0),
+      mPlaneAlpha(0),
+      mUpdated(false),
+      mIsProtected(false),
+      mContentHash(false),
+      mFpsTrace(0),
+      mLastHandle(0),
       mWidth(0),
       mHeight(0),
       mUsage(0),
-      mHandle(0),
-      mIsProtected(false),
-      mType(LAYER_FB),
       mPriority(0),
-      mTransform(0),
-      mStaticCount(0),
-      mUpdated(false)
+      mIsCompressed(false),
+      mFingerprintValid(false),
+      mFingerprint(0),
+      mContentMapper(0),
+      mFps()
 {
     memset(&mSourceCropf, 0, sizeof(mSourceCropf));
     memset(&mDisplayFrame, 0, sizeof(mDisplayFrame));
     memset(&mStride, 0, sizeof(mStride));
 
     mPlaneCandidate = false;
-    setupAttributes();
-
-#ifdef HWC_TRACE_FPS
-    mTraceFps = false;
-    char prop[PROPERTY_VALUE_MAX];
-    if (property_get("debug.hwc.fps_trace.enable", prop, "0") > 0) {
-        mTraceFps = atoi(prop);
-    }
-    mLastHandle = NULL;
-
-    if (mTraceFps) {
-        // holding up to 6 seconds of samples at 60Hz
-        mFrames.setCapacity(6 * 60);
-    }
-#endif
+    mContentHash = isContentHashEnabled();
+    mFpsTrace = getFpsTraceLevel();
+    setupAttributes(clone);
 }
 
 HwcLayer::~HwcLayer()
@@ -99,12 +101,10 @@ HwcLayer::~HwcLayer()
         WTRACE("HwcLayer is not cleaned up");
     }
 
+    releaseContentMapper();
+
     mLayer = NULL;
     mPlane = NULL;
-
-#ifdef HWC_TRACE_FPS
-    mFrames.clear();
-#endif
 }
 
 bool HwcLayer::attachPlane(DisplayPlane* plane, int device)
@@ -233,11 +233,21 @@ bool HwcLayer::isProtected() const
     return mIsProtected;
 }
 
+bool HwcLayer::isCompressed() const
+{
+    return mIsCompressed;
+}
+
 hwc_layer_1_t* HwcLayer::getLayer() const
 {
     return mLayer;
 }
 
+const hwc_rect_t& HwcLayer::getDisplayFrame() const
+{
+    return mDisplayFrame;
+}
+
 DisplayPlane* HwcLayer::getPlane() const
 {
     return mPlane;
@@ -253,36 +263,36 @@ uint32_t HwcLayer::getPriority() const
     return mPriority;
 }
 
-bool HwcLayer::update(hwc_layer_1_t *layer)
+bool HwcLayer::update(hwc_layer_1_t *layer, const HwcLayer *clone)
 {
     // update layer
     mLayer = layer;
-    setupAttributes();
-
-#ifdef HWC_TRACE_FPS
-    if (mTraceFps && mLayer && mLayer->compositionType != HWC_FRAMEBUFFER_TARGET ) {
-        // 1 second = 1000000000 nano seconds
-        uint64_t now = systemTime(CLOCK_MONOTONIC);
-        if (mLastHandle != mHandle) {
-            mLastHandle = mHandle;
-            mFrames.push(now);
-        }
-        // calculate fps in 5-second time window
-        int frames = mFrames.size();
-        while (frames && now - mFrames[0] > 5000000000LL) {
-            mFrames.removeItemsAt(0);
-            frames--;
+    setupAttributes(clone);
+
+    if (mFpsTrace && mLayer && mLayer->compositionType != HWC_FRAMEBUFFER_TARGET &&
+        mLastHandle != mHandle) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        mLastHandle = mHandle;
+        mFps.frame(now);
+        if (mFpsTrace > 1) {
+            uint32_t fps = mFps.getFps10(now);
+            ITRACE("fps of layer %d is %u.%u", mIndex, fps / 10, fps % 10);
         }
-        double fps = 0;
-        if (frames > 1) {
-            fps = frames * 1000000000.0/ (now - mFrames[0]);
-        }
-        ITRACE("fps of layer %d is %.1f", mIndex, fps);
     }
-#endif
 
     // if not a FB layer & a plane was attached update plane's data buffer
     if (mPlane) {
+        // the plane never came on in the last frame, GLES takes the layer
+        // unless it is protected, then the enable is tried again
+        if (mPlane->takeUpdateFailed()) {
+            WTRACE("plane of layer %d failed to enable", mIndex);
+            if (!mIsProtected) {
+                mHandle = 0;
+                return false;
+            }
+            mPlane->enable();
+        }
+
         mPlane->setPosition(layer->displayFrame.left,
                             layer->displayFrame.top,
                             layer->displayFrame.right - layer->displayFrame.left,
@@ -293,7 +303,22 @@ bool HwcLayer::update(hwc_layer_1_t *layer)
                               layer->sourceCropf.bottom - layer->sourceCropf.top);
         mPlane->setTransform(layer->transform);
         mPlane->setPlaneAlpha(layer->planeAlpha, layer->blending);
+
+        // protected video has to be rendered using overlay, GLES can't
+        // compose it. A frame the plane can't show keeps the last one on
+        // screen rather than falling back.
+        if (mIsProtected && !mPlane->checkDataBuffer(layer->handle)) {
+            DTRACE("protected buffer is not ready");
+            mHandle = 0;
+            if (!mPlane->repeatLastFrame()) {
+                WTRACE("no frame to hold for protected video");
+            }
+            return true;
+        }
+
+        mPlane->setAcquireFence(layer->acquireFenceFd);
         bool ret = mPlane->setDataBuffer(layer->handle);
+        mPlane->setAcquireFence(-1);
         if (ret == true) {
             return true;
         }
@@ -302,18 +327,90 @@ bool HwcLayer::update(hwc_layer_1_t *layer)
         if (!mIsProtected) {
             // typical case: rotated buffer is not ready or handle is null
             return false;
-        } else {
-            // protected video has to be rendered using overlay.
-            // if buffer is not ready overlay will still be attached to this layer
-            // but rendering needs to be skipped.
+        }
+
+        // the back buffer may be half set up, flip the last one again
+        if (!mPlane->repeatLastFrame()) {
             WTRACE("ignoring result of data buffer setting for protected video");
-            return true;
         }
+        return true;
     }
 
     return true;
 }
 
+bool HwcLayer::matches(hwc_layer_1_t *layer, bool anyFrame) const
+{
+    if (!layer || (layer->flags & HWC_SKIP_LAYER) ||
+        mTransform != layer->transform ||
+        mSourceCropf != layer->sourceCropf ||
+        (!anyFrame && mDisplayFrame != layer->displayFrame)) {
+        return false;
+    }
+
+    if (mHandle == layer->handle) {
+        return true;
+    }
+
+    // a new buffer from the same queue keeps its format and size
+    if (!layer->handle || mFormat == DataBuffer::FORMAT_INVALID) {
+        return false;
+    }
+
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    BufferAttributes attributes;
+    if (!bm->getBufferAttributes(layer->handle, attributes)) {
+        return false;
+    }
+
+    return attributes.format == mFormat &&
+           attributes.width == mWidth &&
+           attributes.height == mHeight &&
+           attributes.isProtected == mIsProtected &&
+           attributes.isCompressed == mIsCompressed;
+}
+
+void HwcLayer::rebind(int index, hwc_layer_1_t *layer)
+{
+    // plane and attributes are kept, caller resets the type so that
+    // the composition type is written to the new layer
+    mIndex = index;
+    mZOrder = index + 1;
+    mLayer = layer;
+}
+
+bool HwcLayer::isUnchanged(hwc_layer_1_t *layer) const
+{
+    // content of a reused handle can only be checked on the update path
+    if (!layer || mContentHash ||
+        (layer->flags & HWC_SKIP_LAYER) ||
+        layer->acquireFenceFd != -1 ||
+        DisplayQuery::isVideoFormat(mFormat)) {
+        return false;
+    }
+
+    return mHandle == layer->handle &&
+           mTransform == layer->transform &&
+           mSourceCropf == layer->sourceCropf &&
+           mDisplayFrame == layer->displayFrame &&
+           mBlending == (uint32_t)layer->blending &&
+           mPlaneAlpha == layer->planeAlpha;
+}
+
+void HwcLayer::markStatic(hwc_layer_1_t *layer)
+{
+    mLayer = layer;
+    mUpdated = false;
+    // protect it from exceeding its max
+    if (mStaticCount < LAYER_STATIC_COUNT_MAX)
+        mStaticCount++;
+}
+
+uint32_t HwcLayer::getFps10(nsecs_t now) const
+{
+    return mFps.getFps10(now);
+}
+
 bool HwcLayer::isUpdated()
 {
     return mUpdated;
@@ -342,21 +439,114 @@ void HwcLayer::postFlip()
     }
 }
 
-void HwcLayer::setupAttributes()
+static bool isContentHashEnabled()
 {
+    static int enabled = -1;
+    if (enabled < 0) {
+        char prop[PROPERTY_VALUE_MAX];
+        enabled = 0;
+        if (property_get("hwc.content_hash.enable", prop, "0") > 0) {
+            enabled = atoi(prop) ? 1 : 0;
+        }
+    }
+    return enabled;
+}
+
+static int getFpsTraceLevel()
+{
+    // looked up again at most once a second so it can be switched at runtime
+    static int level = 1;
+    static nsecs_t checked = 0;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (!checked || now - checked > FpsMeter::IDLE_TIMEOUT) {
+        char prop[PROPERTY_VALUE_MAX];
+        if (property_get("debug.hwc.fps_trace.enable", prop, "1") > 0) {
+            level = atoi(prop);
+        }
+        checked = now;
+    }
+    return level;
+}
+
+bool HwcLayer::isContentChanged()
+{
+    if (mIsProtected || !mHandle || mFormat == DataBuffer::FORMAT_INVALID) {
+        return false;
+    }
+
+    // map once the layer turns static, the mapping stays until the
+    // handle changes
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    if (!mContentMapper) {
+        DataBufferLocker locker(bm, mHandle);
+        if (!locker.get()) {
+            return false;
+        }
+        mContentMapper = bm->map(*locker.get(), BufferManager::MAPPING_OWNER_LAYER);
+        mFingerprintValid = false;
+        if (!mContentMapper) {
+            // don't retry every frame
+            mContentHash = false;
+            return false;
+        }
+    }
+
+    const uint32_t *data = (const uint32_t*)mContentMapper->getCpuAddress(0);
+    uint32_t words = mContentMapper->getSize(0) / sizeof(uint32_t);
+    if (!data || !words) {
+        return false;
+    }
+
+    // FNV-1a over evenly spaced words, the step is odd so that samples
+    // don't all land on the same columns of every row
+    uint32_t step = words / LAYER_FINGERPRINT_SAMPLES;
+    step = step ? (step | 1) : 1;
+    uint32_t h = 2166136261UL;
+    for (uint32_t i = 0; i < words; i += step) {
+        h ^= data[i];
+        h *= 16777619UL;
+    }
+
+    bool changed = mFingerprintValid && h != mFingerprint;
+    mFingerprint = h;
+    mFingerprintValid = true;
+    return changed;
+}
+
+void HwcLayer::releaseContentMapper()
+{
+    if (mContentMapper) {
+        Hwcomposer::getInstance().getBufferManager()->unmap(mContentMapper,
+                BufferManager::MAPPING_OWNER_LAYER);
+        mContentMapper = 0;
+    }
+    mFingerprintValid = false;
+}
+
+void HwcLayer::setupAttributes(const HwcLayer *clone)
+{
+    // the same buffer is shown by the display this one mirrors
+    if (clone && clone->mHandle != mLayer->handle) {
+        clone = NULL;
+    }
+
     if ((mLayer->flags & HWC_SKIP_LAYER) ||
         mTransform != mLayer->transform ||
         mSourceCropf != mLayer->sourceCropf ||
         mDisplayFrame != mLayer->displayFrame ||
         mHandle != mLayer->handle ||
         DisplayQuery::isVideoFormat(mFormat)) {
-        // TODO: same handle does not mean there is always no update
+        mUpdated = true;
+        mStaticCount = 0;
+        releaseContentMapper();
+    } else if (mContentHash && (clone ? clone->mUpdated : isContentChanged())) {
+        // same handle does not mean there is no update
         mUpdated = true;
         mStaticCount = 0;
     } else {
         // protect it from exceeding its max
-        if (++mStaticCount > 1000)
-            mStaticCount = LAYER_STATIC_THRESHOLD + 1;
+        if (mStaticCount < LAYER_STATIC_COUNT_MAX)
+            mStaticCount++;
     }
 
     // update handle always as it can become "NULL"
@@ -365,6 +555,8 @@ void HwcLayer::setupAttributes()
     mSourceCropf = mLayer->sourceCropf;
     mDisplayFrame = mLayer->displayFrame;
     mHandle = mLayer->handle;
+    mBlending = mLayer->blending;
+    mPlaneAlpha = mLayer->planeAlpha;
 
     if (mFormat != DataBuffer::FORMAT_INVALID) {
         // other attributes have been set.
@@ -376,32 +568,47 @@ void HwcLayer::setupAttributes()
         return;
     }
 
-    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
-    if (bm == NULL) {
-        // TODO: this check is redundant
-        return;
-    }
+    if (clone && clone->mFormat != DataBuffer::FORMAT_INVALID) {
+        mFormat = clone->mFormat;
+        mWidth = clone->mWidth;
+        mHeight = clone->mHeight;
+        mStride = clone->mStride;
+        mUsage = clone->mUsage;
+        mIsProtected = clone->mIsProtected;
+        mIsCompressed = clone->mIsCompressed;
+    } else {
+        BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+        if (bm == NULL) {
+            // TODO: this check is redundant
+            return;
+        }
 
-    DataBuffer *buffer = bm->lockDataBuffer(mLayer->handle);
-     if (!buffer) {
-         ETRACE("failed to get buffer");
-     } else {
-        mFormat = buffer->getFormat();
-        mWidth = buffer->getWidth();
-        mHeight = buffer->getHeight();
-        mStride = buffer->getStride();
-        mPriority = (mSourceCropf.right - mSourceCropf.left) * (mSourceCropf.bottom - mSourceCropf.top);
-        mPriority <<= LAYER_PRIORITY_SIZE_OFFSET;
-        mPriority |= mIndex;
-        GraphicBuffer *gBuffer = (GraphicBuffer*)buffer;
-        mUsage = gBuffer->getUsage();
-        mIsProtected = GraphicBuffer::isProtectedBuffer((GraphicBuffer*)buffer);
-        if (mIsProtected) {
-            mPriority |= LAYER_PRIORITY_PROTECTED;
-        } else if (PlaneCapabilities::isFormatSupported(DisplayPlane::PLANE_OVERLAY, this)) {
-            mPriority |= LAYER_PRIORITY_OVERLAY;
+        BufferAttributes attributes;
+        if (!bm->getBufferAttributes(mHandle, attributes)) {
+            ETRACE("failed to get buffer");
+            return;
         }
-        bm->unlockDataBuffer(buffer);
+
+        mFormat = attributes.format;
+        mWidth = attributes.width;
+        mHeight = attributes.height;
+        mStride = attributes.stride;
+        mUsage = attributes.usage;
+        mIsProtected = attributes.isProtected;
+        mIsCompressed = attributes.isCompressed;
+    }
+
+    mPriority = (mSourceCropf.right - mSourceCropf.left) * (mSourceCropf.bottom - mSourceCropf.top);
+    mPriority <<= LAYER_PRIORITY_SIZE_OFFSET;
+    mPriority |= mIndex;
+    if (mIsProtected) {
+        mPriority |= LAYER_PRIORITY_PROTECTED;
+    } else if (PlaneCapabilities::isFormatSupported(DisplayPlane::PLANE_OVERLAY, this)) {
+        mPriority |= LAYER_PRIORITY_OVERLAY;
+    } else if (mIsCompressed) {
+        // sprite planes scan compressed buffers out as they are, keep
+        // them ahead of uncompressed layers
+        mPriority |= LAYER_PRIORITY_COMPRESSED;
     }
 }
 
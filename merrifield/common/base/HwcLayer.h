@@ -18,15 +18,18 @@
 
 #include <hardware/hwcomposer.h>
 #include <DisplayPlane.h>
+#include <BufferMapper.h>
 #include <utils/Vector.h>
-
-//#define HWC_TRACE_FPS
+#include <FpsMeter.h>
 
 namespace android {
 namespace intel {
 
 enum {
-    LAYER_STATIC_THRESHOLD = 10,
+    // the static count saturates there, thresholds are below it
+    LAYER_STATIC_COUNT_MAX = 1000,
+    // 32-bit words read per content fingerprint
+    LAYER_FINGERPRINT_SAMPLES = 1024,
 };
 
 class HwcLayer {
@@ -53,12 +56,15 @@ public:
     };
 
     enum {
+        LAYER_PRIORITY_COMPRESSED = 0x10000000UL,
         LAYER_PRIORITY_OVERLAY = 0x60000000UL,
         LAYER_PRIORITY_PROTECTED = 0x70000000UL,
         LAYER_PRIORITY_SIZE_OFFSET = 4,
     };
 public:
-    HwcLayer(int index, hwc_layer_1_t *layer);
+    // clone is the layer showing the same buffer on the display this one
+    // mirrors, its buffer attributes and content checks are reused
+    HwcLayer(int index, hwc_layer_1_t *layer, const HwcLayer *clone = NULL);
     virtual ~HwcLayer();
 
     // plane operations
@@ -80,53 +86,78 @@ public:
     buffer_handle_t getHandle() const;
     uint32_t getTransform() const;
     bool isProtected() const;
+    bool isCompressed() const;
     hwc_layer_1_t* getLayer() const;
+    // display frame of the last update
+    const hwc_rect_t& getDisplayFrame() const;
     DisplayPlane* getPlane() const;
 
     void setPriority(uint32_t priority);
     uint32_t getPriority() const;
 
-    bool update(hwc_layer_1_t *layer);
+    bool update(hwc_layer_1_t *layer, const HwcLayer *clone = NULL);
+    // incremental geometry change: whether the new layer shows the same
+    // content the same way, and moves this layer to its new position. With
+    // anyFrame the display frame may have moved or scaled.
+    bool matches(hwc_layer_1_t *layer, bool anyFrame = false) const;
+    void rebind(int index, hwc_layer_1_t *layer);
+    // idle frame: whether the layer is presented exactly as last frame,
+    // and counts such a frame without touching the plane
+    bool isUnchanged(hwc_layer_1_t *layer) const;
+    void markStatic(hwc_layer_1_t *layer);
     void postFlip();
     bool isUpdated();
     uint32_t getStaticCount();
+    // buffer rate of the layer in tenths of a frame per second
+    uint32_t getFps10(nsecs_t now) const;
 
 public:
     // temporary solution for plane assignment
     bool mPlaneCandidate;
 
 private:
-    void setupAttributes();
+    void setupAttributes(const HwcLayer *clone = NULL);
+    bool isContentChanged();
+    void releaseContentMapper();
 
 private:
-    const int mIndex;
-    int mZOrder;
-    int mDevice;
+    // read or written for every layer of every frame by update(),
+    // isUnchanged(), markStatic() and the smart composition, kept first
+    // so that they share the first cache lines of the layer
     hwc_layer_1_t *mLayer;
     DisplayPlane *mPlane;
-    uint32_t mFormat;
-    uint32_t mWidth;
-    uint32_t mHeight;
-    stride_t mStride;
-    uint32_t mUsage;
     buffer_handle_t mHandle;
-    bool mIsProtected;
+    int mIndex;
+    int mZOrder;
+    int mDevice;
     uint32_t mType;
-    uint32_t mPriority;
+    uint32_t mFormat;
     uint32_t mTransform;
-
-    // for smart composition
     hwc_frect_t mSourceCropf;
     hwc_rect_t mDisplayFrame;
+    uint32_t mBlending;
     uint32_t mStaticCount;
+    uint8_t mPlaneAlpha;
     bool mUpdated;
-
-#ifdef HWC_TRACE_FPS
-    // for frame per second trace
-    bool mTraceFps;
+    bool mIsProtected;
+    // sampled content fingerprint, catches updates to a buffer that is
+    // presented again under the same handle
+    bool mContentHash;
+    // frame rate of the layer, 0 turns it off, 2 also logs every frame
+    int mFpsTrace;
     buffer_handle_t mLastHandle;
-    Vector<uint64_t>  mFrames;
-#endif
+
+    // set up when the buffer changes, or read by the plane assignment
+    uint32_t mWidth;
+    uint32_t mHeight;
+    stride_t mStride;
+    uint32_t mUsage;
+    uint32_t mPriority;
+    bool mIsCompressed;
+    bool mFingerprintValid;
+    uint32_t mFingerprint;
+    BufferMapper *mContentMapper;
+    FpsMeter mFps;
 };
 
 
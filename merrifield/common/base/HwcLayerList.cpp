@@ -13,6 +13,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <string.h>
+#include <unistd.h>
+#include <sync/sync.h>
 #include <HwcTrace.h>
 #include <Drm.h>
 #include <HwcLayerList.h>
@@ -20,12 +23,14 @@
 #include <GraphicBuffer.h>
 #include <IDisplayDevice.h>
 #include <PlaneCapabilities.h>
-#include <DisplayQuery.h>
 
 namespace android {
 namespace intel {
 
-HwcLayerList::HwcLayerList(hwc_display_contents_1_t *list, int disp)
+HwcLayerList::HwcLayerList(hwc_display_contents_1_t *list, int disp,
+                           PlaneAssignmentCache *cache, bool protectedOutput,
+                           CompositionLog *log, const HwcLayerList *clone,
+                           BlitComposer *blitter)
     : mList(list),
       mLayerCount(0),
       mLayers(),
@@ -36,8 +41,34 @@ HwcLayerList::HwcLayerList(hwc_display_contents_1_t *list, int disp)
       mZOrderConfig(),
       mFrameBufferTarget(NULL),
       mDisplayIndex(disp),
-      mLayerSize(0)
+      mStaticSavings(0),
+      mAssignmentCache(cache),
+      mSignature(),
+      mAssignment(),
+      mFallbackPending(false),
+      mPartialFallback(false),
+      mSearch(),
+      mIdle(false),
+      mDamage(),
+      mAttachedMappers(),
+      mProtectedLayers(0),
+      mProtectedOutput(protectedOutput),
+      mArena(),
+      mLog(log),
+      mDecisions(),
+      mDecisionFlags(0),
+      mDecisionPending(false),
+      mClone(clone),
+      mVerdicts(),
+      mBlitComposer(blitter),
+      mBlitting(false),
+      mPrerender("Prerendered layers"),
+      mFoldCarrier(-1),
+      mFoldedLayers(),
+      mMovedMerges(0),
+      mMovedStreak(0)
 {
+    memset(mOverlap, 0, sizeof(mOverlap));
     initialize();
 }
 
@@ -46,7 +77,17 @@ HwcLayerList::~HwcLayerList()
     deinitialize();
 }
 
-bool HwcLayerList::checkSupported(int planeType, HwcLayer *hwcLayer)
+// records why a layer was turned down, for the composition log
+static inline bool reject(uint8_t *reason, int code)
+{
+    if (reason) {
+        *reason = code;
+    }
+    return false;
+}
+
+bool HwcLayerList::checkSupported(int planeType, HwcLayer *hwcLayer,
+                                  uint8_t *reason)
 {
     bool valid = false;
     hwc_layer_1_t& layer = *(hwcLayer->getLayer());
@@ -54,113 +95,207 @@ bool HwcLayerList::checkSupported(int planeType, HwcLayer *hwcLayer)
     // if layer was forced to use FB
     if (hwcLayer->getType() == HwcLayer::LAYER_FORCE_FB) {
         VTRACE("layer was forced to use HWC_FRAMEBUFFER");
-        return false;
+        return reject(reason, CompositionLog::REASON_FORCED_FB);
+    }
+
+    uint8_t code = getVerdict(planeType, hwcLayer);
+    if (code != CompositionLog::REASON_NONE) {
+        return reject(reason, code);
+    }
+
+    // GLES blacks out what the output can't protect
+    if (hwcLayer->isProtected() && !mProtectedOutput) {
+        VTRACE("plane type %d: (output not protected)", planeType);
+        return reject(reason, CompositionLog::REASON_UNPROTECTED_OUTPUT);
+    }
+
+    // rotation is stalling frames, let GLES rotate what it can
+    if (planeType == DisplayPlane::PLANE_OVERLAY &&
+        (layer.transform & HAL_TRANSFORM_ROT_90) &&
+        !hwcLayer->isProtected() &&
+        Hwcomposer::getInstance().getJankDetector()->isPolicyActive(
+            JankDetector::POLICY_AVOID_ROTATION)) {
+        VTRACE("plane type %d: (rotation avoided)", planeType);
+        return reject(reason, CompositionLog::REASON_ROTATION_AVOIDED);
+    }
+
+    // check buffer size
+    valid = PlaneCapabilities::isSizeSupported(planeType, hwcLayer);
+    if (!valid) {
+        VTRACE("plane type %d: (bad buffer size)", planeType);
+        return reject(reason, CompositionLog::REASON_SIZE);
+    }
+
+    // check layer scaling
+    valid = PlaneCapabilities::isScalingSupported(planeType, hwcLayer);
+    if (!valid) {
+        VTRACE("plane type %d: (bad scaling)", planeType);
+        return reject(reason, CompositionLog::REASON_SCALING);
     }
 
+    // TODO: check visible region?
+    return true;
+}
+
+uint8_t HwcLayerList::checkLayer(int planeType, HwcLayer *hwcLayer)
+{
+    hwc_layer_1_t& layer = *(hwcLayer->getLayer());
+
     // check layer flags
     if (layer.flags & HWC_SKIP_LAYER) {
         VTRACE("plane type %d: (skip layer flag was set)", planeType);
-        return false;
+        return CompositionLog::REASON_SKIP_LAYER;
     }
 
     if (layer.handle == 0) {
         WTRACE("invalid buffer handle");
-        return false;
+        return CompositionLog::REASON_NO_HANDLE;
     }
 
     // check usage
     if (!hwcLayer->getUsage() & GRALLOC_USAGE_HW_COMPOSER) {
         WTRACE("not a composer layer");
-        return false;
+        return CompositionLog::REASON_NOT_COMPOSER;
     }
 
     // check layer transform
-    valid = PlaneCapabilities::isTransformSupported(planeType, hwcLayer);
-    if (!valid) {
+    if (!PlaneCapabilities::isTransformSupported(planeType, hwcLayer)) {
         VTRACE("plane type %d: (bad transform)", planeType);
-        return false;
+        return CompositionLog::REASON_TRANSFORM;
     }
 
     // check buffer format
-    valid = PlaneCapabilities::isFormatSupported(planeType, hwcLayer);
-    if (!valid) {
+    if (!PlaneCapabilities::isFormatSupported(planeType, hwcLayer)) {
         VTRACE("plane type %d: (bad buffer format)", planeType);
-        return false;
-    }
-
-    // check buffer size
-    valid = PlaneCapabilities::isSizeSupported(planeType, hwcLayer);
-    if (!valid) {
-        VTRACE("plane type %d: (bad buffer size)", planeType);
-        return false;
+        return CompositionLog::REASON_FORMAT;
     }
 
     // check layer blending
-    valid = PlaneCapabilities::isBlendingSupported(planeType, hwcLayer);
-    if (!valid) {
+    if (!PlaneCapabilities::isBlendingSupported(planeType, hwcLayer)) {
         VTRACE("plane type %d: (bad blending)", planeType);
-        return false;
+        return CompositionLog::REASON_BLENDING;
     }
 
-    // check layer scaling
-    valid = PlaneCapabilities::isScalingSupported(planeType, hwcLayer);
-    if (!valid) {
-        VTRACE("plane type %d: (bad scaling)", planeType);
-        return false;
+    return CompositionLog::REASON_NONE;
+}
+
+uint8_t HwcLayerList::getVerdict(int planeType, HwcLayer *hwcLayer)
+{
+    hwc_layer_1_t& layer = *(hwcLayer->getLayer());
+    int index = hwcLayer->getIndex();
+    uint8_t code;
+
+    const Verdict *cloned = NULL;
+    if (mClone && index < (int)mClone->mVerdicts.size()) {
+        cloned = &mClone->mVerdicts.itemAt(index);
+        if (!(cloned->checked & (1 << planeType)) ||
+            cloned->handle != hwcLayer->getHandle() ||
+            cloned->transform != layer.transform ||
+            cloned->blending != layer.blending ||
+            cloned->planeAlpha != layer.planeAlpha ||
+            cloned->skip != (layer.flags & HWC_SKIP_LAYER)) {
+            cloned = NULL;
+        }
     }
 
-    // TODO: check visible region?
-    return true;
+    if (cloned) {
+        code = cloned->reasons[planeType];
+    } else {
+        code = checkLayer(planeType, hwcLayer);
+    }
+
+    // kept for a display mirroring this one
+    if (index < (int)mVerdicts.size()) {
+        Verdict& verdict = mVerdicts.editItemAt(index);
+        if (verdict.handle != hwcLayer->getHandle()) {
+            verdict.checked = 0;
+        }
+        verdict.handle = hwcLayer->getHandle();
+        verdict.transform = layer.transform;
+        verdict.blending = layer.blending;
+        verdict.planeAlpha = layer.planeAlpha;
+        verdict.skip = layer.flags & HWC_SKIP_LAYER;
+        verdict.checked |= (1 << planeType);
+        verdict.reasons[planeType] = code;
+    }
+    return code;
 }
 
-bool HwcLayerList::checkCursorSupported(HwcLayer *hwcLayer)
+void HwcLayerList::resetVerdicts(int count)
+{
+    Verdict verdict;
+    memset(&verdict, 0, sizeof(verdict));
+    mVerdicts.clear();
+    mVerdicts.insertAt(verdict, 0, count);
+}
+
+const HwcLayer* HwcLayerList::getCloneLayer(int index, hwc_layer_1_t *layer) const
+{
+    if (!mClone || mClone->mLayerCount != mLayerCount ||
+        index >= (int)mClone->mLayers.size()) {
+        return NULL;
+    }
+
+    const HwcLayer *clone = mClone->mLayers.itemAt(index);
+    if (!clone || clone->getLayer()->handle != layer->handle) {
+        return NULL;
+    }
+    return clone;
+}
+
+void HwcLayerList::setCloneSource(const HwcLayerList *source)
+{
+    mClone = (source != this) ? source : NULL;
+}
+
+bool HwcLayerList::checkCursorSupported(HwcLayer *hwcLayer, uint8_t *reason)
 {
     hwc_layer_1_t& layer = *(hwcLayer->getLayer());
 
     // if layer was forced to use FB
     if (hwcLayer->getType() == HwcLayer::LAYER_FORCE_FB) {
         VTRACE("layer was forced to use HWC_FRAMEBUFFER");
-        return false;
+        return reject(reason, CompositionLog::REASON_FORCED_FB);
     }
 
     // check layer flags
     if (layer.flags & HWC_SKIP_LAYER) {
         VTRACE("skip layer flag was set");
-        return false;
+        return reject(reason, CompositionLog::REASON_SKIP_LAYER);
     }
 
     if (!(layer.flags & HWC_IS_CURSOR_LAYER)) {
         VTRACE("not a cursor layer");
-        return false;
+        return reject(reason, CompositionLog::REASON_NOT_CURSOR);
     }
 
     if (hwcLayer->getIndex() != mLayerCount - 2) {
         WTRACE("cursor layer is not on top of zorder");
-        return false;
+        return reject(reason, CompositionLog::REASON_CURSOR_ZORDER);
     }
 
     if (layer.handle == 0) {
         WTRACE("invalid buffer handle");
-        return false;
+        return reject(reason, CompositionLog::REASON_NO_HANDLE);
     }
 
     // check usage
     if (!(hwcLayer->getUsage() & GRALLOC_USAGE_HW_COMPOSER)) {
         WTRACE("not a composer layer");
-        return false;
+        return reject(reason, CompositionLog::REASON_NOT_COMPOSER);
     }
 
     uint32_t format = hwcLayer->getFormat();
     if (format != HAL_PIXEL_FORMAT_BGRA_8888 &&
         format != HAL_PIXEL_FORMAT_RGBA_8888) {
         WTRACE("unexpected color format %u for cursor", format);
-        return false;
+        return reject(reason, CompositionLog::REASON_FORMAT);
     }
 
     uint32_t trans = hwcLayer->getLayer()->transform;
     if (trans != 0) {
         WTRACE("unexpected transform %u for cursor", trans);
-        return false;
+        return reject(reason, CompositionLog::REASON_TRANSFORM);
     }
 
     hwc_frect_t& src = hwcLayer->getLayer()->sourceCropf;
@@ -175,26 +310,10 @@ bool HwcLayerList::checkCursorSupported(HwcLayer *hwcLayer)
         //return false;
     }
 
-    if (srcW > 256 || srcH > 256) {
+    // the plane pads any image up to 256x256 to a size it scans out
+    if (srcW <= 0 || srcH <= 0 || srcW > 256 || srcH > 256) {
         WTRACE("unexpected size %dx%d for cursor", srcW, srcH);
-        return false;
-    }
-
-    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
-    if (bm) {
-        DataBuffer *buffer = bm->lockDataBuffer(hwcLayer->getHandle());
-        if (buffer) {
-            uint32_t w = buffer->getWidth();
-            uint32_t h = buffer->getHeight();
-
-            if ((w != 64 || h != 64) &&
-                (w != 128 || h != 128) &&
-                (w != 256 || h != 256)) {
-                bm->unlockDataBuffer(buffer);
-                return false;
-            }
-        }
-        bm->unlockDataBuffer(buffer);
+        return reject(reason, CompositionLog::REASON_SIZE);
     }
 
     return true;
@@ -216,17 +335,37 @@ bool HwcLayerList::initialize()
     mZOrderConfig.setCapacity(mLayerCount);
     Hwcomposer& hwc = Hwcomposer::getInstance();
 
+    // room for every layer plus a z order entry per layer and plane
+    mArena.reserve(mLayerCount * sizeof(HwcLayer) +
+                   (mLayerCount + DisplayPlane::PLANE_MAX) * sizeof(ZOrderLayer));
+
+    // layer stack signature used to look up memoized plane assignment
+    mSignature.clear();
+    mSignature.setCapacity(mLayerCount * 12 + DisplayPlane::PLANE_MAX + 2);
+
+    mDecisions.clear();
+    mDecisions.setCapacity(mLayerCount);
+    mDecisionFlags = 0;
+    mDecisionPending = true;
+    resetVerdicts(mLayerCount);
+
     for (int i = 0; i < mLayerCount; i++) {
         hwc_layer_1_t *layer = &mList->hwLayers[i];
         if (!layer) {
             DEINIT_AND_RETURN_FALSE("layer %d is null", i);
         }
 
-        HwcLayer *hwcLayer = new HwcLayer(i, layer);
+        HwcLayer *hwcLayer = new (mArena.alloc(sizeof(HwcLayer)))
+                HwcLayer(i, layer, getCloneLayer(i, layer));
         if (!hwcLayer) {
             DEINIT_AND_RETURN_FALSE("failed to allocate hwc layer %d", i);
         }
 
+        int candidate = -1;
+        CompositionLog::Layer decision;
+        memset(&decision, 0, sizeof(decision));
+        uint8_t *rejects = decision.rejects;
+
         if (layer->compositionType == HWC_FRAMEBUFFER_TARGET) {
             hwcLayer->setType(HwcLayer::LAYER_FRAMEBUFFER_TARGET);
             mFrameBufferTarget = hwcLayer;
@@ -242,13 +381,21 @@ bool HwcLayerList::initialize()
             // by default use GPU composition
             hwcLayer->setType(HwcLayer::LAYER_FB);
             mFBLayers.add(hwcLayer);
-            if (checkCursorSupported(hwcLayer)) {
+            if (checkCursorSupported(hwcLayer,
+                                     &rejects[DisplayPlane::PLANE_CURSOR])) {
                 mCursorCandidates.add(hwcLayer);
-            } else if (checkSupported(DisplayPlane::PLANE_SPRITE, hwcLayer)) {
+                candidate = DisplayPlane::PLANE_CURSOR;
+            } else if (checkSupported(DisplayPlane::PLANE_SPRITE, hwcLayer,
+                                      &rejects[DisplayPlane::PLANE_SPRITE])) {
                 mSpriteCandidates.add(hwcLayer);
-            } else if (hwc.getDisplayAnalyzer()->isOverlayAllowed() &&
-                checkSupported(DisplayPlane::PLANE_OVERLAY, hwcLayer)) {
+                candidate = DisplayPlane::PLANE_SPRITE;
+            } else if (!hwc.getDisplayAnalyzer()->isOverlayAllowed()) {
+                rejects[DisplayPlane::PLANE_OVERLAY] =
+                        CompositionLog::REASON_OVERLAY_DISALLOWED;
+            } else if (checkSupported(DisplayPlane::PLANE_OVERLAY, hwcLayer,
+                                      &rejects[DisplayPlane::PLANE_OVERLAY])) {
                 mOverlayCandidates.add(hwcLayer);
+                candidate = DisplayPlane::PLANE_OVERLAY;
             } else {
                 // noncandidate layer
             }
@@ -259,6 +406,22 @@ bool HwcLayerList::initialize()
         }
         // add layer to layer list
         mLayers.add(hwcLayer);
+        decision.candidate = candidate;
+        mDecisions.push_back(decision);
+
+        mSignature.push_back(hwcLayer->getType());
+        mSignature.push_back((uint32_t)candidate);
+        mSignature.push_back(hwcLayer->getFormat());
+        mSignature.push_back(layer->transform);
+        mSignature.push_back(layer->blending);
+        mSignature.push_back(layer->planeAlpha);
+        mSignature.push_back(hwcLayer->isProtected());
+        mSignature.push_back(layer->displayFrame.left);
+        mSignature.push_back(layer->displayFrame.top);
+        mSignature.push_back(layer->displayFrame.right);
+        mSignature.push_back(layer->displayFrame.bottom);
+        mSignature.push_back(((int)(layer->sourceCropf.right - layer->sourceCropf.left) << 16) |
+                             ((int)(layer->sourceCropf.bottom - layer->sourceCropf.top) & 0xffff));
     }
 
     if (mFrameBufferTarget == NULL) {
@@ -266,6 +429,17 @@ bool HwcLayerList::initialize()
         return false;
     }
 
+    updateProtectedCount();
+
+    // plane availability changes the outcome of the search as well
+    DisplayPlaneManager *planeManager = hwc.getPlaneManager();
+    mSignature.push_back(mDisplayIndex);
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        mSignature.push_back(planeManager->getFreePlanes(mDisplayIndex, i));
+    }
+
+    buildOverlapMatrix();
+
     // If has layer besides of FB_Target, but no FBLayers, skip plane allocation
     // Note: There is case that SF passes down a layerlist with only FB_Target
     // layer; we need to have this FB_Target to be flipped as well, otherwise it
@@ -277,6 +451,7 @@ bool HwcLayerList::initialize()
     }
 
     allocatePlanes();
+    traceFrameBufferLayers();
 
     //dump();
     return true;
@@ -284,6 +459,7 @@ bool HwcLayerList::initialize()
 
 void HwcLayerList::deinitialize()
 {
+    releaseAttachedBuffers();
     if (mLayerCount == 0) {
         return;
     }
@@ -297,7 +473,7 @@ void HwcLayerList::deinitialize()
                 planeManager->reclaimPlane(mDisplayIndex, *plane);
             }
         }
-        delete hwcLayer;
+        mArena.destroy(hwcLayer);
     }
 
     mLayers.clear();
@@ -306,16 +482,479 @@ void HwcLayerList::deinitialize()
     mSpriteCandidates.clear();
     mCursorCandidates.clear();
     mZOrderConfig.clear();
+    mDecisions.clear();
+    mVerdicts.clear();
     mFrameBufferTarget = NULL;
     mLayerCount = 0;
+    mArena.reset();
+    updateProtectedCount();
+}
+
+void HwcLayerList::getPlaneUsage(uint32_t planeLayers[DisplayPlane::PLANE_MAX],
+                                 uint32_t *frameBufferLayers) const
+{
+    memset(planeLayers, 0, DisplayPlane::PLANE_MAX * sizeof(uint32_t));
+    // the frame buffer target is counted on its plane
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        DisplayPlane *plane = mLayers.itemAt(i)->getPlane();
+        if (plane && plane->getType() >= 0 &&
+            plane->getType() < DisplayPlane::PLANE_MAX) {
+            planeLayers[plane->getType()]++;
+        }
+    }
+    *frameBufferLayers = mFBLayers.size();
 }
 
+void HwcLayerList::updateProtectedCount()
+{
+    // the protected bit comes from the buffer attribute cache when a layer
+    // first sees its handle, reading it back takes no buffer lock
+    int count = 0;
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        if (mLayers.itemAt(i)->isProtected()) {
+            count++;
+        }
+    }
+
+    mProtectedLayers = count;
+}
+
+
+bool HwcLayerList::mergeGeometry(hwc_display_contents_1_t *list)
+{
+    if (!list || list->numHwLayers == 0 || mLayerCount == 0 ||
+        !mFrameBufferTarget) {
+        return false;
+    }
+
+    // folded layers have no plane and SurfaceFlinger draws them again
+    if (mFoldCarrier >= 0) {
+        return false;
+    }
+
+    int count = (int)list->numHwLayers;
+    if (list->hwLayers[count - 1].compositionType != HWC_FRAMEBUFFER_TARGET) {
+        return false;
+    }
+
+    // nothing to keep if everything was composed to the frame buffer
+    // target, and the layer stack must be split the same way around it
+    DisplayPlane *fbPlane = mFrameBufferTarget->getPlane();
+    if (!fbPlane) {
+        return false;
+    }
+    int fbZOrder = fbPlane->getZOrder();
+
+    Hwcomposer& hwc = Hwcomposer::getInstance();
+    bool overlayAllowed = hwc.getDisplayAnalyzer()->isOverlayAllowed();
+    // during touch the planes stay pinned, new layers are composed by GLES
+    // unless they can't be
+    bool pinned = hwc.getInputBoost()->isActive();
+
+    // match old layers to the new list in order, unmatched old layers
+    // with a plane attached can't be kept
+    Vector<HwcLayer*> layers;
+    Vector<HwcLayer*> created;
+    Vector<HwcLayer*> removed;
+    layers.insertAt(NULL, 0, count);
+    removed.setCapacity(mLayerCount);
+    const hwc_rect_t& screen = list->hwLayers[count - 1].displayFrame;
+    int moved = 0;
+
+    int next = 0;
+    for (int i = 0; i < mLayerCount - 1; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        uint32_t type = hwcLayer->getType();
+        DisplayPlane *plane = hwcLayer->getPlane();
+
+        if (type != HwcLayer::LAYER_FB &&
+            type != HwcLayer::LAYER_FORCE_FB &&
+            type != HwcLayer::LAYER_OVERLAY &&
+            type != HwcLayer::LAYER_CURSOR_OVERLAY) {
+            return false;
+        }
+
+        if (plane && plane->getType() == DisplayPlane::PLANE_OVERLAY &&
+            !overlayAllowed) {
+            return false;
+        }
+
+        int j = next;
+        while (j < count - 1 && !hwcLayer->matches(&list->hwLayers[j])) {
+            j++;
+        }
+
+        // animations move and scale the layers on planes every frame, the
+        // plane is kept as long as it can show the layer at its new frame
+        if (j == count - 1 && plane) {
+            j = next;
+            while (j < count - 1 &&
+                   !hwcLayer->matches(&list->hwLayers[j], true)) {
+                j++;
+            }
+            if (j < count - 1 && !isMoveSupported(hwcLayer, i, j,
+                                                  &list->hwLayers[j], screen)) {
+                VTRACE("layer %d can't be moved on its plane", i);
+                return false;
+            }
+            if (j < count - 1) {
+                moved++;
+            }
+        }
+
+        if (j < count - 1) {
+            layers.editItemAt(j) = hwcLayer;
+            next = j + 1;
+        } else if (plane) {
+            VTRACE("layer %d with plane removed", i);
+            return false;
+        } else {
+            removed.push_back(hwcLayer);
+        }
+    }
+
+    // new layers go to the frame buffer target, which must be at the same
+    // position in z order. Layers that want a plane of their own (video,
+    // cursor) need a full plane assignment.
+    bool ok = true;
+    int planes = 0;
+    int fbLayers = 0;
+    for (int j = 0; j < count - 1 && ok; j++) {
+        hwc_layer_1_t *layer = &list->hwLayers[j];
+        if (layer->compositionType != HWC_FRAMEBUFFER &&
+            layer->compositionType != HWC_FORCE_FRAMEBUFFER) {
+            ok = false;
+            break;
+        }
+
+        HwcLayer *hwcLayer = layers.itemAt(j);
+        if (hwcLayer && hwcLayer->getPlane()) {
+            planes++;
+            continue;
+        }
+
+        fbLayers++;
+        if (planes != fbZOrder) {
+            ok = false;
+            break;
+        }
+
+        if (!hwcLayer) {
+            hwcLayer = new (mArena.alloc(sizeof(HwcLayer))) HwcLayer(j, layer);
+            if (!hwcLayer) {
+                ok = false;
+                break;
+            }
+            layers.editItemAt(j) = hwcLayer;
+            created.push_back(hwcLayer);
+
+            if (layer->compositionType == HWC_FRAMEBUFFER &&
+                (hwcLayer->isProtected() ||
+                 (!pinned && checkCursorSupported(hwcLayer)) ||
+                 (!pinned && overlayAllowed &&
+                  checkSupported(DisplayPlane::PLANE_OVERLAY, hwcLayer)))) {
+                ok = false;
+            }
+        }
+    }
+
+    if (!ok || planes == 0 || fbLayers == 0) {
+        // drop the layers created above, the old list stays intact
+        for (size_t i = 0; i < created.size(); i++) {
+            mArena.destroy(created.itemAt(i));
+        }
+        return false;
+    }
+
+    VTRACE("disp %d: merged geometry, layers %d -> %d, kept %d planes, %d moved",
+           mDisplayIndex, mLayerCount, count, planes, moved);
+    if (moved) {
+        mMovedMerges++;
+        mMovedStreak++;
+    } else {
+        mMovedStreak = 0;
+    }
+
+    for (size_t i = 0; i < removed.size(); i++) {
+        mArena.destroy(removed.itemAt(i));
+    }
+
+    mLayers.clear();
+    mFBLayers.clear();
+    mSpriteCandidates.clear();
+    mOverlayCandidates.clear();
+    mCursorCandidates.clear();
+    mStaticLayersIndex.clear();
+    mStaticSavings = 0;
+
+    mLayerCount = count;
+    mList = list;
+    mLayers.setCapacity(mLayerCount);
+    mFBLayers.setCapacity(mLayerCount);
+    mSpriteCandidates.setCapacity(mLayerCount);
+    mOverlayCandidates.setCapacity(mLayerCount);
+    mCursorCandidates.setCapacity(mLayerCount);
+    mZOrderConfig.setCapacity(mLayerCount);
+
+    for (int j = 0; j < count - 1; j++) {
+        HwcLayer *hwcLayer = layers.itemAt(j);
+        hwc_layer_1_t *layer = &list->hwLayers[j];
+        hwcLayer->rebind(j, layer);
+
+        if (hwcLayer->getPlane()) {
+            // rewrites HWC_OVERLAY to the new layer
+            hwcLayer->setType(hwcLayer->getType());
+        } else if (layer->compositionType == HWC_FORCE_FRAMEBUFFER) {
+            hwcLayer->setType(HwcLayer::LAYER_FORCE_FB);
+            mFBLayers.add(hwcLayer);
+        } else {
+            hwcLayer->setType(HwcLayer::LAYER_FB);
+            mFBLayers.add(hwcLayer);
+        }
+        mLayers.add(hwcLayer);
+    }
+
+    mFrameBufferTarget->rebind(count - 1, &list->hwLayers[count - 1]);
+    mFrameBufferTarget->setType(HwcLayer::LAYER_FRAMEBUFFER_TARGET);
+    mLayers.add(mFrameBufferTarget);
+    buildOverlapMatrix();
+    updateProtectedCount();
+
+    // the plane checks were not run again, only the outcome is logged
+    CompositionLog::Layer decision;
+    memset(&decision, 0, sizeof(decision));
+    decision.candidate = -1;
+    mDecisions.clear();
+    mDecisions.insertAt(decision, 0, mLayerCount);
+    mDecisionFlags = CompositionLog::RECORD_MERGED;
+    mDecisionPending = true;
+    resetVerdicts(mLayerCount);
+    return true;
+}
+
+bool HwcLayerList::isMoveSupported(HwcLayer *hwcLayer, int index, int newIndex,
+                                   hwc_layer_1_t *layer, const hwc_rect_t& screen)
+{
+    const hwc_rect_t& frame = layer->displayFrame;
+    if (frame.left < screen.left || frame.top < screen.top ||
+        frame.right > screen.right || frame.bottom > screen.bottom) {
+        return false;
+    }
+
+    // the primary plane covers the screen
+    DisplayPlane *plane = hwcLayer->getPlane();
+    if (plane->getType() == DisplayPlane::PLANE_PRIMARY) {
+        return false;
+    }
+
+    if (plane->getType() == DisplayPlane::PLANE_CURSOR) {
+        // the cursor image is not scaled
+        const hwc_rect_t& old = hwcLayer->getDisplayFrame();
+        return frame.right - frame.left == old.right - old.left &&
+               frame.bottom - frame.top == old.bottom - old.top;
+    }
+
+    // the capabilities read the new frame through the layer
+    hwc_layer_1_t *old = hwcLayer->getLayer();
+    hwcLayer->rebind(newIndex, layer);
+    bool ok = PlaneCapabilities::isSizeSupported(plane->getType(), hwcLayer) &&
+              PlaneCapabilities::isScalingSupported(plane->getType(), hwcLayer);
+    hwcLayer->rebind(index, old);
+    return ok;
+}
 
 bool HwcLayerList::allocatePlanes()
 {
+    STRACE();
+    if (!mAssignmentCache) {
+        return searchPlanes();
+    }
+
+    Vector<PlaneAssignment> assignment;
+    if (mAssignmentCache->lookup(mSignature, assignment)) {
+        if (replayAssignment(assignment)) {
+            return true;
+        }
+        // planes are no longer available as recorded, search again
+        VTRACE("stale plane assignment, size %d", assignment.size());
+        mAssignmentCache->invalidate(mSignature);
+    }
+
+    bool ok = searchPlanes();
+    if (ok && !Hwcomposer::getInstance().getJankDetector()->isPolicyActive(
+            JankDetector::POLICY_FREEZE_ASSIGNMENT_CACHE)) {
+        mAssignmentCache->insert(mSignature, mAssignment);
+    }
+    return ok;
+}
+
+bool HwcLayerList::searchPlanes()
+{
+    DisplayPlaneManager *planeManager = Hwcomposer::getInstance().getPlaneManager();
+
+    // score every valid assignment instead of taking the first one, the
+    // assign*Planes() walk is bounded by the best score found so far and
+    // by a time budget
+    mSearch.active = true;
+    mSearch.expired = false;
+    mSearch.deadline = systemTime(CLOCK_MONOTONIC) + PLANE_SEARCH_BUDGET;
+    mSearch.nodes = 0;
+    mSearch.bestScore = -1;
+    mSearch.best.clear();
+    mSearch.fbTargetBytes = getFrameBufferTargetBytes();
+    mSearch.cursorBytes = planeManager->getFreePlanes(mDisplayIndex, DisplayPlane::PLANE_CURSOR) ?
+            getCandidateBytes(mCursorCandidates, 0) : 0;
+    mSearch.overlayBytes = planeManager->getFreePlanes(mDisplayIndex, DisplayPlane::PLANE_OVERLAY) ?
+            getCandidateBytes(mOverlayCandidates, 0) : 0;
+    mSearch.spriteBytes = getCandidateBytes(mSpriteCandidates, 0);
+
+    assignCursorPlanes();
+    mSearch.active = false;
+
+    VTRACE("plane search: %u nodes, score %lld%s", mSearch.nodes,
+           mSearch.bestScore, mSearch.expired ? ", out of time" : "");
+
+    mAssignment.clear();
+    if (mSearch.bestScore >= 0 && replayAssignment(mSearch.best)) {
+        return true;
+    }
+
+    // plane manager rejected the best one, take the first that attaches
+    VTRACE("failed to attach best assignment, size %d", mSearch.best.size());
+    mAssignment.clear();
     return assignCursorPlanes();
 }
 
+uint64_t HwcLayerList::getCandidateBytes(const PriorityVector& candidates, int index)
+{
+    uint64_t bytes = 0;
+    for (int i = index; i < (int)candidates.size(); i++) {
+        if (!candidates[i]->mPlaneCandidate) {
+            bytes += getFetchBytes(candidates[i]);
+        }
+    }
+    return bytes;
+}
+
+int64_t HwcLayerList::getAssignmentScore()
+{
+    // display bandwidth taken off GLES composition
+    bool fbTarget = false;
+    int64_t score = 0;
+    for (size_t i = 0; i < mZOrderConfig.size(); i++) {
+        HwcLayer *hwcLayer = mZOrderConfig.itemAt(i)->hwcLayer;
+        if (hwcLayer == mFrameBufferTarget) {
+            fbTarget = true;
+        } else {
+            score += getFetchBytes(hwcLayer);
+        }
+    }
+
+    // no composition at all when the frame buffer target is not needed
+    if (!fbTarget) {
+        score += mSearch.fbTargetBytes;
+    }
+    return score;
+}
+
+bool HwcLayerList::pruneSearch(int planeType, int index)
+{
+    if (!mSearch.active) {
+        return false;
+    }
+
+    if (mSearch.expired) {
+        return true;
+    }
+
+    if ((++mSearch.nodes & 0xf) == 0 &&
+        systemTime(CLOCK_MONOTONIC) > mSearch.deadline) {
+        // keep the best one found so far
+        mSearch.expired = true;
+        return true;
+    }
+
+    if (mSearch.bestScore < 0) {
+        return false;
+    }
+
+    // upper bound: every candidate not decided yet gets a plane, the
+    // frame buffer target is not in the config yet so its bytes are counted
+    int64_t bound = getAssignmentScore();
+    switch (planeType) {
+    case DisplayPlane::PLANE_CURSOR:
+        bound += getCandidateBytes(mCursorCandidates, index);
+        bound += mSearch.overlayBytes + mSearch.spriteBytes;
+        break;
+    case DisplayPlane::PLANE_OVERLAY:
+        bound += getCandidateBytes(mOverlayCandidates, index);
+        bound += mSearch.spriteBytes;
+        break;
+    default:
+        bound += getCandidateBytes(mSpriteCandidates, index);
+        break;
+    }
+    return bound <= mSearch.bestScore;
+}
+
+bool HwcLayerList::commitAssignment()
+{
+    if (!mSearch.active) {
+        return attachPlanes();
+    }
+
+    DisplayPlaneManager *planeManager = Hwcomposer::getInstance().getPlaneManager();
+    if (!planeManager->isValidZOrder(mDisplayIndex, mZOrderConfig)) {
+        VTRACE("invalid z order, size of config %d", mZOrderConfig.size());
+        return false;
+    }
+
+    int64_t score = getAssignmentScore();
+    if (score > mSearch.bestScore) {
+        mSearch.bestScore = score;
+        getAssignment(mSearch.best);
+    }
+
+    // keep looking for a better one
+    return false;
+}
+
+void HwcLayerList::getAssignment(Vector<PlaneAssignment>& assignment)
+{
+    assignment.clear();
+    assignment.setCapacity(mZOrderConfig.size());
+    for (size_t i = 0; i < mZOrderConfig.size(); i++) {
+        ZOrderLayer *zlayer = mZOrderConfig.itemAt(i);
+        PlaneAssignment a;
+        a.planeType = zlayer->planeType;
+        a.layerIndex = zlayer->hwcLayer->getIndex();
+        a.zorder = zlayer->zorder;
+        assignment.push_back(a);
+    }
+}
+
+bool HwcLayerList::replayAssignment(const Vector<PlaneAssignment>& assignment)
+{
+    for (size_t i = 0; i < assignment.size(); i++) {
+        const PlaneAssignment& a = assignment.itemAt(i);
+        if (a.layerIndex < 0 || a.layerIndex >= mLayerCount) {
+            ETRACE("invalid layer index %d in cached assignment", a.layerIndex);
+            break;
+        }
+        addZOrderLayer(a.planeType, mLayers.itemAt(a.layerIndex), a.zorder);
+    }
+
+    if (mZOrderConfig.size() == assignment.size() && attachPlanes()) {
+        return true;
+    }
+
+    // roll back candidates added above
+    while (mZOrderConfig.size()) {
+        removeZOrderLayer(mZOrderConfig.itemAt(0));
+    }
+    return false;
+}
+
 bool HwcLayerList::assignCursorPlanes()
 {
     int cursorCandidates = (int)mCursorCandidates.size();
@@ -357,6 +996,9 @@ bool HwcLayerList::assignCursorPlanes(int index, int planeNumber)
 
     int cursorCandidates = (int)mCursorCandidates.size();
     for (int i = index; i <= cursorCandidates - planeNumber; i++) {
+        if (pruneSearch(DisplayPlane::PLANE_CURSOR, i)) {
+            break;
+        }
         ZOrderLayer *zlayer = addZOrderLayer(DisplayPlane::PLANE_CURSOR, mCursorCandidates[i]);
         if (assignCursorPlanes(i + 1, planeNumber - 1)) {
             return true;
@@ -408,6 +1050,9 @@ bool HwcLayerList::assignOverlayPlanes(int index, int planeNumber)
 
     int overlayCandidates = (int)mOverlayCandidates.size();
     for (int i = index; i <= overlayCandidates - planeNumber; i++) {
+        if (pruneSearch(DisplayPlane::PLANE_OVERLAY, i)) {
+            break;
+        }
         ZOrderLayer *zlayer = addZOrderLayer(DisplayPlane::PLANE_OVERLAY, mOverlayCandidates[i]);
         if (assignOverlayPlanes(i + 1, planeNumber - 1)) {
             return true;
@@ -460,6 +1105,9 @@ bool HwcLayerList::assignSpritePlanes(int index, int planeNumber)
 
     int spriteCandidates = (int)mSpriteCandidates.size();
     for (int i = index; i <= spriteCandidates - planeNumber; i++) {
+        if (pruneSearch(DisplayPlane::PLANE_SPRITE, i)) {
+            break;
+        }
         ZOrderLayer *zlayer = addZOrderLayer(DisplayPlane::PLANE_SPRITE, mSpriteCandidates[i]);
         if (assignSpritePlanes(i + 1, planeNumber - 1)) {
             return true;
@@ -498,7 +1146,7 @@ bool HwcLayerList::assignPrimaryPlane()
         }
     } else if (candidates == layers) {
         // all assigned, primary plane may be used during ZOrder config.
-        ok = attachPlanes();
+        ok = commitAssignment();
         if (!ok) {
             VTRACE("failed to assign layers without primary");
         }
@@ -528,7 +1176,7 @@ bool HwcLayerList::assignPrimaryPlane()
 bool HwcLayerList::assignPrimaryPlaneHelper(HwcLayer *hwcLayer, int zorder)
 {
     ZOrderLayer *zlayer = addZOrderLayer(DisplayPlane::PLANE_PRIMARY, hwcLayer, zorder);
-    bool ok = attachPlanes();
+    bool ok = commitAssignment();
     if (!ok) {
         removeZOrderLayer(zlayer);
     }
@@ -543,6 +1191,12 @@ bool HwcLayerList::attachPlanes()
         return false;
     }
 
+    // plane manager may override plane type, record the requested one
+    Vector<PlaneAssignment> assignment;
+    if (mAssignmentCache) {
+        getAssignment(assignment);
+    }
+
     if (!planeManager->assignPlanes(mDisplayIndex, mZOrderConfig)) {
         WTRACE("failed to assign planes");
         return false;
@@ -576,13 +1230,62 @@ bool HwcLayerList::attachPlanes()
             zlayer->plane->getIndex(),
             zlayer->zorder);
 
-        delete zlayer;
+        mArena.destroy(zlayer);
     }
 
     mZOrderConfig.clear();
+    mAssignment = assignment;
+    mapAttachedBuffers();
     return true;
 }
 
+void HwcLayerList::mapAttachedBuffers()
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    buffer_handle_t handles[BufferManager::MAP_BATCH_MAX];
+    BufferMapper *mappers[BufferManager::MAP_BATCH_MAX];
+    size_t count = 0;
+
+    releaseAttachedBuffers();
+    for (int i = 0; i < mLayerCount; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        // the frame buffer target is mapped by its own flip
+        if (!hwcLayer->getPlane() || hwcLayer == mFrameBufferTarget ||
+            !hwcLayer->getHandle()) {
+            continue;
+        }
+        if (count == BufferManager::MAP_BATCH_MAX) {
+            break;
+        }
+        handles[count++] = hwcLayer->getHandle();
+    }
+
+    // a single buffer gains nothing from the workers
+    if (count < 2) {
+        return;
+    }
+
+    bm->mapBatch(handles, count, mappers, BufferManager::MAPPING_OWNER_PREMAP);
+    for (size_t i = 0; i < count; i++) {
+        if (mappers[i]) {
+            mAttachedMappers.push_back(mappers[i]);
+        }
+    }
+}
+
+void HwcLayerList::releaseAttachedBuffers()
+{
+    if (!mAttachedMappers.size()) {
+        return;
+    }
+
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    for (size_t i = 0; i < mAttachedMappers.size(); i++) {
+        bm->unmap(mAttachedMappers.itemAt(i), BufferManager::MAPPING_OWNER_PREMAP);
+    }
+    mAttachedMappers.clear();
+}
+
 bool HwcLayerList::useAsFrameBufferTarget(HwcLayer *target)
 {
     // check if zorder of target can be used as zorder of frame buffer target
@@ -595,151 +1298,495 @@ bool HwcLayerList::useAsFrameBufferTarget(HwcLayer *target)
     // to be moved down to target layer in z order.
 
     int targetLayerIndex = target->getIndex();
+    if (targetLayerIndex >= OVERLAP_MAX_LAYERS) {
+        return false;
+    }
 
-    // check candidate and noncandidate layers below this candidate does not overlap
-    for (int below = 0; below < targetLayerIndex; below++) {
-        if (mFBLayers[below]->mPlaneCandidate) {
-            continue;
+    uint64_t candidates = 0;
+    uint64_t noncandidates = 0;
+    for (size_t i = 0; i < mFBLayers.size(); i++) {
+        int index = mFBLayers[i]->getIndex();
+        if (index >= OVERLAP_MAX_LAYERS) {
+            // no overlap information, be conservative
+            return false;
+        }
+        if (mFBLayers[i]->mPlaneCandidate) {
+            candidates |= (1ULL << index);
         } else {
-            // check candidate layer above this noncandidate layer does not overlap
-            for (int above = below + 1; above < targetLayerIndex; above++) {
-                if (mFBLayers[above]->mPlaneCandidate == false) {
-                    continue;
-                }
-                if (hasIntersection(mFBLayers[above], mFBLayers[below])) {
-                    return false;
-                }
+            noncandidates |= (1ULL << index);
+        }
+    }
+
+    // layers strictly between a noncandidate layer and the target
+    uint64_t below = (1ULL << targetLayerIndex) - 1;
+    uint64_t above = ~below & ~(1ULL << targetLayerIndex);
+    for (int i = 0; i < targetLayerIndex; i++) {
+        if (!(noncandidates & (1ULL << i)))
+            continue;
+        uint64_t between = below & ~((2ULL << i) - 1);
+        if (mOverlap[i] & between & candidates) {
+            return false;
+        }
+    }
+
+    for (int i = targetLayerIndex + 1; i < OVERLAP_MAX_LAYERS; i++) {
+        if (!(noncandidates & (1ULL << i)))
+            continue;
+        uint64_t between = above & ((1ULL << i) - 1);
+        if (mOverlap[i] & between & candidates) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void HwcLayerList::buildOverlapMatrix()
+{
+    // one mask per layer with a bit set for every layer it overlaps,
+    // the frame buffer target is left out
+    memset(mOverlap, 0, sizeof(mOverlap));
+    int count = mLayerCount - 1;
+    if (count > OVERLAP_MAX_LAYERS)
+        count = OVERLAP_MAX_LAYERS;
+
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            if (hasIntersection(mLayers.itemAt(i), mLayers.itemAt(j))) {
+                mOverlap[i] |= (1ULL << j);
+                mOverlap[j] |= (1ULL << i);
             }
         }
     }
+}
+
+bool HwcLayerList::isOverlapping(int la, int lb) const
+{
+    if (la >= OVERLAP_MAX_LAYERS || lb >= OVERLAP_MAX_LAYERS) {
+        return true;
+    }
+    return (mOverlap[la] >> lb) & 1;
+}
+
+bool HwcLayerList::hasIntersection(HwcLayer *la, HwcLayer *lb)
+{
+    hwc_layer_1_t *a = la->getLayer();
+    hwc_layer_1_t *b = lb->getLayer();
+    hwc_rect_t *aRect = &a->displayFrame;
+    hwc_rect_t *bRect = &b->displayFrame;
+
+    if (bRect->right <= aRect->left ||
+        bRect->left >= aRect->right ||
+        bRect->top >= aRect->bottom ||
+        bRect->bottom <= aRect->top)
+        return false;
+
+    return true;
+}
+
+ZOrderLayer* HwcLayerList::addZOrderLayer(int type, HwcLayer *hwcLayer, int zorder)
+{
+    ZOrderLayer *layer = new (mArena.alloc(sizeof(ZOrderLayer))) ZOrderLayer;
+    layer->planeType = type;
+    layer->hwcLayer = hwcLayer;
+    layer->zorder = (zorder != -1) ? zorder : hwcLayer->getZOrder();
+    layer->plane = NULL;
+
+    if (hwcLayer->mPlaneCandidate) {
+        ETRACE("plane is candidate!, order = %d", zorder);
+    }
+
+    hwcLayer->mPlaneCandidate = true;
+
+    if ((int)mZOrderConfig.indexOf(layer) >= 0) {
+        ETRACE("layer exists!");
+    }
+
+    mZOrderConfig.add(layer);
+    return layer;
+}
+
+void HwcLayerList::removeZOrderLayer(ZOrderLayer *layer)
+{
+    if ((int)mZOrderConfig.indexOf(layer) < 0) {
+        ETRACE("layer does not exist!");
+    }
+
+    mZOrderConfig.remove(layer);
+
+    if (layer->hwcLayer->mPlaneCandidate == false) {
+        ETRACE("plane is not candidate!, order %d", layer->zorder);
+    }
+    layer->hwcLayer->mPlaneCandidate = false;
+    mArena.destroy(layer);
+}
+
+uint64_t HwcLayerList::getFetchBytes(HwcLayer *hwcLayer)
+{
+    // bytes a display plane fetches per refresh to scan out this layer
+    hwc_layer_1_t *layer = hwcLayer->getLayer();
+    uint32_t width = (uint32_t)(layer->sourceCropf.right - layer->sourceCropf.left);
+    uint32_t height = (uint32_t)(layer->sourceCropf.bottom - layer->sourceCropf.top);
+    return BandwidthEstimator::getFetchBytes(hwcLayer->getFormat(), width, height,
+                                             hwcLayer->isCompressed());
+}
+
+uint64_t HwcLayerList::getFrameBufferTargetBytes()
+{
+    drmModeModeInfo mode;
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    if (!drm->getModeInfo(mDisplayIndex, mode)) {
+        return 0;
+    }
 
-    // check candidate and noncandidate layers above this candidate does not overlap
-    for (int above = targetLayerIndex + 1; above < mFBLayers.size(); above++) {
-        if (mFBLayers[above]->mPlaneCandidate) {
+    // frame buffer target is always RGBA at display size
+    return BandwidthEstimator::getFetchBytes(HAL_PIXEL_FORMAT_RGBA_8888,
+                                             mode.hdisplay, mode.vdisplay,
+                                             mFrameBufferTarget &&
+                                             mFrameBufferTarget->isCompressed());
+}
+
+bool HwcLayerList::isInStaticSet(const Vector<int>& candidates, uint32_t set, int index)
+{
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if ((set & (1 << i)) && candidates.itemAt(i) == index)
+            return true;
+    }
+    return false;
+}
+
+bool HwcLayerList::isValidStaticSet(const Vector<int>& candidates, uint32_t set)
+{
+    // the set is composed to the frame buffer target, which takes the z
+    // order of one of its layers. Layers staying on planes between a
+    // static layer and that position must not overlap it, same rule as
+    // useAsFrameBufferTarget().
+    for (size_t t = 0; t < candidates.size(); t++) {
+        if (!(set & (1 << t)))
             continue;
-        } else {
-            // check candidate layer below this noncandidate layer does not overlap
-            for (int below = targetLayerIndex + 1; below < above; below++) {
-                if (mFBLayers[below]->mPlaneCandidate == false) {
-                    continue;
-                }
-                if (hasIntersection(mFBLayers[above], mFBLayers[below])) {
-                    return false;
+
+        int target = candidates.itemAt(t);
+        bool ok = true;
+        for (size_t i = 0; i < candidates.size() && ok; i++) {
+            if (!(set & (1 << i)))
+                continue;
+
+            int index = candidates.itemAt(i);
+            int low = (index < target) ? index : target;
+            int high = (index < target) ? target : index;
+            for (int j = low + 1; j < high && ok; j++) {
+                if (!isInStaticSet(candidates, set, j) &&
+                    isOverlapping(j, index)) {
+                    ok = false;
                 }
             }
         }
+
+        if (ok)
+            return true;
+    }
+    return false;
+}
+
+bool HwcLayerList::findStaticSet(const Vector<int>& candidates)
+{
+    uint64_t fbBytes = getFrameBufferTargetBytes();
+    uint64_t bestSavings = 0;
+    uint32_t bestSet = 0;
+
+    if (!fbBytes) {
+        return false;
+    }
+
+    // static layers keep costing their fetch bandwidth on planes, while
+    // composed once they only cost the frame buffer target scan out
+    for (uint32_t set = 1; set < (1U << candidates.size()); set++) {
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (set & (1 << i))
+                bytes += getFetchBytes(mLayers.itemAt(candidates.itemAt(i)));
+        }
+
+        if (bytes <= fbBytes + bestSavings) {
+            continue;
+        }
+
+        if (isValidStaticSet(candidates, set)) {
+            bestSavings = bytes - fbBytes;
+            bestSet = set;
+        }
+    }
+
+    if (!bestSet) {
+        return false;
+    }
+
+    mStaticLayersIndex.clear();
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (bestSet & (1 << i))
+            mStaticLayersIndex.add(candidates.itemAt(i));
+    }
+    mStaticSavings = bestSavings;
+    return true;
+}
+
+void HwcLayerList::setupSmartComposition()
+{
+    uint32_t compositionType = HWC_OVERLAY;
+    HwcLayer *hwcLayer = NULL;
+    uint32_t staticThreshold = TuningPolicy::getStaticThreshold();
+
+    // setup smart composition only there's no update on all FB layers
+    for (size_t i = 0; i < mFBLayers.size(); i++) {
+        hwcLayer = mFBLayers.itemAt(i);
+        if (hwcLayer->isUpdated() ||
+            hwcLayer->getStaticCount() == staticThreshold) {
+            compositionType = HWC_FRAMEBUFFER;
+        }
+    }
+
+    VTRACE("smart composition enabled %s",
+           (compositionType == HWC_OVERLAY) ? "TRUE" : "FALSE");
+    for (size_t i = 0; i < mFBLayers.size(); i++) {
+        hwcLayer = mFBLayers.itemAt(i);
+        switch (hwcLayer->getType()) {
+        case HwcLayer::LAYER_FB:
+        case HwcLayer::LAYER_FORCE_FB:
+            hwcLayer->setCompositionType(compositionType);
+            break;
+        default:
+            ETRACE("Invalid layer type %d", hwcLayer->getType());
+            break;
+        }
+    }
+}
+
+bool HwcLayerList::setupBlitComposition()
+{
+    mBlitting = false;
+    if (!mBlitComposer || !mFrameBufferTarget) {
+        return false;
+    }
+
+    // the blit buffer is not cleared, the bottom layer must cover it
+    const hwc_rect_t& target = mFrameBufferTarget->getDisplayFrame();
+    bool supported = mFBLayers.size() &&
+                     mFBLayers.size() <= BlitComposer::BLIT_LAYERS_MAX &&
+                     mFrameBufferTarget->getPlane() &&
+                     target.left == 0 && target.top == 0 &&
+                     (uint32_t)(target.right - target.left) ==
+                         mFrameBufferTarget->getBufferWidth() &&
+                     (uint32_t)(target.bottom - target.top) ==
+                         mFrameBufferTarget->getBufferHeight();
+    if (supported) {
+        const hwc_rect_t& bottom = mFBLayers.itemAt(0)->getDisplayFrame();
+        supported = bottom.left == target.left && bottom.top == target.top &&
+                    bottom.right == target.right && bottom.bottom == target.bottom;
+    }
+    for (size_t i = 0; supported && i < mFBLayers.size(); i++) {
+        HwcLayer *hwcLayer = mFBLayers.itemAt(i);
+        supported = hwcLayer->getType() == HwcLayer::LAYER_FB &&
+                    BlitComposer::isSupported(hwcLayer, target);
+    }
+
+    if (!supported) {
+        if (!mBlitComposer->isActive()) {
+            return false;
+        }
+        // the frame buffer target of SurfaceFlinger is stale, GLES has to
+        // draw all layers again
+        VTRACE("leaving blit composition");
+        mBlitComposer->deactivate();
+        for (size_t i = 0; i < mFBLayers.size(); i++) {
+            mFBLayers.itemAt(i)->setCompositionType(HWC_FRAMEBUFFER);
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < mFBLayers.size(); i++) {
+        mFBLayers.itemAt(i)->setCompositionType(HWC_OVERLAY);
     }
-
+    mBlitting = true;
     return true;
 }
 
-bool HwcLayerList::hasIntersection(HwcLayer *la, HwcLayer *lb)
+bool HwcLayerList::composeBlitLayers()
 {
-    hwc_layer_1_t *a = la->getLayer();
-    hwc_layer_1_t *b = lb->getLayer();
-    hwc_rect_t *aRect = &a->displayFrame;
-    hwc_rect_t *bRect = &b->displayFrame;
+    if (mIdle) {
+        return true;
+    }
 
-    if (bRect->right <= aRect->left ||
-        bRect->left >= aRect->right ||
-        bRect->top >= aRect->bottom ||
-        bRect->bottom <= aRect->top)
-        return false;
+    hwc_layer_1_t *layers[BlitComposer::BLIT_LAYERS_MAX];
+    bool changed = false;
+    bool ret = true;
+    if (mBlitting) {
+        size_t count = mFBLayers.size();
+        for (size_t i = 0; i < count; i++) {
+            HwcLayer *hwcLayer = mFBLayers.itemAt(i);
+            layers[i] = hwcLayer->getLayer();
+            changed |= hwcLayer->isUpdated();
+        }
+        // a failed blit keeps the last frame buffer target for this frame,
+        // the next prepare sees the composer disabled and goes to GLES
+        ret = blitToPlane(mBlitComposer, mFrameBufferTarget, layers, count, changed);
+    }
 
-    return true;
+    if (mFoldCarrier >= 0) {
+        HwcLayer *carrier = mLayers.itemAt(mFoldCarrier);
+        size_t count = 0;
+        layers[count++] = carrier->getLayer();
+        for (size_t i = 0; i < mFoldedLayers.size(); i++) {
+            layers[count++] = mLayers.itemAt(mFoldedLayers.itemAt(i))->getLayer();
+        }
+        // left by the next prepare if any of them changed
+        if (!blitToPlane(&mPrerender, carrier, layers, count, false)) {
+            ret = false;
+        }
+    }
+    return ret;
 }
 
-ZOrderLayer* HwcLayerList::addZOrderLayer(int type, HwcLayer *hwcLayer, int zorder)
+bool HwcLayerList::blitToPlane(BlitComposer *composer, HwcLayer *target,
+                               hwc_layer_1_t **layers, size_t count, bool changed)
 {
-    ZOrderLayer *layer = new ZOrderLayer;
-    layer->planeType = type;
-    layer->hwcLayer = hwcLayer;
-    layer->zorder = (zorder != -1) ? zorder : hwcLayer->getZOrder();
-    layer->plane = NULL;
-
-    if (hwcLayer->mPlaneCandidate) {
-        ETRACE("plane is candidate!, order = %d", zorder);
+    hwc_layer_1_t *layer = target->getLayer();
+    int fenceFd = -1;
+    buffer_handle_t handle = composer->compose(layers, count,
+            target->getDisplayFrame(), target->getFormat(), changed, &fenceFd);
+    if (!handle) {
+        WTRACE("blit composition failed");
+        return false;
     }
 
-    hwcLayer->mPlaneCandidate = true;
+    DisplayPlane *plane = target->getPlane();
+    if (!plane || !plane->setDataBuffer(handle)) {
+        WTRACE("failed to set blit buffer");
+        composer->deactivate();
+        if (fenceFd >= 0) {
+            sync_wait(fenceFd, -1);
+            close(fenceFd);
+        }
+        return false;
+    }
 
-    if ((int)mZOrderConfig.indexOf(layer) >= 0) {
-        ETRACE("layer exists!");
+    // the source buffers are read until the blit is done, the target gets
+    // the release fence of the post which comes later
+    for (size_t i = 0; i < count; i++) {
+        if (layers[i] != layer) {
+            layers[i]->releaseFenceFd = (fenceFd >= 0) ? dup(fenceFd) : -1;
+        }
     }
 
-    mZOrderConfig.add(layer);
-    return layer;
+    // only the fences of the target layer are used, the post waits for the
+    // blit instead of the buffer of SurfaceFlinger
+    if (layer->acquireFenceFd >= 0) {
+        close(layer->acquireFenceFd);
+    }
+    layer->acquireFenceFd = fenceFd;
+    layer->handle = handle;
+    return true;
 }
 
-void HwcLayerList::removeZOrderLayer(ZOrderLayer *layer)
+bool HwcLayerList::isFolded(int index) const
 {
-    if ((int)mZOrderConfig.indexOf(layer) < 0) {
-        ETRACE("layer does not exist!");
+    for (size_t i = 0; i < mFoldedLayers.size(); i++) {
+        if (mFoldedLayers.itemAt(i) == index) {
+            return true;
+        }
     }
+    return false;
+}
 
-    mZOrderConfig.remove(layer);
-
-    if (layer->hwcLayer->mPlaneCandidate == false) {
-        ETRACE("plane is not candidate!, order %d", layer->zorder);
+void HwcLayerList::dropPrerender()
+{
+    // GLES draws the folded layers until the planes take them again
+    for (size_t i = 0; i < mFoldedLayers.size(); i++) {
+        mLayers.itemAt(mFoldedLayers.itemAt(i))->setCompositionType(HWC_FRAMEBUFFER);
     }
-    layer->hwcLayer->mPlaneCandidate = false;
-    delete layer;
+    mFoldedLayers.clear();
+    mFoldCarrier = -1;
+    mPrerender.invalidate();
 }
 
-void HwcLayerList::addStaticLayerSize(HwcLayer *hwcLayer)
+bool HwcLayerList::checkPrerender()
 {
-    // Calculate static layer size to avoid only composition navigation bar
-    // and status bar etc.
-    hwc_layer_1_t *a = hwcLayer->getLayer();
-    hwc_rect_t *Rect = &a->displayFrame;
-
-    mLayerSize = mLayerSize + ((Rect->right - Rect->left) * (Rect->bottom - Rect->top));
+    if (mLayers.itemAt(mFoldCarrier)->isUpdated()) {
+        return false;
+    }
+    for (size_t i = 0; i < mFoldedLayers.size(); i++) {
+        if (mLayers.itemAt(mFoldedLayers.itemAt(i))->isUpdated()) {
+            return false;
+        }
+    }
+    return true;
 }
 
-bool HwcLayerList::checkStaticLayerSize()
+bool HwcLayerList::setupPrerender()
 {
-    // Check static layer size if over threshold: half display size
-    bool ret = false;
-    int width = 0;
-    int height = 0;
-    drmModeModeInfo mode;
-    Drm *drm = Hwcomposer::getInstance().getDrm();
-    drm->getModeInfo(mDisplayIndex, mode);
-    width = mode.hdisplay;
-    height = mode.vdisplay;
+    if (!BlitComposer::isEnabled()) {
+        return false;
+    }
 
-    if (mLayerSize > (width * height/2))
-        ret = true;
+    uint32_t staticThreshold = TuningPolicy::getStaticThreshold();
+    for (int i = 0; i < mLayerCount - 1; i++) {
+        // the carrier is scanned out unscaled, so that its copy fits the
+        // plane as it is set up
+        HwcLayer *carrier = mLayers.itemAt(i);
+        const hwc_rect_t& bounds = carrier->getDisplayFrame();
+        if (!carrier->getPlane() ||
+            carrier->getType() != HwcLayer::LAYER_OVERLAY ||
+            carrier->getCompositionType() != HWC_OVERLAY ||
+            carrier->getStaticCount() < staticThreshold ||
+            (uint32_t)(bounds.right - bounds.left) != carrier->getBufferWidth() ||
+            (uint32_t)(bounds.bottom - bounds.top) != carrier->getBufferHeight() ||
+            !BlitComposer::isSupported(carrier, bounds)) {
+            continue;
+        }
 
-    return ret;
+        // the layers right above it in z order, within its frame
+        int count = 0;
+        for (int j = i + 1; j < mLayerCount - 1 &&
+             count + 1 < BlitComposer::BLIT_LAYERS_MAX; j++) {
+            HwcLayer *hwcLayer = mLayers.itemAt(j);
+            if (!hwcLayer->getPlane() ||
+                hwcLayer->getType() != HwcLayer::LAYER_OVERLAY ||
+                hwcLayer->getCompositionType() != HWC_OVERLAY ||
+                hwcLayer->getStaticCount() < staticThreshold ||
+                !BlitComposer::isSupported(hwcLayer, bounds)) {
+                break;
+            }
+            count++;
+        }
+        if (!count) {
+            continue;
+        }
+
+        mFoldCarrier = i;
+        for (int j = i + 1; j <= i + count; j++) {
+            mFoldedLayers.push_back(j);
+        }
+        DTRACE("In Smart Composition3, %d layers flattened on layer %d", count, i);
+        return true;
+    }
+    return false;
 }
 
-void HwcLayerList::setupSmartComposition()
+void HwcLayerList::reinitialize(hwc_display_contents_1_t *list)
 {
-    uint32_t compositionType = HWC_OVERLAY;
-    HwcLayer *hwcLayer = NULL;
+    deinitialize();
+    mList = list;
+    initialize();
 
-    // setup smart composition only there's no update on all FB layers
-    for (size_t i = 0; i < mFBLayers.size(); i++) {
-        hwcLayer = mFBLayers.itemAt(i);
-        if (hwcLayer->isUpdated() ||
-            hwcLayer->getStaticCount() == LAYER_STATIC_THRESHOLD) {
-            compositionType = HWC_FRAMEBUFFER;
+    // update all layers again after plane re-allocation
+    for (int i = 0; i < mLayerCount; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        if (!hwcLayer) {
+            ETRACE("no HWC layer for layer %d", i);
+            continue;
         }
-    }
 
-    VTRACE("smart composition enabled %s",
-           (compositionType == HWC_OVERLAY) ? "TRUE" : "FALSE");
-    for (size_t i = 0; i < mFBLayers.size(); i++) {
-        hwcLayer = mFBLayers.itemAt(i);
-        switch (hwcLayer->getType()) {
-        case HwcLayer::LAYER_FB:
-        case HwcLayer::LAYER_FORCE_FB:
-            hwcLayer->setCompositionType(compositionType);
-            break;
-        default:
-            ETRACE("Invalid layer type %d", hwcLayer->getType());
-            break;
+        if (!hwcLayer->update(&list->hwLayers[i])) {
+            DTRACE("fallback to GLES update failed on layer[%d]!\n", i);
         }
     }
 }
@@ -755,9 +1802,35 @@ bool HwcLayerList::setupSmartComposition2()
         // clear static layers vector once geometry changed
         mStaticLayersIndex.setCapacity(mLayerCount);
         mStaticLayersIndex.clear();
+        mStaticSavings = 0;
+        // SurfaceFlinger composes all layers by GLES again
+        mFoldedLayers.clear();
+        mFoldCarrier = -1;
+        mPrerender.invalidate();
+        return ret;
+    }
+
+    // folded layers are not drawn by anyone else, leave at once
+    if (mFoldCarrier >= 0) {
+        if (checkPrerender()) {
+            return ret;
+        }
+        DTRACE("Exit Smart Composition3 !");
+        dropPrerender();
+        return true;
+    }
+
+    // entering or leaving a static set reassigns planes, not while the
+    // user touches the screen. Updated static layers are still drawn by GLES.
+    if (Hwcomposer::getInstance().getInputBoost()->isActive()) {
         return ret;
     }
 
+    // a flattened copy frees the planes and keeps GLES out
+    if (mStaticLayersIndex.size() == 0 && setupPrerender()) {
+        return true;
+    }
+
     if (mStaticLayersIndex.size() > 0) {
         // exit criteria: once either static layer has update
         for (i = 0; i < mStaticLayersIndex.size(); i++) {
@@ -778,63 +1851,46 @@ bool HwcLayerList::setupSmartComposition2()
             }
 
             DTRACE("Exit Smart Composition2 !");
-            mLayerSize = 0;
+            mStaticSavings = 0;
             mStaticLayersIndex.clear();
         }
     } else {
-        // entry criteria: hwc layers has no update
-        if (mFBLayers.size() == 0) {
+        // entry criteria: hwc layers has no update, and the search for the
+        // static set is affordable
+        if (mFBLayers.size() == 0 &&
+            !Hwcomposer::getInstance().getJankDetector()->isPolicyActive(
+                JankDetector::POLICY_SKIP_SMART_COMPOSITION)) {
+            Vector<int> candidates;
+            candidates.setCapacity(STATIC_SET_MAX);
+            uint32_t staticThreshold = TuningPolicy::getStaticThreshold();
             for (i = 0; i < mLayerCount - 1; i++) {
                 hwcLayer = mLayers.itemAt(i);
                 if (hwcLayer->getPlane() &&
                     hwcLayer->getCompositionType() == HWC_OVERLAY &&
-                    hwcLayer->getStaticCount() >= LAYER_STATIC_THRESHOLD) {
-                    mStaticLayersIndex.add(i);
+                    hwcLayer->getStaticCount() >= staticThreshold &&
+                    candidates.size() < STATIC_SET_MAX) {
+                    // composing a compressed layer into an uncompressed
+                    // target only inflates it, keep it on its plane
+                    if (hwcLayer->isCompressed() &&
+                        !mFrameBufferTarget->isCompressed()) {
+                        continue;
+                    }
+                    candidates.add(i);
                 }
             }
 
-            // check if all static layers in sequence
-            // if all in sequence, set FORCE_FB for static layers
-            // TODO: optimization here
-            //    1. If two connected, can trigger smart composition2
-            //    2. Caculate layer size to see if it saves more bandwidth
-            //    3. Dynamically check and add new static layers
-            int staticLayerCount = mStaticLayersIndex.size();
-
-            if (staticLayerCount > 1 && staticLayerCount < mLayerCount-1) {
-                layerIndex = mStaticLayersIndex.itemAt(0);
-                hwcLayer = mLayers.itemAt(layerIndex);
-                mLayerSize = 0;
-                addStaticLayerSize(hwcLayer);
-                int preIndex = hwcLayer->getIndex();
-
-                for (i = 1; i < staticLayerCount; i++) {
+            // pick the static subset whose GLES composition saves the most
+            // memory bandwidth, if any
+            if (candidates.size() > 0 && findStaticSet(candidates)) {
+                for (i = 0; i < (int)mStaticLayersIndex.size(); i++) {
                     layerIndex = mStaticLayersIndex.itemAt(i);
                     hwcLayer = mLayers.itemAt(layerIndex);
-                    int index = hwcLayer->getIndex();
-
-                    if (index == preIndex + 1) {
-                        addStaticLayerSize(hwcLayer);
-                        preIndex = index;
-                    } else
-                        break;
-                }
-
-                if ((i == staticLayerCount) && checkStaticLayerSize()) {
-                    for (i =0; i < staticLayerCount; i++) {
-                        layerIndex = mStaticLayersIndex.itemAt(i);
-                        hwcLayer = mLayers.itemAt(layerIndex);
-                        hwcLayer->setCompositionType(HWC_FORCE_FRAMEBUFFER);
-                    }
-                    DTRACE("In Smart Composition2 !");
-                    ret = true;
-                } else {
-                    mLayerSize = 0;
+                    hwcLayer->setCompositionType(HWC_FORCE_FRAMEBUFFER);
                 }
+                DTRACE("In Smart Composition2, %d layers, saving %llu bytes per refresh",
+                       mStaticLayersIndex.size(), (unsigned long long)mStaticSavings);
+                ret = true;
             }
-
-            if (!ret)
-                mStaticLayersIndex.clear();
         }
     }
 
@@ -846,7 +1902,35 @@ bool HwcLayerList::setupSmartComposition2()
 
 bool HwcLayerList::update(hwc_display_contents_1_t *list)
 {
-    bool ret;
+    if (!updateLayers(list)) {
+        return false;
+    }
+    finishUpdate(list);
+    return true;
+}
+
+bool HwcLayerList::isIdleFrame(hwc_display_contents_1_t *list)
+{
+    if (list->flags & HWC_GEOMETRY_CHANGED) {
+        return false;
+    }
+
+    for (int i = 0; i < mLayerCount; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        if (!hwcLayer || !hwcLayer->isUnchanged(&list->hwLayers[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HwcLayerList::updateLayers(hwc_display_contents_1_t *list)
+{
+    STRACE();
+    mFallbackPending = false;
+    mPartialFallback = false;
+    mIdle = false;
+    memset(&mDamage, 0, sizeof(mDamage));
 
     // basic check to make sure the consistance
     if (!list) {
@@ -862,6 +1946,17 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
     // update list
     mList = list;
 
+    // nothing changed, keep the plane state of the last frame. Static
+    // counts keep going so that smart composition can still kick in.
+    if (isIdleFrame(list)) {
+        for (int i = 0; i < mLayerCount; i++) {
+            mLayers.itemAt(i)->markStatic(&list->hwLayers[i]);
+        }
+        mFallbackPending = setupSmartComposition2();
+        mIdle = !mFallbackPending;
+        return true;
+    }
+
     bool ok = true;
     // update all layers, call each layer's update()
     for (int i = 0; i < mLayerCount; i++) {
@@ -871,43 +1966,215 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
             continue;
         }
 
-        if (!hwcLayer->update(&list->hwLayers[i])) {
+        hwc_rect_t frame = hwcLayer->getDisplayFrame();
+        if (!hwcLayer->update(&list->hwLayers[i],
+                              getCloneLayer(i, &list->hwLayers[i]))) {
             ok = false;
             hwcLayer->setCompositionType(HWC_FORCE_FRAMEBUFFER);
         }
+
+        // a moved layer damages where it was and where it is now
+        if (hwcLayer->isUpdated()) {
+            addDamage(frame);
+            addDamage(hwcLayer->getDisplayFrame());
+        }
+    }
+
+    // layers that went away are not in the list any more
+    if ((list->flags & HWC_GEOMETRY_CHANGED) && mFrameBufferTarget) {
+        addDamage(mFrameBufferTarget->getDisplayFrame());
+    }
+
+    // a layer gets its attributes with its first valid handle
+    updateProtectedCount();
+
+    // a failed layer update only needs the failed layers moved to GLES,
+    // smart composition 2 needs all planes assigned again
+    mPartialFallback = !ok;
+    mFallbackPending = (!ok || setupSmartComposition2());
+    return true;
+}
+
+bool HwcLayerList::partialFallback()
+{
+    HwcLayer *target = mFrameBufferTarget;
+    if (!target || !target->getPlane() || mLayerCount - 1 > OVERLAP_MAX_LAYERS) {
+        // no plane composes GLES layers yet
+        return false;
+    }
+
+    // layers whose update failed still own their planes
+    uint64_t dropped = 0;
+    for (int i = 0; i < mLayerCount - 1; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        if (hwcLayer->getPlane() &&
+            hwcLayer->getCompositionType() == HWC_FORCE_FRAMEBUFFER) {
+            dropped |= (1ULL << i);
+        }
+    }
+
+    if (!dropped) {
+        return false;
+    }
+
+    // a layer moving to GLES is drawn at the z order of the frame buffer
+    // target, layers on planes in between must not overlap it, otherwise
+    // they are moved to GLES as well
+    int targetZOrder = target->getPlane()->getZOrder();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < mLayerCount - 1; i++) {
+            if (!(dropped & (1ULL << i)))
+                continue;
+            int zorder = mLayers.itemAt(i)->getPlane()->getZOrder();
+            int low = zorder < targetZOrder ? zorder : targetZOrder;
+            int high = zorder < targetZOrder ? targetZOrder : zorder;
+            for (int j = 0; j < mLayerCount - 1; j++) {
+                DisplayPlane *plane = mLayers.itemAt(j)->getPlane();
+                if (!plane || (dropped & (1ULL << j)))
+                    continue;
+                if (plane->getZOrder() > low && plane->getZOrder() < high &&
+                    isOverlapping(i, j)) {
+                    dropped |= (1ULL << j);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // the planes left over must still form a valid z order
+    ZOrderConfig config;
+    for (int i = 0; i < mLayerCount; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        if (!hwcLayer->getPlane() || (i < mLayerCount - 1 && (dropped & (1ULL << i))))
+            continue;
+        ZOrderLayer *zlayer = new (mArena.alloc(sizeof(ZOrderLayer))) ZOrderLayer;
+        zlayer->planeType = (hwcLayer == target) ?
+                DisplayPlane::PLANE_PRIMARY : hwcLayer->getPlane()->getType();
+        zlayer->zorder = hwcLayer->getPlane()->getZOrder();
+        zlayer->plane = hwcLayer->getPlane();
+        zlayer->hwcLayer = hwcLayer;
+        config.add(zlayer);
+    }
+
+    DisplayPlaneManager *planeManager = Hwcomposer::getInstance().getPlaneManager();
+    bool valid = planeManager->isValidZOrder(mDisplayIndex, config);
+    for (int i = (int)config.size() - 1; i >= 0; i--) {
+        mArena.destroy(config.itemAt(i));
+    }
+    if (!valid) {
+        VTRACE("invalid z order after partial fallback");
+        return false;
+    }
+
+    for (int i = 0; i < mLayerCount - 1; i++) {
+        if (!(dropped & (1ULL << i)))
+            continue;
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        bool failed = (hwcLayer->getCompositionType() == HWC_FORCE_FRAMEBUFFER);
+        DisplayPlane *plane = hwcLayer->detachPlane();
+        planeManager->reclaimPlane(mDisplayIndex, *plane);
+        hwcLayer->setType(failed ? HwcLayer::LAYER_FORCE_FB : HwcLayer::LAYER_FB);
+        mFBLayers.add(hwcLayer);
+        ITRACE("layer %d fallback to GLES%s", i, failed ? "" : " with failed layer");
     }
+    return true;
+}
 
-    if (!ok || setupSmartComposition2()) {
+void HwcLayerList::finishUpdate(hwc_display_contents_1_t *list)
+{
+    // plane re-allocation goes through the shared plane manager, so this
+    // part must not run concurrently with other displays
+    if (mFallbackPending && mPartialFallback && partialFallback()) {
+        mFallbackPending = false;
+        mIdle = false;
+        addDamage(mFrameBufferTarget->getDisplayFrame());
+        mDecisionFlags |= CompositionLog::RECORD_FALLBACK;
+        mDecisionPending = true;
+    }
+
+    if (mFallbackPending) {
+        mFallbackPending = false;
+        mIdle = false;
         ITRACE("overlay fallback to GLES. flags: %#x", list->flags);
         for (int i = 0; i < mLayerCount - 1; i++) {
             HwcLayer *hwcLayer = mLayers.itemAt(i);
-            if (hwcLayer->getPlane() &&
+            // folded layers stay HWC_OVERLAY, skipped by the new planes
+            if (hwcLayer->getPlane() && !isFolded(i) &&
                 (hwcLayer->getCompositionType() == HWC_OVERLAY ||
                 hwcLayer->getCompositionType() == HWC_CURSOR_OVERLAY)) {
                 hwcLayer->setCompositionType(HWC_FRAMEBUFFER);
             }
         }
-        mLayers.itemAt(mLayerCount - 1)->setCompositionType(HWC_FRAMEBUFFER_TARGET);
-        deinitialize();
-        mList = list;
-        initialize();
+        HwcLayer *target = mLayers.itemAt(mLayerCount - 1);
+        target->setCompositionType(HWC_FRAMEBUFFER_TARGET);
+        // GLES composes the whole frame buffer target again
+        addDamage(target->getDisplayFrame());
+        reinitialize(list);
+        mDecisionFlags |= CompositionLog::RECORD_FALLBACK;
+
+        // nothing shows the folded layers if the carrier lost its plane
+        if (mFoldCarrier >= 0 && !mLayers.itemAt(mFoldCarrier)->getPlane()) {
+            WTRACE("layer %d lost its plane, unfolding", mFoldCarrier);
+            dropPrerender();
+            reinitialize(list);
+        }
+    }
 
-        // update all layers again after plane re-allocation
-        for (int i = 0; i < mLayerCount; i++) {
-            HwcLayer *hwcLayer = mLayers.itemAt(i);
-            if (!hwcLayer) {
-                ETRACE("no HWC layer for layer %d", i);
-                continue;
-            }
+    // the planes hold their mappers now
+    releaseAttachedBuffers();
+    if (!setupBlitComposition()) {
+        setupSmartComposition();
+    }
+    traceFrameBufferLayers();
+    if (mDecisionPending) {
+        logDecisions();
+    }
+}
 
-            if (!hwcLayer->update(&list->hwLayers[i])) {
-                DTRACE("fallback to GLES update failed on layer[%d]!\n", i);
-            }
-        }
+void HwcLayerList::addDamage(const hwc_rect_t& rect)
+{
+    if (rect.right <= rect.left || rect.bottom <= rect.top) {
+        return;
     }
 
-    setupSmartComposition();
-    return true;
+    if (mDamage.right <= mDamage.left || mDamage.bottom <= mDamage.top) {
+        mDamage = rect;
+        return;
+    }
+
+    if (rect.left < mDamage.left)
+        mDamage.left = rect.left;
+    if (rect.top < mDamage.top)
+        mDamage.top = rect.top;
+    if (rect.right > mDamage.right)
+        mDamage.right = rect.right;
+    if (rect.bottom > mDamage.bottom)
+        mDamage.bottom = rect.bottom;
+}
+
+void HwcLayerList::logDecisions()
+{
+    mDecisionPending = false;
+    if (!mLog) {
+        return;
+    }
+
+    CompositionLog::Record& record = mLog->next(mDecisionFlags, mLayerCount);
+    for (int i = 0; i < mLayerCount && i < CompositionLog::MAX_LAYERS; i++) {
+        HwcLayer *hwcLayer = mLayers.itemAt(i);
+        CompositionLog::Layer& layer = record.layers[i];
+        if (i < (int)mDecisions.size()) {
+            layer = mDecisions.itemAt(i);
+        }
+        // what the layer costs on a plane, also when GLES composes it
+        layer.type = hwcLayer->getType();
+        layer.format = hwcLayer->getFormat();
+        layer.fetchKBytes = getFetchBytes(hwcLayer) / 1024;
+        DisplayPlane *plane = hwcLayer->getPlane();
+        layer.plane = plane ? plane->getType() : -1;
+    }
 }
 
 #else
@@ -916,6 +2183,8 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
 {
     bool ret;
 
+    STRACE();
+
     // basic check to make sure the consistance
     if (!list) {
         ETRACE("null layer list");
@@ -941,6 +2210,7 @@ bool HwcLayerList::update(hwc_display_contents_1_t *list)
         hwcLayer->update(&list->hwLayers[i]);
     }
 
+    releaseAttachedBuffers();
     setupSmartComposition();
     return true;
 }
@@ -971,6 +2241,99 @@ DisplayPlane* HwcLayerList::getPlane(uint32_t index) const
     return hwcLayer->getPlane();
 }
 
+HwcLayer* HwcLayerList::getAsyncFlipLayer() const
+{
+    if (mDisplayIndex != IDisplayDevice::DEVICE_PRIMARY ||
+        mLayerCount != 2 || !mFrameBufferTarget ||
+        mLayers.size() != 2) {
+        return NULL;
+    }
+
+    HwcLayer *hwcLayer = mLayers.itemAt(0);
+    DisplayPlane *plane = hwcLayer->getPlane();
+    if (hwcLayer->getType() != HwcLayer::LAYER_OVERLAY || !plane ||
+        plane->getType() != DisplayPlane::PLANE_PRIMARY ||
+        hwcLayer->isProtected() || hwcLayer->isCompressed() ||
+        hwcLayer->getTransform() != 0) {
+        return NULL;
+    }
+
+    switch (hwcLayer->getFormat()) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        break;
+    default:
+        return NULL;
+    }
+
+    hwc_layer_1_t *layer = hwcLayer->getLayer();
+    if (layer->blending != HWC_BLENDING_NONE ||
+        layer->planeAlpha != 0xff) {
+        return NULL;
+    }
+
+    // the whole buffer goes to the whole screen
+    const hwc_rect_t& screen = mFrameBufferTarget->getDisplayFrame();
+    const hwc_rect_t& frame = layer->displayFrame;
+    const hwc_frect_t& crop = layer->sourceCropf;
+    int width = screen.right - screen.left;
+    int height = screen.bottom - screen.top;
+    if (memcmp(&frame, &screen, sizeof(hwc_rect_t)) ||
+        crop.left != 0 || crop.top != 0 ||
+        (int)crop.right != width || (int)crop.bottom != height ||
+        (int)hwcLayer->getBufferWidth() != width ||
+        (int)hwcLayer->getBufferHeight() != height) {
+        return NULL;
+    }
+    return hwcLayer;
+}
+
+HwcLayer* HwcLayerList::getScanoutLayer() const
+{
+    HwcLayer *hwcLayer = getAsyncFlipLayer();
+    if (hwcLayer) {
+        return hwcLayer;
+    }
+
+    // the blit and fold buffers replace the frame buffer target
+    if (mDisplayIndex != IDisplayDevice::DEVICE_PRIMARY ||
+        !mFrameBufferTarget || mBlitting || mFoldCarrier >= 0 ||
+        (int)mLayers.size() != mLayerCount) {
+        return NULL;
+    }
+    for (int i = 0; i < mLayerCount - 1; i++) {
+        int type = mLayers.itemAt(i)->getType();
+        if (type != HwcLayer::LAYER_FB && type != HwcLayer::LAYER_FORCE_FB) {
+            return NULL;
+        }
+    }
+
+    hwcLayer = mFrameBufferTarget;
+    DisplayPlane *plane = hwcLayer->getPlane();
+    if (!plane || plane->getType() != DisplayPlane::PLANE_PRIMARY ||
+        !hwcLayer->getHandle() || hwcLayer->isCompressed()) {
+        return NULL;
+    }
+
+    switch (hwcLayer->getFormat()) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        break;
+    default:
+        return NULL;
+    }
+
+    const hwc_rect_t& screen = hwcLayer->getDisplayFrame();
+    if (screen.left != 0 || screen.top != 0 ||
+        (int)hwcLayer->getBufferWidth() != screen.right ||
+        (int)hwcLayer->getBufferHeight() != screen.bottom) {
+        return NULL;
+    }
+    return hwcLayer;
+}
+
 void HwcLayerList::postFlip()
 {
     for (size_t i = 0; i < mLayers.size(); i++) {
@@ -981,9 +2344,10 @@ void HwcLayerList::postFlip()
 
 void HwcLayerList::dump(Dump& d)
 {
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
     d.append("Layer list: (number of layers %d):\n", mLayers.size());
-    d.append(" LAYER |          TYPE          |   PLANE  | INDEX | Z Order \n");
-    d.append("-------+------------------------+----------------------------\n");
+    d.append(" LAYER |          TYPE          |   PLANE  | INDEX | Z Order |  FPS  \n");
+    d.append("-------+------------------------+----------+-------+---------+-------\n");
     for (size_t i = 0; i < mLayers.size(); i++) {
         HwcLayer *hwcLayer = mLayers.itemAt(i);
         DisplayPlane *plane;
@@ -1037,12 +2401,44 @@ void HwcLayerList::dump(Dump& d)
                 }
             }
 
-            d.append("  %2d   | %22s | %8s | %3ld   | %3ld \n",
-                     i, type, planeType, planeIndex, zorder);
+            uint32_t fps = hwcLayer->getFps10(now);
+            d.append("  %2d   | %22s | %8s | %3ld   | %3ld     | %3u.%u \n",
+                     i, type, planeType, planeIndex, zorder, fps / 10, fps % 10);
         }
     }
+
+    if (mStaticLayersIndex.size() > 0) {
+        d.append("Smart composition 2: %d static layers, saving %llu KB per refresh\n",
+                 mStaticLayersIndex.size(), (unsigned long long)(mStaticSavings >> 10));
+    }
+    if (mFoldCarrier >= 0) {
+        d.append("Smart composition 3: %d static layers flattened on layer %d\n",
+                 mFoldedLayers.size(), mFoldCarrier);
+        mPrerender.dump(d);
+    }
+
+    if (mMovedMerges) {
+        d.append("Geometry changes with moved planes: %u, %u in a row\n",
+                 mMovedMerges, mMovedStreak);
+    }
+
+    if (mAssignmentCache)
+        mAssignmentCache->dump(d);
 }
 
+void HwcLayerList::traceFrameBufferLayers()
+{
+    static const char* counters[] = {
+        "hwc_fb_layers_0",
+        "hwc_fb_layers_1",
+        "hwc_fb_layers_2",
+    };
+
+    if (mDisplayIndex < 0 || mDisplayIndex >= (int)(sizeof(counters) / sizeof(counters[0]))) {
+        return;
+    }
+    STRACE_INT(counters[mDisplayIndex], mFBLayers.size());
+}
 
 void HwcLayerList::dump()
 {
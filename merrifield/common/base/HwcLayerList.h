@@ -19,10 +19,17 @@
 #include <Dump.h>
 #include <hardware/hwcomposer.h>
 #include <utils/SortedVector.h>
+#include <utils/Timers.h>
 #include <DataBuffer.h>
+#include <BufferMapper.h>
 #include <DisplayPlane.h>
 #include <DisplayPlaneManager.h>
 #include <HwcLayer.h>
+#include <PlaneAssignmentCache.h>
+#include <CompositionLog.h>
+#include <BlitComposer.h>
+#include <LayerArena.h>
+#include <LayerVector.h>
 
 namespace android {
 namespace intel {
@@ -30,7 +37,27 @@ namespace intel {
 
 class HwcLayerList {
 public:
-    HwcLayerList(hwc_display_contents_1_t *list, int disp);
+    enum {
+        // static layers considered by smart composition 2
+        STATIC_SET_MAX = 8,
+        // layers covered by the overlap matrix
+        OVERLAP_MAX_LAYERS = 64,
+    };
+
+    // time allowed for the plane assignment search, in nanoseconds
+    static const nsecs_t PLANE_SEARCH_BUDGET = 500000;
+
+public:
+    // protected layers are kept off the planes unless protectedOutput.
+    // clone is the list of a display showing the same layers, see
+    // setCloneSource(). The layers left to GLES may be composed by
+    // blitter instead, if given.
+    HwcLayerList(hwc_display_contents_1_t *list, int disp,
+                 PlaneAssignmentCache *cache = NULL,
+                 bool protectedOutput = true,
+                 CompositionLog *log = NULL,
+                 const HwcLayerList *clone = NULL,
+                 BlitComposer *blitter = NULL);
     virtual ~HwcLayerList();
 
 public:
@@ -38,7 +65,54 @@ public:
     virtual void deinitialize();
 
     virtual bool update(hwc_display_contents_1_t *list);
+
+    // takes over a list after a geometry change, keeping the HwcLayer and
+    // plane of every layer that is unchanged. Returns false, with the list
+    // left as it was, if the planes need to be assigned again.
+    virtual bool mergeGeometry(hwc_display_contents_1_t *list);
+
+    // update() split in two for parallel prepare: updateLayers() only
+    // touches the planes already owned by this list, finishUpdate() does
+    // the GLES fallback which may re-allocate planes.
+    virtual bool updateLayers(hwc_display_contents_1_t *list);
+    virtual void finishUpdate(hwc_display_contents_1_t *list);
+
+    // the list of the display this one mirrors, already updated for the
+    // frame. Buffer attributes, content checks and the plane checks that
+    // don't depend on the display are taken from its layers showing the
+    // same buffers. It must be reset before source goes away.
+    void setCloneSource(const HwcLayerList *source);
+
+    // blits the layers given to the blit composer by the last update and
+    // puts the result on the frame buffer target plane, in place of the
+    // frame buffer target of SurfaceFlinger; likewise for a flattened
+    // static group and the plane of its bottom layer. Called at commit,
+    // once the acquire fences are known.
+    bool composeBlitLayers();
+
+    // nothing changed in the last update, planes were left untouched and
+    // the previous frame stays on screen
+    bool isIdle() const { return mIdle; }
+    // bounds of what changed on the display in the last update, the old
+    // and new frame of every updated layer. Empty if idle.
+    const hwc_rect_t& getDamage() const { return mDamage; }
+    // layers of protected buffers in the list
+    int getProtectedLayerCount() const { return mProtectedLayers; }
+    // checked by the next plane assignment, the current one is kept
+    void setProtectedOutput(bool protectedOutput) { mProtectedOutput = protectedOutput; }
+    // layers on each plane type, indexed by DisplayPlane::PLANE_*, and
+    // layers composed by GLES in the current list
+    void getPlaneUsage(uint32_t planeLayers[DisplayPlane::PLANE_MAX],
+                       uint32_t *frameBufferLayers) const;
     virtual DisplayPlane* getPlane(uint32_t index) const;
+    // the only layer of a primary display list if it is opaque, unscaled,
+    // covers the whole screen and is on the primary plane, so that its
+    // buffer may be flipped to by address alone; NULL otherwise
+    HwcLayer* getAsyncFlipLayer() const;
+    // the layer whose buffer alone is the frame of a primary display list,
+    // the async flip layer or the frame buffer target of a list composed
+    // by GLES that fills the screen; NULL otherwise
+    HwcLayer* getScanoutLayer() const;
 
     void postFlip();
 
@@ -46,9 +120,28 @@ public:
     virtual void dump(Dump& d);
 
 private:
-    bool checkSupported(int planeType, HwcLayer *hwcLayer);
-    bool checkCursorSupported(HwcLayer *hwcLayer);
+    // a rejected layer gets a CompositionLog reason in reason, if given
+    bool checkSupported(int planeType, HwcLayer *hwcLayer,
+                        uint8_t *reason = NULL);
+    bool checkCursorSupported(HwcLayer *hwcLayer, uint8_t *reason = NULL);
+    // the checks of checkSupported() that only depend on the layer and its
+    // buffer, returns the CompositionLog reason of a rejected layer
+    uint8_t checkLayer(int planeType, HwcLayer *hwcLayer);
+    // checkLayer(), or its outcome on the clone source
+    uint8_t getVerdict(int planeType, HwcLayer *hwcLayer);
+    void resetVerdicts(int count);
+    const HwcLayer* getCloneLayer(int index, hwc_layer_1_t *layer) const;
+    // layer, matched at index, keeps its plane at the frame of the new
+    // layer at newIndex
+    bool isMoveSupported(HwcLayer *hwcLayer, int index, int newIndex,
+                         hwc_layer_1_t *layer, const hwc_rect_t& screen);
     bool allocatePlanes();
+    bool searchPlanes();
+    bool pruneSearch(int planeType, int index);
+    bool commitAssignment();
+    int64_t getAssignmentScore();
+    void getAssignment(Vector<PlaneAssignment>& assignment);
+    bool replayAssignment(const Vector<PlaneAssignment>& assignment);
     bool assignCursorPlanes();
     bool assignCursorPlanes(int index, int planeNumber);
     bool assignOverlayPlanes();
@@ -58,38 +151,88 @@ private:
     bool assignPrimaryPlane();
     bool assignPrimaryPlaneHelper(HwcLayer *hwcLayer, int zorder = -1);
     bool attachPlanes();
+    // maps the buffers of the layers attached to planes by attachPlanes()
+    // in one batch, held until the planes took their own references
+    void mapAttachedBuffers();
+    void releaseAttachedBuffers();
     bool useAsFrameBufferTarget(HwcLayer *target);
     bool hasIntersection(HwcLayer *la, HwcLayer *lb);
-    void addStaticLayerSize(HwcLayer *hwcLayer);
-    bool checkStaticLayerSize();
+    void buildOverlapMatrix();
+    bool isOverlapping(int la, int lb) const;
+    uint64_t getFetchBytes(HwcLayer *hwcLayer);
+    uint64_t getFrameBufferTargetBytes();
+    bool isInStaticSet(const Vector<int>& candidates, uint32_t set, int index);
+    bool isValidStaticSet(const Vector<int>& candidates, uint32_t set);
+    bool findStaticSet(const Vector<int>& candidates);
     ZOrderLayer* addZOrderLayer(int type, HwcLayer *hwcLayer, int zorder = -1);
     void removeZOrderLayer(ZOrderLayer *layer);
     void setupSmartComposition();
+    // hands the GLES layers to the blit composer if it can compose all of
+    // them, returns false if it leaves them to smart composition
+    bool setupBlitComposition();
+    // blits layers by composer into the buffer shown by the plane of
+    // target, in place of its own buffer
+    bool blitToPlane(BlitComposer *composer, HwcLayer *target,
+                     hwc_layer_1_t **layers, size_t count, bool changed);
+    // smart composition 3: static layers right above a static layer on a
+    // plane are flattened into a copy of it, their planes are freed.
+    // Returns true if the planes must be assigned again.
+    bool setupPrerender();
+    bool checkPrerender();
+    bool isFolded(int index) const;
+    void dropPrerender();
+    // deinitialize(), initialize() and update all layers
+    void reinitialize(hwc_display_contents_1_t *list);
     bool setupSmartComposition2();
+    bool isIdleFrame(hwc_display_contents_1_t *list);
+    bool partialFallback();
+    void updateProtectedCount();
+    // layers composed by GLES, as a systrace counter of the display
+    void traceFrameBufferLayers();
+    void addDamage(const hwc_rect_t& rect);
+    // adds the plane checks and the outcome to the composition log
+    void logDecisions();
     void dump();
 
 private:
-    class HwcLayerVector : public SortedVector<HwcLayer*> {
-    public:
-        HwcLayerVector() {}
-        virtual int do_compare(const void* lhs, const void* rhs) const {
-            const HwcLayer* l = *(HwcLayer**)lhs;
-            const HwcLayer* r = *(HwcLayer**)rhs;
-            // sorted from index 0 to n
-            return l->getIndex() - r->getIndex();
+    // sorted from index 0 to n
+    struct IndexKey {
+        static uint32_t key(HwcLayer *layer) {
+            return layer->getIndex();
         }
     };
 
-    class PriorityVector : public SortedVector<HwcLayer*> {
-    public:
-        PriorityVector() {}
-        virtual int do_compare(const void* lhs, const void* rhs) const {
-            const HwcLayer* l = *(HwcLayer**)lhs;
-            const HwcLayer* r = *(HwcLayer**)rhs;
-            return r->getPriority() - l->getPriority();
+    // sorted from highest to lowest priority
+    struct PriorityKey {
+        static uint32_t key(HwcLayer *layer) {
+            return ~layer->getPriority();
         }
     };
 
+    typedef LayerVector<HwcLayer*, IndexKey> HwcLayerVector;
+    typedef LayerVector<HwcLayer*, PriorityKey> PriorityVector;
+
+    uint64_t getCandidateBytes(const PriorityVector& candidates, int index);
+
+    // branch and bound state of searchPlanes()
+    struct SearchState {
+        SearchState()
+            : active(false), expired(false), deadline(0), nodes(0),
+              bestScore(-1), fbTargetBytes(0), cursorBytes(0),
+              overlayBytes(0), spriteBytes(0) {}
+        bool active;
+        bool expired;
+        nsecs_t deadline;
+        uint32_t nodes;
+        int64_t bestScore;
+        Vector<PlaneAssignment> best;
+        uint64_t fbTargetBytes;
+        // fetch bytes of all candidates of each plane type
+        uint64_t cursorBytes;
+        uint64_t overlayBytes;
+        uint64_t spriteBytes;
+    };
+
     hwc_display_contents_1_t *mList;
     int mLayerCount;
 
@@ -102,7 +245,78 @@ private:
     ZOrderConfig mZOrderConfig;
     HwcLayer *mFrameBufferTarget;
     int mDisplayIndex;
-    int mLayerSize;
+    // estimated bandwidth saved by smart composition 2
+    uint64_t mStaticSavings;
+
+    // memoized plane assignment, owned by the display device
+    PlaneAssignmentCache *mAssignmentCache;
+    Vector<uint32_t> mSignature;
+    Vector<PlaneAssignment> mAssignment;
+
+    // set by updateLayers(), consumed by finishUpdate()
+    bool mFallbackPending;
+    // the fallback is only for failed layer updates
+    bool mPartialFallback;
+
+    // bit j of mOverlap[i] is set if layers i and j overlap
+    uint64_t mOverlap[OVERLAP_MAX_LAYERS];
+
+    SearchState mSearch;
+
+    // set by updateLayers() when no layer changed
+    bool mIdle;
+    hwc_rect_t mDamage;
+
+    // mapped by mapAttachedBuffers(), released by finishUpdate()
+    Vector<BufferMapper*> mAttachedMappers;
+
+    // published to the display analyzer when it changes
+    int mProtectedLayers;
+    // the display output is protected, e.g. HDCP is authenticated
+    bool mProtectedOutput;
+
+    // backs the HwcLayer and ZOrderLayer objects, reset on deinitialize()
+    LayerArena mArena;
+
+    // owned by the display device, NULL if not logged
+    CompositionLog *mLog;
+    // plane checks of each layer since the planes were last assigned,
+    // logged with the outcome by the next finishUpdate()
+    Vector<CompositionLog::Layer> mDecisions;
+    uint32_t mDecisionFlags;
+    bool mDecisionPending;
+
+    // outcome of checkLayer() for the buffer of each layer
+    struct Verdict {
+        buffer_handle_t handle;
+        uint32_t transform;
+        int32_t blending;
+        uint8_t planeAlpha;
+        uint32_t skip;
+        // bit per plane type that was checked
+        uint8_t checked;
+        uint8_t reasons[DisplayPlane::PLANE_MAX];
+    };
+
+    // set for the prepare of a mirroring display only
+    const HwcLayerList *mClone;
+    Vector<Verdict> mVerdicts;
+
+    // owned by the display device, NULL if blit composition is not used
+    BlitComposer *mBlitComposer;
+    // the GLES layers of the last update go to mBlitComposer
+    bool mBlitting;
+
+    // flattened static group, carrier is the bottom layer which keeps its
+    // plane, the folded layers above are shown by its copy only
+    BlitComposer mPrerender;
+    int mFoldCarrier;
+    Vector<int> mFoldedLayers;
+
+    // geometry changes merged with layers moved or scaled on their planes,
+    // in total and in a row
+    uint32_t mMovedMerges;
+    uint32_t mMovedStreak;
 };
 
 } // namespace intel
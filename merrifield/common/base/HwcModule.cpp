@@ -18,8 +18,11 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <cutils/properties.h>
 #include <HwcTrace.h>
 #include <Hwcomposer.h>
+#include <BootTimeline.h>
 
 #define GET_HWC_RETURN_X_IF_NULL(X) \
     CTRACE(); \
@@ -232,6 +235,7 @@ static int hwc_device_open(const struct hw_module_t* module,
     }
 
     ATRACE("open device %s", name);
+    BootTimeline::mark("module open");
 
     if (strcmp(name, HWC_HARDWARE_COMPOSER) != 0) {
         ETRACE("try to open unknown HWComposer %s", name);
@@ -269,11 +273,15 @@ static int hwc_device_open(const struct hw_module_t* module,
     hwc.hwc_composer_device_1_t::setPowerMode = hwc_setPowerMode;
     hwc.hwc_composer_device_1_t::getActiveConfig = hwc_getActiveConfig;
     hwc.hwc_composer_device_1_t::setActiveConfig = hwc_setActiveConfig;
-    // Todo: add hwc_setCursorPositionAsync after supporting patches
-    hwc.hwc_composer_device_1_t::setCursorPositionAsync = NULL;
+    // asynchronous cursor needs DRM_PSB_UPDATE_CURSOR_POS in the kernel
+    char value[PROPERTY_VALUE_MAX];
+    property_get("hwc.cursor.async", value, "0");
+    hwc.hwc_composer_device_1_t::setCursorPositionAsync =
+        atoi(value) ? hwc_setCursorPositionAsync : NULL;
 
     *device = &hwc.hwc_composer_device_1_t::common;
 
+    BootTimeline::mark("device open");
     return 0;
 }
 
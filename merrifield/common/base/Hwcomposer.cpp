@@ -13,10 +13,22 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cutils/properties.h>
 #include <HwcTrace.h>
 #include <Hwcomposer.h>
 #include <Dump.h>
 #include <UeventObserver.h>
+#include <ThreadPolicy.h>
+#include <DisplayCalibration.h>
+#include <BootTimeline.h>
+#include <MemoryAccounting.h>
+#include <VaDisplayManager.h>
 
 namespace android {
 namespace intel {
@@ -31,11 +43,31 @@ Hwcomposer::Hwcomposer(IPlatFactory *factory)
       mDisplayAnalyzer(0),
       mMultiDisplayObserver(0),
       mUeventObserver(0),
+      mEventLoop(0),
+      mVblankObserver(0),
+      mFrameTiming(0),
+      mPrepareWorkers(0),
+      mCommitScheduler(0),
+      mFenceTracker(0),
+      mJankDetector(0),
+      mInputBoost(0),
+      mLayerTrace(0),
+      mBandwidthEstimator(0),
+      mTelemetry(0),
+      mScanoutCapture(0),
+      mTaskQueue(0),
+      mFenceCloser(0),
+      mPrepareTime(0),
+      mInvalidateLock(),
+      mInvalidatePending(false),
+      mInvalidateDeadline(0),
       mPlaneManager(0),
       mBufferManager(0),
       mDisplayContext(0),
       mInitialized(false)
 {
+    memset(mInvalidateRequests, 0, sizeof(mInvalidateRequests));
+    memset(mInvalidateForwarded, 0, sizeof(mInvalidateForwarded));
     CTRACE();
 
     mDisplayDevices.setCapacity(IDisplayDevice::DEVICE_COUNT);
@@ -59,6 +91,7 @@ bool Hwcomposer::prepare(size_t numDisplays,
     bool ret = true;
 
     RETURN_FALSE_IF_NOT_INIT();
+    STRACE();
     ATRACE("display count = %d", numDisplays);
 
     if (!numDisplays || !displays) {
@@ -66,11 +99,28 @@ bool Hwcomposer::prepare(size_t numDisplays,
         return false;
     }
 
+    FrameTimingScope timing(mFrameTiming, FrameTiming::DISPLAY_ALL,
+                            FrameTiming::STAGE_PREPARE);
+    LayerTrace::PrepareScope trace(mLayerTrace, numDisplays, displays);
+    mPrepareTime = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // state changed from now on needs an invalidate of its own
+    {
+        Mutex::Autolock _l(mInvalidateLock);
+        mInvalidatePending = false;
+    }
+
+    // the planes of the last commit may still be read by its post
+    mDisplayContext->waitPosted();
+
     mDisplayAnalyzer->analyzeContents(numDisplays, displays);
 
-    // disable reclaimed planes
+    // reset reclaimed planes in the background
     mPlaneManager->disableReclaimedPlanes();
 
+    // plane enable/disable updates of this frame are sent in commit
+    mDrm->beginPlaneUpdates();
+
         if(numDisplays > mDisplayDevices.size())
                 numDisplays = mDisplayDevices.size();
 
@@ -88,6 +138,16 @@ bool Hwcomposer::prepare(size_t numDisplays,
         device->prePrepare(displays[i]);
     }
 
+    reservePlanes(numDisplays, displays);
+
+    // a clone list reuses the analysis of the primary list, which has to
+    // be done first, so mirroring frames are prepared serially
+    if (mPrepareWorkers && !hasCloneList(numDisplays, displays)) {
+        ret = prepareParallel(numDisplays, displays);
+        mPlaneManager->clearReservations();
+        return ret;
+    }
+
     for (size_t i = 0; i < numDisplays; i++) {
         IDisplayDevice *device = mDisplayDevices.itemAt(i);
         if (!device) {
@@ -98,13 +158,180 @@ bool Hwcomposer::prepare(size_t numDisplays,
         if (device->getType() == IDisplayDevice::DEVICE_VIRTUAL)
             continue;
 
+        // a mirroring display reuses the layer analysis of the primary one,
+        // which is prepared first
+        if (i != IDisplayDevice::DEVICE_PRIMARY &&
+            isCloneList(displays[IDisplayDevice::DEVICE_PRIMARY], displays[i])) {
+            device->setCloneSource(mDisplayDevices.itemAt(IDisplayDevice::DEVICE_PRIMARY));
+        } else {
+            device->setCloneSource(NULL);
+        }
+
         ret = device->prepare(displays[i]);
+        mPlaneManager->releasePlanes(i);
         if (ret == false) {
             ETRACE("failed to do prepare for device %d", i);
             continue;
         }
     }
 
+    mPlaneManager->clearReservations();
+    return ret;
+}
+
+bool Hwcomposer::isCloneList(hwc_display_contents_1_t *source,
+                             hwc_display_contents_1_t *list)
+{
+    if (!source || !list || source->numHwLayers != list->numHwLayers ||
+        list->numHwLayers < 2) {
+        return false;
+    }
+
+    // the same buffers shown the same way, the display frames differ
+    for (size_t i = 0; i < list->numHwLayers - 1; i++) {
+        hwc_layer_1_t& a = source->hwLayers[i];
+        hwc_layer_1_t& b = list->hwLayers[i];
+        if (a.handle != b.handle ||
+            a.transform != b.transform ||
+            a.blending != b.blending ||
+            a.planeAlpha != b.planeAlpha ||
+            (a.flags & HWC_SKIP_LAYER) != (b.flags & HWC_SKIP_LAYER)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Hwcomposer::hasCloneList(size_t numDisplays,
+                              hwc_display_contents_1_t** displays)
+{
+    // the virtual display is not prepared here
+    for (size_t i = 0; i < numDisplays; i++) {
+        if (i != IDisplayDevice::DEVICE_PRIMARY &&
+            i != IDisplayDevice::DEVICE_VIRTUAL &&
+            isCloneList(displays[IDisplayDevice::DEVICE_PRIMARY], displays[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Hwcomposer::reservePlanes(size_t numDisplays,
+                               hwc_display_contents_1_t** displays)
+{
+    int wanted[DisplayPlaneManager::RESERVATION_DISPLAYS];
+    int granted[DisplayPlaneManager::RESERVATION_DISPLAYS];
+    size_t count = numDisplays;
+
+    mPlaneManager->clearReservations();
+    if (!mDisplayAnalyzer->getVideoInstances() ||
+        !mDisplayAnalyzer->isOverlayAllowed()) {
+        return;
+    }
+
+    if (count > DisplayPlaneManager::RESERVATION_DISPLAYS)
+        count = DisplayPlaneManager::RESERVATION_DISPLAYS;
+
+    // only displays with a new geometry allocate planes in this frame,
+    // the others keep the planes they already have
+    // a starting session holds an overlay for the primary until its first
+    // frames arrive, so they are not composed by GLES
+    bool starting = mDisplayAnalyzer->isVideoStarting() &&
+                    !mDisplayAnalyzer->isVideoExtModeActive();
+
+    for (size_t i = 0; i < count; i++) {
+        hwc_display_contents_1_t *content = displays[i];
+        wanted[i] = 0;
+        granted[i] = 0;
+        if (starting && i == IDisplayDevice::DEVICE_PRIMARY)
+            wanted[i] = 1;
+        if (!content || !(content->flags & HWC_GEOMETRY_CHANGED))
+            continue;
+
+        // in video extended mode the videos are scanned out by the
+        // secondary displays, the primary is about to be blanked
+        if (i == IDisplayDevice::DEVICE_PRIMARY &&
+            mDisplayAnalyzer->isVideoExtModeActive())
+            continue;
+
+        int videos = 0;
+        for (int j = 0; j < (int)content->numHwLayers - 1; j++) {
+            if (mDisplayAnalyzer->isVideoLayer(content->hwLayers[j]))
+                videos++;
+        }
+        if (videos > wanted[i])
+            wanted[i] = videos;
+    }
+
+    // one overlay for every display showing video first, then the rest
+    // in display order
+    int available = mPlaneManager->getFreePlanes(IDisplayDevice::DEVICE_PRIMARY,
+                                            DisplayPlane::PLANE_OVERLAY);
+    for (size_t i = 0; i < count && available > 0; i++) {
+        if (wanted[i]) {
+            granted[i]++;
+            available--;
+        }
+    }
+    for (size_t i = 0; i < count && available > 0; i++) {
+        int more = wanted[i] - granted[i];
+        if (more > available)
+            more = available;
+        granted[i] += more;
+        available -= more;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (granted[i]) {
+            mPlaneManager->reservePlanes(i, DisplayPlane::PLANE_OVERLAY, granted[i]);
+        }
+    }
+}
+
+bool Hwcomposer::prepareParallel(size_t numDisplays,
+                                 hwc_display_contents_1_t** displays)
+{
+    bool ret = true;
+    bool failed[IDisplayDevice::DEVICE_COUNT];
+
+    // plane allocation stays serial and in display order, so every display
+    // gets the same planes it would get from the serial path
+    mPrepareWorkers->clear();
+    for (size_t i = 0; i < numDisplays; i++) {
+        IDisplayDevice *device = mDisplayDevices.itemAt(i);
+        failed[i] = true;
+        if (!device || device->getType() == IDisplayDevice::DEVICE_VIRTUAL)
+            continue;
+
+        bool ok = device->prepareGeometry(displays[i]);
+        mPlaneManager->releasePlanes(i);
+        if (!ok) {
+            ETRACE("failed to do prepare for device %d", i);
+            ret = false;
+            continue;
+        }
+        failed[i] = false;
+        mPrepareWorkers->add(device, displays[i]);
+    }
+
+    // per-layer updates only touch the planes each display already owns
+    if (!mPrepareWorkers->run()) {
+        ETRACE("failed to update layers");
+        ret = false;
+    }
+
+    // GLES fallback may re-allocate planes, back to display order
+    for (size_t i = 0; i < numDisplays; i++) {
+        if (failed[i])
+            continue;
+
+        IDisplayDevice *device = mDisplayDevices.itemAt(i);
+        if (!device->prepareFinish(displays[i])) {
+            ETRACE("failed to do prepare for device %d", i);
+            ret = false;
+        }
+    }
+
     return ret;
 }
 
@@ -114,6 +341,7 @@ bool Hwcomposer::commit(size_t numDisplays,
     bool ret = true;
 
     RETURN_FALSE_IF_NOT_INIT();
+    STRACE();
     ATRACE("display count = %d", numDisplays);
 
     if (!numDisplays || !displays) {
@@ -124,6 +352,19 @@ bool Hwcomposer::commit(size_t numDisplays,
         if(numDisplays > mDisplayDevices.size())
                 numDisplays = mDisplayDevices.size();
 
+    mDisplayAnalyzer->updateStatistics(numDisplays, displays);
+
+    FrameTimingScope timing(mFrameTiming, FrameTiming::DISPLAY_ALL,
+                            FrameTiming::STAGE_COMMIT);
+    LayerTrace::CommitScope trace(mLayerTrace, numDisplays);
+    nsecs_t commitTime = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // planes must be enabled before their contents are flipped, a plane
+    // that failed has its layer moved to GLES by the next prepare
+    if (!mDrm->submitPlaneUpdates()) {
+        invalidate();
+    }
+
     mDisplayContext->commitBegin(numDisplays, displays);
 
     for (size_t i = 0; i < numDisplays; i++) {
@@ -148,11 +389,51 @@ bool Hwcomposer::commit(size_t numDisplays,
         }
     }
 
-    mDisplayContext->commitEnd(numDisplays, displays);
+    if (mCommitScheduler) {
+        mCommitScheduler->waitForDeadline();
+        // cursor moves during the wait go out with this frame
+        applyCursorPositions();
+    }
+
+    {
+        FrameTimingScope commitEndTiming(mFrameTiming, FrameTiming::DISPLAY_ALL,
+                                         FrameTiming::STAGE_COMMIT_END);
+        mDisplayContext->commitEnd(numDisplays, displays);
+    }
+
+    // planes no longer used by the frame just flipped
+    mDrm->submitDeferredPlaneUpdates();
+    mScanoutCapture->onCommit(numDisplays);
+
+    trackRetireFence(numDisplays, displays, commitTime);
+    mBandwidthEstimator->onCommit(numDisplays, displays);
+    mJankDetector->onFrame();
+    mInputBoost->onFrame();
+    mFenceCloser->flush();
     // return true always
     return true;
 }
 
+void Hwcomposer::trackRetireFence(size_t numDisplays,
+                                  hwc_display_contents_1_t** displays,
+                                  nsecs_t commitTime)
+{
+    // physical displays share a single retire fence
+    int fenceFd = -1;
+    uint32_t mask = 0;
+    for (size_t i = 0; i < numDisplays && i < IDisplayDevice::DEVICE_VIRTUAL; i++) {
+        if (!displays[i] || displays[i]->retireFenceFd == -1)
+            continue;
+        if (fenceFd == -1)
+            fenceFd = displays[i]->retireFenceFd;
+        mask |= (1 << i);
+    }
+
+    if (fenceFd != -1) {
+        mFenceTracker->track(fenceFd, mask, mPrepareTime, commitTime);
+    }
+}
+
 bool Hwcomposer::setPowerMode(int disp, int mode)
 {
     RETURN_FALSE_IF_NOT_INIT();
@@ -221,7 +502,16 @@ bool Hwcomposer::setCursorPositionAsync(int disp, int x, int y)
         return false;
     }
 
-    return mDisplayContext->setCursorPosition(disp, x, y);
+    DisplayPlane *plane = mPlaneManager->getCursorPlane(disp);
+    if (!plane || !plane->postCursorPosition(x, y)) {
+        return mDisplayContext->setCursorPosition(disp, x, y);
+    }
+
+    // without vsync nobody picks the position up, apply it right away
+    if (!mVsyncManager->isVsyncEnabled()) {
+        plane->applyCursorPosition();
+    }
+    return true;
 }
 
 bool Hwcomposer::vsyncControl(int disp, int enabled)
@@ -329,6 +619,31 @@ bool Hwcomposer::compositionComplete(int disp)
 void Hwcomposer::vsync(int disp, int64_t timestamp)
 {
     RETURN_VOID_IF_NOT_INIT();
+    STRACE();
+    BootTimeline::mark("first vsync");
+
+    // toggles on every vsync, the period is visible in systrace
+    static const char* counters[] = {
+        "hwc_vsync_0",
+        "hwc_vsync_1",
+        "hwc_vsync_2",
+    };
+    static int toggles[] = { 0, 0, 0 };
+    if (disp >= 0 && disp < (int)(sizeof(counters) / sizeof(counters[0]))) {
+        toggles[disp] ^= 1;
+        STRACE_INT(counters[disp], toggles[disp]);
+    }
+
+    // both sources run for a few vsyncs while the source is switched
+    if (mVsyncManager && !mVsyncManager->onVsync(disp, timestamp)) {
+        return;
+    }
+
+    // reclaimed planes are reset once their last flip is off the screen
+    mPlaneManager->onVsync();
+
+    // latest asynchronous cursor positions, one register write per vblank
+    applyCursorPositions();
 
     if (mProcs && mProcs->vsync) {
         VTRACE("report vsync on disp %d, timestamp %llu", disp, timestamp);
@@ -338,6 +653,16 @@ void Hwcomposer::vsync(int disp, int64_t timestamp)
     }
 }
 
+void Hwcomposer::applyCursorPositions()
+{
+    for (int i = IDisplayDevice::DEVICE_PRIMARY; i <= IDisplayDevice::DEVICE_EXTERNAL; i++) {
+        DisplayPlane *plane = mPlaneManager->getCursorPlane(i);
+        if (plane) {
+            plane->applyCursorPosition();
+        }
+    }
+}
+
 void Hwcomposer::hotplug(int disp, bool connected)
 {
     RETURN_VOID_IF_NOT_INIT();
@@ -355,16 +680,95 @@ void Hwcomposer::hotplug(int disp, bool connected)
     mDisplayAnalyzer->postHotplugEvent(connected);
 }
 
-void Hwcomposer::invalidate()
+void Hwcomposer::invalidate(int reason)
 {
     RETURN_VOID_IF_NOT_INIT();
 
+    if (reason < 0 || reason >= INVALIDATE_REASON_MAX) {
+        reason = INVALIDATE_OTHER;
+    }
+
+    {
+        Mutex::Autolock _l(mInvalidateLock);
+        mInvalidateRequests[reason]++;
+
+        // the prepare of the pending one picks this state up as well. The
+        // deadline covers SurfaceFlinger dropping a request.
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (mInvalidatePending && now < mInvalidateDeadline) {
+            VTRACE("invalidate %d coalesced", reason);
+            return;
+        }
+
+        nsecs_t next = mVsyncManager ? mVsyncManager->getNextVsyncTime(now) : 0;
+        nsecs_t after = next ? mVsyncManager->getNextVsyncTime(next + 1) : 0;
+        mInvalidatePending = true;
+        mInvalidateDeadline = after ? after : now + 2 * DEFAULT_VSYNC_PERIOD;
+        mInvalidateForwarded[reason]++;
+    }
+
     if (mProcs && mProcs->invalidate) {
-        DTRACE("invalidating screen...");
+        DTRACE("invalidating screen, reason %d", reason);
         mProcs->invalidate(const_cast<hwc_procs_t*>(mProcs));
     }
 }
 
+bool Hwcomposer::requestScanoutCapture(int disp, buffer_handle_t target,
+                                       uint32_t width, uint32_t height,
+                                       ScanoutCapture::Callback callback,
+                                       void *data)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (disp < 0 || disp >= IDisplayDevice::DEVICE_VIRTUAL) {
+        ETRACE("invalid disp %d", disp);
+        return false;
+    }
+
+    IDisplayDevice *device = getDisplayDevice(disp);
+    int displayWidth, displayHeight;
+    if (!device || !device->isConnected() ||
+        !device->getDisplaySize(&displayWidth, &displayHeight)) {
+        WTRACE("display %d is not connected", disp);
+        return false;
+    }
+
+    if (!mScanoutCapture->request(disp, displayWidth, displayHeight,
+                                  target, width, height, callback, data)) {
+        return false;
+    }
+
+    // a static screen would not commit again to copy the planes from
+    invalidate(INVALIDATE_CAPTURE);
+    return true;
+}
+
+void Hwcomposer::dumpInvalidates(Dump& d)
+{
+    static const char *names[INVALIDATE_REASON_MAX] = {
+        "other", "video", "blank", "input", "idle", "protected",
+        "resume", "hotplug", "capture",
+    };
+
+    Mutex::Autolock _l(mInvalidateLock);
+    uint32_t requests = 0;
+    uint32_t forwarded = 0;
+    for (int i = 0; i < INVALIDATE_REASON_MAX; i++) {
+        requests += mInvalidateRequests[i];
+        forwarded += mInvalidateForwarded[i];
+    }
+
+    d.append("Invalidates: forwarded %u of %u, pending %d\n",
+             forwarded, requests, mInvalidatePending);
+    for (int i = 0; i < INVALIDATE_REASON_MAX; i++) {
+        if (!mInvalidateRequests[i]) {
+            continue;
+        }
+        d.append("  %-10s forwarded %u of %u\n", names[i],
+                 mInvalidateForwarded[i], mInvalidateRequests[i]);
+    }
+}
+
 bool Hwcomposer::release()
 {
     RETURN_FALSE_IF_NOT_INIT();
@@ -378,6 +782,20 @@ bool Hwcomposer::dump(char *buff, int buff_len, int *cur_len)
 
     Dump d(buff, buff_len);
 
+    // the whole dump, which rarely fits the buffer, can go to a file
+    char prop[PROPERTY_VALUE_MAX];
+    int fd = -1;
+    if (property_get("hwc.dump.file", prop, "") > 0) {
+        fd = open(prop, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            WTRACE("failed to open %s, %s", prop, strerror(errno));
+        }
+        d.setOutput(fd);
+    }
+    if (property_get("hwc.dump.kv", prop, "0") > 0) {
+        d.setKeyValue(atoi(prop) != 0);
+    }
+
     // dump composer status
     d.append("Hardware Composer state:");
     // dump device status
@@ -387,6 +805,14 @@ bool Hwcomposer::dump(char *buff, int buff_len, int *cur_len)
             device->dump(d);
     }
 
+    // dump cached sink modes
+    if (mDrm)
+        mDrm->dump(d);
+
+    // dump vsync source
+    if (mVsyncManager)
+        mVsyncManager->dump(d);
+
     // dump plane manager status
     if (mPlaneManager)
         mPlaneManager->dump(d);
@@ -395,6 +821,66 @@ bool Hwcomposer::dump(char *buff, int buff_len, int *cur_len)
     if (mBufferManager)
         mBufferManager->dump(d);
 
+    if (mCommitScheduler)
+        mCommitScheduler->dump(d);
+
+    // dump scan out latency
+    if (mFenceTracker)
+        mFenceTracker->dump(d);
+
+    if (mFenceCloser)
+        mFenceCloser->dump(d);
+
+    if (mJankDetector)
+        mJankDetector->dump(d);
+
+    if (mInputBoost)
+        mInputBoost->dump(d);
+
+    if (mLayerTrace)
+        mLayerTrace->dump(d);
+
+    if (mBandwidthEstimator)
+        mBandwidthEstimator->dump(d);
+
+    if (mTelemetry)
+        mTelemetry->dump(d);
+
+    if (mScanoutCapture)
+        mScanoutCapture->dump(d);
+
+    if (mDisplayAnalyzer)
+        mDisplayAnalyzer->dump(d);
+
+    ThreadPolicy::dump(d);
+    TuningPolicy::dump(d);
+    DisplayCalibration::dump(d);
+    BootTimeline::dump(d);
+    MemoryAccounting::dump(d);
+    VaDisplayManager::dump(d);
+
+    // dump frame timing statistics
+    if (mFrameTiming)
+        mFrameTiming->dump(d);
+
+    if (mEventLoop)
+        mEventLoop->dump(d);
+
+    if (mTaskQueue)
+        mTaskQueue->dump(d);
+
+    dumpInvalidates(d);
+
+    if (mVblankObserver)
+        mVblankObserver->dump(d);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (d.getTruncated()) {
+        DTRACE("dump truncated, %zu of %zu bytes did not fit",
+               d.getTruncated(), d.getLength());
+    }
     return true;
 }
 
@@ -406,20 +892,57 @@ void Hwcomposer::registerProcs(hwc_procs_t const *procs)
         WTRACE("procs is NULL");
     }
     mProcs = procs;
+    BootTimeline::mark("procs registered");
 }
 
 bool Hwcomposer::initialize()
 {
     CTRACE();
 
+    if (!mPlatFactory){
+        DEINIT_AND_RETURN_FALSE("failed to provide a PlatFactory");
+    }
+
+    // before the buffer manager and the devices size themselves from it
+    TuningPolicy::load();
+
     // create drm
-    mDrm = new Drm();
+    mDrm = mPlatFactory->createDrm();
     if (!mDrm || !mDrm->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to create DRM");
     }
+    BootTimeline::mark("drm");
 
-    if (!mPlatFactory){
-        DEINIT_AND_RETURN_FALSE("failed to provide a PlatFactory");
+    mFrameTiming = new FrameTiming();
+    if (!mFrameTiming || !mFrameTiming->initialize()) {
+        DEINIT_AND_RETURN_FALSE("failed to create frame timing");
+    }
+    BootTimeline::mark("frame timing");
+
+    // opt-in: prepare the physical displays concurrently
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("hwc.prepare.parallel", prop, "0") > 0 && atoi(prop)) {
+        // the calling thread prepares one of the displays itself
+        mPrepareWorkers = new PrepareWorkerPool();
+        if (!mPrepareWorkers ||
+            !mPrepareWorkers->initialize(IDisplayDevice::DEVICE_VIRTUAL - 1)) {
+            DEINIT_AND_RETURN_FALSE("failed to create prepare workers");
+        }
+    }
+
+    // background work of the features without a thread of their own
+    int taskWorkers = TaskQueue::DEFAULT_WORKERS;
+    if (property_get("hwc.tasks.workers", prop, NULL) > 0) {
+        taskWorkers = atoi(prop);
+    }
+    mTaskQueue = new TaskQueue();
+    if (!mTaskQueue || !mTaskQueue->initialize(taskWorkers)) {
+        DEINIT_AND_RETURN_FALSE("failed to create task queue");
+    }
+
+    mFenceCloser = new FenceCloser();
+    if (!mFenceCloser || !mFenceCloser->initialize(mTaskQueue)) {
+        DEINIT_AND_RETURN_FALSE("failed to create fence closer");
     }
 
     // create buffer manager
@@ -427,22 +950,44 @@ bool Hwcomposer::initialize()
     if (!mBufferManager || !mBufferManager->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to create buffer manager");
     }
+    BootTimeline::mark("buffer manager");
 
     // create display plane manager
     mPlaneManager = mPlatFactory->createDisplayPlaneManager();
     if (!mPlaneManager || !mPlaneManager->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to create display plane manager");
     }
+    BootTimeline::mark("plane manager");
 
     mDisplayContext = mPlatFactory->createDisplayContext();
     if (!mDisplayContext || !mDisplayContext->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to create display context");
     }
+    BootTimeline::mark("display context");
+
+    mEventLoop = new EventLoop();
+    if (!mEventLoop || !mEventLoop->initialize()) {
+        DEINIT_AND_RETURN_FALSE("failed to create event loop");
+    }
+
+    if (!TuningPolicy::watch(mEventLoop)) {
+        WTRACE("tuning policy is not watched");
+    }
 
     mUeventObserver = new UeventObserver();
-    if (!mUeventObserver || !mUeventObserver->initialize()) {
+    if (!mUeventObserver || !mUeventObserver->initialize(mEventLoop)) {
         DEINIT_AND_RETURN_FALSE("failed to initialize uevent observer");
     }
+    BootTimeline::mark("event loop");
+
+    // the vsync observers of the displays take their vblanks from it
+    if (property_get("hwc.vsync.events", prop, "1") > 0 && atoi(prop)) {
+        mVblankObserver = new VblankEventObserver();
+        if (!mVblankObserver || !mVblankObserver->initialize(mDrm->getDrmFd())) {
+            WTRACE("no vblank event observer, displays wait for vblanks");
+            DEINIT_AND_DELETE_OBJ(mVblankObserver);
+        }
+    }
 
     // create display device
     mDisplayDevices.clear();
@@ -455,34 +1000,98 @@ bool Hwcomposer::initialize()
         // add this device
         ETRACE("HWC devices initialize device is %p at %d", device, i);
         mDisplayDevices.insertAt(device, i, 1);
+
+        char step[32];
+        snprintf(step, sizeof(step), "display %d", i);
+        BootTimeline::mark(step);
     }
 
     mVsyncManager = new VsyncManager(*this);
     if (!mVsyncManager || !mVsyncManager->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to create Vsync Manager");
     }
+    BootTimeline::mark("vsync manager");
+
+    mFenceTracker = new FenceTracker();
+    if (!mFenceTracker || !mFenceTracker->initialize(mVsyncManager)) {
+        DEINIT_AND_RETURN_FALSE("failed to create fence tracker");
+    }
+
+    mJankDetector = new JankDetector();
+    if (!mJankDetector ||
+        !mJankDetector->initialize(mFenceTracker, mFrameTiming, mVsyncManager)) {
+        DEINIT_AND_RETURN_FALSE("failed to create jank detector");
+    }
+
+    mInputBoost = new InputBoost();
+    if (!mInputBoost || !mInputBoost->initialize()) {
+        DEINIT_AND_RETURN_FALSE("failed to create input boost");
+    }
+
+    mLayerTrace = new LayerTrace();
+    if (!mLayerTrace || !mLayerTrace->initialize(mBufferManager)) {
+        DEINIT_AND_RETURN_FALSE("failed to create layer trace");
+    }
+
+    mScanoutCapture = new ScanoutCapture();
+    if (!mScanoutCapture || !mScanoutCapture->initialize(mPlaneManager)) {
+        DEINIT_AND_RETURN_FALSE("failed to create scanout capture");
+    }
+
+    mBandwidthEstimator = new BandwidthEstimator();
+    if (!mBandwidthEstimator ||
+        !mBandwidthEstimator->initialize(mDrm, mBufferManager)) {
+        DEINIT_AND_RETURN_FALSE("failed to create bandwidth estimator");
+    }
+    BootTimeline::mark("frame statistics");
+
+    // opt-in: post each frame just before the predicted vblank
+    if (property_get("hwc.commit.deadline", prop, "0") > 0 && atoi(prop)) {
+        mCommitScheduler = new CommitScheduler();
+        if (!mCommitScheduler ||
+            !mCommitScheduler->initialize(mVsyncManager, mFrameTiming)) {
+            DEINIT_AND_RETURN_FALSE("failed to create commit scheduler");
+        }
+    }
 
     mDisplayAnalyzer = new DisplayAnalyzer();
     if (!mDisplayAnalyzer || !mDisplayAnalyzer->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to initialize display analyzer");
     }
+    BootTimeline::mark("display analyzer");
 
     mMultiDisplayObserver = new MultiDisplayObserver();
     if (!mMultiDisplayObserver || !mMultiDisplayObserver->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to initialize display observer");
     }
+    BootTimeline::mark("display observer");
 
-    // all initialized, starting uevent observer
-    mUeventObserver->start();
+    mTelemetry = new Telemetry();
+    if (!mTelemetry || !mTelemetry->initialize(mEventLoop)) {
+        DEINIT_AND_RETURN_FALSE("failed to create telemetry");
+    }
 
+    // all initialized, starting uevent observer. Deferred initialization
+    // of external display runs on the loop and may report hotplug at once.
     mInitialized = true;
+    mUeventObserver->start();
+    mEventLoop->start();
+
     return true;
 }
 
 void Hwcomposer::deinitialize()
 {
+    DEINIT_AND_DELETE_OBJ(mTelemetry);
     DEINIT_AND_DELETE_OBJ(mMultiDisplayObserver);
     DEINIT_AND_DELETE_OBJ(mDisplayAnalyzer);
+    DEINIT_AND_DELETE_OBJ(mCommitScheduler);
+    DEINIT_AND_DELETE_OBJ(mBandwidthEstimator);
+    DEINIT_AND_DELETE_OBJ(mScanoutCapture);
+    DEINIT_AND_DELETE_OBJ(mLayerTrace);
+    DEINIT_AND_DELETE_OBJ(mInputBoost);
+    DEINIT_AND_DELETE_OBJ(mJankDetector);
+    DEINIT_AND_DELETE_OBJ(mFenceTracker);
     // delete mVsyncManager first as it holds reference to display devices.
     DEINIT_AND_DELETE_OBJ(mVsyncManager);
 
@@ -493,6 +1102,10 @@ void Hwcomposer::deinitialize()
         DEINIT_AND_DELETE_OBJ(device);
     }
     mDisplayDevices.clear();
+    DEINIT_AND_DELETE_OBJ(mVblankObserver);
+    // after the devices, HDCP runs on it
+    TuningPolicy::unwatch();
+    DEINIT_AND_DELETE_OBJ(mEventLoop);
 
     if (mPlatFactory) {
         delete mPlatFactory;
@@ -502,6 +1115,10 @@ void Hwcomposer::deinitialize()
     DEINIT_AND_DELETE_OBJ(mDisplayContext);
     DEINIT_AND_DELETE_OBJ(mPlaneManager);
     DEINIT_AND_DELETE_OBJ(mBufferManager);
+    DEINIT_AND_DELETE_OBJ(mFenceCloser);
+    DEINIT_AND_DELETE_OBJ(mTaskQueue);
+    DEINIT_AND_DELETE_OBJ(mPrepareWorkers);
+    DEINIT_AND_DELETE_OBJ(mFrameTiming);
     DEINIT_AND_DELETE_OBJ(mDrm);
     mInitialized = false;
 }
@@ -555,5 +1172,50 @@ UeventObserver* Hwcomposer::getUeventObserver()
     return mUeventObserver;
 }
 
+EventLoop* Hwcomposer::getEventLoop()
+{
+    return mEventLoop;
+}
+
+VblankEventObserver* Hwcomposer::getVblankObserver()
+{
+    return mVblankObserver;
+}
+
+FenceTracker* Hwcomposer::getFenceTracker()
+{
+    return mFenceTracker;
+}
+
+JankDetector* Hwcomposer::getJankDetector()
+{
+    return mJankDetector;
+}
+
+InputBoost* Hwcomposer::getInputBoost()
+{
+    return mInputBoost;
+}
+
+BandwidthEstimator* Hwcomposer::getBandwidthEstimator()
+{
+    return mBandwidthEstimator;
+}
+
+FrameTiming* Hwcomposer::getFrameTiming()
+{
+    return mFrameTiming;
+}
+
+TaskQueue* Hwcomposer::getTaskQueue()
+{
+    return mTaskQueue;
+}
+
+FenceCloser* Hwcomposer::getFenceCloser()
+{
+    return mFenceCloser;
+}
+
 } // namespace intel
 } // namespace android
@@ -0,0 +1,161 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <HwcTrace.h>
+#include <cutils/properties.h>
+#include <InputBoost.h>
+
+namespace android {
+namespace intel {
+
+InputBoost::InputBoost()
+    : mInitialized(false),
+      mEnabled(true),
+      mActive(false),
+      mPowerModule(0),
+      mLastHint(0),
+      mBoosts(0),
+      mHints(0),
+      mBoostStart(0),
+      mBoostTime(0)
+{
+    CTRACE();
+    mNode[0] = '\0';
+}
+
+InputBoost::~InputBoost()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool InputBoost::initialize()
+{
+    CTRACE();
+
+    char prop[PROPERTY_VALUE_MAX];
+    mEnabled = true;
+    if (property_get("hwc.input.boost", prop, "1") > 0) {
+        mEnabled = atoi(prop);
+    }
+
+    mNode[0] = '\0';
+    property_get("hwc.input.boost.node", mNode, "");
+
+    // not fatal, the composition policy works without the hint
+    mPowerModule = 0;
+    const hw_module_t *module = 0;
+    if (mEnabled && hw_get_module(POWER_HARDWARE_MODULE_ID, &module) == 0) {
+        mPowerModule = (power_module_t *)module;
+    } else if (mEnabled) {
+        WTRACE("no power HAL, boost without governor hints");
+    }
+
+    mActive = false;
+    mLastHint = 0;
+    mBoosts = 0;
+    mHints = 0;
+    mBoostStart = 0;
+    mBoostTime = 0;
+    mInitialized = true;
+    return true;
+}
+
+void InputBoost::deinitialize()
+{
+    if (mActive) {
+        setActive(false);
+    }
+    mPowerModule = 0;
+    mInitialized = false;
+}
+
+void InputBoost::setActive(bool active)
+{
+    if (!mInitialized || !mEnabled || active == mActive) {
+        return;
+    }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    mActive = active;
+    if (active) {
+        mBoosts++;
+        mBoostStart = now;
+        powerHint();
+    } else {
+        mBoostTime += now - mBoostStart;
+    }
+    writeNode(active);
+    DTRACE("input boost %s", active ? "on" : "off");
+}
+
+void InputBoost::onFrame()
+{
+    if (!mActive) {
+        return;
+    }
+
+    if (systemTime(SYSTEM_TIME_MONOTONIC) - mLastHint >= HINT_INTERVAL) {
+        powerHint();
+    }
+}
+
+void InputBoost::powerHint()
+{
+    mLastHint = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (mPowerModule && mPowerModule->powerHint) {
+        mPowerModule->powerHint(mPowerModule, POWER_HINT_INTERACTION, NULL);
+        mHints++;
+    }
+}
+
+void InputBoost::writeNode(bool active)
+{
+    if (!mNode[0]) {
+        return;
+    }
+
+    int fd = open(mNode, O_WRONLY);
+    if (fd < 0) {
+        WTRACE("failed to open %s", mNode);
+        return;
+    }
+    if (write(fd, active ? "1" : "0", 1) != 1) {
+        WTRACE("failed to write %s", mNode);
+    }
+    close(fd);
+}
+
+void InputBoost::dump(Dump& d)
+{
+    if (!mInitialized) {
+        return;
+    }
+
+    nsecs_t total = mBoostTime;
+    if (mActive) {
+        total += systemTime(SYSTEM_TIME_MONOTONIC) - mBoostStart;
+    }
+    d.append("Input boost: enabled %d, active %d, boosts %u, hints %u, "
+             "boosted %lld ms%s\n",
+             mEnabled, mActive, mBoosts, mHints, ns2ms(total),
+             mPowerModule ? "" : ", no power HAL");
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,72 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef INPUT_BOOST_H
+#define INPUT_BOOST_H
+
+#include <Dump.h>
+#include <utils/Timers.h>
+#include <cutils/properties.h>
+#include <hardware/power.h>
+
+namespace android {
+namespace intel {
+
+// Composition policy while the user touches the screen: plane assignments
+// and smart composition are held as they are so that nothing visibly
+// reshuffles under the finger, and the CPU/GPU governors are kept up
+// through the power HAL and an optional sysfs node. The normal power
+// saving heuristics resume once input goes idle.
+class InputBoost {
+public:
+    InputBoost();
+    ~InputBoost();
+
+public:
+    bool initialize();
+    void deinitialize();
+    void setActive(bool active);
+    bool isActive() const { return mActive; }
+    // called once per commit, renews the power hint while boosted
+    void onFrame();
+    void dump(Dump& d);
+
+private:
+    void powerHint();
+    void writeNode(bool active);
+
+private:
+    // the power HAL drops an interaction boost after a while
+    static const nsecs_t HINT_INTERVAL = 1000000000LL;
+
+    bool mInitialized;
+    bool mEnabled;
+    volatile bool mActive;
+    power_module_t *mPowerModule;
+    // written with 1 and 0 when the boost starts and ends, if set
+    char mNode[PROPERTY_VALUE_MAX];
+    nsecs_t mLastHint;
+
+    // statistics
+    uint32_t mBoosts;
+    uint32_t mHints;
+    nsecs_t mBoostStart;
+    nsecs_t mBoostTime;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* INPUT_BOOST_H */
@@ -0,0 +1,189 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdlib.h>
+#include <HwcTrace.h>
+#include <FenceTracker.h>
+#include <FrameTiming.h>
+#include <VsyncManager.h>
+#include <JankDetector.h>
+#include <cutils/properties.h>
+
+namespace android {
+namespace intel {
+
+JankDetector::JankDetector()
+    : mInitialized(false),
+      mEnabled(true),
+      mFenceTracker(0),
+      mTiming(0),
+      mVsyncManager(0),
+      mPolicies(0),
+      mFrames(0),
+      mLastMissed(0),
+      mCleanWindows(0),
+      mJankyWindows(0),
+      mFallbacks(0),
+      mLastWindowMissed(0),
+      mLastPrepare(0),
+      mLastCommit(0)
+{
+    CTRACE();
+}
+
+JankDetector::~JankDetector()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool JankDetector::initialize(FenceTracker *fenceTracker, FrameTiming *timing,
+                              VsyncManager *vsyncManager)
+{
+    CTRACE();
+
+    if (!fenceTracker || !timing || !vsyncManager) {
+        ETRACE("invalid parameters");
+        return false;
+    }
+
+    char prop[PROPERTY_VALUE_MAX];
+    mEnabled = true;
+    if (property_get("hwc.jank.fallback", prop, "1") > 0) {
+        mEnabled = atoi(prop);
+    }
+
+    mFenceTracker = fenceTracker;
+    mTiming = timing;
+    mVsyncManager = vsyncManager;
+    mPolicies = 0;
+    mFrames = 0;
+    mLastMissed = fenceTracker->getMissedVblanks();
+    mCleanWindows = 0;
+    mJankyWindows = 0;
+    mFallbacks = 0;
+    mInitialized = true;
+    return true;
+}
+
+void JankDetector::deinitialize()
+{
+    mPolicies = 0;
+    mFenceTracker = 0;
+    mTiming = 0;
+    mVsyncManager = 0;
+    mInitialized = false;
+}
+
+void JankDetector::onFrame()
+{
+    if (!mInitialized || !mEnabled) {
+        return;
+    }
+
+    if (++mFrames < WINDOW_FRAMES) {
+        return;
+    }
+    mFrames = 0;
+    evaluate();
+}
+
+void JankDetector::evaluate()
+{
+    uint32_t missed = mFenceTracker->getMissedVblanks();
+    uint32_t windowMissed = missed - mLastMissed;
+    mLastMissed = missed;
+
+    nsecs_t period = DEFAULT_PERIOD;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t vblank = mVsyncManager->getNextVsyncTime(now);
+    if (vblank) {
+        nsecs_t next = mVsyncManager->getNextVsyncTime(vblank + 1);
+        if (next > vblank) {
+            period = next - vblank;
+        }
+    }
+
+    // the post is timed separately from the wait of deadline commits
+    nsecs_t prepare = mTiming->getPercentile(FrameTiming::DISPLAY_ALL,
+                                             FrameTiming::STAGE_PREPARE,
+                                             TIMING_PERCENTILE);
+    nsecs_t commit = mTiming->getPercentile(FrameTiming::DISPLAY_ALL,
+                                            FrameTiming::STAGE_COMMIT_END,
+                                            TIMING_PERCENTILE);
+    nsecs_t busy = prepare + commit;
+    mLastWindowMissed = windowMissed;
+    mLastPrepare = prepare;
+    mLastCommit = commit;
+
+    // frames missed while the composer is fast are not ours to fix
+    if (windowMissed >= JANK_THRESHOLD && busy > period / 2) {
+        mJankyWindows++;
+        mCleanWindows = 0;
+        uint32_t policies = mPolicies;
+        if (prepare >= commit) {
+            policies |= POLICY_SKIP_SMART_COMPOSITION |
+                        POLICY_FREEZE_ASSIGNMENT_CACHE;
+        } else {
+            policies |= POLICY_AVOID_ROTATION;
+        }
+        setPolicies(policies);
+        return;
+    }
+
+    if (!mPolicies) {
+        return;
+    }
+
+    if (windowMissed < JANK_THRESHOLD / 2 && busy < period / 4) {
+        if (++mCleanWindows >= RECOVERY_WINDOWS) {
+            mCleanWindows = 0;
+            setPolicies(0);
+        }
+    } else {
+        mCleanWindows = 0;
+    }
+}
+
+void JankDetector::setPolicies(uint32_t policies)
+{
+    if (policies == mPolicies) {
+        return;
+    }
+
+    if (policies & ~mPolicies) {
+        mFallbacks++;
+    }
+    ITRACE("composition policies %#x -> %#x, missed %u, prepare %lld us, commit %lld us",
+           mPolicies, policies, mLastWindowMissed,
+           mLastPrepare / 1000, mLastCommit / 1000);
+    mPolicies = policies;
+    atrace_int(ATRACE_TAG, "hwc_jank_policies", policies);
+}
+
+void JankDetector::dump(Dump& d)
+{
+    if (!mInitialized) {
+        return;
+    }
+
+    d.append("Jank detector: enabled %d, policies %#x, janky windows %u, "
+             "fallbacks %u\n",
+             mEnabled, mPolicies, mJankyWindows, mFallbacks);
+    d.append("  last window: missed %u, prepare %lld us, commit %lld us\n",
+             mLastWindowMissed, mLastPrepare / 1000, mLastCommit / 1000);
+}
+
+} // namespace intel
+} // namespace android
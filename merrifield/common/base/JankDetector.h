@@ -0,0 +1,99 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef JANK_DETECTOR_H
+#define JANK_DETECTOR_H
+
+#include <Dump.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+class FenceTracker;
+class FrameTiming;
+class VsyncManager;
+
+// Looks at the missed vblanks and the prepare/commit durations once every
+// window of frames. When frames are missed while the composer itself is
+// slow, cheaper composition policies are switched on for the stage that
+// takes longest, and off again after a few clean windows.
+class JankDetector {
+public:
+    enum {
+        // no smart composition 2 entry search
+        POLICY_SKIP_SMART_COMPOSITION = 1 << 0,
+        // plane assignments are looked up but no longer recorded
+        POLICY_FREEZE_ASSIGNMENT_CACHE = 1 << 1,
+        // rotated layers are composed by GLES instead of the overlay
+        POLICY_AVOID_ROTATION = 1 << 2,
+    };
+
+public:
+    JankDetector();
+    ~JankDetector();
+
+public:
+    bool initialize(FenceTracker *fenceTracker, FrameTiming *timing,
+                    VsyncManager *vsyncManager);
+    void deinitialize();
+    // called once per commit
+    void onFrame();
+    bool isPolicyActive(uint32_t policy) const {
+        return (mPolicies & policy) != 0;
+    }
+    uint32_t getPolicies() const { return mPolicies; }
+    uint32_t getJankyWindows() const { return mJankyWindows; }
+    uint32_t getFallbacks() const { return mFallbacks; }
+    void dump(Dump& d);
+
+private:
+    enum {
+        WINDOW_FRAMES = 60,
+        // missed vblanks in a window that count as janky
+        JANK_THRESHOLD = 4,
+        // clean windows before the policies are dropped
+        RECOVERY_WINDOWS = 3,
+        TIMING_PERCENTILE = 90,
+    };
+    // used while the vsync period is not known
+    static const nsecs_t DEFAULT_PERIOD = 16666667;
+
+    void evaluate();
+    void setPolicies(uint32_t policies);
+
+private:
+    bool mInitialized;
+    bool mEnabled;
+    FenceTracker *mFenceTracker;
+    FrameTiming *mTiming;
+    VsyncManager *mVsyncManager;
+    volatile uint32_t mPolicies;
+    uint32_t mFrames;
+    uint32_t mLastMissed;
+    uint32_t mCleanWindows;
+
+    // statistics
+    uint32_t mJankyWindows;
+    uint32_t mFallbacks;
+    uint32_t mLastWindowMissed;
+    nsecs_t mLastPrepare;
+    nsecs_t mLastCommit;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* JANK_DETECTOR_H */
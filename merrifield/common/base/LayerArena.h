@@ -0,0 +1,109 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef LAYER_ARENA_H
+#define LAYER_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <MemoryAccounting.h>
+
+namespace android {
+namespace intel {
+
+// Bump allocator for the objects of one layer list. Memory is handed out
+// in order and given back all at once by reset(); only the most recent
+// allocation can be returned early, which covers the add/remove pattern
+// of the plane assignment search. Requests that don't fit go to the heap.
+class LayerArena {
+public:
+    LayerArena()
+        : mBase(NULL),
+          mSize(0),
+          mUsed(0),
+          mLast(0) {
+    }
+    ~LayerArena() {
+        MemoryAccounting::remove(MemoryAccounting::LAYER_LIST, mSize);
+        ::operator delete(mBase);
+    }
+
+public:
+    // only grows while nothing is allocated from the arena
+    void reserve(size_t size) {
+        size = align(size);
+        if (size <= mSize || mUsed) {
+            return;
+        }
+        MemoryAccounting::remove(MemoryAccounting::LAYER_LIST, mSize);
+        ::operator delete(mBase);
+        mBase = static_cast<uint8_t*>(::operator new(size));
+        mSize = size;
+        MemoryAccounting::add(MemoryAccounting::LAYER_LIST, mSize);
+    }
+
+    void* alloc(size_t size) {
+        size = align(size);
+        if (mBase && mUsed + size <= mSize) {
+            void *ptr = mBase + mUsed;
+            mLast = mUsed;
+            mUsed += size;
+            return ptr;
+        }
+        return ::operator new(size);
+    }
+
+    void release(void *ptr) {
+        uint8_t *p = static_cast<uint8_t*>(ptr);
+        if (!p) {
+            return;
+        }
+        if (p < mBase || p >= mBase + mSize) {
+            ::operator delete(ptr);
+        } else if (p == mBase + mLast && mLast < mUsed) {
+            mUsed = mLast;
+        }
+    }
+
+    template <typename T>
+    void destroy(T *obj) {
+        if (obj) {
+            obj->~T();
+            release(obj);
+        }
+    }
+
+    void reset() {
+        mUsed = 0;
+        mLast = 0;
+    }
+
+private:
+    static size_t align(size_t size) {
+        return (size + 15) & ~(size_t)15;
+    }
+
+private:
+    uint8_t *mBase;
+    size_t mSize;
+    size_t mUsed;
+    size_t mLast;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* LAYER_ARENA_H */
@@ -0,0 +1,309 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <BufferManager.h>
+#include <LayerTrace.h>
+
+namespace android {
+namespace intel {
+
+LayerTrace::LayerTrace()
+    : mInitialized(false),
+      mBufferManager(NULL),
+      mFile(NULL),
+      mLastPoll(0),
+      mBuffers(),
+      mNextBufferId(1),
+      mRecord(),
+      mFrame(0),
+      mTraces(0),
+      mFrames(0),
+      mBytes(0)
+{
+    mPath[0] = '\0';
+}
+
+LayerTrace::~LayerTrace()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool LayerTrace::initialize(BufferManager *bm)
+{
+    if (!bm) {
+        ETRACE("invalid buffer manager");
+        return false;
+    }
+
+    mBufferManager = bm;
+    mInitialized = true;
+    return true;
+}
+
+void LayerTrace::deinitialize()
+{
+    close();
+    mBufferManager = NULL;
+    mInitialized = false;
+}
+
+void LayerTrace::poll()
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (mLastPoll && now - mLastPoll < POLL_INTERVAL) {
+        return;
+    }
+    mLastPoll = now;
+
+    char path[PROPERTY_VALUE_MAX];
+    property_get("debug.hwc.capture", path, "");
+    if (!strcmp(path, mPath)) {
+        return;
+    }
+
+    // a path that failed or reached the size limit is not opened again
+    // until the property changes
+    close();
+    strncpy(mPath, path, sizeof(mPath) - 1);
+    mPath[sizeof(mPath) - 1] = '\0';
+    if (mPath[0]) {
+        open(mPath);
+    }
+}
+
+bool LayerTrace::open(const char *path)
+{
+    mFile = fopen(path, "wb");
+    if (!mFile) {
+        ETRACE("failed to open layer trace %s", path);
+        return false;
+    }
+
+    TraceFileHeader header;
+    header.magic = LAYER_TRACE_MAGIC;
+    header.version = LAYER_TRACE_VERSION;
+    if (fwrite(&header, sizeof(header), 1, mFile) != 1) {
+        ETRACE("failed to write layer trace %s", path);
+        fclose(mFile);
+        mFile = NULL;
+        return false;
+    }
+
+    ITRACE("capturing layers to %s", path);
+    mBuffers.clear();
+    mNextBufferId = 1;
+    mBytes = sizeof(header);
+    mTraces++;
+    return true;
+}
+
+void LayerTrace::close()
+{
+    if (mFile) {
+        ITRACE("layer trace %s closed, %llu bytes", mPath, mBytes);
+        fclose(mFile);
+        mFile = NULL;
+    }
+    mBuffers.clear();
+}
+
+void LayerTrace::append(const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    mRecord.appendArray(bytes, size);
+}
+
+void LayerTrace::beginRecord(uint32_t type)
+{
+    TraceRecordHeader header;
+    header.type = type;
+    header.size = 0;
+    mRecord.clear();
+    append(&header, sizeof(header));
+}
+
+void LayerTrace::endRecord()
+{
+    if (!mFile) {
+        return;
+    }
+
+    TraceRecordHeader *header = (TraceRecordHeader *)mRecord.editArray();
+    header->size = mRecord.size() - sizeof(TraceRecordHeader);
+    if (fwrite(mRecord.array(), mRecord.size(), 1, mFile) != 1) {
+        ETRACE("failed to write layer trace, capture stopped");
+        close();
+        return;
+    }
+
+    mBytes += mRecord.size();
+    if (mBytes >= MAX_TRACE_BYTES) {
+        WTRACE("layer trace reached %d bytes, capture stopped", MAX_TRACE_BYTES);
+        close();
+    }
+}
+
+uint32_t LayerTrace::getBufferId(buffer_handle_t handle)
+{
+    if (!handle) {
+        return 0;
+    }
+
+    BufferAttributes attributes;
+    if (!mBufferManager->getBufferAttributes(handle, attributes)) {
+        return 0;
+    }
+
+    ssize_t index = mBuffers.indexOfKey(handle);
+    if (index >= 0 && mBuffers.valueAt(index).stamp == attributes.stamp) {
+        return mBuffers.valueAt(index).id;
+    }
+
+    if (index < 0 && mBuffers.size() >= MAX_TRACKED_BUFFERS) {
+        // buffers seen again are written again with a new id
+        mBuffers.clear();
+    }
+
+    BufferEntry entry;
+    entry.stamp = attributes.stamp;
+    entry.id = mNextBufferId++;
+    mBuffers.replaceValueFor(handle, entry);
+
+    // written ahead of the frame record being built
+    TraceRecordHeader header;
+    header.type = TRACE_RECORD_BUFFER;
+    header.size = sizeof(TraceBuffer);
+    TraceBuffer buffer;
+    buffer.id = entry.id;
+    buffer.format = attributes.format;
+    buffer.width = attributes.width;
+    buffer.height = attributes.height;
+    buffer.usage = attributes.usage;
+    buffer.isProtected = attributes.isProtected;
+    buffer.isCompressed = attributes.isCompressed;
+    if (fwrite(&header, sizeof(header), 1, mFile) != 1 ||
+        fwrite(&buffer, sizeof(buffer), 1, mFile) != 1) {
+        ETRACE("failed to write buffer record");
+    }
+    mBytes += sizeof(header) + sizeof(buffer);
+    return entry.id;
+}
+
+void LayerTrace::beginPrepare(size_t numDisplays, hwc_display_contents_1_t **displays)
+{
+    if (!mInitialized) {
+        return;
+    }
+
+    poll();
+    mFrame++;
+    if (!mFile) {
+        return;
+    }
+
+    beginRecord(TRACE_RECORD_FRAME);
+    TraceFrame header;
+    header.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    header.frame = mFrame;
+    header.numDisplays = numDisplays;
+    append(&header, sizeof(header));
+
+    for (size_t i = 0; i < numDisplays; i++) {
+        hwc_display_contents_1_t *display = displays[i];
+        TraceDisplay traceDisplay;
+        traceDisplay.present = display ? 1 : 0;
+        traceDisplay.flags = display ? display->flags : 0;
+        traceDisplay.numLayers = display ? display->numHwLayers : 0;
+        append(&traceDisplay, sizeof(traceDisplay));
+
+        for (size_t j = 0; j < traceDisplay.numLayers; j++) {
+            hwc_layer_1_t& layer = display->hwLayers[j];
+            TraceLayer traceLayer;
+            traceLayer.compositionType = layer.compositionType;
+            traceLayer.hints = layer.hints;
+            traceLayer.flags = layer.flags;
+            traceLayer.bufferId = getBufferId(layer.handle);
+            traceLayer.transform = layer.transform;
+            traceLayer.blending = layer.blending;
+            traceLayer.sourceCrop[0] = layer.sourceCropf.left;
+            traceLayer.sourceCrop[1] = layer.sourceCropf.top;
+            traceLayer.sourceCrop[2] = layer.sourceCropf.right;
+            traceLayer.sourceCrop[3] = layer.sourceCropf.bottom;
+            traceLayer.displayFrame[0] = layer.displayFrame.left;
+            traceLayer.displayFrame[1] = layer.displayFrame.top;
+            traceLayer.displayFrame[2] = layer.displayFrame.right;
+            traceLayer.displayFrame[3] = layer.displayFrame.bottom;
+            traceLayer.planeAlpha = layer.planeAlpha;
+            traceLayer.visibleRects = layer.visibleRegionScreen.numRects;
+            traceLayer.hasAcquireFence = layer.acquireFenceFd >= 0;
+            append(&traceLayer, sizeof(traceLayer));
+        }
+    }
+    endRecord();
+}
+
+void LayerTrace::endPrepare(size_t numDisplays, hwc_display_contents_1_t **displays,
+                            nsecs_t start)
+{
+    if (!mFile) {
+        return;
+    }
+
+    beginRecord(TRACE_RECORD_RESULT);
+    TraceResult result;
+    result.prepareTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    result.frame = mFrame;
+    result.numDisplays = numDisplays;
+    append(&result, sizeof(result));
+
+    for (size_t i = 0; i < numDisplays; i++) {
+        hwc_display_contents_1_t *display = displays[i];
+        uint32_t numLayers = display ? display->numHwLayers : 0;
+        append(&numLayers, sizeof(numLayers));
+        for (size_t j = 0; j < numLayers; j++) {
+            uint32_t type = display->hwLayers[j].compositionType;
+            append(&type, sizeof(type));
+        }
+    }
+    endRecord();
+}
+
+void LayerTrace::endCommit(size_t numDisplays, nsecs_t start)
+{
+    if (!mFile) {
+        return;
+    }
+
+    beginRecord(TRACE_RECORD_COMMIT);
+    TraceCommit commit;
+    commit.commitTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    commit.frame = mFrame;
+    commit.numDisplays = numDisplays;
+    append(&commit, sizeof(commit));
+    endRecord();
+    mFrames++;
+}
+
+void LayerTrace::dump(Dump& d)
+{
+    d.append("Layer trace: %s%s, traces %u, frames %u, bytes %llu\n",
+             mFile ? "capturing to " : "off",
+             mFile ? mPath : "", mTraces, mFrames, mBytes);
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,145 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef LAYER_TRACE_H
+#define LAYER_TRACE_H
+
+#include <stdio.h>
+#include <Dump.h>
+#include <hardware/hwcomposer.h>
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <cutils/properties.h>
+#include <LayerTraceFormat.h>
+
+namespace android {
+namespace intel {
+
+class BufferManager;
+
+// Capture of the display contents passed to prepare and set, for offline
+// replay with test/hwc_replay. With debug.hwc.capture set to a path every
+// frame is appended there: the layer attributes and buffer metadata given
+// to prepare, the composition chosen by prepare and the times taken by
+// prepare and commit. The property is polled, clearing it ends the trace.
+class LayerTrace {
+public:
+    LayerTrace();
+    ~LayerTrace();
+
+public:
+    bool initialize(BufferManager *bm);
+    void deinitialize();
+
+    void beginPrepare(size_t numDisplays, hwc_display_contents_1_t **displays);
+    void endPrepare(size_t numDisplays, hwc_display_contents_1_t **displays,
+                    nsecs_t start);
+    void endCommit(size_t numDisplays, nsecs_t start);
+    bool isCapturing() const { return mFile != NULL; }
+    void dump(Dump& d);
+
+    // prepare and commit are captured from scope to scope
+    class PrepareScope {
+    public:
+        PrepareScope(LayerTrace *trace, size_t numDisplays,
+                     hwc_display_contents_1_t **displays)
+            : mTrace(trace), mNumDisplays(numDisplays), mDisplays(displays),
+              mStart(0) {
+            if (mTrace) {
+                mTrace->beginPrepare(numDisplays, displays);
+                if (mTrace->isCapturing()) {
+                    mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+                }
+            }
+        }
+        ~PrepareScope() {
+            if (mStart) {
+                mTrace->endPrepare(mNumDisplays, mDisplays, mStart);
+            }
+        }
+    private:
+        LayerTrace *mTrace;
+        size_t mNumDisplays;
+        hwc_display_contents_1_t **mDisplays;
+        nsecs_t mStart;
+    };
+
+    class CommitScope {
+    public:
+        CommitScope(LayerTrace *trace, size_t numDisplays)
+            : mTrace(trace), mNumDisplays(numDisplays), mStart(0) {
+            if (mTrace && mTrace->isCapturing()) {
+                mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+            }
+        }
+        ~CommitScope() {
+            if (mStart) {
+                mTrace->endCommit(mNumDisplays, mStart);
+            }
+        }
+    private:
+        LayerTrace *mTrace;
+        size_t mNumDisplays;
+        nsecs_t mStart;
+    };
+
+private:
+    // how often the capture property is read
+    static const nsecs_t POLL_INTERVAL = 1000000000LL;
+
+    enum {
+        // a trace is closed once it reaches this size
+        MAX_TRACE_BYTES = 64 * 1024 * 1024,
+        // buffers remembered by handle, older ones are written again
+        MAX_TRACKED_BUFFERS = 256,
+    };
+
+    struct BufferEntry {
+        uint64_t stamp;
+        uint32_t id;
+    };
+
+    void poll();
+    bool open(const char *path);
+    void close();
+    uint32_t getBufferId(buffer_handle_t handle);
+    void append(const void *data, size_t size);
+    void beginRecord(uint32_t type);
+    void endRecord();
+
+private:
+    bool mInitialized;
+    BufferManager *mBufferManager;
+    FILE *mFile;
+    char mPath[PROPERTY_VALUE_MAX];
+    nsecs_t mLastPoll;
+    KeyedVector<buffer_handle_t, BufferEntry> mBuffers;
+    uint32_t mNextBufferId;
+    // the record being built, written in one go once complete
+    Vector<uint8_t> mRecord;
+    // frame number of the last prepare, matched by its commit
+    uint32_t mFrame;
+
+    // statistics
+    uint32_t mTraces;
+    uint32_t mFrames;
+    uint64_t mBytes;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* LAYER_TRACE_H */
@@ -0,0 +1,136 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef LAYER_VECTOR_H
+#define LAYER_VECTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+namespace android {
+namespace intel {
+
+// Sorted list of layer pointers for the plane assignment search. The sort
+// key is taken from KEY when an entry is added and kept next to it, so
+// there is no compare callback; entries are inserted in place. The first
+// INLINE_CAPACITY entries live in the object itself, only longer stacks
+// go to the heap.
+template <typename T, typename KEY>
+class LayerVector {
+public:
+    enum {
+        INLINE_CAPACITY = 16,
+    };
+
+public:
+    LayerVector()
+        : mEntries(mInline),
+          mCapacity(INLINE_CAPACITY),
+          mSize(0) {
+    }
+    ~LayerVector() {
+        if (mEntries != mInline) {
+            delete [] mEntries;
+        }
+    }
+
+public:
+    size_t size() const { return mSize; }
+    bool isEmpty() const { return mSize == 0; }
+    const T& itemAt(size_t index) const { return mEntries[index].item; }
+    const T& operator[](size_t index) const { return mEntries[index].item; }
+
+    void setCapacity(size_t capacity) {
+        if (capacity <= mCapacity) {
+            return;
+        }
+        Entry *entries = new Entry[capacity];
+        memcpy(entries, mEntries, mSize * sizeof(Entry));
+        if (mEntries != mInline) {
+            delete [] mEntries;
+        }
+        mEntries = entries;
+        mCapacity = capacity;
+    }
+
+    // entries with equal keys keep the order they were added in
+    ssize_t add(const T& item) {
+        if (mSize == mCapacity) {
+            setCapacity(mCapacity * 2);
+        }
+        uint32_t key = KEY::key(item);
+        size_t i = mSize;
+        while (i > 0 && mEntries[i - 1].key > key) {
+            mEntries[i] = mEntries[i - 1];
+            i--;
+        }
+        mEntries[i].key = key;
+        mEntries[i].item = item;
+        mSize++;
+        return i;
+    }
+
+    ssize_t indexOf(const T& item) const {
+        for (size_t i = 0; i < mSize; i++) {
+            if (mEntries[i].item == item) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void removeAt(size_t index) {
+        if (index >= mSize) {
+            return;
+        }
+        mSize--;
+        memmove(&mEntries[index], &mEntries[index + 1],
+                (mSize - index) * sizeof(Entry));
+    }
+
+    ssize_t remove(const T& item) {
+        ssize_t index = indexOf(item);
+        if (index >= 0) {
+            removeAt(index);
+        }
+        return index;
+    }
+
+    // keeps the storage
+    void clear() { mSize = 0; }
+
+private:
+    // not copyable
+    LayerVector(const LayerVector&);
+    LayerVector& operator=(const LayerVector&);
+
+private:
+    struct Entry {
+        uint32_t key;
+        T item;
+    };
+
+    Entry mInline[INLINE_CAPACITY];
+    Entry *mEntries;
+    size_t mCapacity;
+    size_t mSize;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* LAYER_VECTOR_H */
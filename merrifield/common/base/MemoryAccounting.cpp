@@ -0,0 +1,156 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <cutils/atomic.h>
+#include <HwcTrace.h>
+#include <MemoryAccounting.h>
+
+namespace android {
+namespace intel {
+
+MemoryAccounting::Counter MemoryAccounting::sCounters[CATEGORY_COUNT];
+MemoryAccounting::Counter MemoryAccounting::sTotal;
+volatile int32_t MemoryAccounting::sReclaimedKB[CATEGORY_COUNT];
+
+static const char* sCategoryNames[MemoryAccounting::CATEGORY_COUNT] = {
+    "GTT mappings",
+    "overlay back buffers",
+    "rotation buffers",
+    "VSP surfaces",
+    "virtual buffers",
+    "frame buffers",
+    "layer lists",
+};
+
+static const char* sCategoryKeys[MemoryAccounting::CATEGORY_COUNT] = {
+    "gtt",
+    "overlay",
+    "rotation",
+    "vsp",
+    "virtual",
+    "fb",
+    "layer_list",
+};
+
+void MemoryAccounting::updatePeak(Counter& counter, int32_t value)
+{
+    int32_t peak;
+    do {
+        peak = android_atomic_acquire_load(&counter.peak);
+        if (value <= peak) {
+            return;
+        }
+    } while (android_atomic_cmpxchg(peak, value, &counter.peak));
+}
+
+void MemoryAccounting::add(Category category, size_t bytes)
+{
+    if (category >= CATEGORY_COUNT || !bytes) {
+        return;
+    }
+
+    Counter& counter = sCounters[category];
+    updatePeak(counter, android_atomic_add((int32_t)bytes, &counter.current) + (int32_t)bytes);
+    android_atomic_inc(&counter.allocations);
+    updatePeak(sTotal, android_atomic_add((int32_t)bytes, &sTotal.current) + (int32_t)bytes);
+    android_atomic_inc(&sTotal.allocations);
+}
+
+void MemoryAccounting::remove(Category category, size_t bytes)
+{
+    if (category >= CATEGORY_COUNT || !bytes) {
+        return;
+    }
+
+    Counter& counter = sCounters[category];
+    if (android_atomic_add(-(int32_t)bytes, &counter.current) < (int32_t)bytes) {
+        WTRACE("%s released more than allocated", sCategoryNames[category]);
+    }
+    android_atomic_dec(&counter.allocations);
+    android_atomic_add(-(int32_t)bytes, &sTotal.current);
+    android_atomic_dec(&sTotal.allocations);
+}
+
+void MemoryAccounting::reclaim(Category category, size_t bytes)
+{
+    if (category >= CATEGORY_COUNT || !bytes) {
+        return;
+    }
+
+    // KB, a byte count since boot would overflow
+    android_atomic_add((int32_t)((bytes + 1023) >> 10),
+                       &sReclaimedKB[category]);
+}
+
+size_t MemoryAccounting::getReclaimedKB(Category category)
+{
+    if (category >= CATEGORY_COUNT) {
+        return 0;
+    }
+    return android_atomic_acquire_load(&sReclaimedKB[category]);
+}
+
+size_t MemoryAccounting::getCurrent(Category category)
+{
+    if (category >= CATEGORY_COUNT) {
+        return 0;
+    }
+    return android_atomic_acquire_load(&sCounters[category].current);
+}
+
+size_t MemoryAccounting::getPeak(Category category)
+{
+    if (category >= CATEGORY_COUNT) {
+        return 0;
+    }
+    return android_atomic_acquire_load(&sCounters[category].peak);
+}
+
+void MemoryAccounting::dump(Dump& d)
+{
+    if (d.isKeyValue()) {
+        d.section("memory");
+        d.value("total_bytes", "%d", sTotal.current);
+        d.value("total_peak_bytes", "%d", sTotal.peak);
+        d.value("total_allocations", "%d", sTotal.allocations);
+        for (int i = 0; i < CATEGORY_COUNT; i++) {
+            char key[Dump::SECTION_MAX_LENGTH];
+            snprintf(key, sizeof(key), "%s_bytes", sCategoryKeys[i]);
+            d.value(key, "%d", sCounters[i].current);
+            snprintf(key, sizeof(key), "%s_peak_bytes", sCategoryKeys[i]);
+            d.value(key, "%d", sCounters[i].peak);
+            snprintf(key, sizeof(key), "%s_reclaimed_kb", sCategoryKeys[i]);
+            d.value(key, "%d", sReclaimedKB[i]);
+        }
+        return;
+    }
+
+    d.append("Memory accounting: %d KB in %d allocations, peak %d KB\n",
+             sTotal.current >> 10, sTotal.allocations, sTotal.peak >> 10);
+    for (int i = 0; i < CATEGORY_COUNT; i++) {
+        const Counter& counter = sCounters[i];
+        d.append("  %-20s: %8d KB, peak %8d KB, %d allocations",
+                 sCategoryNames[i], counter.current >> 10,
+                 counter.peak >> 10, counter.allocations);
+        if (sReclaimedKB[i]) {
+            d.append(", reclaimed %d KB", sReclaimedKB[i]);
+        }
+        d.append("\n");
+    }
+}
+
+} // namespace intel
+} // namespace android
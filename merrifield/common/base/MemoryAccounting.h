@@ -0,0 +1,77 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <Dump.h>
+
+namespace android {
+namespace intel {
+
+// Current and peak bytes held by the HWC, by category. Each subsystem
+// reports its own allocations and frees with the same size; the counters
+// are atomic so they can be updated from any thread. Memory freed because
+// its user went idle is also reported as reclaimed, in KB since boot, to
+// show what the lazy allocation paths save.
+class MemoryAccounting {
+public:
+    enum Category {
+        // gralloc buffers mapped into the GTT by the buffer manager
+        GTT_MAPPING = 0,
+        // TTM back buffers of the overlay planes, slabs included
+        OVERLAY_BACK_BUFFER,
+        // rotated video buffers of the rotation buffer providers
+        ROTATION_BUFFER,
+        // VSP surfaces of the virtual display and the scanout capture
+        VSP_SURFACE,
+        // gralloc buffers of the virtual display buffer lists
+        VIRTUAL_BUFFER,
+        // frame buffers, pooled ones included
+        FRAME_BUFFER,
+        // arenas of the layer lists
+        LAYER_LIST,
+        CATEGORY_COUNT,
+    };
+
+public:
+    static void add(Category category, size_t bytes);
+    static void remove(Category category, size_t bytes);
+    // bytes freed after the idle time, on top of their remove()
+    static void reclaim(Category category, size_t bytes);
+    static size_t getReclaimedKB(Category category);
+    static size_t getCurrent(Category category);
+    static size_t getPeak(Category category);
+    static void dump(Dump& d);
+
+private:
+    struct Counter {
+        volatile int32_t current;
+        volatile int32_t peak;
+        volatile int32_t allocations;
+    };
+
+    static void updatePeak(Counter& counter, int32_t value);
+    static Counter sCounters[CATEGORY_COUNT];
+    static Counter sTotal;
+    static volatile int32_t sReclaimedKB[CATEGORY_COUNT];
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* MEMORY_ACCOUNTING_H */
@@ -0,0 +1,108 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include <stdint.h>
+#include <cutils/atomic.h>
+
+namespace android {
+namespace intel {
+
+// Fixed-capacity multi-producer/single-consumer ring. Any thread may
+// push(), producers claim a slot with a compare-and-swap on the tail and
+// publish it through the slot's sequence number; only one thread pops.
+// Neither side takes a lock or sleeps, the consumer polls. SIZE must be a
+// power of two.
+template <typename T, uint32_t SIZE>
+class MpscRing {
+public:
+    MpscRing()
+        : mHead(0),
+          mTail(0) {
+        clear();
+    }
+
+public:
+    // not thread safe, only while nobody pushes
+    void clear() {
+        for (uint32_t i = 0; i < SIZE; i++) {
+            mSlots[i].sequence = (int32_t)i;
+        }
+        mHead = 0;
+        mTail = 0;
+    }
+
+    // any thread, returns false if the ring is full
+    bool push(const T& item) {
+        Slot *slot;
+        int32_t pos = android_atomic_acquire_load(&mTail);
+        for (;;) {
+            slot = &mSlots[pos & (SIZE - 1)];
+            int32_t sequence = android_atomic_acquire_load(&slot->sequence);
+            int32_t diff = sequence - pos;
+            if (diff == 0) {
+                // android_atomic_cmpxchg returns 0 when it swapped
+                if (!android_atomic_cmpxchg(pos, pos + 1, &mTail))
+                    break;
+                pos = android_atomic_acquire_load(&mTail);
+            } else if (diff < 0) {
+                // the consumer hasn't freed the slot of the last lap
+                return false;
+            } else {
+                pos = android_atomic_acquire_load(&mTail);
+            }
+        }
+
+        slot->item = item;
+        android_atomic_release_store(pos + 1, &slot->sequence);
+        return true;
+    }
+
+    // consumer side
+    bool tryPop(T& item) {
+        Slot *slot = &mSlots[mHead & (SIZE - 1)];
+        int32_t sequence = android_atomic_acquire_load(&slot->sequence);
+        if (sequence - (mHead + 1) < 0)
+            return false;
+
+        item = slot->item;
+        slot->item = T();
+        android_atomic_release_store(mHead + (int32_t)SIZE, &slot->sequence);
+        mHead++;
+        return true;
+    }
+
+private:
+    // not copyable
+    MpscRing(const MpscRing&);
+    MpscRing& operator=(const MpscRing&);
+
+    struct Slot {
+        // pos when free for the producer of pos, pos + 1 once filled
+        volatile int32_t sequence;
+        T item;
+    };
+
+    Slot mSlots[SIZE];
+    int32_t mHead;             // consumer only
+    volatile int32_t mTail;    // claimed by the producers
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* MPSC_RING_H */
@@ -0,0 +1,86 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <cutils/atomic.h>
+
+namespace android {
+namespace intel {
+
+// Fixed set of preallocated slots for objects of type T. Slots are
+// claimed and returned with a single atomic operation so that objects
+// may be created on one thread and destroyed on another. When every slot
+// is busy the pool falls back to the heap.
+template <typename T, int COUNT>
+class ObjectPool {
+public:
+    ObjectPool() {
+        for (int i = 0; i < COUNT; i++)
+            mBusy[i] = 0;
+    }
+
+public:
+    void* alloc(size_t size) {
+        if (size <= sizeof(Slot)) {
+            for (int i = 0; i < COUNT; i++) {
+                if (mBusy[i])
+                    continue;
+                if (android_atomic_acquire_cas(0, 1, &mBusy[i]) == 0)
+                    return &mSlots[i];
+            }
+        }
+        // pool exhausted, this is not expected on the hot path
+        return ::operator new(size);
+    }
+
+    void free(void *ptr) {
+        Slot *slot = static_cast<Slot*>(ptr);
+        if (slot >= mSlots && slot < mSlots + COUNT) {
+            android_atomic_release_store(0, &mBusy[slot - mSlots]);
+            return;
+        }
+        ::operator delete(ptr);
+    }
+
+private:
+    union Slot {
+        char data[sizeof(T)];
+        long double alignDouble;
+        void *alignPointer;
+    };
+
+    Slot mSlots[COUNT];
+    volatile int32_t mBusy[COUNT];
+};
+
+// Routes new/delete of CLASSNAME through a per-class ObjectPool. Object
+// lifetime, including reference counting through sp<>, is unchanged.
+#define DECLARE_POOLED_OBJECT(CLASSNAME, COUNT) \
+    static ObjectPool<CLASSNAME, COUNT>& objectPool() { \
+        static ObjectPool<CLASSNAME, COUNT> sPool; \
+        return sPool; \
+    } \
+    static void* operator new(size_t size) { return objectPool().alloc(size); } \
+    static void operator delete(void *ptr) { objectPool().free(ptr); }
+
+} // namespace intel
+} // namespace android
+
+#endif /* OBJECT_POOL_H */
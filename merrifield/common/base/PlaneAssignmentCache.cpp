@@ -0,0 +1,147 @@
+/*
+// Copyright (c) 2014 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <PlaneAssignmentCache.h>
+
+namespace android {
+namespace intel {
+
+PlaneAssignmentCache::PlaneAssignmentCache()
+    : mEntries(),
+      mHits(0),
+      mMisses(0)
+{
+    mEntries.setCapacity(CACHE_CAPACITY);
+}
+
+PlaneAssignmentCache::~PlaneAssignmentCache()
+{
+    clear();
+}
+
+uint32_t PlaneAssignmentCache::hash(const Vector<uint32_t>& signature)
+{
+    // FNV-1a over the signature words
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < signature.size(); i++) {
+        uint32_t v = signature.itemAt(i);
+        for (int j = 0; j < 4; j++) {
+            h ^= (v & 0xff);
+            h *= 16777619UL;
+            v >>= 8;
+        }
+    }
+    return h;
+}
+
+int PlaneAssignmentCache::find(uint32_t h, const Vector<uint32_t>& signature)
+{
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        Entry *entry = mEntries.itemAt(i);
+        if (entry->hash != h ||
+            entry->signature.size() != signature.size()) {
+            continue;
+        }
+
+        if (!memcmp(entry->signature.array(), signature.array(),
+                    signature.size() * sizeof(uint32_t))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool PlaneAssignmentCache::lookup(const Vector<uint32_t>& signature,
+                                  Vector<PlaneAssignment>& assignment)
+{
+    int index = find(hash(signature), signature);
+    if (index < 0) {
+        mMisses++;
+        return false;
+    }
+
+    Entry *entry = mEntries.itemAt(index);
+    assignment = entry->assignment;
+
+    // move it to the front
+    if (index != 0) {
+        mEntries.removeAt(index);
+        mEntries.insertAt(entry, 0);
+    }
+
+    mHits++;
+    return true;
+}
+
+void PlaneAssignmentCache::insert(const Vector<uint32_t>& signature,
+                                  const Vector<PlaneAssignment>& assignment)
+{
+    uint32_t h = hash(signature);
+    Entry *entry = NULL;
+    int index = find(h, signature);
+    if (index >= 0) {
+        entry = mEntries.itemAt(index);
+        mEntries.removeAt(index);
+    } else if (mEntries.size() >= CACHE_CAPACITY) {
+        // evict the least recently used entry
+        entry = mEntries.top();
+        mEntries.pop();
+    } else {
+        entry = new Entry;
+    }
+
+    entry->hash = h;
+    entry->signature = signature;
+    entry->assignment = assignment;
+    mEntries.insertAt(entry, 0);
+}
+
+void PlaneAssignmentCache::invalidate(const Vector<uint32_t>& signature)
+{
+    int index = find(hash(signature), signature);
+    if (index < 0) {
+        return;
+    }
+
+    delete mEntries.itemAt(index);
+    mEntries.removeAt(index);
+}
+
+void PlaneAssignmentCache::clear()
+{
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        delete mEntries.itemAt(i);
+    }
+    mEntries.clear();
+}
+
+void PlaneAssignmentCache::dump(Dump& d)
+{
+    if (d.isKeyValue()) {
+        d.section("plane_assignment_cache");
+        d.value("entries", "%d", mEntries.size());
+        d.value("hits", "%u", mHits);
+        d.value("misses", "%u", mMisses);
+        return;
+    }
+
+    d.append("Plane assignment cache: entries %d/%d, hits %u, misses %u\n",
+             mEntries.size(), CACHE_CAPACITY, mHits, mMisses);
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,77 @@
+/*
+// Copyright (c) 2014 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef PLANE_ASSIGNMENT_CACHE_H
+#define PLANE_ASSIGNMENT_CACHE_H
+
+#include <Dump.h>
+#include <utils/Vector.h>
+
+namespace android {
+namespace intel {
+
+// One plane assignment decision, replayed through HwcLayerList::attachPlanes.
+struct PlaneAssignment {
+    int planeType;
+    int layerIndex;
+    int zorder;
+};
+
+// Bounded LRU cache mapping a layer stack signature to the plane assignment
+// that won the search for it. Entries are only hints: a replayed assignment
+// is still validated by the plane manager before it is attached.
+class PlaneAssignmentCache {
+public:
+    PlaneAssignmentCache();
+    ~PlaneAssignmentCache();
+
+public:
+    bool lookup(const Vector<uint32_t>& signature,
+                Vector<PlaneAssignment>& assignment);
+    void insert(const Vector<uint32_t>& signature,
+                const Vector<PlaneAssignment>& assignment);
+    void invalidate(const Vector<uint32_t>& signature);
+    void clear();
+    uint32_t getHits() const { return mHits; }
+    uint32_t getMisses() const { return mMisses; }
+
+    // dump interface
+    void dump(Dump& d);
+
+private:
+    static uint32_t hash(const Vector<uint32_t>& signature);
+    int find(uint32_t hash, const Vector<uint32_t>& signature);
+
+private:
+    struct Entry {
+        uint32_t hash;
+        Vector<uint32_t> signature;
+        Vector<PlaneAssignment> assignment;
+    };
+
+    enum {
+        CACHE_CAPACITY = 16,
+    };
+
+    // most recently used entry is at the front
+    Vector<Entry*> mEntries;
+    uint32_t mHits;
+    uint32_t mMisses;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* PLANE_ASSIGNMENT_CACHE_H */
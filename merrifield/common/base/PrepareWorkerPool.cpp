@@ -0,0 +1,196 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <HwcTrace.h>
+#include <PrepareWorkerPool.h>
+
+namespace android {
+namespace intel {
+
+PrepareWorkerPool::Worker::Worker(int index)
+    : mIndex(index),
+      mLock(),
+      mCondition(),
+      mJob(NULL),
+      mBusy(false),
+      mExitThread(false)
+{
+}
+
+PrepareWorkerPool::Worker::~Worker()
+{
+}
+
+bool PrepareWorkerPool::Worker::initialize()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "HwcPrepare%d", mIndex);
+
+    mExitThread = false;
+    mThread = new PrepareWorkerThread(this);
+    if (!mThread.get()) {
+        ETRACE("failed to create prepare worker thread");
+        return false;
+    }
+    mThread->run(name, PRIORITY_URGENT_DISPLAY);
+    return true;
+}
+
+void PrepareWorkerPool::Worker::deinitialize()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThread = true;
+        mCondition.broadcast();
+    }
+
+    if (mThread.get()) {
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+}
+
+void PrepareWorkerPool::Worker::post(Job *job)
+{
+    Mutex::Autolock _l(mLock);
+    mJob = job;
+    mBusy = true;
+    mCondition.broadcast();
+}
+
+void PrepareWorkerPool::Worker::wait()
+{
+    Mutex::Autolock _l(mLock);
+    while (mBusy) {
+        mCondition.wait(mLock);
+    }
+}
+
+bool PrepareWorkerPool::Worker::threadLoop()
+{
+    Job *job;
+    { // scope for lock
+        Mutex::Autolock _l(mLock);
+        while (!mJob) {
+            if (mExitThread) {
+                ITRACE("exiting thread loop");
+                return false;
+            }
+            mCondition.wait(mLock);
+        }
+        job = mJob;
+        mJob = NULL;
+    }
+
+    job->result = job->device->prepareLayers(job->display);
+
+    Mutex::Autolock _l(mLock);
+    mBusy = false;
+    mCondition.broadcast();
+    return true;
+}
+
+PrepareWorkerPool::PrepareWorkerPool()
+    : mInitialized(false),
+      mWorkers(),
+      mJobs()
+{
+}
+
+PrepareWorkerPool::~PrepareWorkerPool()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool PrepareWorkerPool::initialize(int numWorkers)
+{
+    for (int i = 0; i < numWorkers; i++) {
+        Worker *worker = new Worker(i);
+        if (!worker || !worker->initialize()) {
+            DEINIT_AND_DELETE_OBJ(worker);
+            DEINIT_AND_RETURN_FALSE("failed to create prepare worker %d", i);
+        }
+        mWorkers.push_back(worker);
+    }
+
+    // jobs are posted by pointer, never grow the vector in run()
+    mJobs.setCapacity(numWorkers + 1);
+    mInitialized = true;
+    return true;
+}
+
+void PrepareWorkerPool::deinitialize()
+{
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        Worker *worker = mWorkers.itemAt(i);
+        DEINIT_AND_DELETE_OBJ(worker);
+    }
+    mWorkers.clear();
+    mJobs.clear();
+    mInitialized = false;
+}
+
+void PrepareWorkerPool::clear()
+{
+    mJobs.clear();
+}
+
+void PrepareWorkerPool::add(IDisplayDevice *device,
+                            hwc_display_contents_1_t *display)
+{
+    Job job;
+    job.device = device;
+    job.display = display;
+    job.result = true;
+    mJobs.push_back(job);
+}
+
+bool PrepareWorkerPool::run()
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (mJobs.isEmpty()) {
+        return true;
+    }
+
+    // jobs beyond the worker count run inline, after the first one
+    size_t posted = 0;
+    for (size_t i = 1; i < mJobs.size() && posted < mWorkers.size(); i++) {
+        mWorkers.itemAt(posted++)->post(&mJobs.editItemAt(i));
+    }
+
+    for (size_t i = 0; i < mJobs.size(); i++) {
+        if (i == 0 || i > posted) {
+            Job& job = mJobs.editItemAt(i);
+            job.result = job.device->prepareLayers(job.display);
+        }
+    }
+
+    for (size_t i = 0; i < posted; i++) {
+        mWorkers.itemAt(i)->wait();
+    }
+
+    bool ret = true;
+    for (size_t i = 0; i < mJobs.size(); i++) {
+        if (!mJobs.itemAt(i).result) {
+            ret = false;
+        }
+    }
+    return ret;
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,82 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef PREPARE_WORKER_POOL_H
+#define PREPARE_WORKER_POOL_H
+
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <hardware/hwcomposer.h>
+#include <SimpleThread.h>
+#include <IDisplayDevice.h>
+
+namespace android {
+namespace intel {
+
+// Runs IDisplayDevice::prepareLayers() for several displays at once. The
+// first job runs on the calling thread, every other job on its own
+// persistent worker; run() returns once all of them are done.
+class PrepareWorkerPool {
+public:
+    PrepareWorkerPool();
+    ~PrepareWorkerPool();
+
+public:
+    bool initialize(int numWorkers);
+    void deinitialize();
+
+    void clear();
+    void add(IDisplayDevice *device, hwc_display_contents_1_t *display);
+    // returns false if any of the devices failed
+    bool run();
+
+private:
+    struct Job {
+        IDisplayDevice *device;
+        hwc_display_contents_1_t *display;
+        bool result;
+    };
+
+    class Worker {
+    public:
+        Worker(int index);
+        ~Worker();
+
+    public:
+        bool initialize();
+        void deinitialize();
+        void post(Job *job);
+        void wait();
+
+    private:
+        int mIndex;
+        Mutex mLock;
+        Condition mCondition;
+        Job *mJob;
+        bool mBusy;
+        bool mExitThread;
+        DECLARE_THREAD(PrepareWorkerThread, Worker);
+    };
+
+private:
+    bool mInitialized;
+    Vector<Worker*> mWorkers;
+    Vector<Job> mJobs;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* PREPARE_WORKER_POOL_H */
@@ -0,0 +1,756 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <cutils/atomic.h>
+#include <cutils/native_handle.h>
+#include <hal_public.h>
+#include <va/va_android.h>
+#include <HwcTrace.h>
+#include <DisplayPlaneManager.h>
+#include <MemoryAccounting.h>
+#include <TuningPolicy.h>
+#include <VaDisplayManager.h>
+#include <ScanoutCapture.h>
+
+namespace android {
+namespace intel {
+
+// surface sizes of the VSP, as the virtual display allocates them
+static inline uint32_t align_width(uint32_t val)
+{
+    return align_to(val, 64);
+}
+
+static inline uint32_t align_height(uint32_t val)
+{
+    return align_to(val, 16);
+}
+
+// formats of the primary plane VSP can blend, 0 for the others
+static uint32_t getRgbFourcc(uint32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+        return VA_FOURCC_RGBA;
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+    case HAL_PIXEL_FORMAT_BGRX_8888:
+        return VA_FOURCC_BGRA;
+    default:
+        return 0;
+    }
+}
+
+ScanoutCapture::ScanoutCapture()
+    : mInitialized(false),
+      mPlaneManager(NULL),
+      mGralloc(NULL),
+      mState(STATE_IDLE),
+      mExiting(false),
+      mDisplay(NULL),
+      mConfig(0),
+      mContextCount(0),
+      mComposed(0),
+      mComposedWidth(0),
+      mComposedHeight(0),
+      mSurfaceBytes(0),
+      mLastUse(0),
+      mRequests(0),
+      mRejected(0),
+      mCaptures(0),
+      mFailures(0),
+      mStarts(0),
+      mComposeTime(0),
+      mMaxComposeTime(0)
+{
+    memset(&mRequest, 0, sizeof(mRequest));
+    memset(mContexts, 0, sizeof(mContexts));
+}
+
+ScanoutCapture::~ScanoutCapture()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool ScanoutCapture::initialize(DisplayPlaneManager *planeManager)
+{
+    if (!planeManager) {
+        ETRACE("invalid plane manager");
+        return false;
+    }
+
+    hw_module_t const* module;
+    if (hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module)) {
+        ETRACE("failed to get gralloc module");
+        return false;
+    }
+    mGralloc = (gralloc_module_t const*)module;
+
+    mPlaneManager = planeManager;
+    mExiting = false;
+    mState = STATE_IDLE;
+
+    mThread = new CaptureThread(this);
+    if (!mThread.get()) {
+        DEINIT_AND_RETURN_FALSE("failed to create capture thread");
+    }
+    mThread->run("ScanoutCapture", PRIORITY_BACKGROUND);
+
+    mInitialized = true;
+    return true;
+}
+
+void ScanoutCapture::deinitialize()
+{
+    if (mThread.get()) {
+        {
+            Mutex::Autolock _l(mLock);
+            mExiting = true;
+            mCondition.signal();
+        }
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+    stop();
+
+    // a capture armed or copied and never composed
+    if (mState != STATE_IDLE && mRequest.callback) {
+        mRequest.callback(mRequest.data, mRequest.disp, mRequest.target, false);
+    }
+    releaseScanouts(mRequest);
+    mState = STATE_IDLE;
+    mPlaneManager = NULL;
+    mGralloc = NULL;
+    mInitialized = false;
+}
+
+bool ScanoutCapture::request(int disp, uint32_t displayWidth,
+                             uint32_t displayHeight, buffer_handle_t target,
+                             uint32_t width, uint32_t height,
+                             Callback callback, void *data)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    // NV12 needs even sizes, and VSP only scales down here
+    width &= ~1;
+    height &= ~1;
+    if (!target || !callback || !width || !height ||
+        width > displayWidth || height > displayHeight) {
+        ETRACE("invalid capture of display %d into %ux%u", disp, width, height);
+        return false;
+    }
+
+    Mutex::Autolock _l(mLock);
+    mRequests++;
+    if (mState != STATE_IDLE) {
+        mRejected++;
+        return false;
+    }
+
+    mRequest.disp = disp;
+    mRequest.displayWidth = displayWidth;
+    mRequest.displayHeight = displayHeight;
+    mRequest.target = target;
+    mRequest.width = width;
+    mRequest.height = height;
+    mRequest.callback = callback;
+    mRequest.data = data;
+    mRequest.count = 0;
+    android_atomic_release_store(STATE_ARMED, &mState);
+    return true;
+}
+
+void ScanoutCapture::onCommit(size_t numDisplays)
+{
+    // nothing but this load unless a capture is armed
+    if (android_atomic_acquire_load(&mState) != STATE_ARMED)
+        return;
+
+    Mutex::Autolock _l(mLock);
+    if (mState != STATE_ARMED || mRequest.disp >= (int)numDisplays)
+        return;
+
+    int count = mPlaneManager->getScanout(mRequest.disp, mRequest.scanouts,
+                                          MAX_SCANOUTS);
+    // SurfaceFlinger frees the buffers of this frame as it pleases once
+    // they are released, the capture thread reads its own references
+    mRequest.count = 0;
+    for (int i = 0; i < count; i++) {
+        DisplayPlane::Scanout& scanout = mRequest.scanouts[mRequest.count];
+        scanout = mRequest.scanouts[i];
+        scanout.handle = retainBuffer(scanout.handle);
+        if (scanout.handle) {
+            mRequest.count++;
+        }
+    }
+    android_atomic_release_store(STATE_COMPOSING, &mState);
+    mCondition.signal();
+}
+
+bool ScanoutCapture::threadLoop()
+{
+    Request request;
+    bool idle = false;
+    {
+        Mutex::Autolock _l(mLock);
+        while (mState != STATE_COMPOSING && !mExiting) {
+            nsecs_t idleTime = TuningPolicy::getVideoIdleTime();
+            if (!mDisplay || !idleTime) {
+                mCondition.wait(mLock);
+                continue;
+            }
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (now - mLastUse >= idleTime) {
+                idle = true;
+                break;
+            }
+            mCondition.waitRelative(mLock, mLastUse + idleTime - now);
+        }
+        if (mExiting)
+            return false;
+        if (!idle)
+            request = mRequest;
+    }
+
+    if (idle) {
+        ITRACE("Release the VSP of the scanout capture");
+        MemoryAccounting::reclaim(MemoryAccounting::VSP_SURFACE, mSurfaceBytes);
+        stop();
+        return true;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    bool success = compose(request);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    {
+        Mutex::Autolock _l(mLock);
+        releaseScanouts(mRequest);
+        if (success)
+            mCaptures++;
+        else
+            mFailures++;
+        mComposeTime = now - start;
+        if (mComposeTime > mMaxComposeTime)
+            mMaxComposeTime = mComposeTime;
+        mLastUse = now;
+        android_atomic_release_store(STATE_IDLE, &mState);
+    }
+
+    // the callback may ask for the next capture
+    request.callback(request.data, request.disp, request.target, success);
+    return true;
+}
+
+bool ScanoutCapture::compose(const Request& request)
+{
+    ATRACE("display %d into %ux%u", request.disp, request.width, request.height);
+
+    // the lowest NV12 overlay is the video input, the primary plane the
+    // RGB one; sprites are not blended by this VSP pipeline and rotated
+    // video is scanned out of a rotation buffer the plane doesn't cache
+    const DisplayPlane::Scanout *video = NULL;
+    const DisplayPlane::Scanout *rgb = NULL;
+    for (int i = 0; i < request.count; i++) {
+        const DisplayPlane::Scanout& scanout = request.scanouts[i];
+        if (scanout.type == DisplayPlane::PLANE_OVERLAY &&
+            scanout.format == HAL_PIXEL_FORMAT_NV12 && !scanout.transform) {
+            if (!video || scanout.zorder < video->zorder)
+                video = &scanout;
+        } else if (scanout.type == DisplayPlane::PLANE_PRIMARY &&
+                   getRgbFourcc(scanout.format)) {
+            rgb = &scanout;
+        }
+    }
+
+    // VSP blends the RGB input at the size of the output
+    uint32_t displayWidth = request.displayWidth;
+    uint32_t displayHeight = request.displayHeight;
+    if (rgb && (rgb->position.x || rgb->position.y ||
+                (uint32_t)rgb->position.w != displayWidth ||
+                (uint32_t)rgb->position.h != displayHeight)) {
+        DTRACE("primary plane %dx%d doesn't cover the display, left out",
+               rgb->position.w, rgb->position.h);
+        rgb = NULL;
+    }
+
+    if (!video && !rgb) {
+        WTRACE("nothing on display %d to capture", request.disp);
+        return false;
+    }
+
+    if (!start())
+        return false;
+
+    bool scaled = request.width != displayWidth ||
+                  request.height != displayHeight;
+    Context *context = getContext(align_width(displayWidth),
+                                  align_height(displayHeight));
+    if (!context)
+        return false;
+
+    VASurfaceID target = createSurface(request.target, VA_FOURCC_NV12,
+                                       align_width(request.width),
+                                       align_height(request.height));
+    if (!target)
+        return false;
+
+    VASurfaceID output = target;
+    if (scaled) {
+        output = createComposed(displayWidth, displayHeight);
+    }
+
+    VASurfaceID videoIn = context->blankYuv;
+    VARectangle surfaceRegion;
+    VARectangle outputRegion;
+    surfaceRegion.x = 0;
+    surfaceRegion.y = 0;
+    surfaceRegion.width = displayWidth;
+    surfaceRegion.height = displayHeight;
+    outputRegion = surfaceRegion;
+    if (video) {
+        videoIn = createSurface(video->handle, VA_FOURCC_NV12,
+                                video->stride, align_height(video->height));
+        surfaceRegion.x = video->crop.x;
+        surfaceRegion.y = video->crop.y;
+        surfaceRegion.width = video->crop.w;
+        surfaceRegion.height = video->crop.h;
+        outputRegion.x = video->position.x & ~1;
+        outputRegion.y = video->position.y & ~1;
+        outputRegion.width = video->position.w & ~1;
+        outputRegion.height = video->position.h & ~1;
+    }
+
+    VASurfaceID rgbIn = context->blankRgb;
+    if (rgb) {
+        rgbIn = createSurface(rgb->handle, getRgbFourcc(rgb->format),
+                              rgb->stride, align_height(rgb->height));
+    }
+
+    bool ret = output && videoIn && rgbIn &&
+               render(*context, videoIn, surfaceRegion, outputRegion,
+                      rgbIn, output);
+
+    if (video)
+        destroySurface(videoIn);
+    if (rgb)
+        destroySurface(rgbIn);
+
+    if (ret && scaled) {
+        // second pass, the composed display scaled into the target
+        context = getContext(align_width(request.width),
+                             align_height(request.height));
+        surfaceRegion.x = 0;
+        surfaceRegion.y = 0;
+        surfaceRegion.width = displayWidth;
+        surfaceRegion.height = displayHeight;
+        outputRegion.x = 0;
+        outputRegion.y = 0;
+        outputRegion.width = request.width;
+        outputRegion.height = request.height;
+        ret = context &&
+              render(*context, mComposed, surfaceRegion, outputRegion,
+                     context->blankRgb, target);
+    }
+
+    destroySurface(target);
+    return ret;
+}
+
+bool ScanoutCapture::render(const Context& context, VASurfaceID video,
+                            const VARectangle& surfaceRegion,
+                            const VARectangle& outputRegion,
+                            VASurfaceID rgb, VASurfaceID output)
+{
+    VAStatus status;
+    VABufferID pipelineId;
+    status = vaCreateBuffer(mDisplay, context.context,
+                            VAProcPipelineParameterBufferType,
+                            sizeof(VAProcPipelineParameterBuffer),
+                            1, NULL, &pipelineId);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateBuffer returns %08x", status);
+        return false;
+    }
+
+    VAProcPipelineParameterBuffer *pipeline;
+    status = vaMapBuffer(mDisplay, pipelineId, (void **)&pipeline);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaMapBuffer returns %08x", status);
+        vaDestroyBuffer(mDisplay, pipelineId);
+        return false;
+    }
+
+    VABlendState blendState;
+    memset(&blendState, 0, sizeof(blendState));
+    memset(pipeline, 0, sizeof(VAProcPipelineParameterBuffer));
+    pipeline->surface = video;
+    pipeline->surface_region = &surfaceRegion;
+    pipeline->output_region = &outputRegion;
+    pipeline->blend_state = &blendState;
+    pipeline->num_additional_outputs = 1;
+    pipeline->additional_outputs = &rgb;
+
+    status = vaUnmapBuffer(mDisplay, pipelineId);
+    if (status != VA_STATUS_SUCCESS)
+        ETRACE("vaUnmapBuffer returns %08x", status);
+
+    bool ret = true;
+    {
+        // behind the rotation of the local displays, like the virtual one
+        VaDisplayManager::SubmitLock submit(mDisplay,
+                                            VaDisplayManager::PRIORITY_REMOTE);
+        status = vaBeginPicture(mDisplay, context.context, output);
+        if (status != VA_STATUS_SUCCESS) {
+            ETRACE("vaBeginPicture returns %08x", status);
+            return false;
+        }
+        status = vaRenderPicture(mDisplay, context.context, &pipelineId, 1);
+        if (status != VA_STATUS_SUCCESS) {
+            ETRACE("vaRenderPicture returns %08x", status);
+            ret = false;
+        }
+        status = vaEndPicture(mDisplay, context.context);
+        if (status != VA_STATUS_SUCCESS) {
+            ETRACE("vaEndPicture returns %08x", status);
+            ret = false;
+        }
+    }
+
+    status = vaSyncSurface(mDisplay, output);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaSyncSurface returns %08x", status);
+        ret = false;
+    }
+    return ret;
+}
+
+bool ScanoutCapture::start()
+{
+    if (mDisplay)
+        return true;
+
+    ITRACE("Start the VSP of the scanout capture");
+    mDisplay = VaDisplayManager::acquire(0);
+    if (!mDisplay) {
+        ETRACE("failed to get the VSP display");
+        return false;
+    }
+
+    VAConfigAttrib attrib;
+    attrib.type = VAConfigAttribRTFormat;
+    VAStatus status = vaGetConfigAttributes(mDisplay, VAProfileNone,
+                                            VAEntrypointVideoProc,
+                                            &attrib, 1);
+    if (status != VA_STATUS_SUCCESS)
+        ETRACE("vaGetConfigAttributes returns %08x", status);
+
+    status = vaCreateConfig(mDisplay, VAProfileNone, VAEntrypointVideoProc,
+                            &attrib, 1, &mConfig);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateConfig returns %08x", status);
+        VaDisplayManager::release(mDisplay);
+        mDisplay = NULL;
+        mConfig = 0;
+        return false;
+    }
+
+    mStarts++;
+    return true;
+}
+
+void ScanoutCapture::stop()
+{
+    for (int i = 0; i < mContextCount; i++) {
+        destroyContext(mContexts[i]);
+    }
+    mContextCount = 0;
+
+    if (mComposed) {
+        destroySurface(mComposed);
+        uint32_t bytes = mComposedWidth * mComposedHeight * 3 / 2;
+        MemoryAccounting::remove(MemoryAccounting::VSP_SURFACE, bytes);
+        mSurfaceBytes -= bytes;
+        mComposedWidth = 0;
+        mComposedHeight = 0;
+    }
+
+    if (mConfig) {
+        vaDestroyConfig(mDisplay, mConfig);
+        mConfig = 0;
+    }
+    if (mDisplay) {
+        VaDisplayManager::release(mDisplay);
+        mDisplay = NULL;
+    }
+}
+
+ScanoutCapture::Context* ScanoutCapture::getContext(uint32_t width,
+                                                    uint32_t height)
+{
+    for (int i = 0; i < mContextCount; i++) {
+        if (mContexts[i].width == width && mContexts[i].height == height)
+            return &mContexts[i];
+    }
+
+    // a display or target of a new size takes the slot of the oldest one
+    if (mContextCount == MAX_CONTEXTS) {
+        destroyContext(mContexts[0]);
+        memmove(&mContexts[0], &mContexts[1],
+                sizeof(Context) * (MAX_CONTEXTS - 1));
+        mContextCount--;
+    }
+
+    Context& context = mContexts[mContextCount];
+    memset(&context, 0, sizeof(context));
+    context.width = width;
+    context.height = height;
+
+    VAStatus status = vaCreateSurfaces(mDisplay, VA_RT_FORMAT_YUV420,
+                                       width, height, &context.blankYuv,
+                                       1, NULL, 0);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateSurfaces (blank yuv) returns %08x", status);
+        return NULL;
+    }
+
+    unsigned long buffer;
+    VASurfaceAttribExternalBuffers buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.pixel_format = VA_FOURCC_RGBA;
+    buf.width = width;
+    buf.height = height;
+    buf.data_size = width * height * 4;
+    buf.num_planes = 3;
+    buf.pitches[0] = width;
+    buf.pitches[1] = width;
+    buf.pitches[2] = width;
+    buf.offsets[1] = width * height;
+    buf.offsets[2] = buf.offsets[1];
+    buf.buffers = &buffer;
+    buf.num_buffers = 1;
+
+    VASurfaceAttrib attribs[2];
+    attribs[0].type = (VASurfaceAttribType)VASurfaceAttribMemoryType;
+    attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[0].value.type = VAGenericValueTypeInteger;
+    attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_VA;
+    attribs[1].type = (VASurfaceAttribType)VASurfaceAttribExternalBufferDescriptor;
+    attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[1].value.type = VAGenericValueTypePointer;
+    attribs[1].value.value.p = (void *)&buf;
+
+    status = vaCreateSurfaces(mDisplay, VA_RT_FORMAT_RGB32, width, height,
+                              &context.blankRgb, 1, attribs, 2);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateSurfaces (blank rgba) returns %08x", status);
+        destroySurface(context.blankYuv);
+        return NULL;
+    }
+
+    status = vaCreateContext(mDisplay, mConfig, width, height, 0,
+                             &context.blankYuv, 1, &context.context);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateContext returns %08x", status);
+        destroySurface(context.blankYuv);
+        destroySurface(context.blankRgb);
+        return NULL;
+    }
+
+    context.bytes = width * height * 3 / 2 + buf.data_size;
+    MemoryAccounting::add(MemoryAccounting::VSP_SURFACE, context.bytes);
+    mSurfaceBytes += context.bytes;
+    mContextCount++;
+    DTRACE("VSP context of the scanout capture at %ux%u", width, height);
+    return &context;
+}
+
+void ScanoutCapture::destroyContext(Context& context)
+{
+    if (context.context) {
+        VAStatus status = vaDestroyContext(mDisplay, context.context);
+        if (status != VA_STATUS_SUCCESS)
+            ETRACE("vaDestroyContext returns %08x", status);
+        context.context = 0;
+    }
+    destroySurface(context.blankYuv);
+    destroySurface(context.blankRgb);
+
+    MemoryAccounting::remove(MemoryAccounting::VSP_SURFACE, context.bytes);
+    mSurfaceBytes -= context.bytes;
+    context.bytes = 0;
+}
+
+buffer_handle_t ScanoutCapture::retainBuffer(buffer_handle_t handle)
+{
+    native_handle_t *clone = native_handle_clone(handle);
+    if (!clone) {
+        ETRACE("failed to clone buffer %p", handle);
+        return NULL;
+    }
+
+    if (mGralloc->registerBuffer(mGralloc, clone)) {
+        ETRACE("failed to register buffer %p", handle);
+        native_handle_close(clone);
+        native_handle_delete(clone);
+        return NULL;
+    }
+    return clone;
+}
+
+void ScanoutCapture::releaseBuffer(buffer_handle_t handle)
+{
+    if (!handle)
+        return;
+
+    mGralloc->unregisterBuffer(mGralloc, handle);
+    native_handle_t *clone = const_cast<native_handle_t*>(handle);
+    native_handle_close(clone);
+    native_handle_delete(clone);
+}
+
+void ScanoutCapture::releaseScanouts(Request& request)
+{
+    for (int i = 0; i < request.count; i++) {
+        releaseBuffer(request.scanouts[i].handle);
+        request.scanouts[i].handle = NULL;
+    }
+    request.count = 0;
+}
+
+VASurfaceID ScanoutCapture::createSurface(buffer_handle_t handle,
+                                          uint32_t format, uint32_t stride,
+                                          uint32_t height)
+{
+    unsigned long buffer = reinterpret_cast<unsigned long>(handle);
+    VASurfaceAttribExternalBuffers buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.pixel_format = format;
+    buf.width = stride;
+    buf.height = height;
+    buf.buffers = &buffer;
+    buf.num_buffers = 1;
+
+    unsigned int rtFormat;
+    if (format == VA_FOURCC_NV12) {
+        rtFormat = VA_RT_FORMAT_YUV420;
+        buf.data_size = stride * height * 3 / 2;
+        buf.num_planes = 2;
+        buf.pitches[0] = stride;
+        buf.pitches[1] = stride;
+        buf.offsets[1] = stride * height;
+    } else {
+        rtFormat = VA_RT_FORMAT_RGB32;
+        buf.data_size = stride * height * 4;
+        buf.num_planes = 3;
+        buf.pitches[0] = stride;
+        buf.pitches[1] = stride;
+        buf.pitches[2] = stride;
+    }
+
+    VASurfaceAttrib attribs[3];
+    attribs[0].type = (VASurfaceAttribType)VASurfaceAttribMemoryType;
+    attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[0].value.type = VAGenericValueTypeInteger;
+    attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_ANDROID_GRALLOC;
+    attribs[1].type = (VASurfaceAttribType)VASurfaceAttribExternalBufferDescriptor;
+    attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[1].value.type = VAGenericValueTypePointer;
+    attribs[1].value.value.p = (void *)&buf;
+    attribs[2].type = (VASurfaceAttribType)VASurfaceAttribPixelFormat;
+    attribs[2].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[2].value.type = VAGenericValueTypeInteger;
+    attribs[2].value.value.i = format;
+
+    VASurfaceID surface = 0;
+    VAStatus status = vaCreateSurfaces(mDisplay, rtFormat, stride, height,
+                                       &surface, 1, attribs, 3);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateSurfaces of %p returns %08x", handle, status);
+        return 0;
+    }
+    return surface;
+}
+
+VASurfaceID ScanoutCapture::createComposed(uint32_t width, uint32_t height)
+{
+    width = align_width(width);
+    height = align_height(height);
+    if (mComposed && mComposedWidth == width && mComposedHeight == height)
+        return mComposed;
+
+    uint32_t bytes = mComposedWidth * mComposedHeight * 3 / 2;
+    if (mComposed) {
+        destroySurface(mComposed);
+        MemoryAccounting::remove(MemoryAccounting::VSP_SURFACE, bytes);
+        mSurfaceBytes -= bytes;
+    }
+
+    VAStatus status = vaCreateSurfaces(mDisplay, VA_RT_FORMAT_YUV420,
+                                       width, height, &mComposed,
+                                       1, NULL, 0);
+    if (status != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateSurfaces (composed) returns %08x", status);
+        mComposed = 0;
+        mComposedWidth = 0;
+        mComposedHeight = 0;
+        return 0;
+    }
+
+    mComposedWidth = width;
+    mComposedHeight = height;
+    bytes = width * height * 3 / 2;
+    MemoryAccounting::add(MemoryAccounting::VSP_SURFACE, bytes);
+    mSurfaceBytes += bytes;
+    return mComposed;
+}
+
+void ScanoutCapture::destroySurface(VASurfaceID& surface)
+{
+    if (!surface)
+        return;
+
+    VAStatus status = vaDestroySurfaces(mDisplay, &surface, 1);
+    if (status != VA_STATUS_SUCCESS)
+        ETRACE("vaDestroySurfaces returns %08x", status);
+    surface = 0;
+}
+
+void ScanoutCapture::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    if (d.isKeyValue()) {
+        d.section("scanout_capture");
+        d.value("requests", "%u", mRequests);
+        d.value("rejected", "%u", mRejected);
+        d.value("captures", "%u", mCaptures);
+        d.value("failures", "%u", mFailures);
+        d.value("vsp_starts", "%u", mStarts);
+        d.value("compose_us", "%lld", mComposeTime / 1000);
+        d.value("max_compose_us", "%lld", mMaxComposeTime / 1000);
+        d.value("surface_kb", "%u", mSurfaceBytes / 1024);
+        return;
+    }
+
+    d.append("Scanout capture: requests %u (%u rejected), captures %u, "
+             "failures %u, VSP %s (started %u times, %u KB), "
+             "compose %lld us (max %lld us)\n",
+             mRequests, mRejected, mCaptures, mFailures,
+             mDisplay ? "on" : "off", mStarts, mSurfaceBytes / 1024,
+             mComposeTime / 1000, mMaxComposeTime / 1000);
+}
+
+} // namespace intel
+} // namespace android
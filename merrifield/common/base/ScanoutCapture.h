@@ -0,0 +1,165 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SCANOUT_CAPTURE_H
+#define SCANOUT_CAPTURE_H
+
+#include <Dump.h>
+#include <DisplayPlane.h>
+#include <SimpleThread.h>
+#include <hardware/gralloc.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+#include <va/va.h>
+#include <va/va_vpp.h>
+
+namespace android {
+namespace intel {
+
+class DisplayPlaneManager;
+
+// Screenshots of what the planes of a display scan out, for a monitoring
+// agent that must not take the layers off the planes with a GLES readback.
+// request() arms a capture of the next commit of the display. onCommit()
+// copies the geometry the planes hold from their cached mappers and
+// registers clones of their buffer handles, so the buffers outlive the
+// frame SurfaceFlinger releases them with. The capture thread then has
+// VSP compose the video plane and the primary plane into a downscaled
+// NV12 target and calls back once it is done; the flipped buffers are read
+// as they are, the planes are left alone. The VA state is created on the
+// first capture and released after the video idle time of the tuning
+// policy.
+class ScanoutCapture {
+public:
+    // success is false if nothing was composed into the target
+    typedef void (*Callback)(void *data, int disp, buffer_handle_t target,
+                             bool success);
+
+public:
+    ScanoutCapture();
+    ~ScanoutCapture();
+
+public:
+    bool initialize(DisplayPlaneManager *planeManager);
+    void deinitialize();
+
+    // target is an NV12 gralloc buffer of width x height, the display of
+    // displayWidth x displayHeight is scaled into it. One capture at a
+    // time, false while the last one is not done.
+    bool request(int disp, uint32_t displayWidth, uint32_t displayHeight,
+                 buffer_handle_t target, uint32_t width, uint32_t height,
+                 Callback callback, void *data);
+    // called after the commit of all displays
+    void onCommit(size_t numDisplays);
+    void dump(Dump& d);
+
+private:
+    enum {
+        // planes a display may use, cursors left out
+        MAX_SCANOUTS = 8,
+        // displays and targets of different sizes
+        MAX_CONTEXTS = 2,
+    };
+
+    enum State {
+        STATE_IDLE = 0,
+        // waiting for the commit of the display
+        STATE_ARMED,
+        // planes copied, composing
+        STATE_COMPOSING,
+    };
+
+    struct Request {
+        int disp;
+        uint32_t displayWidth;
+        uint32_t displayHeight;
+        buffer_handle_t target;
+        uint32_t width;
+        uint32_t height;
+        Callback callback;
+        void *data;
+        int count;
+        DisplayPlane::Scanout scanouts[MAX_SCANOUTS];
+    };
+
+    // VSP context of one output size, with the blank inputs of that size
+    struct Context {
+        uint32_t width;
+        uint32_t height;
+        VAContextID context;
+        VASurfaceID blankYuv;
+        VASurfaceID blankRgb;
+        uint32_t bytes;
+    };
+
+    bool compose(const Request& request);
+    bool render(const Context& context, VASurfaceID video,
+                const VARectangle& surfaceRegion,
+                const VARectangle& outputRegion,
+                VASurfaceID rgb, VASurfaceID output);
+    bool start();
+    void stop();
+    Context* getContext(uint32_t width, uint32_t height);
+    void destroyContext(Context& context);
+    // a registered clone of the handle, NULL on failure
+    buffer_handle_t retainBuffer(buffer_handle_t handle);
+    void releaseBuffer(buffer_handle_t handle);
+    void releaseScanouts(Request& request);
+    VASurfaceID createSurface(buffer_handle_t handle, uint32_t format,
+                              uint32_t stride, uint32_t height);
+    VASurfaceID createComposed(uint32_t width, uint32_t height);
+    void destroySurface(VASurfaceID& surface);
+
+private:
+    bool mInitialized;
+    DisplayPlaneManager *mPlaneManager;
+    const gralloc_module_t *mGralloc;
+
+    Mutex mLock;
+    Condition mCondition;
+    // mState is read by onCommit() without the lock
+    volatile int32_t mState;
+    Request mRequest;
+    bool mExiting;
+
+    // only touched by the capture thread
+    VADisplay mDisplay;
+    VAConfigID mConfig;
+    Context mContexts[MAX_CONTEXTS];
+    int mContextCount;
+    // display sized result of the first pass, when the target is smaller
+    VASurfaceID mComposed;
+    uint32_t mComposedWidth;
+    uint32_t mComposedHeight;
+    uint32_t mSurfaceBytes;
+    nsecs_t mLastUse;
+
+    // statistics
+    uint32_t mRequests;
+    uint32_t mRejected;
+    uint32_t mCaptures;
+    uint32_t mFailures;
+    uint32_t mStarts;
+    nsecs_t mComposeTime;
+    nsecs_t mMaxComposeTime;
+
+    DECLARE_THREAD(CaptureThread, ScanoutCapture);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* SCANOUT_CAPTURE_H */
@@ -18,6 +18,7 @@
 #define SIMPLE_THREAD_H
 
 #include <utils/threads.h>
+#include <ThreadPolicy.h>
 
 #define DECLARE_THREAD(THREADNAME, THREADOWNER) \
     class THREADNAME: public Thread { \
@@ -25,6 +26,10 @@
         THREADNAME(THREADOWNER *owner) { mOwner = owner; } \
         THREADNAME() { mOwner = NULL; } \
     private: \
+        virtual status_t readyToRun() { \
+            ThreadPolicy::apply(#THREADOWNER); \
+            return NO_ERROR; \
+        } \
         virtual bool threadLoop() { return mOwner->threadLoop(); } \
     private: \
         THREADOWNER *mOwner; \
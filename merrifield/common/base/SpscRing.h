@@ -0,0 +1,130 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <cutils/atomic.h>
+
+namespace android {
+namespace intel {
+
+// Fixed-capacity single-producer/single-consumer ring. push() is only
+// called from one thread and pop() only from another; neither takes a
+// lock. The consumer sleeps on an eventfd which the producer only writes
+// when the consumer has announced that it is about to sleep, so a busy
+// queue costs no syscalls. SIZE must be a power of two.
+template <typename T, uint32_t SIZE>
+class SpscRing {
+public:
+    SpscRing()
+        : mHead(0),
+          mTail(0),
+          mWaiting(0),
+          mEventFd(-1) {
+    }
+    ~SpscRing() {
+        deinitialize();
+    }
+
+public:
+    bool initialize() {
+        if (mEventFd < 0)
+            mEventFd = eventfd(0, EFD_CLOEXEC);
+        return mEventFd >= 0;
+    }
+    void deinitialize() {
+        if (mEventFd >= 0) {
+            close(mEventFd);
+            mEventFd = -1;
+        }
+    }
+
+    // producer side, returns false if the ring is full
+    bool push(const T& item) {
+        uint32_t tail = (uint32_t)mTail;
+        uint32_t head = (uint32_t)android_atomic_acquire_load(&mHead);
+        if (tail - head >= SIZE)
+            return false;
+
+        mSlots[tail & (SIZE - 1)] = item;
+        android_atomic_release_store((int32_t)(tail + 1), &mTail);
+
+        // pairs with the barrier in wait()
+        android_memory_barrier();
+        if (android_atomic_acquire_load(&mWaiting)) {
+            uint64_t one = 1;
+            write(mEventFd, &one, sizeof(one));
+        }
+        return true;
+    }
+
+    // consumer side, blocks until an item is available
+    T pop() {
+        T item;
+        while (!tryPop(item))
+            wait();
+        return item;
+    }
+
+    bool tryPop(T& item) {
+        uint32_t head = (uint32_t)mHead;
+        uint32_t tail = (uint32_t)android_atomic_acquire_load(&mTail);
+        if (head == tail)
+            return false;
+
+        item = mSlots[head & (SIZE - 1)];
+        // drop the ring's reference before handing the slot back
+        mSlots[head & (SIZE - 1)] = T();
+        android_atomic_release_store((int32_t)(head + 1), &mHead);
+        return true;
+    }
+
+    // safe to call from any thread, but only a hint outside the consumer
+    bool empty() const {
+        return android_atomic_acquire_load(&mHead) ==
+               android_atomic_acquire_load(&mTail);
+    }
+
+private:
+    void wait() {
+        android_atomic_release_store(1, &mWaiting);
+        android_memory_barrier();
+        if (empty()) {
+            uint64_t count;
+            read(mEventFd, &count, sizeof(count));
+        }
+        android_atomic_release_store(0, &mWaiting);
+    }
+
+private:
+    // not copyable
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+
+    T mSlots[SIZE];
+    volatile int32_t mHead;    // written by the consumer
+    volatile int32_t mTail;    // written by the producer
+    volatile int32_t mWaiting;
+    int mEventFd;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* SPSC_RING_H */
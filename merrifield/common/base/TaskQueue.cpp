@@ -0,0 +1,269 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <HwcTrace.h>
+#include <TaskQueue.h>
+
+namespace android {
+namespace intel {
+
+TaskQueue::Worker::Worker(TaskQueue *queue, int index, int lanes)
+    : mQueue(queue),
+      mIndex(index),
+      mLanes(lanes)
+{
+}
+
+TaskQueue::Worker::~Worker()
+{
+}
+
+bool TaskQueue::Worker::initialize()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "HwcTask%d", mIndex);
+
+    mThread = new TaskWorkerThread(this);
+    if (!mThread.get()) {
+        ETRACE("failed to create task worker thread");
+        return false;
+    }
+    mThread->run(name, mLanes == 1 ? PRIORITY_URGENT_DISPLAY : PRIORITY_DEFAULT);
+    return true;
+}
+
+void TaskQueue::Worker::deinitialize()
+{
+    // the queue has told the workers to exit
+    if (mThread.get()) {
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+}
+
+bool TaskQueue::Worker::threadLoop()
+{
+    return mQueue->runNext(this);
+}
+
+TaskQueue::TaskQueue()
+    : mInitialized(false),
+      mExitThread(false),
+      mLock(),
+      mCondition(),
+      mDone(),
+      mWorkers(),
+      mRunning(),
+      mNextId(0)
+{
+    memset(mStats, 0, sizeof(mStats));
+}
+
+TaskQueue::~TaskQueue()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool TaskQueue::initialize(int numWorkers)
+{
+    if (numWorkers < 0 || numWorkers > WORKERS_MAX) {
+        numWorkers = DEFAULT_WORKERS;
+    }
+
+    mExitThread = false;
+    mNextId = 0;
+    memset(mStats, 0, sizeof(mStats));
+
+    // worker 0 serves the display lane only
+    for (int i = 0; i <= numWorkers; i++) {
+        mRunning.push_back(-1);
+    }
+    for (int i = 0; i <= numWorkers; i++) {
+        Worker *worker = new Worker(this, i, i ? (int)LANE_MAX : 1);
+        if (!worker || !worker->initialize()) {
+            delete worker;
+            DEINIT_AND_RETURN_FALSE("failed to create task worker %d", i);
+        }
+        mWorkers.push_back(worker);
+    }
+
+    mInitialized = true;
+    return true;
+}
+
+void TaskQueue::deinitialize()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThread = true;
+        mCondition.broadcast();
+    }
+
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        Worker *worker = mWorkers.itemAt(i);
+        DEINIT_AND_DELETE_OBJ(worker);
+    }
+    mWorkers.clear();
+    mRunning.clear();
+
+    for (int i = 0; i < LANE_MAX; i++) {
+        if (mLanes[i].size()) {
+            WTRACE("%zu tasks of lane %d dropped", mLanes[i].size(), i);
+        }
+        mLanes[i].clear();
+    }
+    mInitialized = false;
+}
+
+int TaskQueue::post(int lane, TaskFunc func, void *data, nsecs_t delay)
+{
+    RETURN_X_IF_NOT_INIT(-1);
+
+    if (lane < 0 || lane >= LANE_MAX || !func) {
+        ETRACE("invalid task on lane %d", lane);
+        return -1;
+    }
+
+    Task task;
+    task.func = func;
+    task.data = data;
+    task.due = systemTime(SYSTEM_TIME_MONOTONIC) + (delay > 0 ? delay : 0);
+
+    Mutex::Autolock _l(mLock);
+    mNextId = (mNextId + 1) & 0x7fffffff;
+    task.id = mNextId;
+
+    // after the tasks due at the same time
+    Vector<Task>& tasks = mLanes[lane];
+    size_t i = tasks.size();
+    while (i > 0 && tasks.itemAt(i - 1).due > task.due) {
+        i--;
+    }
+    tasks.insertAt(task, i);
+
+    mStats[lane].posted++;
+    mCondition.broadcast();
+    return task.id;
+}
+
+bool TaskQueue::dequeue(int task)
+{
+    for (int lane = 0; lane < LANE_MAX; lane++) {
+        Vector<Task>& tasks = mLanes[lane];
+        for (size_t i = 0; i < tasks.size(); i++) {
+            if (tasks.itemAt(i).id == task) {
+                tasks.removeAt(i);
+                mStats[lane].cancelled++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool TaskQueue::isRunning(int task) const
+{
+    for (size_t i = 0; i < mRunning.size(); i++) {
+        if (mRunning.itemAt(i) == task) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskQueue::cancel(int task)
+{
+    Mutex::Autolock _l(mLock);
+    return dequeue(task);
+}
+
+void TaskQueue::remove(int task)
+{
+    Mutex::Autolock _l(mLock);
+    dequeue(task);
+    while (isRunning(task)) {
+        mDone.wait(mLock);
+    }
+}
+
+bool TaskQueue::runNext(Worker *worker)
+{
+    Mutex::Autolock _l(mLock);
+    while (!mExitThread) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t wake = 0;
+        for (int lane = 0; lane < worker->mLanes; lane++) {
+            Vector<Task>& tasks = mLanes[lane];
+            if (tasks.isEmpty()) {
+                continue;
+            }
+
+            Task task = tasks.itemAt(0);
+            if (task.due > now) {
+                if (!wake || task.due < wake) {
+                    wake = task.due;
+                }
+                continue;
+            }
+
+            tasks.removeAt(0);
+            LaneStats& stats = mStats[lane];
+            stats.run++;
+            if (now - task.due > stats.maxLatency) {
+                stats.maxLatency = now - task.due;
+            }
+            mRunning.editItemAt(worker->mIndex) = task.id;
+
+            mLock.unlock();
+            task.func(task.data);
+            mLock.lock();
+
+            mRunning.editItemAt(worker->mIndex) = -1;
+            mDone.broadcast();
+            return true;
+        }
+
+        if (wake) {
+            mCondition.waitRelative(mLock, wake - now);
+        } else {
+            mCondition.wait(mLock);
+        }
+    }
+
+    ITRACE("exiting thread loop");
+    return false;
+}
+
+void TaskQueue::dump(Dump& d)
+{
+    static const char *names[LANE_MAX] = {
+        "display", "normal", "background",
+    };
+
+    Mutex::Autolock _l(mLock);
+    d.append("Task queue: %d workers\n", mWorkers.size());
+    for (int i = 0; i < LANE_MAX; i++) {
+        const LaneStats& stats = mStats[i];
+        d.append("  %-10s queued %d, posted %u, run %u, cancelled %u, "
+                 "max latency %lld us\n",
+                 names[i], mLanes[i].size(), stats.posted, stats.run,
+                 stats.cancelled, stats.maxLatency / 1000);
+    }
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,126 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <Dump.h>
+#include <SimpleThread.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+namespace android {
+namespace intel {
+
+typedef void (*TaskFunc)(void *data);
+
+// Workers shared by the background work of the features that don't need a
+// thread of their own. A worker takes the due task of the first lane that
+// has one, the display lane has a worker of its own at display priority.
+// Tasks of a lane run in the order of their due time.
+class TaskQueue {
+public:
+    enum {
+        LANE_DISPLAY = 0,
+        LANE_NORMAL,
+        LANE_BACKGROUND,
+        LANE_MAX,
+    };
+
+    enum {
+        DEFAULT_WORKERS = 2,
+        WORKERS_MAX = 4,
+    };
+
+public:
+    TaskQueue();
+    virtual ~TaskQueue();
+
+public:
+    // numWorkers serve all lanes, next to the display lane worker
+    bool initialize(int numWorkers);
+    void deinitialize();
+
+    // runs func(data) on a worker once delay has passed. Returns the task
+    // or -1, a task is gone once it ran.
+    int post(int lane, TaskFunc func, void *data, nsecs_t delay = 0);
+    // drops a task that has not started, unlike remove() it doesn't wait
+    // for one in progress. False if it is not queued.
+    bool cancel(int task);
+    // once this returns the task is not running and won't run
+    void remove(int task);
+
+    void dump(Dump& d);
+
+private:
+    struct Task {
+        int id;
+        TaskFunc func;
+        void *data;
+        nsecs_t due;
+    };
+
+    class Worker {
+    public:
+        Worker(TaskQueue *queue, int index, int lanes);
+        ~Worker();
+
+    public:
+        bool initialize();
+        void deinitialize();
+
+    private:
+        TaskQueue *mQueue;
+        int mIndex;
+        // lanes served, from LANE_DISPLAY on
+        int mLanes;
+        DECLARE_THREAD(TaskWorkerThread, Worker);
+        friend class TaskQueue;
+    };
+
+    struct LaneStats {
+        uint32_t posted;
+        uint32_t run;
+        uint32_t cancelled;
+        // longest wait of a task after it was due
+        nsecs_t maxLatency;
+    };
+
+    // runs the next due task of the lanes, false once the worker exits
+    bool runNext(Worker *worker);
+    bool isRunning(int task) const;
+    bool dequeue(int task);
+
+private:
+    bool mInitialized;
+    bool mExitThread;
+    Mutex mLock;
+    // wakes the workers for new tasks and exit
+    Condition mCondition;
+    // signaled when a task returns
+    Condition mDone;
+    Vector<Task> mLanes[LANE_MAX];
+    Vector<Worker*> mWorkers;
+    // task run by each worker, -1 if idle
+    Vector<int> mRunning;
+    int mNextId;
+    LaneStats mStats[LANE_MAX];
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* TASK_QUEUE_H */
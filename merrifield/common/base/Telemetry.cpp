@@ -0,0 +1,226 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cutils/atomic.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <MemoryAccounting.h>
+#include <Telemetry.h>
+
+namespace android {
+namespace intel {
+
+Telemetry::Telemetry()
+    : mInitialized(false),
+      mEventLoop(NULL),
+      mTimer(-1),
+      mFd(-1),
+      mRegion(NULL),
+      mUpdates(0),
+      mUpdateTime(0)
+{
+    mPath[0] = '\0';
+}
+
+Telemetry::~Telemetry()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool Telemetry::initialize(EventLoop *loop)
+{
+    if (!loop) {
+        ETRACE("invalid event loop");
+        return false;
+    }
+    mEventLoop = loop;
+
+    // off unless the agent asked for it, failing to publish is not fatal
+    property_get("hwc.telemetry.file", mPath, "");
+    if (mPath[0] && open(mPath)) {
+        mTimer = mEventLoop->addTimer(UPDATE_INTERVAL, UPDATE_INTERVAL,
+                                      timerExpired, this);
+        if (mTimer < 0) {
+            ETRACE("failed to create telemetry timer");
+            close();
+        }
+    }
+
+    mInitialized = true;
+    return true;
+}
+
+void Telemetry::deinitialize()
+{
+    // waits for a running update
+    if (mEventLoop && mTimer >= 0) {
+        mEventLoop->removeTimer(mTimer);
+    }
+    mTimer = -1;
+    close();
+    mEventLoop = NULL;
+    mInitialized = false;
+}
+
+bool Telemetry::open(const char *path)
+{
+    mFd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (mFd < 0) {
+        ETRACE("failed to open telemetry file %s, error %d", path, errno);
+        return false;
+    }
+
+    if (ftruncate(mFd, sizeof(Region)) < 0) {
+        ETRACE("failed to size telemetry file %s, error %d", path, errno);
+        close();
+        return false;
+    }
+
+    void *addr = mmap(NULL, sizeof(Region), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, mFd, 0);
+    if (addr == MAP_FAILED) {
+        ETRACE("failed to map telemetry file %s, error %d", path, errno);
+        close();
+        return false;
+    }
+    mRegion = (Region *)addr;
+
+    // the magic goes last, a reader ignores the file until it is there
+    memset(mRegion, 0, sizeof(Region));
+    mRegion->header.version = TELEMETRY_VERSION;
+    mRegion->header.size = sizeof(Region);
+    android_atomic_release_store(TELEMETRY_MAGIC,
+                                 (volatile int32_t *)&mRegion->header.magic);
+
+    ITRACE("publishing telemetry to %s", path);
+    return true;
+}
+
+void Telemetry::close()
+{
+    if (mRegion) {
+        munmap(mRegion, sizeof(Region));
+        mRegion = NULL;
+    }
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+void Telemetry::collect(TelemetrySystem& system,
+                        TelemetryDisplay displays[TELEMETRY_DISPLAY_COUNT])
+{
+    static const int percents[TELEMETRY_PERCENTILE_COUNT] = { 50, 90, 99 };
+    Hwcomposer& hwc = Hwcomposer::getInstance();
+
+    FrameTiming *timing = hwc.getFrameTiming();
+    for (int stage = 0; timing && stage < FrameTiming::STAGE_COUNT &&
+                        stage < TELEMETRY_STAGE_COUNT; stage++) {
+        timing->getPercentiles(FrameTiming::DISPLAY_ALL, stage, percents,
+                               system.stageTimes[stage],
+                               TELEMETRY_PERCENTILE_COUNT);
+        for (int i = 0; i < TELEMETRY_DISPLAY_COUNT; i++) {
+            timing->getPercentiles(i, stage, percents,
+                                   displays[i].stageTimes[stage],
+                                   TELEMETRY_PERCENTILE_COUNT);
+        }
+    }
+
+    BandwidthEstimator *bandwidth = hwc.getBandwidthEstimator();
+    if (bandwidth) {
+        system.bandwidth = bandwidth->getBandwidth();
+    }
+
+    for (int i = 0; i < MemoryAccounting::CATEGORY_COUNT &&
+                    i < TELEMETRY_MEMORY_COUNT; i++) {
+        MemoryAccounting::Category category = (MemoryAccounting::Category)i;
+        system.memoryCurrent[i] = MemoryAccounting::getCurrent(category);
+        system.memoryPeak[i] = MemoryAccounting::getPeak(category);
+    }
+
+    FenceTracker *fenceTracker = hwc.getFenceTracker();
+    if (fenceTracker) {
+        system.missedVblanks = fenceTracker->getMissedVblanks();
+    }
+
+    JankDetector *jankDetector = hwc.getJankDetector();
+    if (jankDetector) {
+        system.jankyWindows = jankDetector->getJankyWindows();
+        system.jankFallbacks = jankDetector->getFallbacks();
+        system.jankPolicies = jankDetector->getPolicies();
+    }
+
+    for (int i = 0; i < TELEMETRY_DISPLAY_COUNT; i++) {
+        IDisplayDevice *device = hwc.getDisplayDevice(i);
+        if (device) {
+            device->getTelemetry(displays[i]);
+        }
+    }
+}
+
+void Telemetry::update()
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // gathered first, the sequence stays odd only for the copy
+    TelemetrySystem system;
+    TelemetryDisplay displays[TELEMETRY_DISPLAY_COUNT];
+    memset(&system, 0, sizeof(system));
+    memset(displays, 0, sizeof(displays));
+    collect(system, displays);
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    TelemetryHeader& header = mRegion->header;
+    android_atomic_inc(&header.seq);
+    header.timestamp = now;
+    header.updates = ++mUpdates;
+    mRegion->system = system;
+    memcpy(mRegion->displays, displays, sizeof(displays));
+    android_atomic_inc(&header.seq);
+
+    mUpdateTime = now - start;
+}
+
+void Telemetry::timerExpired(int timer, void *data)
+{
+    Telemetry *telemetry = (Telemetry *)data;
+    if (telemetry && telemetry->mRegion) {
+        telemetry->update();
+    }
+}
+
+void Telemetry::dump(Dump& d)
+{
+    if (d.isKeyValue()) {
+        d.section("telemetry");
+        d.value("enabled", "%d", mRegion != NULL);
+        d.value("updates", "%u", mUpdates);
+        d.value("update_us", "%lld", mUpdateTime / 1000);
+        return;
+    }
+
+    d.append("Telemetry: %s%s, updates %u, last update %lld us\n",
+             mRegion ? "publishing to " : "off",
+             mRegion ? mPath : "", mUpdates, mUpdateTime / 1000);
+}
+
+} // namespace intel
+} // namespace android
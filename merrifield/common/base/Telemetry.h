@@ -0,0 +1,80 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Dump.h>
+#include <utils/Timers.h>
+#include <cutils/properties.h>
+#include <TelemetryFormat.h>
+
+namespace android {
+namespace intel {
+
+class EventLoop;
+
+// Binary counters for a monitoring agent. With hwc.telemetry.file set to a
+// path at boot, the file is mapped shared and the records described in
+// TelemetryFormat.h are refreshed once a second from the event loop: frame
+// timing percentiles, plane usage, plane assignment cache hits, bandwidth
+// and memory estimates and the jank statistics. The agent maps the same
+// file and copies the records under the sequence count, nothing is
+// formatted on the composer side. A tmpfs path keeps the file off the
+// disk. Without the property no timer is created.
+class Telemetry {
+public:
+    Telemetry();
+    ~Telemetry();
+
+public:
+    bool initialize(EventLoop *loop);
+    void deinitialize();
+    void dump(Dump& d);
+
+private:
+    static const nsecs_t UPDATE_INTERVAL = 1000000000LL;
+
+    struct Region {
+        TelemetryHeader header;
+        TelemetrySystem system;
+        TelemetryDisplay displays[TELEMETRY_DISPLAY_COUNT];
+    };
+
+    bool open(const char *path);
+    void close();
+    void update();
+    void collect(TelemetrySystem& system,
+                 TelemetryDisplay displays[TELEMETRY_DISPLAY_COUNT]);
+    static void timerExpired(int timer, void *data);
+
+private:
+    bool mInitialized;
+    EventLoop *mEventLoop;
+    int mTimer;
+    int mFd;
+    Region *mRegion;
+    char mPath[PROPERTY_VALUE_MAX];
+
+    // statistics
+    uint32_t mUpdates;
+    // time taken by the last update
+    nsecs_t mUpdateTime;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,160 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <utils/threads.h>
+#include <cutils/properties.h>
+#include <HwcTrace.h>
+#include <ThreadPolicy.h>
+
+namespace android {
+namespace intel {
+
+// vsync delivery must not queue behind the blit and buffer work
+static const struct {
+    const char *owner;
+    int priority;
+    unsigned long cpuMask;
+    unsigned long slackUs;
+} sDefaults[] = {
+    { "VsyncEventObserver", 1, 0, 0 },
+    { "VblankEventObserver", 1, 0, 0 },
+    { "SoftVsyncObserver", 1, 0, 0 },
+};
+
+static Mutex sLock;
+ThreadPolicy::Record ThreadPolicy::sRecords[MAX_THREADS];
+int ThreadPolicy::sCount = 0;
+
+void ThreadPolicy::getPolicy(const char *owner, Policy& policy)
+{
+    memset(&policy, 0, sizeof(policy));
+    for (size_t i = 0; i < sizeof(sDefaults) / sizeof(sDefaults[0]); i++) {
+        if (!strcmp(sDefaults[i].owner, owner)) {
+            policy.priority = sDefaults[i].priority;
+            policy.cpuMask = sDefaults[i].cpuMask;
+            policy.slackUs = sDefaults[i].slackUs;
+            break;
+        }
+    }
+
+    char key[PROPERTY_KEY_MAX];
+    char prop[PROPERTY_VALUE_MAX];
+    snprintf(key, sizeof(key), "hwc.thread.%s", owner);
+    if (property_get(key, prop, NULL) <= 0) {
+        return;
+    }
+
+    // the fields are positional, a property replaces all of them
+    char *field = prop;
+    char *end = NULL;
+    policy.priority = strtol(field, &end, 0);
+    policy.cpuMask = 0;
+    policy.slackUs = 0;
+    if (*end == ',') {
+        field = end + 1;
+        policy.cpuMask = strtoul(field, &end, 16);
+    }
+    if (*end == ',') {
+        field = end + 1;
+        policy.slackUs = strtoul(field, &end, 0);
+    }
+}
+
+void ThreadPolicy::apply(const char *owner)
+{
+    Record record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.owner, owner, NAME_SIZE - 1);
+    record.tid = gettid();
+    getPolicy(owner, record.policy);
+
+    const Policy& policy = record.policy;
+    if (policy.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = policy.priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+            record.priorityError = errno;
+        }
+    }
+
+    if (policy.cpuMask) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned int cpu = 0; cpu < sizeof(policy.cpuMask) * 8; cpu++) {
+            if (policy.cpuMask & (1UL << cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            record.affinityError = errno;
+        }
+    }
+
+    if (policy.slackUs) {
+        if (prctl(PR_SET_TIMERSLACK, policy.slackUs * 1000, 0, 0, 0)) {
+            record.slackError = errno;
+        }
+    }
+
+    if (record.priorityError || record.affinityError || record.slackError) {
+        WTRACE("thread %s (%d): failed to apply fifo %d, mask %#lx, slack %lu us",
+               owner, record.tid, policy.priority, policy.cpuMask, policy.slackUs);
+    }
+
+    Mutex::Autolock _l(sLock);
+    // a thread of the same owner that has exited gives up its slot
+    for (int i = 0; i < sCount; i++) {
+        if (!strcmp(sRecords[i].owner, record.owner) &&
+            kill(sRecords[i].tid, 0) && errno == ESRCH) {
+            sRecords[i] = record;
+            return;
+        }
+    }
+    if (sCount < MAX_THREADS) {
+        sRecords[sCount++] = record;
+    }
+}
+
+void ThreadPolicy::dump(Dump& d)
+{
+    Mutex::Autolock _l(sLock);
+    d.append("Thread policies:\n");
+    d.append("  OWNER                  |   TID | FIFO |   CPUS | SLACK | ERRORS \n");
+    d.append("-------------------------+-------+------+--------+-------+--------\n");
+    for (int i = 0; i < sCount; i++) {
+        const Record& r = sRecords[i];
+        d.append("  %-22s | %5d | %4d | %6lx | %5lu | %d,%d,%d \n",
+                 r.owner,
+                 r.tid,
+                 r.policy.priority,
+                 r.policy.cpuMask,
+                 r.policy.slackUs,
+                 r.priorityError,
+                 r.affinityError,
+                 r.slackError);
+    }
+}
+
+} // namespace intel
+} // namespace android
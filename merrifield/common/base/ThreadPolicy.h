@@ -0,0 +1,65 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <Dump.h>
+#include <sys/types.h>
+
+namespace android {
+namespace intel {
+
+// Scheduling of the HWC threads, applied by every thread to itself when
+// it starts. Threads are named by their owner class; the built-in
+// defaults are overridden per thread with
+//     setprop hwc.thread.<owner> <fifo priority>,<cpu mask>,<timer slack us>
+// where a field left empty or 0 keeps what the thread inherited.
+class ThreadPolicy {
+public:
+    static void apply(const char *owner);
+    static void dump(Dump& d);
+
+private:
+    enum {
+        MAX_THREADS = 24,
+        NAME_SIZE = 24,
+    };
+
+    struct Policy {
+        int priority;
+        unsigned long cpuMask;
+        unsigned long slackUs;
+    };
+
+    struct Record {
+        char owner[NAME_SIZE];
+        pid_t tid;
+        Policy policy;
+        // errno of the calls that failed, 0 on success
+        int priorityError;
+        int affinityError;
+        int slackError;
+    };
+
+    static void getPolicy(const char *owner, Policy& policy);
+    static Record sRecords[MAX_THREADS];
+    static int sCount;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* THREAD_POLICY_H */
@@ -0,0 +1,223 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <HwcTrace.h>
+#include <EventLoop.h>
+#include <TuningPolicy.h>
+
+namespace android {
+namespace intel {
+
+volatile int32_t TuningPolicy::sSeq = 0;
+TuningPolicy::Values TuningPolicy::sValues = {
+    DEFAULT_STATIC_THRESHOLD,
+    DEFAULT_BUFFER_POOL_SIZE,
+    DEFAULT_CSC_BUFFERS,
+    DEFAULT_VIDEO_IDLE_MS,
+    false,
+    { 0, 0, 0 },
+    false,
+};
+EventLoop *TuningPolicy::sEventLoop = NULL;
+int TuningPolicy::sTimer = -1;
+uint32_t TuningPolicy::sChanges = 0;
+
+static const char *sFpsCapKeys[TuningPolicy::CAPPED_DISPLAYS] = {
+    "hwc.policy.fps_cap_primary",
+    "hwc.policy.fps_cap_external",
+    "hwc.policy.fps_cap_virtual",
+};
+
+static uint32_t getProperty(const char *key, uint32_t def,
+                            uint32_t min, uint32_t max)
+{
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get(key, prop, NULL) <= 0) {
+        return def;
+    }
+
+    char *end = NULL;
+    unsigned long value = strtoul(prop, &end, 0);
+    if (end == prop || *end || value < min || value > max) {
+        WTRACE("%s=%s is out of range [%u, %u]", key, prop, min, max);
+        return def;
+    }
+    return value;
+}
+
+void TuningPolicy::read(Values& values, bool runtimeOnly)
+{
+    values.staticThreshold = getProperty("hwc.policy.static_threshold",
+            DEFAULT_STATIC_THRESHOLD, 1, MAX_STATIC_THRESHOLD);
+    values.primaryVsyncOnly =
+            getProperty("hwc.policy.primary_vsync_only", 0, 0, 1) != 0;
+    for (int i = 0; i < CAPPED_DISPLAYS; i++) {
+        values.fpsCaps[i] = getProperty(sFpsCapKeys[i], 0, 0, MAX_FPS_CAP);
+    }
+    values.asyncFlip = getProperty("hwc.policy.async_flip", 0, 0, 1) != 0;
+    if (runtimeOnly) {
+        return;
+    }
+
+    values.bufferPoolSize = getProperty("hwc.policy.buffer_pool",
+            DEFAULT_BUFFER_POOL_SIZE, MIN_BUFFER_POOL_SIZE,
+            MAX_BUFFER_POOL_SIZE);
+    values.cscBuffers = getProperty("hwc.policy.csc_buffers",
+            DEFAULT_CSC_BUFFERS, MIN_CSC_BUFFERS, MAX_CSC_BUFFERS);
+    values.videoIdleMs = getProperty("hwc.policy.video_idle_ms",
+            DEFAULT_VIDEO_IDLE_MS, 0, MAX_VIDEO_IDLE_MS);
+}
+
+void TuningPolicy::publish(const Values& values)
+{
+    // single writer, the load or the watcher; an odd sequence tells
+    // readers that the snapshot is being written
+    android_atomic_inc(&sSeq);
+    sValues = values;
+    android_atomic_inc(&sSeq);
+}
+
+void TuningPolicy::load()
+{
+    Values values;
+    read(values, false);
+    publish(values);
+}
+
+bool TuningPolicy::watch(EventLoop *loop)
+{
+    if (!loop) {
+        ETRACE("invalid event loop");
+        return false;
+    }
+
+    sTimer = loop->addTimer(WATCH_INTERVAL, WATCH_INTERVAL,
+                            timerExpired, NULL);
+    if (sTimer < 0) {
+        ETRACE("failed to create policy watch timer");
+        return false;
+    }
+    sEventLoop = loop;
+    return true;
+}
+
+void TuningPolicy::unwatch()
+{
+    // waits for a running read
+    if (sEventLoop) {
+        sEventLoop->removeTimer(sTimer);
+    }
+    sEventLoop = NULL;
+    sTimer = -1;
+}
+
+void TuningPolicy::timerExpired(int timer, void *data)
+{
+    Values values;
+    getValues(values);
+    Values current = values;
+    read(values, true);
+    if (values.staticThreshold == current.staticThreshold &&
+        values.primaryVsyncOnly == current.primaryVsyncOnly &&
+        !memcmp(values.fpsCaps, current.fpsCaps, sizeof(values.fpsCaps)) &&
+        values.asyncFlip == current.asyncFlip) {
+        return;
+    }
+
+    ITRACE("policy changed: static threshold %u, primary vsync only %d, "
+           "fps caps %u/%u/%u, async flip %d", values.staticThreshold,
+           values.primaryVsyncOnly, values.fpsCaps[0], values.fpsCaps[1],
+           values.fpsCaps[2], values.asyncFlip);
+    sChanges++;
+    publish(values);
+}
+
+void TuningPolicy::getValues(Values& values)
+{
+    int32_t seq;
+    do {
+        seq = android_atomic_acquire_load(&sSeq);
+        values = sValues;
+        android_memory_barrier();
+    } while ((seq & 1) || seq != android_atomic_acquire_load(&sSeq));
+}
+
+uint32_t TuningPolicy::getStaticThreshold()
+{
+    Values values;
+    getValues(values);
+    return values.staticThreshold;
+}
+
+uint32_t TuningPolicy::getFpsCap(int disp)
+{
+    if (disp < 0 || disp >= CAPPED_DISPLAYS) {
+        return 0;
+    }
+
+    Values values;
+    getValues(values);
+    return values.fpsCaps[disp];
+}
+
+bool TuningPolicy::isAsyncFlipAllowed()
+{
+    Values values;
+    getValues(values);
+    return values.asyncFlip;
+}
+
+nsecs_t TuningPolicy::getVideoIdleTime()
+{
+    Values values;
+    getValues(values);
+    return ms2ns(values.videoIdleMs);
+}
+
+void TuningPolicy::dump(Dump& d)
+{
+    Values values;
+    getValues(values);
+
+    if (d.isKeyValue()) {
+        d.section("tuning_policy");
+        d.value("static_threshold", "%u", values.staticThreshold);
+        d.value("primary_vsync_only", "%d", values.primaryVsyncOnly);
+        d.value("buffer_pool", "%u", values.bufferPoolSize);
+        d.value("csc_buffers", "%u", values.cscBuffers);
+        d.value("video_idle_ms", "%u", values.videoIdleMs);
+        d.value("fps_caps", "%u/%u/%u", values.fpsCaps[0],
+                values.fpsCaps[1], values.fpsCaps[2]);
+        d.value("async_flip", "%d", values.asyncFlip);
+        d.value("changes", "%u", sChanges);
+        return;
+    }
+
+    d.append("Tuning policy: static threshold %u, primary vsync only %d, "
+             "buffer pool %u, CSC buffers %u, video idle %u ms, "
+             "fps caps %u/%u/%u, async flip %d, changes %u%s\n",
+             values.staticThreshold, values.primaryVsyncOnly,
+             values.bufferPoolSize, values.cscBuffers, values.videoIdleMs,
+             values.fpsCaps[0],
+             values.fpsCaps[1], values.fpsCaps[2], values.asyncFlip, sChanges,
+             sEventLoop ? "" : " (not watched)");
+}
+
+} // namespace intel
+} // namespace android
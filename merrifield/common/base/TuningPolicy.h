@@ -0,0 +1,113 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef TUNING_POLICY_H
+#define TUNING_POLICY_H
+
+#include <Dump.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+class EventLoop;
+
+// Performance thresholds that can be tuned without a rebuild. The values
+// are read from hwc.policy.* at initialize; the runtime ones are read
+// again by a watcher on the event loop, the others apply from the next
+// start:
+//     hwc.policy.static_threshold     frames without update before a layer
+//                                     is static (runtime)
+//     hwc.policy.primary_vsync_only   no dynamic vsync source (runtime,
+//                                     from the next vsync source choice)
+//     hwc.policy.fps_cap_primary      composition rate cap of each display,
+//     hwc.policy.fps_cap_external     0 for none; video is not capped
+//     hwc.policy.fps_cap_virtual      (runtime, for thermal control)
+//     hwc.policy.async_flip           a full-screen opaque layer of the
+//                                     primary may tear, set by the app
+//                                     policy for games (runtime)
+//     hwc.policy.buffer_pool          buffers cached by the buffer manager
+//     hwc.policy.csc_buffers          CSC buffers of the virtual display
+//     hwc.policy.video_idle_ms        time without video or WiDi before
+//                                     the overlay, rotation, CSC and
+//                                     upscale memory is released, 0 to
+//                                     keep it
+// Values out of range fall back to the default. Readers copy a published
+// snapshot under a sequence count and never block.
+class TuningPolicy {
+public:
+    enum {
+        DEFAULT_STATIC_THRESHOLD = 10,
+        // make the buffer pool large enough
+        DEFAULT_BUFFER_POOL_SIZE = 128,
+        DEFAULT_CSC_BUFFERS = 6,
+        DEFAULT_VIDEO_IDLE_MS = 5000,
+        // bounds of the tunable values
+        MAX_STATIC_THRESHOLD = 999,
+        MIN_BUFFER_POOL_SIZE = 16,
+        MAX_BUFFER_POOL_SIZE = 1024,
+        // two are needed besides the frames held by the sink
+        MIN_CSC_BUFFERS = 3,
+        MAX_CSC_BUFFERS = 12,
+        MAX_VIDEO_IDLE_MS = 600000,
+        MAX_FPS_CAP = 120,
+        // primary, external and virtual display
+        CAPPED_DISPLAYS = 3,
+    };
+
+    struct Values {
+        uint32_t staticThreshold;
+        uint32_t bufferPoolSize;
+        uint32_t cscBuffers;
+        uint32_t videoIdleMs;
+        bool primaryVsyncOnly;
+        // indexed by IDisplayDevice::DEVICE_*
+        uint32_t fpsCaps[CAPPED_DISPLAYS];
+        bool asyncFlip;
+    };
+
+public:
+    // reads all values, before the objects that use them are created
+    static void load();
+    static bool watch(EventLoop *loop);
+    static void unwatch();
+    static void getValues(Values& values);
+    static uint32_t getStaticThreshold();
+    // frames per second allowed on display disp, 0 if not capped
+    static uint32_t getFpsCap(int disp);
+    static bool isAsyncFlipAllowed();
+    // idle time before the video path memory is released, 0 for never
+    static nsecs_t getVideoIdleTime();
+    static void dump(Dump& d);
+
+private:
+    // how often the runtime properties are read again
+    static const nsecs_t WATCH_INTERVAL = 5000000000LL;
+
+    static void read(Values& values, bool runtimeOnly);
+    static void publish(const Values& values);
+    static void timerExpired(int timer, void *data);
+
+    static volatile int32_t sSeq;
+    static Values sValues;
+    static EventLoop *sEventLoop;
+    static int sTimer;
+    static uint32_t sChanges;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* TUNING_POLICY_H */
@@ -0,0 +1,185 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <VaDisplayManager.h>
+#include <va/va_android.h>
+
+namespace android {
+namespace intel {
+
+Mutex VaDisplayManager::sLock;
+Condition VaDisplayManager::sCondition;
+Vector<VaDisplayManager::Entry*> VaDisplayManager::sEntries;
+
+static const char* sPriorityNames[VaDisplayManager::PRIORITY_COUNT] = {
+    "local",
+    "remote",
+};
+
+VaDisplayManager::SubmitLock::SubmitLock(VADisplay display, Priority priority)
+    : mDisplay(display)
+{
+    VaDisplayManager::lock(display, priority);
+}
+
+VaDisplayManager::SubmitLock::~SubmitLock()
+{
+    VaDisplayManager::unlock(mDisplay);
+}
+
+VADisplay VaDisplayManager::acquire(int native)
+{
+    Mutex::Autolock _l(sLock);
+
+    for (size_t i = 0; i < sEntries.size(); i++) {
+        Entry *entry = sEntries.itemAt(i);
+        if (entry->native == native) {
+            entry->users++;
+            return entry->display;
+        }
+    }
+
+    Entry *entry = new Entry;
+    memset(entry, 0, sizeof(*entry));
+    entry->native = native;
+    entry->display = vaGetDisplay(&entry->native);
+    if (entry->display == NULL) {
+        ETRACE("failed to get VADisplay %#x", native);
+        delete entry;
+        return NULL;
+    }
+
+    int major = 0, minor = 0;
+    VAStatus vaStatus = vaInitialize(entry->display, &major, &minor);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaInitialize of display %#x failed. vaStatus = %#x", native, vaStatus);
+        vaTerminate(entry->display);
+        delete entry;
+        return NULL;
+    }
+
+    ITRACE("VA display %#x initialized, version %d.%d", native, major, minor);
+    entry->users = 1;
+    sEntries.push(entry);
+    return entry->display;
+}
+
+void VaDisplayManager::release(VADisplay display)
+{
+    Mutex::Autolock _l(sLock);
+
+    for (size_t i = 0; i < sEntries.size(); i++) {
+        Entry *entry = sEntries.itemAt(i);
+        if (entry->display != display) {
+            continue;
+        }
+
+        if (--entry->users > 0) {
+            return;
+        }
+
+        if (entry->busy) {
+            WTRACE("VA display %#x released during a submission", entry->native);
+        }
+        vaTerminate(entry->display);
+        ITRACE("VA display %#x terminated", entry->native);
+        sEntries.removeAt(i);
+        delete entry;
+        return;
+    }
+
+    WTRACE("VA display %p was not acquired", display);
+}
+
+VaDisplayManager::Entry* VaDisplayManager::find(VADisplay display)
+{
+    for (size_t i = 0; i < sEntries.size(); i++) {
+        if (sEntries.itemAt(i)->display == display) {
+            return sEntries.itemAt(i);
+        }
+    }
+    return NULL;
+}
+
+void VaDisplayManager::lock(VADisplay display, Priority priority)
+{
+    Mutex::Autolock _l(sLock);
+
+    Entry *entry = find(display);
+    if (!entry) {
+        return;
+    }
+
+    if (entry->busy) {
+        entry->contended[priority]++;
+    }
+
+    entry->waiting[priority]++;
+    for (;;) {
+        bool ahead = false;
+        for (int i = 0; i < priority; i++) {
+            if (entry->waiting[i]) {
+                ahead = true;
+                break;
+            }
+        }
+        if (!entry->busy && !ahead) {
+            break;
+        }
+        sCondition.wait(sLock);
+    }
+    entry->waiting[priority]--;
+    entry->busy = true;
+    entry->submits[priority]++;
+}
+
+void VaDisplayManager::unlock(VADisplay display)
+{
+    Mutex::Autolock _l(sLock);
+
+    Entry *entry = find(display);
+    if (!entry) {
+        return;
+    }
+
+    entry->busy = false;
+    sCondition.broadcast();
+}
+
+bool VaDisplayManager::isIdle()
+{
+    Mutex::Autolock _l(sLock);
+    return sEntries.isEmpty();
+}
+
+void VaDisplayManager::dump(Dump& d)
+{
+    Mutex::Autolock _l(sLock);
+
+    d.append("VA displays: %d\n", sEntries.size());
+    for (size_t i = 0; i < sEntries.size(); i++) {
+        Entry *entry = sEntries.itemAt(i);
+        d.append("  display %#x: users %d\n", entry->native, entry->users);
+        for (int j = 0; j < PRIORITY_COUNT; j++) {
+            d.append("    %-8s submits %u, contended %u\n",
+                     sPriorityNames[j], entry->submits[j], entry->contended[j]);
+        }
+    }
+}
+
+} // namespace intel
+} // namespace android
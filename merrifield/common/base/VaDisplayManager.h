@@ -0,0 +1,85 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef VA_DISPLAY_MANAGER_H
+#define VA_DISPLAY_MANAGER_H
+
+#include <utils/Mutex.h>
+#include <utils/Condition.h>
+#include <utils/Vector.h>
+#include <va/va.h>
+#include <Dump.h>
+
+namespace android {
+namespace intel {
+
+// VA displays shared by the video processing clients of the HWC. A display
+// is initialized by its first user and terminated with its last one, so
+// the rotation buffer providers of all overlay planes share one VED
+// display. Picture submissions to a display go through a SubmitLock,
+// which lets the local display clients go ahead of the waiting WiDi ones.
+class VaDisplayManager {
+public:
+    enum Priority {
+        // rotation of the video scanned out on a physical display
+        PRIORITY_LOCAL = 0,
+        // composition for the virtual display
+        PRIORITY_REMOTE,
+        PRIORITY_COUNT,
+    };
+
+    // held from vaBeginPicture() to vaEndPicture()
+    class SubmitLock {
+    public:
+        SubmitLock(VADisplay display, Priority priority);
+        ~SubmitLock();
+    private:
+        VADisplay mDisplay;
+    };
+
+public:
+    // native selects the VA driver, see vaGetDisplay()
+    static VADisplay acquire(int native);
+    static void release(VADisplay display);
+    // no display is initialized, VSP and VED are left to power down
+    static bool isIdle();
+    static void dump(Dump& d);
+
+private:
+    struct Entry {
+        // VA keeps a pointer to the native display
+        int native;
+        VADisplay display;
+        int users;
+        bool busy;
+        int waiting[PRIORITY_COUNT];
+        uint32_t submits[PRIORITY_COUNT];
+        // submissions that found the display busy
+        uint32_t contended[PRIORITY_COUNT];
+    };
+
+    static Entry* find(VADisplay display);
+    static void lock(VADisplay display, Priority priority);
+    static void unlock(VADisplay display);
+
+    static Mutex sLock;
+    static Condition sCondition;
+    static Vector<Entry*> sEntries;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* VA_DISPLAY_MANAGER_H */
@@ -21,6 +21,7 @@
 #include <DisplayPlaneManager.h>
 #include <Hwcomposer.h>
 #include <VsyncManager.h>
+#include <TuningPolicy.h>
 
 
 namespace android {
@@ -32,7 +33,14 @@ VsyncManager::VsyncManager(Hwcomposer &hwc)
       mEnableDynamicVsync(true),
       mEnabled(false),
       mVsyncSource(IDisplayDevice::DEVICE_COUNT),
-      mLock()
+      mLock(),
+      mPendingSource(IDisplayDevice::DEVICE_COUNT),
+      mHandoverVsyncs(0),
+      mHandoverStart(0),
+      mLastVsync(0),
+      mDesiredSource(IDisplayDevice::DEVICE_COUNT),
+      mDesiredSince(0),
+      mSwitches(0)
 {
 }
 
@@ -41,12 +49,24 @@ VsyncManager::~VsyncManager()
     WARN_IF_NOT_DEINIT();
 }
 
+bool VsyncManager::isPrimaryVsyncOnly()
+{
+    // hwc.policy.primary_vsync_only, applies from the next source choice
+    TuningPolicy::Values policy;
+    TuningPolicy::getValues(policy);
+    return policy.primaryVsyncOnly;
+}
+
 bool VsyncManager::initialize()
 {
 
     mEnabled = false;
     mVsyncSource = IDisplayDevice::DEVICE_COUNT;
-    mEnableDynamicVsync = !scUsePrimaryVsyncOnly;
+    mPendingSource = IDisplayDevice::DEVICE_COUNT;
+    mDesiredSource = IDisplayDevice::DEVICE_COUNT;
+    mLastVsync = 0;
+    mSwitches = 0;
+    mEnableDynamicVsync = !isPrimaryVsyncOnly();
     mInitialized = true;
     return true;
 }
@@ -58,8 +78,10 @@ void VsyncManager::deinitialize()
     }
 
     mVsyncSource = IDisplayDevice::DEVICE_COUNT;
+    mPendingSource = IDisplayDevice::DEVICE_COUNT;
+    mDesiredSource = IDisplayDevice::DEVICE_COUNT;
     mEnabled = false;
-    mEnableDynamicVsync = !scUsePrimaryVsyncOnly;
+    mEnableDynamicVsync = !isPrimaryVsyncOnly();
     mInitialized = false;
 }
 
@@ -78,11 +100,15 @@ bool VsyncManager::handleVsyncControl(int disp, bool enabled)
     }
 
     if (!enabled) {
+        cancelHandover();
         disableVsync();
+        mDesiredSource = IDisplayDevice::DEVICE_COUNT;
         mEnabled = false;
         return true;
     } else {
         mEnabled = enableVsync(getCandidate());
+        mDesiredSource = mVsyncSource;
+        mLastVsync = 0;
         return mEnabled;
     }
 
@@ -102,13 +128,7 @@ void VsyncManager::resetVsyncSource()
         return;
     }
 
-    int vsyncSource = getCandidate();
-    if (vsyncSource == mVsyncSource) {
-        return;
-    }
-
-    disableVsync();
-    enableVsync(vsyncSource);
+    requestSource(getCandidate());
 }
 
 int VsyncManager::getVsyncSource()
@@ -116,10 +136,25 @@ int VsyncManager::getVsyncSource()
     return mVsyncSource;
 }
 
+nsecs_t VsyncManager::getNextVsyncTime(nsecs_t after)
+{
+    // the primary model is still good for a while after vsync is disabled
+    int source = mVsyncSource;
+    if (source == IDisplayDevice::DEVICE_COUNT) {
+        source = IDisplayDevice::DEVICE_PRIMARY;
+    }
+
+    IDisplayDevice *device = getDisplayDevice(source);
+    if (!device) {
+        return 0;
+    }
+    return device->getNextVsyncTime(after);
+}
+
 void VsyncManager::enableDynamicVsync(bool enable)
 {
     Mutex::Autolock l(mLock);
-    if (scUsePrimaryVsyncOnly) {
+    if (isPrimaryVsyncOnly()) {
         WTRACE("dynamic vsync is not supported");
         return;
     }
@@ -130,13 +165,137 @@ void VsyncManager::enableDynamicVsync(bool enable)
         return;
     }
 
-    int vsyncSource = getCandidate();
-    if (vsyncSource == mVsyncSource) {
+    requestSource(getCandidate());
+}
+
+bool VsyncManager::onVsync(int disp, int64_t timestamp)
+{
+    Mutex::Autolock l(mLock);
+
+    if (disp == mPendingSource) {
+        mHandoverVsyncs++;
+        // take over once the new source is running steadily and at a
+        // vblank that doesn't come right after the last one reported
+        if (mHandoverVsyncs < HANDOVER_VSYNCS ||
+            timestamp - mLastVsync < HANDOVER_MIN_GAP) {
+            return false;
+        }
+        completeHandover();
+        mLastVsync = timestamp;
+        return true;
+    }
+
+    if (disp != mVsyncSource) {
+        // late event from a source that was just switched off
+        return false;
+    }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (mPendingSource != IDisplayDevice::DEVICE_COUNT &&
+        now - mHandoverStart > HANDOVER_TIMEOUT) {
+        WTRACE("no steady vsync from device %d, switching anyway", mPendingSource);
+        completeHandover();
+    } else if (mDesiredSource != mVsyncSource &&
+               mDesiredSource != mPendingSource &&
+               now - mDesiredSince >= getSwitchHold(mDesiredSource)) {
+        beginHandover(mDesiredSource);
+    }
+
+    mLastVsync = timestamp;
+    return true;
+}
+
+void VsyncManager::dump(Dump& d)
+{
+    Mutex::Autolock l(mLock);
+    d.append("Vsync manager: enabled %d, source %d, pending %d, desired %d, "
+             "switches %u\n",
+             mEnabled, mVsyncSource, mPendingSource, mDesiredSource, mSwitches);
+}
+
+void VsyncManager::requestSource(int candidate)
+{
+    if (candidate == mVsyncSource) {
+        // flipped back before the switch was done
+        cancelHandover();
+        mDesiredSource = candidate;
+        return;
+    }
+
+    IDisplayDevice *device = getDisplayDevice(mVsyncSource);
+    if (!device || !device->isConnected()) {
+        // nothing to hand over from, e.g. HDMI is unplugged
+        cancelHandover();
+        disableVsync();
+        enableVsync(candidate);
+        mDesiredSource = mVsyncSource;
+        mSwitches++;
+        return;
+    }
+
+    if (candidate != mDesiredSource) {
+        mDesiredSource = candidate;
+        mDesiredSince = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+
+    // otherwise the switch starts at a vsync after the hold time
+    if (getSwitchHold(candidate) == 0) {
+        beginHandover(candidate);
+    }
+}
+
+void VsyncManager::beginHandover(int candidate)
+{
+    if (mPendingSource == candidate) {
         return;
     }
+    cancelHandover();
 
+    IDisplayDevice *device = getDisplayDevice(candidate);
+    if (!device || !device->vsyncControl(true)) {
+        WTRACE("failed to enable vsync on display %d, keep using %d",
+               candidate, mVsyncSource);
+        // don't retry on every vsync
+        mDesiredSource = mVsyncSource;
+        return;
+    }
+
+    VTRACE("vsync handover from %d to %d", mVsyncSource, candidate);
+    mPendingSource = candidate;
+    mHandoverVsyncs = 0;
+    mHandoverStart = systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+void VsyncManager::cancelHandover()
+{
+    if (mPendingSource == IDisplayDevice::DEVICE_COUNT) {
+        return;
+    }
+
+    IDisplayDevice *device = getDisplayDevice(mPendingSource);
+    if (device && !device->vsyncControl(false)) {
+        WTRACE("failed to disable vsync on device %d", mPendingSource);
+    }
+    mPendingSource = IDisplayDevice::DEVICE_COUNT;
+}
+
+void VsyncManager::completeHandover()
+{
+    int source = mPendingSource;
+    mPendingSource = IDisplayDevice::DEVICE_COUNT;
     disableVsync();
-    enableVsync(vsyncSource);
+    mVsyncSource = source;
+    mSwitches++;
+    ITRACE("vsync source switched to %d", source);
+}
+
+nsecs_t VsyncManager::getSwitchHold(int candidate) const
+{
+    if (candidate == IDisplayDevice::DEVICE_VIRTUAL ||
+        mVsyncSource == IDisplayDevice::DEVICE_VIRTUAL) {
+        return VIRTUAL_SWITCH_HOLD;
+    }
+    return 0;
 }
 
 IDisplayDevice* VsyncManager::getDisplayDevice(int dispType ) {
@@ -145,7 +304,7 @@ IDisplayDevice* VsyncManager::getDisplayDevice(int dispType ) {
 
 int VsyncManager::getCandidate()
 {
-    if (!mEnableDynamicVsync) {
+    if (!mEnableDynamicVsync || isPrimaryVsyncOnly()) {
         return IDisplayDevice::DEVICE_PRIMARY;
     }
 
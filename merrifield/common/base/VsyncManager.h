@@ -16,8 +16,10 @@
 #ifndef VSYNC_MANAGER_H
 #define VSYNC_MANAGER_H
 
+#include <Dump.h>
 #include <IDisplayDevice.h>
 #include <utils/threads.h>
+#include <utils/Timers.h>
 
 namespace android {
 namespace intel {
@@ -36,13 +38,26 @@ public:
     bool handleVsyncControl(int disp, bool enabled);
     void resetVsyncSource();
     int getVsyncSource();
+    // predicted next vblank of the vsync source, 0 if unknown
+    nsecs_t getNextVsyncTime(nsecs_t after);
+    bool isVsyncEnabled() const { return mEnabled; }
     void enableDynamicVsync(bool enable);
+    // called for every vsync event, returns false if the event is not
+    // from the source reported to SurfaceFlinger
+    bool onVsync(int disp, int64_t timestamp);
+    void dump(Dump& d);
 
 private:
     inline int getCandidate();
     inline bool enableVsync(int candidate);
     inline void disableVsync();
     IDisplayDevice* getDisplayDevice(int dispType);
+    void requestSource(int candidate);
+    void beginHandover(int candidate);
+    void cancelHandover();
+    void completeHandover();
+    nsecs_t getSwitchHold(int candidate) const;
+    static bool isPrimaryVsyncOnly();
 
 private:
     Hwcomposer &mHwc;
@@ -52,9 +67,29 @@ private:
     int  mVsyncSource;
     Mutex mLock;
 
+    // a new source runs next to the current one until it has delivered a
+    // few vsyncs, then takes over at a vblank that keeps the spacing
+    int mPendingSource;
+    uint32_t mHandoverVsyncs;
+    nsecs_t mHandoverStart;
+    nsecs_t mLastVsync;
+    // the source getCandidate() asked for and since when
+    int mDesiredSource;
+    nsecs_t mDesiredSince;
+    uint32_t mSwitches;
+
 private:
-    // toggle this constant to use primary vsync only or enable dynamic vsync.
-    static const bool scUsePrimaryVsyncOnly = false;
+    enum {
+        // vsyncs from the new source before it takes over
+        HANDOVER_VSYNCS = 3,
+    };
+    // the new source also takes over if its vsyncs don't come
+    static const nsecs_t HANDOVER_TIMEOUT = 250000000;
+    // closest a vsync of the new source may follow the last reported one
+    static const nsecs_t HANDOVER_MIN_GAP = 8000000;
+    // switches to or from the virtual display wait this long, video
+    // extended mode may flip back and forth
+    static const nsecs_t VIRTUAL_SWITCH_HOLD = 1000000000;
 };
 
 } // namespace intel
@@ -20,77 +20,251 @@ namespace android {
 namespace intel {
 
 BufferCache::BufferCache(int size)
+    : mSlots(NULL),
+      mCapacity(0),
+      mSize(0),
+      mDeleted(0),
+      mHead(-1),
+      mTail(-1)
 {
-    mBufferPool.setCapacity(size);
+    // keep load factor under 1/2, capacity must be power of 2
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t)size * 2) {
+        capacity <<= 1;
+    }
+
+    if (!resize(capacity)) {
+        ETRACE("failed to allocate buffer cache slots");
+    }
 }
 
 BufferCache::~BufferCache()
 {
-    if (mBufferPool.size() != 0) {
-        ETRACE("buffer cache is not empty");
+    if (mSize != 0) {
+        ETRACE("buffer cache is not empty, %u mappers left", mSize);
+        for (int cur = mHead; cur >= 0; cur = mSlots[cur].next) {
+            ETRACE("  buffer %#llx, refCount %d",
+                   mSlots[cur].key, mSlots[cur].mapper->getRef());
+        }
+    }
+    delete [] mSlots;
+    mSlots = NULL;
+}
+
+uint32_t BufferCache::hash(uint64_t key)
+{
+    // gralloc keys are pointers or ids with low entropy in the low bits,
+    // mix all bits before masking
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+int BufferCache::findSlot(uint64_t key) const
+{
+    if (!mSlots) {
+        return -1;
+    }
+
+    uint32_t mask = mCapacity - 1;
+    uint32_t i = hash(key) & mask;
+    for (uint32_t probe = 0; probe < mCapacity; probe++) {
+        const Slot& slot = mSlots[i];
+        if (slot.state == SLOT_EMPTY) {
+            return -1;
+        }
+        if (slot.state == SLOT_USED && slot.key == key) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+bool BufferCache::resize(uint32_t capacity)
+{
+    Slot *slots = new Slot[capacity];
+    if (!slots) {
+        return false;
+    }
+
+    memset(slots, 0, sizeof(Slot) * capacity);
+    for (uint32_t i = 0; i < capacity; i++) {
+        slots[i].state = SLOT_EMPTY;
+        slots[i].prev = -1;
+        slots[i].next = -1;
+    }
+
+    Slot *oldSlots = mSlots;
+    int oldTail = mTail;
+
+    mSlots = slots;
+    mCapacity = capacity;
+    mSize = 0;
+    mDeleted = 0;
+    mHead = -1;
+    mTail = -1;
+
+    // re-insert from least to most recently used to keep LRU order
+    uint32_t mask = capacity - 1;
+    for (int cur = oldTail; cur >= 0; cur = oldSlots[cur].prev) {
+        uint32_t i = hash(oldSlots[cur].key) & mask;
+        while (mSlots[i].state != SLOT_EMPTY) {
+            i = (i + 1) & mask;
+        }
+        mSlots[i].key = oldSlots[cur].key;
+        mSlots[i].mapper = oldSlots[cur].mapper;
+        mSlots[i].state = SLOT_USED;
+        linkFront(i);
+        mSize++;
+    }
+
+    delete [] oldSlots;
+    return true;
+}
+
+void BufferCache::linkFront(int slot)
+{
+    mSlots[slot].prev = -1;
+    mSlots[slot].next = mHead;
+    if (mHead >= 0) {
+        mSlots[mHead].prev = slot;
+    }
+    mHead = slot;
+    if (mTail < 0) {
+        mTail = slot;
+    }
+}
+
+void BufferCache::unlink(int slot)
+{
+    int prev = mSlots[slot].prev;
+    int next = mSlots[slot].next;
+
+    if (prev >= 0) {
+        mSlots[prev].next = next;
+    } else {
+        mHead = next;
+    }
+
+    if (next >= 0) {
+        mSlots[next].prev = prev;
+    } else {
+        mTail = prev;
     }
-    mBufferPool.clear();
+
+    mSlots[slot].prev = -1;
+    mSlots[slot].next = -1;
 }
 
 bool BufferCache::addMapper(uint64_t handle, BufferMapper* mapper)
 {
-    ssize_t index = mBufferPool.indexOfKey(handle);
-    if (index >= 0) {
+    if (findSlot(handle) >= 0) {
         ETRACE("buffer %#llx exists", handle);
         return false;
     }
 
-    // add mapper
-    index = mBufferPool.add(handle, mapper);
-    if (index < 0) {
-        ETRACE("failed to add mapper. err = %d", (int)index);
-        return false;
+    // grow (or purge tombstones) before load factor exceeds 1/2
+    if (!mSlots || (mSize + mDeleted + 1) * 2 > mCapacity) {
+        uint32_t capacity = mCapacity ? mCapacity : 16;
+        if ((mSize + 1) * 2 > capacity) {
+            capacity <<= 1;
+        }
+        if (!resize(capacity)) {
+            ETRACE("failed to add mapper. out of memory");
+            return false;
+        }
+    }
+
+    uint32_t mask = mCapacity - 1;
+    uint32_t i = hash(handle) & mask;
+    while (mSlots[i].state == SLOT_USED) {
+        i = (i + 1) & mask;
     }
 
+    if (mSlots[i].state == SLOT_DELETED) {
+        mDeleted--;
+    }
+    mSlots[i].key = handle;
+    mSlots[i].mapper = mapper;
+    mSlots[i].state = SLOT_USED;
+    linkFront(i);
+    mSize++;
     return true;
 }
 
 bool BufferCache::removeMapper(BufferMapper* mapper)
 {
-    ssize_t index;
-
     if (!mapper) {
         ETRACE("invalid mapper");
         return false;
     }
 
-    index = mBufferPool.removeItem(mapper->getKey());
-    if (index < 0) {
-        WTRACE("failed to remove mapper. err = %d", (int)index);
+    int slot = findSlot(mapper->getKey());
+    if (slot < 0) {
+        WTRACE("failed to remove mapper. key %#llx", mapper->getKey());
         return false;
     }
 
+    unlink(slot);
+    mSlots[slot].mapper = NULL;
+    mSlots[slot].state = SLOT_DELETED;
+    mSize--;
+    mDeleted++;
     return true;
 }
 
 BufferMapper* BufferCache::getMapper(uint64_t handle)
 {
-    ssize_t index = mBufferPool.indexOfKey(handle);
-    if (index < 0) {
+    int slot = findSlot(handle);
+    if (slot < 0) {
         // don't add ETRACE here as this condition will happen frequently
         return 0;
     }
-    return mBufferPool.valueAt(index);
+
+    if (slot != mHead) {
+        unlink(slot);
+        linkFront(slot);
+    }
+    return mSlots[slot].mapper;
 }
 
 size_t BufferCache::getCacheSize() const
 {
-    return mBufferPool.size();
+    return mSize;
 }
 
 BufferMapper* BufferCache::getMapper(uint32_t index)
 {
-    if (index >= mBufferPool.size()) {
+    if (index >= mSize) {
         ETRACE("invalid index");
         return 0;
     }
-    BufferMapper* mapper = mBufferPool.valueAt(index);
-    return mapper;
+
+    int cur = mHead;
+    while (index-- && cur >= 0) {
+        cur = mSlots[cur].next;
+    }
+    return (cur >= 0) ? mSlots[cur].mapper : 0;
+}
+
+BufferMapper* BufferCache::getLRUMapper() const
+{
+    return (mTail >= 0) ? mSlots[mTail].mapper : 0;
+}
+
+void BufferCache::forEachMapper(MapperFunc func, void *data) const
+{
+    // the next link is read first, func may delete the mapper
+    int cur = mHead;
+    while (cur >= 0) {
+        int next = mSlots[cur].next;
+        func(mSlots[cur].mapper, data);
+        cur = next;
+    }
 }
 
 } // namespace intel
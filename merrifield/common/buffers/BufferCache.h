@@ -16,13 +16,15 @@
 #ifndef BUFFERCACHE_H_
 #define BUFFERCACHE_H_
 
-#include <utils/KeyedVector.h>
 #include <BufferMapper.h>
 
 namespace android {
 namespace intel {
 
 // Generic buffer cache
+// Mappers are kept in an open addressing hash table keyed by buffer key,
+// so lookup, insertion and removal are constant time. Entries are also
+// linked in most-recently-used order, index based access walks that list.
 class BufferCache {
 public:
     BufferCache(int size);
@@ -31,14 +33,48 @@ public:
     virtual bool addMapper(uint64_t handle, BufferMapper* mapper);
     //remove mapper
     virtual bool removeMapper(BufferMapper* mapper);
-    // get a buffer mapper
+    // get a buffer mapper, marks it as most recently used
     virtual BufferMapper* getMapper(uint64_t handle);
     // get cache size
     virtual size_t getCacheSize() const;
-    // get mapper with an index
+    // get mapper with an index, index 0 is the most recently used one
     virtual BufferMapper* getMapper(uint32_t index);
+    // get the least recently used mapper
+    virtual BufferMapper* getLRUMapper() const;
+    // calls func on every mapper, most recently used first, in one walk
+    // of the list. func must not add or remove mappers.
+    typedef void (*MapperFunc)(BufferMapper *mapper, void *data);
+    virtual void forEachMapper(MapperFunc func, void *data) const;
+
+private:
+    enum {
+        SLOT_EMPTY = 0,
+        SLOT_USED,
+        SLOT_DELETED,
+    };
+
+    struct Slot {
+        uint64_t key;
+        BufferMapper *mapper;
+        int state;
+        // LRU links, indices into mSlots
+        int prev;
+        int next;
+    };
+
+    static uint32_t hash(uint64_t key);
+    int findSlot(uint64_t key) const;
+    bool resize(uint32_t capacity);
+    void linkFront(int slot);
+    void unlink(int slot);
+
 private:
-    KeyedVector<uint64_t, BufferMapper*> mBufferPool;
+    Slot *mSlots;
+    uint32_t mCapacity;
+    uint32_t mSize;
+    uint32_t mDeleted;
+    int mHead;
+    int mTail;
 };
 
 }
@@ -14,10 +14,21 @@
 // limitations under the License.
 */
 
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <HwcTrace.h>
 #include <hardware/hwcomposer.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <sync/sync.h>
 #include <BufferManager.h>
+#include <BufferTracer.h>
+#include <GraphicBuffer.h>
 #include <DrmConfig.h>
+#include <MemoryAccounting.h>
+#include <TuningPolicy.h>
+#include <hal_public.h>
 
 namespace android {
 namespace intel {
@@ -26,12 +37,40 @@ BufferManager::BufferManager()
     : mGrallocModule(NULL),
       mAllocDev(NULL),
       mFrameBuffers(),
+      mFrameBufferPool(),
+      mFrameBufferPoolBytes(0),
+      mFrameBufferReuses(0),
       mBufferPool(NULL),
-      mDataBuffer(NULL),
-      mDataBufferLock(),
+      mPremapped(),
+      mPremapCount(0),
+      mDeferredUnmaps(),
+      mUnmapPending(false),
+      mLastReclaim(0),
+      mUnmapCount(0),
+      mResurrectCount(0),
+      mUpgradeCount(0),
+      mMappingBudget(0),
+      mMappedBytes(0),
+      mMappedPeak(0),
+      mOverBudget(false),
+      mTracer(NULL),
+      mExitThread(false),
+      mMapWorkers(NULL),
+      mBatchCount(0),
+      mBatchMapped(0),
       mInitialized(false)
 {
     CTRACE();
+
+    for (int i = 0; i < DATA_BUFFER_POOL_SIZE; i++) {
+        mDataBuffers[i] = NULL;
+        mDataBufferBusy[i] = 0;
+    }
+
+    memset(mAttributes, 0, sizeof(mAttributes));
+    mAttributeHits = 0;
+    mAttributeMisses = 0;
+    memset(mOwnerBytes, 0, sizeof(mOwnerBytes));
 }
 
 BufferManager::~BufferManager()
@@ -49,7 +88,9 @@ bool BufferManager::initialize()
     CTRACE();
 
     // create buffer pool
-    mBufferPool = new BufferCache(DEFAULT_BUFFER_POOL_SIZE);
+    TuningPolicy::Values policy;
+    TuningPolicy::getValues(policy);
+    mBufferPool = new BufferCache(policy.bufferPoolSize);
     if (!mBufferPool) {
         ETRACE("failed to create gralloc buffer cache");
         return false;
@@ -67,11 +108,54 @@ bool BufferManager::initialize()
         WTRACE("failed to open alloc device");
     }
 
-    // create a dummy data buffer
-    mDataBuffer = createDataBuffer(0);
-    if (!mDataBuffer) {
-        DEINIT_AND_RETURN_FALSE("failed to create data buffer");
+    // create dummy data buffers
+    for (int i = 0; i < DATA_BUFFER_POOL_SIZE; i++) {
+        mDataBuffers[i] = createDataBuffer(0);
+        if (!mDataBuffers[i]) {
+            DEINIT_AND_RETURN_FALSE("failed to create data buffer");
+        }
+        mDataBufferBusy[i] = 0;
+    }
+
+    memset(mAttributes, 0, sizeof(mAttributes));
+    mAttributeHits = 0;
+    mAttributeMisses = 0;
+
+    char prop[PROPERTY_VALUE_MAX];
+    uint32_t budget = DEFAULT_MAPPING_BUDGET;
+    if (property_get("hwc.gtt.budget", prop, NULL) > 0 && atoi(prop) > 0) {
+        budget = atoi(prop);
     }
+    mMappingBudget = (uint64_t)budget << 20;
+    mMappedBytes = 0;
+    mMappedPeak = 0;
+    mOverBudget = false;
+    memset(mOwnerBytes, 0, sizeof(mOwnerBytes));
+
+    mTracer = new BufferTracer();
+    if (!mTracer || !mTracer->initialize()) {
+        DEINIT_AND_RETURN_FALSE("failed to create buffer tracer");
+    }
+
+    startWorker();
+
+    int workers = DEFAULT_MAP_WORKERS;
+    if (property_get("hwc.map.workers", prop, NULL) > 0) {
+        workers = atoi(prop);
+        if (workers < 0)
+            workers = 0;
+        if (workers > MAP_WORKERS_MAX)
+            workers = MAP_WORKERS_MAX;
+    }
+    if (workers) {
+        mMapWorkers = new MapWorkerPool();
+        if (!mMapWorkers || !mMapWorkers->initialize(workers)) {
+            WTRACE("failed to create map workers, mapping on one thread");
+            DEINIT_AND_DELETE_OBJ(mMapWorkers);
+        }
+    }
+    mBatchCount = 0;
+    mBatchMapped = 0;
 
     mInitialized = true;
     return true;
@@ -81,63 +165,285 @@ void BufferManager::deinitialize()
 {
     mInitialized = false;
 
+    stopWorker();
+    releasePremapped();
+    DEINIT_AND_DELETE_OBJ(mMapWorkers);
+    // deferred mappers are still in the pool, unmapped with it below
+    mDeferredUnmaps.clear();
+    mUnmapPending = false;
+
+    if (mTracer) {
+        int leaks = mTracer->checkLeaks();
+        if (leaks) {
+            WTRACE("%d buffers still referenced on deinitialize", leaks);
+        }
+    }
+
     if (mBufferPool) {
         // unmap & delete all cached buffer mappers
-        for (size_t i = 0; i < mBufferPool->getCacheSize(); i++) {
-            BufferMapper *mapper = mBufferPool->getMapper(i);
-            mapper->unmap();
-            delete mapper;
-        }
+        mBufferPool->forEachMapper(destroyMapper, NULL);
 
         delete mBufferPool;
         mBufferPool = NULL;
     }
 
     for (size_t j = 0; j < mFrameBuffers.size(); j++) {
-        BufferMapper *mapper = mFrameBuffers.valueAt(j);
+        BufferMapper *mapper = mFrameBuffers.valueAt(j).mapper;
+        MemoryAccounting::remove(MemoryAccounting::FRAME_BUFFER,
+                                 mFrameBuffers.valueAt(j).bytes);
         mapper->unmap();
         delete mapper;
     }
     mFrameBuffers.clear();
 
+    while (mFrameBufferPool.size()) {
+        releaseFrameBuffer(mFrameBufferPool.editItemAt(0));
+        mFrameBufferPool.removeAt(0);
+    }
+    mFrameBufferPoolBytes = 0;
+
+    DEINIT_AND_DELETE_OBJ(mTracer);
+
     if (mAllocDev) {
         gralloc_close(mAllocDev);
         mAllocDev = NULL;
     }
 
-    if (mDataBuffer) {
-        delete mDataBuffer;
-        mDataBuffer = NULL;
+    for (int i = 0; i < DATA_BUFFER_POOL_SIZE; i++) {
+        if (mDataBufferBusy[i]) {
+            WTRACE("data buffer %d is still locked", i);
+        }
+        delete mDataBuffers[i];
+        mDataBuffers[i] = NULL;
+        mDataBufferBusy[i] = 0;
     }
 }
 
 void BufferManager::dump(Dump& d)
 {
-    d.append("Buffer Manager status: pool size %d\n", mBufferPool->getCacheSize());
-    d.append("-------------------------------------------------------------\n");
-    for (uint32_t i = 0; i < mBufferPool->getCacheSize(); i++) {
-        BufferMapper *mapper = mBufferPool->getMapper(i);
-        d.append("Buffer %d: handle %#x, (%dx%d), format %d, refCount %d\n",
-                 i,
-                 mapper->getHandle(),
-                 mapper->getWidth(),
-                 mapper->getHeight(),
-                 mapper->getFormat(),
-                 mapper->getRef());
+    {
+        // the pool is changed by map and unmap under mLock
+        Mutex::Autolock _l(mLock);
+        d.append("Buffer Manager status: pool size %d\n", mBufferPool->getCacheSize());
+        d.append("-------------------------------------------------------------\n");
+        MapperDump dump = { &d, 0 };
+        mBufferPool->forEachMapper(dumpMapper, &dump);
+    }
+    d.append("Buffer attribute cache: hits %u, misses %u\n",
+             mAttributeHits, mAttributeMisses);
+    d.append("Frame buffers: %d in use, %d pooled (%llu KB), reused %u times\n",
+             mFrameBuffers.size(), mFrameBufferPool.size(),
+             mFrameBufferPoolBytes >> 10, mFrameBufferReuses);
+
+    {
+        Mutex::Autolock _l(mWorkerLock);
+        d.append("Premapped buffers: %d, mapped in total %u\n",
+                 mPremapped.size(), mPremapCount);
     }
+    d.append("Map batches: %u, new mappings %u, %d workers\n",
+             mBatchCount, mBatchMapped,
+             mMapWorkers ? mMapWorkers->getWorkerCount() : 0);
+    // mLock is taken before mWorkerLock everywhere
+    dumpMappings(d);
     return;
 }
 
+void BufferManager::dumpMappings(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("Deferred unmaps: pending %d, unmapped %u, resurrected %u, "
+             "upgraded %u\n", mDeferredUnmaps.size(), mUnmapCount,
+             mResurrectCount, mUpgradeCount);
+
+    // the mapped pages against the range of the aperture they are spread over
+    GttSpread spread = { ~0ULL, 0, 0 };
+    mBufferPool->forEachMapper(addGttSpread, &spread);
+    uint64_t pages = spread.pages;
+    uint64_t span = pages ? spread.highest - spread.lowest : 0;
+    int fragmentation = span ? (int)(100 - pages * 100 / span) : 0;
+    int64_t headroom = (int64_t)mMappingBudget - (int64_t)mMappedBytes;
+
+    d.append("GTT mappings: %llu KB, peak %llu KB, budget %llu KB, headroom %lld KB%s\n",
+             mMappedBytes >> 10, mMappedPeak >> 10, mMappingBudget >> 10,
+             headroom / 1024, mOverBudget ? " (over budget)" : "");
+    d.append("  spread over %llu KB of aperture, fragmentation %d%%\n",
+             span * GTT_PAGE_SIZE >> 10, fragmentation);
+    for (int i = 0; i < MAPPING_OWNER_MAX; i++) {
+        d.append("  %-8s referencing %lld KB\n", getOwnerName(i), mOwnerBytes[i] >> 10);
+    }
+
+    if (mTracer && mTracer->isEnabled()) {
+        mTracer->dump(d);
+        char path[PROPERTY_VALUE_MAX];
+        if (property_get("hwc.buffer.trace.file", path, NULL) > 0) {
+            mTracer->exportTo(path);
+        }
+    }
+}
+
+const char* BufferManager::getOwnerName(int owner)
+{
+    static const char* ownerNames[MAPPING_OWNER_MAX] = {
+        "planes", "layers", "virtual", "premap",
+    };
+    if (owner < 0 || owner >= MAPPING_OWNER_MAX) {
+        return "unknown";
+    }
+    return ownerNames[owner];
+}
+
+int BufferManager::getOwnerProfile(int owner)
+{
+    switch (owner) {
+    case MAPPING_OWNER_LAYER:
+    case MAPPING_OWNER_VIRTUAL:
+        return BufferMapper::PROFILE_CPU;
+    default:
+        return BufferMapper::PROFILE_DISPLAY;
+    }
+}
+
 DataBuffer* BufferManager::lockDataBuffer(buffer_handle_t handle)
 {
-    mDataBufferLock.lock();
-    mDataBuffer->resetBuffer(handle);
-    return mDataBuffer;
+    // claim a free pooled object, no lock is held while it is in use
+    for (int i = 0; i < DATA_BUFFER_POOL_SIZE; i++) {
+        if (mDataBufferBusy[i] || !mDataBuffers[i]) {
+            continue;
+        }
+        if (android_atomic_acquire_cas(0, 1, &mDataBufferBusy[i]) == 0) {
+            mDataBuffers[i]->resetBuffer(handle);
+            return mDataBuffers[i];
+        }
+    }
+
+    // pool exhausted, this is not expected on the hot path
+    VTRACE("data buffer pool exhausted, allocating one");
+    return createDataBuffer(handle);
 }
 
 void BufferManager::unlockDataBuffer(DataBuffer *buffer)
 {
-    mDataBufferLock.unlock();
+    if (!buffer) {
+        return;
+    }
+
+    for (int i = 0; i < DATA_BUFFER_POOL_SIZE; i++) {
+        if (mDataBuffers[i] == buffer) {
+            android_atomic_release_store(0, &mDataBufferBusy[i]);
+            return;
+        }
+    }
+
+    // allocated when pool was exhausted
+    delete buffer;
+}
+
+void BufferManager::destroyMapper(BufferMapper *mapper, void *data)
+{
+    mapper->unmap();
+    delete mapper;
+}
+
+void BufferManager::dumpMapper(BufferMapper *mapper, void *data)
+{
+    MapperDump *dump = (MapperDump *)data;
+    dump->d->append("Buffer %d: handle %#x, (%dx%d), format %d, refCount %d\n",
+                    dump->index++,
+                    mapper->getHandle(),
+                    mapper->getWidth(),
+                    mapper->getHeight(),
+                    mapper->getFormat(),
+                    mapper->getRef());
+}
+
+void BufferManager::addGttSpread(BufferMapper *mapper, void *data)
+{
+    GttSpread *spread = (GttSpread *)data;
+    if (!(mapper->getMappedProfile() & BufferMapper::PROFILE_GTT)) {
+        return;
+    }
+    for (int j = 0; j < MAPPER_SUB_BUFFER_MAX; j++) {
+        uint32_t size = mapper->getSize(j);
+        if (!size) {
+            continue;
+        }
+        uint64_t start = mapper->getGttOffsetInPage(j);
+        uint64_t end = start + ((size + GTT_PAGE_SIZE - 1) / GTT_PAGE_SIZE);
+        spread->lowest = start < spread->lowest ? start : spread->lowest;
+        spread->highest = end > spread->highest ? end : spread->highest;
+        spread->pages += end - start;
+    }
+}
+
+static inline bool isSameBuffer(BufferMapper& mapper, DataBuffer& buffer)
+{
+    return mapper.getFormat() == buffer.getFormat() &&
+           mapper.getWidth() == buffer.getWidth() &&
+           mapper.getHeight() == buffer.getHeight() &&
+           !memcmp(&mapper.getStride(), &buffer.getStride(), sizeof(stride_t));
+}
+
+static inline uint64_t buffer_stamp(buffer_handle_t handle)
+{
+    return reinterpret_cast<const IMG_native_handle_t*>(handle)->ui64Stamp;
+}
+
+static inline uint32_t attribute_slot(buffer_handle_t handle)
+{
+    // handles are heap allocated, drop the alignment bits
+    return (uint32_t)(((uintptr_t)handle >> 4) ^ ((uintptr_t)handle >> 10));
+}
+
+bool BufferManager::getBufferAttributes(buffer_handle_t handle,
+                                        BufferAttributes& attributes)
+{
+    if (!handle) {
+        return false;
+    }
+
+    uint64_t stamp = buffer_stamp(handle);
+    BufferAttributes *entry = &mAttributes[attribute_slot(handle) % ATTRIBUTE_CACHE_SIZE];
+    {
+        Mutex::Autolock _l(mAttributeLock);
+        if (entry->handle == handle && entry->stamp == stamp) {
+            attributes = *entry;
+            mAttributeHits++;
+            return true;
+        }
+        mAttributeMisses++;
+    }
+
+    DataBufferLocker locker(this, handle);
+    DataBuffer *buffer = locker.get();
+    if (!buffer) {
+        ETRACE("failed to get buffer");
+        return false;
+    }
+
+    GraphicBuffer *gBuffer = (GraphicBuffer*)buffer;
+    attributes.handle = handle;
+    attributes.stamp = stamp;
+    attributes.format = buffer->getFormat();
+    attributes.width = buffer->getWidth();
+    attributes.height = buffer->getHeight();
+    attributes.usage = gBuffer->getUsage();
+    attributes.stride = buffer->getStride();
+    attributes.isProtected = GraphicBuffer::isProtectedBuffer(gBuffer);
+    attributes.isCompressed = GraphicBuffer::isCompressionBuffer(gBuffer);
+
+    // a colliding buffer simply takes the slot over
+    Mutex::Autolock _l(mAttributeLock);
+    *entry = attributes;
+    return true;
+}
+
+void BufferManager::invalidateBufferAttributes(buffer_handle_t handle)
+{
+    Mutex::Autolock _l(mAttributeLock);
+    BufferAttributes *entry = &mAttributes[attribute_slot(handle) % ATTRIBUTE_CACHE_SIZE];
+    if (entry->handle == handle) {
+        memset(entry, 0, sizeof(*entry));
+    }
 }
 
 DataBuffer* BufferManager::get(buffer_handle_t handle)
@@ -150,18 +456,17 @@ void BufferManager::put(DataBuffer *buffer)
     delete buffer;
 }
 
-BufferMapper* BufferManager::map(DataBuffer& buffer)
+BufferMapper* BufferManager::map(DataBuffer& buffer, int owner)
 {
     bool ret;
     BufferMapper* mapper;
 
     CTRACE();
+    STRACE();
     Mutex::Autolock _l(mLock);
     //try to get mapper from pool
-    mapper = mBufferPool->getMapper(buffer.getKey());
+    mapper = takeMapper(buffer, owner);
     if (mapper) {
-        // increase mapper ref count
-        mapper->incRef();
         return mapper;
     }
 
@@ -173,20 +478,23 @@ BufferMapper* BufferManager::map(DataBuffer& buffer)
             ETRACE("failed to allocate mapper");
             break;
         }
+        mapper->setProfile(getOwnerProfile(owner));
         ret = mapper->map();
+        if (!ret && mDeferredUnmaps.size()) {
+            // the aperture may be full of mappings nobody uses any more
+            WTRACE("failed to map, retrying after flushing deferred unmaps");
+            flushDeferredUnmaps();
+            ret = mapper->map();
+        }
         if (!ret) {
             ETRACE("failed to map");
             delete mapper;
             mapper = NULL;
             break;
         }
-        ret = mBufferPool->addMapper(buffer.getKey(), mapper);
-        if (!ret) {
-            ETRACE("failed to add mapper");
+        if (!addMapper(mapper, owner)) {
             break;
         }
-        // increase mapper ref count
-        mapper->incRef();
         return mapper;
     } while (0);
 
@@ -198,7 +506,185 @@ BufferMapper* BufferManager::map(DataBuffer& buffer)
     return NULL;
 }
 
-void BufferManager::unmap(BufferMapper *mapper)
+BufferMapper* BufferManager::takeMapper(DataBuffer& buffer, int owner)
+{
+    BufferMapper *mapper = mBufferPool->getMapper(buffer.getKey());
+    if (mapper && !mapper->getRef()) {
+        // waiting for a deferred unmap, take it back
+        cancelDeferredUnmap(mapper);
+        if (isSameBuffer(*mapper, buffer)) {
+            mResurrectCount++;
+        } else {
+            // the handle now belongs to another buffer
+            mBufferPool->removeMapper(mapper);
+            removeMapping(mapper);
+            mapper->unmap();
+            delete mapper;
+            mapper = NULL;
+        }
+    }
+    if (mapper && !upgradeMapper(mapper, owner)) {
+        if (!mapper->getRef()) {
+            mBufferPool->removeMapper(mapper);
+            removeMapping(mapper);
+            mapper->unmap();
+            delete mapper;
+        }
+        return NULL;
+    }
+    if (mapper) {
+        // increase mapper ref count
+        mapper->incRef();
+        mOwnerBytes[owner] += getOwnerBytes(mapper, owner);
+        mTracer->onReference(mapper->getKey(), owner, 1);
+    }
+    return mapper;
+}
+
+bool BufferManager::upgradeMapper(BufferMapper *mapper, int owner)
+{
+    int mapped = mapper->getMappedProfile();
+    int profile = getOwnerProfile(owner);
+    if ((mapped & profile) == profile) {
+        return true;
+    }
+
+    mapper->setProfile(mapped | profile);
+    if (!mapper->map()) {
+        ETRACE("failed to map %#x more of buffer %#llx", profile & ~mapped,
+               mapper->getKey());
+        return false;
+    }
+    if (!(mapped & BufferMapper::PROFILE_GTT)) {
+        // a CPU mapping now takes aperture space as well
+        addMappedBytes(getMappedBytes(mapper));
+    }
+    mUpgradeCount++;
+    return true;
+}
+
+bool BufferManager::addMapper(BufferMapper *mapper, int owner)
+{
+    if (!mBufferPool->addMapper(mapper->getKey(), mapper)) {
+        ETRACE("failed to add mapper");
+        return false;
+    }
+    addMapping(mapper);
+    if (mOverBudget) {
+        flushDeferredUnmaps();
+    }
+    // increase mapper ref count
+    mapper->incRef();
+    mOwnerBytes[owner] += getOwnerBytes(mapper, owner);
+    mTracer->onReference(mapper->getKey(), owner, 1);
+    return true;
+}
+
+size_t BufferManager::mapBatch(const buffer_handle_t *handles, size_t count,
+                               BufferMapper **mappers, int owner)
+{
+    BufferMapper *fresh[MAP_BATCH_MAX];
+    bool results[MAP_BATCH_MAX];
+    size_t slots[MAP_BATCH_MAX];
+    size_t misses = 0;
+    size_t mapped = 0;
+
+    STRACE();
+    if (count > MAP_BATCH_MAX) {
+        WTRACE("batch of %d buffers, mapping the first %d", count, MAP_BATCH_MAX);
+        for (size_t i = MAP_BATCH_MAX; i < count; i++) {
+            mappers[i] = NULL;
+        }
+        count = MAP_BATCH_MAX;
+    }
+
+    // pool hits only take a reference, the misses get a new mapper
+    for (size_t i = 0; i < count; i++) {
+        mappers[i] = NULL;
+        DataBuffer *buffer = lockDataBuffer(handles[i]);
+        if (!buffer) {
+            WTRACE("failed to get data buffer, handle = %p", handles[i]);
+            continue;
+        }
+        {
+            Mutex::Autolock _l(mLock);
+            mappers[i] = takeMapper(*buffer, owner);
+            if (!mappers[i]) {
+                fresh[misses] = createBufferMapper(*buffer);
+                if (fresh[misses]) {
+                    fresh[misses]->setProfile(getOwnerProfile(owner));
+                    slots[misses++] = i;
+                } else {
+                    ETRACE("failed to allocate mapper");
+                }
+            }
+        }
+        unlockDataBuffer(buffer);
+        if (mappers[i]) {
+            mapped++;
+        }
+    }
+
+    if (!misses) {
+        return mapped;
+    }
+
+    // the GTT ioctls of each buffer are independent, no lock is held
+    {
+        Mutex::Autolock _b(mBatchLock);
+        if (mMapWorkers) {
+            mMapWorkers->run(fresh, results, misses);
+        } else {
+            for (size_t j = 0; j < misses; j++) {
+                results[j] = fresh[j]->map();
+            }
+        }
+    }
+
+    Mutex::Autolock _l(mLock);
+    mBatchCount++;
+    for (size_t j = 0; j < misses; j++) {
+        BufferMapper *mapper = fresh[j];
+        if (!results[j] && mDeferredUnmaps.size()) {
+            // the aperture may be full of mappings nobody uses any more
+            WTRACE("failed to map, retrying after flushing deferred unmaps");
+            flushDeferredUnmaps();
+            results[j] = mapper->map();
+        }
+        if (!results[j]) {
+            ETRACE("failed to map");
+            delete mapper;
+            continue;
+        }
+        // another thread mapped the buffer meanwhile, keep its mapper
+        BufferMapper *other = mBufferPool->getMapper(mapper->getKey());
+        if (other && !upgradeMapper(other, owner)) {
+            mapper->unmap();
+            delete mapper;
+            continue;
+        }
+        if (other) {
+            cancelDeferredUnmap(other);
+            other->incRef();
+            mOwnerBytes[owner] += getOwnerBytes(other, owner);
+            mTracer->onReference(other->getKey(), owner, 1);
+            mapper->unmap();
+            delete mapper;
+            mapper = other;
+        } else if (!addMapper(mapper, owner)) {
+            mapper->unmap();
+            delete mapper;
+            continue;
+        } else {
+            mBatchMapped++;
+        }
+        mappers[slots[j]] = mapper;
+        mapped++;
+    }
+    return mapped;
+}
+
+void BufferManager::unmap(BufferMapper *mapper, int owner)
 {
     Mutex::Autolock _l(mLock);
     if (!mapper) {
@@ -208,16 +694,331 @@ void BufferManager::unmap(BufferMapper *mapper)
 
     // unmap & remove this mapper from buffer when refCount = 0
     int refCount = mapper->decRef();
+    if (refCount >= 0) {
+        mOwnerBytes[owner] -= getOwnerBytes(mapper, owner);
+        mTracer->onReference(mapper->getKey(), owner, -1);
+    }
     if (refCount < 0) {
         ETRACE("invalid ref count");
     } else if (!refCount) {
+        // over budget the mapping goes right away
+        if (mThread.get() && !mOverBudget) {
+            // leave it in the pool for the worker, a buffer dropped by one
+            // plane is often flipped again or picked up by another one
+            DeferredUnmap deferred;
+            deferred.mapper = mapper;
+            deferred.deadline = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(UNMAP_DELAY);
+            mDeferredUnmaps.push_back(deferred);
+
+            Mutex::Autolock _w(mWorkerLock);
+            if (!mUnmapPending) {
+                mUnmapPending = true;
+                mWorkerCondition.signal();
+            }
+            return;
+        }
+
         // remove mapper from buffer pool
         mBufferPool->removeMapper(mapper);
+        removeMapping(mapper);
         mapper->unmap();
         delete mapper;
     }
 }
 
+uint32_t BufferManager::getMappedBytes(BufferMapper *mapper)
+{
+    // only GTT mappings take aperture space
+    if (!(mapper->getMappedProfile() & BufferMapper::PROFILE_GTT)) {
+        return 0;
+    }
+
+    uint32_t bytes = 0;
+    for (int i = 0; i < MAPPER_SUB_BUFFER_MAX; i++) {
+        bytes += mapper->getSize(i);
+    }
+    return bytes;
+}
+
+uint32_t BufferManager::getOwnerBytes(BufferMapper *mapper, int owner)
+{
+    // an owner mapping just for CPU access references no aperture space
+    if (!(getOwnerProfile(owner) & BufferMapper::PROFILE_GTT)) {
+        return 0;
+    }
+    return getMappedBytes(mapper);
+}
+
+void BufferManager::addMapping(BufferMapper *mapper)
+{
+    addMappedBytes(getMappedBytes(mapper));
+    mTracer->onMap(mapper->getKey());
+}
+
+void BufferManager::addMappedBytes(uint32_t bytes)
+{
+    mMappedBytes += bytes;
+    MemoryAccounting::add(MemoryAccounting::GTT_MAPPING, bytes);
+    if (mMappedBytes > mMappedPeak) {
+        mMappedPeak = mMappedBytes;
+    }
+    mOverBudget = mMappedBytes > mMappingBudget;
+    STRACE_INT("hwc_gtt_mapped_kb", (int32_t)(mMappedBytes >> 10));
+}
+
+void BufferManager::removeMapping(BufferMapper *mapper)
+{
+    uint32_t bytes = getMappedBytes(mapper);
+    mMappedBytes -= bytes;
+    MemoryAccounting::remove(MemoryAccounting::GTT_MAPPING, bytes);
+    mOverBudget = mMappedBytes > mMappingBudget;
+    STRACE_INT("hwc_gtt_mapped_kb", (int32_t)(mMappedBytes >> 10));
+    mTracer->onUnmap(mapper->getKey());
+}
+
+void BufferManager::flushDeferredUnmaps()
+{
+    // called with mLock held, nobody references these mappers
+    for (size_t i = 0; i < mDeferredUnmaps.size(); i++) {
+        BufferMapper *mapper = mDeferredUnmaps.itemAt(i).mapper;
+        mBufferPool->removeMapper(mapper);
+        removeMapping(mapper);
+        mapper->unmap();
+        delete mapper;
+        mUnmapCount++;
+    }
+    mDeferredUnmaps.clear();
+}
+
+void BufferManager::cancelDeferredUnmap(BufferMapper *mapper)
+{
+    for (size_t i = 0; i < mDeferredUnmaps.size(); i++) {
+        if (mDeferredUnmaps.itemAt(i).mapper == mapper) {
+            mDeferredUnmaps.removeAt(i);
+            return;
+        }
+    }
+}
+
+void BufferManager::startWorker()
+{
+    mExitThread = false;
+    mThread = new BufferWorker(this);
+    if (!mThread.get()) {
+        // buffers are still mapped on their first flip
+        WTRACE("failed to create buffer worker");
+        return;
+    }
+    mThread->run("HwcBufferWorker", PRIORITY_BACKGROUND);
+}
+
+void BufferManager::stopWorker()
+{
+    {
+        Mutex::Autolock _l(mWorkerLock);
+        mExitThread = true;
+        mWorkerCondition.signal();
+    }
+
+    if (mThread.get()) {
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+}
+
+void BufferManager::premap(const buffer_handle_t *handles, size_t count)
+{
+    if (!handles) {
+        return;
+    }
+
+    // SurfaceFlinger may free the handles once prepare returns, they are
+    // mapped before that; the misses of the batch map concurrently
+    buffer_handle_t pending[MAP_BATCH_MAX];
+    size_t numPending = 0;
+    {
+        Mutex::Autolock _l(mWorkerLock);
+        for (size_t i = 0; i < count && numPending < MAP_BATCH_MAX; i++) {
+            buffer_handle_t handle = handles[i];
+            if (!handle || mPremapped.indexOfKey((uint64_t)handle) >= 0) {
+                continue;
+            }
+
+            if (mPremapped.size() + numPending >= PREMAP_MAX_BUFFERS) {
+                WTRACE("too many premapped buffers, dropping %p", handle);
+                break;
+            }
+            pending[numPending++] = handle;
+        }
+    }
+    if (!numPending) {
+        return;
+    }
+
+    BufferMapper *mappers[MAP_BATCH_MAX];
+    mapBatch(pending, numPending, mappers, MAPPING_OWNER_PREMAP);
+
+    Vector<BufferMapper*> duplicates;
+    {
+        Mutex::Autolock _l(mWorkerLock);
+        for (size_t i = 0; i < numPending; i++) {
+            if (!mappers[i]) {
+                WTRACE("failed to premap buffer %p", pending[i]);
+                continue;
+            }
+            if (mPremapped.indexOfKey((uint64_t)pending[i]) >= 0) {
+                duplicates.push_back(mappers[i]);
+                continue;
+            }
+            mPremapped.add((uint64_t)pending[i], mappers[i]);
+            mPremapCount++;
+        }
+    }
+
+    for (size_t i = 0; i < duplicates.size(); i++) {
+        unmap(duplicates.itemAt(i), MAPPING_OWNER_PREMAP);
+    }
+}
+
+void BufferManager::releasePremapped()
+{
+    Vector<BufferMapper*> mappers;
+    {
+        Mutex::Autolock _l(mWorkerLock);
+        for (size_t i = 0; i < mPremapped.size(); i++) {
+            mappers.push_back(mPremapped.valueAt(i));
+        }
+        mPremapped.clear();
+    }
+
+    // planes still showing a buffer keep it mapped through their own reference
+    for (size_t i = 0; i < mappers.size(); i++) {
+        unmap(mappers.itemAt(i), MAPPING_OWNER_PREMAP);
+    }
+}
+
+void BufferManager::reclaimDeferredUnmaps()
+{
+    // rate limited, unmaps never burst while the composition thread is busy
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (now - mLastReclaim < ms2ns(UNMAP_INTERVAL)) {
+        return;
+    }
+    mLastReclaim = now;
+
+    BufferMapper *mappers[UNMAP_BATCH];
+    int count = 0;
+    {
+        Mutex::Autolock _l(mLock);
+        // queued in deadline order
+        while (mDeferredUnmaps.size() && count < UNMAP_BATCH) {
+            const DeferredUnmap& deferred = mDeferredUnmaps.itemAt(0);
+            if (deferred.deadline > now) {
+                break;
+            }
+            mBufferPool->removeMapper(deferred.mapper);
+            removeMapping(deferred.mapper);
+            mappers[count++] = deferred.mapper;
+            mDeferredUnmaps.removeAt(0);
+        }
+
+        Mutex::Autolock _w(mWorkerLock);
+        mUnmapPending = mDeferredUnmaps.size() != 0;
+    }
+
+    // out of the pool, nobody else can reach them
+    for (int i = 0; i < count; i++) {
+        mappers[i]->unmap();
+        delete mappers[i];
+        mUnmapCount++;
+    }
+}
+
+bool BufferManager::threadLoop()
+{
+    {
+        Mutex::Autolock _l(mWorkerLock);
+        while (!mUnmapPending && !mExitThread) {
+            mWorkerCondition.wait(mWorkerLock);
+        }
+        if (mExitThread) {
+            ITRACE("exiting thread loop");
+            return false;
+        }
+
+        // let the deferred unmaps age, a flip may still take them back
+        mWorkerCondition.waitRelative(mWorkerLock, milliseconds(UNMAP_INTERVAL));
+        if (mExitThread) {
+            return false;
+        }
+    }
+
+    reclaimDeferredUnmaps();
+    return true;
+}
+
+bool BufferManager::blit(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                         const crop_t& destRect, bool filter, bool async)
+{
+    int fenceFd = blitAsync(srcHandle, destHandle, destRect, filter);
+    if (fenceFd < 0) {
+        return false;
+    }
+
+    if (!async) {
+        sync_wait(fenceFd, -1);
+    }
+    close(fenceFd);
+    return true;
+}
+
+int BufferManager::blitBatch(const BlitRequest *requests, size_t count)
+{
+    int batchFenceFd = -1;
+    bool ret = true;
+
+    if (!requests || !count) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const BlitRequest& request = requests[i];
+        int fenceFd = blitAsync(request.srcHandle, request.destHandle,
+                                request.destRect, request.filter,
+                                request.acquireFenceFd);
+        if (fenceFd < 0) {
+            ETRACE("blit %zu of %zu failed", i, count);
+            ret = false;
+            break;
+        }
+
+        if (batchFenceFd < 0) {
+            batchFenceFd = fenceFd;
+            continue;
+        }
+
+        int merged = sync_merge("hwc_blit_batch", batchFenceFd, fenceFd);
+        if (merged < 0) {
+            // keep the ordering by waiting for what is queued so far
+            WTRACE("failed to merge blit fences");
+            sync_wait(batchFenceFd, -1);
+            close(batchFenceFd);
+            batchFenceFd = fenceFd;
+            continue;
+        }
+        close(batchFenceFd);
+        close(fenceFd);
+        batchFenceFd = merged;
+    }
+
+    if (!ret && batchFenceFd >= 0) {
+        sync_wait(batchFenceFd, -1);
+        close(batchFenceFd);
+        batchFenceFd = -1;
+    }
+    return batchFenceFd;
+}
+
 buffer_handle_t BufferManager::allocFrameBuffer(int width, int height, int *stride)
 {
     RETURN_NULL_IF_NOT_INIT();
@@ -232,6 +1033,21 @@ buffer_handle_t BufferManager::allocFrameBuffer(int width, int height, int *stri
         return 0;
     }
 
+    // hotplug and mode switches usually come back to a recent size
+    for (size_t i = mFrameBufferPool.size(); i > 0; i--) {
+        FrameBuffer fb = mFrameBufferPool.itemAt(i - 1);
+        if (fb.width != width || fb.height != height) {
+            continue;
+        }
+        ITRACE("reusing frame buffer %dx%d", width, height);
+        mFrameBufferPool.removeAt(i - 1);
+        mFrameBufferPoolBytes -= fb.bytes;
+        mFrameBuffers.add(fb.fbHandle, fb);
+        mFrameBufferReuses++;
+        *stride = fb.stride;
+        return fb.fbHandle;
+    }
+
     ITRACE("size of frame buffer to create: %dx%d", width, height);
     buffer_handle_t handle = 0;
     status_t err  = mAllocDev->alloc(
@@ -270,7 +1086,15 @@ buffer_handle_t BufferManager::allocFrameBuffer(int width, int height, int *stri
              break;
          }
 
-        mFrameBuffers.add(fbHandle, mapper);
+        FrameBuffer fb;
+        fb.fbHandle = fbHandle;
+        fb.mapper = mapper;
+        fb.width = width;
+        fb.height = height;
+        fb.stride = *stride;
+        fb.bytes = (uint64_t)*stride * height * DrmConfig::getFrameBufferBpp() / 8;
+        mFrameBuffers.add(fbHandle, fb);
+        MemoryAccounting::add(MemoryAccounting::FRAME_BUFFER, fb.bytes);
         unlockDataBuffer(buffer);
         return fbHandle;
     } while (0);
@@ -301,12 +1125,34 @@ void BufferManager::freeFrameBuffer(buffer_handle_t fbHandle)
         return;
     }
 
-    BufferMapper *mapper = mFrameBuffers.valueAt(index);
-    buffer_handle_t handle = mapper->getHandle();
-    mapper->putFbHandle();
-    delete mapper;
-    mFrameBuffers.removeItem(fbHandle);
-    mAllocDev->free(mAllocDev, handle);
+    // keep it mapped for the next allocation of this size
+    FrameBuffer fb = mFrameBuffers.valueAt(index);
+    mFrameBuffers.removeItemsAt(index);
+    mFrameBufferPool.push_back(fb);
+    mFrameBufferPoolBytes += fb.bytes;
+
+    // drop the oldest ones beyond the pool limits
+    while (mFrameBufferPool.size() &&
+           (mFrameBufferPool.size() > FRAME_BUFFER_POOL_SIZE ||
+            mFrameBufferPoolBytes > FRAME_BUFFER_POOL_BYTES)) {
+        FrameBuffer oldest = mFrameBufferPool.itemAt(0);
+        mFrameBufferPool.removeAt(0);
+        mFrameBufferPoolBytes -= oldest.bytes;
+        releaseFrameBuffer(oldest);
+    }
+}
+
+void BufferManager::releaseFrameBuffer(FrameBuffer& fb)
+{
+    buffer_handle_t handle = fb.mapper->getHandle();
+    MemoryAccounting::remove(MemoryAccounting::FRAME_BUFFER, fb.bytes);
+    fb.mapper->putFbHandle();
+    delete fb.mapper;
+    fb.mapper = NULL;
+    invalidateBufferAttributes(handle);
+    if (mAllocDev) {
+        mAllocDev->free(mAllocDev, handle);
+    }
 }
 
 buffer_handle_t BufferManager::allocGrallocBuffer(uint32_t width, uint32_t height, uint32_t format, uint32_t usage)
@@ -350,8 +1196,10 @@ void BufferManager::freeGrallocBuffer(buffer_handle_t handle)
         return;
     }
 
-    if (handle)
+    if (handle) {
+        invalidateBufferAttributes(handle);
         mAllocDev->free(mAllocDev, handle);
+    }
 }
 
 } // namespace intel
@@ -0,0 +1,277 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <HwcTrace.h>
+#include <cutils/properties.h>
+#include <BufferTracer.h>
+
+namespace android {
+namespace intel {
+
+BufferTracer::BufferTracer()
+    : mEnabled(false),
+      mRecords(),
+      mChurnCount(0),
+      mEvictCount(0)
+{
+}
+
+BufferTracer::~BufferTracer()
+{
+}
+
+bool BufferTracer::initialize()
+{
+    char prop[PROPERTY_VALUE_MAX];
+    mEnabled = property_get("hwc.buffer.trace", prop, "0") > 0 && atoi(prop) == 1;
+    mRecords.clear();
+    mChurnCount = 0;
+    mEvictCount = 0;
+    if (mEnabled) {
+        ITRACE("buffer lifecycle tracing enabled");
+    }
+    return true;
+}
+
+void BufferTracer::deinitialize()
+{
+    mRecords.clear();
+    mEnabled = false;
+}
+
+BufferTracer::Record* BufferTracer::getRecord(uint64_t key)
+{
+    ssize_t index = mRecords.indexOfKey(key);
+    if (index >= 0) {
+        return &mRecords.editValueAt(index);
+    }
+
+    if (mRecords.size() >= MAX_RECORDS) {
+        evictRecord();
+    }
+
+    Record record;
+    memset(&record, 0, sizeof(record));
+    index = mRecords.add(key, record);
+    if (index < 0) {
+        return NULL;
+    }
+    return &mRecords.editValueAt(index);
+}
+
+void BufferTracer::evictRecord()
+{
+    // the unmapped record that was used least recently
+    ssize_t oldest = -1;
+    for (size_t i = 0; i < mRecords.size(); i++) {
+        const Record& record = mRecords.valueAt(i);
+        if (record.mappedSince) {
+            continue;
+        }
+        if (oldest < 0 || record.lastUse < mRecords.valueAt(oldest).lastUse) {
+            oldest = i;
+        }
+    }
+
+    if (oldest < 0) {
+        // everything is mapped, drop the front one
+        oldest = 0;
+    }
+    mRecords.removeItemsAt(oldest);
+    mEvictCount++;
+}
+
+void BufferTracer::onMap(uint64_t key)
+{
+    if (!mEnabled) {
+        return;
+    }
+
+    Record *record = getRecord(key);
+    if (!record) {
+        return;
+    }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    record->maps++;
+    record->mappedSince = now;
+    record->lastUse = now;
+    if (!record->lastUnmap) {
+        return;
+    }
+
+    nsecs_t interval = now - record->lastUnmap;
+    record->remaps++;
+    record->totalRemapInterval += interval;
+    if (record->remaps == 1 || interval < record->minRemapInterval) {
+        record->minRemapInterval = interval;
+    }
+    if (interval < CHURN_INTERVAL) {
+        record->churns++;
+        mChurnCount++;
+        if (record->churns == CHURN_WARN_COUNT) {
+            WTRACE("buffer %#llx remapped %u times within %lld ms of its unmap",
+                   key, record->churns, ns2ms(CHURN_INTERVAL));
+        }
+    }
+}
+
+void BufferTracer::onUnmap(uint64_t key)
+{
+    if (!mEnabled) {
+        return;
+    }
+
+    ssize_t index = mRecords.indexOfKey(key);
+    if (index < 0) {
+        // mapped before its record was evicted
+        return;
+    }
+
+    Record& record = mRecords.editValueAt(index);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (record.mappedSince) {
+        record.totalMapped += now - record.mappedSince;
+    }
+    record.mappedSince = 0;
+    record.lastUnmap = now;
+}
+
+void BufferTracer::onReference(uint64_t key, int owner, int delta)
+{
+    if (!mEnabled || owner < 0 || owner >= BufferManager::MAPPING_OWNER_MAX) {
+        return;
+    }
+
+    ssize_t index = mRecords.indexOfKey(key);
+    if (index < 0) {
+        return;
+    }
+
+    Record& record = mRecords.editValueAt(index);
+    record.owners[owner] += delta;
+    if (delta > 0) {
+        record.lastUse = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+}
+
+int BufferTracer::getReferences(const Record& record)
+{
+    int refs = 0;
+    for (int i = 0; i < BufferManager::MAPPING_OWNER_MAX; i++) {
+        refs += record.owners[i];
+    }
+    return refs;
+}
+
+int BufferTracer::checkLeaks()
+{
+    if (!mEnabled) {
+        return 0;
+    }
+
+    int leaks = 0;
+    for (size_t i = 0; i < mRecords.size(); i++) {
+        const Record& record = mRecords.valueAt(i);
+        if (!getReferences(record)) {
+            continue;
+        }
+        ETRACE("buffer %#llx still referenced: planes %d, layers %d, virtual %d, premap %d",
+               mRecords.keyAt(i),
+               record.owners[BufferManager::MAPPING_OWNER_PLANE],
+               record.owners[BufferManager::MAPPING_OWNER_LAYER],
+               record.owners[BufferManager::MAPPING_OWNER_VIRTUAL],
+               record.owners[BufferManager::MAPPING_OWNER_PREMAP]);
+        leaks++;
+    }
+    return leaks;
+}
+
+void BufferTracer::dump(Dump& d)
+{
+    if (!mEnabled) {
+        return;
+    }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    d.append("Buffer lifecycle: %d records, %u churn remaps, %u records evicted\n",
+             mRecords.size(), mChurnCount, mEvictCount);
+    d.append("  handle             maps remaps churn  avg/min remap ms  mapped ms  owners\n");
+    for (size_t i = 0; i < mRecords.size(); i++) {
+        const Record& record = mRecords.valueAt(i);
+        nsecs_t mapped = record.totalMapped;
+        if (record.mappedSince) {
+            mapped += now - record.mappedSince;
+        }
+        nsecs_t avgRemap = record.remaps ?
+            record.totalRemapInterval / record.remaps : 0;
+        int refs = getReferences(record);
+
+        char owners[64];
+        int len = 0;
+        owners[0] = '\0';
+        for (int j = 0; j < BufferManager::MAPPING_OWNER_MAX; j++) {
+            if (record.owners[j] && len < (int)sizeof(owners)) {
+                len += snprintf(owners + len, sizeof(owners) - len, "%s:%d ",
+                                BufferManager::getOwnerName(j), record.owners[j]);
+            }
+        }
+        d.append("  %#018llx %5u %6u %5u %8lld/%-8lld %10lld  %s%s%s\n",
+                 mRecords.keyAt(i), record.maps, record.remaps, record.churns,
+                 ns2ms(avgRemap), ns2ms(record.minRemapInterval), ns2ms(mapped),
+                 owners,
+                 record.churns >= CHURN_WARN_COUNT ? "[churn] " : "",
+                 refs && now - record.lastUse > IDLE_REFERENCE_AGE ? "[idle ref]" : "");
+    }
+}
+
+bool BufferTracer::exportTo(const char *path)
+{
+    if (!mEnabled || !path) {
+        return false;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        WTRACE("failed to open %s", path);
+        return false;
+    }
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    fprintf(fp, "handle,maps,remaps,churns,min_remap_ns,total_remap_ns,"
+                "mapped_ns,planes,layers,virtual,premap\n");
+    for (size_t i = 0; i < mRecords.size(); i++) {
+        const Record& record = mRecords.valueAt(i);
+        nsecs_t mapped = record.totalMapped;
+        if (record.mappedSince) {
+            mapped += now - record.mappedSince;
+        }
+        fprintf(fp, "%#llx,%u,%u,%u,%lld,%lld,%lld,%d,%d,%d,%d\n",
+                mRecords.keyAt(i), record.maps, record.remaps, record.churns,
+                record.minRemapInterval, record.totalRemapInterval, mapped,
+                record.owners[BufferManager::MAPPING_OWNER_PLANE],
+                record.owners[BufferManager::MAPPING_OWNER_LAYER],
+                record.owners[BufferManager::MAPPING_OWNER_VIRTUAL],
+                record.owners[BufferManager::MAPPING_OWNER_PREMAP]);
+    }
+    fclose(fp);
+    return true;
+}
+
+} // namespace intel
+} // namespace android
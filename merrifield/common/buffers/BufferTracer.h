@@ -0,0 +1,93 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef BUFFER_TRACER_H
+#define BUFFER_TRACER_H
+
+#include <Dump.h>
+#include <BufferManager.h>
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+// Lifecycle records of the buffers mapped by the buffer manager, enabled
+// with hwc.buffer.trace. Not thread safe, called with the buffer manager
+// lock held.
+class BufferTracer {
+public:
+    BufferTracer();
+    virtual ~BufferTracer();
+
+public:
+    bool initialize();
+    void deinitialize();
+    bool isEnabled() const { return mEnabled; }
+
+    // a gtt mapping was created or torn down
+    void onMap(uint64_t key);
+    void onUnmap(uint64_t key);
+    // an owner took (delta 1) or dropped (delta -1) a reference
+    void onReference(uint64_t key, int owner, int delta);
+
+    // reports the buffers still referenced, returns their number
+    int checkLeaks();
+
+    void dump(Dump& d);
+    // writes all records as CSV, returns false if the file can't be written
+    bool exportTo(const char *path);
+
+private:
+    enum {
+        // least recently used unmapped records are dropped beyond this
+        MAX_RECORDS = 256,
+    };
+
+    // a remap sooner than this after the unmap counts as churn
+    static const nsecs_t CHURN_INTERVAL = 1000000000LL;
+    // warn once a handle churned this many times
+    static const uint32_t CHURN_WARN_COUNT = 8;
+    // referenced, but no new reference taken for this long
+    static const nsecs_t IDLE_REFERENCE_AGE = 30000000000LL;
+
+    struct Record {
+        uint32_t maps;
+        uint32_t remaps;
+        uint32_t churns;
+        nsecs_t mappedSince;
+        nsecs_t totalMapped;
+        nsecs_t lastUnmap;
+        nsecs_t lastUse;
+        nsecs_t minRemapInterval;
+        nsecs_t totalRemapInterval;
+        int owners[BufferManager::MAPPING_OWNER_MAX];
+    };
+
+    Record* getRecord(uint64_t key);
+    void evictRecord();
+    static int getReferences(const Record& record);
+
+private:
+    bool mEnabled;
+    KeyedVector<uint64_t, Record> mRecords;
+    uint32_t mChurnCount;
+    uint32_t mEvictCount;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* BUFFER_TRACER_H */
@@ -0,0 +1,188 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdio.h>
+#include <HwcTrace.h>
+#include <MapWorkerPool.h>
+
+namespace android {
+namespace intel {
+
+MapWorkerPool::Worker::Worker(int index)
+    : mIndex(index),
+      mLock(),
+      mCondition(),
+      mJob(NULL),
+      mBusy(false),
+      mExitThread(false)
+{
+}
+
+MapWorkerPool::Worker::~Worker()
+{
+}
+
+bool MapWorkerPool::Worker::initialize()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "HwcMap%d", mIndex);
+
+    mExitThread = false;
+    mThread = new MapWorkerThread(this);
+    if (!mThread.get()) {
+        ETRACE("failed to create map worker thread");
+        return false;
+    }
+    mThread->run(name, PRIORITY_URGENT_DISPLAY);
+    return true;
+}
+
+void MapWorkerPool::Worker::deinitialize()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThread = true;
+        mCondition.broadcast();
+    }
+
+    if (mThread.get()) {
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+}
+
+void MapWorkerPool::Worker::post(Job *job)
+{
+    Mutex::Autolock _l(mLock);
+    mJob = job;
+    mBusy = true;
+    mCondition.broadcast();
+}
+
+void MapWorkerPool::Worker::wait()
+{
+    Mutex::Autolock _l(mLock);
+    while (mBusy) {
+        mCondition.wait(mLock);
+    }
+}
+
+bool MapWorkerPool::Worker::threadLoop()
+{
+    Job *job;
+    { // scope for lock
+        Mutex::Autolock _l(mLock);
+        while (!mJob) {
+            if (mExitThread) {
+                ITRACE("exiting thread loop");
+                return false;
+            }
+            mCondition.wait(mLock);
+        }
+        job = mJob;
+        mJob = NULL;
+    }
+
+    runJob(*job);
+
+    Mutex::Autolock _l(mLock);
+    mBusy = false;
+    mCondition.broadcast();
+    return true;
+}
+
+MapWorkerPool::MapWorkerPool()
+    : mInitialized(false),
+      mWorkers(),
+      mJobs()
+{
+}
+
+MapWorkerPool::~MapWorkerPool()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool MapWorkerPool::initialize(int numWorkers)
+{
+    for (int i = 0; i < numWorkers; i++) {
+        Worker *worker = new Worker(i);
+        if (!worker || !worker->initialize()) {
+            DEINIT_AND_DELETE_OBJ(worker);
+            DEINIT_AND_RETURN_FALSE("failed to create map worker %d", i);
+        }
+        mWorkers.push_back(worker);
+    }
+
+    // jobs are posted by pointer, never grow the vector in run()
+    mJobs.setCapacity(numWorkers + 1);
+    mInitialized = true;
+    return true;
+}
+
+void MapWorkerPool::deinitialize()
+{
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        Worker *worker = mWorkers.itemAt(i);
+        DEINIT_AND_DELETE_OBJ(worker);
+    }
+    mWorkers.clear();
+    mJobs.clear();
+    mInitialized = false;
+}
+
+void MapWorkerPool::runJob(const Job& job)
+{
+    for (size_t i = job.first; i < job.count; i += job.stride) {
+        job.results[i] = job.mappers[i]->map();
+    }
+}
+
+void MapWorkerPool::run(BufferMapper **mappers, bool *results, size_t count)
+{
+    if (!count) {
+        return;
+    }
+
+    // the calling thread takes the first share
+    size_t jobs = mWorkers.size() + 1;
+    if (jobs > count) {
+        jobs = count;
+    }
+
+    mJobs.clear();
+    for (size_t i = 0; i < jobs; i++) {
+        Job job;
+        job.mappers = mappers;
+        job.results = results;
+        job.first = i;
+        job.stride = jobs;
+        job.count = count;
+        mJobs.push_back(job);
+    }
+
+    for (size_t i = 1; i < jobs; i++) {
+        mWorkers.itemAt(i - 1)->post(&mJobs.editItemAt(i));
+    }
+
+    runJob(mJobs.itemAt(0));
+
+    for (size_t i = 1; i < jobs; i++) {
+        mWorkers.itemAt(i - 1)->wait();
+    }
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,86 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef MAP_WORKER_POOL_H
+#define MAP_WORKER_POOL_H
+
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <SimpleThread.h>
+#include <BufferMapper.h>
+
+namespace android {
+namespace intel {
+
+// Runs BufferMapper::map() of several new mappers at once, each mapping
+// is a gralloc lookup and GTT map ioctls of its own. The first job runs
+// on the calling thread, every other job on one of the persistent
+// workers; run() returns once all of them are done.
+class MapWorkerPool {
+public:
+    MapWorkerPool();
+    ~MapWorkerPool();
+
+public:
+    bool initialize(int numWorkers);
+    void deinitialize();
+    int getWorkerCount() const { return mWorkers.size(); }
+
+    // maps mappers[i] and sets results[i]
+    void run(BufferMapper **mappers, bool *results, size_t count);
+
+private:
+    struct Job {
+        BufferMapper **mappers;
+        bool *results;
+        // every stride-th mapper from first
+        size_t first;
+        size_t stride;
+        size_t count;
+    };
+
+    static void runJob(const Job& job);
+
+    class Worker {
+    public:
+        Worker(int index);
+        ~Worker();
+
+    public:
+        bool initialize();
+        void deinitialize();
+        void post(Job *job);
+        void wait();
+
+    private:
+        int mIndex;
+        Mutex mLock;
+        Condition mCondition;
+        Job *mJob;
+        bool mBusy;
+        bool mExitThread;
+        DECLARE_THREAD(MapWorkerThread, Worker);
+    };
+
+private:
+    bool mInitialized;
+    Vector<Worker*> mWorkers;
+    Vector<Job> mJobs;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* MAP_WORKER_POOL_H */
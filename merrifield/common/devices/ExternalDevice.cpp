@@ -14,11 +14,13 @@
 // limitations under the License.
 */
 
+#include <cutils/atomic.h>
 #include <HwcTrace.h>
 #include <Drm.h>
 #include <DrmConfig.h>
 #include <Hwcomposer.h>
 #include <ExternalDevice.h>
+#include <BootTimeline.h>
 
 namespace android {
 namespace intel {
@@ -28,8 +30,14 @@ ExternalDevice::ExternalDevice(Hwcomposer& hwc, DeviceControlFactory* controlFac
       mHdcpControl(NULL),
       mAbortModeSettingCond(),
       mPendingDrmMode(),
-      mHotplugEventPending(false),
-      mExpectedRefreshRate(0)
+      mProtectedOutput(0),
+      mProtectedOutputChanged(0),
+      mDetectTimer(-1),
+      mFitterSet(false),
+      mScaling(DRM_MODE_SCALE_ASPECT),
+      mOverscanH(0),
+      mOverscanV(0),
+      mFitterFailed(false)
 {
     CTRACE();
 }
@@ -50,10 +58,8 @@ bool ExternalDevice::initialize()
         DEINIT_AND_RETURN_FALSE("failed to create HDCP control");
     }
 
-    mHotplugEventPending = false;
-    if (mConnected) {
-        mHdcpControl->startHdcpAsync(HdcpLinkStatusListener, this);
-    }
+    mProtectedOutput = 0;
+    mProtectedOutputChanged = 0;
 
     UeventObserver *observer = Hwcomposer::getInstance().getUeventObserver();
     if (observer) {
@@ -64,9 +70,36 @@ bool ExternalDevice::initialize()
     } else {
         ETRACE("Uevent observer is NULL");
     }
+
+    // reading the EDID and setting a mode take a while, the first frame
+    // of the primary display doesn't wait for them. The display is
+    // reported by hotplug, on the event loop like later hotplugs.
+    mDetectTimer = Hwcomposer::getInstance().getEventLoop()->addTimer(
+        0, 0, detectTimerExpired, this);
+    if (mDetectTimer < 0) {
+        WTRACE("failed to defer detection");
+        hotplugListener();
+    }
     return true;
 }
 
+bool ExternalDevice::initDisplayConfigs()
+{
+    // detected by detectTimerExpired()
+    return true;
+}
+
+void ExternalDevice::detectTimerExpired(int timer, void *data)
+{
+    ExternalDevice *device = (ExternalDevice *)data;
+    if (timer != device->mDetectTimer) {
+        return;
+    }
+    ITRACE("detecting external display");
+    device->hotplugListener();
+    BootTimeline::mark("external detection");
+}
+
 void ExternalDevice::deinitialize()
 {
     // abort mode settings if it is in the middle
@@ -76,16 +109,40 @@ void ExternalDevice::deinitialize()
         mThread = NULL;
     }
 
+    // waits for a detection in progress
+    if (mDetectTimer >= 0) {
+        int timer = mDetectTimer;
+        mDetectTimer = -1;
+        Hwcomposer::getInstance().getEventLoop()->removeTimer(timer);
+    }
+
     if (mHdcpControl) {
         mHdcpControl->stopHdcp();
         delete mHdcpControl;
         mHdcpControl = 0;
     }
 
-    mHotplugEventPending = false;
+    mProtectedOutputChanged = 0;
     PhysicalDevice::deinitialize();
 }
 
+bool ExternalDevice::prePrepare(hwc_display_contents_1_t *display)
+{
+    // the planes were assigned for the last HDCP state, assign them again.
+    // HDCP is authenticated again after every refresh rate switch, a list
+    // without protected layers only takes the new state.
+    if (display && android_atomic_acquire_cas(1, 0, &mProtectedOutputChanged) == 0) {
+        Mutex::Autolock _l(mLock);
+        if (mLayerList && mLayerList->getProtectedLayerCount() == 0) {
+            mLayerList->setProtectedOutput(isProtectedOutputAllowed());
+        } else if (mLayerList) {
+            display->flags |= HWC_GEOMETRY_CHANGED;
+            DEINIT_AND_DELETE_OBJ(mLayerList);
+        }
+    }
+    return PhysicalDevice::prePrepare(display);
+}
+
 bool ExternalDevice::setDrmMode(drmModeModeInfo& value)
 {
     if (!mConnected) {
@@ -148,7 +205,7 @@ void ExternalDevice::setDrmMode()
     }
 
     // TODO: potential threading issue with onHotplug callback
-    mHdcpControl->stopHdcp();
+    stopHdcp();
     if (!drm->setDrmMode(mType, mPendingDrmMode)) {
         ETRACE("failed to set Drm mode");
         mHwc.hotplug(mType, true);
@@ -161,14 +218,48 @@ void ExternalDevice::setDrmMode()
         return;
     }
     mConnected = true;
-    mHotplugEventPending = true;
-    // delay sending hotplug event until HDCP is authenticated
+    {
+        // the borders are pixels of the mode
+        Mutex::Autolock lock(mLock);
+        applyPanelFitter();
+    }
+    // new frames are composed while HDCP authenticates
+    startHdcp();
+    mHwc.hotplug(mType, true);
+}
+
+void ExternalDevice::startHdcp()
+{
+    setProtectedOutput(false);
     if (mHdcpControl->startHdcpAsync(HdcpLinkStatusListener, this) == false) {
+        // keeps protected content on HDMI with HDCP turned off for debugging
         ETRACE("startHdcpAsync() failed; HDCP is not enabled");
-        mHotplugEventPending = false;
-        mHwc.hotplug(mType, true);
+        setProtectedOutput(true);
     }
-    mExpectedRefreshRate = 0;
+}
+
+void ExternalDevice::stopHdcp()
+{
+    setProtectedOutput(false);
+    mHdcpControl->stopHdcp();
+}
+
+void ExternalDevice::setProtectedOutput(bool allowed)
+{
+    int32_t value = allowed ? 1 : 0;
+    if (android_atomic_acquire_load(&mProtectedOutput) == value) {
+        return;
+    }
+
+    ITRACE("protected content %s", allowed ? "allowed" : "gated");
+    android_atomic_release_store(value, &mProtectedOutput);
+    android_atomic_release_store(1, &mProtectedOutputChanged);
+    mHwc.invalidate(Hwcomposer::INVALIDATE_PROTECTED);
+}
+
+bool ExternalDevice::isProtectedOutputAllowed()
+{
+    return android_atomic_acquire_load(&mProtectedOutput) != 0;
 }
 
 
@@ -189,11 +280,8 @@ void ExternalDevice::HdcpLinkStatusListener(bool success)
         mHwc.getVsyncManager()->enableDynamicVsync(false);
     }
 
-    if (mHotplugEventPending) {
-        DTRACE("HDCP authentication status %d, sending hotplug event...", success);
-        mHwc.hotplug(mType, mConnected);
-        mHotplugEventPending = false;
-    }
+    DTRACE("HDCP authentication status %d", success);
+    setProtectedOutput(success);
 
     if (success) {
         ITRACE("HDCP authenticated, enabling dynamic vsync");
@@ -236,20 +324,20 @@ void ExternalDevice::hotplugListener()
     }
 
     if (mConnected == false) {
-        mHotplugEventPending = false;
         mHwc.getVsyncManager()->resetVsyncSource();
-        mHdcpControl->stopHdcp();
+        stopHdcp();
         mHwc.hotplug(mType, mConnected);
     } else {
-        DTRACE("start HDCP asynchronously...");
-         // delay sending hotplug event till HDCP is authenticated.
-        mHotplugEventPending = true;
-        ret = mHdcpControl->startHdcpAsync(HdcpLinkStatusListener, this);
-        if (ret == false) {
-            ETRACE("failed to start HDCP");
-            mHotplugEventPending = false;
-            mHwc.hotplug(mType, mConnected);
+        // HDCP authenticates while the display already shows the
+        // unprotected content, protected layers are gated until then
+        {
+            // a new sink may not keep the fitter settings
+            Mutex::Autolock lock(mLock);
+            applyPanelFitter();
         }
+        DTRACE("start HDCP asynchronously...");
+        startHdcp();
+        mHwc.hotplug(mType, mConnected);
     }
     mActiveDisplayConfig = 0;
 }
@@ -263,6 +351,74 @@ int ExternalDevice::getRefreshRate()
     return mode.vrefresh;
 }
 
+bool ExternalDevice::setScaling(int scaling)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (scaling < DRM_MODE_SCALE_NONE || scaling > DRM_MODE_SCALE_ASPECT) {
+        ETRACE("invalid scaling mode %d", scaling);
+        return false;
+    }
+
+    Mutex::Autolock _l(mLock);
+    mScaling = scaling;
+    mFitterSet = true;
+    return applyPanelFitter();
+}
+
+bool ExternalDevice::setOverscan(int hValue, int vValue)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (hValue < 0 || hValue > MAX_OVERSCAN ||
+        vValue < 0 || vValue > MAX_OVERSCAN) {
+        WTRACE("overscan %d/%d is beyond the fitter", hValue, vValue);
+        return false;
+    }
+
+    Mutex::Autolock _l(mLock);
+    mOverscanH = hValue;
+    mOverscanV = vValue;
+    mFitterSet = true;
+    return applyPanelFitter();
+}
+
+bool ExternalDevice::applyPanelFitter()
+{
+    if (!mFitterSet || !mConnected) {
+        return true;
+    }
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    drmModeModeInfo mode;
+    if (!drm->getModeInfo(mType, mode)) {
+        return false;
+    }
+
+    // half of the overscan on each side
+    int hBorder = mode.hdisplay * mOverscanH / 200;
+    int vBorder = mode.vdisplay * mOverscanV / 200;
+    mFitterFailed = !drm->setPanelFitter(mType, mScaling, hBorder, vBorder);
+    if (mFitterFailed) {
+        WTRACE("panel fitter can't do scaling %d, overscan %d%%/%d%%",
+               mScaling, mOverscanH, mOverscanV);
+    }
+    return !mFitterFailed;
+}
+
+void ExternalDevice::dump(Dump& d)
+{
+    PhysicalDevice::dump(d);
+    if (mFitterSet) {
+        d.append("Panel fitter: scaling %d, overscan %d%%/%d%%%s\n",
+                 mScaling, mOverscanH, mOverscanV,
+                 mFitterFailed ? " (refused)" : "");
+    }
+    if (mHdcpControl) {
+        mHdcpControl->dump(d);
+    }
+}
+
 void ExternalDevice::setRefreshRate(int hz)
 {
     RETURN_VOID_IF_NOT_INIT();
@@ -285,23 +441,19 @@ void ExternalDevice::setRefreshRate(int hz)
     if (hz == (int)mode.vrefresh)
         return;
 
-    if (mExpectedRefreshRate != 0 &&
-            mExpectedRefreshRate == hz && mHotplugEventPending) {
-        ITRACE("Ignore a new refresh setting event because there is a same event is handling");
-        return;
-    }
-    mExpectedRefreshRate = hz;
-
     ITRACE("changing refresh rate from %d to %d", mode.vrefresh, hz);
 
     mHwc.getVsyncManager()->enableDynamicVsync(false);
 
-    mHdcpControl->stopHdcp();
+    stopHdcp();
 
-    drm->setRefreshRate(IDisplayDevice::DEVICE_EXTERNAL, hz);
+    if (drm->setRefreshRate(IDisplayDevice::DEVICE_EXTERNAL, hz)) {
+        onRefreshChanged();
+        // the mode set scans out its own frame buffer until the next post
+        mHwc.invalidate();
+    }
 
-    mHotplugEventPending = false;
-    mHdcpControl->startHdcpAsync(HdcpLinkStatusListener, this);
+    startHdcp();
     mHwc.getVsyncManager()->enableDynamicVsync(true);
 }
 
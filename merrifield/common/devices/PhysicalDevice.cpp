@@ -17,7 +17,12 @@
 #include <Hwcomposer.h>
 #include <Drm.h>
 #include <PhysicalDevice.h>
+#include <TelemetryFormat.h>
+#include <TuningPolicy.h>
+#include <DisplayCalibration.h>
+#include <DisplayPlaneManager.h>
 #include <cutils/properties.h>
+#include <cutils/atomic.h>
 
 namespace android {
 namespace intel {
@@ -30,11 +35,32 @@ PhysicalDevice::PhysicalDevice(uint32_t type, Hwcomposer& hwc, DeviceControlFact
       mVsyncObserver(NULL),
       mControlFactory(controlFactory),
       mLayerList(NULL),
+      mPlaneAssignmentCache(),
+      mCompositionLog(),
+      mBlitComposer(),
       mConnected(false),
       mBlank(false),
+      mPowerOff(false),
+      mResumePending(false),
+      mUnblankResumes(0),
+      mSelfRefreshFrames(0),
+      mPartialFrames(0),
+      mPartialDamage(0),
+      mFrameRate(),
+      mCloneSource(NULL),
+      mCloneFrames(0),
+      mPrepareTime(0),
+      mModeInfoChanged(0),
+      mRefreshSwitches(0),
+      mRefreshQueued(false),
+      mRememberRefresh(false),
+      mAttributeSeq(0),
       mDisplayState(DEVICE_DISPLAY_ON),
       mInitialized(false),
-      mFpsDivider(1)
+      mFpsDivider(1),
+      mCapDivider(1),
+      mCappedFrames(0),
+      mCapLiftedFrames(0)
 {
     CTRACE();
 
@@ -66,14 +92,17 @@ void PhysicalDevice::onGeometryChanged(hwc_display_contents_1_t *list)
 
     ATRACE("disp = %d, layer number = %d", mType, list->numHwLayers);
 
-    // NOTE: should NOT be here
+    // list kept across the geometry change by prePrepare()
     if (mLayerList) {
-        WTRACE("mLayerList exists");
-        DEINIT_AND_DELETE_OBJ(mLayerList);
+        VTRACE("layer list merged");
+        return;
     }
 
     // create a new layer list
-    mLayerList = new HwcLayerList(list, mType);
+    mLayerList = new HwcLayerList(list, mType, &mPlaneAssignmentCache,
+                                  isProtectedOutputAllowed(),
+                                  &mCompositionLog, getCloneList(),
+                                  &mBlitComposer);
     if (!mLayerList) {
         WTRACE("failed to create layer list");
     }
@@ -84,6 +113,29 @@ bool PhysicalDevice::prePrepare(hwc_display_contents_1_t *display)
     RETURN_FALSE_IF_NOT_INIT();
     Mutex::Autolock _l(mLock);
 
+    // a queued refresh switch was made by the last commit
+    if (mRefreshQueued &&
+        !Hwcomposer::getInstance().getDrm()->hasPendingMode(mType)) {
+        mRefreshQueued = false;
+        if (mRememberRefresh) {
+            Hwcomposer::getInstance().getDrm()->rememberActiveMode(mType);
+            mRememberRefresh = false;
+        }
+        onRefreshChanged();
+    }
+
+    // the planes clip to the display size and estimate bandwidth from the
+    // refresh rate, nothing else of them depends on the timing
+    if (android_atomic_acquire_cas(1, 0, &mModeInfoChanged) == 0) {
+        mHwc.getPlaneManager()->updateModeInfo(mType);
+    }
+
+    // keep the planes of the last frame across blank, the first frame after
+    // unblank merges into them
+    if (mConnected && mBlank && mLayerList && keepPlanesWhileBlank()) {
+        return true;
+    }
+
     // for a null list, delete hwc list
     if (!mConnected || !display || mBlank) {
         if (mLayerList) {
@@ -92,8 +144,16 @@ bool PhysicalDevice::prePrepare(hwc_display_contents_1_t *display)
         return true;
     }
 
-    // check if geometry is changed, if changed delete list
-    if ((display->flags & HWC_GEOMETRY_CHANGED) && mLayerList) {
+    // the first frame after unblank always goes through the geometry path
+    if (mResumePending) {
+        mResumePending = false;
+        display->flags |= HWC_GEOMETRY_CHANGED;
+    }
+
+    // check if geometry is changed, if changed and the planes of unchanged
+    // layers can't be kept, delete list
+    if ((display->flags & HWC_GEOMETRY_CHANGED) && mLayerList &&
+        !mLayerList->mergeGeometry(display)) {
         DEINIT_AND_DELETE_OBJ(mLayerList);
     }
     return true;
@@ -104,8 +164,14 @@ bool PhysicalDevice::prepare(hwc_display_contents_1_t *display)
     RETURN_FALSE_IF_NOT_INIT();
     Mutex::Autolock _l(mLock);
 
-    if (!mConnected || !display || mBlank)
+    if (!mConnected || !display || mBlank) {
+        mCloneSource = NULL;
         return true;
+    }
+
+    FrameTiming *frameTiming = Hwcomposer::getInstance().getFrameTiming();
+    FrameTimingScope timing(frameTiming, mType,
+                            FrameTiming::STAGE_DEVICE_PREPARE);
 
     // check if geometry is changed
     if (display->flags & HWC_GEOMETRY_CHANGED) {
@@ -117,7 +183,131 @@ bool PhysicalDevice::prepare(hwc_display_contents_1_t *display)
     }
 
     // update list with new list
-    return mLayerList->update(display);
+    FrameTimingScope updateTiming(frameTiming, mType,
+                                  FrameTiming::STAGE_LAYER_LIST_UPDATE);
+    HwcLayerList *clone = getCloneList();
+    if (clone) {
+        mCloneFrames++;
+    }
+    mLayerList->setCloneSource(clone);
+    bool ret = mLayerList->update(display);
+    mLayerList->setCloneSource(NULL);
+    mCloneSource = NULL;
+    updateFrameCap();
+    return ret;
+}
+
+void PhysicalDevice::setCloneSource(IDisplayDevice *source)
+{
+    mCloneSource = (source != this) ? source : NULL;
+}
+
+HwcLayerList* PhysicalDevice::getLayerList()
+{
+    return mLayerList;
+}
+
+HwcLayerList* PhysicalDevice::getCloneList()
+{
+    return mCloneSource ? mCloneSource->getLayerList() : NULL;
+}
+
+bool PhysicalDevice::prepareGeometry(hwc_display_contents_1_t *display)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    mPrepareTime = 0;
+    if (!mConnected || !display || mBlank)
+        return true;
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    // creating the layer list allocates planes
+    if (display->flags & HWC_GEOMETRY_CHANGED) {
+        onGeometryChanged(display);
+    }
+    mPrepareTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    return true;
+}
+
+bool PhysicalDevice::prepareLayers(hwc_display_contents_1_t *display)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    if (!mConnected || !display || mBlank)
+        return true;
+
+    if (!mLayerList) {
+        WTRACE("null HWC layer list");
+        return true;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    bool ret;
+    {
+        FrameTiming *frameTiming = Hwcomposer::getInstance().getFrameTiming();
+        FrameTimingScope updateTiming(frameTiming, mType,
+                                      FrameTiming::STAGE_LAYER_LIST_UPDATE);
+        ret = mLayerList->updateLayers(display);
+    }
+    mPrepareTime += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    return ret;
+}
+
+bool PhysicalDevice::prepareFinish(hwc_display_contents_1_t *display)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    if (!mConnected || !display || mBlank)
+        return true;
+
+    // the phases of the parallel prepare add up to the serial prepare()
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (mLayerList) {
+        mLayerList->finishUpdate(display);
+        updateFrameCap();
+    }
+    FrameTiming *frameTiming = Hwcomposer::getInstance().getFrameTiming();
+    if (frameTiming) {
+        frameTiming->record(mType, FrameTiming::STAGE_DEVICE_PREPARE,
+                            mPrepareTime + systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    }
+    mPrepareTime = 0;
+    return true;
+}
+
+void PhysicalDevice::updateFrameCap()
+{
+    int32_t divider = 1;
+    uint32_t cap = TuningPolicy::getFpsCap(mType);
+    DisplayConfig *config = NULL;
+    if (mActiveDisplayConfig >= 0 &&
+        mActiveDisplayConfig < (int)mDisplayConfigs.size()) {
+        config = mDisplayConfigs.itemAt(mActiveDisplayConfig);
+    }
+
+    if (cap && config && mLayerList) {
+        uint32_t planeLayers[DisplayPlane::PLANE_MAX];
+        uint32_t frameBufferLayers;
+        mLayerList->getPlaneUsage(planeLayers, &frameBufferLayers);
+        // the refresh rate of the config is already divided by mFpsDivider
+        uint32_t rate = config->getRefreshRate();
+        if (planeLayers[DisplayPlane::PLANE_OVERLAY]) {
+            // video is on the overlays and goes at its content rate
+            mCapLiftedFrames++;
+        } else if (rate > cap) {
+            divider = (rate + cap - 1) / cap;
+            mCappedFrames++;
+        }
+    }
+
+    if (divider != android_atomic_acquire_load(&mCapDivider)) {
+        DTRACE("%s frame cap %u fps, vsync divider %u", mName, cap,
+               mFpsDivider * divider);
+        android_atomic_release_store(divider, &mCapDivider);
+    }
 }
 
 
@@ -128,9 +318,39 @@ bool PhysicalDevice::commit(hwc_display_contents_1_t *display, IDisplayContext *
     if (!display || !context || !mLayerList || mBlank) {
         return true;
     }
+    if (!mLayerList->isIdle()) {
+        mFrameRate.frame(systemTime(SYSTEM_TIME_MONOTONIC));
+        countDamage(display);
+    } else {
+        mSelfRefreshFrames++;
+    }
+    if (!mLayerList->composeBlitLayers()) {
+        WTRACE("%s: failed to compose layers by blit", mName);
+    }
     return context->commitContents(display, mLayerList);
 }
 
+void PhysicalDevice::countDamage(hwc_display_contents_1_t *display)
+{
+    if (!display->numHwLayers) {
+        return;
+    }
+
+    // the frame buffer target covers the screen
+    const hwc_rect_t& screen = display->hwLayers[display->numHwLayers - 1].displayFrame;
+    const hwc_rect_t& damage = mLayerList->getDamage();
+    int64_t screenArea = (int64_t)(screen.right - screen.left) * (screen.bottom - screen.top);
+    int64_t damageArea = (int64_t)(damage.right - damage.left) * (damage.bottom - damage.top);
+    if (screenArea <= 0 || damageArea <= 0 || damageArea >= screenArea) {
+        return;
+    }
+
+    VTRACE("%s damage [%d, %d, %d, %d]", mName,
+           damage.left, damage.top, damage.right, damage.bottom);
+    mPartialFrames++;
+    mPartialDamage += (uint64_t)(damageArea * 100 / screenArea);
+}
+
 bool PhysicalDevice::vsyncControl(bool enabled)
 {
     RETURN_FALSE_IF_NOT_INIT();
@@ -146,6 +366,7 @@ bool PhysicalDevice::blank(bool blank)
     if (!mConnected)
         return false;
 
+    bool wasBlank = mBlank;
     mBlank = blank;
     bool ret = mBlankControl->blank(mType, blank);
     if (ret == false) {
@@ -153,18 +374,65 @@ bool PhysicalDevice::blank(bool blank)
         return false;
     }
 
+    if (wasBlank && !blank) {
+        onUnblank();
+    }
     return true;
 }
 
+bool PhysicalDevice::keepPlanesWhileBlank()
+{
+    // the planes stay owned by this display, don't hold them while another
+    // physical display may need them
+    for (int i = 0; i < DEVICE_VIRTUAL; i++) {
+        if (i == (int)mType) {
+            continue;
+        }
+        IDisplayDevice *device = mHwc.getDisplayDevice(i);
+        if (device && device->isConnected()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PhysicalDevice::onUnblank()
+{
+    // the pipe may lose its gamma LUT while it is off
+    applyCalibration();
+
+    {
+        Mutex::Autolock _l(mLock);
+        if (!mLayerList) {
+            return;
+        }
+        // the pipe scans out the planes of the kept list as soon as it is
+        // powered, they still hold the buffers of the last frame
+        mUnblankResumes++;
+        mResumePending = true;
+        ITRACE("%s resumes with the planes of the last frame", mName);
+    }
+
+    // don't wait for a content update to post the first frame
+    mHwc.invalidate(Hwcomposer::INVALIDATE_RESUME);
+}
+
 bool PhysicalDevice::getDisplaySize(int *width, int *height)
 {
     RETURN_FALSE_IF_NOT_INIT();
-    Mutex::Autolock _l(mLock);
     if (!width || !height) {
         ETRACE("invalid parameters");
         return false;
     }
 
+    DisplayAttributes attributes;
+    if (readAttributes(attributes) && attributes.count > 0) {
+        *width = attributes.width;
+        *height = attributes.height;
+        return true;
+    }
+
+    Mutex::Autolock _l(mLock);
     *width = 0;
     *height = 0;
     drmModeModeInfo mode;
@@ -189,20 +457,30 @@ bool PhysicalDevice::getDisplayConfigs(uint32_t *configs,
 {
     RETURN_FALSE_IF_NOT_INIT();
 
-    Mutex::Autolock _l(mLock);
-
-    if (!mConnected) {
-        ITRACE("device is not connected");
+    if (!configs || !numConfigs || *numConfigs < 1) {
+        ETRACE("invalid parameters");
         return false;
     }
 
-    if (!configs || !numConfigs || *numConfigs < 1) {
-        ETRACE("invalid parameters");
+    bool connected;
+    size_t count;
+    DisplayAttributes attributes;
+    if (readAttributes(attributes) && !attributes.truncated) {
+        connected = attributes.connected;
+        count = attributes.count;
+    } else {
+        Mutex::Autolock _l(mLock);
+        connected = mConnected;
+        count = mDisplayConfigs.size();
+    }
+
+    if (!connected) {
+        ITRACE("device is not connected");
         return false;
     }
 
     // fill in all config handles
-    *numConfigs = min(*numConfigs, mDisplayConfigs.size());
+    *numConfigs = min(*numConfigs, count);
     for (int i = 0; i < static_cast<int>(*numConfigs); i++) {
         configs[i] = i;
     }
@@ -215,15 +493,55 @@ bool PhysicalDevice::getDisplayAttributes(uint32_t config,
 {
     RETURN_FALSE_IF_NOT_INIT();
 
-    Mutex::Autolock _l(mLock);
+    if (!attributes || !values) {
+        ETRACE("invalid parameters");
+        return false;
+    }
 
-    if (!mConnected) {
+    // the attributes of the published configs are read without the lock
+    DisplayAttributes snapshot;
+    bool published = readAttributes(snapshot);
+    if (published && !snapshot.connected) {
         ITRACE("device is not connected");
         return false;
     }
+    if (published && config < snapshot.count) {
+        const ConfigAttributes& record = snapshot.configs[config];
+        for (int i = 0; attributes[i] != HWC_DISPLAY_NO_ATTRIBUTE; i++) {
+            switch (attributes[i]) {
+            case HWC_DISPLAY_VSYNC_PERIOD:
+                if (!record.vsyncPeriod) {
+                    ETRACE("refresh rate is 0!!!");
+                }
+                values[i] = record.vsyncPeriod;
+                break;
+            case HWC_DISPLAY_WIDTH:
+                values[i] = record.width;
+                break;
+            case HWC_DISPLAY_HEIGHT:
+                values[i] = record.height;
+                break;
+            case HWC_DISPLAY_DPI_X:
+                values[i] = record.dpiX;
+                break;
+            case HWC_DISPLAY_DPI_Y:
+                values[i] = record.dpiY;
+                break;
+            default:
+                ETRACE("unknown attribute %d", attributes[i]);
+                break;
+            }
+        }
+        return true;
+    }
 
-    if (!attributes || !values) {
-        ETRACE("invalid parameters");
+    Mutex::Autolock _l(mLock);
+    if (!mConnected) {
+        ITRACE("device is not connected");
+        return false;
+    }
+    if (config >= mDisplayConfigs.size()) {
+        WTRACE("failed to get display config");
         return false;
     }
 
@@ -282,6 +600,62 @@ void PhysicalDevice::removeDisplayConfigs()
 
     mDisplayConfigs.clear();
     mActiveDisplayConfig = -1;
+    publishAttributes();
+}
+
+void PhysicalDevice::publishAttributes()
+{
+    // called with mLock held, an odd sequence tells readers that the
+    // record is being written; the barriers keep the writes of the record
+    // between the two increments
+    android_atomic_inc(&mAttributeSeq);
+    android_memory_barrier();
+
+    size_t count = mDisplayConfigs.size();
+    // a device that failed to get its mode has no configs
+    mAttributes.connected = mConnected && count > 0;
+    mAttributes.truncated = count > MAX_PUBLISHED_CONFIGS;
+    if (mAttributes.truncated) {
+        count = MAX_PUBLISHED_CONFIGS;
+    }
+    mAttributes.count = count;
+    mAttributes.width = 0;
+    mAttributes.height = 0;
+    for (size_t i = 0; i < count; i++) {
+        DisplayConfig *config = mDisplayConfigs.itemAt(i);
+        ConfigAttributes& record = mAttributes.configs[i];
+        record.vsyncPeriod = config->getRefreshRate() ?
+                1e9 / config->getRefreshRate() : 0;
+        record.width = config->getWidth();
+        record.height = config->getHeight();
+        record.dpiX = config->getDpiX() * 1000.0f;
+        record.dpiY = config->getDpiY() * 1000.0f;
+    }
+    if (count > 0) {
+        // the first config is the current drm mode
+        mAttributes.width = mAttributes.configs[0].width;
+        mAttributes.height = mAttributes.configs[0].height;
+    }
+
+    android_memory_barrier();
+    android_atomic_inc(&mAttributeSeq);
+}
+
+bool PhysicalDevice::readAttributes(DisplayAttributes& attributes) const
+{
+    for (int i = 0; i < ATTRIBUTE_READ_RETRIES; i++) {
+        int32_t seq = android_atomic_acquire_load(&mAttributeSeq);
+        if (seq & 1) {
+            continue;
+        }
+        attributes = mAttributes;
+        android_memory_barrier();
+        if (android_atomic_acquire_load(&mAttributeSeq) == seq) {
+            return true;
+        }
+    }
+    // configs kept changing, the caller takes the lock
+    return false;
 }
 
 bool PhysicalDevice::detectDisplayConfigs()
@@ -304,6 +678,9 @@ bool PhysicalDevice::updateDisplayConfigs()
     // reset display configs
     removeDisplayConfigs();
 
+    // cached plane assignments are only valid for the current mode
+    mPlaneAssignmentCache.clear();
+
     // update device connection status
     mConnected = drm->isConnected(mType);
     if (!mConnected) {
@@ -392,9 +769,36 @@ bool PhysicalDevice::updateDisplayConfigs()
         }
     }
 
+    publishAttributes();
+    applyCalibration();
     return true;
 }
 
+void PhysicalDevice::applyCalibration()
+{
+    DisplayCalibration::Values values;
+    DisplayCalibration::get(mType, values);
+    if (!DisplayCalibration::hasGamma(values)) {
+        return;
+    }
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    int size = drm->getGammaSize(mType);
+    if (size <= 0) {
+        WTRACE("%s pipe has no gamma LUT", mName);
+        return;
+    }
+
+    Vector<uint16_t> lut;
+    lut.resize(size * DisplayCalibration::CHANNEL_COUNT);
+    uint16_t *red = lut.editArray();
+    DisplayCalibration::buildGammaLut(values, size, red, red + size,
+                                      red + 2 * size);
+    if (!drm->setGamma(mType, red, red + size, red + 2 * size, size)) {
+        WTRACE("failed to set the calibrated gamma of %s", mName);
+    }
+}
+
 bool PhysicalDevice::initialize()
 {
     CTRACE();
@@ -414,8 +818,11 @@ bool PhysicalDevice::initialize()
         return false;
     }
 
+    // before the configs, which program its gamma LUT on the pipe
+    DisplayCalibration::load(mType);
+
     // detect display configs
-    bool ret = detectDisplayConfigs();
+    bool ret = initDisplayConfigs();
     if (ret == false) {
         DEINIT_AND_RETURN_FALSE("failed to detect display config");
     }
@@ -446,6 +853,8 @@ void PhysicalDevice::deinitialize()
     if (mLayerList) {
         DEINIT_AND_DELETE_OBJ(mLayerList);
     }
+    mPlaneAssignmentCache.clear();
+    mBlitComposer.clear();
 
     DEINIT_AND_DELETE_OBJ(mVsyncObserver);
 
@@ -517,14 +926,70 @@ void PhysicalDevice::dump(Dump& d)
                      config->getDpiY());
         }
     }
+    if (mVsyncObserver)
+        mVsyncObserver->dump(d);
+    d.append("Resumed with kept planes: %u\n", mUnblankResumes);
+    d.append("Frames prepared as a clone: %u\n", mCloneFrames);
+    d.append("Refresh rate switches kept the layer list: %u\n", mRefreshSwitches);
+    d.append("Self-refresh frames: %u, partial frames: %u (%u%% of the screen)\n",
+             mSelfRefreshFrames, mPartialFrames,
+             mPartialFrames ? (uint32_t)(mPartialDamage / mPartialFrames) : 0);
+    uint32_t fps = mFrameRate.getFps10(systemTime(SYSTEM_TIME_MONOTONIC));
+    d.append("Frame rate: %u.%u fps, %u frames\n", fps / 10, fps % 10, mFrameRate.getFrames());
+    d.append("Frame cap: %u fps, vsync divider %u, capped frames %u, "
+             "lifted for video %u\n", TuningPolicy::getFpsCap(mType),
+             getFpsDivider(), mCappedFrames, mCapLiftedFrames);
+    mBlitComposer.dump(d);
     // dump layer list
     if (mLayerList)
         mLayerList->dump(d);
+    mCompositionLog.dump(d);
+}
+
+bool PhysicalDevice::getTelemetry(TelemetryDisplay& record)
+{
+    Mutex::Autolock _l(mLock);
+    record.connected = mConnected;
+    if (!mConnected) {
+        return true;
+    }
+
+    record.fps10 = mFrameRate.getFps10(systemTime(SYSTEM_TIME_MONOTONIC));
+    record.frames = mFrameRate.getFrames();
+    record.assignmentCacheHits = mPlaneAssignmentCache.getHits();
+    record.assignmentCacheMisses = mPlaneAssignmentCache.getMisses();
+    if (mLayerList) {
+        uint32_t planeLayers[DisplayPlane::PLANE_MAX];
+        mLayerList->getPlaneUsage(planeLayers, &record.frameBufferLayers);
+        for (int i = 0; i < DisplayPlane::PLANE_MAX &&
+                        i < TELEMETRY_PLANE_COUNT; i++) {
+            record.planeLayers[i] = planeLayers[i];
+        }
+    }
+    return true;
 }
 
 uint32_t PhysicalDevice::getFpsDivider()
 {
-    return mFpsDivider;
+    // SurfaceFlinger composes on the vsync, so a capped display defers its
+    // updates to the vsync the cap allows
+    return mFpsDivider * android_atomic_acquire_load(&mCapDivider);
+}
+
+nsecs_t PhysicalDevice::getNextVsyncTime(nsecs_t after)
+{
+    if (!mVsyncObserver) {
+        return 0;
+    }
+    return mVsyncObserver->getNextVsyncTime(after);
+}
+
+nsecs_t PhysicalDevice::getVsyncPeriod()
+{
+    if (!mVsyncObserver) {
+        return 0;
+    }
+    return mVsyncObserver->getVsyncPeriod();
 }
 
 bool PhysicalDevice::setPowerMode(int mode)
@@ -542,6 +1007,12 @@ bool PhysicalDevice::setPowerMode(int mode)
           return false;
     }
 
+    // the layer list is not touched while the panel is off, resume with it
+    bool off = (mode == HWC_POWER_MODE_OFF);
+    if (mPowerOff && !off) {
+        onUnblank();
+    }
+    mPowerOff = off;
     return true;
 }
 
@@ -552,10 +1023,62 @@ int PhysicalDevice::getActiveConfig()
 
 bool PhysicalDevice::setActiveConfig(int index)
 {
-    // TODO: for now only implement in external
-    if (index == 0)
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    if (index < 0 || index >= (int)mDisplayConfigs.size()) {
+        return false;
+    }
+    if (index == mActiveDisplayConfig) {
         return true;
-    return false;
+    }
+
+    // the configs only differ in the refresh rate, see updateDisplayConfigs()
+    DisplayConfig *config = mDisplayConfigs.itemAt(index);
+    DisplayConfig *active = mDisplayConfigs.itemAt(mActiveDisplayConfig);
+    if (config->getWidth() != active->getWidth() ||
+        config->getHeight() != active->getHeight()) {
+        WTRACE("config %d changes the display size", index);
+        return false;
+    }
+
+    // the active mode is published divided by the fps divider
+    int hz = config->getRefreshRate();
+    if (index == 0) {
+        hz *= mFpsDivider;
+    }
+    if (!switchRefreshRate(hz)) {
+        return false;
+    }
+    mRememberRefresh = true;
+    mActiveDisplayConfig = index;
+
+    // nothing may be drawn, the switch is made by the commit of a frame
+    mHwc.invalidate();
+    return true;
+}
+
+bool PhysicalDevice::switchRefreshRate(int hz)
+{
+    ITRACE("switching device %d to %d Hz", mType, hz);
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    if (!drm->queueRefreshRate(mType, hz)) {
+        WTRACE("failed to set refresh rate %d", hz);
+        return false;
+    }
+    mRefreshQueued = true;
+    return true;
+}
+
+void PhysicalDevice::onRefreshChanged()
+{
+    // the vsync period changed underneath the model
+    if (mVsyncObserver) {
+        mVsyncObserver->resetModel();
+    }
+    android_atomic_release_store(1, &mModeInfoChanged);
+    mRefreshSwitches++;
 }
 
 } // namespace intel
@@ -18,12 +18,19 @@
 #include <Hwcomposer.h>
 #include <DrmConfig.h>
 #include <PrimaryDevice.h>
+#include <cutils/properties.h>
 
 namespace android {
 namespace intel {
 
 PrimaryDevice::PrimaryDevice(Hwcomposer& hwc, DeviceControlFactory* controlFactory)
-    : PhysicalDevice(DEVICE_PRIMARY, hwc, controlFactory)
+    : PhysicalDevice(DEVICE_PRIMARY, hwc, controlFactory),
+      mIdleRefreshEnabled(false),
+      mIdleRefreshMin(IDLE_REFRESH_MIN),
+      mIdleRefresh(false),
+      mIdleRefreshRate(0),
+      mFullRefreshRate(0),
+      mIdleRefreshEntries(0)
 {
     CTRACE();
 }
@@ -49,6 +56,18 @@ bool PrimaryDevice::initialize()
         ETRACE("Uevent observer is NULL");
     }
 
+    // lowest rate the panel may drop to while idle, 0 to stay at full rate
+    char prop[PROPERTY_VALUE_MAX];
+    mIdleRefreshMin = IDLE_REFRESH_MIN;
+    if (property_get("hwc.primary.idle_refresh", prop, NULL) > 0) {
+        mIdleRefreshMin = atoi(prop);
+    }
+    mIdleRefreshEnabled = mIdleRefreshMin > 0;
+    mIdleRefresh = false;
+    mIdleRefreshRate = 0;
+    mFullRefreshRate = 0;
+    mIdleRefreshEntries = 0;
+
     return true;
 }
 
@@ -69,7 +88,7 @@ void PrimaryDevice::repeatedFrameEventListener(void *data)
 void PrimaryDevice::repeatedFrameListener()
 {
     Hwcomposer::getInstance().getDisplayAnalyzer()->postIdleEntryEvent();
-    Hwcomposer::getInstance().invalidate();
+    Hwcomposer::getInstance().invalidate(Hwcomposer::INVALIDATE_IDLE);
 }
 
 bool PrimaryDevice::blank(bool blank)
@@ -77,8 +96,113 @@ bool PrimaryDevice::blank(bool blank)
     if (!mConnected)
         return true;
 
+    // the panel comes back at full rate. The screen goes dark anyway, the
+    // rate is set now rather than by the commit of a frame.
+    if (blank) {
+        Mutex::Autolock _l(mLock);
+        if (mIdleRefresh) {
+            ITRACE("blank, refresh rate %d -> %d Hz", mIdleRefreshRate,
+                   mFullRefreshRate);
+            Drm *drm = Hwcomposer::getInstance().getDrm();
+            if (!drm->setRefreshRate(mType, mFullRefreshRate)) {
+                WTRACE("failed to restore full refresh rate");
+            }
+            mIdleRefresh = false;
+            onRefreshChanged();
+        }
+    }
     return PhysicalDevice::blank(blank);
 }
 
+int PrimaryDevice::findIdleRefreshRate()
+{
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    drmModeModeInfo current;
+    if (!drm->getModeInfo(mType, current)) {
+        return 0;
+    }
+    if (mFullRefreshRate == 0) {
+        mFullRefreshRate = current.vrefresh;
+    }
+
+    // DRRS panels list the same timing at the lower rates they support
+    int count = 0;
+    drmModeModeInfoPtr modes = drm->detectAllConfigs(mType, &count);
+    int hz = 0;
+    for (int i = 0; modes && i < count; i++) {
+        int vrefresh = (int)modes[i].vrefresh;
+        if (modes[i].hdisplay != current.hdisplay ||
+            modes[i].vdisplay != current.vdisplay ||
+            vrefresh >= mFullRefreshRate ||
+            vrefresh < mIdleRefreshMin) {
+            continue;
+        }
+        if (hz == 0 || vrefresh < hz) {
+            hz = vrefresh;
+        }
+    }
+    return hz;
+}
+
+void PrimaryDevice::setIdleRefresh(bool idle)
+{
+    Mutex::Autolock _l(mLock);
+    if (!mConnected || idle == mIdleRefresh) {
+        return;
+    }
+
+    // called from the analysis of a frame, whose commit makes the switch;
+    // the idle frame is composed by GLES, so it shows in the new timings
+    // without a blank
+    int hz;
+    if (idle) {
+        if (!mIdleRefreshEnabled || mBlank) {
+            return;
+        }
+        hz = findIdleRefreshRate();
+        if (hz == 0) {
+            // nothing below the full rate, don't look again
+            VTRACE("panel has no idle refresh rate");
+            mIdleRefreshEnabled = false;
+            return;
+        }
+        ITRACE("idle, refresh rate %d -> %d Hz", mFullRefreshRate, hz);
+    } else {
+        hz = mFullRefreshRate;
+        ITRACE("active, refresh rate %d -> %d Hz", mIdleRefreshRate, hz);
+    }
+
+    if (!PhysicalDevice::switchRefreshRate(hz)) {
+        return;
+    }
+    if (idle) {
+        mIdleRefreshRate = hz;
+        mIdleRefreshEntries++;
+    }
+    mIdleRefresh = idle;
+}
+
+bool PrimaryDevice::switchRefreshRate(int hz)
+{
+    if (!PhysicalDevice::switchRefreshRate(hz)) {
+        return false;
+    }
+
+    // the selected config is the full rate the panel comes back to
+    mFullRefreshRate = hz;
+    mIdleRefresh = false;
+    return true;
+}
+
+void PrimaryDevice::dump(Dump& d)
+{
+    PhysicalDevice::dump(d);
+    d.append("Idle refresh: %s, %s at %d Hz (full %d Hz), entered %u times\n",
+             mIdleRefreshEnabled ? "enabled" : "disabled",
+             mIdleRefresh ? "idle" : "active",
+             mIdleRefresh ? mIdleRefreshRate : mFullRefreshRate,
+             mFullRefreshRate, mIdleRefreshEntries);
+}
+
 } // namespace intel
 } // namespace android
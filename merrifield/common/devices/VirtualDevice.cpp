@@ -19,6 +19,11 @@
 #include <DisplayQuery.h>
 #include <VirtualDevice.h>
 #include <SoftVsyncObserver.h>
+#include <ColorSwap.h>
+#include <ObjectPool.h>
+#include <MemoryAccounting.h>
+#include <VaDisplayManager.h>
+#include <TuningPolicy.h>
 
 #include <binder/IServiceManager.h>
 #include <binder/ProcessState.h>
@@ -36,9 +41,32 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
 
-#define NUM_CSC_BUFFERS 6
 #define NUM_SCALING_BUFFERS 3
+// RGB input surfaces kept mapped for VSP
+#define VA_MAP_CACHE_SIZE 8
+// longest a task waits for its input buffers before going ahead anyway
+#define FENCE_WAIT_TIMEOUT_MS 300
+#define MAX_WAIT_FENCES 4
+// an undamaged frame is still sent this often to keep the sink fed
+#define STATIC_FRAME_RESEND_INTERVAL s2ns(1)
+// content cadence detection: a gap longer than this restarts measuring,
+// and a new cadence must hold for this many video frames to be applied
+#define CADENCE_MAX_INTERVAL ms2ns(200)
+#define CADENCE_STABLE_FRAMES 30
+// the longest the render waits for the sink to return a frame once it
+// holds its in-flight window, see TuningPolicy for the window
+#define SINK_BACKPRESSURE_TIMEOUT ms2ns(32)
+// content frame rate: a timestamp gap longer than this, in microseconds,
+// restarts the window
+#define CONTENT_RATE_MAX_GAP 200000
+// per-frame task objects in flight are bounded by the CSC buffers
+#define NUM_POOLED_TASKS (TuningPolicy::MAX_CSC_BUFFERS + 2)
+// compose tasks between two dumps of the VSP inputs and output
+#define DEFAULT_DUMP_INTERVAL 200
+// upscaling is left to the sink this long once it costs too much
+#define UPSCALE_BACKOFF s2ns(5)
 
 #define QCIF_WIDTH 176
 #define QCIF_HEIGHT 144
@@ -46,6 +74,38 @@
 namespace android {
 namespace intel {
 
+static inline uint64_t buffer_stamp(buffer_handle_t handle)
+{
+    return reinterpret_cast<const IMG_native_handle_t*>(handle)->ui64Stamp;
+}
+
+// hwc.policy.csc_buffers, read once at start
+static uint32_t getCscBufferCount()
+{
+    TuningPolicy::Values policy;
+    TuningPolicy::getValues(policy);
+    return policy.cscBuffers;
+}
+
+static uint32_t classify_cadence(nsecs_t interval)
+{
+    static const uint32_t rates[] = { 24, 25, 30, 60 };
+    uint32_t best = 0;
+    nsecs_t bestError = 0;
+    for (size_t i = 0; i < sizeof(rates)/sizeof(rates[0]); i++) {
+        nsecs_t period = s2ns(1) / rates[i];
+        nsecs_t error = interval > period ? interval - period : period - interval;
+        // within 10% of a standard content rate
+        if (error * 10 > period)
+            continue;
+        if (best == 0 || error < bestError) {
+            best = rates[i];
+            bestError = error;
+        }
+    }
+    return best;
+}
+
 static inline uint32_t align_width(uint32_t val)
 {
     return align_to(val, 64);
@@ -60,6 +120,12 @@ static void my_close_fence(const char* func, const char* fenceName, int& fenceFd
 {
     if (fenceFd != -1) {
         ALOGV("%s: closing fence %s (fd=%d)", func, fenceName, fenceFd);
+        // batched off the frame path while HWC runs
+        FenceCloser *closer = Hwcomposer::getInstance().getFenceCloser();
+        if (closer) {
+            closer->close(fenceFd);
+            return;
+        }
         int err = close(fenceFd);
         if (err < 0) {
             ALOGE("%s: fence %s close error %d: %s", func, fenceName, err, strerror(errno));
@@ -72,7 +138,7 @@ static void my_sync_wait_and_close(const char* func, const char* fenceName, int&
 {
     if (fenceFd != -1) {
         ALOGV("%s: waiting on fence %s (fd=%d)", func, fenceName, fenceFd);
-        int err = sync_wait(fenceFd, 300);
+        int err = sync_wait(fenceFd, FENCE_WAIT_TIMEOUT_MS);
         if (err < 0) {
             ALOGE("%s: fence %s sync_wait error %d: %s", func, fenceName, err, strerror(errno));
         }
@@ -80,6 +146,58 @@ static void my_sync_wait_and_close(const char* func, const char* fenceName, int&
     }
 }
 
+// Waits on several fences at once, so the total wait is bounded by one
+// timeout instead of one per fence. Each fence is closed as it signals.
+static void my_sync_wait_all_and_close(const char* func, int* fenceFds[], size_t count)
+{
+    struct pollfd fds[MAX_WAIT_FENCES];
+    int* owners[MAX_WAIT_FENCES];
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(FENCE_WAIT_TIMEOUT_MS);
+
+    if (count > MAX_WAIT_FENCES)
+        count = MAX_WAIT_FENCES;
+
+    for (;;) {
+        nfds_t pending = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (*fenceFds[i] == -1)
+                continue;
+            fds[pending].fd = *fenceFds[i];
+            fds[pending].events = POLLIN;
+            fds[pending].revents = 0;
+            owners[pending] = fenceFds[i];
+            pending++;
+        }
+        if (pending == 0)
+            return;
+
+        int timeout = ns2ms(deadline - systemTime(SYSTEM_TIME_MONOTONIC));
+        if (timeout <= 0) {
+            ALOGE("%s: timed out waiting on %d fence(s)", func, (int)pending);
+            break;
+        }
+
+        ALOGV("%s: waiting on %d fence(s)", func, (int)pending);
+        int ret = poll(fds, pending, timeout);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("%s: fence poll error %d: %s", func, ret, strerror(errno));
+            break;
+        }
+        for (nfds_t i = 0; i < pending; i++) {
+            if (fds[i].revents & (POLLIN | POLLERR | POLLNVAL)) {
+                if (!(fds[i].revents & POLLIN))
+                    ALOGE("%s: fence (fd=%d) signaled with error", func, fds[i].fd);
+                my_close_fence(func, "acquire", *owners[i]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+        my_close_fence(func, "acquire", *fenceFds[i]);
+}
+
 static void my_timeline_inc(const char* func, const char* timelineName, int& syncTimelineFd)
 {
     if (syncTimelineFd != -1) {
@@ -93,6 +211,7 @@ static void my_timeline_inc(const char* func, const char* timelineName, int& syn
 
 #define CLOSE_FENCE(fenceName)          my_close_fence(__func__, #fenceName, fenceName)
 #define SYNC_WAIT_AND_CLOSE(fenceName)  my_sync_wait_and_close(__func__, #fenceName, fenceName)
+#define SYNC_WAIT_ALL_AND_CLOSE(fences) my_sync_wait_all_and_close(__func__, fences, sizeof(fences)/sizeof(fences[0]))
 #define TIMELINE_INC(timelineName)      my_timeline_inc(__func__, #timelineName, timelineName)
 
 class MappedSurface {
@@ -272,10 +391,12 @@ VirtualDevice::CachedBuffer::CachedBuffer(BufferManager *mgr, buffer_handle_t ha
     : manager(mgr),
       mapper(NULL),
       vaMappedHandle(NULL),
-      cachedKhandle(0)
+      cachedKhandle(0),
+      stamp(buffer_stamp(handle)),
+      lastUsed(0)
 {
     DataBuffer *buffer = manager->lockDataBuffer((buffer_handle_t)handle);
-    mapper = manager->map(*buffer);
+    mapper = manager->map(*buffer, BufferManager::MAPPING_OWNER_VIRTUAL);
     manager->unlockDataBuffer(buffer);
 }
 
@@ -283,7 +404,7 @@ VirtualDevice::CachedBuffer::~CachedBuffer()
 {
     if (vaMappedHandle != NULL)
         delete vaMappedHandle;
-    manager->unmap(mapper);
+    manager->unmap(mapper, BufferManager::MAPPING_OWNER_VIRTUAL);
 }
 
 VirtualDevice::HeldDecoderBuffer::HeldDecoderBuffer(const sp<VirtualDevice>& vd, const android::sp<CachedBuffer>& cachedBuffer)
@@ -308,17 +429,36 @@ struct VirtualDevice::Task : public RefBase {
 };
 
 struct VirtualDevice::RenderTask : public VirtualDevice::Task {
-    RenderTask() : successful(false) { }
-    virtual void run(VirtualDevice& vd) = 0;
+    RenderTask() : successful(false), completed(false), renderStart(0), renderEnd(0) { }
+    virtual void run(VirtualDevice& vd) {
+        // delays the timeline, and so SurfaceFlinger's release fence
+        vd.waitForSink();
+        renderStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        render(vd);
+        renderEnd = systemTime(SYSTEM_TIME_MONOTONIC);
+        // the worker thread's OnFrameReadyTask waits for this
+        Mutex::Autolock _l(vd.mTaskLock);
+        completed = true;
+    }
+    virtual void render(VirtualDevice& vd) = 0;
     bool successful;
+    bool completed;
+    // frame timeline, read by the OnFrameReadyTask once completed
+    nsecs_t renderStart;
+    nsecs_t renderEnd;
 };
 
 struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
+    DECLARE_POOLED_OBJECT(ComposeTask, NUM_POOLED_TASKS);
+
     ComposeTask()
         : videoKhandle(0),
           rgbHandle(NULL),
+          cacheRgbMapping(false),
+          rgbPixelFormat(VA_FOURCC_BGRA),
           mappedRgbIn(NULL),
           outputHandle(NULL),
+          upscaled(false),
           yuvAcquireFenceFd(-1),
           rgbAcquireFenceFd(-1),
           outbufAcquireFenceFd(-1),
@@ -335,15 +475,14 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
         TIMELINE_INC(syncTimelineFd);
     }
 
-    virtual void run(VirtualDevice& vd) {
-        bool dump = false;
-        if (vd.mDebugVspDump && ++vd.mDebugCounter > 200) {
-            dump = true;
-            vd.mDebugCounter = 0;
-        }
+    virtual void render(VirtualDevice& vd) {
+        bool dump = vd.mFrameDumper.sample();
 
-        SYNC_WAIT_AND_CLOSE(yuvAcquireFenceFd);
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t cpuStart = systemTime(SYSTEM_TIME_THREAD);
 
+        // Map everything before waiting, so surface setup overlaps with
+        // the producers still rendering into these buffers.
         VASurfaceID videoInSurface;
         if (videoKhandle == 0) {
             videoInSurface = vd.va_blank_yuv_in;
@@ -361,8 +500,16 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
             ETRACE("Couldn't map video");
             return;
         }
-        SYNC_WAIT_AND_CLOSE(rgbAcquireFenceFd);
-        SYNC_WAIT_AND_CLOSE(outbufAcquireFenceFd);
+
+        // VA objects only live on this thread, so the RGB mapping cache
+        // is looked up here rather than in queueCompose()
+        if (rgbHandle != NULL && cacheRgbMapping) {
+            mappedRgbIn = vd.getVaMapping(rgbHandle, outWidth, outHeight, rgbPixelFormat);
+            if (mappedRgbIn == NULL) {
+                ETRACE("Unable to map RGB surface");
+                return;
+            }
+        }
 
         VAMappedHandle mappedVideoOut(vd.va_dpy, outputHandle, align_width(outWidth), align_height(outHeight), (unsigned int)VA_FOURCC_NV12);
         if (mappedVideoOut.surface == 0) {
@@ -370,12 +517,20 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
             return;
         }
 
+        nsecs_t mapped = systemTime(SYSTEM_TIME_MONOTONIC);
+        vd.addStageTime(STAGE_MAP, mapped - start);
+
+        int* fences[] = { &yuvAcquireFenceFd, &rgbAcquireFenceFd, &outbufAcquireFenceFd };
+        SYNC_WAIT_ALL_AND_CLOSE(fences);
+        nsecs_t waited = systemTime(SYSTEM_TIME_MONOTONIC);
+        vd.addStageTime(STAGE_FENCE_WAIT, waited - mapped);
+
         if (dump)
-            dumpSurface(vd.va_dpy, "/data/misc/vsp_in.yuv", videoInSurface, videoStride*videoBufHeight*3/2);
+            dumpSurface(vd, "vsp_in_yuv", videoInSurface, videoStride*videoBufHeight*3/2);
 
         if (mappedRgbIn != NULL) {
             if (dump)
-                dumpSurface(vd.va_dpy, "/data/misc/vsp_in.rgb", mappedRgbIn->surface, align_width(outWidth)*align_height(outHeight)*4);
+                dumpSurface(vd, "vsp_in_rgb", mappedRgbIn->surface, align_width(outWidth)*align_height(outHeight)*4);
             vd.vspCompose(videoInSurface, mappedRgbIn->surface, mappedVideoOut.surface, &surface_region, &output_region);
         }
         else if (rgbHandle != NULL) {
@@ -385,34 +540,41 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
         else {
             // No RGBA, so compose with 100% transparent RGBA frame.
             if (dump)
-                dumpSurface(vd.va_dpy, "/data/misc/vsp_in.rgb", vd.va_blank_rgb_in, align_width(outWidth)*align_height(outHeight)*4);
+                dumpSurface(vd, "vsp_in_rgb", vd.va_blank_rgb_in, align_width(outWidth)*align_height(outHeight)*4);
             vd.vspCompose(videoInSurface, vd.va_blank_rgb_in, mappedVideoOut.surface, &surface_region, &output_region);
         }
+        nsecs_t composed = systemTime(SYSTEM_TIME_MONOTONIC);
+        vd.addStageTime(STAGE_COMPOSE, composed - waited);
+        if (upscaled) {
+            // the wait covers the GPU scaling blit of the RGB layer
+            int32_t cost = ns2us(composed - mapped);
+            int32_t average = android_atomic_acquire_load(&vd.mUpscaleCostUs);
+            android_atomic_release_store(average ? average + (cost - average) / 4 : cost,
+                                         &vd.mUpscaleCostUs);
+        }
         if (dump)
-            dumpSurface(vd.va_dpy, "/data/misc/vsp_out.yuv", mappedVideoOut.surface, align_width(outWidth)*align_height(outHeight)*3/2);
+            dumpSurface(vd, "vsp_out_yuv", mappedVideoOut.surface, align_width(outWidth)*align_height(outHeight)*3/2);
         TIMELINE_INC(syncTimelineFd);
+        vd.addStageTime(STAGE_RENDER_CPU, systemTime(SYSTEM_TIME_THREAD) - cpuStart);
         successful = true;
     }
-    void dumpSurface(VADisplay va_dpy, const char* filename, VASurfaceID surf, int size) {
-        MappedSurface dumpSurface(va_dpy, surf);
-        if (dumpSurface.valid()) {
-            int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-            if (fd > 0) {
-                write(fd, dumpSurface.getPtr(), size);
-                close(fd);
-                ALOGI("Output dumped");
-            }
-            else
-                ALOGE("Error %d opening output file: %s", errno, strerror(errno));
+    void dumpSurface(VirtualDevice& vd, const char* name, VASurfaceID surf, int size) {
+        // only the copy into the dump ring is paid on this thread
+        MappedSurface dumpSurface(vd.va_dpy, surf);
+        if (!dumpSurface.valid()) {
+            ALOGE("Failed to map %s for dump", name);
+            return;
         }
-        else
-            ALOGE("Failed to map output for dump");
+        if (!vd.mFrameDumper.capture(name, dumpSurface.getPtr(), size))
+            VTRACE("Dump ring full, %s not dumped", name);
     }
     buffer_handle_t videoKhandle;
     uint32_t videoStride;
     uint32_t videoBufHeight;
     bool videoTiled;
     buffer_handle_t rgbHandle;
+    bool cacheRgbMapping;
+    unsigned int rgbPixelFormat;
     sp<RefBase> heldRgbHandle;
     sp<VAMappedHandleObject> mappedRgbIn;
     buffer_handle_t outputHandle;
@@ -420,6 +582,8 @@ struct VirtualDevice::ComposeTask : public VirtualDevice::RenderTask {
     VARectangle output_region;
     uint32_t outWidth;
     uint32_t outHeight;
+    // output at the sink's size instead of the FB target's
+    bool upscaled;
     sp<CachedBuffer> videoCachedBuffer;
     sp<RefBase> heldVideoBuffer;
     int yuvAcquireFenceFd;
@@ -438,11 +602,14 @@ struct VirtualDevice::EnableVspTask : public VirtualDevice::Task {
 
 struct VirtualDevice::DisableVspTask : public VirtualDevice::Task {
     virtual void run(VirtualDevice& vd) {
+        vd.mVaMapCache.clear();
         vd.vspDisable();
     }
 };
 
 struct VirtualDevice::BlitTask : public VirtualDevice::RenderTask {
+    DECLARE_POOLED_OBJECT(BlitTask, NUM_POOLED_TASKS);
+
     BlitTask()
         : srcAcquireFenceFd(-1),
           destAcquireFenceFd(-1),
@@ -459,15 +626,20 @@ struct VirtualDevice::BlitTask : public VirtualDevice::RenderTask {
         TIMELINE_INC(syncTimelineFd);
     }
 
-    virtual void run(VirtualDevice& vd) {
-        SYNC_WAIT_AND_CLOSE(srcAcquireFenceFd);
+    virtual void render(VirtualDevice& vd) {
+        // the blit itself waits for the source, only the destination
+        // has to be released before it is queued
         SYNC_WAIT_AND_CLOSE(destAcquireFenceFd);
         BufferManager* mgr = vd.mHwc.getBufferManager();
-        if (!(mgr->blit(srcHandle, destHandle, destRect, false, false))) {
+        int blitFenceFd = mgr->blitAsync(srcHandle, destHandle, destRect, false, srcAcquireFenceFd);
+        CLOSE_FENCE(srcAcquireFenceFd);
+        if (blitFenceFd < 0) {
             ETRACE("color space conversion from RGB to NV12 failed");
         }
-        else
+        else {
+            SYNC_WAIT_AND_CLOSE(blitFenceFd);
             successful = true;
+        }
         TIMELINE_INC(syncTimelineFd);
     }
     buffer_handle_t srcHandle;
@@ -511,27 +683,62 @@ struct VirtualDevice::BufferInfoChangedTask : public VirtualDevice::Task {
 };
 
 struct VirtualDevice::OnFrameReadyTask : public VirtualDevice::Task {
+    DECLARE_POOLED_OBJECT(OnFrameReadyTask, NUM_POOLED_TASKS);
+
     virtual void run(VirtualDevice& vd) {
+        // frames queued behind this one, including itself
+        int32_t queued = android_atomic_dec(&vd.mPendingFrames);
+        if (renderTask != NULL) {
+            Mutex::Autolock _l(vd.mTaskLock);
+            while (!renderTask->completed) {
+                VTRACE("Waiting for WidiBlit thread to render frame...");
+                vd.mRequestDequeued.wait(vd.mTaskLock);
+            }
+        }
         if (renderTask != NULL && !renderTask->successful)
             return;
 
+        // a slow sink loses its oldest frame rather than the newest one,
+        // the buffer goes back to the pool with this task
+        if (queued > 1 && vd.isSinkBehind()) {
+            VTRACE("Sink is behind, dropping frame %p", handle);
+            android_atomic_inc(&vd.mDroppedFrames);
+            return;
+        }
+
         {
             Mutex::Autolock _l(vd.mHeldBuffersLock);
             //Add the heldbuffer to the vector before calling onFrameReady, so that the buffer will be removed
             //from the vector properly even if the notifyBufferReturned call acquires mHeldBuffersLock first.
             vd.mHeldBuffers.add(handle, heldBuffer);
+            vd.mHeldSince.add(handle, systemTime(SYSTEM_TIME_MONOTONIC));
+            if (vd.mHeldBuffers.size() > vd.mMaxInFlight)
+                vd.mMaxInFlight = vd.mHeldBuffers.size();
         }
 #ifdef INTEL_WIDI
         // FIXME: we could remove this casting once onFrameReady receives
         // a buffer_handle_t handle
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
         status_t result = frameListener->onFrameReady((uint32_t)handle, handleType, renderTimestamp, mediaTimestamp);
+        nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+        vd.addStageTime(STAGE_NOTIFY, end - start);
+        // renderTimestamp is the prepare time of the frame
+        if (renderTask != NULL) {
+            vd.addStageTime(STAGE_QUEUE, renderTask->renderStart - renderTimestamp);
+            vd.addStageTime(STAGE_DELIVER, start - renderTask->renderEnd);
+        }
+        vd.addStageTime(STAGE_HWC, end - renderTimestamp);
         if (result != OK) {
             Mutex::Autolock _l(vd.mHeldBuffersLock);
             vd.mHeldBuffers.removeItem(handle);
+            vd.mHeldSince.removeItem(handle);
+            vd.mHeldBuffersReturned.broadcast();
         }
 #else
         Mutex::Autolock _l(vd.mHeldBuffersLock);
         vd.mHeldBuffers.removeItem(handle);
+        vd.mHeldSince.removeItem(handle);
+        vd.mHeldBuffersReturned.broadcast();
 #endif
     }
     sp<RenderTask> renderTask;
@@ -550,19 +757,22 @@ struct VirtualDevice::BufferList::HeldBuffer : public RefBase {
         : mList(list),
           mHandle(handle),
           mWidth(w),
-          mHeight(h) { }
+          mHeight(h),
+          mGeneration(list.mGeneration) { }
     virtual ~HeldBuffer()
     {
         Mutex::Autolock _l(mList.mVd.mTaskLock);
-        if (mWidth == mList.mWidth && mHeight == mList.mHeight) {
+        Buffer buffer;
+        buffer.handle = mHandle;
+        buffer.width = mWidth;
+        buffer.height = mHeight;
+        buffer.lastUsed = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (mGeneration == mList.mGeneration) {
             VTRACE("Returning %s buffer %p (%ux%u) to list", mList.mName, mHandle, mWidth, mHeight);
-            mList.mAvailableBuffers.push_back(mHandle);
+            mList.mAvailableBuffers.push_front(buffer);
         } else {
-            VTRACE("Deleting %s buffer %p (%ux%u)", mList.mName, mHandle, mWidth, mHeight);
-            BufferManager* mgr = mList.mVd.mHwc.getBufferManager();
-            mgr->freeGrallocBuffer((mHandle));
-            if (mList.mBuffersToCreate < mList.mLimit)
-                mList.mBuffersToCreate++;
+            // the list was cleared while this buffer was out
+            mList.freeBuffer(buffer);
         }
     }
 
@@ -570,6 +780,7 @@ struct VirtualDevice::BufferList::HeldBuffer : public RefBase {
     buffer_handle_t mHandle;
     uint32_t mWidth;
     uint32_t mHeight;
+    uint32_t mGeneration;
 };
 
 VirtualDevice::BufferList::BufferList(VirtualDevice& vd, const char* name,
@@ -579,66 +790,122 @@ VirtualDevice::BufferList::BufferList(VirtualDevice& vd, const char* name,
       mLimit(limit),
       mFormat(format),
       mUsage(usage),
-      mBuffersToCreate(0),
-      mWidth(0),
-      mHeight(0)
+      mAllocated(0),
+      mGeneration(0),
+      mRingGeneration(0)
 {
 }
 
-buffer_handle_t VirtualDevice::BufferList::get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer)
+buffer_handle_t VirtualDevice::BufferList::get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer,
+                                               bool allowLarger)
 {
     width = align_width(width);
     height = align_height(height);
-    if (mWidth != width || mHeight != height) {
-        ITRACE("%s buffers changing from %dx%d to %dx%d",
-                mName, mWidth, mHeight, width, height);
-        clear();
-        mWidth = width;
-        mHeight = height;
-        mBuffersToCreate = mLimit;
-    }
-
-    buffer_handle_t handle;
-    if (mAvailableBuffers.empty()) {
-        if (mBuffersToCreate <= 0)
-            return NULL;
+    trim(systemTime(SYSTEM_TIME_MONOTONIC));
+
+    // prefer an exact match, otherwise the smallest buffer that fits
+    // without wasting more than twice the requested area
+    List<Buffer>::iterator best = mAvailableBuffers.end();
+    for (List<Buffer>::iterator i = mAvailableBuffers.begin(); i != mAvailableBuffers.end(); ++i) {
+        if (i->width == width && i->height == height) {
+            best = i;
+            break;
+        }
+        if (!allowLarger || i->width < width || i->height < height)
+            continue;
+        if (i->width * i->height > 2 * width * height)
+            continue;
+        if (best == mAvailableBuffers.end() ||
+            i->width * i->height < best->width * best->height)
+            best = i;
+    }
+
+    Buffer buffer;
+    if (best != mAvailableBuffers.end()) {
+        buffer = *best;
+        mAvailableBuffers.erase(best);
+        if (buffer.width != width || buffer.height != height)
+            VTRACE("Using %s buffer %p (%ux%u) for %ux%u", mName, buffer.handle,
+                   buffer.width, buffer.height, width, height);
+    } else {
+        if (mAllocated >= mLimit) {
+            if (mAvailableBuffers.empty())
+                return NULL;
+            // make room by dropping the least recently used idle buffer
+            List<Buffer>::iterator last = --mAvailableBuffers.end();
+            freeBuffer(*last);
+            mAvailableBuffers.erase(last);
+            mAllocated--;
+        }
         BufferManager* mgr = mVd.mHwc.getBufferManager();
-        handle = reinterpret_cast<buffer_handle_t>(
+        buffer.handle = reinterpret_cast<buffer_handle_t>(
             mgr->allocGrallocBuffer(width, height, mFormat, mUsage));
-        if (handle == NULL){
+        if (buffer.handle == NULL) {
             ETRACE("failed to allocate %s buffer", mName);
             return NULL;
         }
-        mBuffersToCreate--;
-    }
-    else {
-        handle = *mAvailableBuffers.begin();
-        mAvailableBuffers.erase(mAvailableBuffers.begin());
+        ITRACE("Allocated %s buffer %p (%ux%u)", mName, buffer.handle, width, height);
+        MemoryAccounting::add(MemoryAccounting::VIRTUAL_BUFFER, getBytes(width, height));
+        buffer.width = width;
+        buffer.height = height;
+        mAllocated++;
+        mRingGeneration++;
+    }
+    *heldBuffer = new HeldBuffer(*this, buffer.handle, buffer.width, buffer.height);
+    return buffer.handle;
+}
+
+void VirtualDevice::BufferList::trim(nsecs_t now)
+{
+    // idle CSC/upscale buffers are freed after the video idle time
+    nsecs_t idleTime = TuningPolicy::getVideoIdleTime();
+    if (!idleTime)
+        return;
+
+    // the list is kept in return order, so idle buffers are at the back
+    while (!mAvailableBuffers.empty()) {
+        List<Buffer>::iterator last = --mAvailableBuffers.end();
+        if (now - last->lastUsed < idleTime)
+            break;
+        VTRACE("Trimming idle %s buffer %p (%ux%u)", mName, last->handle, last->width, last->height);
+        MemoryAccounting::reclaim(MemoryAccounting::VIRTUAL_BUFFER, getBytes(last->width, last->height));
+        freeBuffer(*last);
+        mAvailableBuffers.erase(last);
+        mAllocated--;
     }
-    *heldBuffer = new HeldBuffer(*this, handle, width, height);
-    return handle;
+}
+
+void VirtualDevice::BufferList::freeBuffer(const Buffer& buffer)
+{
+    VTRACE("Deleting %s buffer %p (%ux%u)", mName, buffer.handle, buffer.width, buffer.height);
+    mVd.mHwc.getBufferManager()->freeGrallocBuffer(buffer.handle);
+    mRingGeneration++;
+    MemoryAccounting::remove(MemoryAccounting::VIRTUAL_BUFFER, getBytes(buffer.width, buffer.height));
+}
+
+size_t VirtualDevice::BufferList::getBytes(uint32_t width, uint32_t height) const
+{
+    // a full read of the buffer is its size
+    return BandwidthEstimator::getFetchBytes(mFormat, width, height, false);
 }
 
 void VirtualDevice::BufferList::clear()
 {
-    if (mWidth != 0 || mHeight != 0)
-        ITRACE("Releasing %s buffers (%ux%u)", mName, mWidth, mHeight);
-    if (!mAvailableBuffers.empty()) {
-        // iterate the list and call freeGraphicBuffer
-        for (List<buffer_handle_t>::iterator i = mAvailableBuffers.begin(); i != mAvailableBuffers.end(); ++i) {
-            VTRACE("Deleting the gralloc buffer associated with handle (%p)", (*i));
-            mVd.mHwc.getBufferManager()->freeGrallocBuffer((*i));
-        }
-        mAvailableBuffers.clear();
-    }
-    mWidth = 0;
-    mHeight = 0;
+    if (mAllocated != 0)
+        ITRACE("Releasing %s buffers", mName);
+    for (List<Buffer>::iterator i = mAvailableBuffers.begin(); i != mAvailableBuffers.end(); ++i) {
+        freeBuffer(*i);
+    }
+    mAvailableBuffers.clear();
+    // buffers still out are freed when they come back
+    mAllocated = 0;
+    mGeneration++;
 }
 
 VirtualDevice::VirtualDevice(Hwcomposer& hwc)
     : mProtectedMode(false),
       mCscBuffers(*this, "CSC",
-                  NUM_CSC_BUFFERS, DisplayQuery::queryNV12Format(),
+                  getCscBufferCount(), DisplayQuery::queryNV12Format(),
                   GRALLOC_USAGE_HW_VIDEO_ENCODER | GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_PRIVATE_1),
       mRgbUpscaleBuffers(*this, "RGB upscale",
                          NUM_SCALING_BUFFERS, HAL_PIXEL_FORMAT_BGRA_8888,
@@ -654,12 +921,25 @@ VirtualDevice::VirtualDevice(Hwcomposer& hwc)
       mCachedBufferCapcity(16),
       mDecWidth(0),
       mDecHeight(0),
-      mFpsDivider(1)
+      mFpsDivider(1),
+      mLastVideoUpdate(0),
+      mLastVideoTimestamp(-1),
+      mVideoInterval(0),
+      mCandidateFps(0),
+      mCandidateCount(0),
+      mCadenceFps(0),
+      mRateCount(0),
+      mRateHead(0),
+      mContentRateN(0),
+      mContentRateD(1),
+      mPreparedFrames(0),
+      mBypassFrames(0)
 {
     CTRACE();
 #ifdef INTEL_WIDI
     mNextConfig.frameServerActive = false;
 #endif
+    memset(mStageStats, 0, sizeof(mStageStats));
 }
 
 VirtualDevice::~VirtualDevice()
@@ -671,35 +951,170 @@ sp<VirtualDevice::CachedBuffer> VirtualDevice::getMappedBuffer(buffer_handle_t h
 {
     ssize_t index = mMappedBufferCache.indexOfKey(handle);
     sp<CachedBuffer> cachedBuffer;
-    if (index == NAME_NOT_FOUND) {
-        if (mMappedBufferCache.size() > mCachedBufferCapcity)
-            mMappedBufferCache.clear();
+    if (index != NAME_NOT_FOUND) {
+        cachedBuffer = mMappedBufferCache[index];
+        if (cachedBuffer->stamp != buffer_stamp(handle)) {
+            // the app freed the buffer and the handle got reused
+            VTRACE("Dropping stale mapping of %p", handle);
+            mMappedBufferCache.removeItemsAt(index);
+            cachedBuffer = NULL;
+        }
+    }
+
+    if (cachedBuffer == NULL) {
+        // over the GTT budget every new mapping replaces an old one
+        if (mMappedBufferCache.size() >= mCachedBufferCapcity ||
+            (mMappedBufferCache.size() && mHwc.getBufferManager()->isOverBudget())) {
+            // evict the least recently used mapping
+            size_t victim = 0;
+            for (size_t i = 1; i < mMappedBufferCache.size(); i++) {
+                if (mMappedBufferCache[i]->lastUsed < mMappedBufferCache[victim]->lastUsed)
+                    victim = i;
+            }
+            mMappedBufferCache.removeItemsAt(victim);
+        }
 
         cachedBuffer = new CachedBuffer(mHwc.getBufferManager(), handle);
         mMappedBufferCache.add(handle, cachedBuffer);
-    } else {
-        cachedBuffer = mMappedBufferCache[index];
     }
 
+    cachedBuffer->lastUsed = ++mMappedBufferClock;
     return cachedBuffer;
 }
 
+sp<VirtualDevice::VAMappedHandleObject> VirtualDevice::getVaMapping(buffer_handle_t handle,
+        uint32_t stride, uint32_t height, unsigned int format)
+{
+    uint64_t stamp = buffer_stamp(handle);
+    for (size_t i = 0; i < mVaMapCache.size(); i++) {
+        if (mVaMapCache[i].handle != handle)
+            continue;
+
+        VaMapEntry entry = mVaMapCache[i];
+        mVaMapCache.removeAt(i);
+        if (entry.stamp == stamp && entry.stride == stride &&
+            entry.height == height && entry.format == format) {
+            // move it to the front
+            mVaMapCache.insertAt(entry, 0);
+            return entry.mapping;
+        }
+        // reallocated buffer or new geometry, map it again
+        break;
+    }
+
+    VaMapEntry entry;
+    entry.handle = handle;
+    entry.stamp = stamp;
+    entry.stride = stride;
+    entry.height = height;
+    entry.format = format;
+    entry.mapping = new VAMappedHandleObject(va_dpy, handle, stride, height, format);
+    if (entry.mapping->surface == 0) {
+        ETRACE("Failed to map %p to a VA surface", handle);
+        return NULL;
+    }
+
+    if (mVaMapCache.size() >= VA_MAP_CACHE_SIZE)
+        mVaMapCache.pop();
+    mVaMapCache.insertAt(entry, 0);
+    return entry.mapping;
+}
+
+bool VirtualDevice::pushTask(TaskRing& ring, const sp<Task>& task)
+{
+    if (!ring.push(task)) {
+        // tasks clean up their fences when dropped, so this only loses a frame
+        WTRACE("task ring full, dropping task");
+        return false;
+    }
+    return true;
+}
+
 bool VirtualDevice::threadLoop()
 {
-    sp<Task> task;
-    {
-        Mutex::Autolock _l(mTaskLock);
-        while (mTasks.empty()) {
-            mRequestQueued.wait(mTaskLock);
+    sp<Task> task = mTasks.pop();
+    if (task != NULL) {
+        task->run(*this);
+        task = NULL;
+    }
+    // wakes both queueCompose() and any OnFrameReadyTask waiting on a render;
+    // the waiters check the rings under mTaskLock, so the signal is sent
+    // under it too or it could fall between their check and their wait
+    Mutex::Autolock _l(mTaskLock);
+    mRequestDequeued.broadcast();
+
+    return true;
+}
+
+bool VirtualDevice::queueFrameReady(const sp<OnFrameReadyTask>& task)
+{
+    android_atomic_inc(&mPendingFrames);
+    if (!pushTask(mWorkerTasks, task)) {
+        android_atomic_dec(&mPendingFrames);
+        return false;
+    }
+    return true;
+}
+
+bool VirtualDevice::isUpscaleAffordable()
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (now < mUpscaleBackoffUntil) {
+        mUpscaleSkips++;
+        return false;
+    }
+
+#ifdef INTEL_WIDI
+    uint32_t refresh = mCurrentConfig.policy.refresh ? mCurrentConfig.policy.refresh : 60;
+#else
+    uint32_t refresh = 60;
+#endif
+    nsecs_t budget = s2ns(1) / refresh;
+    int32_t cost = android_atomic_acquire_load(&mUpscaleCostUs);
+    if (us2ns(cost) * 4 <= budget * 3)
+        return true;
+
+    // the sink scales the FB target sized output for a while, then the
+    // cost is measured again
+    ITRACE("VSP upscale takes %d us of a %lld us frame, leaving it to the sink",
+        cost, ns2us(budget));
+    mUpscaleBackoffUntil = now + UPSCALE_BACKOFF;
+    android_atomic_release_store(0, &mUpscaleCostUs);
+    mUpscaleSkips++;
+    return false;
+}
+
+void VirtualDevice::waitForSink()
+{
+    Mutex::Autolock _l(mHeldBuffersLock);
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + SINK_BACKPRESSURE_TIMEOUT;
+    while (mHeldBuffers.size() >= mInFlightWindow) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (now >= deadline) {
+            // latency stays bounded, the worker drops the oldest frame
+            VTRACE("Sink still holds %zu frames", mHeldBuffers.size());
+            break;
         }
-        task = *mTasks.begin();
-        mTasks.erase(mTasks.begin());
+        mHeldBuffersReturned.waitRelative(mHeldBuffersLock, deadline - now);
     }
+}
+
+bool VirtualDevice::isSinkBehind()
+{
+    Mutex::Autolock _l(mHeldBuffersLock);
+    return mHeldBuffers.size() >= mInFlightWindow;
+}
+
+bool VirtualDevice::workerThreadLoop()
+{
+    sp<Task> task = mWorkerTasks.pop();
     if (task != NULL) {
         task->run(*this);
         task = NULL;
     }
-    mRequestDequeued.signal();
+    // dropping an OnFrameReadyTask may return an RGB upscale buffer
+    Mutex::Autolock _l(mTaskLock);
+    mRequestDequeued.broadcast();
 
     return true;
 }
@@ -770,6 +1185,19 @@ status_t VirtualDevice::notifyBufferReturned(int handle)
         VTRACE("Removing heldBuffer associated with handle (%p)", handle);
         mHeldBuffers.removeItemsAt(index, 1);
     }
+
+    index = mHeldSince.indexOfKey((buffer_handle_t)handle);
+    if (index >= 0) {
+        // moving average of the time the sink holds a frame
+        nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - mHeldSince.valueAt(index);
+        addStageTime(STAGE_SINK, latency);
+        if (mSinkLatency == 0)
+            mSinkLatency = latency;
+        else
+            mSinkLatency += (latency - mSinkLatency) / 8;
+        mHeldSince.removeItemsAt(index, 1);
+    }
+    mHeldBuffersReturned.broadcast();
     return NO_ERROR;
 }
 
@@ -782,13 +1210,16 @@ status_t VirtualDevice::setResolution(const FrameProcessingPolicy& policy, sp<IF
     return NO_ERROR;
 }
 #endif
+// a full-screen RGB layer sent without GLES composition. Only the bottom
+// layer may be opaque, a layer above the video has to let it through.
 static bool canUseDirectly(const hwc_display_contents_1_t *display, size_t n)
 {
     const hwc_layer_1_t& fbTarget = display->hwLayers[display->numHwLayers-1];
     const hwc_layer_1_t& layer = display->hwLayers[n];
     const IMG_native_handle_t* nativeHandle = reinterpret_cast<const IMG_native_handle_t*>(layer.handle);
     return !(layer.flags & HWC_SKIP_LAYER) && layer.transform == 0 &&
-            layer.blending == HWC_BLENDING_PREMULT &&
+            (layer.blending == HWC_BLENDING_PREMULT ||
+             (n == 0 && layer.blending == HWC_BLENDING_NONE)) &&
             layer.sourceCropf.left == 0 && layer.sourceCropf.top == 0 &&
             layer.displayFrame.left == 0 && layer.displayFrame.top == 0 &&
             layer.sourceCropf.right == fbTarget.sourceCropf.right &&
@@ -828,10 +1259,15 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
         char propertyVal[PROPERTY_VALUE_MAX];
         if (property_get("widi.compose.rgb_upscale", propertyVal, NULL) > 0)
             mVspUpscale = atoi(propertyVal);
+        if (property_get("widi.extmode.rotation", propertyVal, "1") > 0)
+            mExtRotation = atoi(propertyVal);
         if (property_get("widi.compose.all_video", propertyVal, NULL) > 0)
             mDebugVspClear = atoi(propertyVal);
-        if (property_get("widi.compose.dump", propertyVal, NULL) > 0)
-            mDebugVspDump = atoi(propertyVal);
+        if (property_get("widi.compose.dump", propertyVal, NULL) > 0) {
+            // 1 keeps the historical sampling of one frame in 200
+            uint32_t interval = atoi(propertyVal);
+            mFrameDumper.setInterval(interval == 1 ? DEFAULT_DUMP_INTERVAL : interval);
+        }
 
         Hwcomposer::getInstance().getMultiDisplayObserver()->notifyWidiConnectionStatus(shouldBeConnected);
         mLastConnectionStatus = shouldBeConnected;
@@ -861,6 +1297,7 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
     const ssize_t fbTarget = display->numHwLayers-1;
     mRgbLayer = fbTarget;
     mYuvLayer = -1;
+    mVideoActive = false;
 
     DisplayAnalyzer *analyzer = mHwc.getDisplayAnalyzer();
 
@@ -917,6 +1354,9 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
 #ifdef INTEL_WIDI
     if (mCurrentConfig.frameServerActive && mCurrentConfig.extendedModeEnabled && mYuvLayer != -1) {
         if (handleExtendedMode(display)) {
+            // the video is sent by handleExtendedMode(), nothing is
+            // composed, but its cadence is still tracked
+            mVideoActive = true;
             mYuvLayer = -1;
             mRgbLayer = -1;
             // Extended mode is successful.
@@ -953,6 +1393,9 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
         else
             layer.compositionType = HWC_FRAMEBUFFER;
     }
+    mPreparedFrames++;
+    if (fbTarget > 0 && mRgbLayer != fbTarget)
+        mBypassFrames++;
     if (mYuvLayer != -1 && mRgbLayer == fbTarget)
         // This tells SurfaceFlinger to render this layer by writing transparent pixels
         // to this layer's target region within the framebuffer. This effectively punches
@@ -961,6 +1404,7 @@ bool VirtualDevice::prepare(hwc_display_contents_1_t *display)
         // together. Content above will draw on top of this hole and can cover the video.
         // This has no effect when the video is the bottommost layer.
         display->hwLayers[mYuvLayer].hints |= HWC_HINT_CLEAR_FB;
+    mVideoActive = mYuvLayer != -1;
 
 #ifdef INTEL_WIDI
     // we're streaming fbtarget, so send onFramePrepare and wait for composition to happen
@@ -974,17 +1418,26 @@ bool VirtualDevice::commit(hwc_display_contents_1_t *display, IDisplayContext *c
 {
     RETURN_FALSE_IF_NOT_INIT();
 
+    if (display == NULL || !mVideoActive)
+        resetCadence();
+
     if (display != NULL && (mRgbLayer != -1 || mYuvLayer != -1))
         sendToWidi(display);
 
+    {
+        // let memory drop while WiDi is idle
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        Mutex::Autolock _l(mTaskLock);
+        mCscBuffers.trim(now);
+        mRgbUpscaleBuffers.trim(now);
+    }
+
     if (mVspEnabled && !mVspInUse) {
-        mVaMapCache.clear();
         sp<DisableVspTask> disableVsp = new DisableVspTask();
         mMappedBufferCache.clear();
         Mutex::Autolock _l(mTaskLock);
         mRgbUpscaleBuffers.clear();
-        mTasks.push(disableVsp);
-        mRequestQueued.signal();
+        pushTask(mTasks, disableVsp);
         mVspEnabled = false;
     }
 
@@ -1055,20 +1508,23 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
     composeTask->outHeight = fbTarget.sourceCropf.bottom - fbTarget.sourceCropf.top;
 
     bool scaleRgb = false;
+    bool vspUpscale = false;
 #ifdef INTEL_WIDI
     if (mCurrentConfig.frameServerActive) {
-        if (mVspUpscale) {
+        vspUpscale = mVspUpscale && isUpscaleAffordable();
+        if (vspUpscale) {
             composeTask->outWidth = mCurrentConfig.policy.scaledWidth;
             composeTask->outHeight = mCurrentConfig.policy.scaledHeight;
             upscale_x = mCurrentConfig.policy.scaledWidth/(fbTarget.sourceCropf.right - fbTarget.sourceCropf.left);
             upscale_y = mCurrentConfig.policy.scaledHeight/(fbTarget.sourceCropf.bottom - fbTarget.sourceCropf.top);
             scaleRgb = composeTask->outWidth != fbTarget.sourceCropf.right - fbTarget.sourceCropf.left ||
                        composeTask->outHeight != fbTarget.sourceCropf.bottom - fbTarget.sourceCropf.top;
+            composeTask->upscaled = scaleRgb;
         }
 
         composeTask->outputHandle = mCscBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldBuffer);
         if (composeTask->outputHandle == NULL) {
-            WTRACE("Out of CSC buffers, dropping frame");
+            WTRACE_LIMITED("Out of CSC buffers, dropping frame");
             return true;
         }
     } else {
@@ -1090,11 +1546,13 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         return false;
     }
     composeTask->heldVideoBuffer = new HeldDecoderBuffer(this, composeTask->videoCachedBuffer);
-    IVideoPayloadManager::MetaData videoMetadata;
-    if (!mPayloadManager->getMetaData(composeTask->videoCachedBuffer->mapper, &videoMetadata)) {
+    const IVideoPayloadManager::MetaData *payloadMetadata =
+        mPayloadManager->getMetaData(composeTask->videoCachedBuffer->mapper);
+    if (!payloadMetadata) {
         ETRACE("Failed to map video payload info");
         return false;
     }
+    const IVideoPayloadManager::MetaData& videoMetadata = *payloadMetadata;
     if (videoMetadata.normalBuffer.width == 0 || videoMetadata.normalBuffer.height == 0) {
         ETRACE("Bad video metadata for handle %p", yuvLayer.handle);
         return false;
@@ -1164,6 +1622,8 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         return true;
     }
 
+    updateCadence(videoMetadata.timestamp);
+
     composeTask->videoKhandle = info.khandle;
     composeTask->videoStride = info.lumaStride;
     composeTask->videoBufHeight = info.bufHeight;
@@ -1220,6 +1680,17 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         composeTask->videoTiled = false;
     }
 
+#ifdef INTEL_WIDI
+    if (mCurrentConfig.frameServerActive && yuvLayer.acquireFenceFd == -1 &&
+        isUndamagedFrame(display, mRgbLayer != -1 ? &display->hwLayers[mRgbLayer] : NULL,
+                         composeTask->videoKhandle, videoMetadata.timestamp,
+                         composeTask->outWidth, composeTask->outHeight)) {
+        VTRACE("No damage, skipping compose");
+        CLOSE_FENCE(display->outbufAcquireFenceFd);
+        return true;
+    }
+#endif
+
     composeTask->yuvAcquireFenceFd = yuvLayer.acquireFenceFd;
     yuvLayer.acquireFenceFd = -1;
 
@@ -1253,7 +1724,7 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
             buffer_handle_t scalingBuffer;
             sp<RefBase> heldUpscaleBuffer;
             while ((scalingBuffer = mRgbUpscaleBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldUpscaleBuffer)) == NULL &&
-                   !mTasks.empty()) {
+                   (!mTasks.empty() || !mWorkerTasks.empty())) {
                 VTRACE("Waiting for free RGB upscale buffer...");
                 mRequestDequeued.wait(mTaskLock);
             }
@@ -1267,8 +1738,14 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
             destRect.y = 0;
             destRect.w = composeTask->outWidth;
             destRect.h = composeTask->outHeight;
-            if (!mgr->blit(rgbLayer.handle, scalingBuffer, destRect, true, true))
+            // queued behind the layer's acquire fence, the compose task
+            // waits for the scaled copy instead of the layer
+            int blitFenceFd = mgr->blitAsync(rgbLayer.handle, scalingBuffer, destRect,
+                                             true, composeTask->rgbAcquireFenceFd);
+            if (blitFenceFd < 0)
                 return true;
+            CLOSE_FENCE(composeTask->rgbAcquireFenceFd);
+            composeTask->rgbAcquireFenceFd = blitFenceFd;
             composeTask->rgbHandle = scalingBuffer;
             composeTask->heldRgbHandle = heldUpscaleBuffer;
         }
@@ -1278,24 +1755,16 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
             if (nativeHandle->iFormat == HAL_PIXEL_FORMAT_RGBA_8888)
                 pixel_format = VA_FOURCC_RGBA;
             mRgbUpscaleBuffers.clear();
-            ssize_t index = mVaMapCache.indexOfKey(rgbLayer.handle);
-            if (index == NAME_NOT_FOUND) {
-                composeTask->mappedRgbIn = new VAMappedHandleObject(va_dpy, rgbLayer.handle, composeTask->outWidth, composeTask->outHeight, pixel_format);
-                mVaMapCache.add(rgbLayer.handle, composeTask->mappedRgbIn);
-            }
-            else
-                composeTask->mappedRgbIn = mVaMapCache[index];
-            if (composeTask->mappedRgbIn->surface == 0) {
-                ETRACE("Unable to map RGB surface");
-                return false;
-            }
+            composeTask->rgbHandle = rgbLayer.handle;
+            composeTask->cacheRgbMapping = true;
+            composeTask->rgbPixelFormat = pixel_format;
         }
     }
     else
         composeTask->mappedRgbIn = NULL;
 
-    mTasks.push_back(composeTask);
-    mRequestQueued.signal();
+    if (!pushTask(mTasks, composeTask))
+        return false;
 #ifdef INTEL_WIDI
     if (mCurrentConfig.frameServerActive) {
 
@@ -1303,7 +1772,7 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         memset(&inputFrameInfo, 0, sizeof(inputFrameInfo));
         inputFrameInfo.isProtected = mProtectedMode;
         inputFrameInfo.frameType = HWC_FRAMETYPE_FRAME_BUFFER;
-        if (mVspUpscale) {
+        if (vspUpscale) {
             float upscale_x = (rotatedCrop.right - rotatedCrop.left) /
                               (yuvLayer.displayFrame.right - yuvLayer.displayFrame.left);
             float upscale_y = (rotatedCrop.bottom - rotatedCrop.top) /
@@ -1322,16 +1791,21 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
         inputFrameInfo.contentFrameRateD = 0;
         FrameInfo outputFrameInfo = inputFrameInfo;
 
-        BufferManager* mgr = mHwc.getBufferManager();
-        DataBuffer* dataBuf = mgr->lockDataBuffer(composeTask->outputHandle);
-        outputFrameInfo.contentWidth = composeTask->outWidth;
-        outputFrameInfo.contentHeight = composeTask->outHeight;
-        outputFrameInfo.bufferWidth = dataBuf->getWidth();
-        outputFrameInfo.bufferHeight = dataBuf->getHeight();
-        outputFrameInfo.lumaUStride = dataBuf->getWidth();
-        outputFrameInfo.chromaUStride = dataBuf->getWidth();
-        outputFrameInfo.chromaVStride = dataBuf->getWidth();
-        mgr->unlockDataBuffer(dataBuf);
+        {
+            DataBufferLocker locker(mHwc.getBufferManager(), composeTask->outputHandle);
+            DataBuffer *dataBuf = locker.get();
+            if (!dataBuf) {
+                ETRACE("failed to get the output buffer");
+                return true;
+            }
+            outputFrameInfo.contentWidth = composeTask->outWidth;
+            outputFrameInfo.contentHeight = composeTask->outHeight;
+            outputFrameInfo.bufferWidth = dataBuf->getWidth();
+            outputFrameInfo.bufferHeight = dataBuf->getHeight();
+            outputFrameInfo.lumaUStride = dataBuf->getWidth();
+            outputFrameInfo.chromaUStride = dataBuf->getWidth();
+            outputFrameInfo.chromaVStride = dataBuf->getWidth();
+        }
 
         queueFrameTypeInfo(inputFrameInfo);
         if (mCurrentConfig.policy.scaledWidth == 0 || mCurrentConfig.policy.scaledHeight == 0)
@@ -1347,7 +1821,7 @@ bool VirtualDevice::queueCompose(hwc_display_contents_1_t *display)
             frameReadyTask->handleType = HWC_HANDLE_TYPE_GRALLOC;
             frameReadyTask->renderTimestamp = mRenderTimestamp;
             frameReadyTask->mediaTimestamp = -1;
-            mTasks.push_back(frameReadyTask);
+            queueFrameReady(frameReadyTask);
         }
     }
     else {
@@ -1410,6 +1884,16 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
     sp<RefBase> heldBuffer;
     Mutex::Autolock _l(mTaskLock);
 
+#ifdef INTEL_WIDI
+    if (mCurrentConfig.frameServerActive &&
+        isUndamagedFrame(display, &layer, NULL, -1, blitTask->destRect.w, blitTask->destRect.h)) {
+        VTRACE("No damage, skipping blit");
+        CLOSE_FENCE(display->retireFenceFd);
+        CLOSE_FENCE(display->outbufAcquireFenceFd);
+        return true;
+    }
+#endif
+
     blitTask->srcAcquireFenceFd = layer.acquireFenceFd;
     layer.acquireFenceFd = -1;
 
@@ -1419,7 +1903,7 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
     mNextSyncPoint++;
 #ifdef INTEL_WIDI
     if (mCurrentConfig.frameServerActive) {
-        blitTask->destHandle = mCscBuffers.get(blitTask->destRect.w, blitTask->destRect.h, &heldBuffer);
+        blitTask->destHandle = mCscBuffers.get(blitTask->destRect.w, blitTask->destRect.h, &heldBuffer, true);
         blitTask->destAcquireFenceFd = -1;
 
         // we do not use retire fence in frameServerActive path.
@@ -1443,12 +1927,16 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
     display->retireFenceFd = dup(layer.releaseFenceFd);
 #endif
     if (blitTask->destHandle == NULL) {
-        WTRACE("Out of CSC buffers, dropping frame");
+        WTRACE_LIMITED("Out of CSC buffers, dropping frame");
+#ifdef INTEL_WIDI
+        // make sure the next frame is not taken for an undamaged repeat
+        mLastSentRgbHandle = NULL;
+#endif
         return false;
     }
 
-    mTasks.push_back(blitTask);
-    mRequestQueued.signal();
+    if (!pushTask(mTasks, blitTask))
+        return false;
 #ifdef INTEL_WIDI
     if (mCurrentConfig.frameServerActive) {
         FrameInfo inputFrameInfo;
@@ -1463,14 +1951,19 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
         inputFrameInfo.contentFrameRateD = 0;
         outputFrameInfo = inputFrameInfo;
 
-        BufferManager* mgr = mHwc.getBufferManager();
-        DataBuffer* dataBuf = mgr->lockDataBuffer(blitTask->destHandle);
-        outputFrameInfo.bufferWidth = dataBuf->getWidth();
-        outputFrameInfo.bufferHeight = dataBuf->getHeight();
-        outputFrameInfo.lumaUStride = dataBuf->getWidth();
-        outputFrameInfo.chromaUStride = dataBuf->getWidth();
-        outputFrameInfo.chromaVStride = dataBuf->getWidth();
-        mgr->unlockDataBuffer(dataBuf);
+        {
+            DataBufferLocker locker(mHwc.getBufferManager(), blitTask->destHandle);
+            DataBuffer *dataBuf = locker.get();
+            if (!dataBuf) {
+                ETRACE("failed to get the output buffer");
+                return true;
+            }
+            outputFrameInfo.bufferWidth = dataBuf->getWidth();
+            outputFrameInfo.bufferHeight = dataBuf->getHeight();
+            outputFrameInfo.lumaUStride = dataBuf->getWidth();
+            outputFrameInfo.chromaUStride = dataBuf->getWidth();
+            outputFrameInfo.chromaVStride = dataBuf->getWidth();
+        }
 
         if (!mIsForceCloneMode)
             queueFrameTypeInfo(inputFrameInfo);
@@ -1488,7 +1981,7 @@ bool VirtualDevice::queueColorConvert(hwc_display_contents_1_t *display)
             frameReadyTask->handleType = HWC_HANDLE_TYPE_GRALLOC;
             frameReadyTask->renderTimestamp = mRenderTimestamp;
             frameReadyTask->mediaTimestamp = -1;
-            mTasks.push_back(frameReadyTask);
+            queueFrameReady(frameReadyTask);
         }
     }
 #endif
@@ -1517,11 +2010,14 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
     inputFrameInfo.contentFrameRateN = 30;
     inputFrameInfo.contentFrameRateD = 1;
 
-    IVideoPayloadManager::MetaData metadata;
-    if (!mPayloadManager->getMetaData(cachedBuffer->mapper, &metadata)) {
+    const IVideoPayloadManager::MetaData *payloadMetadata =
+        mPayloadManager->getMetaData(cachedBuffer->mapper);
+    if (!payloadMetadata) {
         ETRACE("Failed to get metadata");
         return false;
     }
+    const IVideoPayloadManager::MetaData& metadata = *payloadMetadata;
+    bool rateMeasured = updateContentRate(metadata.timestamp);
 
     if (metadata.transform == 0 || metadata.transform == HAL_TRANSFORM_ROT_180) {
         inputFrameInfo.contentWidth = metadata.normalBuffer.width;
@@ -1529,9 +2025,12 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
     } else {
         inputFrameInfo.contentWidth = metadata.normalBuffer.height;
         inputFrameInfo.contentHeight = metadata.normalBuffer.width;
-        // 90 and 270 have some issues that appear to be decoder bugs
-        ITRACE("Skipping extended mode due to rotation of 90 or 270");
-        return false;
+        // the decoder's rotated buffer is taken by getFrameOfSize() and
+        // normalized by the VSP below, the desktop is never composed
+        if (!mExtRotation) {
+            ITRACE("Skipping extended mode due to rotation of 90 or 270");
+            return false;
+        }
     }
     // Use the crop size if something changed derive it again..
     // Only get video source info if frame rate has not been initialized.
@@ -1556,13 +2055,23 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
                         videoInfo.frameRate);
                 if (videoInfo.frameRate > 0) {
                     mVideoFramerate = videoInfo.frameRate;
+                    // use the stream rate until the cadence is measured
+                    if (mCadenceFps == 0)
+                        android_atomic_release_store(
+                            classify_cadence(s2ns(1) / videoInfo.frameRate), &mCadenceFps);
                 }
             }
         }
         mFirstVideoFrame = false;
     }
-    inputFrameInfo.contentFrameRateN = mVideoFramerate;
-    inputFrameInfo.contentFrameRateD = 1;
+    // the stream rate from MDS is only used until the content is measured
+    if (rateMeasured) {
+        inputFrameInfo.contentFrameRateN = mContentRateN;
+        inputFrameInfo.contentFrameRateD = mContentRateD;
+    } else {
+        inputFrameInfo.contentFrameRateN = mVideoFramerate;
+        inputFrameInfo.contentFrameRateD = 1;
+    }
 
     sp<ComposeTask> composeTask;
     sp<RefBase> heldBuffer;
@@ -1579,10 +2088,21 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         return false;
     }
 
+    // some decoders publish the rotated handle before its layout, which
+    // was the reason 90/270 used to be refused
+    if (info.khandle == metadata.rotationBuffer.khandle &&
+        (info.bufWidth < info.width + info.offsetX ||
+         info.bufHeight < info.height + info.offsetY)) {
+        ITRACE("Rotated frame %dx%d doesn't fit its %dx%d buffer",
+            info.width, info.height, info.bufWidth, info.bufHeight);
+        return false;
+    }
+
     queueFrameTypeInfo(inputFrameInfo);
 
     heldBuffer = new HeldDecoderBuffer(this, cachedBuffer);
     int64_t mediaTimestamp = metadata.timestamp;
+    updateCadence(mediaTimestamp);
 
     VARectangle surface_region;
     surface_region.x = info.offsetX;
@@ -1651,7 +2171,7 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         composeTask->outHeight = info.height;
         composeTask->outputHandle = mCscBuffers.get(composeTask->outWidth, composeTask->outHeight, &heldBuffer);
         if (composeTask->outputHandle == NULL) {
-            ITRACE("Out of CSC buffers, dropping frame");
+            ITRACE_LIMITED("Out of CSC buffers, dropping frame");
             return true;
         }
 
@@ -1668,22 +2188,27 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         composeTask->videoBufHeight = info.bufHeight;
         composeTask->videoTiled = info.tiled;
 
-        BufferManager* mgr = mHwc.getBufferManager();
-        DataBuffer* dataBuf = mgr->lockDataBuffer(composeTask->outputHandle);
-        outputFrameInfo.contentWidth = composeTask->outWidth;
-        outputFrameInfo.contentHeight = composeTask->outHeight;
-        outputFrameInfo.bufferWidth = dataBuf->getWidth();
-        outputFrameInfo.bufferHeight = dataBuf->getHeight();
-        outputFrameInfo.lumaUStride = dataBuf->getWidth();
-        outputFrameInfo.chromaUStride = dataBuf->getWidth();
-        outputFrameInfo.chromaVStride = dataBuf->getWidth();
-        mgr->unlockDataBuffer(dataBuf);
+        {
+            DataBufferLocker locker(mHwc.getBufferManager(), composeTask->outputHandle);
+            DataBuffer *dataBuf = locker.get();
+            if (!dataBuf) {
+                ETRACE("failed to get the output buffer");
+                return true;
+            }
+            outputFrameInfo.contentWidth = composeTask->outWidth;
+            outputFrameInfo.contentHeight = composeTask->outHeight;
+            outputFrameInfo.bufferWidth = dataBuf->getWidth();
+            outputFrameInfo.bufferHeight = dataBuf->getHeight();
+            outputFrameInfo.lumaUStride = dataBuf->getWidth();
+            outputFrameInfo.chromaUStride = dataBuf->getWidth();
+            outputFrameInfo.chromaVStride = dataBuf->getWidth();
+        }
 
         handle = composeTask->outputHandle;
         handleType = HWC_HANDLE_TYPE_GRALLOC;
 
-        mTasks.push_back(composeTask);
-        mRequestQueued.signal();
+        if (!pushTask(mTasks, composeTask))
+            return true;
     }
 
     queueBufferInfo(outputFrameInfo);
@@ -1698,8 +2223,7 @@ bool VirtualDevice::handleExtendedMode(hwc_display_contents_1_t *display)
         frameReadyTask->renderTimestamp = mRenderTimestamp;
         frameReadyTask->mediaTimestamp = mediaTimestamp;
 
-        mTasks.push_back(frameReadyTask);
-        mRequestQueued.signal();
+        queueFrameReady(frameReadyTask);
     }
 
     return true;
@@ -1716,16 +2240,53 @@ void VirtualDevice::queueFrameTypeInfo(const FrameInfo& inputFrameInfo)
         sp<FrameTypeChangedTask> notifyTask = new FrameTypeChangedTask;
         notifyTask->typeChangeListener = mCurrentConfig.typeChangeListener;
         notifyTask->inputFrameInfo = inputFrameInfo;
-        mTasks.push_back(notifyTask);
+        pushTask(mWorkerTasks, notifyTask);
     }
 }
 
+// HWC 1.4 layers carry no surface damage, so damage is inferred from the
+// inputs: SurfaceFlinger hands us the same, already consumed framebuffer
+// target when it did not recompose, and a paused video repeats its khandle
+// and timestamp. Any difference counts as full damage.
+bool VirtualDevice::isUndamagedFrame(hwc_display_contents_1_t *display, const hwc_layer_1_t *rgbLayer,
+                                     buffer_handle_t videoKhandle, int64_t videoTimestamp,
+                                     uint32_t width, uint32_t height)
+{
+    buffer_handle_t rgbHandle = rgbLayer ? rgbLayer->handle : NULL;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    bool undamaged = !(display->flags & HWC_GEOMETRY_CHANGED) &&
+                     !mCurrentConfig.forceNotifyFrameType &&
+                     !mCurrentConfig.forceNotifyBufferInfo &&
+                     (rgbLayer == NULL || rgbLayer->acquireFenceFd == -1) &&
+                     rgbHandle == mLastSentRgbHandle &&
+                     videoKhandle == mLastSentVideoKhandle &&
+                     videoTimestamp == mLastSentVideoTimestamp &&
+                     width == mLastSentWidth && height == mLastSentHeight &&
+                     now - mLastSentTime < STATIC_FRAME_RESEND_INTERVAL;
+    if (undamaged)
+        return true;
+
+    mLastSentRgbHandle = rgbHandle;
+    mLastSentVideoKhandle = videoKhandle;
+    mLastSentVideoTimestamp = videoTimestamp;
+    mLastSentWidth = width;
+    mLastSentHeight = height;
+    mLastSentTime = now;
+    return false;
+}
+
 void VirtualDevice::queueBufferInfo(const FrameInfo& outputFrameInfo)
 {
+    // the frame server registers the CSC buffers as encoder input surfaces
+    // on bufferInfoChanged(), so a new buffer set is announced as well
+    uint32_t ringGeneration = mCscBuffers.getRingGeneration();
     if (mCurrentConfig.forceNotifyBufferInfo ||
+        ringGeneration != mLastRingGeneration ||
         memcmp(&outputFrameInfo, &mLastOutputFrameInfo, sizeof(outputFrameInfo)) != 0) {
         mNextConfig.forceNotifyBufferInfo = false;
         mLastOutputFrameInfo = outputFrameInfo;
+        mLastRingGeneration = ringGeneration;
 
         sp<BufferInfoChangedTask> notifyTask = new BufferInfoChangedTask;
         notifyTask->typeChangeListener = mCurrentConfig.typeChangeListener;
@@ -1733,7 +2294,7 @@ void VirtualDevice::queueBufferInfo(const FrameInfo& outputFrameInfo)
 
         //if (handleType == HWC_HANDLE_TYPE_GRALLOC)
         //    mMappedBufferCache.clear(); // !
-        mTasks.push_back(notifyTask);
+        pushTask(mWorkerTasks, notifyTask);
     }
 }
 #endif
@@ -1756,15 +2317,7 @@ void VirtualDevice::colorSwap(buffer_handle_t src, buffer_handle_t dest, uint32_
     uint8_t* destPtr = static_cast<uint8_t*>(destCachedBuffer->mapper->getCpuAddress(0));
     if (srcPtr == NULL || destPtr == NULL)
         return;
-    while (pixelCount > 0) {
-        destPtr[0] = srcPtr[2];
-        destPtr[1] = srcPtr[1];
-        destPtr[2] = srcPtr[0];
-        destPtr[3] = srcPtr[3];
-        srcPtr += 4;
-        destPtr += 4;
-        pixelCount--;
-    }
+    colorSwapRB(destPtr, srcPtr, pixelCount);
 }
 
 void VirtualDevice::vspPrepare(uint32_t width, uint32_t height)
@@ -1772,27 +2325,19 @@ void VirtualDevice::vspPrepare(uint32_t width, uint32_t height)
     if (mVspEnabled && width == mVspWidth && height == mVspHeight)
         return;
 
+    // the VA display, the mapped surfaces and the context of the old size
+    // are all kept, a switch back to a recent size is only a lookup
     if (mVspEnabled)
-    {
         ITRACE("Going to switch VSP from %ux%u to %ux%u", mVspWidth, mVspHeight, width, height);
-        mMappedBufferCache.clear();
-        mVaMapCache.clear();
-        sp<DisableVspTask> disableVsp = new DisableVspTask();
-        mTasks.push_back(disableVsp);
-    }
     mVspWidth = width;
     mVspHeight = height;
 
     sp<EnableVspTask> enableTask = new EnableVspTask();
     enableTask->width = width;
     enableTask->height = height;
-    mTasks.push_back(enableTask);
-    mRequestQueued.signal();
-    // to map a buffer from this thread, we need this task to complete on the other thread
-    while (enableTask->getStrongCount() > 1) {
-        VTRACE("Waiting for WidiBlit thread to enable VSP...");
-        mRequestDequeued.wait(mTaskLock);
-    }
+    pushTask(mTasks, enableTask);
+    // No need to wait: VA objects are only touched on the WidiBlit thread,
+    // which runs this task before any compose task queued after it.
     mVspEnabled = true;
 }
 
@@ -1800,39 +2345,52 @@ void VirtualDevice::vspEnable(uint32_t width, uint32_t height)
 {
     width = align_width(width);
     height = align_height(height);
+
+    for (size_t i = 0; i < mVspContexts.size(); i++) {
+        VspContext ctx = mVspContexts.itemAt(i);
+        if (ctx.width != width || ctx.height != height)
+            continue;
+        ITRACE("Reuse VSP context at %ux%u", width, height);
+        mVspContexts.removeAt(i);
+        mVspContexts.insertAt(ctx, 0);
+        va_context = ctx.context;
+        va_blank_yuv_in = ctx.blankYuv;
+        va_blank_rgb_in = ctx.blankRgb;
+        return;
+    }
+
     ITRACE("Start VSP at %ux%u", width, height);
     VAStatus va_status;
 
-    int display = 0;
-    int major_ver, minor_ver;
-    va_dpy = vaGetDisplay(&display);
-    va_status = vaInitialize(va_dpy, &major_ver, &minor_ver);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaInitialize returns %08x", va_status);
-
-    VAConfigAttrib va_attr;
-    va_attr.type = VAConfigAttribRTFormat;
-    va_status = vaGetConfigAttributes(va_dpy,
-                VAProfileNone,
-                VAEntrypointVideoProc,
-                &va_attr,
-                1);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaGetConfigAttributes returns %08x", va_status);
-
-    va_status = vaCreateConfig(
-                va_dpy,
-                VAProfileNone,
-                VAEntrypointVideoProc,
-                &(va_attr),
-                1,
-                &va_config
-                );
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateConfig returns %08x", va_status);
+    if (va_dpy == NULL) {
+        va_dpy = VaDisplayManager::acquire(0);
+        if (va_dpy == NULL) ETRACE("failed to get the VSP display");
+
+        VAConfigAttrib va_attr;
+        va_attr.type = VAConfigAttribRTFormat;
+        va_status = vaGetConfigAttributes(va_dpy,
+                    VAProfileNone,
+                    VAEntrypointVideoProc,
+                    &va_attr,
+                    1);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaGetConfigAttributes returns %08x", va_status);
+
+        va_status = vaCreateConfig(
+                    va_dpy,
+                    VAProfileNone,
+                    VAEntrypointVideoProc,
+                    &(va_attr),
+                    1,
+                    &va_config
+                    );
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateConfig returns %08x", va_status);
 
-    VADisplayAttribute attr;
-    attr.type = VADisplayAttribRenderMode;
-    attr.value = VA_RENDER_MODE_LOCAL_OVERLAY;
-    va_status = vaSetDisplayAttributes(va_dpy, &attr, 1);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaSetDisplayAttributes returns %08x", va_status);
+        VADisplayAttribute attr;
+        attr.type = VADisplayAttribRenderMode;
+        attr.value = VA_RENDER_MODE_LOCAL_OVERLAY;
+        va_status = vaSetDisplayAttributes(va_dpy, &attr, 1);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaSetDisplayAttributes returns %08x", va_status);
+    }
 
 
     va_status = vaCreateSurfaces(
@@ -1889,6 +2447,10 @@ void VirtualDevice::vspEnable(uint32_t width, uint32_t height)
                 2);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaCreateSurfaces (blank rgba in) returns %08x", va_status);
 
+    uint32_t surfaceBytes = width * height * 3 / 2 + buf.data_size;
+    MemoryAccounting::add(MemoryAccounting::VSP_SURFACE, surfaceBytes);
+    mVspSurfaceBytes += surfaceBytes;
+
     va_status = vaCreateContext(
                 va_dpy,
                 va_config,
@@ -1957,21 +2519,29 @@ void VirtualDevice::vspEnable(uint32_t width, uint32_t height)
         else
             ETRACE("Unable to map blank rgba in");
     }
-}
-
-void VirtualDevice::vspDisable()
-{
-    ITRACE("Shut down VSP");
 
-    if (va_context == 0 && va_blank_yuv_in == 0) {
-        ITRACE("Already shut down");
-        return;
+    VspContext ctx;
+    ctx.width = width;
+    ctx.height = height;
+    ctx.context = va_context;
+    ctx.blankYuv = va_blank_yuv_in;
+    ctx.blankRgb = va_blank_rgb_in;
+    ctx.bytes = surfaceBytes;
+    mVspContexts.insertAt(ctx, 0);
+    if (mVspContexts.size() > VSP_CONTEXT_CACHE) {
+        // the least recently used size, never the current one
+        ITRACE("Destroy VSP context %ux%u", mVspContexts.top().width, mVspContexts.top().height);
+        vspDestroyContext(mVspContexts.top());
+        mVspContexts.pop();
     }
+}
 
+void VirtualDevice::vspDestroyContext(const VspContext& ctx)
+{
     VABufferID pipeline_param_id;
     VAStatus va_status;
     va_status = vaCreateBuffer(va_dpy,
-                va_context,
+                ctx.context,
                 VAProcPipelineParameterBufferType,
                 sizeof(VAProcPipelineParameterBuffer),
                 1,
@@ -1994,32 +2564,55 @@ void VirtualDevice::vspDisable()
     va_status = vaUnmapBuffer(va_dpy, pipeline_param_id);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaUnmapBuffer returns %08x", va_status);
 
-    va_status = vaBeginPicture(va_dpy, va_context, va_blank_yuv_in /* just need some valid surface */);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaBeginPicture returns %08x", va_status);
+    {
+        VaDisplayManager::SubmitLock submit(va_dpy, VaDisplayManager::PRIORITY_REMOTE);
+        va_status = vaBeginPicture(va_dpy, ctx.context, ctx.blankYuv /* just need some valid surface */);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaBeginPicture returns %08x", va_status);
 
-    va_status = vaRenderPicture(va_dpy, va_context, &pipeline_param_id, 1);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaRenderPicture returns %08x", va_status);
+        va_status = vaRenderPicture(va_dpy, ctx.context, &pipeline_param_id, 1);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaRenderPicture returns %08x", va_status);
 
-    va_status = vaEndPicture(va_dpy, va_context);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaEndPicture returns %08x", va_status);
+        va_status = vaEndPicture(va_dpy, ctx.context);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaEndPicture returns %08x", va_status);
+    }
 
-    va_status = vaDestroyContext(va_dpy, va_context);
+    va_status = vaDestroyContext(va_dpy, ctx.context);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroyContext returns %08x", va_status);
-    va_context = 0;
 
-    va_status = vaDestroySurfaces(va_dpy, &va_blank_yuv_in, 1);
+    VASurfaceID surface = ctx.blankYuv;
+    va_status = vaDestroySurfaces(va_dpy, &surface, 1);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (video in) returns %08x", va_status);
-    va_blank_yuv_in = 0;
 
-    va_status = vaDestroySurfaces(va_dpy, &va_blank_rgb_in, 1);
+    surface = ctx.blankRgb;
+    va_status = vaDestroySurfaces(va_dpy, &surface, 1);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaDestroySurfaces (blank rgba in) returns %08x", va_status);
 
+    MemoryAccounting::remove(MemoryAccounting::VSP_SURFACE, ctx.bytes);
+    mVspSurfaceBytes -= ctx.bytes;
+}
+
+void VirtualDevice::vspDisable()
+{
+    ITRACE("Shut down VSP");
+
+    if (mVspContexts.isEmpty())
+        ITRACE("Already shut down");
+    for (size_t i = 0; i < mVspContexts.size(); i++) {
+        VspContext ctx = mVspContexts.itemAt(i);
+        ITRACE("Destroy VSP context %ux%u", ctx.width, ctx.height);
+        vspDestroyContext(ctx);
+    }
+    mVspContexts.clear();
+    va_context = 0;
+    va_blank_yuv_in = 0;
+    va_blank_rgb_in = 0;
+
     if (va_config) {
         vaDestroyConfig(va_dpy, va_config);
         va_config = 0;
     }
     if (va_dpy) {
-        vaTerminate(va_dpy);
+        VaDisplayManager::release(va_dpy);
         va_dpy = NULL;
     }
 }
@@ -2027,6 +2620,7 @@ void VirtualDevice::vspDisable()
 void VirtualDevice::vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurfaceID videoOut,
                                const VARectangle* surface_region, const VARectangle* output_region)
 {
+    STRACE();
     VAStatus va_status;
 
     VABufferID pipeline_param_id;
@@ -2061,14 +2655,18 @@ void VirtualDevice::vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurface
     va_status = vaUnmapBuffer(va_dpy, pipeline_param_id);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaUnmapBuffer returns %08x", va_status);
 
-    va_status = vaBeginPicture(va_dpy, va_context, videoOut);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaBeginPicture returns %08x", va_status);
+    {
+        // waits for the rotation of the local display
+        VaDisplayManager::SubmitLock submit(va_dpy, VaDisplayManager::PRIORITY_REMOTE);
+        va_status = vaBeginPicture(va_dpy, va_context, videoOut);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaBeginPicture returns %08x", va_status);
 
-    va_status = vaRenderPicture(va_dpy, va_context, &pipeline_param_id, 1);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaRenderPicture returns %08x", va_status);
+        va_status = vaRenderPicture(va_dpy, va_context, &pipeline_param_id, 1);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaRenderPicture returns %08x", va_status);
 
-    va_status = vaEndPicture(va_dpy, va_context);
-    if (va_status != VA_STATUS_SUCCESS) ETRACE("vaEndPicture returns %08x", va_status);
+        va_status = vaEndPicture(va_dpy, va_context);
+        if (va_status != VA_STATUS_SUCCESS) ETRACE("vaEndPicture returns %08x", va_status);
+    }
 
     va_status = vaSyncSurface(va_dpy, videoOut);
     if (va_status != VA_STATUS_SUCCESS) ETRACE("vaSyncSurface returns %08x", va_status);
@@ -2219,6 +2817,7 @@ bool VirtualDevice::initialize()
 {
     mRgbLayer = -1;
     mYuvLayer = -1;
+    mVideoActive = false;
     char prop[PROPERTY_VALUE_MAX];
     char *retptr;
 
@@ -2245,6 +2844,14 @@ bool VirtualDevice::initialize()
 
     memset(&mLastInputFrameInfo, 0, sizeof(mLastInputFrameInfo));
     memset(&mLastOutputFrameInfo, 0, sizeof(mLastOutputFrameInfo));
+
+    mLastSentRgbHandle = NULL;
+    mLastSentVideoKhandle = NULL;
+    mLastSentVideoTimestamp = -1;
+    mLastSentWidth = 0;
+    mLastSentHeight = 0;
+    mLastSentTime = 0;
+    mLastRingGeneration = 0;
 #endif
     mPayloadManager = mHwc.getPlatFactory()->createVideoPayloadManager();
 
@@ -2257,6 +2864,10 @@ bool VirtualDevice::initialize()
         DEINIT_AND_RETURN_FALSE("Failed to create Soft Vsync Observer");
     }
 
+    if (!mTasks.initialize() || !mWorkerTasks.initialize()) {
+        DEINIT_AND_RETURN_FALSE("Failed to create task rings");
+    }
+
     mSyncTimelineFd = sw_sync_timeline_create();
     mNextSyncPoint = 1;
     mExpectAcquireFences = false;
@@ -2264,6 +2875,9 @@ bool VirtualDevice::initialize()
     mThread = new WidiBlitThread(this);
     mThread->run("WidiBlit", PRIORITY_URGENT_DISPLAY);
 
+    mWorkerThread = new WidiWorkerThread(this);
+    mWorkerThread->run("WidiWorker", PRIORITY_URGENT_DISPLAY);
+
 #ifdef INTEL_WIDI
     // Publish frame server service with service manager
     status_t ret = defaultServiceManager()->addService(String16("hwc.widi"), this);
@@ -2277,6 +2891,7 @@ bool VirtualDevice::initialize()
 #else
     mInitialized = true;
 #endif
+    mMappedBufferClock = 0;
     mVspEnabled = false;
     mVspInUse = false;
     mVspWidth = 0;
@@ -2286,10 +2901,20 @@ bool VirtualDevice::initialize()
     va_context = 0;
     va_blank_yuv_in = 0;
     va_blank_rgb_in = 0;
+    mVspSurfaceBytes = 0;
     mVspUpscale = false;
+    mUpscaleCostUs = 0;
+    mUpscaleBackoffUntil = 0;
+    mUpscaleSkips = 0;
+    mExtRotation = true;
     mDebugVspClear = false;
-    mDebugVspDump = false;
-    mDebugCounter = 0;
+    if (!mFrameDumper.initialize("/data/misc"))
+        WTRACE("VSP output can't be dumped");
+    mSinkLatency = 0;
+    mMaxInFlight = 0;
+    mInFlightWindow = getCscBufferCount() - 2;
+    mDroppedFrames = 0;
+    mPendingFrames = 0;
 
     ITRACE("Init done.");
 
@@ -2316,13 +2941,190 @@ void VirtualDevice::onVsync(int64_t timestamp)
     mHwc.vsync(DEVICE_VIRTUAL, timestamp);
 }
 
+static const uint32_t sHistogramBounds[] = { 1, 2, 4, 8, 16, 33, 66 };
+
+void VirtualDevice::addStageTime(int stage, nsecs_t time)
+{
+    StageStats& stats = mStageStats[stage];
+    stats.count++;
+    stats.total += time;
+    if (time > stats.max)
+        stats.max = time;
+
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && time >= ms2ns(sHistogramBounds[bucket]))
+        bucket++;
+    stats.buckets[bucket]++;
+}
+
 void VirtualDevice::dump(Dump& d)
 {
+    static const char* names[STAGE_COUNT] = {
+        "map", "fence wait", "compose", "render cpu", "notify",
+        "queue", "deliver", "hwc total", "sink",
+    };
+
+    d.append("-------------------------------------------------------------\n");
+    d.append("Device Name: %s (%s)\n", getName(),
+        mInitialized ? "initialized" : "uninitialized");
+    d.append("VSP: %s, %ux%u\n", mVspEnabled ? "enabled" : "disabled",
+        mVspWidth, mVspHeight);
+    {
+        Mutex::Autolock _l(mHeldBuffersLock);
+        d.append("Sink: in flight %zu (max %u, window %d), latency %lld us, "
+            "pending %d, dropped %d\n", mHeldBuffers.size(), mMaxInFlight,
+            mInFlightWindow, ns2us(mSinkLatency), mPendingFrames, mDroppedFrames);
+    }
+    d.append("GLES bypass: %u of %u frames\n", mBypassFrames, mPreparedFrames);
+    d.append("VSP upscale: %s, cost %d us, left to the sink %u frames\n",
+        mVspUpscale ? "enabled" : "disabled", mUpscaleCostUs, mUpscaleSkips);
+    mFrameDumper.dump(d);
+    d.append("Frame stages:\n");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const StageStats& stats = mStageStats[i];
+        d.append("  %-10s: count %u, total %lld us, avg %lld us, max %lld us\n",
+            names[i], stats.count, ns2us(stats.total),
+            stats.count ? ns2us(stats.total / stats.count) : 0,
+            ns2us(stats.max));
+        if (!stats.count)
+            continue;
+        d.append("              ");
+        for (int j = 0; j < HISTOGRAM_BUCKETS - 1; j++)
+            d.append("<%ums %u, ", sHistogramBounds[j], stats.buckets[j]);
+        d.append(">=%ums %u\n", sHistogramBounds[HISTOGRAM_BUCKETS - 2],
+            stats.buckets[HISTOGRAM_BUCKETS - 1]);
+    }
 }
 
 uint32_t VirtualDevice::getFpsDivider()
 {
-    return mFpsDivider;
+    // Called from the soft vsync thread. With known video cadence use the
+    // largest divider that still gives one vsync per content frame, so
+    // 24/25/30 fps content runs the virtual display at 30Hz. Without video
+    // the frame cap of the tuning policy holds the composition rate down.
+    uint32_t divider = mFpsDivider;
+    int32_t fps = android_atomic_acquire_load(&mCadenceFps);
+    uint32_t cap = TuningPolicy::getFpsCap(DEVICE_VIRTUAL);
+    if (fps > 0) {
+        if (60 / (uint32_t)fps > divider)
+            divider = 60 / fps;
+    } else if (cap && (60 + cap - 1) / cap > divider) {
+        divider = (60 + cap - 1) / cap;
+    }
+    return divider;
+}
+
+void VirtualDevice::updateCadence(int64_t mediaTimestamp)
+{
+    if (mediaTimestamp == mLastVideoTimestamp)
+        return; // same frame again
+
+    mLastVideoTimestamp = mediaTimestamp;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t interval = now - mLastVideoUpdate;
+    mLastVideoUpdate = now;
+    if (interval > CADENCE_MAX_INTERVAL) {
+        // first frame or the video was paused, measure again
+        mVideoInterval = 0;
+        return;
+    }
+
+    // moving average of frame arrival intervals, smooths decoder jitter
+    if (mVideoInterval == 0)
+        mVideoInterval = interval;
+    else
+        mVideoInterval += (interval - mVideoInterval) / 8;
+
+    uint32_t fps = classify_cadence(mVideoInterval);
+    if (fps != mCandidateFps) {
+        mCandidateFps = fps;
+        mCandidateCount = 0;
+    }
+    if (mCandidateCount < CADENCE_STABLE_FRAMES && ++mCandidateCount == CADENCE_STABLE_FRAMES &&
+        (int32_t)fps != mCadenceFps) {
+        ITRACE("Video cadence %u fps (stream reports %d fps)", fps, mVideoFramerate);
+        android_atomic_release_store(fps, &mCadenceFps);
+    }
+}
+
+static void classify_content_rate(int64_t span, uint32_t intervals,
+                                  int32_t *rateN, int32_t *rateD)
+{
+    static const int32_t rates[][2] = {
+        { 24000, 1001 }, { 24, 1 }, { 25, 1 }, { 30000, 1001 }, { 30, 1 },
+        { 50, 1 }, { 60000, 1001 }, { 60, 1 },
+    };
+
+    // frame rate in millihertz, the timestamps are in microseconds
+    int64_t measured = (int64_t)intervals * 1000000000LL / span;
+    int64_t bestError = -1;
+    for (size_t i = 0; i < sizeof(rates)/sizeof(rates[0]); i++) {
+        int64_t rate = (int64_t)rates[i][0] * 1000 / rates[i][1];
+        int64_t error = measured > rate ? measured - rate : rate - measured;
+        // within 2% of a standard content rate
+        if (error * 50 > rate)
+            continue;
+        if (bestError < 0 || error < bestError) {
+            *rateN = rates[i][0];
+            *rateD = rates[i][1];
+            bestError = error;
+        }
+    }
+
+    if (bestError < 0) {
+        *rateN = (int32_t)((measured + 500) / 1000);
+        *rateD = 1;
+    }
+}
+
+bool VirtualDevice::updateContentRate(int64_t mediaTimestamp)
+{
+    if (mRateCount) {
+        int64_t newest = mRateTimestamps[(mRateHead + CONTENT_RATE_WINDOW - 1) % CONTENT_RATE_WINDOW];
+        if (mediaTimestamp == newest)
+            return mContentRateN > 0; // same frame again
+
+        // seek or pause, the last measured rate stays valid
+        if (mediaTimestamp < newest || mediaTimestamp - newest > CONTENT_RATE_MAX_GAP)
+            mRateCount = 0;
+    }
+
+    mRateTimestamps[mRateHead] = mediaTimestamp;
+    mRateHead = (mRateHead + 1) % CONTENT_RATE_WINDOW;
+    if (mRateCount < CONTENT_RATE_WINDOW)
+        mRateCount++;
+
+    if (mRateCount == CONTENT_RATE_WINDOW) {
+        // the head is the oldest entry once the window is full
+        int64_t span = mediaTimestamp - mRateTimestamps[mRateHead];
+        int32_t rateN = 0;
+        int32_t rateD = 1;
+        if (span > 0)
+            classify_content_rate(span, CONTENT_RATE_WINDOW - 1, &rateN, &rateD);
+        if (rateN > 0 && (rateN != mContentRateN || rateD != mContentRateD)) {
+            ITRACE("Content frame rate %d/%d (stream reports %d fps)",
+                rateN, rateD, mVideoFramerate);
+            mContentRateN = rateN;
+            mContentRateD = rateD;
+        }
+    }
+    return mContentRateN > 0;
+}
+
+void VirtualDevice::resetCadence()
+{
+    if (mCadenceFps != 0)
+        ITRACE("Video cadence reset");
+    mRateCount = 0;
+    mRateHead = 0;
+    mContentRateN = 0;
+    mContentRateD = 1;
+    mLastVideoUpdate = 0;
+    mLastVideoTimestamp = -1;
+    mVideoInterval = 0;
+    mCandidateFps = 0;
+    mCandidateCount = 0;
+    android_atomic_release_store(0, &mCadenceFps);
 }
 
 void VirtualDevice::deinitialize()
@@ -2334,6 +3136,7 @@ void VirtualDevice::deinitialize()
         mPayloadManager = NULL;
     }
     DEINIT_AND_DELETE_OBJ(mVsyncObserver);
+    mFrameDumper.deinitialize();
     mInitialized = false;
 }
 
@@ -0,0 +1,150 @@
+# Copyright (C) 2008 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# The display engine shared by the platforms: composition, buffer
+# management, devices and observers, and the parts of the IPs that do
+# not depend on the display planes. Paths are relative to the root of
+# the tree, HWC_ENGINE_PATH. The platforms add their planes and factory,
+# the mock platform of test/mock builds the same sources.
+HWC_ENGINE_PATH := $(patsubst %/common,%,$(call my-dir))
+
+HWC_ENGINE_SRC_FILES := \
+    common/base/Drm.cpp \
+    common/base/HwcLayer.cpp \
+    common/base/HwcLayerList.cpp \
+    common/base/PlaneAssignmentCache.cpp \
+    common/base/Hwcomposer.cpp \
+    common/base/HwcModule.cpp \
+    common/base/DisplayAnalyzer.cpp \
+    common/base/VsyncManager.cpp \
+    common/base/FrameTiming.cpp \
+    common/base/CommitScheduler.cpp \
+    common/base/CompositionLog.cpp \
+    common/base/FenceTracker.cpp \
+    common/base/JankDetector.cpp \
+    common/base/InputBoost.cpp \
+    common/base/ThreadPolicy.cpp \
+    common/base/PrepareWorkerPool.cpp \
+    common/base/TaskQueue.cpp \
+    common/base/FenceCloser.cpp \
+    common/base/EventLoop.cpp \
+    common/base/ContentStats.cpp \
+    common/base/EdidCache.cpp \
+    common/base/BootTimeline.cpp \
+    common/base/LayerTrace.cpp \
+    common/base/FrameDumper.cpp \
+    common/base/BandwidthEstimator.cpp \
+    common/base/MemoryAccounting.cpp \
+    common/base/VaDisplayManager.cpp \
+    common/base/Telemetry.cpp \
+    common/base/ScanoutCapture.cpp \
+    common/base/TuningPolicy.cpp \
+    common/base/DisplayCalibration.cpp \
+    common/base/BlitComposer.cpp \
+    common/buffers/BufferCache.cpp \
+    common/buffers/GraphicBuffer.cpp \
+    common/buffers/BufferManager.cpp \
+    common/buffers/MapWorkerPool.cpp \
+    common/buffers/BufferTracer.cpp \
+    common/devices/PhysicalDevice.cpp \
+    common/devices/PrimaryDevice.cpp \
+    common/devices/ExternalDevice.cpp \
+    common/devices/VirtualDevice.cpp \
+    common/observers/UeventObserver.cpp \
+    common/observers/VsyncEventObserver.cpp \
+    common/observers/VblankEventObserver.cpp \
+    common/observers/VsyncModel.cpp \
+    common/observers/SoftVsyncObserver.cpp \
+    common/observers/MultiDisplayObserver.cpp \
+    common/planes/DisplayPlane.cpp \
+    common/planes/DisplayPlaneManager.cpp \
+    common/utils/Dump.cpp \
+    common/utils/ColorSwap.cpp
+
+HWC_ENGINE_SRC_FILES += \
+    ips/common/BlankControl.cpp \
+    ips/common/HdcpControl.cpp \
+    ips/common/DrmControl.cpp \
+    ips/common/VsyncControl.cpp \
+    ips/common/PrepareListener.cpp \
+    ips/common/OverlayPlaneBase.cpp \
+    ips/common/SpritePlaneBase.cpp \
+    ips/common/PixelFormat.cpp \
+    ips/common/FormatTable.cpp \
+    ips/common/GrallocBufferBase.cpp \
+    ips/common/GrallocBufferMapperBase.cpp \
+    ips/common/TTMBufferMapper.cpp \
+    ips/common/DrmConfig.cpp \
+    ips/common/VideoPayloadManager.cpp \
+    ips/common/Wsbm.cpp \
+    ips/common/WsbmWrapper.c \
+    ips/common/RotationBufferProvider.cpp \
+    ips/common/CursorImageCache.cpp \
+    ips/common/PrescaleBufferCache.cpp \
+    ips/common/TTMMapperPool.cpp \
+    ips/common/TTMSlabAllocator.cpp \
+    ips/common/RotationModePredictor.cpp \
+    ips/common/ConvertBufferCache.cpp \
+    ips/common/VideoCadenceAnalyzer.cpp
+
+HWC_ENGINE_SRC_FILES += \
+    ips/tangier/TngGrallocBuffer.cpp \
+    ips/tangier/TngGrallocBufferMapper.cpp \
+    ips/tangier/TngDisplayQuery.cpp \
+    ips/tangier/TngDisplayContext.cpp
+
+HWC_ENGINE_C_INCLUDES := $(addprefix $(HWC_ENGINE_PATH)/../, $(SGX_INCLUDES)) \
+    $(call include-path-for, frameworks-native)/media/openmax \
+    $(TARGET_OUT_HEADERS)/khronos/openmax \
+    $(call include-path-for, opengl) \
+    $(call include-path-for, libhardware_legacy)/hardware_legacy \
+    prebuilts/intel/vendor/intel/hardware/prebuilts/$(REF_DEVICE_NAME)/rgx \
+    prebuilts/intel/vendor/intel/hardware/prebuilts/$(REF_DEVICE_NAME)/rgx/include \
+    vendor/intel/hardware/PRIVATE/widi/libhwcwidi/ \
+    system/core \
+    system/core/libsync/include \
+    $(TARGET_OUT_HEADERS)/drm \
+    $(TARGET_OUT_HEADERS)/libdrm \
+    $(TARGET_OUT_HEADERS)/libdrm/shared-core \
+    $(TARGET_OUT_HEADERS)/libwsbm/wsbm \
+    $(TARGET_OUT_HEADERS)/libttm \
+    $(TARGET_OUT_HEADERS)/libva
+
+HWC_ENGINE_C_INCLUDES += \
+    $(HWC_ENGINE_PATH)/include \
+    $(HWC_ENGINE_PATH)/include/pvr/hal \
+    $(HWC_ENGINE_PATH)/common/base \
+    $(HWC_ENGINE_PATH)/common/buffers \
+    $(HWC_ENGINE_PATH)/common/devices \
+    $(HWC_ENGINE_PATH)/common/observers \
+    $(HWC_ENGINE_PATH)/common/planes \
+    $(HWC_ENGINE_PATH)/common/utils \
+    $(HWC_ENGINE_PATH)/ips/
+
+HWC_ENGINE_SHARED_LIBRARIES := liblog libcutils libdrm \
+                               libwsbm libutils libhardware \
+                               libva libva-tpi libva-android libsync libz
+
+# the features change class layouts, the platform sources see the same
+HWC_ENGINE_CFLAGS := -DLINUX
+
+ifeq ($(INTEL_WIDI), true)
+   HWC_ENGINE_SHARED_LIBRARIES += libhwcwidi libbinder
+   HWC_ENGINE_CFLAGS += -DINTEL_WIDI
+endif
+
+ifeq ($(TARGET_HAS_MULTIPLE_DISPLAY),true)
+   HWC_ENGINE_SHARED_LIBRARIES += libmultidisplay libbinder
+   HWC_ENGINE_CFLAGS += -DTARGET_HAS_MULTIPLE_DISPLAY
+endif
@@ -73,15 +73,13 @@ status_t MultiDisplayCallback::updateInputState(bool state)
 status_t MultiDisplayCallback::setHdmiScalingType(MDS_SCALING_TYPE type)
 {
     ITRACE("scaling type: %d", type);
-    // Merrifield doesn't implement this API
-    return INVALID_OPERATION;
+    return mDispObserver->setHdmiScalingType(type);
 }
 
 status_t MultiDisplayCallback::setHdmiOverscan(int hValue, int vValue)
 {
-    ITRACE("oversacn compensation, h: %d v: %d", hValue, vValue);
-    // Merrifield doesn't implement this API
-    return INVALID_OPERATION;
+    ITRACE("overscan compensation, h: %d v: %d", hValue, vValue);
+    return mDispObserver->setHdmiOverscan(hValue, vValue);
 }
 
 ////// MultiDisplayObserver
@@ -97,7 +95,13 @@ MultiDisplayObserver::MultiDisplayObserver()
       mThreadLoopCount(0),
       mDeviceConnected(false),
       mExternalHdmiTiming(false),
-      mInitialized(false)
+      mClientReady(false),
+      mExitThread(false),
+      mInitialized(false),
+      mCalls(),
+      mDroppedCalls(0),
+      mVideoSourceInfo(),
+      mVideoSessionNumber(0)
 {
     CTRACE();
 }
@@ -176,6 +180,7 @@ bool MultiDisplayObserver::initMDSClient()
 
     Drm *drm = Hwcomposer::getInstance().getDrm();
     mDeviceConnected = drm->isConnected(IDisplayDevice::DEVICE_EXTERNAL);
+    mClientReady = true;
     ITRACE("MDS client is initialized");
     return true;
 }
@@ -187,6 +192,10 @@ void MultiDisplayObserver::deinitMDSClient()
     }
 
     mDeviceConnected = false;
+    mClientReady = false;
+    mCalls.clear();
+    mVideoSourceInfo.clear();
+    mVideoSessionNumber = 0;
     mMDSCbRegistrar = NULL;
     mMDSInfoProvider = NULL;
     mMDSCallback = NULL;
@@ -201,14 +210,15 @@ bool MultiDisplayObserver::initMDSClientAsync()
         return true;
     }
 
-    mThread = new MDSClientInitThread(this);
+    mThread = new MDSClientThread(this);
     if (mThread.get() == NULL) {
-        ETRACE("failed to create MDS client init thread");
+        ETRACE("failed to create MDS client thread");
         return false;
     }
     mThreadLoopCount = 0;
+    mExitThread = false;
     // TODO: check return value
-    mThread->run("MDSClientInitThread", PRIORITY_URGENT_DISPLAY);
+    mThread->run("MDSClientThread", PRIORITY_URGENT_DISPLAY);
     return true;
 }
 
@@ -222,20 +232,10 @@ bool MultiDisplayObserver::initialize()
         return true;
     }
 
-    // initialize MDS client once. This should succeed if MDS service starts
-    // before surfaceflinger service is started.
-    // if surface flinger runs first, MDS client will be initialized asynchronously in
-    // a working thread
-    if (isMDSRunning()) {
-        if (!initMDSClient()) {
-            ETRACE("failed to initialize MDS client");
-            // FIXME: NOT a common case for system server crash.
-            // Start a working thread to initialize MDS client if exception happens
-            ret = initMDSClientAsync();
-        }
-    } else {
-        ret = initMDSClientAsync();
-    }
+    // the MDS client is initialized in the working thread, the binder
+    // lookups stay off the boot path. Calls made before it is up are
+    // queued, and the thread makes them once the client is up.
+    ret = initMDSClientAsync();
 
     mInitialized = true;
     return ret;
@@ -243,11 +243,12 @@ bool MultiDisplayObserver::initialize()
 
 void MultiDisplayObserver::deinitialize()
 {
-    sp<MDSClientInitThread> detachedThread;
+    sp<MDSClientThread> detachedThread;
     do {
         Mutex::Autolock _l(mLock);
 
         if (mThread.get()) {
+            mExitThread = true;
             mCondition.signal();
             detachedThread = mThread;
             mThread = NULL;
@@ -265,32 +266,164 @@ void MultiDisplayObserver::deinitialize()
 
 bool MultiDisplayObserver::threadLoop()
 {
-    Mutex::Autolock _l(mLock);
+    Call call;
+    do {
+        Mutex::Autolock _l(mLock);
+        if (mExitThread) {
+            return false;
+        }
 
-    // try to create MDS client in the working thread
-    // multiple delayed attempts are made until MDS service starts.
+        if (mClientReady) {
+            if (mCalls.size() == 0) {
+                mCondition.wait(mLock);
+                return true;
+            }
+            call = mCalls.itemAt(0);
+            mCalls.removeAt(0);
+            break;
+        }
 
-    // Return false if MDS service is running or loop limit is reached
-    // such that thread becomes inactive.
-    if (isMDSRunning()) {
-        if (!initMDSClient()) {
-            ETRACE("failed to initialize MDS client");
+        // try to create MDS client in the working thread
+        // multiple delayed attempts are made until MDS service starts.
+
+        // Return false if MDS service fails or loop limit is reached
+        // such that thread becomes inactive.
+        if (isMDSRunning()) {
+            if (!initMDSClient()) {
+                ETRACE("failed to initialize MDS client");
+                deinitMDSClient();
+                return false;
+            }
+            return true;
+        }
+
+        if (mThreadLoopCount++ > THREAD_LOOP_BOUND) {
+            ETRACE("failed to initialize MDS client, loop limit reached");
+            return false;
+        }
+
+        status_t err = mCondition.waitRelative(mLock, milliseconds(THREAD_LOOP_DELAY));
+        if (err != -ETIMEDOUT) {
+            ITRACE("thread is interrupted");
+        }
+        return true; // keep trying
+    } while (0);
+
+    // binder calls are made without the lock, the composition thread only
+    // ever waits for the queue and the cache
+    processCall(call);
+    return true;
+}
+
+void MultiDisplayObserver::queueCall(const Call& call)
+{
+    // mLock is held by the caller
+    if (call.type != CALL_VIDEO_STATE) {
+        // only the latest connection status and decoder setting of a
+        // session matter, the video states are all delivered
+        for (size_t i = 0; i < mCalls.size(); i++) {
+            Call& queued = mCalls.editItemAt(i);
+            if (queued.type == call.type &&
+                (call.type == CALL_HOTPLUG || call.type == CALL_WIDI_STATUS ||
+                 queued.sessionID == call.sessionID)) {
+                queued = call;
+                return;
+            }
         }
-        return false;
     }
 
-    if (mThreadLoopCount++ > THREAD_LOOP_BOUND) {
-        ETRACE("failed to initialize MDS client, loop limit reached");
-        return false;
+    if (mCalls.size() >= CALL_QUEUE_MAX) {
+        WTRACE("MDS call queue is full, dropping call %d", mCalls.itemAt(0).type);
+        mCalls.removeAt(0);
+        mDroppedCalls++;
     }
+    mCalls.push(call);
+    mCondition.signal();
+}
 
-    status_t err = mCondition.waitRelative(mLock, milliseconds(THREAD_LOOP_DELAY));
-    if (err != -ETIMEDOUT) {
-        ITRACE("thread is interrupted");
-        return false;
+void MultiDisplayObserver::processCall(const Call& call)
+{
+    sp<IMultiDisplayConnectionObserver> connObserver;
+    sp<IMultiDisplayDecoderConfig> decoderConfig;
+    {
+        Mutex::Autolock _l(mLock);
+        connObserver = mMDSConnObserver;
+        decoderConfig = mMDSDecoderConfig;
+    }
+
+    status_t ret = NO_ERROR;
+    switch (call.type) {
+    case CALL_HOTPLUG:
+        if (connObserver.get()) {
+            ret = connObserver->updateHdmiConnectionStatus(call.args[0]);
+        }
+        break;
+    case CALL_WIDI_STATUS:
+        if (connObserver.get()) {
+            ret = connObserver->updateWidiConnectionStatus(call.args[0]);
+        }
+        break;
+    case CALL_DECODER_RESOLUTION:
+        if (decoderConfig.get()) {
+            ret = decoderConfig->setDecoderOutputResolution(call.sessionID,
+                    call.args[0], call.args[1], call.args[2], call.args[3],
+                    call.args[4], call.args[5]);
+        }
+        if (ret == NO_ERROR) {
+            ITRACE("Video Session[%d] output resolution %dx%d ",
+                    call.sessionID, call.args[0], call.args[1]);
+        }
+        break;
+    case CALL_VIDEO_STATE:
+        // the analyzer reads the cache when it handles the state change
+        refreshVideoSourceInfo(call.sessionID);
+        Hwcomposer::getInstance().getDisplayAnalyzer()->postVideoEvent(
+            call.sessionID, call.args[0]);
+        break;
+    case CALL_SOURCE_INFO:
+        refreshVideoSourceInfo(call.sessionID);
+        break;
+    default:
+        break;
+    }
+
+    if (ret != NO_ERROR) {
+        ETRACE("MDS call %d failed, error %d", call.type, ret);
+    }
+}
+
+void MultiDisplayObserver::refreshVideoSourceInfo(int sessionID)
+{
+    sp<IMultiDisplayInfoProvider> infoProvider;
+    {
+        Mutex::Autolock _l(mLock);
+        infoProvider = mMDSInfoProvider;
+    }
+    if (infoProvider.get() == NULL) {
+        return;
+    }
+
+    MDSVideoSourceInfo videoInfo;
+    memset(&videoInfo, 0, sizeof(MDSVideoSourceInfo));
+    status_t ret = infoProvider->getVideoSourceInfo(sessionID, &videoInfo);
+    int sessions = infoProvider->getVideoSessionNumber();
+
+    Mutex::Autolock _l(mLock);
+    mVideoSessionNumber = sessions;
+    if (ret != NO_ERROR) {
+        // the session is gone
+        mVideoSourceInfo.removeItem(sessionID);
+        return;
     }
 
-    return true; // keep trying
+    VideoSourceInfo info;
+    info.width     = videoInfo.displayW;
+    info.height    = videoInfo.displayH;
+    info.frameRate = videoInfo.frameRate;
+    info.isProtected = videoInfo.isProtected;
+    mVideoSourceInfo.replaceValueFor(sessionID, info);
+    VTRACE("Video Session[%d] source info: %dx%d@%d", sessionID,
+            info.width, info.height, info.frameRate);
 }
 
 
@@ -303,8 +436,15 @@ status_t MultiDisplayObserver::blankSecondaryDisplay(bool blank)
 
 status_t MultiDisplayObserver::updateVideoState(int sessionId, MDS_VIDEO_STATE state)
 {
-    Hwcomposer::getInstance().getDisplayAnalyzer()->postVideoEvent(
-        sessionId, (int)state);
+    // calling back into MDS from its callback could deadlock, the state is
+    // posted by the client thread after the source info is refreshed
+    Mutex::Autolock _l(mLock);
+    Call call;
+    memset(&call, 0, sizeof(call));
+    call.type = CALL_VIDEO_STATE;
+    call.sessionID = sessionId;
+    call.args[0] = (int32_t)state;
+    queueCall(call);
     return 0;
 }
 
@@ -326,6 +466,46 @@ status_t MultiDisplayObserver::setHdmiTiming(const MDSHdmiTiming& timing)
     return 0;
 }
 
+status_t MultiDisplayObserver::setHdmiScalingType(MDS_SCALING_TYPE type)
+{
+    int scaling;
+    switch (type) {
+    case MDS_SCALING_NONE:
+        scaling = DRM_MODE_SCALE_NONE;
+        break;
+    case MDS_SCALING_FULL_SCREEN:
+        scaling = DRM_MODE_SCALE_FULLSCREEN;
+        break;
+    case MDS_SCALING_CENTER:
+        scaling = DRM_MODE_SCALE_CENTER;
+        break;
+    case MDS_SCALING_ASPECT:
+        scaling = DRM_MODE_SCALE_ASPECT;
+        break;
+    default:
+        WTRACE("unknown scaling type %d", type);
+        return INVALID_OPERATION;
+    }
+
+    // MDS composes the scaled frames itself if the fitter can't
+    ExternalDevice *dev =
+        (ExternalDevice *)Hwcomposer::getInstance().getDisplayDevice(HWC_DISPLAY_EXTERNAL);
+    if (!dev || !dev->setScaling(scaling)) {
+        return INVALID_OPERATION;
+    }
+    return NO_ERROR;
+}
+
+status_t MultiDisplayObserver::setHdmiOverscan(int hValue, int vValue)
+{
+    ExternalDevice *dev =
+        (ExternalDevice *)Hwcomposer::getInstance().getDisplayDevice(HWC_DISPLAY_EXTERNAL);
+    if (!dev || !dev->setOverscan(hValue, vValue)) {
+        return INVALID_OPERATION;
+    }
+    return NO_ERROR;
+}
+
 status_t MultiDisplayObserver::updateInputState(bool active)
 {
     Hwcomposer::getInstance().getDisplayAnalyzer()->postInputEvent(active);
@@ -337,30 +517,33 @@ status_t MultiDisplayObserver::updateInputState(bool active)
 
 status_t MultiDisplayObserver::notifyHotPlug( bool connected)
 {
-    {
-        // lock scope
-        Mutex::Autolock _l(mLock);
-        if (mMDSConnObserver.get() == NULL) {
-            return NO_INIT;
-        }
+    Mutex::Autolock _l(mLock);
+    if (!mClientReady) {
+        return NO_INIT;
+    }
 
-        if (connected == mDeviceConnected) {
-            WTRACE("hotplug event ignored");
-            return NO_ERROR;
-        }
+    if (connected == mDeviceConnected) {
+        WTRACE("hotplug event ignored");
+        return NO_ERROR;
+    }
 
-        // clear it after externel device is disconnected
-        if (!connected) mExternalHdmiTiming = false;
+    // clear it after externel device is disconnected
+    if (!connected) mExternalHdmiTiming = false;
 
-        mDeviceConnected = connected;
-    }
-    return mMDSConnObserver->updateHdmiConnectionStatus(connected);
+    mDeviceConnected = connected;
+
+    Call call;
+    memset(&call, 0, sizeof(call));
+    call.type = CALL_HOTPLUG;
+    call.args[0] = connected;
+    queueCall(call);
+    return NO_ERROR;
 }
 
 status_t MultiDisplayObserver::getVideoSourceInfo(int sessionID, VideoSourceInfo* info)
 {
     Mutex::Autolock _l(mLock);
-    if (mMDSInfoProvider.get() == NULL) {
+    if (!mClientReady) {
         return NO_INIT;
     }
 
@@ -369,28 +552,26 @@ status_t MultiDisplayObserver::getVideoSourceInfo(int sessionID, VideoSourceInfo
         return UNKNOWN_ERROR;
     }
 
-    MDSVideoSourceInfo videoInfo;
-    memset(&videoInfo, 0, sizeof(MDSVideoSourceInfo));
-    status_t ret = mMDSInfoProvider->getVideoSourceInfo(sessionID, &videoInfo);
-    if (ret == NO_ERROR) {
-        info->width     = videoInfo.displayW;
-        info->height    = videoInfo.displayH;
-        info->frameRate = videoInfo.frameRate;
-        info->isProtected = videoInfo.isProtected;
-        VTRACE("Video Session[%d] source info: %dx%d@%d", sessionID,
-                info->width, info->height, info->frameRate);
+    ssize_t index = mVideoSourceInfo.indexOfKey(sessionID);
+    if (index < 0) {
+        // fetched in the background, the caller asks again later
+        VTRACE("Video Session[%d] source info is not cached", sessionID);
+        Call call;
+        memset(&call, 0, sizeof(call));
+        call.type = CALL_SOURCE_INFO;
+        call.sessionID = sessionID;
+        queueCall(call);
+        return NAME_NOT_FOUND;
     }
-    return ret;
+
+    *info = mVideoSourceInfo.valueAt(index);
+    return NO_ERROR;
 }
 
 int MultiDisplayObserver::getVideoSessionNumber()
 {
     Mutex::Autolock _l(mLock);
-    if (mMDSInfoProvider.get() == NULL) {
-        return 0;
-    }
-
-    return mMDSInfoProvider->getVideoSessionNumber();
+    return mVideoSessionNumber;
 }
 
 bool MultiDisplayObserver::isExternalDeviceTimingFixed() const
@@ -402,10 +583,16 @@ bool MultiDisplayObserver::isExternalDeviceTimingFixed() const
 status_t MultiDisplayObserver::notifyWidiConnectionStatus( bool connected)
 {
     Mutex::Autolock _l(mLock);
-    if (mMDSConnObserver.get() == NULL) {
+    if (!mClientReady) {
         return NO_INIT;
     }
-    return mMDSConnObserver->updateWidiConnectionStatus(connected);
+
+    Call call;
+    memset(&call, 0, sizeof(call));
+    call.type = CALL_WIDI_STATUS;
+    call.args[0] = connected;
+    queueCall(call);
+    return NO_ERROR;
 }
 
 status_t MultiDisplayObserver::setDecoderOutputResolution(
@@ -415,7 +602,7 @@ status_t MultiDisplayObserver::setDecoderOutputResolution(
         int32_t bufWidth, int32_t bufHeight)
 {
     Mutex::Autolock _l(mLock);
-    if (mMDSDecoderConfig.get() == NULL) {
+    if (!mClientReady) {
         return NO_INIT;
     }
     if (width <= 0 || height <= 0 ||
@@ -425,11 +612,17 @@ status_t MultiDisplayObserver::setDecoderOutputResolution(
         return UNKNOWN_ERROR;
     }
 
-    status_t ret = mMDSDecoderConfig->setDecoderOutputResolution(sessionID, width, height, offX, offY, bufWidth, bufHeight);
-    if (ret == NO_ERROR) {
-        ITRACE("Video Session[%d] output resolution %dx%d ", sessionID, width, height);
-    }
-    return ret;
+    Call call;
+    call.type = CALL_DECODER_RESOLUTION;
+    call.sessionID = sessionID;
+    call.args[0] = width;
+    call.args[1] = height;
+    call.args[2] = offX;
+    call.args[3] = offY;
+    call.args[4] = bufWidth;
+    call.args[5] = bufHeight;
+    queueCall(call);
+    return NO_ERROR;
 }
 
 
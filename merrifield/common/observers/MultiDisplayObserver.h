@@ -18,6 +18,8 @@
 
 #ifdef TARGET_HAS_MULTIPLE_DISPLAY
 #include <display/MultiDisplayService.h>
+#include <utils/KeyedVector.h>
+#include <utils/Vector.h>
 #include <SimpleThread.h>
 #else
 #include <utils/Errors.h>
@@ -67,6 +69,9 @@ public:
 public:
     bool initialize();
     void deinitialize();
+    // calls into MDS are queued and made by the client thread, the video
+    // source info and session number are served from a cache it refreshes
+    // on every video state change
     status_t notifyHotPlug(bool connected);
     status_t getVideoSourceInfo(int sessionID, VideoSourceInfo* info);
     int  getVideoSessionNumber();
@@ -85,13 +90,39 @@ private:
     status_t blankSecondaryDisplay(bool blank);
     status_t updateVideoState(int sessionId, MDS_VIDEO_STATE state);
     status_t setHdmiTiming(const MDSHdmiTiming& timing);
+    // done by the panel fitter, INVALID_OPERATION leaves them to MDS
+    status_t setHdmiScalingType(MDS_SCALING_TYPE type);
+    status_t setHdmiOverscan(int hValue, int vValue);
     status_t updateInputState(bool active);
     friend class MultiDisplayCallback;
 
+private:
+    enum CallType {
+        CALL_HOTPLUG,
+        CALL_WIDI_STATUS,
+        CALL_DECODER_RESOLUTION,
+        // refresh the cached source info, then post the state change
+        CALL_VIDEO_STATE,
+        // refresh the cached source info only
+        CALL_SOURCE_INFO,
+    };
+
+    struct Call {
+        int type;
+        int sessionID;
+        int32_t args[6];
+    };
+
+    void queueCall(const Call& call);
+    void processCall(const Call& call);
+    void refreshVideoSourceInfo(int sessionID);
+
 private:
     enum {
         THREAD_LOOP_DELAY = 10, // 10 ms
         THREAD_LOOP_BOUND = 2000, // 20s
+        // calls waiting for the client thread
+        CALL_QUEUE_MAX = 32,
     };
 
 private:
@@ -106,10 +137,16 @@ private:
     bool mDeviceConnected;
     // indicate external devices's timing is set
     bool mExternalHdmiTiming;
+    bool mClientReady;
+    bool mExitThread;
     bool mInitialized;
+    Vector<Call> mCalls;
+    uint32_t mDroppedCalls;
+    KeyedVector<int, VideoSourceInfo> mVideoSourceInfo;
+    int mVideoSessionNumber;
 
 private:
-    DECLARE_THREAD(MDSClientInitThread, MultiDisplayObserver);
+    DECLARE_THREAD(MDSClientThread, MultiDisplayObserver);
 };
 
 #else
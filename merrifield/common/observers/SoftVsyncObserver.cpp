@@ -13,14 +13,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
 #include <HwcTrace.h>
+#include <cutils/properties.h>
 #include <SoftVsyncObserver.h>
 #include <IDisplayDevice.h>
-
-extern "C" int clock_nanosleep(clockid_t clock_id, int flags,
-                           const struct timespec *request,
-                           struct timespec *remain);
-
+#include <Hwcomposer.h>
 
 namespace android {
 namespace intel {
@@ -34,6 +34,9 @@ SoftVsyncObserver::SoftVsyncObserver(IDisplayDevice& disp)
       mLock(),
       mCondition(),
       mNextFakeVSync(0),
+      mLockMode(LOCK_NONE),
+      mLockOffset(0),
+      mLastVSync(0),
       mExitThread(false),
       mInitialized(false)
 {
@@ -53,8 +56,26 @@ bool SoftVsyncObserver::initialize()
 
     mExitThread = false;
     mEnabled = false;
-    mRefreshRate = 60/mDisplayDevice.getFpsDivider();
+    // the divider is applied per period in threadLoop(), it may change
+    // while vsync is enabled
+    mRefreshRate = 60;
     mDevice = mDisplayDevice.getType();
+
+    char prop[PROPERTY_VALUE_MAX];
+    mLockMode = LOCK_NONE;
+    if (property_get("hwc.softvsync.lock", prop, "0") > 0 &&
+        atoi(prop) == LOCK_HARDWARE) {
+        mLockMode = LOCK_HARDWARE;
+    }
+    mLockOffset = 0;
+    if (property_get("hwc.softvsync.offset", prop, "0") > 0) {
+        mLockOffset = us2ns(atoi(prop));
+    }
+    if (mLockMode != LOCK_NONE) {
+        ITRACE("soft vsync locked to hardware vsync, offset %lld us",
+               ns2us(mLockOffset));
+    }
+
     mThread = new VsyncEventPollThread(this);
     if (!mThread.get()) {
         DEINIT_AND_RETURN_FALSE("failed to create vsync event poll thread.");
@@ -83,12 +104,16 @@ void SoftVsyncObserver::deinitialize()
 
 void SoftVsyncObserver::setRefreshRate(int rate)
 {
-    if (mEnabled) {
-        WTRACE("too late to set refresh rate");
-    } else if (rate < 1 || rate > 120) {
+    if (rate < 1 || rate > 120) {
         WTRACE("invalid refresh rate %d", rate);
-    } else {
-        mRefreshRate = rate;
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    mRefreshRate = rate;
+    if (mEnabled) {
+        // takes effect from the next vsync, the one already due is kept
+        mRefreshPeriod = nsecs_t(1e9 / mRefreshRate);
     }
 }
 
@@ -102,6 +127,7 @@ bool SoftVsyncObserver::control(bool enabled)
     if (enabled) {
         mRefreshPeriod = nsecs_t(1e9 / mRefreshRate);
         mNextFakeVSync = systemTime(CLOCK_MONOTONIC) + mRefreshPeriod;
+        mLastVSync = 0;
     }
     mEnabled = enabled;
     mCondition.signal();
@@ -110,6 +136,7 @@ bool SoftVsyncObserver::control(bool enabled)
 
 bool SoftVsyncObserver::threadLoop()
 {
+    nsecs_t refreshPeriod;
     { // scope for lock
         Mutex::Autolock _l(mLock);
         while (!mEnabled) {
@@ -119,19 +146,44 @@ bool SoftVsyncObserver::threadLoop()
                 return false;
             }
         }
+        refreshPeriod = mRefreshPeriod;
     }
 
 
-    const nsecs_t period = mRefreshPeriod * mDisplayDevice.getFpsDivider();
+    const uint32_t divider = mDisplayDevice.getFpsDivider();
+    nsecs_t period = refreshPeriod * divider;
     const nsecs_t now = systemTime(CLOCK_MONOTONIC);
-    nsecs_t next_vsync = mNextFakeVSync;
-    nsecs_t sleep = next_vsync - now;
-    if (sleep < 0) {
-        // we missed, find where the next vsync should be
-        sleep = (period - ((now - next_vsync) % period));
-        next_vsync = now + sleep;
+    nsecs_t next_vsync = 0;
+    nsecs_t modelPeriod = 0;
+    IDisplayDevice *source = NULL;
+    if (mLockMode != LOCK_NONE) {
+        source = getLockSource(modelPeriod);
+    }
+    if (source) {
+        // a locked soft vsync runs at the measured hardware rate
+        refreshPeriod = modelPeriod;
+        period = modelPeriod * divider;
+        // no earlier than half a period before the divided vsync is due
+        nsecs_t after = now;
+        if (mLastVSync && mLastVSync + period - refreshPeriod / 2 > after) {
+            after = mLastVSync + period - refreshPeriod / 2;
+        }
+        next_vsync = source->getNextVsyncTime(after - mLockOffset);
+        if (next_vsync) {
+            next_vsync += mLockOffset;
+        }
+    }
+    if (!next_vsync) {
+        next_vsync = mNextFakeVSync;
+        nsecs_t sleep = next_vsync - now;
+        if (sleep < 0) {
+            // we missed, find where the next vsync should be
+            sleep = (period - ((now - next_vsync) % period));
+            next_vsync = now + sleep;
+        }
     }
     mNextFakeVSync = next_vsync + period;
+    mLastVSync = next_vsync;
 
     struct timespec spec;
     spec.tv_sec  = next_vsync / 1000000000;
@@ -140,7 +192,7 @@ bool SoftVsyncObserver::threadLoop()
     int err;
     do {
         err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
-    } while (err < 0 && errno == EINTR);
+    } while (err == EINTR);
 
 
     if (err == 0) {
@@ -150,6 +202,27 @@ bool SoftVsyncObserver::threadLoop()
     return true;
 }
 
+IDisplayDevice* SoftVsyncObserver::getLockSource(nsecs_t& period)
+{
+    Hwcomposer& hwc = Hwcomposer::getInstance();
+    IDisplayDevice *source = hwc.getDisplayDevice(IDisplayDevice::DEVICE_EXTERNAL);
+    if (source && source->isConnected()) {
+        period = source->getVsyncPeriod();
+        if (period > 0) {
+            return source;
+        }
+    }
+    source = hwc.getDisplayDevice(IDisplayDevice::DEVICE_PRIMARY);
+    if (source) {
+        period = source->getVsyncPeriod();
+        if (period > 0) {
+            return source;
+        }
+    }
+    period = 0;
+    return NULL;
+}
+
 } // namespace intel
 } // namesapce android
 
@@ -34,6 +34,18 @@ public:
     virtual void setRefreshRate(int rate);
     virtual bool control(bool enabled);
 
+private:
+    // lock modes, set by hwc.softvsync.lock
+    enum {
+        LOCK_NONE = 0,
+        // follow the HDMI vsync when connected, else the primary one
+        LOCK_HARDWARE,
+    };
+
+    // display whose vsync model is locked, NULL if none; period is set to
+    // the measured hardware period
+    IDisplayDevice* getLockSource(nsecs_t& period);
+
 private:
     IDisplayDevice& mDisplayDevice;
     int  mDevice;
@@ -43,6 +55,10 @@ private:
     mutable Mutex mLock;
     Condition mCondition;
     mutable nsecs_t mNextFakeVSync;
+    int mLockMode;
+    // added to the hardware vblank time, hwc.softvsync.offset in us
+    nsecs_t mLockOffset;
+    nsecs_t mLastVSync;
     bool mExitThread;
     bool mInitialized;
 
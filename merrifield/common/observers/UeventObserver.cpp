@@ -13,15 +13,16 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
-#include <poll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/queue.h>
 #include <linux/netlink.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <DrmConfig.h>
 #include <HwcTrace.h>
+#include <EventLoop.h>
 #include <UeventObserver.h>
 
 namespace android {
@@ -29,8 +30,8 @@ namespace intel {
 
 UeventObserver::UeventObserver()
     : mUeventFd(-1),
-      mExitRDFd(-1),
-      mExitWDFd(-1),
+      mEventLoop(NULL),
+      mStarted(false),
       mListeners()
 {
 }
@@ -40,7 +41,7 @@ UeventObserver::~UeventObserver()
     deinitialize();
 }
 
-bool UeventObserver::initialize()
+bool UeventObserver::initialize(EventLoop *loop)
 {
     mListeners.clear();
 
@@ -48,11 +49,11 @@ bool UeventObserver::initialize()
         return true;
     }
 
-    mThread = new UeventObserverThread(this);
-    if (!mThread.get()) {
-        ETRACE("failed to create uevent observer thread");
+    if (!loop) {
+        ETRACE("no event loop to read uevents on");
         return false;
     }
+    mEventLoop = loop;
 
     // init uevent socket
     struct sockaddr_nl addr;
@@ -81,46 +82,35 @@ bool UeventObserver::initialize()
     }
 
     memset(mUeventMessage, 0, UEVENT_MSG_LEN);
-
-    int exitFds[2];
-    if (pipe(exitFds) < 0) {
-        ETRACE("failed to make pipe");
-        deinitialize();
-        return false;
-    }
-    mExitRDFd = exitFds[0];
-    mExitWDFd = exitFds[1];
-
     return true;
 }
 
 void UeventObserver::deinitialize()
 {
+    if (mStarted) {
+        // waits for a uevent being handled
+        mEventLoop->removeFd(mUeventFd);
+        mStarted = false;
+    }
+
     if (mUeventFd != -1) {
-        if (mExitWDFd != -1) {
-            close(mExitWDFd);
-            mExitWDFd = -1;
-        }
         close(mUeventFd);
         mUeventFd = -1;
     }
+    mEventLoop = NULL;
 
-    if (mThread.get()) {
-        mThread->requestExitAndWait();
-        mThread = NULL;
-    }
-
-    while (!mListeners.isEmpty()) {
-        UeventListener *listener = mListeners.valueAt(0);
-        mListeners.removeItemsAt(0);
-        delete listener;
-    }
+    mListeners.clear();
 }
 
 void UeventObserver::start()
 {
-    if (mThread.get()) {
-        mThread->run("UeventObserver", PRIORITY_URGENT_DISPLAY);
+    if (mUeventFd == -1 || mStarted) {
+        return;
+    }
+
+    mStarted = mEventLoop->addFd(mUeventFd, EPOLLIN, ueventReadable, this);
+    if (!mStarted) {
+        ETRACE("failed to watch uevent socket");
     }
 }
 
@@ -132,54 +122,51 @@ void UeventObserver::registerListener(const char *event, UeventListenerFunc func
         return;
     }
 
-    String8 key(event);
-    if (mListeners.indexOfKey(key) >= 0) {
-        ETRACE("listener for uevent %s exists", event);
-        return;
+    for (size_t i = 0; i < mListeners.size(); i++) {
+        const UeventListener& listener = mListeners.itemAt(i);
+        if (listener.func == func && listener.data == data &&
+            listener.event == event) {
+            ETRACE("listener for uevent %s exists", event);
+            return;
+        }
     }
 
-    UeventListener *listener = new UeventListener;
-    if (!listener) {
-        ETRACE("failed to create Uevent Listener");
-        return;
-    }
-    listener->func = func;
-    listener->data = data;
+    UeventListener listener;
+    listener.hash = hash(event, &listener.length);
+    listener.event = String8(event);
+    listener.func = func;
+    listener.data = data;
+    mListeners.push_back(listener);
+}
 
-    mListeners.add(key, listener);
+uint32_t UeventObserver::hash(const char *str, size_t *length)
+{
+    // FNV-1a, the length comes for free
+    uint32_t h = 2166136261UL;
+    const char *p = str;
+    while (*p) {
+        h ^= (uint8_t)*p++;
+        h *= 16777619UL;
+    }
+    *length = p - str;
+    return h;
 }
 
-bool UeventObserver::threadLoop()
+void UeventObserver::ueventReadable(int fd, uint32_t events, void *data)
 {
-    if (mUeventFd == -1) {
-        ETRACE("invalid uEvent file descriptor");
-        return false;
+    UeventObserver *observer = (UeventObserver *)data;
+    if (!(events & EPOLLIN)) {
+        return;
     }
 
-    struct pollfd fds[2];
-    int nr;
-
-    fds[0].fd = mUeventFd;
-    fds[0].events = POLLIN;
-    fds[0].revents = 0;
-    fds[1].fd = mExitRDFd;
-    fds[1].events = POLLIN;
-    fds[1].revents = 0;
-    nr = poll(fds, 2, -1);
-
-    if (nr > 0 && fds[0].revents == POLLIN) {
-        int count = recv(mUeventFd, mUeventMessage, UEVENT_MSG_LEN - 2, 0);
-        if (count > 0) {
-            onUevent();
-        }
-    } else if (fds[1].revents) {
-        close(mExitRDFd);
-        mExitRDFd = -1;
-        ITRACE("exiting wait");
-        return false;
+    // drain the socket, a hotplug comes with a burst of uevents
+    int count;
+    while ((count = recv(fd, observer->mUeventMessage, UEVENT_MSG_LEN - 2,
+                         MSG_DONTWAIT)) > 0) {
+        observer->mUeventMessage[count] = '\0';
+        observer->mUeventMessage[count + 1] = '\0';
+        observer->onUevent();
     }
-    // always looping
-    return true;
 }
 
 void UeventObserver::onUevent()
@@ -191,23 +178,35 @@ void UeventObserver::onUevent()
 
     msg += strlen(msg) + 1;
 
-    UeventListener *listener;
-    String8 key;
     while (*msg) {
-        key = String8(msg);
-        if (mListeners.indexOfKey(key) >= 0) {
-            DTRACE("received Uevent: %s", msg);
-            listener = mListeners.valueFor(key);
-            if (listener) {
-                listener->func(listener->data);
-            } else {
-                ETRACE("no listener for uevent %s", msg);
-            }
+        msg += dispatch(msg) + 1;
+    }
+}
+
+void UeventObserver::notify(const char *event)
+{
+    if (!mEventLoop || !mEventLoop->isLoopThread()) {
+        ETRACE("uevent %s not notified on the event loop", event);
+        return;
+    }
+    dispatch(event);
+}
+
+size_t UeventObserver::dispatch(const char *event)
+{
+    size_t length;
+    uint32_t h = hash(event, &length);
+    for (size_t i = 0; i < mListeners.size(); i++) {
+        const UeventListener& listener = mListeners.itemAt(i);
+        if (listener.hash != h || listener.length != length ||
+            memcmp(listener.event.string(), event, length)) {
+            continue;
         }
-        msg += strlen(msg) + 1;
+        DTRACE("received Uevent: %s", event);
+        listener.func(listener.data);
     }
+    return length;
 }
 
 } // namespace intel
 } // namespace android
-
@@ -0,0 +1,290 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <HwcTrace.h>
+#include <VblankEventObserver.h>
+#include <VsyncEventObserver.h>
+
+namespace android {
+namespace intel {
+
+VblankEventObserver::VblankEventObserver()
+    : mLock(),
+      mCondition(),
+      mDrmFd(-1),
+      mDispatching(-1),
+      mExitThread(false),
+      mInitialized(false),
+      mEvents(0),
+      mStaleEvents(0),
+      mArmFailures(0)
+{
+    CTRACE();
+    resetPipes();
+    mWakeFds[0] = mWakeFds[1] = -1;
+}
+
+VblankEventObserver::~VblankEventObserver()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool VblankEventObserver::initialize(int drmFd)
+{
+    if (mInitialized) {
+        WTRACE("object has been initialized");
+        return true;
+    }
+
+    if (drmFd < 0) {
+        DEINIT_AND_RETURN_FALSE("invalid drm fd");
+    }
+    mDrmFd = drmFd;
+    mExitThread = false;
+    mDispatching = -1;
+    resetPipes();
+
+    if (pipe(mWakeFds) < 0) {
+        mWakeFds[0] = mWakeFds[1] = -1;
+        DEINIT_AND_RETURN_FALSE("failed to create wake pipe, error %d", errno);
+    }
+    fcntl(mWakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(mWakeFds[1], F_SETFL, O_NONBLOCK);
+
+    mThread = new VblankEventThread(this);
+    if (!mThread.get()) {
+        DEINIT_AND_RETURN_FALSE("failed to create vblank event thread");
+    }
+    mThread->run("VblankEventObserver", PRIORITY_URGENT_DISPLAY);
+
+    mInitialized = true;
+    return true;
+}
+
+void VblankEventObserver::deinitialize()
+{
+    mInitialized = false;
+    if (mThread.get()) {
+        mExitThread = true;
+        wake();
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (mWakeFds[i] >= 0) {
+            close(mWakeFds[i]);
+            mWakeFds[i] = -1;
+        }
+    }
+    // pending events are left on the fd, they have no listener to go to
+    resetPipes();
+    mDrmFd = -1;
+}
+
+void VblankEventObserver::resetPipes()
+{
+    for (int i = 0; i < PIPE_MAX; i++) {
+        mPipes[i].owner = this;
+        mPipes[i].listener = NULL;
+        mPipes[i].pending = false;
+    }
+}
+
+bool VblankEventObserver::addListener(int pipe, VsyncEventObserver *listener)
+{
+    if (!mInitialized || pipe < 0 || pipe >= PIPE_MAX || !listener) {
+        return false;
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (mPipes[pipe].listener) {
+        WTRACE("pipe %d has a listener already", pipe);
+        return false;
+    }
+    mPipes[pipe].listener = listener;
+    return true;
+}
+
+void VblankEventObserver::removeListener(int pipe)
+{
+    if (pipe < 0 || pipe >= PIPE_MAX) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    mPipes[pipe].listener = NULL;
+    while (mDispatching == pipe) {
+        mCondition.wait(mLock);
+    }
+}
+
+bool VblankEventObserver::arm(int pipe)
+{
+    if (pipe < 0 || pipe >= PIPE_MAX) {
+        return false;
+    }
+
+    Mutex::Autolock _l(mLock);
+    return armLocked(pipe);
+}
+
+bool VblankEventObserver::armLocked(int pipe)
+{
+    if (mPipes[pipe].pending) {
+        return true;
+    }
+
+    drmVBlank vblank;
+    memset(&vblank, 0, sizeof(vblank));
+    uint32_t type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+    if (pipe == 1) {
+        type |= DRM_VBLANK_SECONDARY;
+    } else if (pipe > 1) {
+        type |= (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    }
+    vblank.request.type = (drmVBlankSeqType)type;
+    vblank.request.sequence = 1;
+    vblank.request.signal = (unsigned long)&mPipes[pipe];
+
+    int ret = drmWaitVBlank(mDrmFd, &vblank);
+    if (ret != 0) {
+        if (!mArmFailures++) {
+            WTRACE("failed to request vblank event on pipe %d, error: %d", pipe, ret);
+        }
+        return false;
+    }
+    mPipes[pipe].pending = true;
+    return true;
+}
+
+void VblankEventObserver::wake()
+{
+    if (mWakeFds[1] < 0) {
+        return;
+    }
+    char c = 0;
+    if (write(mWakeFds[1], &c, 1) < 0 && errno != EAGAIN) {
+        WTRACE("failed to wake vblank event thread, error %d", errno);
+    }
+}
+
+void VblankEventObserver::handleVblank(int fd, unsigned int sequence,
+                                       unsigned int sec, unsigned int usec,
+                                       void *data)
+{
+    (void)fd;
+    (void)sequence;
+
+    // data is the signal of the request, the pipe it was made for
+    Pipe *pipe = (Pipe *)data;
+    VblankEventObserver *owner = pipe->owner;
+    int64_t timestamp = (int64_t)sec * 1000000000LL + (int64_t)usec * 1000LL;
+    owner->dispatch(pipe - owner->mPipes, timestamp);
+}
+
+void VblankEventObserver::dispatch(int pipe, int64_t timestamp)
+{
+    VsyncEventObserver *listener = NULL;
+    {
+        Mutex::Autolock _l(mLock);
+        mPipes[pipe].pending = false;
+        listener = mPipes[pipe].listener;
+        if (!listener) {
+            mStaleEvents++;
+            return;
+        }
+        mDispatching = pipe;
+        mEvents++;
+    }
+
+    bool rearm = listener->onVblank(timestamp);
+
+    bool armed = true;
+    {
+        Mutex::Autolock _l(mLock);
+        if (rearm && mPipes[pipe].listener == listener) {
+            armed = armLocked(pipe);
+        }
+    }
+
+    // removeListener() waits until the listener has fallen back
+    if (!armed) {
+        listener->onVblankLost();
+    }
+
+    Mutex::Autolock _l(mLock);
+    mDispatching = -1;
+    mCondition.broadcast();
+}
+
+bool VblankEventObserver::threadLoop()
+{
+    struct pollfd fds[2];
+    fds[0].fd = mDrmFd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = mWakeFds[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    int ret = poll(fds, 2, -1);
+    if (mExitThread) {
+        ITRACE("exiting thread loop");
+        return false;
+    }
+    if (ret < 0) {
+        if (errno != EINTR) {
+            ETRACE("failed to poll drm events, error %d", errno);
+            usleep(16000);
+        }
+        return true;
+    }
+
+    if (fds[1].revents & POLLIN) {
+        char buf[16];
+        while (read(mWakeFds[0], buf, sizeof(buf)) > 0);
+    }
+
+    if (fds[0].revents & POLLIN) {
+        drmEventContext context;
+        memset(&context, 0, sizeof(context));
+        context.version = DRM_EVENT_CONTEXT_VERSION;
+        context.vblank_handler = handleVblank;
+        drmHandleEvent(mDrmFd, &context);
+    }
+    return true;
+}
+
+void VblankEventObserver::dump(Dump& d)
+{
+    d.append("Vblank events: ");
+    for (int i = 0; i < PIPE_MAX; i++) {
+        d.append("pipe %d %s, ", i,
+                 !mPipes[i].listener ? "off" :
+                 (mPipes[i].pending ? "armed" : "idle"));
+    }
+    d.append("events %u, stale %u, failed requests %u\n",
+             mEvents, mStaleEvents, mArmFailures);
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,90 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef __VBLANK_EVENT_OBSERVER_H__
+#define __VBLANK_EVENT_OBSERVER_H__
+
+#include <Dump.h>
+#include <SimpleThread.h>
+#include <utils/Mutex.h>
+#include <utils/Condition.h>
+
+namespace android {
+namespace intel {
+
+class VsyncEventObserver;
+
+// one thread reading the DRM vblank events of all pipes, with the kernel
+// timestamps. Each VsyncEventObserver re-arms its pipe from the event, so
+// no display thread sleeps in the kernel for the next vblank.
+class VblankEventObserver {
+public:
+    enum {
+        PIPE_MAX = 3,
+    };
+
+public:
+    VblankEventObserver();
+    virtual ~VblankEventObserver();
+
+public:
+    bool initialize(int drmFd);
+    void deinitialize();
+    // the vblanks of pipe go to listener, false if events are not
+    // available and it has to wait for them itself
+    bool addListener(int pipe, VsyncEventObserver *listener);
+    // waits for a vblank handed to listener to return
+    void removeListener(int pipe);
+    // requests the event of the next vblank on pipe, unless one is pending
+    bool arm(int pipe);
+    void dump(Dump& d);
+
+private:
+    void resetPipes();
+    bool armLocked(int pipe);
+    void wake();
+    void dispatch(int pipe, int64_t timestamp);
+    static void handleVblank(int fd, unsigned int sequence,
+                             unsigned int sec, unsigned int usec, void *data);
+
+private:
+    // the signal of the event requests
+    struct Pipe {
+        VblankEventObserver *owner;
+        VsyncEventObserver *listener;
+        bool pending;
+    } mPipes[PIPE_MAX];
+
+    Mutex mLock;
+    Condition mCondition;
+    int mDrmFd;
+    // wakes the thread up from poll() to exit
+    int mWakeFds[2];
+    // pipe whose vblank is handed to its listener, -1 if none
+    int mDispatching;
+    bool mExitThread;
+    bool mInitialized;
+    uint32_t mEvents;
+    uint32_t mStaleEvents;
+    uint32_t mArmFailures;
+
+private:
+    DECLARE_THREAD(VblankEventThread, VblankEventObserver);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* __VBLANK_EVENT_OBSERVER_H__ */
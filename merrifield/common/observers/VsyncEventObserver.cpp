@@ -13,9 +13,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <errno.h>
+#include <time.h>
 #include <HwcTrace.h>
 #include <VsyncEventObserver.h>
 #include <PhysicalDevice.h>
+#include <Hwcomposer.h>
 
 namespace android {
 namespace intel {
@@ -29,7 +32,15 @@ VsyncEventObserver::VsyncEventObserver(PhysicalDevice& disp)
       mEnabled(false),
       mExitThread(false),
       mInitialized(false),
-      mFpsCounter(0)
+      mFpsCounter(0),
+      mModel(),
+      mWaitFailures(0),
+      mSynthesized(0),
+      mGated(false),
+      mLastDelivered(0),
+      mGatedCycles(0),
+      mVblankObserver(NULL),
+      mEventDriven(false)
 {
     CTRACE();
 }
@@ -48,20 +59,46 @@ bool VsyncEventObserver::initialize()
 
     mExitThread = false;
     mEnabled = false;
+    mWaitFailures = 0;
+    mSynthesized = 0;
+    mGated = false;
+    mLastDelivered = 0;
+    mGatedCycles = 0;
+    mModel.reset();
     mDevice = mDisplayDevice.getType();
     mVsyncControl = mDisplayDevice.createVsyncControl();
     if (!mVsyncControl || !mVsyncControl->initialize()) {
         DEINIT_AND_RETURN_FALSE("failed to initialize vsync control");
     }
 
+    // pipe equals to device
+    mVblankObserver = Hwcomposer::getInstance().getVblankObserver();
+    if (mVblankObserver && mVblankObserver->addListener(mDevice, this)) {
+        mEventDriven = true;
+    } else {
+        mVblankObserver = NULL;
+        mEventDriven = false;
+        if (!startThread()) {
+            DEINIT_AND_RETURN_FALSE("failed to create vsync event poll thread.");
+        }
+    }
+
+    mInitialized = true;
+    return true;
+}
+
+bool VsyncEventObserver::startThread()
+{
+    if (mThread.get()) {
+        return true;
+    }
+
     mThread = new VsyncEventPollThread(this);
     if (!mThread.get()) {
-        DEINIT_AND_RETURN_FALSE("failed to create vsync event poll thread.");
+        return false;
     }
 
     mThread->run("VsyncEventObserver", PRIORITY_URGENT_DISPLAY);
-
-    mInitialized = true;
     return true;
 }
 
@@ -71,6 +108,14 @@ void VsyncEventObserver::deinitialize()
         WTRACE("vsync is still enabled");
         control(false);
     }
+
+    // an event in flight may still fall back to the thread
+    if (mVblankObserver) {
+        mVblankObserver->removeListener(mDevice);
+        mVblankObserver = NULL;
+    }
+    mEventDriven = false;
+
     mInitialized = false;
     mExitThread = true;
     mEnabled = false;
@@ -93,23 +138,74 @@ bool VsyncEventObserver::control(bool enabled)
     }
 
     Mutex::Autolock _l(mLock);
-    bool ret = mVsyncControl->control(mDevice, enabled);
-    if (!ret) {
-        ETRACE("failed to control (%d) vsync on display %d", enabled, mDevice);
-        return false;
+    if (!enabled && mGated) {
+        // interrupts are already off, the thread leaves them so
+        mGated = false;
+    } else {
+        bool ret = mVsyncControl->control(mDevice, enabled);
+        if (!ret) {
+            ETRACE("failed to control (%d) vsync on display %d", enabled, mDevice);
+            return false;
+        }
     }
 
     mEnabled = enabled;
+    mLastDelivered = 0;
     mCondition.signal();
+
+    // set enabled first, a pending event may be taken meanwhile
+    if (enabled && mEventDriven && !mVblankObserver->arm(mDevice)) {
+        WTRACE("no vblank events on display %d, waiting for them", mDevice);
+        mEventDriven = false;
+        if (!startThread()) {
+            ETRACE("failed to create vsync event poll thread");
+            return false;
+        }
+    }
     return true;
 }
 
+bool VsyncEventObserver::onVblank(int64_t timestamp)
+{
+    if (!mEnabled || !mEventDriven) {
+        return false;
+    }
+
+    // a disconnected display keeps its requests, it just gets no vsync
+    if (!mDisplayDevice.isConnected()) {
+        return true;
+    }
+
+    // the kernel timestamp of the vblank, interrupts stay on with the fps
+    // divider as the event thread has nothing else to sleep in
+    timestamp = mModel.addSample(timestamp);
+    uint32_t divider = mDisplayDevice.getFpsDivider();
+    if ((mFpsCounter++) % divider == 0) {
+        mLastDelivered = timestamp;
+        mDisplayDevice.onVsync(timestamp);
+    }
+    return true;
+}
+
+void VsyncEventObserver::onVblankLost()
+{
+    Mutex::Autolock _l(mLock);
+    if (!mEventDriven) {
+        return;
+    }
+    WTRACE("vblank events failed on display %d, waiting for them", mDevice);
+    mEventDriven = false;
+    if (!startThread()) {
+        ETRACE("failed to create vsync event poll thread");
+    }
+}
+
 bool VsyncEventObserver::threadLoop()
 {
     do {
         // scope for lock
         Mutex::Autolock _l(mLock);
-        while (!mEnabled) {
+        while (!mEnabled || mEventDriven) {
             mCondition.wait(mLock);
             if (mExitThread) {
                 ITRACE("exiting thread loop");
@@ -119,21 +215,133 @@ bool VsyncEventObserver::threadLoop()
     } while (0);
 
     if(mEnabled && mDisplayDevice.isConnected()) {
+        uint32_t divider = mDisplayDevice.getFpsDivider();
+        bool gated = divider > 1 && sleepGated(divider);
+        if (!mEnabled) {
+            return true;
+        }
+
         int64_t timestamp;
         bool ret = mVsyncControl->wait(mDevice, timestamp);
-        if (ret == false) {
-            WTRACE("failed to wait for vsync on display %d, vsync enabled %d", mDevice, mEnabled);
-            usleep(16000);
-            return true;
+        if (ret) {
+            mWaitFailures = 0;
+            timestamp = mModel.addSample(timestamp);
+        } else {
+            mWaitFailures++;
+            WTRACE_LIMITED("failed to wait for vsync on display %d, vsync enabled %d", mDevice, mEnabled);
+            // carry on with the model rather than leave a gap
+            if (!waitPredicted(timestamp)) {
+                usleep(16000);
+                return true;
+            }
+            mSynthesized++;
         }
 
+        // the vblank after a gated sleep is the one to deliver
+        if (gated)
+            mFpsCounter = 0;
+
         // send vsync event notification every hwc.fps_divider
-        if ((mFpsCounter++) % mDisplayDevice.getFpsDivider() == 0)
+        if ((mFpsCounter++) % divider == 0) {
+            mLastDelivered = timestamp;
             mDisplayDevice.onVsync(timestamp);
+        }
     }
 
     return true;
 }
 
+bool VsyncEventObserver::waitPredicted(int64_t& timestamp)
+{
+    nsecs_t next = mModel.getNextVsync(systemTime(SYSTEM_TIME_MONOTONIC));
+    if (!next) {
+        return false;
+    }
+
+    struct timespec spec;
+    spec.tv_sec  = next / 1000000000;
+    spec.tv_nsec = next % 1000000000;
+
+    int err;
+    do {
+        err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+    } while (err == EINTR);
+
+    if (err != 0) {
+        return false;
+    }
+    timestamp = next;
+    return true;
+}
+
+bool VsyncEventObserver::sleepGated(uint32_t divider)
+{
+    nsecs_t period = mModel.getPeriod();
+    if (!period || !mLastDelivered) {
+        return false;
+    }
+
+    // wake half a period ahead of the vblank to deliver, so that the
+    // first interrupt after enabling them again is that one
+    nsecs_t target = mModel.getNextVsync(mLastDelivered +
+                                         (divider - 1) * period + period / 2);
+    if (!target) {
+        return false;
+    }
+    nsecs_t wake = target - period / 2;
+
+    Mutex::Autolock _l(mLock);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (!mEnabled || wake - now < period) {
+        // not a single interrupt to save
+        return false;
+    }
+
+    if (!mVsyncControl->control(mDevice, false)) {
+        return false;
+    }
+    mGated = true;
+
+    while (mGated && !mExitThread && now < wake) {
+        mCondition.waitRelative(mLock, wake - now);
+        now = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+
+    // cleared if vsync was disabled meanwhile
+    if (!mGated) {
+        return false;
+    }
+    mGated = false;
+    if (!mVsyncControl->control(mDevice, true)) {
+        ETRACE("failed to enable vsync on display %d after gating", mDevice);
+        return false;
+    }
+    mGatedCycles++;
+    return true;
+}
+
+nsecs_t VsyncEventObserver::getNextVsyncTime(nsecs_t after) const
+{
+    return mModel.getNextVsync(after);
+}
+
+nsecs_t VsyncEventObserver::getVsyncPeriod() const
+{
+    return mModel.isLocked() ? mModel.getPeriod() : 0;
+}
+
+void VsyncEventObserver::resetModel()
+{
+    mModel.reset();
+}
+
+void VsyncEventObserver::dump(Dump& d)
+{
+    mModel.dump(d);
+    d.append("  synthesized vsyncs %u, failed waits in a row %u, gated cycles %u, %s\n",
+             mSynthesized, mWaitFailures, mGatedCycles,
+             mEventDriven ? "vblank events" : "vblank wait");
+}
+
 } // namespace intel
 } // namesapce android
@@ -16,8 +16,11 @@
 #ifndef __VSYNC_EVENT_OBSERVER_H__
 #define __VSYNC_EVENT_OBSERVER_H__
 
+#include <Dump.h>
 #include <SimpleThread.h>
 #include <IVsyncControl.h>
+#include <VsyncModel.h>
+#include <VblankEventObserver.h>
 
 namespace android {
 namespace intel {
@@ -33,6 +36,28 @@ public:
     virtual bool initialize();
     virtual void deinitialize();
     bool control(bool enabled);
+    // predicted time of the first vblank after the given time, 0 if the
+    // model has not locked on to the hardware vsync yet
+    nsecs_t getNextVsyncTime(nsecs_t after) const;
+    // fitted vsync period, 0 until the model has locked
+    nsecs_t getVsyncPeriod() const;
+    // the vsync period changed with a mode set, learn it again
+    void resetModel();
+    void dump(Dump& d);
+
+    // events of the VblankEventObserver, on its thread. onVblank() returns
+    // whether to request the next one, onVblankLost() falls back to a
+    // thread waiting for the vblanks.
+    bool onVblank(int64_t timestamp);
+    void onVblankLost();
+
+private:
+    bool startThread();
+    // sleeps until the predicted vsync, false if there is no prediction
+    bool waitPredicted(int64_t& timestamp);
+    // with vsync interrupts off, sleeps until shortly before the vblank
+    // delivered next; false if the model can't tell when that is
+    bool sleepGated(uint32_t divider);
 
 private:
     mutable Mutex mLock;
@@ -44,6 +69,19 @@ private:
     bool mExitThread;
     bool mInitialized;
     unsigned int mFpsCounter;
+    VsyncModel mModel;
+    // consecutive failed waits, the vsyncs synthesized in total
+    uint32_t mWaitFailures;
+    uint32_t mSynthesized;
+    // interrupts are off while the vblanks filtered by the fps divider
+    // pass
+    bool mGated;
+    nsecs_t mLastDelivered;
+    uint32_t mGatedCycles;
+    // vblanks come from the shared event thread, the own thread is only
+    // started if the events fail
+    VblankEventObserver *mVblankObserver;
+    bool mEventDriven;
 
 private:
     DECLARE_THREAD(VsyncEventPollThread, VsyncEventObserver);
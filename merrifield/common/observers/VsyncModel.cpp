@@ -0,0 +1,191 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <VsyncModel.h>
+
+namespace android {
+namespace intel {
+
+VsyncModel::VsyncModel()
+    : mLock(),
+      mCount(0),
+      mNext(0),
+      mPeriod(0),
+      mPhase(0),
+      mLastSample(0),
+      mResets(0),
+      mSnapped(0),
+      mMaxError(0)
+{
+    memset(mSamples, 0, sizeof(mSamples));
+}
+
+VsyncModel::~VsyncModel()
+{
+}
+
+void VsyncModel::reset()
+{
+    Mutex::Autolock _l(mLock);
+    resetLocked();
+}
+
+void VsyncModel::resetLocked()
+{
+    mCount = 0;
+    mNext = 0;
+    mPeriod = 0;
+    mPhase = 0;
+    mMaxError = 0;
+}
+
+nsecs_t VsyncModel::addSample(nsecs_t timestamp)
+{
+    Mutex::Autolock _l(mLock);
+    if (mCount && timestamp <= mLastSample) {
+        return timestamp;
+    }
+
+    if (mCount >= MIN_SAMPLES && mPeriod) {
+        nsecs_t offset = timestamp - mPhase;
+        nsecs_t n = (offset + mPeriod / 2) / mPeriod;
+        nsecs_t error = offset - n * mPeriod;
+        if (error < 0) {
+            error = -error;
+        }
+        if (n <= 0 || error > mPeriod / 4) {
+            // the source changed its timing, a mode set or a new panel
+            VTRACE("vsync off the model by %lld us, resetting", ns2us(error));
+            resetLocked();
+            mResets++;
+        } else if (error > mMaxError) {
+            mMaxError = error;
+        }
+    }
+
+    mSamples[mNext] = timestamp;
+    mNext = (mNext + 1) % SAMPLE_COUNT;
+    if (mCount < SAMPLE_COUNT) {
+        mCount++;
+    }
+    mLastSample = timestamp;
+    fit();
+
+    if (mCount < MIN_SAMPLES || !mPeriod) {
+        return timestamp;
+    }
+
+    // mPhase is the fitted time of this sample
+    nsecs_t error = timestamp - mPhase;
+    if (error >= -JITTER_TOLERANCE && error <= JITTER_TOLERANCE) {
+        mSnapped++;
+        return mPhase;
+    }
+    return timestamp;
+}
+
+void VsyncModel::fit()
+{
+    if (mCount < 2) {
+        return;
+    }
+
+    uint32_t oldest = (mNext + SAMPLE_COUNT - mCount) % SAMPLE_COUNT;
+    nsecs_t guess = mPeriod;
+    if (!guess) {
+        // missed vsyncs only widen the gaps, the smallest one is a period
+        for (uint32_t i = 1; i < mCount; i++) {
+            nsecs_t gap = mSamples[(oldest + i) % SAMPLE_COUNT] -
+                          mSamples[(oldest + i - 1) % SAMPLE_COUNT];
+            if (!guess || gap < guess) {
+                guess = gap;
+            }
+        }
+    }
+    if (guess <= 0) {
+        return;
+    }
+
+    // t = phase + n * period, n counted back from the newest sample
+    nsecs_t newest = mLastSample;
+    double sumN = 0, sumT = 0, sumNN = 0, sumNT = 0;
+    for (uint32_t i = 0; i < mCount; i++) {
+        nsecs_t t = mSamples[(oldest + i) % SAMPLE_COUNT] - newest;
+        double n = (double)((t - guess / 2) / guess);
+        sumN += n;
+        sumT += t;
+        sumNN += n * n;
+        sumNT += n * t;
+    }
+
+    double denom = mCount * sumNN - sumN * sumN;
+    if (denom <= 0) {
+        return;
+    }
+    double period = (mCount * sumNT - sumN * sumT) / denom;
+    double phase = (sumT - period * sumN) / mCount;
+    if (period < guess / 2 || period > guess * 2) {
+        return;
+    }
+
+    mPeriod = (nsecs_t)period;
+    mPhase = newest + (nsecs_t)phase;
+}
+
+bool VsyncModel::isLockedLocked(nsecs_t now) const
+{
+    return mCount >= MIN_SAMPLES && mPeriod > 0 &&
+           now - mLastSample < MAX_SAMPLE_AGE;
+}
+
+bool VsyncModel::isLocked() const
+{
+    Mutex::Autolock _l(mLock);
+    return isLockedLocked(systemTime(SYSTEM_TIME_MONOTONIC));
+}
+
+nsecs_t VsyncModel::getPeriod() const
+{
+    Mutex::Autolock _l(mLock);
+    return mPeriod;
+}
+
+nsecs_t VsyncModel::getNextVsync(nsecs_t after) const
+{
+    Mutex::Autolock _l(mLock);
+    if (!isLockedLocked(systemTime(SYSTEM_TIME_MONOTONIC))) {
+        return 0;
+    }
+
+    if (after >= mPhase) {
+        return mPhase + ((after - mPhase) / mPeriod + 1) * mPeriod;
+    }
+    return mPhase - ((mPhase - after - 1) / mPeriod) * mPeriod;
+}
+
+void VsyncModel::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    bool locked = isLockedLocked(systemTime(SYSTEM_TIME_MONOTONIC));
+    d.append("Vsync model: %s, period %lld us, samples %d, snapped %u, "
+             "resets %u, max error %lld us\n",
+             locked ? "locked" : "unlocked", ns2us(mPeriod), mCount,
+             mSnapped, mResets, ns2us(mMaxError));
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,80 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef VSYNC_MODEL_H
+#define VSYNC_MODEL_H
+
+#include <Dump.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+// Period and phase of a vsync source, a least squares fit over the most
+// recent hardware timestamps. Fed by the vsync thread, read from anywhere.
+class VsyncModel {
+public:
+    VsyncModel();
+    ~VsyncModel();
+
+public:
+    void reset();
+    // adds a hardware timestamp, returns the timestamp to report: the
+    // fitted one if the sample is within the jitter tolerance, else the
+    // sample itself
+    nsecs_t addSample(nsecs_t timestamp);
+    bool isLocked() const;
+    nsecs_t getPeriod() const;
+    // first predicted vsync later than the given time, 0 if not locked
+    nsecs_t getNextVsync(nsecs_t after) const;
+    void dump(Dump& d);
+
+private:
+    enum {
+        SAMPLE_COUNT = 16,
+        // samples needed before predictions are made
+        MIN_SAMPLES = 6,
+    };
+
+    // samples off the fit by less than this are snapped to it
+    static const nsecs_t JITTER_TOLERANCE = 1000000;
+    // predictions are not trusted this long after the last sample
+    static const nsecs_t MAX_SAMPLE_AGE = 10000000000LL;
+
+    void fit();
+    void resetLocked();
+    bool isLockedLocked(nsecs_t now) const;
+
+private:
+    mutable Mutex mLock;
+    nsecs_t mSamples[SAMPLE_COUNT];
+    uint32_t mCount;
+    uint32_t mNext;
+
+    // fitted period and the fitted time of the newest sample
+    nsecs_t mPeriod;
+    nsecs_t mPhase;
+    nsecs_t mLastSample;
+
+    uint32_t mResets;
+    uint32_t mSnapped;
+    nsecs_t mMaxError;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* VSYNC_MODEL_H */
@@ -30,16 +30,23 @@ DisplayPlane::DisplayPlane(int index, int type, int disp)
       mDataBuffers(),
       mActiveBuffers(),
       mCacheCapacity(0),
+      mCacheClock(0),
+      mCacheHits(0),
+      mCacheMisses(0),
+      mCacheEvictions(0),
       mIsProtectedBuffer(false),
       mTransform(0),
       mPlaneAlpha(0),
       mBlending(HWC_BLENDING_NONE),
+      mAcquireFence(-1),
       mCurrentDataBuffer(0),
-      mUpdateMasks(0)
+      mUpdateMasks(0),
+      mUpdateFailed(false)
 {
     CTRACE();
     memset(&mPosition, 0, sizeof(mPosition));
     memset(&mSrcCrop, 0, sizeof(mSrcCrop));
+    memset(&mStats, 0, sizeof(mStats));
 }
 
 DisplayPlane::~DisplayPlane()
@@ -101,39 +108,6 @@ void DisplayPlane::checkPosition(int& x, int& y, int& w, int& h)
         h = mode->vdisplay - y;
 }
 
-void DisplayPlane::setPosition(int x, int y, int w, int h)
-{
-    ATRACE("Position = %d, %d - %dx%d", x, y, w, h);
-
-    if (mPosition.x != x || mPosition.y != y ||
-        mPosition.w != w || mPosition.h != h) {
-        mUpdateMasks |= PLANE_POSITION_CHANGED;
-        mPosition.x = x;
-        mPosition.y = y;
-        mPosition.w = w;
-        mPosition.h = h;
-    }
-}
-
-void DisplayPlane::setSourceCrop(int x, int y, int w, int h)
-{
-    ATRACE("Source crop = %d, %d - %dx%d", x, y, w, h);
-
-    if (mSrcCrop.x != x || mSrcCrop.y != y ||
-        mSrcCrop.w != w || mSrcCrop.h != h) {
-        mUpdateMasks |= PLANE_SOURCE_CROP_CHANGED;
-        mSrcCrop.x = x;
-        mSrcCrop.y = y;
-        if (mType == DisplayPlane::PLANE_OVERLAY) {
-            mSrcCrop.w = w & (~0x01);
-            mSrcCrop.h = h & (~0x01);
-        } else {
-            mSrcCrop.w = w;
-            mSrcCrop.h = h;
-        }
-    }
-}
-
 void DisplayPlane::setTransform(int trans)
 {
     ATRACE("transform = %d", trans);
@@ -147,26 +121,11 @@ void DisplayPlane::setTransform(int trans)
     mUpdateMasks |= PLANE_TRANSFORM_CHANGED;
 }
 
-void DisplayPlane::setPlaneAlpha(uint8_t alpha, uint32_t blending)
-{
-    ATRACE("plane alpha = 0x%x", alpha);
-
-    if (mPlaneAlpha != alpha) {
-        mPlaneAlpha = alpha;
-        mUpdateMasks |= PLANE_BUFFER_CHANGED;
-    }
-
-    if (mBlending != blending) {
-        mBlending = blending;
-        mUpdateMasks |= PLANE_BUFFER_CHANGED;
-    }
-}
-
 bool DisplayPlane::setDataBuffer(buffer_handle_t handle)
 {
+    STRACE();
     DataBuffer *buffer;
     BufferMapper *mapper;
-    ssize_t index;
     bool ret;
     bool isCompression;
     BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
@@ -187,6 +146,7 @@ bool DisplayPlane::setDataBuffer(buffer_handle_t handle)
     if (!mUpdateMasks)
         return true;
 
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
     buffer = bm->lockDataBuffer(handle);
     if (!buffer) {
         ETRACE("failed to get buffer");
@@ -197,18 +157,11 @@ bool DisplayPlane::setDataBuffer(buffer_handle_t handle)
     isCompression = GraphicBuffer::isCompressionBuffer((GraphicBuffer*)buffer);
 
     // map buffer if it's not in cache
-    index = mDataBuffers.indexOfKey(buffer->getKey());
-    if (index < 0) {
-        VTRACE("unmapped buffer, mapping...");
-        mapper = mapBuffer(buffer);
-        if (!mapper) {
-            ETRACE("failed to map buffer %p", handle);
-            bm->unlockDataBuffer(buffer);
-            return false;
-        }
-    } else {
-        VTRACE("got mapper in saved data buffers and update source Crop");
-        mapper = mDataBuffers.valueAt(index);
+    mapper = getMapper(buffer);
+    if (!mapper) {
+        ETRACE("failed to map buffer %p", handle);
+        bm->unlockDataBuffer(buffer);
+        return false;
     }
 
     // always update source crop to mapper
@@ -225,17 +178,110 @@ bool DisplayPlane::setDataBuffer(buffer_handle_t handle)
         mCurrentDataBuffer = handle;
         // update active buffers
         updateActiveBuffers(mapper);
+        mStats.fetchBytes = getFetchBytes(*mapper);
     }
+
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    mStats.updates++;
+    mStats.updateTime += elapsed;
+    if (elapsed > mStats.maxUpdateTime)
+        mStats.maxUpdateTime = elapsed;
     return ret;
 }
 
+bool DisplayPlane::getScanout(Scanout& scanout) const
+{
+    if (!mInitialized || !mStats.enabled || !mCurrentDataBuffer ||
+        mIsProtectedBuffer) {
+        return false;
+    }
+
+    ssize_t index = mDataBuffers.indexOfKey((uint64_t)mCurrentDataBuffer);
+    if (index < 0)
+        return false;
+
+    BufferMapper *mapper = mDataBuffers.valueAt(index).mapper;
+    stride_t& stride = mapper->getStride();
+    scanout.type = mType;
+    scanout.device = mDevice;
+    scanout.zorder = mZOrder;
+    scanout.transform = mTransform;
+    scanout.handle = mCurrentDataBuffer;
+    scanout.format = mapper->getFormat();
+    scanout.width = mapper->getWidth();
+    scanout.height = mapper->getHeight();
+    if (mType == PLANE_OVERLAY)
+        scanout.stride = stride.yuv.yStride;
+    else
+        scanout.stride = stride.rgb.stride / 4;
+    scanout.crop = mapper->getCrop();
+    scanout.position = mPosition;
+    return true;
+}
+
+BufferMapper* DisplayPlane::getMapper(DataBuffer *buffer)
+{
+    ssize_t index = mDataBuffers.indexOfKey(buffer->getKey());
+    if (index < 0) {
+        VTRACE("unmapped buffer, mapping...");
+        mCacheMisses++;
+        return mapBuffer(buffer);
+    }
+
+    VTRACE("got mapper in saved data buffers and update source Crop");
+    mCacheHits++;
+    CachedBuffer& cached = mDataBuffers.editValueAt(index);
+    cached.lastUse = ++mCacheClock;
+    return cached.mapper;
+}
+
+bool DisplayPlane::checkDataBuffer(buffer_handle_t handle)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (!handle) {
+        return false;
+    }
+
+    DataBuffer *buffer = bm->lockDataBuffer(handle);
+    if (!buffer) {
+        ETRACE("failed to get buffer");
+        return false;
+    }
+
+    BufferMapper *mapper = getMapper(buffer);
+    bm->unlockDataBuffer(buffer);
+    if (!mapper) {
+        ETRACE("failed to map buffer %p", handle);
+        return false;
+    }
+
+    mapper->setCrop(mSrcCrop.x, mSrcCrop.y, mSrcCrop.w, mSrcCrop.h);
+    return checkDataBuffer(*mapper);
+}
+
+bool DisplayPlane::checkDataBuffer(BufferMapper& mapper)
+{
+    return true;
+}
+
+bool DisplayPlane::repeatLastFrame()
+{
+    return false;
+}
+
 BufferMapper* DisplayPlane::mapBuffer(DataBuffer *buffer)
 {
     BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
 
-    // invalidate buffer cache  if cache is full
-    if ((int)mDataBuffers.size() >= mCacheCapacity) {
-        invalidateBufferCache();
+    // make room by dropping the least recently used mapper only, over the
+    // GTT budget the cache shrinks down to what may still be on screen
+    while (mDataBuffers.size() &&
+           ((int)mDataBuffers.size() >= mCacheCapacity ||
+            (bm->isOverBudget() && mDataBuffers.size() >= MIN_DATA_BUFFER_COUNT))) {
+        evictBuffer();
     }
 
     BufferMapper *mapper = bm->map(*buffer);
@@ -245,7 +291,10 @@ BufferMapper* DisplayPlane::mapBuffer(DataBuffer *buffer)
     }
 
     // add it to data buffers
-    ssize_t index = mDataBuffers.add(buffer->getKey(), mapper);
+    CachedBuffer cached;
+    cached.mapper = mapper;
+    cached.lastUse = ++mCacheClock;
+    ssize_t index = mDataBuffers.add(buffer->getKey(), cached);
     if (index < 0) {
         ETRACE("failed to add mapper");
         bm->unmap(mapper);
@@ -255,9 +304,33 @@ BufferMapper* DisplayPlane::mapBuffer(DataBuffer *buffer)
     return mapper;
 }
 
+void DisplayPlane::evictBuffer()
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    // unsigned distance from the clock keeps working across wrap around
+    size_t oldest = 0;
+    uint32_t oldestAge = 0;
+    for (size_t i = 0; i < mDataBuffers.size(); i++) {
+        uint32_t age = mCacheClock - mDataBuffers.valueAt(i).lastUse;
+        if (age >= oldestAge) {
+            oldest = i;
+            oldestAge = age;
+        }
+    }
+
+    VTRACE("evicting mapper %#llx", mDataBuffers.keyAt(oldest));
+    // active buffers hold their own reference, an on-screen buffer
+    // stays mapped until it leaves the active list
+    bm->unmap(mDataBuffers.valueAt(oldest).mapper);
+    mDataBuffers.removeItemsAt(oldest);
+    mCacheEvictions++;
+}
+
 int DisplayPlane::findActiveBuffer(BufferMapper *mapper)
 {
-    for (size_t i = 0; i < mActiveBuffers.size(); i++) {
+    // the list is bounded by MIN_DATA_BUFFER_COUNT, most recent at the end
+    for (int i = (int)mActiveBuffers.size() - 1; i >= 0; i--) {
         BufferMapper *activeMapper = mActiveBuffers.itemAt(i);
         if (!activeMapper)
             continue;
@@ -285,6 +358,13 @@ void DisplayPlane::updateActiveBuffers(BufferMapper *mapper)
     if (!exist) {
         mapper->incRef();
     } else {
+        BufferMapper *active = mActiveBuffers.itemAt(index);
+        if (active != mapper) {
+            // buffer got evicted and mapped again while on screen
+            bm->unmap(active);
+            mapper->incRef();
+            mStats.remaps++;
+        }
         mActiveBuffers.removeAt(index);
     }
     mActiveBuffers.push_back(mapper);
@@ -317,7 +397,7 @@ void DisplayPlane::invalidateBufferCache()
     RETURN_VOID_IF_NOT_INIT();
 
     for (size_t i = 0; i < mDataBuffers.size(); i++) {
-        mapper = mDataBuffers.valueAt(i);
+        mapper = mDataBuffers.valueAt(i).mapper;
         bm->unmap(mapper);
     }
 
@@ -343,10 +423,26 @@ bool DisplayPlane::assignToDevice(int disp)
     return true;
 }
 
+void DisplayPlane::updateModeInfo(int disp)
+{
+    RETURN_VOID_IF_NOT_INIT();
+
+    if (disp != mDevice) {
+        return;
+    }
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    if (!drm->getModeInfo(mDevice, mModeInfo)) {
+        ETRACE("failed to get mode info");
+    }
+}
+
 bool DisplayPlane::flip(void *ctx)
 {
     RETURN_FALSE_IF_NOT_INIT();
 
+    mStats.flips++;
+
     // always flip
     return true;
 }
@@ -367,9 +463,17 @@ bool DisplayPlane::reset()
         invalidateActiveBuffers();
     }
 
+    mUpdateFailed = false;
     return true;
 }
 
+bool DisplayPlane::takeUpdateFailed()
+{
+    bool failed = mUpdateFailed;
+    mUpdateFailed = false;
+    return failed;
+}
+
 void DisplayPlane::setZOrder(int zorder)
 {
     mZOrder = zorder;
@@ -380,5 +484,82 @@ int DisplayPlane::getZOrder() const
     return mZOrder;
 }
 
+void DisplayPlane::setRetireFence(int fenceFd)
+{
+}
+
+bool DisplayPlane::postCursorPosition(int x, int y)
+{
+    return false;
+}
+
+bool DisplayPlane::applyCursorPosition()
+{
+    return false;
+}
+
+void DisplayPlane::prewarmRotation()
+{
+}
+
+bool DisplayPlane::releaseIdleRotation(nsecs_t now, bool videoActive)
+{
+    return false;
+}
+
+bool DisplayPlane::releaseIdleBuffers(nsecs_t now)
+{
+    return false;
+}
+
+void DisplayPlane::prewarmBuffers()
+{
+}
+
+void DisplayPlane::recordPlaneState(bool enabled)
+{
+    // overlay flushes re-enable the plane on every update, count transitions
+    if (enabled == mStats.enabled)
+        return;
+
+    if (enabled) {
+        mStats.enables++;
+    } else {
+        mStats.disables++;
+    }
+    mStats.enabled = enabled;
+}
+
+uint64_t DisplayPlane::getFetchBytes(BufferMapper& mapper) const
+{
+    return BandwidthEstimator::getFetchBytes(mapper.getFormat(),
+                                             mSrcCrop.w, mSrcCrop.h,
+                                             mapper.isCompression());
+}
+
+void DisplayPlane::dump(Dump& d)
+{
+    // a plane scans out its buffer on every refresh while it is enabled
+    uint64_t bandwidth = 0;
+    if (mStats.enabled) {
+        bandwidth = mStats.fetchBytes * mModeInfo.vrefresh;
+    }
+
+    nsecs_t avgUpdateTime = 0;
+    if (mStats.updates) {
+        avgUpdateTime = mStats.updateTime / mStats.updates;
+    }
+
+    d.append("    plane %d type %d: mappers %d/%d, hits %u, misses %u, evictions %u\n",
+             mIndex, mType, mDataBuffers.size(), mCacheCapacity,
+             mCacheHits, mCacheMisses, mCacheEvictions);
+    d.append("      flips %u, updates %u (avg %lld us, max %lld us), remaps %u\n",
+             mStats.flips, mStats.updates,
+             ns2us(avgUpdateTime), ns2us(mStats.maxUpdateTime),
+             mStats.remaps);
+    d.append("      enables %u, disables %u, fetch %llu KB/s\n",
+             mStats.enables, mStats.disables, bandwidth / 1024);
+}
+
 } // namespace intel
 } // namespace android
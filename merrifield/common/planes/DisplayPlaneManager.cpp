@@ -13,27 +13,50 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <string.h>
 #include <HwcTrace.h>
 #include <IDisplayDevice.h>
 #include <DisplayPlaneManager.h>
+#include <VaDisplayManager.h>
 
 namespace android {
 namespace intel {
 
+DisplayPlaneManager::PlanePool::PlanePool()
+    : lock()
+{
+    memset(free, 0, sizeof(free));
+    memset(reclaimed, 0, sizeof(reclaimed));
+    memset(pending, 0, sizeof(pending));
+    memset(resetting, 0, sizeof(resetting));
+}
+
 DisplayPlaneManager::DisplayPlaneManager()
     : mTotalPlaneCount(0),
       mPrimaryPlaneCount(DEFAULT_PRIMARY_PLANE_COUNT),
       mSpritePlaneCount(0),
       mOverlayPlaneCount(0),
-      mInitialized(false)
+      mInitialized(false),
+      mLock(),
+      mResetCondition(),
+      mResetRequested(false),
+      mVsyncSeen(false),
+      mExitThread(false),
+      mOverlaysGated(false),
+      mGatedSince(0),
+      mGatedTime(0),
+      mGates(0),
+      mWakes(0),
+      mLateWakes(0),
+      mWakeCost(0)
 {
     int i;
 
     for (i = 0; i < DisplayPlane::PLANE_MAX; i++) {
         mPlaneCount[i] = 0;
-        mFreePlanes[i] = 0;
-        mReclaimedPlanes[i] = 0;
     }
+
+    clearReservations();
 }
 
 DisplayPlaneManager::~DisplayPlaneManager()
@@ -46,6 +69,8 @@ void DisplayPlaneManager::deinitialize()
     int i;
     size_t j;
 
+    stopResetWorker();
+
     for (i = 0; i < DisplayPlane::PLANE_MAX; i++) {
         for (j = 0; j < mPlanes[i].size(); j++) {
             // reset plane
@@ -82,8 +107,22 @@ bool DisplayPlaneManager::initialize()
         return false;
     }
 
+    if (mPlaneCount[DisplayPlane::PLANE_PRIMARY] > PIPE_MAX ||
+        mPlaneCount[DisplayPlane::PLANE_CURSOR] > PIPE_MAX) {
+        ETRACE("more pipe planes than pipes");
+        return false;
+    }
+
     for (i = 0; i < DisplayPlane::PLANE_MAX; i++) {
-        mFreePlanes[i] = ((1 << mPlaneCount[i]) - 1);
+        uint32_t all = ((1 << mPlaneCount[i]) - 1);
+        for (j = 0; j < POOL_COUNT; j++) {
+            PlanePool& pool = mPools[j];
+            Mutex::Autolock _l(pool.lock);
+            pool.free[i] = all & getPoolMask(j, i);
+            pool.reclaimed[i] = 0;
+            pool.pending[i] = 0;
+            pool.resetting[i] = 0;
+        }
     }
 
     // allocate plane pools
@@ -102,10 +141,54 @@ bool DisplayPlaneManager::initialize()
         }
     }
 
+    startResetWorker();
+
     mInitialized = true;
     return true;
 }
 
+void DisplayPlaneManager::startResetWorker()
+{
+    mExitThread = false;
+    mThread = new PlaneResetThread(this);
+    if (!mThread.get()) {
+        // reclaimed planes are still handed out, just never reset
+        WTRACE("failed to create plane reset thread");
+        return;
+    }
+    mThread->run("HwcPlaneReset", PRIORITY_BACKGROUND);
+}
+
+void DisplayPlaneManager::stopResetWorker()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThread = true;
+        mResetCondition.broadcast();
+    }
+
+    if (mThread.get()) {
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+}
+
+DisplayPlaneManager::PlanePool& DisplayPlaneManager::getPool(int type, int index)
+{
+    if (isPipePlane(type) && index >= 0 && index < PIPE_MAX) {
+        return mPools[POOL_SHARED + 1 + index];
+    }
+    return mPools[POOL_SHARED];
+}
+
+uint32_t DisplayPlaneManager::getPoolMask(int pool, int type) const
+{
+    if (pool == POOL_SHARED) {
+        return isPipePlane(type) ? 0 : ~0U;
+    }
+    return isPipePlane(type) ? (1U << (pool - POOL_SHARED - 1)) : 0;
+}
+
 int DisplayPlaneManager::getPlane(uint32_t& mask)
 {
     if (!mask)
@@ -160,11 +243,18 @@ DisplayPlane* DisplayPlaneManager::getPlane(int type, int index)
         return 0;
     }
 
-    int freePlaneIndex = getPlane(mReclaimedPlanes[type], index);
-    if (freePlaneIndex >= 0)
+    // a plane being reset is in neither bitmap, it is skipped rather than
+    // waited for as the reset worker runs at background priority
+    PlanePool& pool = getPool(type, index);
+    Mutex::Autolock _l(pool.lock);
+
+    int freePlaneIndex = getPlane(pool.reclaimed[type], index);
+    if (freePlaneIndex >= 0) {
+        pool.pending[type] &= ~(1 << freePlaneIndex);
         return mPlanes[type].itemAt(freePlaneIndex);
+    }
 
-    freePlaneIndex = getPlane(mFreePlanes[type], index);
+    freePlaneIndex = getPlane(pool.free[type], index);
     if (freePlaneIndex >= 0)
         return mPlanes[type].itemAt(freePlaneIndex);
 
@@ -180,11 +270,21 @@ DisplayPlane* DisplayPlaneManager::getAnyPlane(int type)
         return 0;
     }
 
-    int freePlaneIndex = getPlane(mReclaimedPlanes[type]);
-    if (freePlaneIndex >= 0)
+    if (isPipePlane(type)) {
+        ETRACE("plane type %d is fixed to a pipe", type);
+        return 0;
+    }
+
+    PlanePool& pool = mPools[POOL_SHARED];
+    Mutex::Autolock _l(pool.lock);
+
+    int freePlaneIndex = getPlane(pool.reclaimed[type]);
+    if (freePlaneIndex >= 0) {
+        pool.pending[type] &= ~(1 << freePlaneIndex);
         return mPlanes[type].itemAt(freePlaneIndex);
+    }
 
-    freePlaneIndex = getPlane(mFreePlanes[type]);
+    freePlaneIndex = getPlane(pool.free[type]);
     if (freePlaneIndex >= 0)
         return mPlanes[type].itemAt(freePlaneIndex);
 
@@ -206,7 +306,9 @@ void DisplayPlaneManager::putPlane(int dsp, DisplayPlane& plane)
         return;
     }
 
-    putPlane(index, mFreePlanes[type]);
+    PlanePool& pool = getPool(type, index);
+    Mutex::Autolock _l(pool.lock);
+    putPlane(index, pool.free[type]);
 }
 
 bool DisplayPlaneManager::isFreePlane(int type, int index)
@@ -216,13 +318,28 @@ bool DisplayPlaneManager::isFreePlane(int type, int index)
         return false;
     }
 
-    int freePlanes = mFreePlanes[type] | mReclaimedPlanes[type];
-    if ((freePlanes & (1 << index)) == 0)
+    if ((getAvailablePlanes(type) & (1 << index)) == 0)
         return false;
 
     return true;
 }
 
+uint32_t DisplayPlaneManager::getAvailablePlanes(int type)
+{
+    // one lock for sprites and overlays, the pipe planes are gathered pipe
+    // by pipe, each one only changes under its own display
+    uint32_t planes = 0;
+    for (int i = 0; i < POOL_COUNT; i++) {
+        if (!getPoolMask(i, type)) {
+            continue;
+        }
+        PlanePool& pool = mPools[i];
+        Mutex::Autolock _l(pool.lock);
+        planes |= pool.free[type] | pool.reclaimed[type];
+    }
+    return planes;
+}
+
 int DisplayPlaneManager::getFreePlanes(int dsp, int type)
 {
     RETURN_NULL_IF_NOT_INIT();
@@ -237,8 +354,7 @@ int DisplayPlaneManager::getFreePlanes(int dsp, int type)
         return 0;
     }
 
-
-    uint32_t freePlanes = mFreePlanes[type] | mReclaimedPlanes[type];
+    uint32_t freePlanes = getAvailablePlanes(type);
     if (type == DisplayPlane::PLANE_PRIMARY ||
         type == DisplayPlane::PLANE_CURSOR) {
         return ((freePlanes & (1 << dsp)) == 0) ? 0 : 1;
@@ -249,11 +365,58 @@ int DisplayPlaneManager::getFreePlanes(int dsp, int type)
                 count++;
             }
         }
-        return count;
+        count -= getReservedPlanes(dsp, type);
+        return count > 0 ? count : 0;
     }
     return 0;
 }
 
+int DisplayPlaneManager::getReservedPlanes(int dsp, int type)
+{
+    // planes held back for the other displays
+    int count = 0;
+    for (int i = 0; i < RESERVATION_DISPLAYS; i++) {
+        if (i != dsp) {
+            count += mReservedPlanes[i][type];
+        }
+    }
+    return count;
+}
+
+void DisplayPlaneManager::reservePlanes(int dsp, int type, int count)
+{
+    if (dsp < 0 || dsp >= RESERVATION_DISPLAYS) {
+        ETRACE("Invalid display device %d", dsp);
+        return;
+    }
+
+    if (type < 0 || type >= DisplayPlane::PLANE_MAX) {
+        ETRACE("Invalid plane type %d", type);
+        return;
+    }
+
+    VTRACE("reserve %d planes of type %d for device %d", count, type, dsp);
+    mReservedPlanes[dsp][type] = count;
+}
+
+void DisplayPlaneManager::releasePlanes(int dsp)
+{
+    if (dsp < 0 || dsp >= RESERVATION_DISPLAYS) {
+        return;
+    }
+
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        mReservedPlanes[dsp][i] = 0;
+    }
+}
+
+void DisplayPlaneManager::clearReservations()
+{
+    for (int i = 0; i < RESERVATION_DISPLAYS; i++) {
+        releasePlanes(i);
+    }
+}
+
 void DisplayPlaneManager::reclaimPlane(int dsp, DisplayPlane& plane)
 {
     RETURN_VOID_IF_NOT_INIT();
@@ -268,7 +431,9 @@ void DisplayPlaneManager::reclaimPlane(int dsp, DisplayPlane& plane)
         return;
     }
 
-    putPlane(index, mReclaimedPlanes[type]);
+    PlanePool& pool = getPool(type, index);
+    Mutex::Autolock _l(pool.lock);
+    putPlane(index, pool.reclaimed[type]);
 
     // NOTE: don't invalidate plane's data cache here because the reclaimed
     // plane might be re-assigned to the same layer later
@@ -276,35 +441,294 @@ void DisplayPlaneManager::reclaimPlane(int dsp, DisplayPlane& plane)
 
 void DisplayPlaneManager::disableReclaimedPlanes()
 {
-    int i, j;
-    bool ret;
-
     RETURN_VOID_IF_NOT_INIT();
 
-    for (i = 0; i < DisplayPlane::PLANE_MAX; i++) {
-        // disable reclaimed planes
-        if (mReclaimedPlanes[i]) {
-            for (j = 0; j < mPlaneCount[i]; j++) {
-                int bit = (1 << j);
-                if (mReclaimedPlanes[i] & bit) {
-                    DisplayPlane* plane = mPlanes[i].itemAt(j);
-                    // check plane state first
-                    ret = plane->isDisabled();
-                    // reset plane
-                    if (ret)
-                        ret = plane->reset();
-                    if (ret) {
-                        // only merge into free bitmap if it is successfully disabled and reset
-                        // otherwise, plane will be disabled and reset again.
-                        mFreePlanes[i] |=bit;
-                        mReclaimedPlanes[i] &= ~bit;
-                    }
-                }
+    bool pending = false;
+    for (int j = 0; j < POOL_COUNT; j++) {
+        PlanePool& pool = mPools[j];
+        Mutex::Autolock _l(pool.lock);
+        for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+            pool.pending[i] |= pool.reclaimed[i];
+            if (pool.pending[i]) {
+                pending = true;
+            }
+        }
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (pending && !mResetRequested) {
+        mResetRequested = true;
+        mVsyncSeen = false;
+        mResetCondition.signal();
+    }
+}
+
+void DisplayPlaneManager::onVsync()
+{
+    Mutex::Autolock _l(mLock);
+    if (mResetRequested) {
+        mVsyncSeen = true;
+        mResetCondition.signal();
+    }
+}
+
+void DisplayPlaneManager::resetPlanes(uint32_t *planes)
+{
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        for (int j = 0; j < mPlaneCount[i]; j++) {
+            int bit = (1 << j);
+            if (!(planes[i] & bit)) {
+                continue;
+            }
+
+            DisplayPlane* plane = mPlanes[i].itemAt(j);
+            // check plane state first
+            bool ret = plane->isDisabled();
+            // reset plane
+            if (ret)
+                ret = plane->reset();
+            if (!ret) {
+                // reset again next time
+                planes[i] &= ~bit;
             }
         }
     }
 }
 
+bool DisplayPlaneManager::threadLoop()
+{
+    uint32_t planes[DisplayPlane::PLANE_MAX];
+    uint32_t taken[POOL_COUNT][DisplayPlane::PLANE_MAX];
+
+    { // scope for lock
+        Mutex::Autolock _l(mLock);
+        while (!mResetRequested) {
+            if (mExitThread) {
+                ITRACE("exiting thread loop");
+                return false;
+            }
+            mResetCondition.wait(mLock);
+        }
+
+        // the flip that dropped the planes is on screen after the next
+        // vblank; don't wait forever when vsync is off
+        while (!mVsyncSeen && !mExitThread) {
+            if (mResetCondition.waitRelative(mLock,
+                    milliseconds(PLANE_RESET_TIMEOUT)) == TIMED_OUT) {
+                break;
+            }
+        }
+        if (mExitThread) {
+            return false;
+        }
+        mResetRequested = false;
+    }
+
+    // planes taken back by a display since don't need the reset. The
+    // pools serve disjoint bits of each type.
+    memset(planes, 0, sizeof(planes));
+    for (int j = 0; j < POOL_COUNT; j++) {
+        PlanePool& pool = mPools[j];
+        Mutex::Autolock _l(pool.lock);
+        for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+            taken[j][i] = pool.pending[i] & pool.reclaimed[i];
+            pool.reclaimed[i] &= ~taken[j][i];
+            pool.resetting[i] = taken[j][i];
+            pool.pending[i] = 0;
+            planes[i] |= taken[j][i];
+        }
+    }
+
+    resetPlanes(planes);
+
+    for (int j = 0; j < POOL_COUNT; j++) {
+        PlanePool& pool = mPools[j];
+        Mutex::Autolock _l(pool.lock);
+        for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+            // only merge into free bitmap if it is successfully disabled
+            // and reset, otherwise it stays reclaimed and is reset again
+            uint32_t done = taken[j][i] & planes[i];
+            pool.free[i] |= done;
+            pool.reclaimed[i] |= taken[j][i] & ~done;
+            pool.resetting[i] = 0;
+        }
+    }
+    return true;
+}
+
+DisplayPlane* DisplayPlaneManager::getCursorPlane(int dsp)
+{
+    if (!mInitialized || dsp < 0 ||
+        dsp >= (int)mPlanes[DisplayPlane::PLANE_CURSOR].size()) {
+        return NULL;
+    }
+
+    return mPlanes[DisplayPlane::PLANE_CURSOR].itemAt(dsp);
+}
+
+int DisplayPlaneManager::getScanout(int dsp, DisplayPlane::Scanout *scanouts,
+                                    int max)
+{
+    if (!mInitialized || !scanouts)
+        return 0;
+
+    int count = 0;
+    for (int type = 0; type < DisplayPlane::PLANE_MAX; type++) {
+        if (type == DisplayPlane::PLANE_CURSOR)
+            continue;
+        for (size_t i = 0; i < mPlanes[type].size() && count < max; i++) {
+            DisplayPlane::Scanout& scanout = scanouts[count];
+            if (mPlanes[type].itemAt(i)->getScanout(scanout) &&
+                scanout.device == dsp) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+uint32_t DisplayPlaneManager::getBusyOverlayPlanes()
+{
+    // only prepare reclaims planes, so the set can't grow until it returns
+    PlanePool& pool = mPools[POOL_SHARED];
+    Mutex::Autolock _l(pool.lock);
+    int type = DisplayPlane::PLANE_OVERLAY;
+    return pool.reclaimed[type] | pool.pending[type] | pool.resetting[type];
+}
+
+void DisplayPlaneManager::prewarmRotation()
+{
+    RETURN_VOID_IF_NOT_INIT();
+
+    uint32_t busy = getBusyOverlayPlanes();
+    for (int i = 0; i < mPlaneCount[DisplayPlane::PLANE_OVERLAY]; i++) {
+        if (!(busy & (1 << i))) {
+            mPlanes[DisplayPlane::PLANE_OVERLAY].itemAt(i)->prewarmRotation();
+        }
+    }
+}
+
+bool DisplayPlaneManager::releaseIdleRotation(nsecs_t now, bool videoActive)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    bool held = false;
+    uint32_t busy = getBusyOverlayPlanes();
+    for (int i = 0; i < mPlaneCount[DisplayPlane::PLANE_OVERLAY]; i++) {
+        if (busy & (1 << i)) {
+            // checked again once it is reset
+            held = true;
+            continue;
+        }
+        DisplayPlane *plane = mPlanes[DisplayPlane::PLANE_OVERLAY].itemAt(i);
+        if (plane->releaseIdleRotation(now, videoActive)) {
+            held = true;
+        }
+    }
+    return held;
+}
+
+bool DisplayPlaneManager::releaseIdleBuffers(nsecs_t now)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    bool held = false;
+    uint32_t busy = getBusyOverlayPlanes();
+    for (int i = 0; i < mPlaneCount[DisplayPlane::PLANE_OVERLAY]; i++) {
+        DisplayPlane *plane = mPlanes[DisplayPlane::PLANE_OVERLAY].itemAt(i);
+        // planes in use are checked again once they are free
+        if ((busy & (1 << i)) ||
+            !isFreePlane(DisplayPlane::PLANE_OVERLAY, i)) {
+            held = true;
+            continue;
+        }
+        if (plane->releaseIdleBuffers(now)) {
+            held = true;
+        }
+    }
+    return held;
+}
+
+void DisplayPlaneManager::updatePowerState(nsecs_t now)
+{
+    RETURN_VOID_IF_NOT_INIT();
+
+    bool held = releaseIdleBuffers(now);
+    bool idle = !held && isOverlayPlanesDisabled() && VaDisplayManager::isIdle();
+    if (idle == mOverlaysGated) {
+        return;
+    }
+
+    if (!idle) {
+        // in use again without a video session start ahead of it
+        mLateWakes++;
+        mGatedTime += now - mGatedSince;
+        mOverlaysGated = false;
+        return;
+    }
+
+    releaseVideoCaches();
+    mOverlaysGated = true;
+    mGatedSince = now;
+    mGates++;
+    DTRACE("overlay and VSP idle, left to power down");
+}
+
+void DisplayPlaneManager::wakeOverlays()
+{
+    RETURN_VOID_IF_NOT_INIT();
+
+    if (!mOverlaysGated) {
+        return;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint32_t busy = getBusyOverlayPlanes();
+    for (int i = 0; i < mPlaneCount[DisplayPlane::PLANE_OVERLAY]; i++) {
+        if (!(busy & (1 << i))) {
+            mPlanes[DisplayPlane::PLANE_OVERLAY].itemAt(i)->prewarmBuffers();
+        }
+    }
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    mWakeCost = now - start;
+    mGatedTime += now - mGatedSince;
+    mOverlaysGated = false;
+    mWakes++;
+    DTRACE("overlays woken in %lld us", ns2us(mWakeCost));
+}
+
+void DisplayPlaneManager::updateModeInfo(int dsp)
+{
+    RETURN_VOID_IF_NOT_INIT();
+
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        for (size_t j = 0; j < mPlanes[i].size(); j++) {
+            mPlanes[i].itemAt(j)->updateModeInfo(dsp);
+        }
+    }
+}
+
+void DisplayPlaneManager::releaseVideoCaches()
+{
+    RETURN_VOID_IF_NOT_INIT();
+
+    int type = DisplayPlane::PLANE_OVERLAY;
+    uint32_t busy = getBusyOverlayPlanes();
+    uint32_t free;
+    {
+        PlanePool& pool = mPools[POOL_SHARED];
+        Mutex::Autolock _l(pool.lock);
+        free = pool.free[type];
+    }
+
+    // planes still assigned keep their cache until they are released
+    for (int i = 0; i < mPlaneCount[type]; i++) {
+        if ((free & (1 << i)) && !(busy & (1 << i))) {
+            mPlanes[type].itemAt(i)->invalidateBufferCache();
+        }
+    }
+}
+
 bool DisplayPlaneManager::isOverlayPlanesDisabled()
 {
     for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
@@ -322,26 +746,47 @@ bool DisplayPlaneManager::isOverlayPlanesDisabled()
 
 void DisplayPlaneManager::dump(Dump& d)
 {
+    static const char *names[DisplayPlane::PLANE_MAX] = {
+        "SPRITE", "OVERLAY", "PRIMARY", "CURSOR",
+    };
+
+    uint32_t free[DisplayPlane::PLANE_MAX];
+    uint32_t reclaimed[DisplayPlane::PLANE_MAX];
+    memset(free, 0, sizeof(free));
+    memset(reclaimed, 0, sizeof(reclaimed));
+    for (int j = 0; j < POOL_COUNT; j++) {
+        PlanePool& pool = mPools[j];
+        Mutex::Autolock _l(pool.lock);
+        for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+            free[i] |= pool.free[i];
+            reclaimed[i] |= pool.reclaimed[i];
+        }
+    }
+
     d.append("Display Plane Manager state:\n");
     d.append("-------------------------------------------------------------\n");
     d.append(" PLANE TYPE | COUNT |   FREE   | RECLAIMED \n");
     d.append("------------+-------+----------+-----------\n");
-    d.append("    SPRITE  |  %2d   | %08x | %08x\n",
-             mPlaneCount[DisplayPlane::PLANE_SPRITE],
-             mFreePlanes[DisplayPlane::PLANE_SPRITE],
-             mReclaimedPlanes[DisplayPlane::PLANE_SPRITE]);
-    d.append("   OVERLAY  |  %2d   | %08x | %08x\n",
-             mPlaneCount[DisplayPlane::PLANE_OVERLAY],
-             mFreePlanes[DisplayPlane::PLANE_OVERLAY],
-             mReclaimedPlanes[DisplayPlane::PLANE_OVERLAY]);
-    d.append("   PRIMARY  |  %2d   | %08x | %08x\n",
-             mPlaneCount[DisplayPlane::PLANE_PRIMARY],
-             mFreePlanes[DisplayPlane::PLANE_PRIMARY],
-             mReclaimedPlanes[DisplayPlane::PLANE_PRIMARY]);
-    d.append("   CURSOR   |  %2d   | %08x | %08x\n",
-             mPlaneCount[DisplayPlane::PLANE_CURSOR],
-             mFreePlanes[DisplayPlane::PLANE_CURSOR],
-             mReclaimedPlanes[DisplayPlane::PLANE_CURSOR]);
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        d.append("  %8s  |  %2d   | %08x | %08x\n",
+                 names[i], mPlaneCount[i], free[i], reclaimed[i]);
+    }
+
+    nsecs_t gatedTime = mGatedTime;
+    if (mOverlaysGated) {
+        gatedTime += systemTime(SYSTEM_TIME_MONOTONIC) - mGatedSince;
+    }
+    d.append(" Overlay power: %s, gated %u times for %lld ms, woken %u times "
+             "ahead (last in %lld us), %u late\n",
+             mOverlaysGated ? "gated" : "on", mGates, ns2ms(gatedTime),
+             mWakes, ns2us(mWakeCost), mLateWakes);
+
+    d.append(" Mapper cache and update statistics:\n");
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        for (size_t j = 0; j < mPlanes[i].size(); j++) {
+            mPlanes[i].itemAt(j)->dump(d);
+        }
+    }
 }
 
 } // namespace intel
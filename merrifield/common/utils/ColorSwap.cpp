@@ -0,0 +1,159 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <ColorSwap.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define COLOR_SWAP_X86
+#endif
+
+namespace android {
+namespace intel {
+
+static inline void colorSwapScalar(uint8_t *dest, const uint8_t *src, uint32_t pixelCount)
+{
+    while (pixelCount > 0) {
+        dest[0] = src[2];
+        dest[1] = src[1];
+        dest[2] = src[0];
+        dest[3] = src[3];
+        src += 4;
+        dest += 4;
+        pixelCount--;
+    }
+}
+
+#ifdef COLOR_SWAP_X86
+
+// write combined gralloc memory is never read back by the CPU, so the
+// vector kernels align the destination and bypass the cache on stores
+
+__attribute__((target("ssse3")))
+static void colorSwapSSSE3(uint8_t *dest, const uint8_t *src, uint32_t pixelCount)
+{
+    // pixel heads until the destination is 16 byte aligned
+    uint32_t head = ((16 - ((uintptr_t)dest & 15)) & 15) >> 2;
+    if ((uintptr_t)dest & 3) {
+        // never aligns, stores would straddle pixels
+        head = pixelCount;
+    }
+    if (head > pixelCount) {
+        head = pixelCount;
+    }
+    colorSwapScalar(dest, src, head);
+    dest += head * 4;
+    src += head * 4;
+    pixelCount -= head;
+
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                       10, 9, 8, 11, 14, 13, 12, 15);
+    while (pixelCount >= 16) {
+        __m128i p0 = _mm_loadu_si128((const __m128i *)(src + 0));
+        __m128i p1 = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i p2 = _mm_loadu_si128((const __m128i *)(src + 32));
+        __m128i p3 = _mm_loadu_si128((const __m128i *)(src + 48));
+        _mm_stream_si128((__m128i *)(dest + 0), _mm_shuffle_epi8(p0, mask));
+        _mm_stream_si128((__m128i *)(dest + 16), _mm_shuffle_epi8(p1, mask));
+        _mm_stream_si128((__m128i *)(dest + 32), _mm_shuffle_epi8(p2, mask));
+        _mm_stream_si128((__m128i *)(dest + 48), _mm_shuffle_epi8(p3, mask));
+        src += 64;
+        dest += 64;
+        pixelCount -= 16;
+    }
+    while (pixelCount >= 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *)src);
+        _mm_stream_si128((__m128i *)dest, _mm_shuffle_epi8(p, mask));
+        src += 16;
+        dest += 16;
+        pixelCount -= 4;
+    }
+    _mm_sfence();
+
+    colorSwapScalar(dest, src, pixelCount);
+}
+
+__attribute__((target("avx2")))
+static void colorSwapAVX2(uint8_t *dest, const uint8_t *src, uint32_t pixelCount)
+{
+    // pixel heads until the destination is 32 byte aligned
+    uint32_t head = ((32 - ((uintptr_t)dest & 31)) & 31) >> 2;
+    if ((uintptr_t)dest & 3) {
+        head = pixelCount;
+    }
+    if (head > pixelCount) {
+        head = pixelCount;
+    }
+    colorSwapScalar(dest, src, head);
+    dest += head * 4;
+    src += head * 4;
+    pixelCount -= head;
+
+    // vpshufb shuffles within each 128 bit lane, which is all we need
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                          10, 9, 8, 11, 14, 13, 12, 15,
+                                          2, 1, 0, 3, 6, 5, 4, 7,
+                                          10, 9, 8, 11, 14, 13, 12, 15);
+    while (pixelCount >= 16) {
+        __m256i p0 = _mm256_loadu_si256((const __m256i *)(src + 0));
+        __m256i p1 = _mm256_loadu_si256((const __m256i *)(src + 32));
+        _mm256_stream_si256((__m256i *)(dest + 0), _mm256_shuffle_epi8(p0, mask));
+        _mm256_stream_si256((__m256i *)(dest + 32), _mm256_shuffle_epi8(p1, mask));
+        src += 64;
+        dest += 64;
+        pixelCount -= 16;
+    }
+    while (pixelCount >= 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)src);
+        _mm256_stream_si256((__m256i *)dest, _mm256_shuffle_epi8(p, mask));
+        src += 32;
+        dest += 32;
+        pixelCount -= 8;
+    }
+    _mm_sfence();
+
+    colorSwapScalar(dest, src, pixelCount);
+}
+
+typedef void (*ColorSwapFunc)(uint8_t *, const uint8_t *, uint32_t);
+
+static ColorSwapFunc selectColorSwap()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return colorSwapAVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return colorSwapSSSE3;
+    return colorSwapScalar;
+}
+
+#endif // COLOR_SWAP_X86
+
+void colorSwapRB(uint8_t *dest, const uint8_t *src, uint32_t pixelCount)
+{
+#ifdef COLOR_SWAP_X86
+    // selected once, the result is the same for every thread
+    static ColorSwapFunc colorSwapFunc = 0;
+    if (!colorSwapFunc) {
+        colorSwapFunc = selectColorSwap();
+    }
+    colorSwapFunc(dest, src, pixelCount);
+#else
+    colorSwapScalar(dest, src, pixelCount);
+#endif
+}
+
+} // namespace intel
+} // namespace android
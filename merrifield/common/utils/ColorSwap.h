@@ -0,0 +1,32 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef COLOR_SWAP_H
+#define COLOR_SWAP_H
+
+#include <stdint.h>
+
+namespace android {
+namespace intel {
+
+// Converts 32bpp RGBA to BGRA (or back) by swapping the first and third
+// byte of every pixel. Picks the widest kernel the CPU supports at runtime.
+// src and dest must not overlap.
+void colorSwapRB(uint8_t *dest, const uint8_t *src, uint32_t pixelCount);
+
+} // namespace intel
+} // namespace android
+
+#endif /* COLOR_SWAP_H */
@@ -15,17 +15,30 @@
 */
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <Dump.h>
 
 namespace android {
 namespace intel {
 
+static const char sTruncated[] = "\n... dump truncated, set hwc.dump.file to get all of it\n";
+
 Dump::Dump(char *buf, int len)
     : mBuf(buf),
-      mLen(len)
+      mLen(len),
+      mFd(-1),
+      mKeyValue(false),
+      mWritten(0),
+      mTruncated(0)
 {
-
+    mSection[0] = '\0';
+    if (mBuf && mLen > 0) {
+        mBuf[0] = '\0';
+    }
 }
 
 Dump::~Dump()
@@ -33,20 +46,134 @@ Dump::~Dump()
 
 }
 
+void Dump::setOutput(int fd)
+{
+    mFd = fd;
+}
+
+void Dump::setKeyValue(bool enabled)
+{
+    mKeyValue = enabled;
+}
+
+void Dump::section(const char *name)
+{
+    strncpy(mSection, name ? name : "", sizeof(mSection) - 1);
+    mSection[sizeof(mSection) - 1] = '\0';
+}
+
+void Dump::write(const char *text, size_t len)
+{
+    if (!len) {
+        return;
+    }
+
+    mWritten += len;
+
+    size_t done = 0;
+    while (mFd >= 0 && done < len) {
+        ssize_t ret = ::write(mFd, text + done, len - done);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // keep the buffer output, stop streaming
+            mFd = -1;
+            break;
+        }
+        done += ret;
+    }
+
+    if (mTruncated || !mBuf || mLen <= 0) {
+        mTruncated += len;
+        return;
+    }
+
+    // a record that doesn't fit is dropped whole, the note takes its place
+    size_t room = (size_t)mLen - 1;
+    size_t note = sizeof(sTruncated) - 1;
+    if (len + note > room) {
+        if (note > room) {
+            note = room;
+        }
+        memcpy(mBuf, sTruncated, note);
+        mBuf[note] = '\0';
+        mBuf += note;
+        mLen -= note;
+        mTruncated = len;
+        return;
+    }
+
+    memcpy(mBuf, text, len);
+    mBuf += len;
+    mLen -= len;
+    mBuf[0] = '\0';
+}
+
 void Dump::append(const char *fmt, ...)
 {
-    int len;
+    if (mKeyValue) {
+        return;
+    }
+
+    char line[LINE_MAX_LENGTH];
+    va_list ap;
+    va_start(ap, fmt);
+    va_list copy;
+    va_copy(copy, ap);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (len < 0) {
+        va_end(copy);
+        return;
+    }
+
+    if (len < (int)sizeof(line)) {
+        write(line, len);
+    } else {
+        char *text = (char*)malloc(len + 1);
+        if (text) {
+            vsnprintf(text, len + 1, fmt, copy);
+            write(text, len);
+            free(text);
+        }
+    }
+    va_end(copy);
+}
+
+void Dump::value(const char *key, const char *fmt, ...)
+{
+    if (!mKeyValue) {
+        return;
+    }
 
-    if (!mBuf || !mLen)
+    char line[LINE_MAX_LENGTH];
+    int len;
+    if (mSection[0]) {
+        len = snprintf(line, sizeof(line), "%s.%s=", mSection, key);
+    } else {
+        len = snprintf(line, sizeof(line), "%s=", key);
+    }
+    if (len < 0 || len >= (int)sizeof(line) - 1) {
         return;
+    }
 
     va_list ap;
     va_start(ap, fmt);
-    len = vsnprintf(mBuf, mLen, fmt, ap);
+    int ret = vsnprintf(line + len, sizeof(line) - len - 1, fmt, ap);
     va_end(ap);
+    if (ret < 0) {
+        return;
+    }
 
-    mLen -= len;
-    mBuf += len;
+    // values longer than a line are cut, keys stay intact
+    len += ret;
+    if (len > (int)sizeof(line) - 2) {
+        len = sizeof(line) - 2;
+    }
+    line[len++] = '\n';
+    write(line, len);
 }
 
 } // namespace intel
@@ -16,18 +16,52 @@
 #ifndef DUMP_H_
 #define DUMP_H_
 
+#include <stddef.h>
+
 namespace android {
 namespace intel {
 
+// Writes the dump into the caller's buffer without ever running past it.
+// Text that doesn't fit is dropped behind a truncation note, it can be
+// streamed in full to a file descriptor as well. In key/value mode only
+// value() records are written, as "section.key=value" lines for
+// collectors that parse them.
 class Dump {
 public:
+    enum {
+        // longer records are formatted on the heap
+        LINE_MAX_LENGTH = 512,
+        SECTION_MAX_LENGTH = 32,
+    };
+
     Dump(char *buf, int len);
     ~Dump();
 
+    // everything written is also copied to fd, -1 stops it
+    void setOutput(int fd);
+    void setKeyValue(bool enabled);
+    bool isKeyValue() const { return mKeyValue; }
+
+    // prefix of the following value() keys
+    void section(const char *name);
     void append(const char *fmt, ...);
+    void value(const char *key, const char *fmt, ...);
+
+    // bytes written, and bytes that didn't fit the buffer
+    size_t getLength() const { return mWritten; }
+    size_t getTruncated() const { return mTruncated; }
+
+private:
+    void write(const char *text, size_t len);
+
 private:
     char *mBuf;
     int mLen;
+    int mFd;
+    bool mKeyValue;
+    size_t mWritten;
+    size_t mTruncated;
+    char mSection[SECTION_MAX_LENGTH];
 };
 
 } // namespace intel
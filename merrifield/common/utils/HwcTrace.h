@@ -51,6 +51,80 @@ extern "C" {
 #endif
 
 
+// Systrace sections and counters of the hot paths, in the graphics tag
+// next to SurfaceFlinger. While the tag is not traced each costs a load
+// and a test, so they stay compiled in.
+#ifndef ATRACE_TAG
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+#endif
+#include <cutils/trace.h>
+
+#ifdef __cplusplus
+#include <utils/Trace.h>
+#if 1
+#define STRACE()                ATRACE_CALL()
+#define STRACE_NAME(name)       ATRACE_NAME(name)
+#define STRACE_INT(name, value) atrace_int(ATRACE_TAG, name, value)
+#else
+#define STRACE()                ((void)0)
+#define STRACE_NAME(name)       ((void)0)
+#define STRACE_INT(name, value) ((void)0)
+#endif
+#endif
+
+
+// Rate limited traces of the per-frame paths. The first occurrence at a
+// call site is logged, repeats at most once per TRACE_LIMIT_PERIOD seconds
+// with the number of them suppressed since.
+#ifdef __cplusplus
+#include <cutils/atomic.h>
+#include <utils/Timers.h>
+
+#define TRACE_LIMIT_PERIOD 5
+
+struct TraceLimit {
+    // monotonic second of the last trace plus one, 0 before the first
+    volatile int32_t last;
+    volatile int32_t suppressed;
+};
+
+// the number of suppressed traces to report if this one goes out, -1 if
+// it is suppressed as well
+static inline int32_t checkTraceLimit(TraceLimit *limit)
+{
+    int32_t now = (int32_t)(systemTime(SYSTEM_TIME_MONOTONIC) / 1000000000LL) + 1;
+    int32_t last = android_atomic_acquire_load(&limit->last);
+    // android_atomic_cmpxchg returns 0 when it swapped
+    if ((last && now - last < TRACE_LIMIT_PERIOD) ||
+        android_atomic_cmpxchg(last, now, &limit->last)) {
+        android_atomic_inc(&limit->suppressed);
+        return -1;
+    }
+
+    int32_t suppressed;
+    do {
+        suppressed = android_atomic_acquire_load(&limit->suppressed);
+    } while (android_atomic_cmpxchg(suppressed, 0, &limit->suppressed));
+    return suppressed;
+}
+
+#define LIMITED_TRACE(TRACE, fmt, ...) \
+do { \
+    static TraceLimit _limit = { 0, 0 }; \
+    int32_t _suppressed = checkTraceLimit(&_limit); \
+    if (_suppressed == 0) { \
+        TRACE(fmt, ##__VA_ARGS__); \
+    } else if (_suppressed > 0) { \
+        TRACE(fmt " (repeated %d times)", ##__VA_ARGS__, _suppressed); \
+    } \
+} while (0)
+
+#define ITRACE_LIMITED(fmt,...)     LIMITED_TRACE(ITRACE, fmt, ##__VA_ARGS__)
+#define WTRACE_LIMITED(fmt,...)     LIMITED_TRACE(WTRACE, fmt, ##__VA_ARGS__)
+#define ETRACE_LIMITED(fmt,...)     LIMITED_TRACE(ETRACE, fmt, ##__VA_ARGS__)
+#endif
+
+
 
 // Helper to abort the execution if object is not initialized.
 // This should never happen if the rules below are followed during design:
@@ -20,13 +20,50 @@
 #include <DataBuffer.h>
 #include <BufferMapper.h>
 #include <BufferCache.h>
+#include <SimpleThread.h>
+#include <MapWorkerPool.h>
+#include <utils/KeyedVector.h>
 #include <utils/Mutex.h>
+#include <utils/Condition.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
 
 namespace android {
 namespace intel {
 
+class BufferTracer;
+
+// buffer attributes decoded from a gralloc handle, the stamp tells a
+// reused handle apart from the buffer it was cached for
+struct BufferAttributes {
+    buffer_handle_t handle;
+    uint64_t stamp;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t usage;
+    stride_t stride;
+    bool isProtected;
+    bool isCompressed;
+};
+
 // Gralloc Buffer Manager
 class BufferManager {
+public:
+    // users of mappings, for the per owner accounting of the GTT budget
+    enum {
+        MAPPING_OWNER_PLANE = 0,
+        MAPPING_OWNER_LAYER,
+        MAPPING_OWNER_VIRTUAL,
+        MAPPING_OWNER_PREMAP,
+        MAPPING_OWNER_MAX,
+    };
+
+    static const char* getOwnerName(int owner);
+    // BufferMapper::PROFILE_* mapped for owner: the planes need the GTT,
+    // the layers and the virtual display only read the buffers by CPU
+    static int getOwnerProfile(int owner);
+
 public:
     BufferManager();
     virtual ~BufferManager();
@@ -38,49 +75,239 @@ public:
     // dump interface
     void dump(Dump& d);
 
-    // lockDataBuffer and unlockDataBuffer must be used in serial
-    // nested calling of them will cause a deadlock
+    // lockDataBuffer returns a DataBuffer from a small pool of reusable
+    // objects without taking a lock, so callers on different threads and
+    // nested calls don't block each other. Every locked buffer must be
+    // returned through unlockDataBuffer, see DataBufferLocker below.
     DataBuffer* lockDataBuffer(buffer_handle_t handle);
     void unlockDataBuffer(DataBuffer *buffer);
 
+    // attributes of the buffer from a handle-keyed cache, the handle is
+    // only decoded through lockDataBuffer for buffers not seen before
+    bool getBufferAttributes(buffer_handle_t handle, BufferAttributes& attributes);
+
     // get and put interfaces are deprecated
     // use lockDataBuffer and unlockDataBuffer instead
     DataBuffer* get(buffer_handle_t handle);
     void put(DataBuffer *buffer);
 
-    // map/unmap a data buffer into/from display memory
-    BufferMapper* map(DataBuffer& buffer);
-    void unmap(BufferMapper *mapper);
+    // map/unmap a data buffer into/from display memory, a mapper must be
+    // unmapped by the owner it was mapped for
+    BufferMapper* map(DataBuffer& buffer, int owner = MAPPING_OWNER_PLANE);
+    void unmap(BufferMapper *mapper, int owner = MAPPING_OWNER_PLANE);
+    // map() of a set of buffers, the buffers missing from the pool are
+    // mapped concurrently. mappers[i] is NULL if handles[i] failed; at most
+    // MAP_BATCH_MAX buffers per call, returns the number mapped.
+    size_t mapBatch(const buffer_handle_t *handles, size_t count,
+                    BufferMapper **mappers, int owner);
+
+    // the GTT mapped by all mappers exceeds the budget, caches should
+    // shrink to what is on screen
+    bool isOverBudget() const { return mOverBudget; }
+
+    // map buffers of the prepared list ahead of their first flip, so the
+    // planes find warm mappers. Called from prepare while the handles are
+    // valid; premapped buffers hold a mapper reference until
+    // releasePremapped().
+    void premap(const buffer_handle_t *handles, size_t count);
+    void releasePremapped();
 
     // frame buffer management
     //return 0 if allocation fails
     virtual buffer_handle_t allocFrameBuffer(int width, int height, int *stride);
     virtual void freeFrameBuffer(buffer_handle_t fbHandle);
 
-    buffer_handle_t allocGrallocBuffer(uint32_t width, uint32_t height, uint32_t format, uint32_t usage);
-    void freeGrallocBuffer(buffer_handle_t handle);
-    virtual bool blit(buffer_handle_t srcHandle, buffer_handle_t destHandle,
-                      const crop_t& destRect, bool filter, bool async) = 0;
+    virtual buffer_handle_t allocGrallocBuffer(uint32_t width, uint32_t height, uint32_t format, uint32_t usage);
+    virtual void freeGrallocBuffer(buffer_handle_t handle);
+
+    // one blit of a batch
+    struct BlitRequest {
+        buffer_handle_t srcHandle;
+        buffer_handle_t destHandle;
+        crop_t destRect;
+        bool filter;
+        // -1 if the source is ready
+        int acquireFenceFd;
+    };
+
+    // queue a blit of srcHandle into destRect of destHandle, started once
+    // acquireFenceFd signals. Returns a fence that signals when the blit is
+    // done, owned by the caller, or -1 on failure. acquireFenceFd is not
+    // closed.
+    virtual int blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                          const crop_t& destRect, bool filter,
+                          int acquireFenceFd = -1) = 0;
+    // queue all blits, returns a single fence for the whole batch. On
+    // failure the blits already queued are waited for and -1 is returned.
+    int blitBatch(const BlitRequest *requests, size_t count);
+    // blocking unless async is set, in which case completion is not tracked
+    bool blit(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+              const crop_t& destRect, bool filter, bool async);
 protected:
+    void invalidateBufferAttributes(buffer_handle_t handle);
     virtual DataBuffer* createDataBuffer(buffer_handle_t handle) = 0;
     virtual BufferMapper* createBufferMapper(DataBuffer& buffer) = 0;
 
     gralloc_module_t const* mGrallocModule;
 private:
+    void startWorker();
+    void stopWorker();
+    // pool hit of map(), called with mLock held
+    BufferMapper* takeMapper(DataBuffer& buffer, int owner);
+    // maps the parts of the owner profile a pooled mapper lacks, called
+    // with mLock held
+    bool upgradeMapper(BufferMapper *mapper, int owner);
+    // adds a mapped mapper to the pool, called with mLock held
+    bool addMapper(BufferMapper *mapper, int owner);
+    void cancelDeferredUnmap(BufferMapper *mapper);
+    void reclaimDeferredUnmaps();
+    void flushDeferredUnmaps();
+    // GTT bytes of the mapping, 0 for a CPU only one
+    static uint32_t getMappedBytes(BufferMapper *mapper);
+    // GTT bytes an owner references through the mapping
+    static uint32_t getOwnerBytes(BufferMapper *mapper, int owner);
+    void addMapping(BufferMapper *mapper);
+    void addMappedBytes(uint32_t bytes);
+    void removeMapping(BufferMapper *mapper);
+    void dumpMappings(Dump& d);
+    // BufferCache::forEachMapper() visitors
+    struct MapperDump {
+        Dump *d;
+        int index;
+    };
+    struct GttSpread {
+        uint64_t lowest;
+        uint64_t highest;
+        uint64_t pages;
+    };
+    static void destroyMapper(BufferMapper *mapper, void *data);
+    static void dumpMapper(BufferMapper *mapper, void *data);
+    static void addGttSpread(BufferMapper *mapper, void *data);
+
+public:
     enum {
-        // make the buffer pool large enough
-        DEFAULT_BUFFER_POOL_SIZE = 128,
+        MAP_BATCH_MAX = 16,
+    };
+
+private:
+    struct FrameBuffer {
+        buffer_handle_t fbHandle;
+        BufferMapper *mapper;
+        int width;
+        int height;
+        int stride;
+        uint64_t bytes;
+    };
+    void releaseFrameBuffer(FrameBuffer& fb);
+private:
+    enum {
+        // concurrent lockDataBuffer users (prepare, commit, blit threads
+        // and nested calls), more callers fall back to heap allocation
+        DATA_BUFFER_POOL_SIZE = 4,
+        // direct mapped by handle
+        ATTRIBUTE_CACHE_SIZE = 64,
+        // decoder buffer sets are well below this
+        PREMAP_MAX_BUFFERS = 32,
+        // in ms, how long an unreferenced mapper waits to be taken back
+        UNMAP_DELAY = 50,
+        // in ms, spacing of the worker's unmap batches
+        UNMAP_INTERVAL = 16,
+        UNMAP_BATCH = 4,
+        // in MB, overridden by hwc.gtt.budget
+        DEFAULT_MAPPING_BUDGET = 256,
+        // sub buffers of a gralloc mapper, sizes past the end read as 0
+        MAPPER_SUB_BUFFER_MAX = 3,
+        GTT_PAGE_SIZE = 4096,
+        // freed frame buffers kept around, within FRAME_BUFFER_POOL_BYTES
+        FRAME_BUFFER_POOL_SIZE = 3,
+        FRAME_BUFFER_POOL_BYTES = 48 * 1024 * 1024,
+        // threads helping mapBatch(), overridden by hwc.map.workers
+        DEFAULT_MAP_WORKERS = 2,
+        MAP_WORKERS_MAX = 4,
     };
 
     alloc_device_t *mAllocDev;
-    KeyedVector<buffer_handle_t, BufferMapper*> mFrameBuffers;
+    KeyedVector<buffer_handle_t, FrameBuffer> mFrameBuffers;
+    // freed frame buffers kept for reuse, oldest first
+    Vector<FrameBuffer> mFrameBufferPool;
+    uint64_t mFrameBufferPoolBytes;
+    uint32_t mFrameBufferReuses;
     BufferCache *mBufferPool;
-    DataBuffer *mDataBuffer;
-    Mutex mDataBufferLock;
+    DataBuffer *mDataBuffers[DATA_BUFFER_POOL_SIZE];
+    volatile int32_t mDataBufferBusy[DATA_BUFFER_POOL_SIZE];
     Mutex mLock;
+
+    // buffer attribute cache
+    BufferAttributes mAttributes[ATTRIBUTE_CACHE_SIZE];
+    uint32_t mAttributeHits;
+    uint32_t mAttributeMisses;
+    Mutex mAttributeLock;
+
+    // mappers held for the premapped buffers, protected by mWorkerLock
+    KeyedVector<uint64_t, BufferMapper*> mPremapped;
+    uint32_t mPremapCount;
+
+    // unreferenced mappers left in the pool, protected by mLock
+    struct DeferredUnmap {
+        BufferMapper *mapper;
+        nsecs_t deadline;
+    };
+    Vector<DeferredUnmap> mDeferredUnmaps;
+    bool mUnmapPending;
+    nsecs_t mLastReclaim;
+    uint32_t mUnmapCount;
+    uint32_t mResurrectCount;
+    // pooled mappers that had to map more for another owner
+    uint32_t mUpgradeCount;
+
+    // GTT budget, protected by mLock
+    uint64_t mMappingBudget;
+    uint64_t mMappedBytes;
+    uint64_t mMappedPeak;
+    int64_t mOwnerBytes[MAPPING_OWNER_MAX];
+    volatile bool mOverBudget;
+
+    // buffer lifecycle records, protected by mLock
+    BufferTracer *mTracer;
+
+    Mutex mWorkerLock;
+    Condition mWorkerCondition;
+    bool mExitThread;
+    DECLARE_THREAD(BufferWorker, BufferManager);
+
+    // NULL if mapBatch() maps on the calling thread only
+    MapWorkerPool *mMapWorkers;
+    // one batch at a time on the pool
+    Mutex mBatchLock;
+    uint32_t mBatchCount;
+    uint32_t mBatchMapped;
+
     bool mInitialized;
 };
 
+// scoped lockDataBuffer/unlockDataBuffer pair
+class DataBufferLocker {
+public:
+    DataBufferLocker(BufferManager *bm, buffer_handle_t handle)
+        : mBufferManager(bm),
+          mBuffer(bm ? bm->lockDataBuffer(handle) : NULL)
+    {
+    }
+    ~DataBufferLocker()
+    {
+        if (mBuffer)
+            mBufferManager->unlockDataBuffer(mBuffer);
+    }
+    DataBuffer* get() const { return mBuffer; }
+
+private:
+    DataBufferLocker(const DataBufferLocker&);
+    DataBufferLocker& operator=(const DataBufferLocker&);
+
+    BufferManager *mBufferManager;
+    DataBuffer *mBuffer;
+};
+
 } // namespace intel
 } // namespace android
 
@@ -22,9 +22,23 @@ namespace android {
 namespace intel {
 
 class BufferMapper : public DataBuffer {
+public:
+    // parts of a mapping a user needs, see setProfile()
+    enum {
+        // CPU addresses
+        PROFILE_CPU = 1 << 0,
+        // GTT offsets, for the planes
+        PROFILE_GTT = 1 << 1,
+        // kernel handle resolved by map() instead of getKHandle()
+        PROFILE_KHANDLE = 1 << 2,
+        PROFILE_DISPLAY = PROFILE_CPU | PROFILE_GTT,
+        PROFILE_ALL = PROFILE_DISPLAY | PROFILE_KHANDLE,
+    };
+
 public:
     BufferMapper(DataBuffer& buffer)
         : DataBuffer(buffer),
+          mProfile(PROFILE_DISPLAY),
           mRefCount(0)
     {
     }
@@ -46,6 +60,11 @@ public:
         return mRefCount;
     }
 
+    // the parts the next map() maps, a mapper may map more than asked
+    void setProfile(int profile) { mProfile = profile; }
+    // parts mapped so far, map() after a wider setProfile() maps the rest
+    virtual int getMappedProfile() const { return PROFILE_ALL; }
+
     // map the given buffer into both DC & CPU MMU
     virtual bool map() = 0;
     // unmap the give buffer from both DC & CPU MMU
@@ -58,6 +77,8 @@ public:
     virtual buffer_handle_t getKHandle(int subIndex) = 0;
     virtual buffer_handle_t getFbHandle(int subIndex) = 0;
     virtual void putFbHandle() = 0;
+protected:
+    int mProfile;
 private:
     int mRefCount;
 };
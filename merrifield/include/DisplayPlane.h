@@ -17,6 +17,8 @@
 #define DISPLAYPLANE_H_
 
 #include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+#include <Dump.h>
 #include <BufferMapper.h>
 #include <Drm.h>
 
@@ -79,46 +81,109 @@ public:
     virtual int getType() const { return mType; }
     virtual bool initCheck() const { return mInitialized; }
 
-    // data destination
-    virtual void setPosition(int x, int y, int w, int h);
-    virtual void setSourceCrop(int x, int y, int w, int h);
+    // data destination, set for every layer of every frame; no plane
+    // overrides the position, crop or alpha, they are inlined below
+    inline void setPosition(int x, int y, int w, int h);
+    inline void setSourceCrop(int x, int y, int w, int h);
     virtual void setTransform(int transform);
-    virtual void setPlaneAlpha(uint8_t alpha, uint32_t blending);
+    inline void setPlaneAlpha(uint8_t alpha, uint32_t blending);
+    // acquire fence of the layer, owned by the layer and only valid until
+    // the setDataBuffer() that follows returns
+    inline void setAcquireFence(int fenceFd) { mAcquireFence = fenceFd; }
 
     // data source
     virtual bool setDataBuffer(buffer_handle_t handle);
+    // maps the buffer ahead of setDataBuffer() and checks that the plane
+    // can show it, for protected buffers GLES can't fall back to
+    virtual bool checkDataBuffer(buffer_handle_t handle);
+    // the plane flips the buffer of the last frame again, returns false if
+    // there is none
+    virtual bool repeatLastFrame();
 
     virtual void invalidateBufferCache();
 
     // display device
     virtual bool assignToDevice(int disp);
+    // reads the mode of the assigned display again after a refresh rate
+    // switch of the same size, the buffer caches and the assignment stay
+    void updateModeInfo(int disp);
 
     // hardware operations
     virtual bool flip(void *ctx);
     virtual void postFlip();
+    // fence of the posted frame, signalled once the hardware is done with
+    // what the plane flipped; planes keeping it must dup it
+    virtual void setRetireFence(int fenceFd);
 
     virtual bool reset();
     virtual bool enable() = 0;
     virtual bool disable() = 0;
     virtual bool isDisabled() = 0;
+    // an enable queued with the frame failed when it was sent, the layer
+    // on the plane has to go to GLES. Cleared when read and on reset().
+    void setUpdateFailed() { mUpdateFailed = true; }
+    bool takeUpdateFailed();
 
     // set z order config
     virtual void setZOrderConfig(ZOrderConfig& config,
                                      void *nativeConfig) = 0;
 
     virtual void setZOrder(int zorder);
+
+    // asynchronous cursor position, only cursor planes implement it
+    virtual bool postCursorPosition(int x, int y);
+    virtual bool applyCursorPosition();
     virtual int getZOrder() const;
 
+    // video rotation resources, only planes rotating video implement them;
+    // releaseIdleRotation() returns true while some are still held
+    virtual void prewarmRotation();
+    virtual bool releaseIdleRotation(nsecs_t now, bool videoActive);
+    // memory allocated on first use, freed after the video idle time of the
+    // tuning policy; returns true while some is still held
+    virtual bool releaseIdleBuffers(nsecs_t now);
+    // allocates that memory ahead of the first use
+    virtual void prewarmBuffers();
+
     virtual void* getContext() const = 0;
 
+    // what the plane shows since its last flip, taken from the cached
+    // mapper for a capture outside the composition path
+    struct Scanout {
+        int type;
+        int device;
+        int zorder;
+        int transform;
+        buffer_handle_t handle;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        // in pixels
+        uint32_t stride;
+        crop_t crop;
+        PlanePosition position;
+    };
+    // false while the plane shows nothing or a protected buffer
+    bool getScanout(Scanout& scanout) const;
+
     virtual bool initialize(uint32_t bufferCount);
     virtual void deinitialize();
 
+    // dump interface
+    virtual void dump(Dump& d);
+
 protected:
     virtual void checkPosition(int& x, int& y, int& w, int& h);
     virtual bool setDataBuffer(BufferMapper& mapper) = 0;
+    virtual bool checkDataBuffer(BufferMapper& mapper);
+    // bookkeeping for dump, called once the enable/disable ioctl is issued
+    void recordPlaneState(bool enabled);
 private:
+    uint64_t getFetchBytes(BufferMapper& mapper) const;
     inline BufferMapper* mapBuffer(DataBuffer *buffer);
+    // cached mapper of the buffer, mapped on a miss
+    BufferMapper* getMapper(DataBuffer *buffer);
+    void evictBuffer();
 
     inline int findActiveBuffer(BufferMapper *mapper);
     void updateActiveBuffers(BufferMapper *mapper);
@@ -130,11 +195,34 @@ protected:
     int mDevice;
     bool mInitialized;
 
-    // cached data buffers
-    KeyedVector<uint64_t, BufferMapper*> mDataBuffers;
+    // cached data buffers, stamped with the cache clock on every use
+    struct CachedBuffer {
+        BufferMapper *mapper;
+        uint32_t lastUse;
+    };
+    KeyedVector<uint64_t, CachedBuffer> mDataBuffers;
     // holding the most recent buffers
     Vector<BufferMapper*> mActiveBuffers;
     int mCacheCapacity;
+    uint32_t mCacheClock;
+    uint32_t mCacheHits;
+    uint32_t mCacheMisses;
+    uint32_t mCacheEvictions;
+
+    // update statistics, reported by dump
+    struct PlaneStats {
+        uint32_t flips;
+        uint32_t updates;
+        uint32_t remaps;
+        uint32_t enables;
+        uint32_t disables;
+        nsecs_t updateTime;
+        nsecs_t maxUpdateTime;
+        // bytes scanned out per refresh by the last flipped buffer
+        uint64_t fetchBytes;
+        bool enabled;
+    };
+    PlaneStats mStats;
 
     PlanePosition mPosition;
     crop_t mSrcCrop;
@@ -142,12 +230,52 @@ protected:
     int mTransform;
     uint8_t mPlaneAlpha;
     uint32_t mBlending;
+    int mAcquireFence;
     buffer_handle_t mCurrentDataBuffer;
     uint32_t mUpdateMasks;
+    bool mUpdateFailed;
     drmModeModeInfo mModeInfo;
     int mPanelOrientation;
 };
 
+void DisplayPlane::setPosition(int x, int y, int w, int h)
+{
+    if (mPosition.x != x || mPosition.y != y ||
+        mPosition.w != w || mPosition.h != h) {
+        mUpdateMasks |= PLANE_POSITION_CHANGED;
+        mPosition.x = x;
+        mPosition.y = y;
+        mPosition.w = w;
+        mPosition.h = h;
+    }
+}
+
+void DisplayPlane::setSourceCrop(int x, int y, int w, int h)
+{
+    if (mSrcCrop.x != x || mSrcCrop.y != y ||
+        mSrcCrop.w != w || mSrcCrop.h != h) {
+        mUpdateMasks |= PLANE_SOURCE_CROP_CHANGED;
+        mSrcCrop.x = x;
+        mSrcCrop.y = y;
+        if (mType == DisplayPlane::PLANE_OVERLAY) {
+            mSrcCrop.w = w & (~0x01);
+            mSrcCrop.h = h & (~0x01);
+        } else {
+            mSrcCrop.w = w;
+            mSrcCrop.h = h;
+        }
+    }
+}
+
+void DisplayPlane::setPlaneAlpha(uint8_t alpha, uint32_t blending)
+{
+    if (mPlaneAlpha != alpha || mBlending != blending) {
+        mPlaneAlpha = alpha;
+        mBlending = blending;
+        mUpdateMasks |= PLANE_BUFFER_CHANGED;
+    }
+}
+
 } // namespace intel
 } // namespace android
 
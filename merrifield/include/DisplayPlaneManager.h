@@ -19,6 +19,7 @@
 #include <Dump.h>
 #include <DisplayPlane.h>
 #include <HwcLayer.h>
+#include <SimpleThread.h>
 #include <utils/Vector.h>
 
 namespace android {
@@ -55,6 +56,13 @@ public:
 
 
 class DisplayPlaneManager {
+public:
+    enum {
+        RESERVATION_DISPLAYS = 2,
+        // pipes with a primary and a cursor plane of their own
+        PIPE_MAX = 3,
+    };
+
 public:
     DisplayPlaneManager();
     virtual ~DisplayPlaneManager();
@@ -69,22 +77,66 @@ public:
     virtual void* getZOrderConfig() const = 0;
     virtual int getFreePlanes(int dsp, int type);
     virtual void reclaimPlane(int dsp, DisplayPlane& plane);
+    // hands the planes reclaimed so far to the reset worker, which checks
+    // they are disabled and resets them after the next vblank
     virtual void disableReclaimedPlanes();
+    void onVsync();
     virtual bool isOverlayPlanesDisabled();
+    // cursor plane of a pipe, NULL if there is none
+    DisplayPlane* getCursorPlane(int dsp);
+    // what the planes of a display show, cursor planes left out; called
+    // after the commit, returns the number of entries filled
+    int getScanout(int dsp, DisplayPlane::Scanout *scanouts, int max);
+
+    // video rotation resources of the overlay planes, called by prepare;
+    // planes handed to the reset worker are skipped
+    void prewarmRotation();
+    bool releaseIdleRotation(nsecs_t now, bool videoActive);
+    // back buffers of the overlay planes no display has used for a while
+    bool releaseIdleBuffers(nsecs_t now);
+    // called by the idle check of the display analyzer. Once the back
+    // buffers are released, every overlay is off and no VA display is left,
+    // nothing holds the overlay and VSP power islands and the kernel gates
+    // them; the mapped video buffers are dropped then.
+    void updatePowerState(nsecs_t now);
+    // restores the back buffers when a video session starts, ahead of its
+    // first overlay assignment
+    void wakeOverlays();
+    // drops the mapped video buffers of the free overlay planes once the
+    // last video session stops
+    void releaseVideoCaches();
+    // the display switched its refresh rate at the same size, the planes
+    // assigned to it update their timing and keep the rest
+    void updateModeInfo(int dsp);
+
+    // per frame reservation, planes reserved for a display are hidden from
+    // getFreePlanes() of every other display until released
+    void reservePlanes(int dsp, int type, int count);
+    void releasePlanes(int dsp);
+    void clearReservations();
     // dump interface
     virtual void dump(Dump& d);
 
 protected:
     // plane allocation & free
     int getPlane(uint32_t& mask);
+    int getReservedPlanes(int dsp, int type);
     int getPlane(uint32_t& mask, int index);
     DisplayPlane* getPlane(int type, int index);
     DisplayPlane* getAnyPlane(int type);
     void putPlane(int index, uint32_t& mask);
     void putPlane(int dsp, DisplayPlane& plane);
     bool isFreePlane(int type, int index);
+    // free and reclaimed planes of a type, planes being reset are left out
+    uint32_t getAvailablePlanes(int type);
     virtual DisplayPlane* allocPlane(int index, int type) = 0;
 
+    // primary and cursor planes are fixed to the pipe of their index
+    static bool isPipePlane(int type) {
+        return type == DisplayPlane::PLANE_PRIMARY ||
+               type == DisplayPlane::PLANE_CURSOR;
+    }
+
 protected:
     int mPlaneCount[DisplayPlane::PLANE_MAX];
     int mTotalPlaneCount;
@@ -95,12 +147,68 @@ protected:
 
     Vector<DisplayPlane*> mPlanes[DisplayPlane::PLANE_MAX];
 
-    // Bitmap of free planes. Bit0 - plane A, bit 1 - plane B, etc.
-    uint32_t mFreePlanes[DisplayPlane::PLANE_MAX];
-    uint32_t mReclaimedPlanes[DisplayPlane::PLANE_MAX];
+    // planes reserved for primary and external
+    int mReservedPlanes[RESERVATION_DISPLAYS][DisplayPlane::PLANE_MAX];
 
     bool mInitialized;
 
+private:
+    // Bitmaps of a set of planes, bit 0 - plane A, bit 1 - plane B, etc.
+    // Reclaimed planes are handed to the reset worker as pending, and are
+    // resetting while it works on them; a plane being reset is not
+    // available until it is done.
+    struct PlanePool {
+        PlanePool();
+        Mutex lock;
+        uint32_t free[DisplayPlane::PLANE_MAX];
+        uint32_t reclaimed[DisplayPlane::PLANE_MAX];
+        uint32_t pending[DisplayPlane::PLANE_MAX];
+        uint32_t resetting[DisplayPlane::PLANE_MAX];
+    };
+
+    enum {
+        // the shared pool, then one per pipe
+        POOL_SHARED = 0,
+        POOL_COUNT = PIPE_MAX + 1,
+    };
+
+    // sprites and overlays are arbitrated in the shared pool, the primary
+    // and cursor planes of a pipe are only taken by its own display
+    PlanePool& getPool(int type, int index);
+    // the bits of type that pool serves
+    uint32_t getPoolMask(int pool, int type) const;
+
+    void startResetWorker();
+    void stopResetWorker();
+    void resetPlanes(uint32_t *planes);
+    // overlay planes reclaimed, or being reset
+    uint32_t getBusyOverlayPlanes();
+
+private:
+    enum {
+        // reset anyway if no vblank is seen for this long, in ms
+        PLANE_RESET_TIMEOUT = 20,
+    };
+
+    PlanePool mPools[POOL_COUNT];
+    // protects the reset worker state, taken after a pool lock if both
+    Mutex mLock;
+    Condition mResetCondition;
+    bool mResetRequested;
+    bool mVsyncSeen;
+    bool mExitThread;
+    DECLARE_THREAD(PlaneResetThread, DisplayPlaneManager);
+
+    // overlay power state, only touched by the prepare thread
+    bool mOverlaysGated;
+    nsecs_t mGatedSince;
+    nsecs_t mGatedTime;
+    uint32_t mGates;
+    // woken ahead of a video session, or found in use by the idle check
+    uint32_t mWakes;
+    uint32_t mLateWakes;
+    nsecs_t mWakeCost;
+
 enum {
     DEFAULT_PRIMARY_PLANE_COUNT = 3
 };
@@ -32,15 +32,34 @@ public:
 public:
     virtual bool initialize();
     virtual void deinitialize();
+    virtual bool prePrepare(hwc_display_contents_1_t *display);
     virtual bool setDrmMode(drmModeModeInfo& value);
     virtual void setRefreshRate(int hz);
     virtual int  getActiveConfig();
     virtual bool setActiveConfig(int index);
     int getRefreshRate();
+    // HDMI scaling (DRM_MODE_SCALE_*) and overscan compensation (percent of
+    // the width and height) asked for by MDS, done by the panel fitter of
+    // the pipe and kept over mode sets. Returns false if the fitter can't
+    // do it, the frames then have to be composed scaled.
+    bool setScaling(int scaling);
+    bool setOverscan(int hValue, int vValue);
+    virtual void dump(Dump& d);
 
 private:
     static void HdcpLinkStatusListener(bool success, void *userData);
     void HdcpLinkStatusListener(bool success);
+    void startHdcp();
+    void stopHdcp();
+    // protected layers only go to the planes while HDCP is authenticated
+    void setProtectedOutput(bool allowed);
+    virtual bool isProtectedOutputAllowed();
+    // programs the fitter with the settings of MDS for the current mode,
+    // called with mLock held
+    bool applyPanelFitter();
+protected:
+    virtual bool initDisplayConfigs();
+    static void detectTimerExpired(int timer, void *data);
     void setDrmMode();
 protected:
     IHdcpControl *mHdcpControl;
@@ -52,8 +71,22 @@ private:
 private:
     Condition mAbortModeSettingCond;
     drmModeModeInfo mPendingDrmMode;
-    bool mHotplugEventPending;
-    int mExpectedRefreshRate;
+    volatile int32_t mProtectedOutput;
+    // set when the planes need to be assigned for a new HDCP state
+    volatile int32_t mProtectedOutputChanged;
+    // detects the display once the event loop runs
+    int mDetectTimer;
+
+    enum {
+        MAX_OVERSCAN = 10,
+    };
+    // panel fitter settings, left to the kernel until MDS sets them
+    bool mFitterSet;
+    int mScaling;
+    int mOverscanH;
+    int mOverscanV;
+    // the last settings were refused by the fitter
+    bool mFitterFailed;
 
 private:
     DECLARE_THREAD(ModeSettingThread, ExternalDevice);
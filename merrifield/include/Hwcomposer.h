@@ -29,13 +29,46 @@
 #include <VsyncManager.h>
 #include <MultiDisplayObserver.h>
 #include <UeventObserver.h>
+#include <VblankEventObserver.h>
 #include <IPlatFactory.h>
+#include <FrameTiming.h>
+#include <EventLoop.h>
+#include <PrepareWorkerPool.h>
+#include <TaskQueue.h>
+#include <FenceCloser.h>
+#include <CommitScheduler.h>
+#include <FenceTracker.h>
+#include <JankDetector.h>
+#include <InputBoost.h>
+#include <LayerTrace.h>
+#include <BandwidthEstimator.h>
+#include <Telemetry.h>
+#include <ScanoutCapture.h>
+#include <TuningPolicy.h>
 
 
 namespace android {
 namespace intel {
 
 class Hwcomposer : public hwc_composer_device_1_t {
+public:
+    // subsystems asking SurfaceFlinger for a composition
+    enum InvalidateReason {
+        INVALIDATE_OTHER = 0,
+        INVALIDATE_VIDEO,
+        INVALIDATE_BLANK,
+        INVALIDATE_INPUT,
+        INVALIDATE_IDLE,
+        INVALIDATE_PROTECTED,
+        INVALIDATE_RESUME,
+        INVALIDATE_HOTPLUG,
+        INVALIDATE_CAPTURE,
+        INVALIDATE_REASON_MAX,
+    };
+
+    // default vsync period, until the vsync model has locked on
+    static const nsecs_t DEFAULT_VSYNC_PERIOD = 16666667;
+
 public:
     virtual ~Hwcomposer();
 public:
@@ -67,7 +100,15 @@ public:
     // callbacks
     virtual void vsync(int disp, int64_t timestamp);
     virtual void hotplug(int disp, bool connected);
-    virtual void invalidate();
+    // requests arriving while one is still waiting for its prepare are
+    // coalesced with it, for at most two vsync periods
+    virtual void invalidate(int reason = INVALIDATE_OTHER);
+
+    // copy of what the planes of a physical display show, composed by VSP
+    // into target once the next commit has flipped; see ScanoutCapture
+    bool requestScanoutCapture(int disp, buffer_handle_t target,
+                               uint32_t width, uint32_t height,
+                               ScanoutCapture::Callback callback, void *data);
 
     virtual bool initCheck() const;
     virtual bool initialize();
@@ -84,6 +125,15 @@ public:
     MultiDisplayObserver* getMultiDisplayObserver();
     IDisplayDevice* getDisplayDevice(int disp);
     UeventObserver* getUeventObserver();
+    EventLoop* getEventLoop();
+    VblankEventObserver* getVblankObserver();
+    FrameTiming* getFrameTiming();
+    FenceTracker* getFenceTracker();
+    JankDetector* getJankDetector();
+    InputBoost* getInputBoost();
+    BandwidthEstimator* getBandwidthEstimator();
+    TaskQueue* getTaskQueue();
+    FenceCloser* getFenceCloser();
     IPlatFactory* getPlatFactory() {return mPlatFactory;}
 protected:
     Hwcomposer(IPlatFactory *factory);
@@ -104,6 +154,22 @@ public:
     // Need to be implemented
     static Hwcomposer* createHwcomposer();
 
+private:
+    bool prepareParallel(size_t numDisplays,
+                         hwc_display_contents_1_t** displays);
+    // list shows the buffers of source the same way, at any position
+    static bool isCloneList(hwc_display_contents_1_t *source,
+                            hwc_display_contents_1_t *list);
+    // a secondary display mirrors the primary in this frame
+    static bool hasCloneList(size_t numDisplays,
+                             hwc_display_contents_1_t** displays);
+    void reservePlanes(size_t numDisplays,
+                       hwc_display_contents_1_t** displays);
+    void applyCursorPositions();
+    void dumpInvalidates(Dump& d);
+    void trackRetireFence(size_t numDisplays,
+                          hwc_display_contents_1_t** displays,
+                          nsecs_t commitTime);
 
 private:
     hwc_procs_t const *mProcs;
@@ -115,6 +181,39 @@ private:
     DisplayAnalyzer *mDisplayAnalyzer;
     MultiDisplayObserver *mMultiDisplayObserver;
     UeventObserver *mUeventObserver;
+    // shared by the observers without a thread of their own
+    EventLoop *mEventLoop;
+    // vblank events of all displays, NULL if each one waits for its own
+    VblankEventObserver *mVblankObserver;
+    FrameTiming *mFrameTiming;
+    // NULL unless parallel prepare is enabled
+    PrepareWorkerPool *mPrepareWorkers;
+    // NULL unless deadline scheduled commit is enabled
+    CommitScheduler *mCommitScheduler;
+    FenceTracker *mFenceTracker;
+    JankDetector *mJankDetector;
+    InputBoost *mInputBoost;
+    // captures the display contents while debug.hwc.capture is set
+    LayerTrace *mLayerTrace;
+    BandwidthEstimator *mBandwidthEstimator;
+    // binary counters for a monitoring agent, off by default
+    Telemetry *mTelemetry;
+    // screenshots of the planes for monitoring, idle until requested
+    ScanoutCapture *mScanoutCapture;
+    // shared background workers, outlive the display devices
+    TaskQueue *mTaskQueue;
+    // closes the fences done with on mTaskQueue, NULL without it
+    FenceCloser *mFenceCloser;
+    // start of the last prepare, frames are tracked from there
+    nsecs_t mPrepareTime;
+
+    // an invalidate went to SurfaceFlinger and no prepare followed yet,
+    // protected by mInvalidateLock
+    Mutex mInvalidateLock;
+    bool mInvalidatePending;
+    nsecs_t mInvalidateDeadline;
+    uint32_t mInvalidateRequests[INVALIDATE_REASON_MAX];
+    uint32_t mInvalidateForwarded[INVALIDATE_REASON_MAX];
 
     // created from IPlatFactory
     DisplayPlaneManager *mPlaneManager;
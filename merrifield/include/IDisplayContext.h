@@ -35,6 +35,9 @@ public:
     virtual bool commitEnd(size_t numDisplays, hwc_display_contents_1_t **displays) = 0;
     virtual bool compositionComplete() = 0;
     virtual bool setCursorPosition(int disp, int x, int y) = 0;
+    // returns once nothing posted by the last commit still reads the plane
+    // contexts and buffers, called before prepare changes them
+    virtual void waitPosted() = 0;
 };
 
 }
@@ -17,12 +17,16 @@
 #define IDISPLAY_DEVICE_H
 
 #include <Dump.h>
+#include <utils/Timers.h>
 #include <IDisplayContext.h>
 #include <DisplayPlane.h>
 
 namespace android {
 namespace intel {
 
+struct TelemetryDisplay;
+class HwcLayerList;
+
 // display config
 class DisplayConfig {
 public:
@@ -73,6 +77,19 @@ public:
 public:
     virtual bool prePrepare(hwc_display_contents_1_t *display) = 0;
     virtual bool prepare(hwc_display_contents_1_t *display) = 0;
+
+    // prepare() split in three for parallel prepare. prepareGeometry() and
+    // prepareFinish() run serially in display order as they may allocate
+    // planes, prepareLayers() may run concurrently with other displays.
+    virtual bool prepareGeometry(hwc_display_contents_1_t *display) {
+        return true;
+    }
+    virtual bool prepareLayers(hwc_display_contents_1_t *display) {
+        return prepare(display);
+    }
+    virtual bool prepareFinish(hwc_display_contents_1_t *display) {
+        return true;
+    }
     virtual bool commit(hwc_display_contents_1_t *display,
                           IDisplayContext *context) = 0;
 
@@ -98,6 +115,26 @@ public:
     virtual void onVsync(int64_t timestamp) = 0;
     virtual void dump(Dump& d) = 0;
     virtual uint32_t getFpsDivider() = 0;
+    // predicted time of the first vblank after the given time, 0 if unknown
+    virtual nsecs_t getNextVsyncTime(nsecs_t after) {
+        return 0;
+    }
+    // measured period of the hardware vsync, 0 if unknown
+    virtual nsecs_t getVsyncPeriod() {
+        return 0;
+    }
+    // fills the counters of the telemetry record of the display, false if
+    // the device keeps none
+    virtual bool getTelemetry(TelemetryDisplay& record) {
+        return false;
+    }
+    // the next prepare shows the same layers as source, which is prepared
+    // first. NULL if the display shows its own.
+    virtual void setCloneSource(IDisplayDevice *source) {}
+    // the layer list of the last prepare, only valid on the prepare thread
+    virtual HwcLayerList* getLayerList() {
+        return NULL;
+    }
 };
 
 }
@@ -16,6 +16,8 @@
 #ifndef IHDCP_CONTROL_H
 #define IHDCP_CONTROL_H
 
+#include <Dump.h>
+
 namespace android {
 namespace intel {
 
@@ -29,6 +31,7 @@ public:
     virtual bool startHdcp() = 0;
     virtual bool startHdcpAsync(HdcpStatusCallback cb, void *userData) = 0;
     virtual bool stopHdcp() = 0;
+    virtual void dump(Dump& d) {}
 };
 
 } // namespace intel
@@ -22,6 +22,7 @@
 #include <IDisplayContext.h>
 #include <DisplayPlaneManager.h>
 #include <IVideoPayloadManager.h>
+#include <Drm.h>
 
 
 namespace android {
@@ -33,6 +34,7 @@ class IPlatFactory {
 public:
     virtual ~IPlatFactory() {};
 public:
+    virtual Drm* createDrm() = 0;
     virtual DisplayPlaneManager* createDisplayPlaneManager() = 0;
     virtual BufferManager* createBufferManager() = 0;
     virtual IDisplayDevice* createDisplayDevice(int disp) = 0;
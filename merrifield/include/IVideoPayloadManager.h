@@ -46,13 +46,17 @@ public:
         uint32_t format;
         uint32_t transform;
         int64_t  timestamp;
+        // bumped every time the record is rebuilt from the payload
+        uint32_t version;
         Buffer normalBuffer;
         Buffer scalingBuffer;
         Buffer rotationBuffer;
     };
 
 public:
-    virtual bool getMetaData(BufferMapper *mapper, MetaData *metadata) = 0;
+    // returns a view of the payload metadata, valid until the next call,
+    // or NULL if the buffer has no payload
+    virtual const MetaData* getMetaData(BufferMapper *mapper) = 0;
     virtual bool setRenderStatus(BufferMapper *mapper, bool renderStatus) = 0;
 };
 
@@ -0,0 +1,111 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef LAYER_TRACE_FORMAT_H
+#define LAYER_TRACE_FORMAT_H
+
+#include <stdint.h>
+
+namespace android {
+namespace intel {
+
+// Records of a layer trace written by LayerTrace and read by the replay
+// tool in test/. A trace is a TraceFileHeader followed by records, each a
+// TraceRecordHeader and a payload of TraceRecordHeader::size bytes. All
+// fields are host endian, 64 bit fields come first to keep the layout the
+// same on 32 and 64 bit builds.
+enum {
+    LAYER_TRACE_MAGIC = 0x54435748, // "HWCT"
+    LAYER_TRACE_VERSION = 1,
+};
+
+enum {
+    // first use of a buffer: TraceBuffer
+    TRACE_RECORD_BUFFER = 1,
+    // input of prepare: TraceFrame, then for each display a TraceDisplay
+    // followed by its TraceLayers
+    TRACE_RECORD_FRAME,
+    // output of prepare: TraceResult, then for each display the layer
+    // count and the composition type of each layer, all uint32_t
+    TRACE_RECORD_RESULT,
+    // TraceCommit
+    TRACE_RECORD_COMMIT,
+};
+
+struct TraceFileHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct TraceRecordHeader {
+    uint32_t type;
+    uint32_t size;
+};
+
+struct TraceBuffer {
+    // 0 is no buffer, ids are not reused within a trace
+    uint32_t id;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t usage;
+    uint32_t isProtected;
+    uint32_t isCompressed;
+};
+
+struct TraceFrame {
+    // monotonic time at the start of prepare
+    int64_t timestamp;
+    uint32_t frame;
+    uint32_t numDisplays;
+};
+
+struct TraceDisplay {
+    // 0 for a null display, no layers follow
+    uint32_t present;
+    uint32_t flags;
+    uint32_t numLayers;
+};
+
+struct TraceLayer {
+    uint32_t compositionType;
+    uint32_t hints;
+    uint32_t flags;
+    uint32_t bufferId;
+    uint32_t transform;
+    uint32_t blending;
+    float sourceCrop[4];
+    int32_t displayFrame[4];
+    uint32_t planeAlpha;
+    uint32_t visibleRects;
+    uint32_t hasAcquireFence;
+};
+
+struct TraceResult {
+    int64_t prepareTime;
+    uint32_t frame;
+    uint32_t numDisplays;
+};
+
+struct TraceCommit {
+    int64_t commitTime;
+    uint32_t frame;
+    uint32_t numDisplays;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* LAYER_TRACE_FORMAT_H */
@@ -23,6 +23,7 @@
 #include <VsyncEventObserver.h>
 #include <HwcLayerList.h>
 #include <Drm.h>
+#include <FpsMeter.h>
 #include <IDisplayDevice.h>
 
 namespace android {
@@ -49,6 +50,9 @@ public:
 public:
     virtual bool prePrepare(hwc_display_contents_1_t *display);
     virtual bool prepare(hwc_display_contents_1_t *display);
+    virtual bool prepareGeometry(hwc_display_contents_1_t *display);
+    virtual bool prepareLayers(hwc_display_contents_1_t *display);
+    virtual bool prepareFinish(hwc_display_contents_1_t *display);
     virtual bool commit(hwc_display_contents_1_t *display, IDisplayContext *context);
 
     virtual bool vsyncControl(bool enabled);
@@ -77,6 +81,11 @@ public:
     virtual const char* getName() const;
     virtual int getType() const;
     virtual uint32_t getFpsDivider();
+    virtual nsecs_t getNextVsyncTime(nsecs_t after);
+    virtual nsecs_t getVsyncPeriod();
+    virtual bool getTelemetry(TelemetryDisplay& record);
+    virtual void setCloneSource(IDisplayDevice *source);
+    virtual HwcLayerList* getLayerList();
 
     //events
     virtual void onVsync(int64_t timestamp);
@@ -85,10 +94,66 @@ public:
 
 protected:
     void onGeometryChanged(hwc_display_contents_1_t *list);
+    // display configs at initialize(), a device may detect them later
+    virtual bool initDisplayConfigs() { return detectDisplayConfigs(); }
+    // whether protected layers may be scanned out, checked for each new
+    // layer list
+    virtual bool isProtectedOutputAllowed() { return true; }
     bool updateDisplayConfigs();
+    // attribute queries are answered from a record published by
+    // updateDisplayConfigs(), without taking mLock
+    void publishAttributes();
+    // the layer list survives blank if no other display competes for planes
+    bool keepPlanesWhileBlank();
+    void onUnblank();
+    // programs the gamma LUT of the panel calibration on the pipe
+    void applyCalibration();
+    // list of the clone source, if set for this prepare
+    HwcLayerList* getCloneList();
+    // counts a frame that damaged only part of the screen
+    void countDamage(hwc_display_contents_1_t *display);
+    // raises the vsync divider to hold the display to the frame cap of the
+    // tuning policy, called with the updated list
+    void updateFrameCap();
+    // queues the refresh rate of a config of the active size, called with
+    // mLock held. The commit of the next frame makes the switch, the
+    // layer list and the planes are kept.
+    virtual bool switchRefreshRate(int hz);
+    // after the refresh rate changed at the same size: resets the vsync
+    // model, the planes update their mode on the next prepare
+    void onRefreshChanged();
     IVsyncControl* createVsyncControl() {return mControlFactory->createVsyncControl();}
     friend class VsyncEventObserver;
 
+private:
+    enum {
+        MAX_PUBLISHED_CONFIGS = 16,
+        ATTRIBUTE_READ_RETRIES = 4,
+    };
+
+    struct ConfigAttributes {
+        int32_t vsyncPeriod;
+        int32_t width;
+        int32_t height;
+        int32_t dpiX;
+        int32_t dpiY;
+    };
+
+    struct DisplayAttributes {
+        DisplayAttributes()
+            : connected(false), count(0), truncated(false), width(0), height(0) {}
+        // mConnected, read with the configs instead of without the lock
+        bool connected;
+        uint32_t count;
+        // more configs than published, the count comes from mDisplayConfigs
+        bool truncated;
+        int32_t width;
+        int32_t height;
+        ConfigAttributes configs[MAX_PUBLISHED_CONFIGS];
+    };
+
+    bool readAttributes(DisplayAttributes& attributes) const;
+
 protected:
     uint32_t mType;
     const char *mName;
@@ -107,8 +172,41 @@ protected:
 
     // layer list
     HwcLayerList *mLayerList;
+    PlaneAssignmentCache mPlaneAssignmentCache;
+    CompositionLog mCompositionLog;
+    BlitComposer mBlitComposer;
     bool mConnected;
     bool mBlank;
+    // HWC_POWER_MODE_OFF was set
+    bool mPowerOff;
+    // set by onUnblank(), consumed by the next prePrepare()
+    bool mResumePending;
+    uint32_t mUnblankResumes;
+    // idle frames, left to the panel self-refresh, and frames that only
+    // damaged part of the screen
+    uint32_t mSelfRefreshFrames;
+    uint32_t mPartialFrames;
+    // summed damage of the partial frames, in 1/100 of the screen
+    uint64_t mPartialDamage;
+    // rate of the frames that updated the layer list
+    FpsMeter mFrameRate;
+    // display mirrored by the next prepare
+    IDisplayDevice *mCloneSource;
+    uint32_t mCloneFrames;
+    // time spent in the phases of a parallel prepare so far, recorded as
+    // one device prepare by prepareFinish()
+    nsecs_t mPrepareTime;
+    // set by onRefreshChanged(), consumed by the next prePrepare()
+    volatile int32_t mModeInfoChanged;
+    uint32_t mRefreshSwitches;
+    // a switch is queued in Drm, the mode is kept for the sink if it was
+    // a config the user picked
+    bool mRefreshQueued;
+    bool mRememberRefresh;
+
+    // sequence lock of mAttributes, odd while it is written
+    volatile int32_t mAttributeSeq;
+    DisplayAttributes mAttributes;
 
     // lock
     Mutex mLock;
@@ -117,6 +215,11 @@ protected:
     int mDisplayState;
     bool mInitialized;
     uint32_t mFpsDivider;
+    // extra divider of the frame cap, read by the vsync thread
+    volatile int32_t mCapDivider;
+    // frames prepared under the cap, and with the cap lifted for video
+    uint32_t mCappedFrames;
+    uint32_t mCapLiftedFrames;
 };
 
 
@@ -36,9 +36,31 @@ public:
     virtual void deinitialize();
 
     bool blank(bool blank);
+    // drops the panel to its idle refresh rate, or back to the full one,
+    // with the commit of the frame being prepared
+    void setIdleRefresh(bool idle);
+    virtual void dump(Dump& d);
+
+protected:
+    virtual bool switchRefreshRate(int hz);
+
 private:
     static void repeatedFrameEventListener(void *data);
     void repeatedFrameListener();
+    int findIdleRefreshRate();
+
+private:
+    enum {
+        // lowest idle rate unless hwc.primary.idle_refresh says otherwise
+        IDLE_REFRESH_MIN = 30,
+    };
+
+    bool mIdleRefreshEnabled;
+    int mIdleRefreshMin;
+    bool mIdleRefresh;
+    int mIdleRefreshRate;
+    int mFullRefreshRate;
+    uint32_t mIdleRefreshEntries;
 };
 
 }
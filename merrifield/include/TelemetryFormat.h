@@ -0,0 +1,98 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef TELEMETRY_FORMAT_H
+#define TELEMETRY_FORMAT_H
+
+#include <stdint.h>
+
+namespace android {
+namespace intel {
+
+// Layout of the telemetry region published by Telemetry. The region is a
+// TelemetryHeader, a TelemetrySystem and TELEMETRY_DISPLAY_COUNT
+// TelemetryDisplay records, TelemetryHeader::size bytes in all. A reader
+// maps the file read only and copies the records between two reads of
+// TelemetryHeader::seq; the copy is consistent if seq was even and did not
+// change. All fields are host endian, 64 bit fields come first to keep the
+// layout the same on 32 and 64 bit builds. Fields are only appended, a
+// reader accepts any version at least the one it knows.
+enum {
+    TELEMETRY_MAGIC = 0x4d435748, // "HWCM"
+    TELEMETRY_VERSION = 1,
+};
+
+enum {
+    // in the order of the FrameTiming stages: prepare, commit, device
+    // prepare, layer list update, commit end
+    TELEMETRY_STAGE_COUNT = 5,
+    // p50, p90 and p99 of the recent samples of a stage
+    TELEMETRY_PERCENTILE_COUNT = 3,
+    // in the order of the MemoryAccounting categories, spare ones are 0
+    TELEMETRY_MEMORY_COUNT = 8,
+    // sprite, overlay, primary and cursor planes
+    TELEMETRY_PLANE_COUNT = 4,
+    // primary, external and virtual
+    TELEMETRY_DISPLAY_COUNT = 3,
+};
+
+struct TelemetryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    // odd while the records are written
+    volatile int32_t seq;
+    // monotonic time of the last update
+    int64_t timestamp;
+    uint32_t updates;
+    uint32_t reserved;
+};
+
+struct TelemetrySystem {
+    // nanoseconds, 0 if no sample was recorded
+    int64_t stageTimes[TELEMETRY_STAGE_COUNT][TELEMETRY_PERCENTILE_COUNT];
+    // estimated memory fetch of scan out and GLES composition, bytes/s
+    uint64_t bandwidth;
+    // bytes
+    uint64_t memoryCurrent[TELEMETRY_MEMORY_COUNT];
+    uint64_t memoryPeak[TELEMETRY_MEMORY_COUNT];
+    uint32_t missedVblanks;
+    uint32_t jankyWindows;
+    uint32_t jankFallbacks;
+    // JankDetector policies in effect
+    uint32_t jankPolicies;
+};
+
+struct TelemetryDisplay {
+    // nanoseconds, only the device prepare and layer list update stages
+    // are timed per display
+    int64_t stageTimes[TELEMETRY_STAGE_COUNT][TELEMETRY_PERCENTILE_COUNT];
+    // 0 for a disconnected display, the other fields are then 0 too
+    uint32_t connected;
+    // frames per second in tenths, frames that updated the layer list
+    uint32_t fps10;
+    uint32_t frames;
+    // layers scanned out by each plane type in the last frame
+    uint32_t planeLayers[TELEMETRY_PLANE_COUNT];
+    // layers composed by GLES in the last frame
+    uint32_t frameBufferLayers;
+    uint32_t assignmentCacheHits;
+    uint32_t assignmentCacheMisses;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* TELEMETRY_FORMAT_H */
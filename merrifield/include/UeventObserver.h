@@ -16,13 +16,14 @@
 #ifndef UEVENT_OBSERVER_H
 #define UEVENT_OBSERVER_H
 
-#include <utils/KeyedVector.h>
 #include <utils/String8.h>
-#include <SimpleThread.h>
+#include <utils/Vector.h>
 
 namespace android {
 namespace intel {
 
+class EventLoop;
+
 typedef void (*UeventListenerFunc)(void *data);
 
 class UeventObserver
@@ -32,14 +33,23 @@ public:
     virtual ~UeventObserver();
 
 public:
-    bool initialize();
+    bool initialize(EventLoop *loop);
     void deinitialize();
+    // uevents are read on the event loop from here on
     void start();
+    // an event may have several listeners, all are called in the order
+    // they registered
     void registerListener(const char *event, UeventListenerFunc func, void *data);
+    // calls the listeners of event as if it had been received, on the
+    // event loop thread only. Used by the mock platform to inject hotplugs.
+    void notify(const char *event);
 
 private:
-    DECLARE_THREAD(UeventObserverThread, UeventObserver);
+    static void ueventReadable(int fd, uint32_t events, void *data);
+    static uint32_t hash(const char *str, size_t *length);
     void onUevent();
+    // calls the listeners of event, returns its length
+    size_t dispatch(const char *event);
 
 private:
     enum {
@@ -48,13 +58,18 @@ private:
 
     char mUeventMessage[UEVENT_MSG_LEN];
     int mUeventFd;
-    int mExitRDFd;
-    int mExitWDFd;
+    EventLoop *mEventLoop;
+    bool mStarted;
+    // matched on the hash and length of each token of a message, the
+    // string is only compared on a hit
     struct UeventListener {
+        uint32_t hash;
+        size_t length;
+        String8 event;
         UeventListenerFunc func;
         void *data;
     };
-    KeyedVector<String8, UeventListener*> mListeners;
+    Vector<UeventListener> mListeners;
 };
 
 } // namespace intel
@@ -18,11 +18,14 @@
 
 #include <IDisplayDevice.h>
 #include <SimpleThread.h>
+#include <SpscRing.h>
+#include <FrameDumper.h>
 #include <IVideoPayloadManager.h>
 #include <utils/Condition.h>
 #include <utils/Mutex.h>
 #include <utils/Vector.h>
 #include <utils/List.h>
+#include <utils/Timers.h>
 #ifdef INTEL_WIDI
 #include "IFrameServer.h"
 #endif
@@ -52,6 +55,25 @@ protected:
         BufferMapper *mapper;
         VAMappedHandle *vaMappedHandle;
         buffer_handle_t cachedKhandle;
+        // gralloc allocation stamp, tells a reused handle from the original
+        uint64_t stamp;
+        uint32_t lastUsed;
+    };
+    struct VaMapEntry {
+        buffer_handle_t handle;
+        uint64_t stamp;
+        uint32_t stride;
+        uint32_t height;
+        unsigned int format;
+        android::sp<VAMappedHandleObject> mapping;
+    };
+    struct VspContext {
+        uint32_t width;
+        uint32_t height;
+        VAContextID context;
+        VASurfaceID blankYuv;
+        VASurfaceID blankRgb;
+        uint32_t bytes;
     };
     struct HeldDecoderBuffer : public android::RefBase {
         HeldDecoderBuffer(const sp<VirtualDevice>& vd, const android::sp<CachedBuffer>& cachedBuffer);
@@ -70,22 +92,41 @@ protected:
         bool forceNotifyBufferInfo;
     };
 #endif
+    // Pool of gralloc buffers that may hold several resolutions at once,
+    // up to mLimit buffers in total. Idle buffers are freed after the video
+    // idle time of the tuning policy, least recently used first.
     class BufferList {
     public:
         BufferList(VirtualDevice& vd, const char* name, uint32_t limit, uint32_t format, uint32_t usage);
-        buffer_handle_t get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer);
+        // allowLarger lets a bigger idle buffer serve the request, the
+        // caller must then only touch the requested sub-rectangle
+        buffer_handle_t get(uint32_t width, uint32_t height, sp<RefBase>* heldBuffer,
+                            bool allowLarger = false);
+        void trim(nsecs_t now);
         void clear();
+        // bumped whenever a buffer enters or leaves the list, a sink
+        // importing the handles once has to import them again
+        uint32_t getRingGeneration() const { return mRingGeneration; }
     private:
         struct HeldBuffer;
+        struct Buffer {
+            buffer_handle_t handle;
+            uint32_t width;
+            uint32_t height;
+            nsecs_t lastUsed;
+        };
+        void freeBuffer(const Buffer& buffer);
+        size_t getBytes(uint32_t width, uint32_t height) const;
         VirtualDevice& mVd;
         const char* mName;
-        android::List<buffer_handle_t> mAvailableBuffers;
+        // most recently returned buffer at the front
+        android::List<Buffer> mAvailableBuffers;
         const uint32_t mLimit;
         const uint32_t mFormat;
         const uint32_t mUsage;
-        uint32_t mBuffersToCreate;
-        uint32_t mWidth;
-        uint32_t mHeight;
+        uint32_t mAllocated;
+        uint32_t mGeneration;
+        uint32_t mRingGeneration;
     };
     struct Task;
     struct RenderTask;
@@ -104,6 +145,9 @@ protected:
 #endif
     ssize_t mRgbLayer;
     ssize_t mYuvLayer;
+    // a video is streamed in this frame, composed or in extended mode;
+    // mYuvLayer is cleared once extended mode took the video
+    bool mVideoActive;
     bool mProtectedMode;
 
     buffer_handle_t mExtLastKhandle;
@@ -114,10 +158,44 @@ protected:
     Mutex mTaskLock; // for task queue and buffer lists
     BufferList mCscBuffers;
     BufferList mRgbUpscaleBuffers;
+    // Task rings are filled by the prepare/commit thread only and drained
+    // by their own thread only. mRequestDequeued is still signaled after
+    // each task, under mTaskLock, for the rare waits on buffer return or
+    // render completion.
+    enum {
+        TASK_RING_SIZE = 32,
+    };
+    typedef SpscRing< sp<Task>, TASK_RING_SIZE > TaskRing;
+    bool pushTask(TaskRing& ring, const sp<Task>& task);
+    bool queueFrameReady(const sp<OnFrameReadyTask>& task);
+    // holds the render back while the sink has a full window in flight
+    void waitForSink();
+    bool isSinkBehind();
+    // VSP upscaling fits the frame budget of the sink's refresh rate
+    bool isUpscaleAffordable();
+
+    // render queue: VSP enable/disable, compose and blit tasks, in order
     DECLARE_THREAD(WidiBlitThread, VirtualDevice);
-    Condition mRequestQueued;
     Condition mRequestDequeued;
-    Vector< sp<Task> > mTasks;
+    TaskRing mTasks;
+
+    // worker queue: listener notifications and frame ready bookkeeping
+    class WidiWorkerThread : public Thread {
+    public:
+        WidiWorkerThread(VirtualDevice *owner) { mOwner = owner; }
+    private:
+        virtual status_t readyToRun() {
+            ThreadPolicy::apply("WidiWorker");
+            return NO_ERROR;
+        }
+        virtual bool threadLoop() { return mOwner->workerThreadLoop(); }
+    private:
+        VirtualDevice *mOwner;
+    };
+    friend class WidiWorkerThread;
+    bool workerThreadLoop();
+    sp<WidiWorkerThread> mWorkerThread;
+    TaskRing mWorkerTasks;
 
     // fence info
     int mSyncTimelineFd;
@@ -126,12 +204,35 @@ protected:
 #ifdef INTEL_WIDI
     FrameInfo mLastInputFrameInfo;
     FrameInfo mLastOutputFrameInfo;
+
+    // inputs of the last frame sent to the frame server, to skip
+    // frames that have no damage at all
+    buffer_handle_t mLastSentRgbHandle;
+    buffer_handle_t mLastSentVideoKhandle;
+    int64_t mLastSentVideoTimestamp;
+    uint32_t mLastSentWidth;
+    uint32_t mLastSentHeight;
+    nsecs_t mLastSentTime;
+    // CSC buffer set last announced by bufferInfoChanged()
+    uint32_t mLastRingGeneration;
 #endif
     int32_t mVideoFramerate;
 
     android::KeyedVector<buffer_handle_t, android::sp<CachedBuffer> > mMappedBufferCache;
+    uint32_t mMappedBufferClock;
     android::Mutex mHeldBuffersLock;
     android::KeyedVector<buffer_handle_t, android::sp<android::RefBase> > mHeldBuffers;
+    // in-flight window of the sink, guarded by mHeldBuffersLock: when
+    // each held buffer was delivered, and the latency of its return
+    android::KeyedVector<buffer_handle_t, nsecs_t> mHeldSince;
+    android::Condition mHeldBuffersReturned;
+    nsecs_t mSinkLatency;
+    uint32_t mMaxInFlight;
+    // frames the sink may hold, two less than the CSC buffers
+    uint32_t mInFlightWindow;
+    volatile int32_t mDroppedFrames;
+    // OnFrameReadyTasks queued and not yet run
+    volatile int32_t mPendingFrames;
 
     // VSP
     bool mVspInUse;
@@ -143,15 +244,60 @@ protected:
     VAContextID va_context;
     VASurfaceID va_blank_yuv_in;
     VASurfaceID va_blank_rgb_in;
-    android::KeyedVector<buffer_handle_t, android::sp<VAMappedHandleObject> > mVaMapCache;
+    // reported to the memory accounting while the blank surfaces exist
+    uint32_t mVspSurfaceBytes;
+    // contexts and blank surfaces by aligned size, WidiBlit thread only,
+    // most recently used first. The first one is also in va_context.
+    enum {
+        VSP_CONTEXT_CACHE = 3,
+    };
+    android::Vector<VspContext> mVspContexts;
+    // RGB input mappings, WidiBlit thread only, most recently used first.
+    // Entries outlive VSP resolution switches, only vspDisable() drops them.
+    android::Vector<VaMapEntry> mVaMapCache;
 
     bool mVspUpscale;
+    // average cost of an upscaled compose, written by the WidiBlit thread
+    volatile int32_t mUpscaleCostUs;
+    nsecs_t mUpscaleBackoffUntil;
+    uint32_t mUpscaleSkips;
+    // 90/270 video in extended mode, from the decoder's rotated buffer
+    bool mExtRotation;
     bool mDebugVspClear;
-    bool mDebugVspDump;
-    uint32_t mDebugCounter;
+    FrameDumper mFrameDumper;
+
+    // cost of the stages of a WiDi frame, shown by dump(). Each stage is
+    // only written by the thread that runs it.
+    enum {
+        STAGE_MAP = 0,      // VA surfaces of a compose
+        STAGE_FENCE_WAIT,   // acquire fences of a compose
+        STAGE_COMPOSE,      // vspCompose()
+        STAGE_RENDER_CPU,   // CPU time of the WidiBlit thread per compose
+        STAGE_NOTIFY,       // onFrameReady() to the sink
+        STAGE_QUEUE,        // prepare to the start of the render
+        STAGE_DELIVER,      // end of the render to onFrameReady()
+        STAGE_HWC,          // prepare to onFrameReady() returning
+        STAGE_SINK,         // onFrameReady() to notifyBufferReturned(),
+                            // written under mHeldBuffersLock
+        STAGE_COUNT,
+    };
+    // upper bounds of the histogram buckets in ms, the last one is open
+    enum {
+        HISTOGRAM_BUCKETS = 8,
+    };
+    struct StageStats {
+        uint32_t count;
+        nsecs_t total;
+        nsecs_t max;
+        uint32_t buckets[HISTOGRAM_BUCKETS];
+    };
+    StageStats mStageStats[STAGE_COUNT];
+    void addStageTime(int stage, nsecs_t time);
 
 private:
     android::sp<CachedBuffer> getMappedBuffer(buffer_handle_t handle);
+    android::sp<VAMappedHandleObject> getVaMapping(buffer_handle_t handle, uint32_t stride,
+                                                   uint32_t height, unsigned int format);
 
     bool sendToWidi(hwc_display_contents_1_t *display);
     bool queueCompose(hwc_display_contents_1_t *display);
@@ -160,17 +306,26 @@ private:
     bool handleExtendedMode(hwc_display_contents_1_t *display);
 
     void queueFrameTypeInfo(const FrameInfo& inputFrameInfo);
+    bool isUndamagedFrame(hwc_display_contents_1_t *display, const hwc_layer_1_t *rgbLayer,
+                          buffer_handle_t videoKhandle, int64_t videoTimestamp,
+                          uint32_t width, uint32_t height);
     void queueBufferInfo(const FrameInfo& outputFrameInfo);
 #endif
     void colorSwap(buffer_handle_t src, buffer_handle_t dest, uint32_t pixelCount);
     void vspPrepare(uint32_t width, uint32_t height);
     void vspEnable(uint32_t width, uint32_t height);
     void vspDisable();
+    void vspDestroyContext(const VspContext& ctx);
     void vspCompose(VASurfaceID videoIn, VASurfaceID rgbIn, VASurfaceID videoOut,
                     const VARectangle* surface_region, const VARectangle* output_region);
 
     bool getFrameOfSize(uint32_t width, uint32_t height, const IVideoPayloadManager::MetaData& metadata, IVideoPayloadManager::Buffer& info);
     void setMaxDecodeResolution(uint32_t width, uint32_t height);
+    void updateCadence(int64_t mediaTimestamp);
+    // content frame rate from the payload timestamps, false until a full
+    // window of frames is measured
+    bool updateContentRate(int64_t mediaTimestamp);
+    void resetCadence();
 
 public:
     VirtualDevice(Hwcomposer& hwc);
@@ -226,6 +381,28 @@ protected:
     uint32_t mDecHeight;
     bool mIsForceCloneMode;
     uint32_t mFpsDivider;
+
+    // video content cadence, raises getFpsDivider() while video plays
+    nsecs_t mLastVideoUpdate;
+    int64_t mLastVideoTimestamp;
+    nsecs_t mVideoInterval;
+    uint32_t mCandidateFps;
+    uint32_t mCandidateCount;
+    volatile int32_t mCadenceFps;
+
+    // content frame rate, from the media timestamps of the last frames
+    enum {
+        CONTENT_RATE_WINDOW = 16,
+    };
+    int64_t mRateTimestamps[CONTENT_RATE_WINDOW];
+    uint32_t mRateCount;
+    uint32_t mRateHead;
+    int32_t mContentRateN;
+    int32_t mContentRateD;
+
+    // clone mode frames, and those sent without SurfaceFlinger's GLES
+    uint32_t mPreparedFrames;
+    uint32_t mBypassFrames;
 };
 
 }
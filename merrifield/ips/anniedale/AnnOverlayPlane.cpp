@@ -33,7 +33,8 @@ AnnOverlayPlane::AnnOverlayPlane(int index, int disp)
       mRotationBufProvider(NULL),
       mRotationConfig(0),
       mZOrderConfig(0),
-      mUseOverlayRotation(true)
+      mUseOverlayRotation(true),
+      mRotationPredictor()
 {
     CTRACE();
 
@@ -86,6 +87,7 @@ bool AnnOverlayPlane::enable()
 
     // by default always use overlay rotation
     mUseOverlayRotation = true;
+    mRotationPredictor.reset();
 
     if (mContext.ctx.ov_ctx.ovadd & (0x1 << 15))
         return true;
@@ -570,6 +572,12 @@ bool AnnOverlayPlane::flip(void *ctx)
         return false;
     }
 
+    // wait for the rotated buffer queued in setDataBuffer
+    if (mRotationBufProvider && !mRotationBufProvider->syncRotationBuffer()) {
+        ETRACE("failed to wait for rotation buffer");
+        return false;
+    }
+
     // update back buffer address
     ovadd = (mBackBuffer[mCurrent]->gttOffsetInPage << 12);
 
@@ -597,7 +605,7 @@ bool AnnOverlayPlane::flip(void *ctx)
     mContext.ctx.ov_ctx.ovadd |= mPipeConfig;
 
     // move to next back buffer
-    mCurrent = (mCurrent + 1) % OVERLAY_BACK_BUFFER_COUNT;
+    flipBackBuffer();
 
     VTRACE("ovadd = %#x, index = %d, device = %d",
           mContext.ctx.ov_ctx.ovadd,
@@ -619,6 +627,11 @@ bool AnnOverlayPlane::setDataBuffer(BufferMapper& mapper)
         return false;
     }
 
+    // the back buffer on screen is flipped again as it is
+    if (mFrameRepeated) {
+        return true;
+    }
+
     signalVideoRotation(mapper);
 
     if (mIsProtectedBuffer) {
@@ -654,6 +667,11 @@ void AnnOverlayPlane::deinitialize()
     OverlayPlaneBase::deinitialize();
 }
 
+bool AnnOverlayPlane::isDeinterlaceSupported()
+{
+    return mRotationBufProvider && mRotationBufProvider->isDeinterlaceSupported();
+}
+
 bool AnnOverlayPlane::rotatedBufferReady(BufferMapper& mapper, BufferMapper* &rotatedMapper)
 {
     struct VideoPayloadBuffer *payload;
@@ -686,6 +704,11 @@ bool AnnOverlayPlane::rotatedBufferReady(BufferMapper& mapper, BufferMapper* &ro
         }
     }
 
+    // the rotated buffer holds progressive frames, no field mode
+    if (mBobDeinterlace && mRotationBufProvider->isDeinterlaced()) {
+        mBobDeinterlace = 0;
+    }
+
     rotatedMapper = getTTMMapper(mapper, payload);
     return true;
 }
@@ -730,7 +753,15 @@ bool AnnOverlayPlane::useOverlayRotation(BufferMapper& mapper)
     if (mTransform == 0)
         return true;
 
+    // a converted copy is rotated already
+    if (mUseConvertedBuffer) {
+        mUseOverlayRotation = false;
+        mRotationConfig = 0;
+        return false;
+    }
+
     if (!isSettingRotBitAllowed()) {
+        mRotationPredictor.predict(false, systemTime());
         mUseOverlayRotation = false;
         mRotationConfig = 0;
         return false;
@@ -772,7 +803,10 @@ bool AnnOverlayPlane::useOverlayRotation(BufferMapper& mapper)
         fallback = true;
     }
 
-    if (fallback || mBobDeinterlace) {
+    // overlay rotation is only taken back once it stays supported, the
+    // decoder is not asked to stop and restart rotation on every frame
+    bool supported = !fallback && !mBobDeinterlace;
+    if (!mRotationPredictor.predict(supported, systemTime())) {
         mUseOverlayRotation = false;
         mRotationConfig = 0;
     } else {
@@ -781,6 +815,32 @@ bool AnnOverlayPlane::useOverlayRotation(BufferMapper& mapper)
     return mUseOverlayRotation;
 }
 
+bool AnnOverlayPlane::isOverlayRotationUsed() const
+{
+    return mUseOverlayRotation;
+}
+
+void AnnOverlayPlane::prewarmRotation()
+{
+    if (mRotationBufProvider) {
+        mRotationBufProvider->prewarm();
+    }
+}
+
+bool AnnOverlayPlane::releaseIdleRotation(nsecs_t now, bool videoActive)
+{
+    if (!mRotationBufProvider) {
+        return false;
+    }
+    return mRotationBufProvider->releaseIdle(now, videoActive);
+}
+
+void AnnOverlayPlane::dump(Dump& d)
+{
+    OverlayPlaneBase::dump(d);
+    mRotationPredictor.dump(d);
+}
+
 bool AnnOverlayPlane::scaledBufferReady(BufferMapper& mapper, BufferMapper* &scaledMapper, VideoPayloadBuffer *payload)
 {
     mUseScaledBuffer = (payload->scaling_khandle != 0);
@@ -819,13 +879,14 @@ bool AnnOverlayPlane::flush(uint32_t flags)
         DTRACE("disabling overlay %d on device %d", mIndex, mDevice);
     }
 
-    // issue ioctl
+    // issue ioctl, batched with the frame if prepare is running
     Drm *drm = Hwcomposer::getInstance().getDrm();
-    bool ret = drm->writeReadIoctl(DRM_PSB_REGISTER_RW, &arg, sizeof(arg));
+    bool ret = drm->updatePlane(arg, this);
     if (ret == false) {
         WTRACE("overlay update failed with error code %d", ret);
         return false;
     }
+    recordPlaneState(arg.plane_enable_mask != 0);
 
     return true;
 }
@@ -23,6 +23,7 @@
 #include <common/Wsbm.h>
 #include <common/OverlayPlaneBase.h>
 #include <common/RotationBufferProvider.h>
+#include <common/RotationModePredictor.h>
 
 namespace android {
 namespace intel {
@@ -45,9 +46,16 @@ public:
     virtual bool initialize(uint32_t bufferCount);
     virtual void deinitialize();
     virtual bool rotatedBufferReady(BufferMapper& mapper, BufferMapper* &rotatedMapper);
+    virtual bool isDeinterlaceSupported();
     virtual bool useOverlayRotation(BufferMapper& mapper);
+    virtual bool isOverlayRotationUsed() const;
     virtual bool scaledBufferReady(BufferMapper& mapper, BufferMapper* &scaledMapper, VideoPayloadBuffer *payload);
 
+    virtual void prewarmRotation();
+    virtual bool releaseIdleRotation(nsecs_t now, bool videoActive);
+
+    virtual void dump(Dump& d);
+
 private:
     void signalVideoRotation(BufferMapper& mapper);
     bool isSettingRotBitAllowed();
@@ -67,6 +75,8 @@ protected:
     // z order config
     uint32_t mZOrderConfig;
     bool mUseOverlayRotation;
+    // hysteresis between overlay and decoder rotation
+    RotationModePredictor mRotationPredictor;
     // hardware context
     struct intel_dc_plane_ctx mContext;
 };
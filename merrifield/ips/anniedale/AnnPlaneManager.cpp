@@ -13,6 +13,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <string.h>
 #include <HwcTrace.h>
 #include <utils/String8.h>
 #include <anniedale/AnnPlaneManager.h>
@@ -111,12 +112,101 @@ static ZOrderDescription PIPE_B_ZORDER_DESC[] =
     {12, "BDGH"}  // overlay A/C at top (1 << 2 + 1 << 3)
 };
 
-static ZOrderDescription *PIPE_A_ZORDER_TBL;
-static int PIPE_A_ZORDER_COMBINATIONS;
-static ZOrderDescription *PIPE_B_ZORDER_TBL;
-static int PIPE_B_ZORDER_COMBINATIONS;
+enum {
+    // planes of a stack, cursor excluded
+    ZORDER_MAX_DEPTH = 4,
+    ZORDER_OVERLAY_MASKS = 1 << ZORDER_MAX_DEPTH,
+    // stacks sharing one overlay position mask
+    ZORDER_MAX_STACKS = 4,
+    ZORDER_PIPES = 2,
+};
+
+// a zorder string resolved through PLANE_DESC
+struct ZOrderStack {
+    const char *zorder;
+    int length;
+    PlaneDescription *planes[ZORDER_MAX_DEPTH];
+    // plane bits used by the bottom n planes of the stack
+    uint32_t planeBits[ZORDER_MAX_DEPTH + 1];
+    // position of overlay C, which can't be transformed, or -1
+    int overlayC;
+};
+
+// stacks of a pipe with the same overlay positions
+struct ZOrderLookup {
+    int count;
+    // bit n is set if a stack is deep enough for n layers
+    uint32_t depths;
+    ZOrderStack stacks[ZORDER_MAX_STACKS];
+};
+
+// first plane bit of each plane type
+static int PLANE_BIT_BASE[DisplayPlane::PLANE_MAX];
+static ZOrderLookup ZORDER_LOOKUP[ZORDER_PIPES][ZORDER_OVERLAY_MASKS];
 static bool OVERLAY_HW_WORKAROUND;
 
+static inline uint32_t getPlaneBit(const PlaneDescription& desc)
+{
+    return 1 << (PLANE_BIT_BASE[desc.type] + desc.index);
+}
+
+// overlay positions of a z order config and the number of its layers,
+// cursor excluded
+static int getOverlayMask(ZOrderConfig& config, int *depth)
+{
+    int mask = 0;
+    int layers = 0;
+    for (int i = 0; i < (int)config.size(); i++) {
+        int type = config[i]->planeType;
+        if (type == DisplayPlane::PLANE_CURSOR)
+            continue;
+        if (type == DisplayPlane::PLANE_OVERLAY)
+            mask |= (1 << i);
+        layers++;
+    }
+    *depth = layers;
+    return mask;
+}
+
+static void buildZOrderLookup(ZOrderLookup *lookup,
+                              ZOrderDescription *table, int combinations)
+{
+    memset(lookup, 0, sizeof(ZOrderLookup) * ZORDER_OVERLAY_MASKS);
+
+    for (int i = 0; i < combinations; i++) {
+        ZOrderDescription& desc = table[i];
+        int length = (int)strlen(desc.zorder);
+        if (desc.index < 0 || desc.index >= ZORDER_OVERLAY_MASKS ||
+            length > ZORDER_MAX_DEPTH) {
+            ETRACE("invalid zorder %s", desc.zorder);
+            continue;
+        }
+
+        ZOrderLookup& entry = lookup[desc.index];
+        if (entry.count >= ZORDER_MAX_STACKS) {
+            ETRACE("too many zorders for overlay mask %d", desc.index);
+            continue;
+        }
+
+        ZOrderStack& stack = entry.stacks[entry.count++];
+        stack.zorder = desc.zorder;
+        stack.length = length;
+        stack.overlayC = -1;
+        stack.planeBits[0] = 0;
+        for (int j = 0; j < length; j++) {
+            PlaneDescription *plane = &PLANE_DESC[desc.zorder[j] - 'A'];
+            stack.planes[j] = plane;
+            stack.planeBits[j + 1] = stack.planeBits[j] | getPlaneBit(*plane);
+            if (plane->type == DisplayPlane::PLANE_OVERLAY && plane->index == 1)
+                stack.overlayC = j;
+        }
+
+        for (int n = 1; n <= length; n++) {
+            entry.depths |= (1 << n);
+        }
+    }
+}
+
 AnnPlaneManager::AnnPlaneManager()
     : DisplayPlaneManager()
 {
@@ -133,25 +223,29 @@ bool AnnPlaneManager::initialize()
     mPrimaryPlaneCount = 3; // Primary A, B, C
     mCursorPlaneCount = 3;
 
+    for (int i = (int)(sizeof(PLANE_DESC)/sizeof(PlaneDescription)) - 1; i >= 0; i--) {
+        PLANE_BIT_BASE[PLANE_DESC[i].type] = i - PLANE_DESC[i].index;
+    }
+
     uint32_t videoMode = 0;
     Drm *drm = Hwcomposer::getInstance().getDrm();
     drm->readIoctl(DRM_PSB_PANEL_QUERY, &videoMode, sizeof(uint32_t));
     if (videoMode == 1) {
         DTRACE("video mode panel, no primay A always on hack");
-        PIPE_A_ZORDER_TBL = PIPE_A_ZORDER_DESC_VID;
-        PIPE_A_ZORDER_COMBINATIONS =
-            sizeof(PIPE_A_ZORDER_DESC_VID)/sizeof(ZOrderDescription);
+        buildZOrderLookup(ZORDER_LOOKUP[IDisplayDevice::DEVICE_PRIMARY],
+            PIPE_A_ZORDER_DESC_VID,
+            sizeof(PIPE_A_ZORDER_DESC_VID)/sizeof(ZOrderDescription));
     } else {
         DTRACE("command mode panel, need primay A always on hack");
-        PIPE_A_ZORDER_TBL = PIPE_A_ZORDER_DESC_CMD;
-        PIPE_A_ZORDER_COMBINATIONS =
-            sizeof(PIPE_A_ZORDER_DESC_CMD)/sizeof(ZOrderDescription);
+        buildZOrderLookup(ZORDER_LOOKUP[IDisplayDevice::DEVICE_PRIMARY],
+            PIPE_A_ZORDER_DESC_CMD,
+            sizeof(PIPE_A_ZORDER_DESC_CMD)/sizeof(ZOrderDescription));
 	OVERLAY_HW_WORKAROUND = true;
     }
 
-    PIPE_B_ZORDER_TBL = PIPE_B_ZORDER_DESC;
-    PIPE_B_ZORDER_COMBINATIONS =
-        sizeof(PIPE_B_ZORDER_DESC)/sizeof(ZOrderDescription);
+    buildZOrderLookup(ZORDER_LOOKUP[IDisplayDevice::DEVICE_EXTERNAL],
+        PIPE_B_ZORDER_DESC,
+        sizeof(PIPE_B_ZORDER_DESC)/sizeof(ZOrderDescription));
 
     return DisplayPlaneManager::initialize();
 }
@@ -254,6 +348,15 @@ bool AnnPlaneManager::isValidZOrder(int dsp, ZOrderConfig& config)
         ETRACE("invalid display device %d", dsp);
         return false;
     }
+
+    // some stack of the pipe must have the overlays at these positions
+    int depth;
+    int mask = getOverlayMask(config, &depth);
+    if (mask >= ZORDER_OVERLAY_MASKS ||
+        !(ZORDER_LOOKUP[dsp][mask].depths & (1 << depth))) {
+        VTRACE("no plane stack for overlay mask %#x, depth %d", mask, depth);
+        return false;
+    }
     return true;
 }
 
@@ -265,106 +368,68 @@ bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config)
     }
 
     int size = (int)config.size();
-
-    // calculate index based on overlay Z order position
-    int index = 0;
-    for (int i = 0; i < size; i++) {
-        if (config[i]->planeType == DisplayPlane::PLANE_OVERLAY) {
-            index += (1 << i);
-        }
-    }
-
-    int combinations;
-    ZOrderDescription *table;
-    if (dsp == IDisplayDevice::DEVICE_PRIMARY) {
-        combinations = PIPE_A_ZORDER_COMBINATIONS;
-        table = PIPE_A_ZORDER_TBL;
-    } else {
-        combinations = PIPE_B_ZORDER_COMBINATIONS;
-        table = PIPE_B_ZORDER_TBL;
+    if (size == 0) {
+        return false;
     }
 
-    for (int i = 0; i < combinations; i++) {
-        ZOrderDescription *zorderDesc = table + i;
-
-        if (zorderDesc->index != index)
+    // cursor layer is not part of the stacks, it must be on top of the
+    // zorder and there can be no more than one cursor layer
+    for (int i = 0; i < size; i++) {
+        if (config[i]->planeType != DisplayPlane::PLANE_CURSOR)
             continue;
-
-        if (assignPlanes(dsp, config, zorderDesc->zorder)) {
-            VTRACE("zorder assigned %s", zorderDesc->zorder);
-            return true;
+        if (i != size - 1) {
+            ETRACE("invalid zorder of cursor layer");
+            return false;
+        }
+        PlaneDescription& desc = PLANE_DESC['I' - 'A' + dsp];
+        if (!isFreePlane(desc.type, desc.index)) {
+            ETRACE("cursor plane is not available");
+            return false;
         }
     }
-    return false;
-}
-
-bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const char *zorder)
-{
-    // zorder string does not include cursor plane, therefore cursor layer needs to be handled
-    // in a special way. Cursor layer must be on top of zorder and no more than one cursor layer.
 
-    int size = (int)config.size();
-    if (zorder == NULL || size == 0) {
-        //DTRACE("invalid zorder or ZOrder config.");
+    // look up the stacks based on overlay Z order position
+    int depth;
+    int mask = getOverlayMask(config, &depth);
+    if (mask >= ZORDER_OVERLAY_MASKS) {
         return false;
     }
 
-    int zorderLen = (int)strlen(zorder);
+    uint32_t freeBits = 0;
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        freeBits |= getAvailablePlanes(i) << PLANE_BIT_BASE[i];
+    }
 
-    // test if plane is avalable
-    for (int i = 0; i < size; i++) {
-        if (config[i]->planeType == DisplayPlane::PLANE_CURSOR) {
-            if (i != size - 1) {
-                ETRACE("invalid zorder of cursor layer");
-                return false;
-            }
-            PlaneDescription& desc = PLANE_DESC['I' - 'A' + dsp];
-            if (!isFreePlane(desc.type, desc.index)) {
-                ETRACE("cursor plane is not available");
-                return false;
-            }
-            continue;
-        }
-        if (i >= zorderLen) {
+    ZOrderLookup& lookup = ZORDER_LOOKUP[dsp][mask];
+    for (int i = 0; i < lookup.count; i++) {
+        ZOrderStack& stack = lookup.stacks[i];
+        if (stack.length < depth) {
             DTRACE("index of ZOrderConfig is out of bound");
-            return false;
-        }
-
-        char id = *(zorder + i);
-        PlaneDescription& desc = PLANE_DESC[id - 'A'];
-        if (!isFreePlane(desc.type, desc.index)) {
-            DTRACE("plane type %d index %d is not available", desc.type, desc.index);
-            return false;
+            continue;
         }
 
-#if 0
-        // plane type check
-        if (config[i]->planeType == DisplayPlane::PLANE_OVERLAY &&
-            desc.type != DisplayPlane::PLANE_OVERLAY) {
-            ETRACE("invalid plane type %d, expected %d", desc.type, config[i]->planeType);
-            return false;
+        if (stack.planeBits[depth] & ~freeBits) {
+            DTRACE("planes of zorder %s are not available", stack.zorder);
+            continue;
         }
 
-        if (config[i]->planeType != DisplayPlane::PLANE_OVERLAY) {
-            if (config[i]->planeType != DisplayPlane::PLANE_PRIMARY &&
-                config[i]->planeType != DisplayPlane::PLANE_SPRITE) {
-                ETRACE("invalid plane type %d,", config[i]->planeType);
-                return false;
-            }
-            if (desc.type != DisplayPlane::PLANE_PRIMARY &&
-                desc.type != DisplayPlane::PLANE_SPRITE) {
-                ETRACE("invalid plane type %d, expected %d", desc.type, config[i]->planeType);
-                return false;
-            }
+        if (stack.overlayC >= 0 && stack.overlayC < depth &&
+            config[stack.overlayC]->hwcLayer->getTransform() != 0) {
+            DTRACE("overlay C does not support transform");
+            continue;
         }
-#endif
 
-        if  (desc.type == DisplayPlane::PLANE_OVERLAY && desc.index == 1 &&
-             config[i]->hwcLayer->getTransform() != 0) {
-            DTRACE("overlay C does not support transform");
-            return false;
+        if (assignPlanes(dsp, config, stack)) {
+            VTRACE("zorder assigned %s", stack.zorder);
+            return true;
         }
     }
+    return false;
+}
+
+bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const ZOrderStack& stack)
+{
+    int size = (int)config.size();
 
     bool primaryPlaneActive = false;
     // allocate planes
@@ -379,8 +444,7 @@ bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const char *zo
             continue;
         }
 
-        char id = *(zorder + i);
-        PlaneDescription& desc = PLANE_DESC[id - 'A'];
+        PlaneDescription& desc = *stack.planes[i];
         ZOrderLayer *zLayer = config.itemAt(i);
         zLayer->plane = getPlane(desc.type, desc.index);
         if (zLayer->plane == NULL) {
@@ -410,7 +474,7 @@ bool AnnPlaneManager::assignPlanes(int dsp, ZOrderConfig& config, const char *zo
     }
 
 #if 0
-    DTRACE("config size %d, zorder %s", size, zorder);
+    DTRACE("config size %d, zorder %s", size, stack.zorder);
     for (int i = 0; i < size; i++) {
         const ZOrderLayer *l = config.itemAt(i);
         ITRACE("%d: plane type %d, index %d, zorder %d",
@@ -439,7 +503,7 @@ int AnnPlaneManager::getFreePlanes(int dsp, int type)
         return 0;
     }
 
-    uint32_t freePlanes = mFreePlanes[type] | mReclaimedPlanes[type];
+    uint32_t freePlanes = getAvailablePlanes(type);
     int start = 0;
     int stop = mSpritePlaneCount;
     if (dsp == IDisplayDevice::DEVICE_EXTERNAL) {
@@ -22,6 +22,8 @@
 namespace android {
 namespace intel {
 
+struct ZOrderStack;
+
 class AnnPlaneManager : public DisplayPlaneManager {
 public:
     AnnPlaneManager();
@@ -38,7 +40,7 @@ public:
 
 protected:
     DisplayPlane* allocPlane(int index, int type);
-    bool assignPlanes(int dsp, ZOrderConfig& config, const char *zorder);
+    bool assignPlanes(int dsp, ZOrderConfig& config, const ZOrderStack& stack);
 };
 
 } // namespace intel
@@ -35,6 +35,19 @@ AnnRGBPlane::~AnnRGBPlane()
     CTRACE();
 }
 
+bool AnnRGBPlane::reset()
+{
+    // the plane is off, scaled copies are no longer scanned out
+    mPrescaleCache.clear();
+    return DisplayPlane::reset();
+}
+
+void AnnRGBPlane::deinitialize()
+{
+    mPrescaleCache.clear();
+    DisplayPlane::deinitialize();
+}
+
 bool AnnRGBPlane::enable()
 {
     return enablePlane(true);
@@ -85,7 +98,7 @@ bool AnnRGBPlane::setDataBuffer(buffer_handle_t handle)
     return true;
 }
 
-bool AnnRGBPlane::setDataBuffer(BufferMapper& mapper)
+bool AnnRGBPlane::setDataBuffer(BufferMapper& source)
 {
     int bpp;
     int srcX, srcY, srcW, srcH;
@@ -104,6 +117,19 @@ bool AnnRGBPlane::setDataBuffer(BufferMapper& mapper)
     dstW = mPosition.w;
     dstH = mPosition.h;
 
+    // the plane can't scale, show a copy scaled to the display frame
+    BufferMapper *buf = &source;
+    if (source.getCrop().w != mPosition.w ||
+        source.getCrop().h != mPosition.h) {
+        buf = mPrescaleCache.get(source, mPosition.w, mPosition.h,
+                                 mUpdateMasks & PLANE_BUFFER_CHANGED);
+        if (!buf) {
+            ETRACE("failed to prescale buffer");
+            return false;
+        }
+    }
+    BufferMapper& mapper = *buf;
+
     checkPosition(dstX, dstY, dstW, dstH);
 
     // setup plane format
@@ -137,15 +163,17 @@ bool AnnRGBPlane::setDataBuffer(BufferMapper& mapper)
         mContext.type = DC_PRIMARY_PLANE;
 
     // setup plane alpha
-    if (0 < mPlaneAlpha && mPlaneAlpha < 0xff) {
-       planeAlpha = mPlaneAlpha | 0x80000000;
-    } else {
-       // disable plane alpha to offload HW
-       planeAlpha = 0xff;
-    }
+    planeAlpha = getPlaneAlpha();
 
     mContext.ctx.sp_ctx.index = mIndex;
     mContext.ctx.sp_ctx.pipe = mDevice;
+    // an opaque layer must not blend with the alpha channel of its buffer
+    if (mBlending == HWC_BLENDING_NONE) {
+        if (spriteFormat == PixelFormat::PLANE_PIXEL_FORMAT_BGRA8888)
+            spriteFormat = PixelFormat::PLANE_PIXEL_FORMAT_BGRX8888;
+        else if (spriteFormat == PixelFormat::PLANE_PIXEL_FORMAT_RGBA8888)
+            spriteFormat = PixelFormat::PLANE_PIXEL_FORMAT_RGBX8888;
+    }
     mContext.ctx.sp_ctx.cntr = spriteFormat | 0x80000000;
     mContext.ctx.sp_ctx.linoff = linoff;
     mContext.ctx.sp_ctx.stride = stride;
@@ -214,13 +242,14 @@ bool AnnRGBPlane::enablePlane(bool enabled)
     arg.plane.index = mIndex;
     arg.plane.ctx = 0;
 
-    // issue ioctl
+    // issue ioctl, batched with the frame if prepare is running
     Drm *drm = Hwcomposer::getInstance().getDrm();
-    bool ret = drm->writeReadIoctl(DRM_PSB_REGISTER_RW, &arg, sizeof(arg));
+    bool ret = drm->updatePlane(arg, this);
     if (ret == false) {
         WTRACE("plane enabling (%d) failed with error code %d", enabled, ret);
         return false;
     }
+    recordPlaneState(arg.plane_enable_mask != 0);
 
     return true;
 }
@@ -258,6 +287,17 @@ void AnnRGBPlane::postFlip()
     // skipping flip may cause flicking
 }
 
+uint32_t AnnRGBPlane::getPlaneAlpha() const
+{
+    // a fully transparent layer keeps its plane with a zero constant alpha
+    if (mPlaneAlpha < 0xff) {
+        return mPlaneAlpha | 0x80000000;
+    }
+
+    // disable plane alpha to offload HW
+    return 0xff;
+}
+
 void AnnRGBPlane::setFramebufferTarget(buffer_handle_t handle)
 {
     uint32_t stride;
@@ -283,12 +323,7 @@ void AnnRGBPlane::setFramebufferTarget(buffer_handle_t handle)
 
     stride = align_to((4 * align_to(mPosition.w, 32)), 64);
 
-    if (0 < mPlaneAlpha && mPlaneAlpha < 0xff) {
-       planeAlpha = mPlaneAlpha | 0x80000000;
-    } else {
-       // disable plane alpha to offload HW
-       planeAlpha = 0xff;
-    }
+    planeAlpha = getPlaneAlpha();
 
     // FIXME: use sprite context for sprite plane
     mContext.ctx.prim_ctx.update_mask = SPRITE_UPDATE_ALL;
@@ -21,6 +21,7 @@
 #include <Hwcomposer.h>
 #include <BufferCache.h>
 #include <DisplayPlane.h>
+#include <common/PrescaleBufferCache.h>
 
 #include <linux/psb_drm.h>
 
@@ -37,6 +38,8 @@ public:
     bool disable();
     bool isDisabled();
     void postFlip();
+    bool reset();
+    void deinitialize();
 
     void* getContext() const;
     void setZOrderConfig(ZOrderConfig& config, void *nativeConfig);
@@ -47,8 +50,12 @@ protected:
     bool enablePlane(bool enabled);
 private:
     void setFramebufferTarget(buffer_handle_t handle);
+    // contalpa of the plane: the enable bit and the layer's plane alpha
+    uint32_t getPlaneAlpha() const;
 protected:
     struct intel_dc_plane_ctx mContext;
+    // scaled copies of layers the plane can't show 1:1
+    PrescaleBufferCache mPrescaleCache;
 };
 
 } // namespace intel
@@ -14,13 +14,17 @@
 // limitations under the License.
 */
 
+#include <stdlib.h>
+#include <cutils/properties.h>
 #include <HwcTrace.h>
 #include <DisplayPlane.h>
 #include <hal_public.h>
 #include <OMX_IVCommon.h>
 #include <OMX_IntelVideoExt.h>
 #include <PlaneCapabilities.h>
+#include <common/FormatTable.h>
 #include <common/OverlayHardware.h>
+#include <common/ConvertBufferCache.h>
 #include <HwcLayer.h>
 #include <BufferManager.h>
 #include <Hwcomposer.h>
@@ -28,6 +32,8 @@
 
 #define SPRITE_PLANE_MAX_STRIDE_TILED      16384
 #define SPRITE_PLANE_MAX_STRIDE_LINEAR     16384
+#define SPRITE_PLANE_MAX_WIDTH             2048
+#define SPRITE_PLANE_MAX_HEIGHT            2048
 
 #define OVERLAY_PLANE_MAX_STRIDE_PACKED    4096
 #define OVERLAY_PLANE_MAX_STRIDE_LINEAR    8192
@@ -35,42 +41,68 @@
 namespace android {
 namespace intel {
 
+// scaled RGB layers may be shown through a prescaled copy, see
+// AnnRGBPlane::setDataBuffer(), read once from hwc.sprite.prescale
+static bool isPrescaleEnabled()
+{
+    static volatile int enabled = -1;
+
+    if (enabled < 0) {
+        char prop[PROPERTY_VALUE_MAX];
+        property_get("hwc.sprite.prescale", prop, "0");
+        enabled = atoi(prop) ? 1 : 0;
+    }
+    return enabled == 1;
+}
+
+static bool isPrescaleSupported(HwcLayer *hwcLayer, int srcW, int srcH,
+                                int dstW, int dstH)
+{
+    hwc_frect_t& src = hwcLayer->getLayer()->sourceCropf;
+
+    if (!isPrescaleEnabled() || hwcLayer->isProtected()) {
+        return false;
+    }
+
+    // the blit scales the whole buffer
+    if ((int)src.left != 0 || (int)src.top != 0 ||
+        srcW != (int)hwcLayer->getBufferWidth() ||
+        srcH != (int)hwcLayer->getBufferHeight()) {
+        DTRACE("source crop is not the whole buffer, no prescaling");
+        return false;
+    }
+
+    if (dstW <= 0 || dstH <= 0 ||
+        dstW > SPRITE_PLANE_MAX_WIDTH || dstH > SPRITE_PLANE_MAX_HEIGHT) {
+        DTRACE("invalid prescale size %dx%d", dstW, dstH);
+        return false;
+    }
+    return true;
+}
+
 bool PlaneCapabilities::isFormatSupported(int planeType, HwcLayer *hwcLayer)
 {
     uint32_t format = hwcLayer->getFormat();
     uint32_t trans = hwcLayer->getLayer()->transform;
 
-    if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            return trans ? false : true;
-        default:
+    if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY ||
+        planeType == DisplayPlane::PLANE_OVERLAY) {
+        const FormatTable::Descriptor *desc = FormatTable::get(format);
+        if (!desc || !(desc->planes & (1 << planeType))) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
-    } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            // TODO: overlay supports 180 degree rotation
-            if (trans == HAL_TRANSFORM_ROT_180) {
-                WTRACE("180 degree rotation is not supported yet");
-            }
-            return trans ? false : true;
-        case HAL_PIXEL_FORMAT_YV12:
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
+        if (!trans) {
             return true;
-        default:
-            VTRACE("unsupported format %#x", format);
+        }
+        if (planeType != DisplayPlane::PLANE_OVERLAY) {
             return false;
         }
+        // rotated layers are shown through a converted copy
+        if (desc->flags & FormatTable::FORMAT_OVERLAY_NO_ROTATION) {
+            return ConvertBufferCache::isSupported(hwcLayer);
+        }
+        return true;
     } else {
         ETRACE("invalid plane type %d", planeType);
         return false;
@@ -84,46 +116,28 @@ bool PlaneCapabilities::isSizeSupported(int planeType, HwcLayer *hwcLayer)
     uint32_t h = hwcLayer->getBufferHeight();
     const stride_t& stride = hwcLayer->getBufferStride();
 
-    bool isYUVPacked;
     uint32_t maxStride;
 
     if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            VTRACE("stride %d", stride.rgb.stride);
-            if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
-                VTRACE("too large stride %d", stride.rgb.stride);
-                return false;
-            }
-            return true;
-        default:
+        if (!FormatTable::isPlaneSupported(format, planeType)) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
+        VTRACE("stride %d", stride.rgb.stride);
+        if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
+            VTRACE("too large stride %d", stride.rgb.stride);
+            return false;
+        }
+        return true;
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_YV12:
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-            isYUVPacked = false;
-            break;
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            isYUVPacked = true;
-            break;
-        default:
+        const FormatTable::Descriptor *desc = FormatTable::get(format);
+        if (!desc || !(desc->planes & (1 << planeType))) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
         // don't use overlay plane if stride is too big
         maxStride = OVERLAY_PLANE_MAX_STRIDE_LINEAR;
-        if (isYUVPacked) {
+        if (desc->flags & FormatTable::FORMAT_YUV_PACKED) {
             maxStride = OVERLAY_PLANE_MAX_STRIDE_PACKED;
         }
 
@@ -173,8 +187,21 @@ bool PlaneCapabilities::isBlendingSupported(int planeType, HwcLayer *hwcLayer)
             return false;
         }
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        // overlay doesn't support blending
-        return (blending == HWC_BLENDING_NONE) ? true : false;
+        // overlay doesn't support blending, but a YUV buffer has no alpha
+        // channel, so a blended layer is opaque unless it has plane alpha
+        switch (blending) {
+        case HWC_BLENDING_NONE:
+            return true;
+        case HWC_BLENDING_PREMULT:
+        case HWC_BLENDING_COVERAGE:
+            if (planeAlpha == 0xff)
+                return true;
+            VTRACE("unsupported plane alpha %#x", planeAlpha);
+            return false;
+        default:
+            VTRACE("unsupported blending %#x", blending);
+            return false;
+        }
     } else {
         ETRACE("invalid plane type %d", planeType);
         return false;
@@ -196,10 +223,17 @@ bool PlaneCapabilities::isScalingSupported(int planeType, HwcLayer *hwcLayer)
     dstH = dest.bottom - dest.top;
 
     if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        // no scaling is supported
-        return ((srcW == dstW) && (srcH == dstH)) ? true : false;
+        // no scaling is supported, other than through a prescaled copy
+        if ((srcW == dstW) && (srcH == dstH))
+            return true;
+        return isPrescaleSupported(hwcLayer, srcW, srcH, dstW, dstH);
 
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
+        // the converted copy is scaled to what the overlay supports
+        if (ConvertBufferCache::isSupported(hwcLayer)) {
+            return dstW > 100 && dstH > 1;
+        }
+
         // overlay cannot support resolution that bigger than 2047x2047.
         if ((srcW > INTEL_OVERLAY_MAX_WIDTH - 1) || (srcH > INTEL_OVERLAY_MAX_HEIGHT - 1)) {
             uint32_t format = hwcLayer->getFormat();
@@ -233,7 +267,8 @@ bool PlaneCapabilities::isScalingSupported(int planeType, HwcLayer *hwcLayer)
 
             float scaleX = (float)srcW / dstW;
             float scaleY = (float)srcH / dstH;
-            if (scaleX >= 3 || scaleY >= 3) {
+            if ((scaleX >= 3 || scaleY >= 3) &&
+                !ConvertBufferCache::isDownscaleSupported(hwcLayer)) {
                 DTRACE("overlay rotation with scaling >= 3, fall back to GLES");
                 return false;
             }
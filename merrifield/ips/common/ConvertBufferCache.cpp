@@ -0,0 +1,519 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <sync/sync.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <BufferManager.h>
+#include <MemoryAccounting.h>
+#include <hal_public.h>
+#include <OMX_IVCommon.h>
+#include <OMX_IntelVideoExt.h>
+#include <va/va_android.h>
+#include <common/ConvertBufferCache.h>
+
+namespace android {
+namespace intel {
+
+volatile int32_t ConvertBufferCache::sDisabled = -1;
+
+ConvertBufferCache::ConvertBufferCache()
+    : mDisplay(0),
+      mVaDpy(0),
+      mVaCfg(0),
+      mVaCtx(0),
+      mDummySurface(0),
+      mVaStarted(false),
+      mCurrent(0),
+      mConversions(0),
+      mReuses(0),
+      mFailures(0)
+{
+    memset(mImages, 0, sizeof(mImages));
+}
+
+ConvertBufferCache::~ConvertBufferCache()
+{
+    clear();
+}
+
+bool ConvertBufferCache::isEnabled()
+{
+    if (sDisabled < 0) {
+        char prop[PROPERTY_VALUE_MAX];
+        property_get("hwc.overlay.convert", prop, "1");
+        android_atomic_release_store(atoi(prop) ? 0 : 1, &sDisabled);
+    }
+    return !sDisabled;
+}
+
+bool ConvertBufferCache::isDownscaleSupported(HwcLayer *hwcLayer)
+{
+    if (!isEnabled() || hwcLayer->isProtected()) {
+        return false;
+    }
+
+    // the VSP reads linear NV12 only, tiled video stays on the decoder
+    // scaled buffers
+    return hwcLayer->getFormat() == OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar;
+}
+
+bool ConvertBufferCache::isSupported(HwcLayer *hwcLayer)
+{
+    if (!isEnabled() || hwcLayer->isProtected()) {
+        return false;
+    }
+
+    switch (hwcLayer->getFormat()) {
+    case HAL_PIXEL_FORMAT_I420:
+    case HAL_PIXEL_FORMAT_YUY2:
+    case HAL_PIXEL_FORMAT_UYVY:
+        break;
+    default:
+        return false;
+    }
+
+    return getVaRotation(hwcLayer->getLayer()->transform) != VA_ROTATION_NONE;
+}
+
+int ConvertBufferCache::getVaRotation(int transform)
+{
+    switch (transform) {
+    case HAL_TRANSFORM_ROT_90:
+        return VA_ROTATION_90;
+    case HAL_TRANSFORM_ROT_180:
+        return VA_ROTATION_180;
+    case HAL_TRANSFORM_ROT_270:
+        return VA_ROTATION_270;
+    default:
+        return VA_ROTATION_NONE;
+    }
+}
+
+bool ConvertBufferCache::startVA()
+{
+    VAStatus vaStatus;
+    int majorVer, minorVer;
+
+    // display 0 is the VSP
+    mVaDpy = vaGetDisplay(&mDisplay);
+    if (!mVaDpy) {
+        ETRACE("failed to get VA display");
+        return false;
+    }
+
+    vaStatus = vaInitialize(mVaDpy, &majorVer, &minorVer);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaInitialize returns %08x", vaStatus);
+        mVaDpy = 0;
+        return false;
+    }
+    mVaStarted = true;
+
+    VAConfigAttrib attrib;
+    attrib.type = VAConfigAttribRTFormat;
+    vaStatus = vaGetConfigAttributes(mVaDpy, VAProfileNone,
+                                     VAEntrypointVideoProc, &attrib, 1);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaGetConfigAttributes returns %08x", vaStatus);
+        return false;
+    }
+
+    vaStatus = vaCreateConfig(mVaDpy, VAProfileNone, VAEntrypointVideoProc,
+                              &attrib, 1, &mVaCfg);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateConfig returns %08x", vaStatus);
+        return false;
+    }
+
+    vaStatus = vaCreateSurfaces(mVaDpy, VA_RT_FORMAT_YUV420, 64, 64,
+                                &mDummySurface, 1, NULL, 0);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateSurfaces returns %08x", vaStatus);
+        mDummySurface = 0;
+        return false;
+    }
+
+    vaStatus = vaCreateContext(mVaDpy, mVaCfg, 64, 64, 0,
+                               &mDummySurface, 1, &mVaCtx);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateContext returns %08x", vaStatus);
+        mVaCtx = 0;
+        return false;
+    }
+
+    VAProcPipelineCaps caps;
+    memset(&caps, 0, sizeof(caps));
+    vaStatus = vaQueryVideoProcPipelineCaps(mVaDpy, mVaCtx, NULL, 0, &caps);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaQueryVideoProcPipelineCaps returns %08x", vaStatus);
+        return false;
+    }
+
+    uint32_t rotations = (1 << VA_ROTATION_90) | (1 << VA_ROTATION_180) |
+                         (1 << VA_ROTATION_270);
+    if ((caps.rotation_flags & rotations) != rotations) {
+        WTRACE("VSP can't rotate (flags %#x)", caps.rotation_flags);
+        return false;
+    }
+    return true;
+}
+
+void ConvertBufferCache::stopVA()
+{
+    if (mVaCtx) {
+        vaDestroyContext(mVaDpy, mVaCtx);
+    }
+    if (mDummySurface) {
+        vaDestroySurfaces(mVaDpy, &mDummySurface, 1);
+    }
+    if (mVaCfg) {
+        vaDestroyConfig(mVaDpy, mVaCfg);
+    }
+    if (mVaStarted) {
+        vaTerminate(mVaDpy);
+    }
+
+    mVaDpy = 0;
+    mVaCfg = 0;
+    mVaCtx = 0;
+    mDummySurface = 0;
+    mVaStarted = false;
+}
+
+bool ConvertBufferCache::allocImage(Image& image, int width, int height)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    image.handle = bm->allocGrallocBuffer(width, height, HAL_PIXEL_FORMAT_NV12,
+                                          GRALLOC_USAGE_HW_RENDER |
+                                          GRALLOC_USAGE_HW_COMPOSER);
+    if (!image.handle) {
+        ETRACE("failed to allocate %dx%d convert buffer", width, height);
+        return false;
+    }
+
+    DataBuffer *buffer = bm->lockDataBuffer(image.handle);
+    if (buffer) {
+        image.mapper = bm->map(*buffer);
+        bm->unlockDataBuffer(buffer);
+    }
+
+    if (!image.mapper) {
+        ETRACE("failed to map convert buffer");
+        bm->freeGrallocBuffer(image.handle);
+        memset(&image, 0, sizeof(image));
+        return false;
+    }
+
+    // the VSP writes the gralloc buffer directly
+    uint32_t stride = image.mapper->getStride().yuv.yStride;
+    uint32_t bufHeight = image.mapper->getHeight();
+    MemoryAccounting::add(MemoryAccounting::ROTATION_BUFFER,
+                          stride * bufHeight * 3 / 2);
+    unsigned long handle = (unsigned long)image.handle;
+    VASurfaceAttribExternalBuffers buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.pixel_format = VA_FOURCC_NV12;
+    buf.width = width;
+    buf.height = height;
+    buf.data_size = stride * bufHeight * 3 / 2;
+    buf.num_planes = 2;
+    buf.pitches[0] = stride;
+    buf.pitches[1] = stride;
+    buf.offsets[0] = 0;
+    buf.offsets[1] = stride * bufHeight;
+    buf.buffers = &handle;
+    buf.num_buffers = 1;
+
+    VASurfaceAttrib attribs[2];
+    attribs[0].type = (VASurfaceAttribType)VASurfaceAttribMemoryType;
+    attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[0].value.type = VAGenericValueTypeInteger;
+    attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_ANDROID_GRALLOC;
+    attribs[1].type = (VASurfaceAttribType)VASurfaceAttribExternalBufferDescriptor;
+    attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[1].value.type = VAGenericValueTypePointer;
+    attribs[1].value.value.p = (void *)&buf;
+
+    VAStatus vaStatus = vaCreateSurfaces(mVaDpy, VA_RT_FORMAT_YUV420,
+                                         width, height, &image.surface, 1,
+                                         attribs, 2);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateSurfaces (target) returns %08x", vaStatus);
+        image.surface = 0;
+        freeImage(image);
+        return false;
+    }
+
+    image.mapper->setCrop(0, 0, width, height);
+    image.mapper->setIsCompression(false);
+    image.sourceKey = 0;
+    image.width = width;
+    image.height = height;
+    return true;
+}
+
+void ConvertBufferCache::freeImage(Image& image)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    if (image.surface) {
+        vaDestroySurfaces(mVaDpy, &image.surface, 1);
+    }
+    if (image.mapper) {
+        MemoryAccounting::remove(MemoryAccounting::ROTATION_BUFFER,
+            image.mapper->getStride().yuv.yStride * image.mapper->getHeight() * 3 / 2);
+        bm->unmap(image.mapper);
+    }
+    if (image.handle) {
+        bm->freeGrallocBuffer(image.handle);
+    }
+    memset(&image, 0, sizeof(image));
+}
+
+void ConvertBufferCache::clear()
+{
+    for (int i = 0; i < CONVERT_BUFFER_COUNT; i++) {
+        freeImage(mImages[i]);
+    }
+    mCurrent = 0;
+    stopVA();
+}
+
+VASurfaceID ConvertBufferCache::createSourceSurface(BufferMapper& source)
+{
+    uint32_t yStride = source.getStride().yuv.yStride;
+    uint32_t uvStride = source.getStride().yuv.uvStride;
+    uint32_t height = source.getHeight();
+    unsigned long handle = (unsigned long)source.getHandle();
+    unsigned int rtFormat;
+
+    VASurfaceAttribExternalBuffers buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.width = source.getWidth();
+    buf.height = height;
+    buf.buffers = &handle;
+    buf.num_buffers = 1;
+
+    switch (source.getFormat()) {
+    case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
+        rtFormat = VA_RT_FORMAT_YUV420;
+        buf.pixel_format = VA_FOURCC_NV12;
+        buf.num_planes = 2;
+        buf.pitches[0] = yStride;
+        buf.pitches[1] = uvStride;
+        buf.offsets[0] = 0;
+        buf.offsets[1] = yStride * height;
+        buf.data_size = buf.offsets[1] + uvStride * (height / 2);
+        break;
+    case HAL_PIXEL_FORMAT_I420:
+        rtFormat = VA_RT_FORMAT_YUV420;
+        buf.pixel_format = VA_FOURCC('I', '4', '2', '0');
+        buf.num_planes = 3;
+        buf.pitches[0] = yStride;
+        buf.pitches[1] = uvStride;
+        buf.pitches[2] = uvStride;
+        buf.offsets[0] = 0;
+        buf.offsets[1] = yStride * height;
+        buf.offsets[2] = buf.offsets[1] + uvStride * (height / 2);
+        buf.data_size = buf.offsets[2] + uvStride * (height / 2);
+        break;
+    case HAL_PIXEL_FORMAT_YUY2:
+    case HAL_PIXEL_FORMAT_UYVY:
+        rtFormat = VA_RT_FORMAT_YUV422;
+        buf.pixel_format = source.getFormat() == HAL_PIXEL_FORMAT_YUY2 ?
+                           VA_FOURCC_YUY2 : VA_FOURCC_UYVY;
+        buf.num_planes = 1;
+        buf.pitches[0] = yStride;
+        buf.offsets[0] = 0;
+        buf.data_size = yStride * height;
+        break;
+    default:
+        ETRACE("unsupported format %#x", source.getFormat());
+        return 0;
+    }
+
+    VASurfaceAttrib attribs[2];
+    attribs[0].type = (VASurfaceAttribType)VASurfaceAttribMemoryType;
+    attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[0].value.type = VAGenericValueTypeInteger;
+    attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_ANDROID_GRALLOC;
+    attribs[1].type = (VASurfaceAttribType)VASurfaceAttribExternalBufferDescriptor;
+    attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attribs[1].value.type = VAGenericValueTypePointer;
+    attribs[1].value.value.p = (void *)&buf;
+
+    VASurfaceID surface = 0;
+    VAStatus vaStatus = vaCreateSurfaces(mVaDpy, rtFormat, buf.width, height,
+                                         &surface, 1, attribs, 2);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateSurfaces (source) returns %08x", vaStatus);
+        return 0;
+    }
+    return surface;
+}
+
+bool ConvertBufferCache::convert(BufferMapper& source, Image& image,
+                                 int transform)
+{
+    VAStatus vaStatus;
+    VABufferID pipelineBuf = 0;
+    bool ret = false;
+
+    // source buffers come and go, the surface only lives for one frame
+    VASurfaceID surface = createSourceSurface(source);
+    if (!surface) {
+        return false;
+    }
+
+    crop_t& crop = source.getCrop();
+    VARectangle surfaceRegion = {(int16_t)crop.x, (int16_t)crop.y,
+                                 (uint16_t)crop.w, (uint16_t)crop.h};
+    VARectangle outputRegion = {0, 0, (uint16_t)image.width,
+                                (uint16_t)image.height};
+
+    do {
+        vaStatus = vaBeginPicture(mVaDpy, mVaCtx, image.surface);
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            ETRACE("vaBeginPicture returns %08x", vaStatus);
+            break;
+        }
+
+        VAProcPipelineParameterBuffer param;
+        memset(&param, 0, sizeof(param));
+        param.surface = surface;
+        param.surface_region = &surfaceRegion;
+        param.output_region = &outputRegion;
+        param.rotation_state = getVaRotation(transform);
+        vaStatus = vaCreateBuffer(mVaDpy, mVaCtx,
+                                  VAProcPipelineParameterBufferType,
+                                  sizeof(param), 1, &param, &pipelineBuf);
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            ETRACE("vaCreateBuffer returns %08x", vaStatus);
+            vaEndPicture(mVaDpy, mVaCtx);
+            break;
+        }
+
+        vaStatus = vaRenderPicture(mVaDpy, mVaCtx, &pipelineBuf, 1);
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            ETRACE("vaRenderPicture returns %08x", vaStatus);
+            vaEndPicture(mVaDpy, mVaCtx);
+            break;
+        }
+
+        vaStatus = vaEndPicture(mVaDpy, mVaCtx);
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            ETRACE("vaEndPicture returns %08x", vaStatus);
+            break;
+        }
+
+        // the copy is complete when it's flipped
+        vaStatus = vaSyncSurface(mVaDpy, image.surface);
+        if (vaStatus != VA_STATUS_SUCCESS) {
+            ETRACE("vaSyncSurface returns %08x", vaStatus);
+            break;
+        }
+        ret = true;
+    } while (0);
+
+    if (pipelineBuf) {
+        vaDestroyBuffer(mVaDpy, pipelineBuf);
+    }
+    vaDestroySurfaces(mVaDpy, &surface, 1);
+    return ret;
+}
+
+BufferMapper* ConvertBufferCache::get(BufferMapper& source, int transform,
+                                      int width, int height,
+                                      bool bufferChanged,
+                                      int acquireFenceFd)
+{
+    STRACE();
+
+    // a pending fence on the same buffer is a new frame rendered into it
+    bool pending = acquireFenceFd >= 0 && sync_wait(acquireFenceFd, 0) < 0;
+
+    // a repeated frame and position only updates keep the copy
+    Image& current = mImages[mCurrent];
+    crop_t& crop = source.getCrop();
+    if (current.mapper && !bufferChanged && !pending &&
+        current.sourceKey == source.getKey() &&
+        !memcmp(&current.sourceCrop, &crop, sizeof(crop_t)) &&
+        current.transform == transform &&
+        current.width == width && current.height == height) {
+        mReuses++;
+        return current.mapper;
+    }
+
+    if (!mVaStarted && !startVA()) {
+        // don't offer the overlay for these layers again
+        WTRACE("VSP conversion is not available");
+        android_atomic_release_store(1, &sDisabled);
+        stopVA();
+        mFailures++;
+        return NULL;
+    }
+
+    // never write to the copy on screen or waiting for the flip
+    int next = (mCurrent + 1) % CONVERT_BUFFER_COUNT;
+    Image& image = mImages[next];
+    if (image.mapper && (image.width != width || image.height != height)) {
+        freeImage(image);
+    }
+
+    if (!image.mapper && !allocImage(image, width, height)) {
+        mFailures++;
+        return NULL;
+    }
+
+    // the VSP reads the source at once, not on the fence
+    if (pending && sync_wait(acquireFenceFd, CONVERT_FENCE_TIMEOUT_MS) < 0) {
+        DTRACE("source %#llx is not rendered yet", source.getKey());
+        return NULL;
+    }
+
+    if (!convert(source, image, transform)) {
+        ETRACE("failed to convert %#llx to %dx%d", source.getKey(),
+               width, height);
+        mFailures++;
+        return NULL;
+    }
+
+    VTRACE("converted %#llx to %dx%d, transform %d", source.getKey(),
+           width, height, transform);
+    image.sourceKey = source.getKey();
+    image.sourceCrop = crop;
+    image.transform = transform;
+    mCurrent = next;
+    mConversions++;
+    return image.mapper;
+}
+
+void ConvertBufferCache::dump(Dump& d)
+{
+    if (!mConversions && !mFailures) {
+        return;
+    }
+    d.append("      converted copies: conversions %u, reuses %u, failures %u\n",
+             mConversions, mReuses, mFailures);
+}
+
+} // namespace intel
+} // namespace android
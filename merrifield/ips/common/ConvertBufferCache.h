@@ -0,0 +1,111 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef CONVERT_BUFFER_CACHE_H
+#define CONVERT_BUFFER_CACHE_H
+
+#include <va/va.h>
+#include <va/va_vpp.h>
+#include <Dump.h>
+#include <BufferMapper.h>
+#include <HwcLayer.h>
+
+namespace android {
+namespace intel {
+
+// Rotated NV12 copies of the YUV layers the overlay can't rotate (I420,
+// YUY2 and UYVY), made by the VSP. The copy is also scaled if the overlay
+// can't scale down that far, which makes it the downscale stage of NV12
+// video too. It is kept while the source buffer doesn't change, so a
+// paused or repeated frame is converted once.
+class ConvertBufferCache {
+public:
+    ConvertBufferCache();
+    ~ConvertBufferCache();
+
+public:
+    // the layer may be shown by the overlay through a converted copy,
+    // read once from hwc.overlay.convert
+    static bool isSupported(HwcLayer *hwcLayer);
+    // the layer may be downscaled by the VSP beyond the overlay limits
+    static bool isDownscaleSupported(HwcLayer *hwcLayer);
+    // VSP copies are allowed and have not failed
+    static bool isEnabled();
+
+    // returns the mapper of the source crop rotated by transform into a
+    // width x height NV12 copy; the conversion is redone only if source is
+    // a different buffer, the geometry changed, bufferChanged is set or
+    // acquireFenceFd is still pending, and waits for acquireFenceFd first
+    BufferMapper* get(BufferMapper& source, int transform,
+                      int width, int height, bool bufferChanged,
+                      int acquireFenceFd);
+    // frees the copies and stops VA
+    void clear();
+
+    void dump(Dump& d);
+
+private:
+    enum {
+        // one copy on screen, one waiting for the flip, one being written
+        CONVERT_BUFFER_COUNT = 3,
+        // the source is still being rendered past this, the layer goes
+        // to GLES for the frame
+        CONVERT_FENCE_TIMEOUT_MS = 50,
+    };
+
+    struct Image {
+        buffer_handle_t handle;
+        BufferMapper *mapper;
+        VASurfaceID surface;
+        uint64_t sourceKey;
+        crop_t sourceCrop;
+        int transform;
+        int width;
+        int height;
+    };
+
+    bool startVA();
+    void stopVA();
+    bool allocImage(Image& image, int width, int height);
+    void freeImage(Image& image);
+    VASurfaceID createSourceSurface(BufferMapper& source);
+    bool convert(BufferMapper& source, Image& image, int transform);
+    static int getVaRotation(int transform);
+
+private:
+    static volatile int32_t sDisabled;
+
+    // VA holds a pointer to the native display
+    int mDisplay;
+    VADisplay mVaDpy;
+    VAConfigID mVaCfg;
+    VAContextID mVaCtx;
+    // render target of the context, not used by the VSP
+    VASurfaceID mDummySurface;
+    bool mVaStarted;
+
+    Image mImages[CONVERT_BUFFER_COUNT];
+    int mCurrent;
+
+    // statistics
+    uint32_t mConversions;
+    uint32_t mReuses;
+    uint32_t mFailures;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* CONVERT_BUFFER_CACHE_H */
@@ -0,0 +1,187 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include <string.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <BufferManager.h>
+#include <hal_public.h>
+#include <common/CursorImageCache.h>
+
+namespace android {
+namespace intel {
+
+// swap color from BGRA to RGBA - alpha is MSB
+static void swizzleRow(uint32_t *dst, const uint32_t *src, int count)
+{
+    int i = 0;
+#ifdef __SSSE3__
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                       10, 9, 8, 11, 14, 13, 12, 15);
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(p, mask));
+    }
+#endif
+    for (; i < count; i++) {
+        uint32_t p = src[i];
+        dst[i] = (p & 0xff00ff00) | ((p & 0xff) << 16) | ((p >> 16) & 0xff);
+    }
+}
+
+CursorImageCache::CursorImageCache()
+    : mCurrent(0)
+{
+    memset(mImages, 0, sizeof(mImages));
+}
+
+CursorImageCache::~CursorImageCache()
+{
+    clear();
+}
+
+bool CursorImageCache::allocImage(Image& image)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    image.handle = bm->allocGrallocBuffer(CURSOR_MAX_SIZE, CURSOR_MAX_SIZE,
+                                          HAL_PIXEL_FORMAT_RGBA_8888,
+                                          GRALLOC_USAGE_SW_WRITE_OFTEN |
+                                          GRALLOC_USAGE_HW_COMPOSER);
+    if (!image.handle) {
+        ETRACE("failed to allocate cursor image");
+        return false;
+    }
+
+    DataBuffer *buffer = bm->lockDataBuffer(image.handle);
+    if (buffer) {
+        image.mapper = bm->map(*buffer);
+        bm->unlockDataBuffer(buffer);
+    }
+
+    if (!image.mapper || !image.mapper->getCpuAddress(0)) {
+        ETRACE("failed to map cursor image");
+        if (image.mapper) {
+            bm->unmap(image.mapper);
+        }
+        bm->freeGrallocBuffer(image.handle);
+        memset(&image, 0, sizeof(image));
+        return false;
+    }
+
+    image.sourceKey = 0;
+    return true;
+}
+
+void CursorImageCache::clear()
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    for (int i = 0; i < CURSOR_IMAGE_COUNT; i++) {
+        Image& image = mImages[i];
+        if (image.mapper) {
+            bm->unmap(image.mapper);
+        }
+        if (image.handle) {
+            bm->freeGrallocBuffer(image.handle);
+        }
+        memset(&image, 0, sizeof(image));
+    }
+    mCurrent = 0;
+}
+
+int CursorImageCache::fitCursorSize(int w, int h)
+{
+    int size = w > h ? w : h;
+    if (size <= 0 || size > CURSOR_MAX_SIZE) {
+        return 0;
+    }
+    if (size <= 64) {
+        return 64;
+    }
+    return size <= 128 ? 128 : 256;
+}
+
+BufferMapper* CursorImageCache::get(BufferMapper& source, const crop_t& crop,
+                                    int cursorSize, bool bufferChanged)
+{
+    // position only updates keep using the converted image
+    Image& current = mImages[mCurrent];
+    if (current.mapper && current.sourceKey == source.getKey() &&
+        current.cursorSize == cursorSize && !bufferChanged) {
+        return current.mapper;
+    }
+
+    if (cursorSize > CURSOR_MAX_SIZE) {
+        ETRACE("invalid cursor size %d", cursorSize);
+        return NULL;
+    }
+
+    // never write to the image on screen
+    int next = (mCurrent + 1) % CURSOR_IMAGE_COUNT;
+    Image& image = mImages[next];
+    if (!image.mapper && !allocImage(image)) {
+        return NULL;
+    }
+
+    uint8_t *src = (uint8_t *)source.getCpuAddress(0);
+    uint8_t *dst = (uint8_t *)image.mapper->getCpuAddress(0);
+    uint32_t srcStride = source.getStride().rgb.stride;
+    // the cursor plane reads rows packed at its own size, not at the
+    // stride of the buffer allocated for the largest one
+    uint32_t dstStride = cursorSize * 4;
+    if (!src) {
+        return NULL;
+    }
+
+    // anything outside the source crop is transparent, the crop goes to
+    // the top left corner of the image
+    int w = crop.w ? crop.w : (int)source.getWidth();
+    int h = crop.h ? crop.h : (int)source.getHeight();
+    if (w > cursorSize)
+        w = cursorSize;
+    if (h > cursorSize)
+        h = cursorSize;
+    if (crop.w && crop.h) {
+        src += crop.y * srcStride + crop.x * 4;
+    }
+
+    bool swizzle = (source.getFormat() == HAL_PIXEL_FORMAT_BGRA_8888);
+    for (int i = 0; i < cursorSize; i++) {
+        uint32_t *dstRow = (uint32_t *)(dst + i * dstStride);
+        if (i >= h) {
+            memset(dstRow, 0, cursorSize * 4);
+            continue;
+        }
+        uint32_t *srcRow = (uint32_t *)(src + i * srcStride);
+        if (swizzle) {
+            swizzleRow(dstRow, srcRow, w);
+        } else {
+            memcpy(dstRow, srcRow, w * 4);
+        }
+        memset(dstRow + w, 0, (cursorSize - w) * 4);
+    }
+
+    image.sourceKey = source.getKey();
+    image.cursorSize = cursorSize;
+    mCurrent = next;
+    return image.mapper;
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,69 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef CURSOR_IMAGE_CACHE_H
+#define CURSOR_IMAGE_CACHE_H
+
+#include <BufferMapper.h>
+#include <DisplayPlane.h>
+
+namespace android {
+namespace intel {
+
+// Private RGBA copies of application cursor buffers. The cursor plane scans
+// out the copy, so BGRA buffers are converted without touching client
+// memory, and a cursor that only moves costs no pixel work.
+class CursorImageCache {
+public:
+    CursorImageCache();
+    ~CursorImageCache();
+
+public:
+    // returns the mapper of the converted image of source; the copy is
+    // redone only if source is a different buffer or bufferChanged is set
+    BufferMapper* get(BufferMapper& source, const crop_t& crop,
+                      int cursorSize, bool bufferChanged);
+    void clear();
+
+    // smallest cursor plane size, 64, 128 or 256, that holds a w x h
+    // image padded with transparent pixels; 0 if it is too big
+    static int fitCursorSize(int w, int h);
+
+private:
+    enum {
+        CURSOR_MAX_SIZE = 256,
+        // one image on screen, one being converted
+        CURSOR_IMAGE_COUNT = 2,
+    };
+
+    struct Image {
+        buffer_handle_t handle;
+        BufferMapper *mapper;
+        uint64_t sourceKey;
+        // rows are packed at cursorSize * 4 bytes
+        int cursorSize;
+    };
+
+    bool allocImage(Image& image);
+
+private:
+    Image mImages[CURSOR_IMAGE_COUNT];
+    int mCurrent;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* CURSOR_IMAGE_CACHE_H */
@@ -0,0 +1,85 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef CURSOR_POSITION_MAILBOX_H
+#define CURSOR_POSITION_MAILBOX_H
+
+#include <stdint.h>
+#include <cutils/atomic.h>
+
+namespace android {
+namespace intel {
+
+// Latest-value mailbox for the cursor position register. post() may be
+// called from any thread and never blocks; take() hands the most recent
+// value out once, so a burst of input events costs one register write.
+class CursorPositionMailbox {
+public:
+    CursorPositionMailbox()
+        : mPosition(0),
+          mPosted(0),
+          mTaken(0) {
+    }
+
+public:
+    void post(int x, int y) {
+        android_atomic_release_store((int32_t)encode(x, y), &mPosition);
+        android_atomic_inc(&mPosted);
+    }
+
+    bool take(uint32_t& pos) {
+        int32_t posted = android_atomic_acquire_load(&mPosted);
+        int32_t taken = android_atomic_acquire_load(&mTaken);
+        if (posted == taken) {
+            return false;
+        }
+        // another consumer got it first
+        if (android_atomic_cmpxchg(taken, posted, &mTaken)) {
+            return false;
+        }
+        pos = (uint32_t)android_atomic_acquire_load(&mPosition);
+        return true;
+    }
+
+    // cursor position register layout, sign bits 15 and 31
+    static uint32_t encode(int x, int y) {
+        uint32_t pos = 0;
+        if (x < 0) {
+            pos |= 1 << 15;
+            x = -x;
+        }
+        if (y < 0) {
+            pos |= 1U << 31;
+            y = -y;
+        }
+        return pos | (y & 0xfff) << 16 | (x & 0xfff);
+    }
+
+    // stores pos in the position field of a plane context, which the
+    // vsync thread and the commit both write while a post may read it
+    static void publish(uint32_t& field, uint32_t pos) {
+        android_atomic_release_store((int32_t)pos, (volatile int32_t *)&field);
+    }
+
+private:
+    volatile int32_t mPosition;
+    volatile int32_t mPosted;
+    volatile int32_t mTaken;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* CURSOR_POSITION_MAILBOX_H */
@@ -0,0 +1,112 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <hal_public.h>
+#include <OMX_IVCommon.h>
+#include <OMX_IntelVideoExt.h>
+#include <Drm.h>
+#include <DisplayPlane.h>
+#include <common/PixelFormat.h>
+#include <common/FormatTable.h>
+
+namespace android {
+namespace intel {
+
+#define SPRITE_PLANES  ((1 << DisplayPlane::PLANE_SPRITE) | (1 << DisplayPlane::PLANE_PRIMARY))
+#define OVERLAY_PLANES (1 << DisplayPlane::PLANE_OVERLAY)
+
+// in the order of getIndex()
+const FormatTable::Descriptor FormatTable::sDescriptors[] = {
+    { HAL_PIXEL_FORMAT_RGBA_8888, FORMAT_RGB, SPRITE_PLANES, 4,
+      PixelFormat::PLANE_PIXEL_FORMAT_RGBA8888, 0 },
+    { HAL_PIXEL_FORMAT_RGBX_8888, FORMAT_RGB, SPRITE_PLANES, 4,
+      PixelFormat::PLANE_PIXEL_FORMAT_RGBX8888, DRM_FORMAT_XRGB8888 },
+    { HAL_PIXEL_FORMAT_BGRX_8888, FORMAT_RGB, SPRITE_PLANES, 4,
+      PixelFormat::PLANE_PIXEL_FORMAT_BGRX8888, 0 },
+    { HAL_PIXEL_FORMAT_BGRA_8888, FORMAT_RGB, SPRITE_PLANES, 4,
+      PixelFormat::PLANE_PIXEL_FORMAT_BGRA8888, 0 },
+    { HAL_PIXEL_FORMAT_RGB_565, FORMAT_RGB, SPRITE_PLANES, 2,
+      PixelFormat::PLANE_PIXEL_FORMAT_BGRX565, 0 },
+    { HAL_PIXEL_FORMAT_YV12, FORMAT_YUV_PLANAR | FORMAT_VIDEO, OVERLAY_PLANES, 1,
+      0, 0 },
+    { HAL_PIXEL_FORMAT_I420, FORMAT_YUV_PLANAR | FORMAT_OVERLAY_NO_ROTATION,
+      OVERLAY_PLANES, 1, 0, 0 },
+    { HAL_PIXEL_FORMAT_NV12, FORMAT_YUV_PLANAR, OVERLAY_PLANES, 1,
+      0, 0 },
+    { HAL_PIXEL_FORMAT_YUY2, FORMAT_YUV_PACKED | FORMAT_OVERLAY_NO_ROTATION,
+      OVERLAY_PLANES, 2, 0, 0 },
+    { HAL_PIXEL_FORMAT_UYVY, FORMAT_YUV_PACKED | FORMAT_OVERLAY_NO_ROTATION,
+      OVERLAY_PLANES, 2, 0, 0 },
+    { OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar,
+      FORMAT_YUV_PLANAR | FORMAT_VIDEO, OVERLAY_PLANES, 1, 0, 0 },
+    { OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled,
+      FORMAT_YUV_PLANAR | FORMAT_VIDEO, OVERLAY_PLANES, 1, 0, 0 },
+};
+
+int FormatTable::getIndex(uint32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+        return 0;
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+        return 1;
+    case HAL_PIXEL_FORMAT_BGRX_8888:
+        return 2;
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        return 3;
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return 4;
+    case HAL_PIXEL_FORMAT_YV12:
+        return 5;
+    case HAL_PIXEL_FORMAT_I420:
+        return 6;
+    case HAL_PIXEL_FORMAT_NV12:
+        return 7;
+    case HAL_PIXEL_FORMAT_YUY2:
+        return 8;
+    case HAL_PIXEL_FORMAT_UYVY:
+        return 9;
+    case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
+        return 10;
+    case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
+        return 11;
+    default:
+        return -1;
+    }
+}
+
+const FormatTable::Descriptor* FormatTable::get(uint32_t format)
+{
+    int index = getIndex(format);
+    if (index < 0) {
+        return NULL;
+    }
+    return &sDescriptors[index];
+}
+
+bool FormatTable::isPlaneSupported(uint32_t format, int planeType)
+{
+    const Descriptor *desc = get(format);
+    return desc && (desc->planes & (1 << planeType));
+}
+
+bool FormatTable::hasFlags(uint32_t format, uint32_t flags)
+{
+    const Descriptor *desc = get(format);
+    return desc && (desc->flags & flags) == flags;
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,70 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef FORMAT_TABLE_H
+#define FORMAT_TABLE_H
+
+#include <stdint.h>
+
+namespace android {
+namespace intel {
+
+// What the planes need to know about a gralloc format, kept in one static
+// table. A lookup maps the format to its index in the table with a single
+// switch, so a new format is added in FormatTable.cpp only.
+class FormatTable {
+public:
+    enum {
+        FORMAT_RGB = 1 << 0,
+        FORMAT_YUV_PACKED = 1 << 1,
+        // planar or semi planar
+        FORMAT_YUV_PLANAR = 1 << 2,
+        // decoder output
+        FORMAT_VIDEO = 1 << 3,
+        // the overlay can't rotate it, see ConvertBufferCache
+        FORMAT_OVERLAY_NO_ROTATION = 1 << 4,
+    };
+
+    struct Descriptor {
+        uint32_t format;
+        uint32_t flags;
+        // bit (1 << DisplayPlane::PLANE_*) set for the planes that can
+        // scan it out
+        uint32_t planes;
+        // bytes per pixel of the first plane
+        int bpp;
+        // DSPACNTR pixel format of the sprite planes, 0 if none
+        uint32_t spriteFormat;
+        // DRM fourcc of a framebuffer of this format, 0 if none
+        uint32_t drmFormat;
+    };
+
+public:
+    // NULL if no plane knows the format
+    static const Descriptor* get(uint32_t format);
+    static bool isPlaneSupported(uint32_t format, int planeType);
+    static bool hasFlags(uint32_t format, uint32_t flags);
+
+private:
+    static int getIndex(uint32_t format);
+
+private:
+    static const Descriptor sDescriptors[];
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* FORMAT_TABLE_H */
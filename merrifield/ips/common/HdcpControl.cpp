@@ -30,18 +30,25 @@ HdcpControl::HdcpControl()
       mUserData(NULL),
       mCallbackState(CALLBACK_PENDING),
       mMutex(),
-      mStoppedCondition(),
       mCompletedCondition(),
       mWaitForCompletion(false),
-      mStopped(true),
-      mAuthenticated(false),
+      mState(STATE_STOPPED),
+      mSession(0),
       mActionDelay(0),
-      mAuthRetryCount(0)
+      mAuthRetryCount(0),
+      mActionTimer(-1),
+      mAuthStartTime(0),
+      mStats()
 {
 }
 
 HdcpControl::~HdcpControl()
 {
+    // waits for an action running on the event loop
+    if (mActionTimer >= 0) {
+        Hwcomposer::getInstance().getEventLoop()->removeTimer(mActionTimer);
+        mActionTimer = -1;
+    }
 }
 
 bool HdcpControl::startHdcp()
@@ -57,48 +64,41 @@ bool HdcpControl::startHdcp()
         }
     }
 
-    if (!mStopped) {
+    if (mState != STATE_STOPPED) {
         WTRACE("HDCP has been started");
         return true;
     }
 
-    mStopped = false;
-    mAuthenticated = false;
+    mSession++;
+    mStats.sessions++;
+    mState = STATE_AUTHENTICATING;
+    mAuthStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mAuthRetryCount = 0;
     mWaitForCompletion = false;
 
-    mThread = new HdcpControlThread(this);
-    if (!mThread.get()) {
-        ETRACE("failed to create hdcp control thread");
-        return false;
-    }
+    mStats.attempts++;
+    setAuthenticated(runHdcp());
 
-    if (!runHdcp()) {
-        ETRACE("failed to run HDCP");
-        mStopped = true;
-        mThread = NULL;
+    if (!scheduleAction()) {
+        mState = STATE_STOPPED;
         return false;
     }
 
-    mAuthRetryCount = 0;
-    mWaitForCompletion = !mAuthenticated;
-    if (mAuthenticated) {
-        mActionDelay = HDCP_VERIFICATION_DELAY_MS;
-    } else {
-        mActionDelay = HDCP_AUTHENTICATION_SHORT_DELAY_MS;
-    }
-
-    mThread->run("HdcpControl", PRIORITY_NORMAL);
-
-    if (!mWaitForCompletion) {
-        // HDCP is authenticated.
+    if (mState == STATE_AUTHENTICATED) {
         return true;
     }
+    if (Hwcomposer::getInstance().getEventLoop()->isLoopThread()) {
+        // the retries run on this thread, can't wait for them
+        WTRACE("HDCP is not authenticated yet");
+        return false;
+    }
+    mWaitForCompletion = true;
     status_t err = mCompletedCondition.waitRelative(mMutex, milliseconds(HDCP_AUTHENTICATION_TIMEOUT_MS));
     if (err == -ETIMEDOUT) {
         WTRACE("timeout waiting for completion");
     }
     mWaitForCompletion = false;
-    return mAuthenticated;
+    return mState == STATE_AUTHENTICATED;
 }
 
 bool HdcpControl::startHdcpAsync(HdcpStatusCallback cb, void *userData)
@@ -118,54 +118,83 @@ bool HdcpControl::startHdcpAsync(HdcpStatusCallback cb, void *userData)
 
     Mutex::Autolock lock(mMutex);
 
-    if (!mStopped) {
+    if (mState != STATE_STOPPED) {
         WTRACE("HDCP has been started");
         return true;
     }
 
-    mThread = new HdcpControlThread(this);
-    if (!mThread.get()) {
-        ETRACE("failed to create hdcp control thread");
-        return false;
-    }
-
+    mSession++;
+    mStats.sessions++;
+    mState = STATE_AUTHENTICATING;
+    mAuthStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
     mAuthRetryCount = 0;
     mCallback = cb;
     mUserData = userData;
     mCallbackState = CALLBACK_PENDING;
     mWaitForCompletion = false;
-    mAuthenticated = false;
-    mStopped = false;
     mActionDelay = HDCP_ASYNC_START_DELAY_MS;
-    mThread->run("HdcpControl", PRIORITY_NORMAL);
+    if (!scheduleAction()) {
+        mState = STATE_STOPPED;
+        mCallback = NULL;
+        mUserData = NULL;
+        return false;
+    }
 
     return true;
 }
 
 bool HdcpControl::stopHdcp()
 {
-    do {
+    int timer;
+    {
         Mutex::Autolock lock(mMutex);
-        if (mStopped) {
+        if (mState == STATE_STOPPED) {
             return true;
         }
 
-        mStopped = true;
-        mStoppedCondition.signal();
+        // the result of an attempt still running on the event loop belongs
+        // to an older session and is dropped
+        mState = STATE_STOPPED;
+        mSession++;
+        timer = mActionTimer;
+        mActionTimer = -1;
 
-        mAuthenticated = false;
+        // a synchronous start waiting for authentication gives up
+        mCompletedCondition.signal();
         mWaitForCompletion = false;
         mCallback = NULL;
         mUserData = NULL;
+    }
+
+    // waits for an attempt in flight, unlocked as it takes mMutex to
+    // complete, so that authentication isn't enabled after it's disabled
+    Hwcomposer::getInstance().getEventLoop()->removeTimer(timer);
+
+    Mutex::Autolock lock(mMutex);
+    if (mState == STATE_STOPPED) {
         disableAuthentication();
-    } while (0);
+    }
+    return true;
+}
 
-    if (mThread.get()) {
-        mThread->requestExitAndWait();
-        mThread = NULL;
+bool HdcpControl::scheduleAction()
+{
+    EventLoop *loop = Hwcomposer::getInstance().getEventLoop();
+    if (mActionTimer < 0) {
+        mActionTimer = loop->addTimer(ms2ns(mActionDelay), 0, actionTimerExpired, this);
+        if (mActionTimer < 0) {
+            ETRACE("failed to create hdcp action timer");
+            return false;
+        }
+        return true;
     }
+    return loop->setTimer(mActionTimer, ms2ns(mActionDelay), 0);
+}
 
-    return true;
+void HdcpControl::actionTimerExpired(int timer, void *data)
+{
+    HdcpControl *control = (HdcpControl *)data;
+    control->runAction();
 }
 
 bool HdcpControl::enableAuthentication()
@@ -251,55 +280,24 @@ bool HdcpControl::checkAuthenticated()
     }
     if (match) {
         VTRACE("HDCP is authenticated");
-        mAuthenticated = true;
-    } else {
-        ETRACE("HDCP is not authenticated");
-        mAuthenticated = false;
+        return true;
     }
-    return mAuthenticated;
+    ETRACE("HDCP is not authenticated");
+    return false;
 }
 
 bool HdcpControl::runHdcp()
 {
-    // Default return value is true so HDCP can be re-authenticated in the working thread
-    bool ret = true;
-
+    // one attempt, retries are scheduled on the action timer so a stop
+    // never waits out a retry delay
     preRunHdcp();
-
-    for (int i = 0; i < HDCP_INLOOP_RETRY_NUMBER; i++) {
-        VTRACE("enable and verify HDCP, iteration# %d", i);
-        if (mStopped) {
-            WTRACE("HDCP authentication has been stopped");
-            ret = false;
-            break;
-        }
-
-        if (!enableAuthentication()) {
-            ETRACE("HDCP authentication failed. Retry");
-            mAuthenticated = false;
-            ret = true;
-        } else {
-            ITRACE("HDCP is authenticated");
-            mAuthenticated = true;
-            ret = true;
-            break;
-        }
-
-        if (mStopped) {
-            WTRACE("HDCP authentication has been stopped");
-            ret = false;
-            break;
-        }
-
-        if (i < HDCP_INLOOP_RETRY_NUMBER - 1) {
-            // Adding delay to make sure panel receives video signal so it can start HDCP authentication.
-            // (HDCP spec 1.3, section 2.3)
-            usleep(HDCP_INLOOP_RETRY_DELAY_US);
-        }
+    bool ret = enableAuthentication();
+    if (ret) {
+        ITRACE("HDCP is authenticated");
+    } else {
+        ETRACE("HDCP authentication failed. Retry");
     }
-
     postRunHdcp();
-
     return ret;
 }
 
@@ -319,36 +317,77 @@ bool HdcpControl::postRunHdcp()
 void HdcpControl::signalCompletion()
 {
     if (mWaitForCompletion) {
-        ITRACE("signal HDCP authentication completed, status = %d", mAuthenticated);
+        ITRACE("signal HDCP authentication completed, status = %d",
+               mState == STATE_AUTHENTICATED);
         mCompletedCondition.signal();
         mWaitForCompletion = false;
     }
 }
 
-bool HdcpControl::threadLoop()
+void HdcpControl::runAction()
 {
-    Mutex::Autolock lock(mMutex);
-    status_t err = mStoppedCondition.waitRelative(mMutex, milliseconds(mActionDelay));
-    if (err != -ETIMEDOUT) {
-        ITRACE("Hdcp is stopped.");
-        signalCompletion();
-        return false;
+    int state;
+    uint32_t session;
+    {
+        Mutex::Autolock lock(mMutex);
+        if (mState == STATE_STOPPED) {
+            return;
+        }
+        state = mState;
+        session = mSession;
+        if (state == STATE_AUTHENTICATING) {
+            mStats.attempts++;
+        }
     }
 
-    // default is to keep thread active
-    bool ret = true;
-    if (!mAuthenticated) {
-        ret = runHdcp();
-        mAuthRetryCount++;
+    // the ioctls run unlocked so stopHdcp() returns at once on unplug
+    bool authenticated;
+    if (state == STATE_AUTHENTICATING) {
+        authenticated = runHdcp();
     } else {
-        mAuthRetryCount = 0;
-        checkAuthenticated();
+        authenticated = checkAuthenticated();
     }
 
-    // set next action delay
-    if (mAuthenticated) {
+    Mutex::Autolock lock(mMutex);
+    if (session != mSession) {
+        // stopped during the attempt, stopHdcp() disables authentication
+        // once this returns
+        mStats.staleResults++;
+        return;
+    }
+
+    setAuthenticated(authenticated);
+    scheduleAction();
+}
+
+void HdcpControl::setAuthenticated(bool authenticated)
+{
+    // called with mMutex held
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (authenticated) {
+        if (mState == STATE_AUTHENTICATING) {
+            nsecs_t latency = now - mAuthStartTime;
+            mStats.authentications++;
+            mStats.lastLatency = latency;
+            mStats.totalLatency += latency;
+            if (latency > mStats.maxLatency) {
+                mStats.maxLatency = latency;
+            }
+            ITRACE("HDCP authenticated in %lld ms, %u attempts",
+                   ns2ms(latency), mAuthRetryCount + 1);
+        }
+        mState = STATE_AUTHENTICATED;
+        mAuthRetryCount = 0;
         mActionDelay = HDCP_VERIFICATION_DELAY_MS;
     } else {
+        if (mState == STATE_AUTHENTICATED) {
+            WTRACE("HDCP link is lost");
+            mStats.linkLosses++;
+            mAuthStartTime = now;
+        } else {
+            mAuthRetryCount++;
+        }
+        mState = STATE_AUTHENTICATING;
         // If HDCP can not authenticate after "HDCP_RETRY_LIMIT" attempts
         // reduce HDCP retry frequency to 2 sec
         if (mAuthRetryCount >= HDCP_RETRY_LIMIT) {
@@ -358,22 +397,48 @@ bool HdcpControl::threadLoop()
         }
     }
 
-    // TODO: move out of lock?
-    if (!ret || mAuthenticated) {
+    if (authenticated) {
         signalCompletion();
     }
 
     if (mCallback) {
-         if ((mAuthenticated && mCallbackState == CALLBACK_AUTHENTICATED) ||
-            (!mAuthenticated && mCallbackState == CALLBACK_NOT_AUTHENTICATED)) {
+        if ((authenticated && mCallbackState == CALLBACK_AUTHENTICATED) ||
+            (!authenticated && mCallbackState == CALLBACK_NOT_AUTHENTICATED)) {
             // ignore callback as state is not changed
         } else {
             mCallbackState =
-                mAuthenticated ? CALLBACK_AUTHENTICATED : CALLBACK_NOT_AUTHENTICATED;
-            (*mCallback)(mAuthenticated, mUserData);
+                authenticated ? CALLBACK_AUTHENTICATED : CALLBACK_NOT_AUTHENTICATED;
+            (*mCallback)(authenticated, mUserData);
         }
     }
-    return ret;
+}
+
+const char* HdcpControl::getStateName() const
+{
+    switch (mState) {
+    case STATE_STOPPED:
+        return "stopped";
+    case STATE_AUTHENTICATING:
+        return "authenticating";
+    case STATE_AUTHENTICATED:
+        return "authenticated";
+    default:
+        return "unknown";
+    }
+}
+
+void HdcpControl::dump(Dump& d)
+{
+    Mutex::Autolock lock(mMutex);
+    d.append("HDCP: %s, retries %u, sessions %u, attempts %u\n",
+             getStateName(), mAuthRetryCount, mStats.sessions, mStats.attempts);
+    d.append("    authenticated %u, link losses %u, stale attempts %u\n",
+             mStats.authentications, mStats.linkLosses, mStats.staleResults);
+    nsecs_t average = mStats.authentications ?
+            mStats.totalLatency / mStats.authentications : 0;
+    d.append("    latency (ms): last %lld, avg %lld, max %lld\n",
+             ns2ms(mStats.lastLatency), ns2ms(average),
+             ns2ms(mStats.maxLatency));
 }
 
 } // namespace intel
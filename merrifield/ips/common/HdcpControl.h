@@ -17,7 +17,8 @@
 #define HDCP_CONTROL_H
 
 #include <IHdcpControl.h>
-#include <SimpleThread.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
 
 namespace android {
 namespace intel {
@@ -31,25 +32,32 @@ public:
     virtual bool startHdcp();
     virtual bool startHdcpAsync(HdcpStatusCallback cb, void *userData);
     virtual bool stopHdcp();
+    virtual void dump(Dump& d);
 
 protected:
-    bool enableAuthentication();
-    bool disableAuthentication();
+    // driver requests, overridden by the mock platform
+    virtual bool enableAuthentication();
+    virtual bool disableAuthentication();
     bool enableOverlay();
     bool disableOverlay();
-    bool enableDisplayIED();
-    bool disableDisplayIED();
-    bool isHdcpSupported();
-    bool checkAuthenticated();
+    virtual bool enableDisplayIED();
+    virtual bool disableDisplayIED();
+    virtual bool isHdcpSupported();
+    virtual bool checkAuthenticated();
     virtual bool preRunHdcp();
     virtual bool postRunHdcp();
     bool runHdcp();
     inline void signalCompletion();
+    // authentication and link checks run on a timer of the event loop
+    bool scheduleAction();
+    static void actionTimerExpired(int timer, void *data);
+    void runAction();
+    // moves the state machine on the result of an attempt or link check
+    void setAuthenticated(bool authenticated);
+    const char* getStateName() const;
 
 private:
     enum {
-        HDCP_INLOOP_RETRY_NUMBER = 1,
-        HDCP_INLOOP_RETRY_DELAY_US = 50000,
         HDCP_VERIFICATION_DELAY_MS = 2000,
         HDCP_ASYNC_START_DELAY_MS = 100,
         HDCP_AUTHENTICATION_SHORT_DELAY_MS = 200,
@@ -64,21 +72,48 @@ private:
         CALLBACK_NOT_AUTHENTICATED,
     };
 
+    enum {
+        // no session, the action timer is disarmed
+        STATE_STOPPED = 0,
+        // authentication is retried on the action timer
+        STATE_AUTHENTICATING,
+        // the link is verified on the action timer
+        STATE_AUTHENTICATED,
+    };
+
+    struct AuthStats {
+        AuthStats()
+            : sessions(0), attempts(0), authentications(0), linkLosses(0),
+              staleResults(0), lastLatency(0), maxLatency(0),
+              totalLatency(0) {}
+        uint32_t sessions;
+        uint32_t attempts;
+        uint32_t authentications;
+        uint32_t linkLosses;
+        // attempts still running when the session was stopped
+        uint32_t staleResults;
+        nsecs_t lastLatency;
+        nsecs_t maxLatency;
+        nsecs_t totalLatency;
+    };
+
 protected:
     HdcpStatusCallback mCallback;
     void *mUserData;
     int mCallbackState;
     Mutex mMutex;
-    Condition mStoppedCondition;
     Condition mCompletedCondition;
     bool mWaitForCompletion;
-    bool mStopped;
-    bool mAuthenticated;
+    int mState;
+    // bumped by every start and stop, an attempt of an older session is
+    // dropped when it completes
+    uint32_t mSession;
     int mActionDelay;  // in milliseconds
     uint32_t mAuthRetryCount;
-
-private:
-    DECLARE_THREAD(HdcpControlThread, HdcpControl);
+    int mActionTimer;
+    // when the current authentication began
+    nsecs_t mAuthStartTime;
+    AuthStats mStats;
 };
 
 } // namespace intel
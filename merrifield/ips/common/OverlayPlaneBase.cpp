@@ -15,6 +15,11 @@
 */
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sync/sync.h>
+#include <cutils/properties.h>
 #include <HwcTrace.h>
 #include <Drm.h>
 #include <Hwcomposer.h>
@@ -23,6 +28,9 @@
 #include <common/TTMBufferMapper.h>
 #include <common/GrallocSubBuffer.h>
 #include <DisplayQuery.h>
+#include <MemoryAccounting.h>
+#include <TuningPolicy.h>
+#include <DisplayCalibration.h>
 
 
 // FIXME: remove it
@@ -37,15 +45,37 @@ OverlayPlaneBase::OverlayPlaneBase(int index, int disp)
       mTTMBuffers(),
       mActiveTTMBuffers(),
       mCurrent(0),
+      mBackBufferCount(OVERLAY_BACK_BUFFER_COUNT),
+      mFlippedBuffer(-1),
+      mShownBuffer(-1),
       mWsbm(0),
+      mTTMMapperPool(0),
+      mSlabAllocator(0),
       mPipeConfig(0),
       mBobDeinterlace(0),
-      mUseScaledBuffer(0)
+      mUseScaledBuffer(0),
+      mUseConvertedBuffer(false),
+      mConvertCache(),
+      mFrameRepeated(false),
+      mRepeatSkips(0),
+      mFrameHolds(0),
+      mBusySkips(0),
+      mBusyWaits(0),
+      mCadence(),
+      mCoeffCacheClock(0),
+      mColorSetups(0),
+      mColorSkips(0),
+      mBackBufferLastUse(0),
+      mBackBufferReleases(0)
 {
     CTRACE();
     for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
         mBackBuffer[i] = 0;
+        mRetireFence[i] = -1;
     }
+    memset(mCoeffCache, 0, sizeof(mCoeffCache));
+    memset(mBackBufferGeometry, 0, sizeof(mBackBufferGeometry));
+    memset(mBackBufferColor, 0, sizeof(mBackBufferColor));
 }
 
 OverlayPlaneBase::~OverlayPlaneBase()
@@ -77,15 +107,36 @@ bool OverlayPlaneBase::initialize(uint32_t bufferCount)
         DEINIT_AND_RETURN_FALSE("failed to create wsbm");
     }
 
+    // rotation and scaling buffers are wrapped once for all overlays
+    if (!TTMMapperPool::getInstance().initialize(drm->getDrmFd())) {
+        DEINIT_AND_RETURN_FALSE("failed to initialize TTM mapper pool");
+    }
+    mTTMMapperPool = &TTMMapperPool::getInstance();
+
+    // back buffers come out of shared slabs, one TTM object for many planes
+    if (TTMSlabAllocator::getInstance().initialize(drm->getDrmFd())) {
+        mSlabAllocator = &TTMSlabAllocator::getInstance();
+    } else {
+        WTRACE("failed to initialize slab allocator");
+    }
+
     // create overlay back buffer
-    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
-        mBackBuffer[i] = createBackBuffer();
-        if (!mBackBuffer[i]) {
-            DEINIT_AND_RETURN_FALSE("failed to create overlay back buffer");
-        }
-        // reset back buffer
-        resetBackBuffer(i);
+    mBackBufferCount = getBackBufferCount();
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("hwc.overlay.shallow", prop, "0") > 0 && atoi(prop) &&
+        mBackBufferCount > OVERLAY_SHALLOW_BACK_BUFFER_COUNT) {
+        mBackBufferCount = OVERLAY_SHALLOW_BACK_BUFFER_COUNT;
     }
+    if (mBackBufferCount < 1 || mBackBufferCount > OVERLAY_BACK_BUFFER_COUNT) {
+        DEINIT_AND_RETURN_FALSE("invalid back buffer count %d", mBackBufferCount);
+    }
+    ITRACE("overlay %d uses %d back buffers", mIndex, mBackBufferCount);
+
+    // back buffers are created when the plane is first assigned, a unit
+    // that never shows video never allocates them
+
+    // compute the coefficients of the most common scaling ratios up front
+    prewarmCoeffCache();
 
     // disable overlay when created
     flush(PLANE_DISABLE);
@@ -131,23 +182,44 @@ void OverlayPlaneBase::deinitialize()
         invalidateActiveTTMBuffers();
     }
 
+    if (mTTMMapperPool) {
+        mTTMMapperPool->deinitialize();
+        mTTMMapperPool = 0;
+    }
+
     // delete back buffer
-    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
-        if (mBackBuffer[i]) {
-            deleteBackBuffer(i);
-            mBackBuffer[i] = NULL;
-        }
+    freeBackBuffers();
+    if (mSlabAllocator) {
+        mSlabAllocator->deinitialize();
+        mSlabAllocator = 0;
     }
+    mConvertCache.clear();
     DEINIT_AND_DELETE_OBJ(mWsbm);
 
     DisplayPlane::deinitialize();
 }
 
+void OverlayPlaneBase::dump(Dump& d)
+{
+    DisplayPlane::dump(d);
+    d.append("      color setups %u, skipped %u, repeated frames kept %u, held %u\n",
+             mColorSetups, mColorSkips, mRepeatSkips, mFrameHolds);
+    d.append("      back buffers %s, released idle %u\n",
+             mBackBuffer[0] ? "allocated" : "none", mBackBufferReleases);
+    if (mBusySkips || mBusyWaits) {
+        d.append("      busy scaled buffers skipped %u, waited for %u\n",
+                 mBusySkips, mBusyWaits);
+    }
+    mCadence.dump(d);
+    mConvertCache.dump(d);
+}
+
 void OverlayPlaneBase::invalidateBufferCache()
 {
     // clear plane buffer cache
     DisplayPlane::invalidateBufferCache();
     invalidateTTMBuffers();
+    mConvertCache.clear();
 }
 
 bool OverlayPlaneBase::assignToDevice(int disp)
@@ -167,6 +239,12 @@ bool OverlayPlaneBase::assignToDevice(int disp)
         break;
     }
 
+    if (!allocateBackBuffers()) {
+        ETRACE("failed to allocate back buffers of overlay %d", mIndex);
+        return false;
+    }
+    mBackBufferLastUse = systemTime(SYSTEM_TIME_MONOTONIC);
+
     // if pipe switching happened, then disable overlay first
     if (mPipeConfig != pipeConfig) {
         DTRACE("overlay %d switched from %d to %d", mIndex, mDevice, disp);
@@ -176,6 +254,9 @@ bool OverlayPlaneBase::assignToDevice(int disp)
     mPipeConfig = pipeConfig;
     DisplayPlane::assignToDevice(disp);
 
+    // mode and panel orientation may have changed
+    invalidateBackBufferGeometry();
+
     enable();
 
     return true;
@@ -200,7 +281,9 @@ void OverlayPlaneBase::setZOrderConfig(ZOrderConfig& zorderConfig,
         }
     }
 
-    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
+    for (int i = 0; i < mBackBufferCount; i++) {
+        if (!mBackBuffer[i])
+            return;
         OverlayBackBufferBlk *backBuffer = mBackBuffer[i]->buf;
         if (!backBuffer)
             return;
@@ -220,22 +303,32 @@ bool OverlayPlaneBase::reset()
 
     DisplayPlane::reset();
 
-    // invalidate active TTM buffers
+    // drop the pool references of the TTM buffers, the pool keeps them
+    // wrapped for the next user
+    invalidateTTMBuffers();
     if (mActiveTTMBuffers.size() > 0) {
         invalidateActiveTTMBuffers();
     }
 
     // reset back buffers
-    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
+    closeRetireFences();
+    for (int i = 0; i < mBackBufferCount; i++) {
         resetBackBuffer(i);
     }
+    invalidateBackBufferGeometry();
+    mCadence.reset();
+
+    // the plane may not show a converted layer again for a while
+    mConvertCache.clear();
     return true;
 }
 
 bool OverlayPlaneBase::enable()
 {
     RETURN_FALSE_IF_NOT_INIT();
-    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
+    for (int i = 0; i < mBackBufferCount; i++) {
+        if (!mBackBuffer[i])
+            return false;
         OverlayBackBufferBlk *backBuffer = mBackBuffer[i]->buf;
         if (!backBuffer)
             return false;
@@ -254,7 +347,10 @@ bool OverlayPlaneBase::enable()
 bool OverlayPlaneBase::disable()
 {
     RETURN_FALSE_IF_NOT_INIT();
-    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
+    for (int i = 0; i < mBackBufferCount; i++) {
+        // released back buffers were disabled before
+        if (!mBackBuffer[i])
+            return true;
         OverlayBackBufferBlk *backBuffer = mBackBuffer[i]->buf;
         if (!backBuffer)
             return false;
@@ -281,22 +377,35 @@ OverlayBackBuffer* OverlayPlaneBase::createBackBuffer()
         return 0;
     }
 
-
-    int size = sizeof(OverlayBackBufferBlk);
-    int alignment = 64 * 1024;
+    void *virtAddr = 0;
+    uint32_t gttOffsetInPage = 0;
     void *wsbmBufferObject = 0;
-    bool ret = mWsbm->allocateTTMBuffer(size, alignment, &wsbmBufferObject);
-    if (ret == false) {
-        ETRACE("failed to allocate TTM buffer");
-        return 0;
+    int slot = -1;
+
+    if (mSlabAllocator && sizeof(OverlayBackBufferBlk) <= TTMSlabAllocator::SLOT_SIZE) {
+        slot = mSlabAllocator->allocate(&virtAddr, &gttOffsetInPage);
     }
 
-    void *virtAddr = mWsbm->getCPUAddress(wsbmBufferObject);
-    uint32_t gttOffsetInPage = mWsbm->getGttOffset(wsbmBufferObject);
+    if (slot < 0) {
+        // dedicated TTM buffer
+        int size = sizeof(OverlayBackBufferBlk);
+        int alignment = 64 * 1024;
+        bool ret = mWsbm->allocateTTMBuffer(size, alignment, &wsbmBufferObject);
+        if (ret == false) {
+            ETRACE("failed to allocate TTM buffer");
+            free(backBuffer);
+            return 0;
+        }
+
+        virtAddr = mWsbm->getCPUAddress(wsbmBufferObject);
+        gttOffsetInPage = mWsbm->getGttOffset(wsbmBufferObject);
+        MemoryAccounting::add(MemoryAccounting::OVERLAY_BACK_BUFFER, size);
+    }
 
     backBuffer->buf = (OverlayBackBufferBlk *)virtAddr;
     backBuffer->gttOffsetInPage = gttOffsetInPage;
     backBuffer->bufObject = wsbmBufferObject;
+    backBuffer->slot = slot;
 
     VTRACE("cpu %p, gtt %d", virtAddr, gttOffsetInPage);
 
@@ -308,10 +417,16 @@ void OverlayPlaneBase::deleteBackBuffer(int buf)
     if (!mBackBuffer[buf])
         return;
 
-    void *wsbmBufferObject = mBackBuffer[buf]->bufObject;
-    bool ret = mWsbm->destroyTTMBuffer(wsbmBufferObject);
-    if (ret == false) {
-        WTRACE("failed to destroy TTM buffer");
+    if (mBackBuffer[buf]->slot >= 0) {
+        mSlabAllocator->release(mBackBuffer[buf]->slot);
+    } else {
+        void *wsbmBufferObject = mBackBuffer[buf]->bufObject;
+        bool ret = mWsbm->destroyTTMBuffer(wsbmBufferObject);
+        if (ret == false) {
+            WTRACE("failed to destroy TTM buffer");
+        }
+        MemoryAccounting::remove(MemoryAccounting::OVERLAY_BACK_BUFFER,
+                                 sizeof(OverlayBackBufferBlk));
     }
     // free back buffer
     free(mBackBuffer[buf]);
@@ -351,10 +466,8 @@ BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct
     int srcX, srcY, srcW, srcH;
     int tmp;
 
-    DataBuffer *buf;
     ssize_t index;
-    TTMBufferMapper *mapper;
-    bool ret;
+    BufferMapper *mapper;
 
     if (!payload) {
         ETRACE("invalid payload buffer");
@@ -374,7 +487,7 @@ BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct
     }
     index = mTTMBuffers.indexOfKey(khandle);
     if (index < 0) {
-        VTRACE("unmapped TTM buffer, will map it");
+        VTRACE("TTM buffer not used by this plane yet");
 
         if (mUseScaledBuffer) {
             w = payload->scaling_width;
@@ -391,107 +504,86 @@ BufferMapper* OverlayPlaneBase::getTTMMapper(BufferMapper& grallocMapper, struct
         if (payload->tiling)
             format = OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled;
 
-        // calculate stride
-        switch (format) {
-        case HAL_PIXEL_FORMAT_YV12:
-        case HAL_PIXEL_FORMAT_I420:
-            uint32_t yStride_align;
-            yStride_align = DisplayQuery::getOverlayLumaStrideAlignment(grallocMapper.getFormat());
-            if (yStride_align > 0)
-            {
-                yStride = align_to(align_to(w, 32), yStride_align);
-            }
-            else
-            {
+        // another overlay or an earlier assignment may have wrapped it
+        mapper = mTTMMapperPool->acquire(khandle, w, h, format);
+        if (!mapper) {
+            VTRACE("unmapped TTM buffer, will map it");
+
+            // calculate stride
+            switch (format) {
+            case HAL_PIXEL_FORMAT_YV12:
+            case HAL_PIXEL_FORMAT_I420:
+                uint32_t yStride_align;
+                yStride_align = DisplayQuery::getOverlayLumaStrideAlignment(grallocMapper.getFormat());
+                if (yStride_align > 0)
+                {
+                    yStride = align_to(align_to(w, 32), yStride_align);
+                }
+                else
+                {
+                    yStride = align_to(align_to(w, 32), 64);
+                }
+                uvStride = align_to(yStride >> 1, 64);
+                stride.yuv.yStride = yStride;
+                stride.yuv.uvStride = uvStride;
+                break;
+            case HAL_PIXEL_FORMAT_NV12:
                 yStride = align_to(align_to(w, 32), 64);
-            }
-            uvStride = align_to(yStride >> 1, 64);
-            stride.yuv.yStride = yStride;
-            stride.yuv.uvStride = uvStride;
-            break;
-        case HAL_PIXEL_FORMAT_NV12:
-            yStride = align_to(align_to(w, 32), 64);
-            uvStride = yStride;
-            stride.yuv.yStride = yStride;
-            stride.yuv.uvStride = uvStride;
-            break;
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-            if (mUseScaledBuffer) {
-                stride.yuv.yStride = payload->scaling_luma_stride;
-                stride.yuv.uvStride = payload->scaling_chroma_u_stride;
-            } else {
-               yStride = align_to(align_to(w, 32), 64);
-               uvStride = yStride;
-               stride.yuv.yStride = yStride;
-               stride.yuv.uvStride = uvStride;
-            }
-            break;
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            yStride = align_to((align_to(w, 32) << 1), 64);
-            uvStride = 0;
-            stride.yuv.yStride = yStride;
-            stride.yuv.uvStride = uvStride;
-            break;
-        }
-
-        DataBuffer buf(khandle);
-        // update buffer
-        buf.setStride(stride);
-        buf.setWidth(w);
-        buf.setHeight(h);
-        buf.setCrop(srcX, srcY, srcW, srcH);
-        buf.setFormat(format);
-
-        // create buffer mapper
-        bool res = false;
-        do {
-            mapper = new TTMBufferMapper(*mWsbm, buf);
-            if (!mapper) {
-                ETRACE("failed to allocate mapper");
+                uvStride = yStride;
+                stride.yuv.yStride = yStride;
+                stride.yuv.uvStride = uvStride;
                 break;
-            }
-            // map ttm buffer
-            ret = mapper->map();
-            if (!ret) {
-                ETRACE("failed to map");
-                invalidateTTMBuffers();
-                ret = mapper->map();
-                if (!ret) {
-                    ETRACE("failed to remap");
-                    break;
+            case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
+            case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
+                if (mUseScaledBuffer) {
+                    stride.yuv.yStride = payload->scaling_luma_stride;
+                    stride.yuv.uvStride = payload->scaling_chroma_u_stride;
+                } else {
+                   yStride = align_to(align_to(w, 32), 64);
+                   uvStride = yStride;
+                   stride.yuv.yStride = yStride;
+                   stride.yuv.uvStride = uvStride;
                 }
+                break;
+            case HAL_PIXEL_FORMAT_YUY2:
+            case HAL_PIXEL_FORMAT_UYVY:
+                yStride = align_to((align_to(w, 32) << 1), 64);
+                uvStride = 0;
+                stride.yuv.yStride = yStride;
+                stride.yuv.uvStride = uvStride;
+                break;
             }
 
-            if (mTTMBuffers.size() >= OVERLAY_DATA_BUFFER_COUNT) {
-                invalidateTTMBuffers();
-            }
+            DataBuffer buf(khandle);
+            // update buffer
+            buf.setStride(stride);
+            buf.setWidth(w);
+            buf.setHeight(h);
+            buf.setCrop(srcX, srcY, srcW, srcH);
+            buf.setFormat(format);
 
-            // add mapper
-            index = mTTMBuffers.add(khandle, mapper);
-            if (index < 0) {
-                ETRACE("failed to add TTMMapper");
-                break;
+            mapper = mTTMMapperPool->acquire(buf);
+            if (!mapper) {
+                ETRACE("failed to map TTM buffer");
+                return 0;
             }
+        }
 
-            // increase mapper refCount since it is added to mTTMBuffers
-            mapper->incRef();
-            res = true;
-        } while (0);
-
-        if (!res) {
-            // error handling
-            if (mapper) {
-                mapper->unmap();
-                delete mapper;
-                mapper = NULL;
-            }
+        if (mTTMBuffers.size() >= OVERLAY_DATA_BUFFER_COUNT) {
+            invalidateTTMBuffers();
+        }
+
+        // add the view, the pool reference belongs to mTTMBuffers
+        index = mTTMBuffers.add(khandle, mapper);
+        if (index < 0) {
+            ETRACE("failed to add TTMMapper");
+            mTTMMapperPool->release(mapper);
             return 0;
         }
+        mapper->setCrop(srcX, srcY, srcW, srcH);
     } else {
         VTRACE("got mapper in saved ttm buffers");
-        mapper = reinterpret_cast<TTMBufferMapper *>(mTTMBuffers.valueAt(index));
+        mapper = mTTMBuffers.valueAt(index);
         if (mapper->getCrop().x != srcX || mapper->getCrop().y != srcY ||
             mapper->getCrop().w != srcW || mapper->getCrop().h != srcH) {
             if(!mUseScaledBuffer)
@@ -509,13 +601,8 @@ void OverlayPlaneBase::putTTMMapper(BufferMapper* mapper)
     if (!mapper)
         return;
 
-    if (!mapper->decRef()) {
-        // unmap it
-        mapper->unmap();
-
-        // destroy this mapper
-        delete mapper;
-    }
+    // the pool keeps it wrapped for the next user
+    mTTMMapperPool->release(mapper);
 }
 
 bool OverlayPlaneBase::isActiveTTMBuffer(BufferMapper *mapper)
@@ -610,12 +697,57 @@ bool OverlayPlaneBase::rotatedBufferReady(BufferMapper& mapper, BufferMapper* &r
 }
 
 
+bool OverlayPlaneBase::isDownscaleNeeded(BufferMapper& mapper)
+{
+    int width = mapper.getCrop().w;
+    int height = mapper.getCrop().h;
+    if (mTransform == HAL_TRANSFORM_ROT_90 || mTransform == HAL_TRANSFORM_ROT_270) {
+        width = mapper.getCrop().h;
+        height = mapper.getCrop().w;
+    }
+
+    return width > INTEL_OVERLAY_MAX_WIDTH - 1 || height > INTEL_OVERLAY_MAX_HEIGHT - 1 ||
+           width >= mPosition.w * 3 || height >= mPosition.h * 3;
+}
+
+BufferMapper* OverlayPlaneBase::getConvertedBuffer(BufferMapper& mapper)
+{
+    // the copy is in the orientation of the display frame
+    int width = mapper.getCrop().w;
+    int height = mapper.getCrop().h;
+    if (mTransform == HAL_TRANSFORM_ROT_90 || mTransform == HAL_TRANSFORM_ROT_270) {
+        width = mapper.getCrop().h;
+        height = mapper.getCrop().w;
+    }
+
+    // the VSP does the scaling the overlay can't
+    if (isDownscaleNeeded(mapper)) {
+        width = mPosition.w;
+        height = mPosition.h;
+    }
+
+    return mConvertCache.get(mapper, mTransform, width & ~1, height & ~1,
+                             mUpdateMasks & PLANE_BUFFER_CHANGED,
+                             mAcquireFence);
+}
+
 bool OverlayPlaneBase::useOverlayRotation(BufferMapper& mapper)
 {
     // by default overlay plane does not support rotation.
     return false;
 }
 
+bool OverlayPlaneBase::isOverlayRotationUsed() const
+{
+    return false;
+}
+
+bool OverlayPlaneBase::isDeinterlaceSupported()
+{
+    // by default bob deinterlace is done by the overlay field mode
+    return false;
+}
+
 bool OverlayPlaneBase::scaledBufferReady(BufferMapper& mapper, BufferMapper* &scaledMapper, VideoPayloadBuffer *payload)
 {
     return false;
@@ -907,9 +1039,59 @@ bool OverlayPlaneBase::setCoeffRegs(double *coeff, int mantSize,
     return true;
 }
 
+void OverlayPlaneBase::prewarmCoeffCache()
+{
+    static const double cutoffs[] = { 1.0, 1.5, 2.0, 3.0 };
+    coeffRec coeff[MAX_TAPS * N_PHASES];
+
+    for (size_t i = 0; i < sizeof(cutoffs) / sizeof(cutoffs[0]); i++) {
+        updateCoeff(N_HORIZ_Y_TAPS, cutoffs[i], true, true, coeff);
+        updateCoeff(N_HORIZ_UV_TAPS, cutoffs[i], true, false, coeff);
+        updateCoeff(N_VERT_Y_TAPS, cutoffs[i], false, true, coeff);
+        updateCoeff(N_VERT_UV_TAPS, cutoffs[i], false, false, coeff);
+    }
+}
+
 void OverlayPlaneBase::updateCoeff(int taps, double fCutoff,
                                  bool isHoriz, bool isY,
                                  coeffPtr pCoeff)
+{
+    // cutoff is always derived from a 1/4096 scaling fraction, so keying
+    // on it in the same units is exact
+    uint32_t key = (taps << 24) |
+                   (isHoriz ? (1 << 23) : 0) |
+                   (isY ? (1 << 22) : 0) |
+                   ((uint32_t)(fCutoff * 4096.0 + 0.5) & 0x3fffff);
+    size_t count = taps * N_PHASES;
+    int victim = 0;
+
+    mCoeffCacheClock++;
+    for (int i = 0; i < COEFF_CACHE_SIZE; i++) {
+        CoeffCacheEntry& entry = mCoeffCache[i];
+        if (entry.key == key) {
+            entry.lastUse = mCoeffCacheClock;
+            memcpy(pCoeff, entry.coeff, count * sizeof(coeffRec));
+            return;
+        }
+        // empty slots have lastUse 0 and are picked first
+        if (entry.lastUse < mCoeffCache[victim].lastUse) {
+            victim = i;
+        }
+    }
+
+    VTRACE("coeff cache miss, taps %d, cutoff %f, horiz %d, Y %d",
+          taps, fCutoff, isHoriz, isY);
+    computeCoeff(taps, fCutoff, isHoriz, isY, pCoeff);
+
+    CoeffCacheEntry& entry = mCoeffCache[victim];
+    entry.key = key;
+    entry.lastUse = mCoeffCacheClock;
+    memcpy(entry.coeff, pCoeff, count * sizeof(coeffRec));
+}
+
+void OverlayPlaneBase::computeCoeff(int taps, double fCutoff,
+                                  bool isHoriz, bool isY,
+                                  coeffPtr pCoeff)
 {
     int i, j, j1, num, pos, mantSize;
     double pi = 3.1415926535, val, sinc, window, sum;
@@ -1153,55 +1335,377 @@ bool OverlayPlaneBase::colorSetup(BufferMapper& mapper)
         return false;
     }
 
+    uint32_t key = COLOR_KEY_VALID | (mDevice << COLOR_KEY_DEVICE_SHIFT);
     uint32_t format = mapper.getFormat();
-    if (format != OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar &&
-        format != OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled) {
+    if (format == OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar ||
+        format == OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled) {
+        struct VideoPayloadBuffer *payload;
+        payload = (struct VideoPayloadBuffer *)mapper.getCpuAddress(SUB_BUFFER1);
+        // check payload
+        if (!payload) {
+            ETRACE("no payload found");
+            return false;
+        }
+
+        key |= COLOR_KEY_VIDEO;
+        // BT.601 or BT.709
+        if (payload->csc_mode & 1)
+            key |= COLOR_KEY_BT709;
+        // no level expansion for video on HDMI
+        if (payload->video_range || mPipeConfig == (0x2 << 6))
+            key |= COLOR_KEY_FULL_RANGE;
+    }
+
+    // the registers of this back buffer are already set up
+    if (mBackBufferColor[mCurrent] == key) {
+        mColorSkips++;
+        return true;
+    }
+    mBackBufferColor[mCurrent] = key;
+    mColorSetups++;
 
+    if (!(key & COLOR_KEY_VIDEO)) {
         VTRACE("Not video layer, use default color setting");
-        backBuffer->OCLRC0 = (OVERLAY_INIT_CONTRAST << 18) |
-                         (OVERLAY_INIT_BRIGHTNESS & 0xff);
-        backBuffer->OCLRC1 = OVERLAY_INIT_SATURATION;
+        setColorRegisters(backBuffer, OVERLAY_INIT_CONTRAST,
+                          OVERLAY_INIT_BRIGHTNESS, OVERLAY_INIT_SATURATION);
         backBuffer->OCONFIG &= ~(1 << 5);
 
         return true;
     }
 
+    backBuffer->OCONFIG &= ~(1 << 5);
+    if (key & COLOR_KEY_BT709)
+        backBuffer->OCONFIG |= (1 << 5);
+
+    if (key & COLOR_KEY_FULL_RANGE) {
+        // full range, no need to do level expansion
+        setColorRegisters(backBuffer, 0x40, 0, 0x80);
+    } else {
+        // level expansion for limited range
+        setColorRegisters(backBuffer, OVERLAY_INIT_CONTRAST,
+                          OVERLAY_INIT_BRIGHTNESS, OVERLAY_INIT_SATURATION);
+    }
+
+    return true;
+}
+
+void OverlayPlaneBase::setColorRegisters(OverlayBackBufferBlk *backBuffer,
+                                         int contrast, int brightness,
+                                         int saturation)
+{
+    // the color correction of the panel goes on top of the one of the
+    // format, the values are clamped to their register fields
+    DisplayCalibration::Values calibration;
+    DisplayCalibration::get(mDevice, calibration);
+    contrast = contrast * calibration.overlayContrast /
+               DisplayCalibration::UNITY_GAIN;
+    brightness += calibration.overlayBrightness;
+    saturation = saturation * calibration.overlaySaturation /
+                 DisplayCalibration::UNITY_GAIN;
+    contrast = contrast > 0x1ff ? 0x1ff : contrast;
+    brightness = brightness < -128 ? -128 :
+                 (brightness > 127 ? 127 : brightness);
+    saturation = saturation > 0x3ff ? 0x3ff : saturation;
+
+    backBuffer->OCLRC0 = (contrast << 18) | (brightness & 0xff);
+    backBuffer->OCLRC1 = saturation;
+}
+
+bool OverlayPlaneBase::allocateBackBuffers()
+{
+    if (mBackBuffer[0]) {
+        return true;
+    }
+
+    for (int i = 0; i < mBackBufferCount; i++) {
+        mBackBuffer[i] = createBackBuffer();
+        if (!mBackBuffer[i]) {
+            freeBackBuffers();
+            return false;
+        }
+        resetBackBuffer(i);
+    }
+    mCurrent = 0;
+    mShownBuffer = -1;
+    invalidateBackBufferGeometry();
+    DTRACE("overlay %d allocated %d back buffers", mIndex, mBackBufferCount);
+    return true;
+}
+
+void OverlayPlaneBase::freeBackBuffers()
+{
+    closeRetireFences();
+    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
+        if (mBackBuffer[i]) {
+            deleteBackBuffer(i);
+        }
+    }
+    mCurrent = 0;
+    mShownBuffer = -1;
+    invalidateBackBufferGeometry();
+}
+
+bool OverlayPlaneBase::releaseIdleBuffers(nsecs_t now)
+{
+    if (!mBackBuffer[0]) {
+        return false;
+    }
+
+    nsecs_t idleTime = TuningPolicy::getVideoIdleTime();
+    if (!idleTime || now - mBackBufferLastUse < idleTime) {
+        return true;
+    }
+
+    // the hardware must not fetch the registers any more
+    if (!isDisabled()) {
+        return true;
+    }
+
+    size_t held = MemoryAccounting::getCurrent(MemoryAccounting::OVERLAY_BACK_BUFFER);
+    freeBackBuffers();
+    if (mSlabAllocator) {
+        mSlabAllocator->trim();
+    }
+    size_t left = MemoryAccounting::getCurrent(MemoryAccounting::OVERLAY_BACK_BUFFER);
+    if (left < held) {
+        MemoryAccounting::reclaim(MemoryAccounting::OVERLAY_BACK_BUFFER, held - left);
+    }
+
+    DTRACE("overlay %d idle for %lld ms, back buffers released",
+           mIndex, ns2ms(now - mBackBufferLastUse));
+    mBackBufferReleases++;
+    return false;
+}
+
+void OverlayPlaneBase::prewarmBuffers()
+{
+    if (mBackBuffer[0] || !allocateBackBuffers()) {
+        return;
+    }
+    // kept for the idle time if the video never comes
+    mBackBufferLastUse = systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+int OverlayPlaneBase::getBackBufferCount() const
+{
+    return OVERLAY_BACK_BUFFER_COUNT;
+}
+
+void OverlayPlaneBase::setRetireFence(int fenceFd)
+{
+    if (mFlippedBuffer < 0 || fenceFd < 0) {
+        return;
+    }
+
+    int& fence = mRetireFence[mFlippedBuffer];
+    if (fence >= 0) {
+        close(fence);
+    }
+    fence = dup(fenceFd);
+    mFlippedBuffer = -1;
+}
+
+void OverlayPlaneBase::closeRetireFences()
+{
+    for (int i = 0; i < OVERLAY_BACK_BUFFER_COUNT; i++) {
+        if (mRetireFence[i] >= 0) {
+            close(mRetireFence[i]);
+            mRetireFence[i] = -1;
+        }
+    }
+    mFlippedBuffer = -1;
+}
+
+bool OverlayPlaneBase::isBackBufferRetired(int buf)
+{
+    int& fence = mRetireFence[buf];
+    if (fence < 0) {
+        return true;
+    }
+
+    // poll only, the ring must never wait for the hardware
+    if (sync_wait(fence, 0) < 0) {
+        return false;
+    }
+
+    close(fence);
+    fence = -1;
+    return true;
+}
+
+void OverlayPlaneBase::selectBackBuffer()
+{
+    // the next buffer in the ring is the oldest one, skip forward only
+    // if the hardware may still be reading it
+    for (int i = 0; i < mBackBufferCount; i++) {
+        int buf = (mCurrent + i) % mBackBufferCount;
+        if (isBackBufferRetired(buf)) {
+            if (buf != mCurrent) {
+                VTRACE("back buffer %d busy, using %d", mCurrent, buf);
+                mCurrent = buf;
+            }
+            return;
+        }
+    }
+
+    VTRACE("all back buffers busy, reusing %d", mCurrent);
+}
+
+void OverlayPlaneBase::flipBackBuffer()
+{
+    mFlippedBuffer = mCurrent;
+    mShownBuffer = mCurrent;
+    mCurrent = (mCurrent + 1) % mBackBufferCount;
+}
+
+void OverlayPlaneBase::invalidateBackBufferGeometry()
+{
+    for (int i = 0; i < mBackBufferCount; i++) {
+        mBackBufferGeometry[i].valid = false;
+        mBackBufferColor[i] = 0;
+    }
+    mShownBuffer = -1;
+}
+
+bool OverlayPlaneBase::updateBackBufferGeometry(BufferMapper& mapper, bool rotated)
+{
+    BackBufferGeometry geometry;
+
+    memset(&geometry, 0, sizeof(BackBufferGeometry));
+    geometry.valid = true;
+    geometry.format = mapper.getFormat();
+    geometry.width = mapper.getWidth();
+    geometry.height = mapper.getHeight();
+    geometry.stride = mapper.getStride();
+    geometry.crop = mapper.getCrop();
+    geometry.position = mPosition;
+    geometry.srcCrop = mSrcCrop;
+    geometry.transform = mTransform;
+    geometry.bobDeinterlace = mBobDeinterlace;
+    geometry.scaled = mUseScaledBuffer;
+    geometry.rotated = rotated;
+    geometry.overlayRotation = isOverlayRotationUsed();
+    geometry.panelOrientation = mPanelOrientation;
+    geometry.modeWidth = mModeInfo.hdisplay;
+    geometry.modeHeight = mModeInfo.vdisplay;
+    geometry.modeFlags = mModeInfo.flags;
+
+    BackBufferGeometry& current = mBackBufferGeometry[mCurrent];
+    if (!memcmp(&current, &geometry, sizeof(BackBufferGeometry))) {
+        return false;
+    }
+
+    memcpy(&current, &geometry, sizeof(BackBufferGeometry));
+    return true;
+}
+
+bool OverlayPlaneBase::checkDataBuffer(BufferMapper& mapper)
+{
+    uint32_t format = mapper.getFormat();
+    if (format != OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar &&
+        format != OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled) {
+        return true;
+    }
+
+    // the same conditions setDataBuffer() fails on, before any back
+    // buffer is touched
     struct VideoPayloadBuffer *payload;
     payload = (struct VideoPayloadBuffer *)mapper.getCpuAddress(SUB_BUFFER1);
-    // check payload
     if (!payload) {
-        ETRACE("no payload found");
+        DTRACE("no payload yet");
         return false;
     }
 
-    // BT.601 or BT.709
-    backBuffer->OCONFIG &= ~(1 << 5);
-    backBuffer->OCONFIG |= ((payload->csc_mode & 1) << 5);
+    if (payload->force_output_method == FORCE_OUTPUT_GPU) {
+        DTRACE("output method is GPU");
+        return false;
+    }
 
-    // no level expansion for video on HDMI
-    if (payload->video_range || mPipeConfig == (0x2 << 6)) {
-        // full range, no need to do level expansion
-        backBuffer->OCLRC0 = 0x1000000;
-        backBuffer->OCLRC1 = 0x80;
-    } else {
-        // level expansion for limited range
-        backBuffer->OCLRC0 = (OVERLAY_INIT_CONTRAST << 18) |
-                         (OVERLAY_INIT_BRIGHTNESS & 0xff);
-        backBuffer->OCLRC1 = OVERLAY_INIT_SATURATION;
+    int srcW = mapper.getCrop().w - mapper.getCrop().x;
+    int srcH = mapper.getCrop().h - mapper.getCrop().y;
+    if (((srcW > INTEL_OVERLAY_MAX_WIDTH - 1) || (srcH > INTEL_OVERLAY_MAX_HEIGHT - 1)) &&
+        !payload->scaling_khandle) {
+        DTRACE("no scaled buffer yet");
+        return false;
+    }
+    return true;
+}
+
+bool OverlayPlaneBase::repeatLastFrame()
+{
+    if (mShownBuffer < 0) {
+        return false;
+    }
+
+    // a back buffer left half set up is written again when next used
+    if (mCurrent != mShownBuffer) {
+        mBackBufferGeometry[mCurrent].valid = false;
+        mBackBufferColor[mCurrent] = 0;
     }
 
+    VTRACE("holding back buffer %d", mShownBuffer);
+    mCurrent = mShownBuffer;
+    mFrameHolds++;
     return true;
 }
 
+bool OverlayPlaneBase::isRepeatedFrame(BufferMapper& mapper)
+{
+    uint32_t format = mapper.getFormat();
+    if (format != OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar &&
+        format != OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled) {
+        return false;
+    }
+
+    struct VideoPayloadBuffer *payload;
+    payload = (struct VideoPayloadBuffer *)mapper.getCpuAddress(SUB_BUFFER1);
+    if (!payload) {
+        return false;
+    }
+
+    int frame = mCadence.analyze(payload->timestamp, systemTime(SYSTEM_TIME_MONOTONIC));
+    if (frame != VideoCadenceAnalyzer::FRAME_REPEAT ||
+        mShownBuffer < 0 || mIsProtectedBuffer) {
+        return false;
+    }
+
+    // the back buffer is only kept if the plane didn't move
+    const BackBufferGeometry& shown = mBackBufferGeometry[mShownBuffer];
+    return shown.valid &&
+           shown.format == format &&
+           shown.transform == mTransform &&
+           !memcmp(&shown.position, &mPosition, sizeof(PlanePosition)) &&
+           !memcmp(&shown.srcCrop, &mSrcCrop, sizeof(crop_t));
+}
+
 bool OverlayPlaneBase::setDataBuffer(BufferMapper& grallocMapper)
 {
     BufferMapper *mapper;
     BufferMapper *videoBufferMapper = 0;
     bool ret;
     uint32_t format;
+    bool vspDownscale = false;
 
     RETURN_FALSE_IF_NOT_INIT();
 
+    if (!allocateBackBuffers()) {
+        ETRACE("no back buffers on overlay %d", mIndex);
+        return false;
+    }
+    mBackBufferLastUse = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // a repeated video frame flips the back buffer on screen again
+    mFrameRepeated = isRepeatedFrame(grallocMapper);
+    if (mFrameRepeated) {
+        VTRACE("repeated frame, keeping back buffer %d", mShownBuffer);
+        mCurrent = mShownBuffer;
+        mRepeatSkips++;
+        return true;
+    }
+
+    // write to a back buffer the hardware is done with
+    selectBackBuffer();
+
     // get gralloc mapper
     mapper = &grallocMapper;
     format = grallocMapper.getFormat();
@@ -1216,10 +1720,18 @@ bool OverlayPlaneBase::setDataBuffer(BufferMapper& grallocMapper)
 
         mBobDeinterlace = payload->bob_deinterlace;
 
+        // the VSP downscales progressive linear video the overlay can't
+        // scale, without waiting for a decoder scaled buffer
+        vspDownscale = format == OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar &&
+                       !mBobDeinterlace && !mIsProtectedBuffer &&
+                       ConvertBufferCache::isEnabled() &&
+                       isDownscaleNeeded(grallocMapper);
+
         int srcW, srcH;
         srcW = grallocMapper.getCrop().w - grallocMapper.getCrop().x;
         srcH = grallocMapper.getCrop().h - grallocMapper.getCrop().y;
-        if ((srcW > INTEL_OVERLAY_MAX_WIDTH - 1) || (srcH > INTEL_OVERLAY_MAX_HEIGHT - 1)) {
+        if (!vspDownscale &&
+            ((srcW > INTEL_OVERLAY_MAX_WIDTH - 1) || (srcH > INTEL_OVERLAY_MAX_HEIGHT - 1))) {
             if (mTransform) {
                 int x, y, w, h;
                 x = mSrcCrop.x;
@@ -1241,20 +1753,62 @@ bool OverlayPlaneBase::setDataBuffer(BufferMapper& grallocMapper)
                 videoBufferMapper->setFormat(OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar);
                 mapper = videoBufferMapper;
             }
+
+            // a scaled frame the decoder is still writing is skipped, the
+            // composition thread doesn't wait for it
+            if (!mTTMMapperPool->isIdle(videoBufferMapper)) {
+                if (repeatLastFrame()) {
+                    VTRACE("scaled buffer busy, holding the last frame");
+                    mFrameRepeated = true;
+                    mBusySkips++;
+                    return true;
+                }
+                // nothing on screen to hold
+                mBusyWaits++;
+                if (!mTTMMapperPool->waitIdle(videoBufferMapper)) {
+                    ETRACE("failed to wait for scaled buffer");
+                    return false;
+                }
+            }
         }
     }
 
-    if (!mUseScaledBuffer && mTransform && !useOverlayRotation(grallocMapper)) {
-        if (!rotatedBufferReady(grallocMapper, videoBufferMapper)) {
-            DTRACE("rotated buffer is not ready");
+    // the overlay can't rotate these formats, or scale the video down that
+    // far, show a rotated and scaled NV12 copy
+    mUseConvertedBuffer = false;
+    if (vspDownscale ||
+        (mTransform && (format == HAL_PIXEL_FORMAT_I420 ||
+         format == HAL_PIXEL_FORMAT_YUY2 || format == HAL_PIXEL_FORMAT_UYVY))) {
+        videoBufferMapper = getConvertedBuffer(grallocMapper);
+        if (!videoBufferMapper) {
+            DTRACE("converted buffer is not ready");
             return false;
         }
+        mapper = videoBufferMapper;
+        mUseConvertedBuffer = true;
+        // lets the platform drop the hardware rotation
+        useOverlayRotation(grallocMapper);
+    }
 
-        if (!videoBufferMapper) {
+    // interlaced video goes through the rotation pipeline even unrotated
+    // if it can be deinterlaced there
+    if (!mUseScaledBuffer && !mUseConvertedBuffer &&
+        ((mTransform && !useOverlayRotation(grallocMapper)) ||
+         (!mTransform && mBobDeinterlace && isDeinterlaceSupported()))) {
+        if (!rotatedBufferReady(grallocMapper, videoBufferMapper)) {
+            if (!mTransform) {
+                DTRACE("deinterlaced buffer is not ready, use field mode");
+                videoBufferMapper = 0;
+            } else {
+                DTRACE("rotated buffer is not ready");
+                return false;
+            }
+        } else if (!videoBufferMapper) {
             ETRACE("failed to get rotated buffer");
             return false;
+        } else {
+            mapper = videoBufferMapper;
         }
-        mapper = videoBufferMapper;
     }
 
     OverlayBackBufferBlk *backBuffer = mBackBuffer[mCurrent]->buf;
@@ -1266,19 +1820,28 @@ bool OverlayPlaneBase::setDataBuffer(BufferMapper& grallocMapper)
     ret = bufferOffsetSetup(*mapper);
     if (ret == false) {
         ETRACE("failed to set up buffer offsets");
+        mBackBufferGeometry[mCurrent].valid = false;
         return false;
     }
 
-    ret = coordinateSetup(*mapper);
-    if (ret == false) {
-        ETRACE("failed to set up overlay coordinates");
-        return false;
-    }
+    // coordinate and scaling registers only depend on the geometry, skip
+    // them if this back buffer was already programmed with the same one.
+    // NOTE: compare the values rather than rely on mUpdateMasks, back
+    // buffers rotate and AnnOverlayPlane never clears the masks
+    if (updateBackBufferGeometry(*mapper, videoBufferMapper != 0)) {
+        ret = coordinateSetup(*mapper);
+        if (ret == false) {
+            ETRACE("failed to set up overlay coordinates");
+            mBackBufferGeometry[mCurrent].valid = false;
+            return false;
+        }
 
-    ret = scalingSetup(*mapper);
-    if (ret == false) {
-        ETRACE("failed to set up scaling parameters");
-        return false;
+        ret = scalingSetup(*mapper);
+        if (ret == false) {
+            ETRACE("failed to set up scaling parameters");
+            mBackBufferGeometry[mCurrent].valid = false;
+            return false;
+        }
     }
 
     backBuffer->OCMD |= 0x1;
@@ -1297,7 +1860,7 @@ bool OverlayPlaneBase::setDataBuffer(BufferMapper& grallocMapper)
     }
 
     // add to active ttm buffers if it's a rotated buffer
-    if (videoBufferMapper) {
+    if (videoBufferMapper && !mUseConvertedBuffer) {
         updateActiveTTMBuffers(mapper);
     }
 
@@ -21,8 +21,12 @@
 #include <DisplayPlane.h>
 #include <BufferMapper.h>
 #include <common/Wsbm.h>
+#include <common/TTMMapperPool.h>
+#include <common/TTMSlabAllocator.h>
 #include <common/OverlayHardware.h>
 #include <common/VideoPayloadBuffer.h>
+#include <common/ConvertBufferCache.h>
+#include <common/VideoCadenceAnalyzer.h>
 
 namespace android {
 namespace intel {
@@ -31,6 +35,8 @@ typedef struct {
     OverlayBackBufferBlk *buf;
     uint32_t gttOffsetInPage;
     void* bufObject;
+    // slab slot, -1 if bufObject is a dedicated TTM buffer
+    int slot;
 } OverlayBackBuffer;
 
 class OverlayPlaneBase : public DisplayPlane {
@@ -55,10 +61,18 @@ public:
     virtual bool initialize(uint32_t bufferCount);
     virtual void deinitialize();
 
+    virtual void dump(Dump& d);
+
+    virtual void setRetireFence(int fenceFd);
+    virtual bool repeatLastFrame();
+    virtual bool releaseIdleBuffers(nsecs_t now);
+    virtual void prewarmBuffers();
+
 protected:
     // generic overlay register flush
     virtual bool flush(uint32_t flags) = 0;
     virtual bool setDataBuffer(BufferMapper& mapper);
+    virtual bool checkDataBuffer(BufferMapper& mapper);
     virtual bool bufferOffsetSetup(BufferMapper& mapper);
     virtual uint32_t calculateSWidthSW(uint32_t offset, uint32_t width);
     virtual bool coordinateSetup(BufferMapper& mapper);
@@ -67,14 +81,31 @@ protected:
     virtual void updateCoeff(int taps, double fCutoff,
                                 bool isHoriz, bool isY,
                                 coeffPtr pCoeff);
+    void computeCoeff(int taps, double fCutoff,
+                         bool isHoriz, bool isY,
+                         coeffPtr pCoeff);
     virtual bool scalingSetup(BufferMapper& mapper);
     virtual bool colorSetup(BufferMapper& mapper);
+    // writes the color registers with the calibration of the display
+    void setColorRegisters(OverlayBackBufferBlk *backBuffer, int contrast,
+                           int brightness, int saturation);
     virtual void checkPosition(int& x, int& y, int& w, int& h);
     virtual void checkCrop(int& x, int& y, int& w, int& h, int coded_width, int coded_height);
 
 
 protected:
     // back buffer operations
+    // depth of the back buffer ring, hwc.overlay.shallow caps it at
+    // OVERLAY_SHALLOW_BACK_BUFFER_COUNT
+    virtual int getBackBufferCount() const;
+    // flip() of planes rotating through the ring moves to the next buffer
+    // with flipBackBuffer(), setDataBuffer() then skips the buffers whose
+    // retire fence is still pending
+    void selectBackBuffer();
+    void flipBackBuffer();
+    // the ring is created on first use and freed once the plane is idle
+    bool allocateBackBuffers();
+    void freeBackBuffers();
     virtual OverlayBackBuffer* createBackBuffer();
     virtual void deleteBackBuffer(int buf);
     virtual void resetBackBuffer(int buf);
@@ -83,13 +114,29 @@ protected:
     virtual void  putTTMMapper(BufferMapper* mapper);
     virtual bool rotatedBufferReady(BufferMapper& mapper, BufferMapper* &rotatedMapper);
     virtual bool useOverlayRotation(BufferMapper& mapper);
+    // the last useOverlayRotation() decision, without deciding again
+    virtual bool isOverlayRotationUsed() const;
+    // interlaced video is turned progressive by rotatedBufferReady()
+    virtual bool isDeinterlaceSupported();
     virtual bool scaledBufferReady(BufferMapper& mapper, BufferMapper* &scaledMapper, VideoPayloadBuffer *payload);
+    // the video frame repeats the one on screen, nothing but the buffer
+    // changed
+    bool isRepeatedFrame(BufferMapper& mapper);
+    // rotated NV12 copy of a layer the overlay can't rotate
+    BufferMapper* getConvertedBuffer(BufferMapper& mapper);
+    // the crop is downscaled more than the overlay can do
+    bool isDownscaleNeeded(BufferMapper& mapper);
 
 private:
     inline bool isActiveTTMBuffer(BufferMapper *mapper);
     void updateActiveTTMBuffers(BufferMapper *mapper);
     void invalidateActiveTTMBuffers();
     void invalidateTTMBuffers();
+    void prewarmCoeffCache();
+    bool updateBackBufferGeometry(BufferMapper& mapper, bool rotated);
+    void invalidateBackBufferGeometry();
+    bool isBackBufferRetired(int buf);
+    void closeRetireFences();
 
 protected:
     // flush flags
@@ -101,8 +148,52 @@ protected:
 
     enum {
         OVERLAY_BACK_BUFFER_COUNT = 3,
+        OVERLAY_SHALLOW_BACK_BUFFER_COUNT = 2,
         MAX_ACTIVE_TTM_BUFFERS = 3,
         OVERLAY_DATA_BUFFER_COUNT = 20,
+        COEFF_CACHE_SIZE = 32,
+    };
+
+    // inputs of the color registers, see colorSetup()
+    enum {
+        COLOR_KEY_VALID = 1 << 31,
+        COLOR_KEY_VIDEO = 1 << 0,
+        COLOR_KEY_BT709 = 1 << 1,
+        COLOR_KEY_FULL_RANGE = 1 << 2,
+        // the display, whose calibration is applied
+        COLOR_KEY_DEVICE_SHIFT = 8,
+    };
+
+    // inputs of the geometry registers last written to a back buffer
+    struct BackBufferGeometry {
+        bool valid;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        stride_t stride;
+        crop_t crop;
+        PlanePosition position;
+        crop_t srcCrop;
+        int transform;
+        int bobDeinterlace;
+        int scaled;
+        int rotated;
+        // the hardware rotation and the panel orientation change the
+        // coordinates and the scaling
+        int overlayRotation;
+        int panelOrientation;
+        // the position is clipped to the mode
+        uint16_t modeWidth;
+        uint16_t modeHeight;
+        uint32_t modeFlags;
+    };
+
+    // computed polyphase filter coefficients, keyed by
+    // (taps, orientation, plane, cutoff in 1/4096 units)
+    struct CoeffCacheEntry {
+        uint32_t key;
+        uint32_t lastUse;
+        coeffRec coeff[MAX_TAPS * N_PHASES];
     };
 
     // TTM data buffers
@@ -113,13 +204,49 @@ protected:
     // overlay back buffer
     OverlayBackBuffer *mBackBuffer[OVERLAY_BACK_BUFFER_COUNT];
     int mCurrent;
+    int mBackBufferCount;
+    // buffer of the last flip, waiting for its retire fence
+    int mFlippedBuffer;
+    int mRetireFence[OVERLAY_BACK_BUFFER_COUNT];
+    BackBufferGeometry mBackBufferGeometry[OVERLAY_BACK_BUFFER_COUNT];
+    // back buffer of the last flip, -1 once its geometry is invalid
+    int mShownBuffer;
+    // color key last written to each back buffer, 0 if unknown
+    uint32_t mBackBufferColor[OVERLAY_BACK_BUFFER_COUNT];
+    uint32_t mColorSetups;
+    uint32_t mColorSkips;
+    // last assignment or frame, the back buffers are released after the
+    // video idle time of the tuning policy
+    nsecs_t mBackBufferLastUse;
+    uint32_t mBackBufferReleases;
     // wsbm
     Wsbm *mWsbm;
+    // shared by all overlay planes, set once the plane holds a pool reference
+    TTMMapperPool *mTTMMapperPool;
+    // NULL if back buffers are dedicated TTM buffers
+    TTMSlabAllocator *mSlabAllocator;
     // pipe config
     uint32_t mPipeConfig;
 
     int mBobDeinterlace;
     int mUseScaledBuffer;
+    // the frame is a converted copy, rotated already
+    bool mUseConvertedBuffer;
+    ConvertBufferCache mConvertCache;
+    // the last setDataBuffer() kept the shown back buffer
+    bool mFrameRepeated;
+    uint32_t mRepeatSkips;
+    // frames that couldn't be set up and kept the last one on screen
+    uint32_t mFrameHolds;
+    // scaled buffers still written by the decoder, skipped for the last
+    // frame, and the ones waited for as nothing was on screen
+    uint32_t mBusySkips;
+    uint32_t mBusyWaits;
+    VideoCadenceAnalyzer mCadence;
+
+    // filter coefficient cache
+    CoeffCacheEntry mCoeffCache[COEFF_CACHE_SIZE];
+    uint32_t mCoeffCacheClock;
 };
 
 } // namespace intel
@@ -16,37 +16,20 @@
 #include <hal_public.h>
 #include <HwcTrace.h>
 #include <common/PixelFormat.h>
+#include <common/FormatTable.h>
 
 namespace android {
 namespace intel {
 
 bool PixelFormat::convertFormat(uint32_t grallocFormat, uint32_t& spriteFormat, int& bpp)
 {
-    switch (grallocFormat) {
-    case HAL_PIXEL_FORMAT_RGBA_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_RGBA8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_RGBX_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_RGBX8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_BGRX_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_BGRX8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_BGRA_8888:
-        spriteFormat = PLANE_PIXEL_FORMAT_BGRA8888;
-        bpp = 4;
-        break;
-    case HAL_PIXEL_FORMAT_RGB_565:
-        spriteFormat = PLANE_PIXEL_FORMAT_BGRX565;
-        bpp = 2;
-        break;
-    default:
+    const FormatTable::Descriptor *desc = FormatTable::get(grallocFormat);
+    if (!desc || !desc->spriteFormat) {
         return false;
     }
 
+    spriteFormat = desc->spriteFormat;
+    bpp = desc->bpp;
     return true;
 }
 
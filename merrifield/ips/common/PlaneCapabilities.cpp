@@ -20,7 +20,9 @@
 #include <OMX_IVCommon.h>
 #include <OMX_IntelVideoExt.h>
 #include <PlaneCapabilities.h>
+#include "FormatTable.h"
 #include "OverlayHardware.h"
+#include "ConvertBufferCache.h"
 #include <HwcLayer.h>
 
 #define SPRITE_PLANE_MAX_STRIDE_TILED      16384
@@ -38,38 +40,25 @@ bool PlaneCapabilities::isFormatSupported(int planeType, HwcLayer *hwcLayer)
     uint32_t format = hwcLayer->getFormat();
     uint32_t trans = hwcLayer->getLayer()->transform;
 
-    if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            return trans ? false : true;
-        default:
+    if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY ||
+        planeType == DisplayPlane::PLANE_OVERLAY) {
+        const FormatTable::Descriptor *desc = FormatTable::get(format);
+        if (!desc || !(desc->planes & (1 << planeType))) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
-    } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            // TODO: overlay supports 180 degree rotation
-            if (trans == HAL_TRANSFORM_ROT_180) {
-                WTRACE("180 degree rotation is not supported yet");
-            }
-            return trans ? false : true;
-        case HAL_PIXEL_FORMAT_YV12:
-            return trans ? false: true;
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
+        if (!trans) {
             return true;
-        default:
-            VTRACE("unsupported format %#x", format);
+        }
+        if (planeType != DisplayPlane::PLANE_OVERLAY) {
             return false;
         }
+        // rotated layers are shown through a converted copy
+        if (desc->flags & FormatTable::FORMAT_OVERLAY_NO_ROTATION) {
+            return ConvertBufferCache::isSupported(hwcLayer);
+        }
+        // no rotation of YV12 on this overlay
+        return format != HAL_PIXEL_FORMAT_YV12;
     } else {
         ETRACE("invalid plane type %d", planeType);
         return false;
@@ -83,45 +72,27 @@ bool PlaneCapabilities::isSizeSupported(int planeType, HwcLayer *hwcLayer)
     uint32_t h = hwcLayer->getBufferHeight();
     const stride_t& stride = hwcLayer->getBufferStride();
 
-    bool isYUVPacked;
     uint32_t maxStride;
 
     if (planeType == DisplayPlane::PLANE_SPRITE || planeType == DisplayPlane::PLANE_PRIMARY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-        case HAL_PIXEL_FORMAT_BGRX_8888:
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-            if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
-                VTRACE("too large stride %d", stride.rgb.stride);
-                return false;
-            }
-            return true;
-        default:
+        if (!FormatTable::isPlaneSupported(format, planeType)) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
+        if (stride.rgb.stride > SPRITE_PLANE_MAX_STRIDE_LINEAR) {
+            VTRACE("too large stride %d", stride.rgb.stride);
+            return false;
+        }
+        return true;
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        switch (format) {
-        case HAL_PIXEL_FORMAT_YV12:
-        case HAL_PIXEL_FORMAT_I420:
-        case HAL_PIXEL_FORMAT_NV12:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-        case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-            isYUVPacked = false;
-            break;
-        case HAL_PIXEL_FORMAT_YUY2:
-        case HAL_PIXEL_FORMAT_UYVY:
-            isYUVPacked = true;
-            break;
-        default:
+        const FormatTable::Descriptor *desc = FormatTable::get(format);
+        if (!desc || !(desc->planes & (1 << planeType))) {
             VTRACE("unsupported format %#x", format);
             return false;
         }
         // don't use overlay plane if stride is too big
         maxStride = OVERLAY_PLANE_MAX_STRIDE_LINEAR;
-        if (isYUVPacked) {
+        if (desc->flags & FormatTable::FORMAT_YUV_PACKED) {
             maxStride = OVERLAY_PLANE_MAX_STRIDE_PACKED;
         }
 
@@ -186,8 +157,11 @@ bool PlaneCapabilities::isScalingSupported(int planeType, HwcLayer *hwcLayer)
         return ((srcW == dstW) && (srcH == dstH)) ? true : false;
 
     } else if (planeType == DisplayPlane::PLANE_OVERLAY) {
-        // overlay cannot support resolution that bigger than 2047x2047.
-        if ((srcW > INTEL_OVERLAY_MAX_WIDTH - 1) || (srcH > INTEL_OVERLAY_MAX_HEIGHT - 1)) {
+        // overlay cannot support resolution that bigger than 2047x2047,
+        // a converted copy is scaled to the display frame
+        if (((srcW > INTEL_OVERLAY_MAX_WIDTH - 1) || (srcH > INTEL_OVERLAY_MAX_HEIGHT - 1)) &&
+            !ConvertBufferCache::isSupported(hwcLayer) &&
+            !ConvertBufferCache::isDownscaleSupported(hwcLayer)) {
             return false;
         }
 
@@ -0,0 +1,134 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <BufferManager.h>
+#include <hal_public.h>
+#include <common/PrescaleBufferCache.h>
+
+namespace android {
+namespace intel {
+
+PrescaleBufferCache::PrescaleBufferCache()
+    : mCurrent(0)
+{
+    memset(mImages, 0, sizeof(mImages));
+}
+
+PrescaleBufferCache::~PrescaleBufferCache()
+{
+    clear();
+}
+
+bool PrescaleBufferCache::allocImage(Image& image, int width, int height,
+                                     uint32_t format)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    image.handle = bm->allocGrallocBuffer(width, height, format,
+                                          GRALLOC_USAGE_HW_RENDER |
+                                          GRALLOC_USAGE_HW_COMPOSER);
+    if (!image.handle) {
+        ETRACE("failed to allocate %dx%d prescale buffer", width, height);
+        return false;
+    }
+
+    DataBuffer *buffer = bm->lockDataBuffer(image.handle);
+    if (buffer) {
+        image.mapper = bm->map(*buffer);
+        bm->unlockDataBuffer(buffer);
+    }
+
+    if (!image.mapper) {
+        ETRACE("failed to map prescale buffer");
+        bm->freeGrallocBuffer(image.handle);
+        memset(&image, 0, sizeof(image));
+        return false;
+    }
+
+    image.mapper->setCrop(0, 0, width, height);
+    image.mapper->setIsCompression(false);
+    image.sourceKey = 0;
+    image.width = width;
+    image.height = height;
+    image.format = format;
+    return true;
+}
+
+void PrescaleBufferCache::freeImage(Image& image)
+{
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+
+    if (image.mapper) {
+        bm->unmap(image.mapper);
+    }
+    if (image.handle) {
+        bm->freeGrallocBuffer(image.handle);
+    }
+    memset(&image, 0, sizeof(image));
+}
+
+void PrescaleBufferCache::clear()
+{
+    for (int i = 0; i < PRESCALE_BUFFER_COUNT; i++) {
+        freeImage(mImages[i]);
+    }
+    mCurrent = 0;
+}
+
+BufferMapper* PrescaleBufferCache::get(BufferMapper& source, int width,
+                                       int height, bool bufferChanged)
+{
+    // position only updates keep using the scaled copy
+    Image& current = mImages[mCurrent];
+    if (current.mapper && current.sourceKey == source.getKey() &&
+        current.width == width && current.height == height &&
+        !bufferChanged) {
+        return current.mapper;
+    }
+
+    // never blit to the copy on screen
+    int next = (mCurrent + 1) % PRESCALE_BUFFER_COUNT;
+    Image& image = mImages[next];
+    if (image.mapper && (image.width != width || image.height != height ||
+        image.format != source.getFormat())) {
+        freeImage(image);
+    }
+
+    if (!image.mapper &&
+        !allocImage(image, width, height, source.getFormat())) {
+        return NULL;
+    }
+
+    // the blit is ordered after the rendering still pending on the source
+    // and is waited for, the copy is complete when it's flipped
+    BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
+    crop_t destRect = {0, 0, width, height};
+    if (!bm->blit(source.getHandle(), image.handle, destRect, true, false)) {
+        ETRACE("failed to prescale %dx%d to %dx%d", source.getWidth(),
+            source.getHeight(), width, height);
+        return NULL;
+    }
+
+    VTRACE("prescaled %#llx to %dx%d", source.getKey(), width, height);
+    image.sourceKey = source.getKey();
+    mCurrent = next;
+    return image.mapper;
+}
+
+} // namespace intel
+} // namespace android
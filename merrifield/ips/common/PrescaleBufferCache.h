@@ -0,0 +1,66 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef PRESCALE_BUFFER_CACHE_H
+#define PRESCALE_BUFFER_CACHE_H
+
+#include <BufferMapper.h>
+
+namespace android {
+namespace intel {
+
+// Scaled copies of RGB layers for planes without a scaler. The copy is
+// made with the gralloc blit and kept while the source buffer doesn't
+// change, so a static scaled layer costs a single blit.
+class PrescaleBufferCache {
+public:
+    PrescaleBufferCache();
+    ~PrescaleBufferCache();
+
+public:
+    // returns the mapper of source scaled to width x height; the blit is
+    // redone only if source is a different buffer, the size changed or
+    // bufferChanged is set
+    BufferMapper* get(BufferMapper& source, int width, int height,
+                      bool bufferChanged);
+    void clear();
+
+private:
+    enum {
+        // one copy on screen, one being blitted
+        PRESCALE_BUFFER_COUNT = 2,
+    };
+
+    struct Image {
+        buffer_handle_t handle;
+        BufferMapper *mapper;
+        uint64_t sourceKey;
+        int width;
+        int height;
+        uint32_t format;
+    };
+
+    bool allocImage(Image& image, int width, int height, uint32_t format);
+    void freeImage(Image& image);
+
+private:
+    Image mImages[PRESCALE_BUFFER_COUNT];
+    int mCurrent;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* PRESCALE_BUFFER_CACHE_H */
@@ -14,8 +14,12 @@
 // limitations under the License.
 */
 
+#include <stdlib.h>
 #include <HwcTrace.h>
+#include <MemoryAccounting.h>
+#include <VaDisplayManager.h>
 #include <common/RotationBufferProvider.h>
+#include <cutils/properties.h>
 
 namespace android {
 namespace intel {
@@ -38,12 +42,17 @@ if (vaStatus != VA_STATUS_SUCCESS) {\
 RotationBufferProvider::RotationBufferProvider(Wsbm* wsbm)
     : mWsbm(wsbm),
       mVaInitialized(false),
+      mVaStarted(false),
       mVaDpy(0),
       mVaCfg(0),
       mVaCtx(0),
       mVaBufFilter(0),
+      mVaBufDeinterlace(0),
+      mPrevSourceSurface(0),
+      mDeinterlaceEnabled(true),
+      mDeinterlaceMode(DEINTERLACE_UNKNOWN),
+      mDeinterlaced(false),
       mSourceSurface(0),
-      mDisplay(DISPLAYVALUE),
       mWidth(0),
       mHeight(0),
       mTransform(0),
@@ -51,13 +60,19 @@ RotationBufferProvider::RotationBufferProvider(Wsbm* wsbm)
       mRotatedHeight(0),
       mRotatedStride(0),
       mTargetIndex(0),
+      mPendingIndex(-1),
+      mAsyncRotation(false),
       mTTMWrappers(),
-      mBobDeinterlace(0)
+      mSourceSurfaces(),
+      mBobDeinterlace(0),
+      mLastUse(0),
+      mKeepWarmTime(0)
 {
     for (int i = 0; i < MAX_SURFACE_NUM; i++) {
         mKhandles[i] = 0;
         mRotatedSurfaces[i] = 0;
         mDrmBuf[i] = NULL;
+        mDrmBufSize[i] = 0;
     }
 }
 
@@ -77,6 +92,24 @@ bool RotationBufferProvider::initialize()
     if (NULL == mWsbm)
         return false;
     mTTMWrappers.setCapacity(TTM_WRAPPER_COUNT);
+    mSourceSurfaces.setCapacity(SOURCE_SURFACE_COUNT);
+
+    // rotate in the background and wait for it at flip time
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("hwc.video.rotation.async", prop, "1") > 0) {
+        mAsyncRotation = atoi(prop);
+    }
+
+    // interlaced video goes through the VPP deinterlacer if it has one
+    if (property_get("hwc.video.deinterlace", prop, "1") > 0) {
+        mDeinterlaceEnabled = atoi(prop) ? true : false;
+    }
+
+    // VA stays up this long after the last rotated frame, in ms
+    mKeepWarmTime = milliseconds(DEFAULT_KEEP_WARM_TIME);
+    if (property_get("hwc.video.rotation.keepwarm", prop, NULL) > 0) {
+        mKeepWarmTime = milliseconds(atoi(prop));
+    }
     return true;
 }
 
@@ -91,6 +124,9 @@ void RotationBufferProvider::reset()
     if (mTTMWrappers.size()) {
         invalidateCaches();
     }
+
+    // decoder buffers may be reallocated with the same khandle
+    freeSourceSurfaces();
 }
 
 void RotationBufferProvider::invalidateCaches()
@@ -185,8 +221,10 @@ bool RotationBufferProvider::createVaSurface(VideoPayloadBuffer *payload, int tr
     }
 
     mBobDeinterlace = payload->bob_deinterlace;
-    // adjust source target for Bob deinterlace
-    if (!isTarget && mBobDeinterlace) {
+    // adjust source target for Bob deinterlace, a single field is read
+    // unless the deinterlacer takes the whole frame
+    int fieldShift = getFieldShift(payload);
+    if (!isTarget && fieldShift) {
         height >>= 1;
         bufferHeight >>= 1;
         stride <<= 1;
@@ -213,6 +251,8 @@ bool RotationBufferProvider::createVaSurface(VideoPayloadBuffer *payload, int tr
             ETRACE("failed to create buffer by wsbm");
             return false;
         }
+        mDrmBufSize[mTargetIndex] = stride * bufferHeight * 3 / 2;
+        MemoryAccounting::add(MemoryAccounting::ROTATION_BUFFER, mDrmBufSize[mTargetIndex]);
 
         mKhandles[mTargetIndex] = khandle;
         vaSurfaceAttrib->buffers[0] = (uintptr_t) khandle;
@@ -224,7 +264,7 @@ bool RotationBufferProvider::createVaSurface(VideoPayloadBuffer *payload, int tr
         /* set src surface width/height to video crop size */
         if (payload->crop_width && payload->crop_height) {
             width = payload->crop_width;
-            height = (payload->crop_height >> mBobDeinterlace);
+            height = (payload->crop_height >> fieldShift);
         } else {
             VTRACE("Invalid cropping width or height");
             payload->crop_width = width;
@@ -250,26 +290,89 @@ bool RotationBufferProvider::createVaSurface(VideoPayloadBuffer *payload, int tr
     return true;
 }
 
+bool RotationBufferProvider::prewarm()
+{
+    if (mVaStarted) {
+        return true;
+    }
+
+    // the VA display and config don't depend on the stream, the context
+    // is created by the first rotated frame
+    nsecs_t start = systemTime();
+    if (!startVADisplay()) {
+        WTRACE("failed to prewarm VA");
+        stopVA();
+        return false;
+    }
+
+    mLastUse = systemTime();
+    DTRACE("VA prewarmed in %lld us", ns2us(mLastUse - start));
+    return true;
+}
+
+bool RotationBufferProvider::releaseIdle(nsecs_t now, bool videoActive)
+{
+    if (!mVaStarted) {
+        return false;
+    }
+
+    if (now - mLastUse < mKeepWarmTime) {
+        return true;
+    }
+
+    size_t held = MemoryAccounting::getCurrent(MemoryAccounting::ROTATION_BUFFER);
+    bool warm = videoActive;
+    if (videoActive) {
+        // the rotated surfaces are freed, the display and config stay for
+        // a rotation later in the session
+        if (mVaInitialized) {
+            DTRACE("rotation idle for %lld ms, VA context is destroyed",
+                   ns2ms(now - mLastUse));
+            destroyVaContext();
+            mVaInitialized = false;
+        }
+    } else {
+        DTRACE("rotation idle for %lld ms, VA is stopped", ns2ms(now - mLastUse));
+        stopVA();
+    }
+
+    size_t left = MemoryAccounting::getCurrent(MemoryAccounting::ROTATION_BUFFER);
+    if (left < held) {
+        MemoryAccounting::reclaim(MemoryAccounting::ROTATION_BUFFER, held - left);
+    }
+    return warm;
+}
+
 bool RotationBufferProvider::startVA(VideoPayloadBuffer *payload, int transform)
 {
-    bool ret = true;
+    if (!mVaStarted && !startVADisplay()) {
+        return false;
+    }
+
+    if (!createVaContext(payload, transform)) {
+        return false;
+    }
+
+    mVaInitialized = true;
+
+    return true;
+}
+
+bool RotationBufferProvider::startVADisplay()
+{
     VAStatus vaStatus;
     VAEntrypoint *entryPoint;
     VAConfigAttrib attribDummy;
     int numEntryPoints;
     bool supportVideoProcessing = false;
-    int majorVer = 0, minorVer = 0;
 
-    // VA will hold a copy of the param pointer, so local varialbe doesn't work
-    mVaDpy = vaGetDisplay(&mDisplay);
+    // shared with the providers of the other overlay planes
+    mVaDpy = VaDisplayManager::acquire(DISPLAYVALUE);
     if (NULL == mVaDpy) {
         ETRACE("failed to get VADisplay");
         return false;
     }
 
-    vaStatus = vaInitialize(mVaDpy, &majorVer, &minorVer);
-    CHECK_VA_STATUS_RETURN("vaInitialize");
-
     numEntryPoints = vaMaxNumEntrypoints(mVaDpy);
 
     if (numEntryPoints <= 0) {
@@ -309,6 +412,16 @@ bool RotationBufferProvider::startVA(VideoPayloadBuffer *payload, int transform)
                               &mVaCfg);
     CHECK_VA_STATUS_RETURN("vaCreateConfig");
 
+    mVaStarted = true;
+
+    return true;
+}
+
+bool RotationBufferProvider::createVaContext(VideoPayloadBuffer *payload, int transform)
+{
+    bool ret;
+    VAStatus vaStatus;
+
     // create first target surface
     ret = createVaSurface(payload, transform, true);
     if (ret == false) {
@@ -341,6 +454,10 @@ bool RotationBufferProvider::startVA(VideoPayloadBuffer *payload, int transform)
         return false;
     }
 
+    if (mDeinterlaceEnabled) {
+        createDeinterlaceFilter(filters, numFilters);
+    }
+
     VAProcFilterParameterBuffer filter;
     filter.type = VAProcFilterNone;
     filter.value = 0;
@@ -369,8 +486,6 @@ bool RotationBufferProvider::startVA(VideoPayloadBuffer *payload, int transform)
         return false;
     }
 
-    mVaInitialized = true;
-
     return true;
 }
 
@@ -393,16 +508,29 @@ bool RotationBufferProvider::setupRotationBuffer(VideoPayloadBuffer *payload, in
         payload->tiling = 1;
     }
 
+    // VA context only processes one rotation at a time
+    if (mPendingIndex >= 0 && !syncRotationBuffer()) {
+        WTRACE("previous rotation failed");
+    }
+
     do {
         if (isContextChanged(payload->width, payload->height, transform)) {
-            DTRACE("VA is restarted as rotation context changes");
+            DTRACE("VA context is recreated as rotation context changes");
 
-            if (mVaInitialized) {
-                stopVA(); // need to re-initialize VA for new rotation config
-            }
             mTransform = transform;
             mWidth = payload->width;
             mHeight = payload->height;
+
+            if (mVaInitialized) {
+                // VA display and config don't depend on the stream, only
+                // the surfaces and the context need to be recreated
+                destroyVaContext();
+                ret = createVaContext(payload, transform);
+                if (ret == false) {
+                    vaStatus = VA_STATUS_ERROR_OPERATION_FAILED;
+                    break;
+                }
+            }
         }
 
         if (!mVaInitialized) {
@@ -413,6 +541,12 @@ bool RotationBufferProvider::setupRotationBuffer(VideoPayloadBuffer *payload, in
             }
         }
 
+        // without rotation there is only a point in deinterlacing
+        if (!transform && !(payload->bob_deinterlace && mVaBufDeinterlace)) {
+            WTRACE("nothing to do without a deinterlacer");
+            return false;
+        }
+
         // start to create next target surface
         if (!mRotatedSurfaces[mTargetIndex]) {
             ret = createVaSurface(payload, transform, true);
@@ -423,8 +557,8 @@ bool RotationBufferProvider::setupRotationBuffer(VideoPayloadBuffer *payload, in
             }
         }
 
-        // create source surface
-        ret = createVaSurface(payload, transform, false);
+        // look up or create source surface
+        ret = getSourceSurface(payload, transform);
         if (ret == false) {
             ETRACE("failed to create source surface with attribute");
             vaStatus = VA_STATUS_ERROR_OPERATION_FAILED;
@@ -434,44 +568,66 @@ bool RotationBufferProvider::setupRotationBuffer(VideoPayloadBuffer *payload, in
 #ifdef DEBUG_ROTATION_PERFROMANCE
         uint32_t beginPicture = getMilliseconds();
 #endif
-        vaStatus = vaBeginPicture(mVaDpy, mVaCtx, mRotatedSurfaces[mTargetIndex]);
-        CHECK_VA_STATUS_BREAK("vaBeginPicture");
-
-        VABufferID pipelineBuf;
-        void *p;
-        VAProcPipelineParameterBuffer *pipelineParam;
-        vaStatus = vaCreateBuffer(mVaDpy,
-                                  mVaCtx,
-                                  VAProcPipelineParameterBufferType,
-                                  sizeof(*pipelineParam),
-                                  1,
-                                  NULL,
-                                  &pipelineBuf);
-        CHECK_VA_STATUS_BREAK("vaCreateBuffer");
-
-        vaStatus = vaMapBuffer(mVaDpy, pipelineBuf, &p);
-        CHECK_VA_STATUS_BREAK("vaMapBuffer");
-
-        pipelineParam = (VAProcPipelineParameterBuffer*)p;
-        pipelineParam->surface = mSourceSurface;
-        pipelineParam->rotation_state = transFromHalToVa(transform);
-        pipelineParam->filters = &mVaBufFilter;
-        pipelineParam->num_filters = 1;
-        pipelineParam->surface_region = NULL;
-        pipelineParam->output_region = NULL;
-        pipelineParam->num_forward_references = 0;
-        pipelineParam->num_backward_references = 0;
-        vaStatus = vaUnmapBuffer(mVaDpy, pipelineBuf);
-        CHECK_VA_STATUS_BREAK("vaUnmapBuffer");
-
-        vaStatus = vaRenderPicture(mVaDpy, mVaCtx, &pipelineBuf, 1);
-        CHECK_VA_STATUS_BREAK("vaRenderPicture");
-
-        vaStatus = vaEndPicture(mVaDpy, mVaCtx);
-        CHECK_VA_STATUS_BREAK("vaEndPicture");
-
-        vaStatus = vaSyncSurface(mVaDpy, mRotatedSurfaces[mTargetIndex]);
-        CHECK_VA_STATUS_BREAK("vaSyncSurface");
+        {
+            // rotation of the local display goes ahead of WiDi
+            VaDisplayManager::SubmitLock submit(mVaDpy, VaDisplayManager::PRIORITY_LOCAL);
+            vaStatus = vaBeginPicture(mVaDpy, mVaCtx, mRotatedSurfaces[mTargetIndex]);
+            CHECK_VA_STATUS_BREAK("vaBeginPicture");
+
+            VABufferID pipelineBuf;
+            void *p;
+            VAProcPipelineParameterBuffer *pipelineParam;
+            vaStatus = vaCreateBuffer(mVaDpy,
+                                      mVaCtx,
+                                      VAProcPipelineParameterBufferType,
+                                      sizeof(*pipelineParam),
+                                      1,
+                                      NULL,
+                                      &pipelineBuf);
+            CHECK_VA_STATUS_BREAK("vaCreateBuffer");
+
+            vaStatus = vaMapBuffer(mVaDpy, pipelineBuf, &p);
+            CHECK_VA_STATUS_BREAK("vaMapBuffer");
+
+            pipelineParam = (VAProcPipelineParameterBuffer*)p;
+            pipelineParam->surface = mSourceSurface;
+            pipelineParam->rotation_state = transFromHalToVa(transform);
+            pipelineParam->filters = &mVaBufFilter;
+            pipelineParam->num_filters = 1;
+            pipelineParam->surface_region = NULL;
+            pipelineParam->output_region = NULL;
+            pipelineParam->num_forward_references = 0;
+            pipelineParam->num_backward_references = 0;
+
+            // the whole interlaced frame is turned into a progressive one,
+            // motion adaptive looks back at the previous frame
+            mDeinterlaced = payload->bob_deinterlace && mVaBufDeinterlace;
+            if (mDeinterlaced) {
+                pipelineParam->filters = &mVaBufDeinterlace;
+                if (mDeinterlaceMode == DEINTERLACE_MOTION_ADAPTIVE &&
+                    mPrevSourceSurface && mPrevSourceSurface != mSourceSurface) {
+                    pipelineParam->forward_references = &mPrevSourceSurface;
+                    pipelineParam->num_forward_references = 1;
+                }
+                mPrevSourceSurface = mSourceSurface;
+            }
+            vaStatus = vaUnmapBuffer(mVaDpy, pipelineBuf);
+            CHECK_VA_STATUS_BREAK("vaUnmapBuffer");
+
+            vaStatus = vaRenderPicture(mVaDpy, mVaCtx, &pipelineBuf, 1);
+            CHECK_VA_STATUS_BREAK("vaRenderPicture");
+
+            vaStatus = vaEndPicture(mVaDpy, mVaCtx);
+            CHECK_VA_STATUS_BREAK("vaEndPicture");
+        }
+
+        if (mAsyncRotation) {
+            // syncRotationBuffer() waits for it before the plane is flipped
+            mPendingIndex = mTargetIndex;
+        } else {
+            vaStatus = vaSyncSurface(mVaDpy, mRotatedSurfaces[mTargetIndex]);
+            CHECK_VA_STATUS_BREAK("vaSyncSurface");
+        }
 
 #ifdef DEBUG_ROTATION_PERFROMANCE
         ITRACE("time spent %dms from vaBeginPicture to vaSyncSurface",
@@ -488,6 +644,8 @@ bool RotationBufferProvider::setupRotationBuffer(VideoPayloadBuffer *payload, in
         if (mTargetIndex >= MAX_SURFACE_NUM)
             mTargetIndex = 0;
 
+        mLastUse = systemTime();
+
     } while (0);
 
 #ifdef DEBUG_ROTATION_PERFROMANCE
@@ -495,13 +653,6 @@ bool RotationBufferProvider::setupRotationBuffer(VideoPayloadBuffer *payload, in
          getMilliseconds() - setup_Begin);
 #endif
 
-    if (mSourceSurface > 0) {
-        vaStatus = vaDestroySurfaces(mVaDpy, &mSourceSurface, 1);
-        if (vaStatus != VA_STATUS_SUCCESS)
-            WTRACE("vaDestroySurfaces failed, vaStatus = %d", vaStatus);
-        mSourceSurface = 0;
-    }
-
     if (vaStatus != VA_STATUS_SUCCESS) {
         stopVA();
         return false; // To not block HWC, just abort instead of retry
@@ -515,6 +666,184 @@ bool RotationBufferProvider::setupRotationBuffer(VideoPayloadBuffer *payload, in
     return true;
 }
 
+bool RotationBufferProvider::syncRotationBuffer()
+{
+    VAStatus vaStatus = VA_STATUS_SUCCESS;
+
+    if (mPendingIndex < 0) {
+        return true;
+    }
+
+#ifdef DEBUG_ROTATION_PERFROMANCE
+    uint32_t syncBegin = getMilliseconds();
+#endif
+    if (mRotatedSurfaces[mPendingIndex]) {
+        vaStatus = vaSyncSurface(mVaDpy, mRotatedSurfaces[mPendingIndex]);
+    }
+#ifdef DEBUG_ROTATION_PERFROMANCE
+    ITRACE("time spent %dms waiting for rotation", getMilliseconds() - syncBegin);
+#endif
+
+    mPendingIndex = -1;
+
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaSyncSurface failed. vaStatus = %#x", vaStatus);
+        return false;
+    }
+    return true;
+}
+
+bool RotationBufferProvider::getSourceSurface(VideoPayloadBuffer *payload, int transform)
+{
+    VAStatus vaStatus;
+    uint32_t cropWidth = payload->crop_width;
+    uint32_t cropHeight = payload->crop_height;
+
+    ssize_t index = mSourceSurfaces.indexOfKey(payload->khandle);
+    if (index >= 0) {
+        const SourceSurface& cached = mSourceSurfaces.valueAt(index);
+        if (cached.cropWidth == cropWidth &&
+            cached.cropHeight == cropHeight &&
+            cached.bobDeinterlace == payload->bob_deinterlace &&
+            cached.fieldShift == getFieldShift(payload)) {
+            mSourceSurface = cached.surface;
+            mBobDeinterlace = payload->bob_deinterlace;
+            // same fallback as createVaSurface() for a missing video crop
+            if (!cropWidth || !cropHeight) {
+                payload->crop_width = payload->width;
+                payload->crop_height = payload->height >> cached.fieldShift;
+            }
+            return true;
+        }
+
+        VTRACE("source surface of khandle %#x is stale", (uint32_t)payload->khandle);
+        VASurfaceID surface = cached.surface;
+        if (surface == mPrevSourceSurface) {
+            mPrevSourceSurface = 0;
+        }
+        vaStatus = vaDestroySurfaces(mVaDpy, &surface, 1);
+        if (vaStatus != VA_STATUS_SUCCESS)
+            WTRACE("vaDestroySurfaces failed, vaStatus = %d", vaStatus);
+        mSourceSurfaces.removeItemsAt(index);
+    }
+
+    if (mSourceSurfaces.size() >= SOURCE_SURFACE_COUNT) {
+        WTRACE("mSourceSurfaces is unexpectedly full. Invalidate caches");
+        freeSourceSurfaces();
+    }
+
+    if (!createVaSurface(payload, transform, false)) {
+        return false;
+    }
+
+    SourceSurface entry;
+    entry.surface = mSourceSurface;
+    entry.cropWidth = cropWidth;
+    entry.cropHeight = cropHeight;
+    entry.bobDeinterlace = payload->bob_deinterlace;
+    entry.fieldShift = getFieldShift(payload);
+    mSourceSurfaces.add(payload->khandle, entry);
+    return true;
+}
+
+void RotationBufferProvider::freeSourceSurfaces()
+{
+    VAStatus vaStatus;
+
+    if (!mSourceSurfaces.size()) {
+        return;
+    }
+
+    // a queued rotation may still be reading from one of them
+    syncRotationBuffer();
+
+    for (size_t i = 0; i < mSourceSurfaces.size(); i++) {
+        VASurfaceID surface = mSourceSurfaces.valueAt(i).surface;
+        vaStatus = vaDestroySurfaces(mVaDpy, &surface, 1);
+        if (vaStatus != VA_STATUS_SUCCESS)
+            WTRACE("vaDestroySurfaces failed, vaStatus = %d", vaStatus);
+    }
+    mSourceSurfaces.clear();
+    mSourceSurface = 0;
+    mPrevSourceSurface = 0;
+}
+
+int RotationBufferProvider::getFieldShift(VideoPayloadBuffer *payload) const
+{
+    return (payload->bob_deinterlace && !mVaBufDeinterlace) ? 1 : 0;
+}
+
+bool RotationBufferProvider::isDeinterlaceSupported() const
+{
+    return mDeinterlaceEnabled && mDeinterlaceMode != DEINTERLACE_UNSUPPORTED;
+}
+
+bool RotationBufferProvider::createDeinterlaceFilter(VAProcFilterType *filters,
+                                                     unsigned int numFilters)
+{
+    VAStatus vaStatus;
+    bool supported = false;
+
+    for (unsigned int i = 0; i < numFilters; i++) {
+        if (filters[i] == VAProcFilterDeinterlacing)
+            supported = true;
+    }
+
+    mDeinterlaceMode = DEINTERLACE_UNSUPPORTED;
+    if (!supported) {
+        DTRACE("VAProcFilterDeinterlacing is not supported");
+        return false;
+    }
+
+    VAProcFilterCapDeinterlacing caps[VAProcDeinterlacingCount];
+    unsigned int numCaps = VAProcDeinterlacingCount;
+    vaStatus = vaQueryVideoProcFilterCaps(mVaDpy, mVaCtx,
+                                          VAProcFilterDeinterlacing,
+                                          caps, &numCaps);
+    CHECK_VA_STATUS_RETURN("vaQueryVideoProcFilterCaps");
+
+    // motion adaptive if the driver has it, bob otherwise
+    for (unsigned int i = 0; i < numCaps; i++) {
+        if (caps[i].type == VAProcDeinterlacingMotionAdaptive) {
+            mDeinterlaceMode = DEINTERLACE_MOTION_ADAPTIVE;
+        } else if (caps[i].type == VAProcDeinterlacingBob &&
+                   mDeinterlaceMode == DEINTERLACE_UNSUPPORTED) {
+            mDeinterlaceMode = DEINTERLACE_BOB;
+        }
+    }
+    if (mDeinterlaceMode == DEINTERLACE_UNSUPPORTED) {
+        DTRACE("no bob or motion adaptive deinterlacing");
+        return false;
+    }
+
+    VAProcFilterParameterBufferDeinterlacing deinterlace;
+    memset(&deinterlace, 0, sizeof(deinterlace));
+    deinterlace.type = VAProcFilterDeinterlacing;
+    deinterlace.algorithm = mDeinterlaceMode == DEINTERLACE_MOTION_ADAPTIVE ?
+                            VAProcDeinterlacingMotionAdaptive :
+                            VAProcDeinterlacingBob;
+    // top field first, one progressive frame per decoded frame
+    deinterlace.flags = 0;
+
+    vaStatus = vaCreateBuffer(mVaDpy,
+                              mVaCtx,
+                              VAProcFilterParameterBufferType,
+                              sizeof(deinterlace),
+                              1,
+                              &deinterlace,
+                              &mVaBufDeinterlace);
+    if (vaStatus != VA_STATUS_SUCCESS) {
+        ETRACE("vaCreateBuffer (deinterlace) failed. vaStatus = %#x", vaStatus);
+        mVaBufDeinterlace = 0;
+        mDeinterlaceMode = DEINTERLACE_UNSUPPORTED;
+        return false;
+    }
+
+    DTRACE("%s deinterlacing",
+           mDeinterlaceMode == DEINTERLACE_MOTION_ADAPTIVE ? "motion adaptive" : "bob");
+    return true;
+}
+
 bool RotationBufferProvider::prepareBufferInfo(int w, int h, int stride, VideoPayloadBuffer *payload, void *user_pt)
 {
     int chroma_offset, size;
@@ -565,12 +894,16 @@ void RotationBufferProvider::freeVaSurfaces()
     bool ret;
     VAStatus vaStatus;
 
+    freeSourceSurfaces();
+
     for (int i = 0; i < MAX_SURFACE_NUM; i++) {
         if (NULL != mDrmBuf[i]) {
             ret = mWsbm->destroyTTMBuffer(mDrmBuf[i]);
             if (!ret)
                 WTRACE("failed to free TTMBuffer");
+            MemoryAccounting::remove(MemoryAccounting::ROTATION_BUFFER, mDrmBufSize[i]);
             mDrmBuf[i] = NULL;
+            mDrmBufSize[i] = 0;
         }
     }
 
@@ -585,39 +918,55 @@ void RotationBufferProvider::freeVaSurfaces()
     }
 }
 
-void RotationBufferProvider::stopVA()
+void RotationBufferProvider::destroyVaContext()
 {
+    // never free surfaces the hardware is still writing to
+    syncRotationBuffer();
     freeVaSurfaces();
 
     if (0 != mVaBufFilter)
         vaDestroyBuffer(mVaDpy, mVaBufFilter);
-    if (0 != mVaCfg)
-        vaDestroyConfig(mVaDpy,mVaCfg);
+    if (0 != mVaBufDeinterlace)
+        vaDestroyBuffer(mVaDpy, mVaBufDeinterlace);
     if (0 != mVaCtx)
         vaDestroyContext(mVaDpy, mVaCtx);
-    if (0 != mVaDpy)
-        vaTerminate(mVaDpy);
-
-    mVaInitialized = false;
 
     for (int i = 0; i < MAX_SURFACE_NUM; i++) {
         mKhandles[i] = 0;
         mRotatedSurfaces[i] = 0;
         mDrmBuf[i] = NULL;
     }
-    // reset VA variable
-    mVaDpy = 0;
-    mVaCfg = 0;
     mVaCtx = 0;
     mVaBufFilter = 0;
+    mVaBufDeinterlace = 0;
+    mDeinterlaced = false;
     mSourceSurface = 0;
 
-    mWidth = 0;
-    mHeight = 0;
     mRotatedWidth = 0;
     mRotatedHeight = 0;
     mRotatedStride = 0;
     mTargetIndex = 0;
+    mPendingIndex = -1;
+}
+
+void RotationBufferProvider::stopVA()
+{
+    destroyVaContext();
+
+    if (0 != mVaCfg)
+        vaDestroyConfig(mVaDpy,mVaCfg);
+    if (0 != mVaDpy)
+        VaDisplayManager::release(mVaDpy);
+
+    mVaInitialized = false;
+    mVaStarted = false;
+
+    // reset VA variable
+    mVaDpy = 0;
+    mVaCfg = 0;
+
+    mWidth = 0;
+    mHeight = 0;
     mBobDeinterlace = 0;
 }
 
@@ -44,34 +44,73 @@ public:
     void deinitialize();
     void reset();
     bool setupRotationBuffer(VideoPayloadBuffer *payload, int transform);
+    bool syncRotationBuffer();
     bool prepareBufferInfo(int, int, int, VideoPayloadBuffer *, void *);
 
+    // interlaced frames are deinterlaced by VA, along with the rotation
+    // if any; unknown until the first context is created
+    bool isDeinterlaceSupported() const;
+    // the last buffer set up is a progressive frame of interlaced video
+    bool isDeinterlaced() const { return mDeinterlaced; }
+
+    // starts the VA display and config ahead of the first rotated frame
+    bool prewarm();
+    // releases VA once unused for the keep warm time; the display and
+    // config are kept while a video session is active. Returns true if
+    // VA is still up.
+    bool releaseIdle(nsecs_t now, bool videoActive);
+
 private:
     void invalidateCaches();
     bool startVA(VideoPayloadBuffer *payload, int transform);
+    bool startVADisplay();
     void stopVA();
+    bool createVaContext(VideoPayloadBuffer *payload, int transform);
+    bool createDeinterlaceFilter(VAProcFilterType *filters, unsigned int numFilters);
+    // 1 if only one field of the source is read
+    int getFieldShift(VideoPayloadBuffer *payload) const;
+    void destroyVaContext();
     bool isContextChanged(int width, int height, int transform);
     int transFromHalToVa(int transform);
     buffer_handle_t createWsbmBuffer(int width, int height, void **buf);
     int getStride(bool isTarget, int width);
     bool createVaSurface(VideoPayloadBuffer *payload, int transform, bool isTarget);
     void freeVaSurfaces();
+    bool getSourceSurface(VideoPayloadBuffer *payload, int transform);
+    void freeSourceSurfaces();
     inline uint32_t getMilliseconds();
 
 private:
     enum {
-        MAX_SURFACE_NUM = 4
+        MAX_SURFACE_NUM = 4,
+        // ms VA stays up after the last rotated frame
+        DEFAULT_KEEP_WARM_TIME = 3000,
+    };
+
+    enum {
+        DEINTERLACE_UNKNOWN,
+        DEINTERLACE_UNSUPPORTED,
+        DEINTERLACE_BOB,
+        DEINTERLACE_MOTION_ADAPTIVE,
     };
 
     Wsbm* mWsbm;
 
+    // the context is created
     bool mVaInitialized;
+    // the display and config are created
+    bool mVaStarted;
     VADisplay mVaDpy;
     VAConfigID mVaCfg;
     VAContextID mVaCtx;
     VABufferID mVaBufFilter;
+    VABufferID mVaBufDeinterlace;
+    // reference frame of motion adaptive deinterlacing
+    VASurfaceID mPrevSourceSurface;
+    bool mDeinterlaceEnabled;
+    int mDeinterlaceMode;
+    bool mDeinterlaced;
     VASurfaceID mSourceSurface;
-    Display mDisplay;
 
     // rotation config variables
     int mWidth;
@@ -83,17 +122,36 @@ private:
     int mRotatedStride;
 
     int mTargetIndex;
+    // target surface being rotated asynchronously, or -1
+    int mPendingIndex;
+    bool mAsyncRotation;
     buffer_handle_t mKhandles[MAX_SURFACE_NUM];
     VASurfaceID mRotatedSurfaces[MAX_SURFACE_NUM];
     void *mDrmBuf[MAX_SURFACE_NUM];
+    uint32_t mDrmBufSize[MAX_SURFACE_NUM];
 
     enum {
         TTM_WRAPPER_COUNT = 10,
+        SOURCE_SURFACE_COUNT = 32,
+    };
+
+    // source surfaces wrapping decoder buffers, keyed by khandle
+    struct SourceSurface {
+        VASurfaceID surface;
+        uint32_t cropWidth;
+        uint32_t cropHeight;
+        int bobDeinterlace;
+        int fieldShift;
     };
+    KeyedVector<buffer_handle_t, SourceSurface> mSourceSurfaces;
 
     KeyedVector<uint64_t, void*> mTTMWrappers; /* userPt/wsbmBuffer  */
 
     int mBobDeinterlace;
+
+    // last rotated frame or prewarm
+    nsecs_t mLastUse;
+    nsecs_t mKeepWarmTime;
 };
 
 } // name space intel
@@ -0,0 +1,87 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <HwcTrace.h>
+#include <common/RotationModePredictor.h>
+
+namespace android {
+namespace intel {
+
+RotationModePredictor::RotationModePredictor()
+    : mMode(MODE_OVERLAY),
+      mSwitchTime(0),
+      mSupportedFrames(0),
+      mOverlaySwitches(0),
+      mDecoderSwitches(0),
+      mHeldFrames(0)
+{
+}
+
+bool RotationModePredictor::predict(bool overlaySupported, nsecs_t now)
+{
+    if (!overlaySupported) {
+        // rotated buffers are always correct, leave at once
+        mSupportedFrames = 0;
+        if (mMode == MODE_OVERLAY) {
+            switchTo(MODE_DECODER, now);
+        }
+        return false;
+    }
+
+    if (mMode == MODE_DECODER) {
+        mSupportedFrames++;
+        if (mSupportedFrames < STABLE_FRAMES ||
+            now - mSwitchTime < HOLD_TIME) {
+            mHeldFrames++;
+            return false;
+        }
+        switchTo(MODE_OVERLAY, now);
+    }
+    return true;
+}
+
+void RotationModePredictor::switchTo(int mode, nsecs_t now)
+{
+    DTRACE("rotation mode %d -> %d after %lld ms", mMode, mode,
+           mSwitchTime ? ns2ms(now - mSwitchTime) : 0);
+
+    mMode = mode;
+    mSwitchTime = now;
+    mSupportedFrames = 0;
+    if (mode == MODE_OVERLAY) {
+        mOverlaySwitches++;
+    } else {
+        mDecoderSwitches++;
+    }
+    STRACE_INT("hwc_rotation_mode", mode);
+}
+
+void RotationModePredictor::reset()
+{
+    mMode = MODE_OVERLAY;
+    mSwitchTime = 0;
+    mSupportedFrames = 0;
+}
+
+void RotationModePredictor::dump(Dump& d)
+{
+    d.append("      rotation mode %s: switches to overlay %u, to decoder %u, "
+             "held frames %u\n",
+             mMode == MODE_OVERLAY ? "overlay" : "decoder",
+             mOverlaySwitches, mDecoderSwitches, mHeldFrames);
+}
+
+} // namespace intel
+} // namespace android
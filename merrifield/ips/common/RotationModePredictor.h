@@ -0,0 +1,74 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef ROTATION_MODE_PREDICTOR_H
+#define ROTATION_MODE_PREDICTOR_H
+
+#include <utils/Timers.h>
+#include <Dump.h>
+
+namespace android {
+namespace intel {
+
+// Chooses between overlay rotation and decoder (VA) rotated buffers for a
+// rotated video. Overlay rotation is left as soon as it is not supported,
+// but it is only taken back once it has been supported for a while, so a
+// crop that oscillates around a limit (e.g. during a zoom) settles on the
+// rotated buffers instead of restarting the decoder rotation every frame.
+class RotationModePredictor {
+public:
+    enum {
+        MODE_OVERLAY = 0,
+        MODE_DECODER,
+    };
+
+    enum {
+        // frames overlay rotation must be supported in a row
+        STABLE_FRAMES = 8,
+    };
+
+    // minimum time in a mode before overlay rotation is taken back
+    static const nsecs_t HOLD_TIME = 500000000LL;
+
+public:
+    RotationModePredictor();
+
+public:
+    // overlaySupported is the decision of the current frame alone, returns
+    // true if overlay rotation is to be used
+    bool predict(bool overlaySupported, nsecs_t now);
+    // a new video session starts with overlay rotation
+    void reset();
+    int getMode() const { return mMode; }
+
+    void dump(Dump& d);
+
+private:
+    void switchTo(int mode, nsecs_t now);
+
+private:
+    int mMode;
+    nsecs_t mSwitchTime;
+    uint32_t mSupportedFrames;
+    // statistics
+    uint32_t mOverlaySwitches;
+    uint32_t mDecoderSwitches;
+    uint32_t mHeldFrames;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* ROTATION_MODE_PREDICTOR_H */
@@ -53,12 +53,8 @@ bool TTMBufferMapper::map()
         return false;
     }
 
-    // TODO: review this later
-    ret = mWsbm.waitIdleTTMBuffer(wsbmBufferObject);
-    if (ret == false) {
-        ETRACE("failed to wait ttm buffer idle");
-        return false;
-    }
+    // not waited for idle here, the planes check isIdle() before they
+    // show a buffer the decoder may still be writing
 
     virtAddr = mWsbm.getCPUAddress(wsbmBufferObject);
     gttOffsetInPage = mWsbm.getGttOffset(wsbmBufferObject);
@@ -92,11 +88,24 @@ bool TTMBufferMapper::unmap()
     return true;
 }
 
+void TTMBufferMapper::share(const TTMBufferMapper& other)
+{
+    mBufferObject = other.mBufferObject;
+    mGttOffsetInPage = other.mGttOffsetInPage;
+    mCpuAddress = other.mCpuAddress;
+    mSize = other.mSize;
+}
+
 bool TTMBufferMapper::waitIdle()
 {
     return mWsbm.waitIdleTTMBuffer(mBufferObject);
 }
 
+bool TTMBufferMapper::isIdle()
+{
+    return mWsbm.isIdleTTMBuffer(mBufferObject);
+}
+
 } // namespace intel
 } // namespace android
 
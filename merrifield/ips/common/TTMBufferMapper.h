@@ -30,6 +30,9 @@ public:
 public:
     bool map();
     bool unmap();
+    // makes this a view of the mapping of other, with a crop of its own;
+    // a view is never unmapped, other has to stay mapped while it lives
+    void share(const TTMBufferMapper& other);
 
     uint32_t getGttOffsetInPage(int subIndex) const {
         return mGttOffsetInPage;
@@ -52,6 +55,8 @@ public:
 
     // wait idle
     bool waitIdle();
+    // no writer is pending, does not block
+    bool isIdle();
 private:
     int mRefCount;
     Wsbm& mWsbm;
@@ -0,0 +1,252 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <HwcTrace.h>
+#include <common/TTMBufferMapper.h>
+#include <common/TTMMapperPool.h>
+
+namespace android {
+namespace intel {
+
+TTMMapperPool& TTMMapperPool::getInstance()
+{
+    static TTMMapperPool sPool;
+    return sPool;
+}
+
+TTMMapperPool::TTMMapperPool()
+    : mEntries(),
+      mClock(0),
+      mHits(0),
+      mMisses(0),
+      mWsbm(0),
+      mUsers(0)
+{
+}
+
+TTMMapperPool::~TTMMapperPool()
+{
+    if (mUsers) {
+        WTRACE("pool still has %d users", mUsers);
+    }
+}
+
+bool TTMMapperPool::initialize(int drmFd)
+{
+    Mutex::Autolock _l(mLock);
+    if (mUsers++) {
+        return true;
+    }
+
+    mWsbm = new Wsbm(drmFd);
+    if (!mWsbm || !mWsbm->initialize()) {
+        ETRACE("failed to create wsbm");
+        delete mWsbm;
+        mWsbm = 0;
+        mUsers = 0;
+        return false;
+    }
+    mEntries.setCapacity(POOL_CAPACITY);
+    return true;
+}
+
+void TTMMapperPool::deinitialize()
+{
+    Mutex::Autolock _l(mLock);
+    if (!mUsers || --mUsers) {
+        return;
+    }
+
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        BufferMapper *mapper = mEntries.itemAt(i).mapper;
+        if (mapper->getRef()) {
+            WTRACE("mapper %p is still referenced", mapper->getHandle());
+        }
+        destroyMapper(mapper);
+    }
+    mEntries.clear();
+
+    mWsbm->deinitialize();
+    delete mWsbm;
+    mWsbm = 0;
+}
+
+int TTMMapperPool::find(buffer_handle_t khandle, uint32_t width,
+                        uint32_t height, uint32_t format) const
+{
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        BufferMapper *mapper = mEntries.itemAt(i).mapper;
+        if (mapper->getHandle() == khandle &&
+            mapper->getWidth() == width &&
+            mapper->getHeight() == height &&
+            mapper->getFormat() == format) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+BufferMapper* TTMMapperPool::acquire(buffer_handle_t khandle, uint32_t width,
+                                     uint32_t height, uint32_t format)
+{
+    Mutex::Autolock _l(mLock);
+    int index = find(khandle, width, height, format);
+    if (index < 0) {
+        return 0;
+    }
+
+    mHits++;
+    return createView(mEntries.editItemAt(index));
+}
+
+BufferMapper* TTMMapperPool::acquire(DataBuffer& buffer)
+{
+    Mutex::Autolock _l(mLock);
+    if (!mWsbm) {
+        ETRACE("pool is not initialized");
+        return 0;
+    }
+
+    int index = find(buffer.getHandle(), buffer.getWidth(),
+                     buffer.getHeight(), buffer.getFormat());
+    if (index >= 0) {
+        mHits++;
+        return createView(mEntries.editItemAt(index));
+    }
+
+    mMisses++;
+    TTMBufferMapper *mapper = new TTMBufferMapper(*mWsbm, buffer);
+    if (!mapper) {
+        ETRACE("failed to allocate mapper");
+        return 0;
+    }
+
+    bool ret = mapper->map();
+    if (!ret) {
+        // drop the unreferenced wrappings and try again
+        WTRACE("failed to map, trimming pool");
+        for (size_t i = mEntries.size(); i > 0; i--) {
+            if (!mEntries.itemAt(i - 1).mapper->getRef()) {
+                destroyMapper(mEntries.itemAt(i - 1).mapper);
+                mEntries.removeAt(i - 1);
+            }
+        }
+        ret = mapper->map();
+    }
+    if (!ret) {
+        ETRACE("failed to map TTM buffer");
+        delete mapper;
+        return 0;
+    }
+
+    Entry entry;
+    entry.mapper = mapper;
+    entry.lastUse = mClock;
+    mEntries.push_back(entry);
+    BufferMapper *view = createView(mEntries.editTop());
+    trim();
+    return view;
+}
+
+BufferMapper* TTMMapperPool::createView(Entry& entry)
+{
+    TTMBufferMapper *mapper = static_cast<TTMBufferMapper*>(entry.mapper);
+    TTMBufferMapper *view = new TTMBufferMapper(*mWsbm, *mapper);
+    if (!view) {
+        ETRACE("failed to allocate mapper view");
+        return 0;
+    }
+    view->share(*mapper);
+    view->incRef();
+    mapper->incRef();
+    entry.lastUse = ++mClock;
+    return view;
+}
+
+void TTMMapperPool::release(BufferMapper *view)
+{
+    if (!view) {
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (view->decRef() > 0) {
+        return;
+    }
+
+    int index = find(view->getHandle(), view->getWidth(),
+                     view->getHeight(), view->getFormat());
+    if (index < 0 || mEntries.itemAt(index).mapper->decRef() < 0) {
+        ETRACE("invalid ref count");
+    }
+    delete view;
+    trim();
+}
+
+bool TTMMapperPool::isIdle(BufferMapper *mapper)
+{
+    // every mapper of the pool is a TTM mapper
+    return mapper && static_cast<TTMBufferMapper*>(mapper)->isIdle();
+}
+
+bool TTMMapperPool::waitIdle(BufferMapper *mapper)
+{
+    return mapper && static_cast<TTMBufferMapper*>(mapper)->waitIdle();
+}
+
+void TTMMapperPool::trim()
+{
+    // evict the least recently used unreferenced mappers beyond capacity
+    while (mEntries.size() > POOL_CAPACITY) {
+        int victim = -1;
+        uint32_t oldestAge = 0;
+        for (size_t i = 0; i < mEntries.size(); i++) {
+            const Entry& entry = mEntries.itemAt(i);
+            uint32_t age = mClock - entry.lastUse;
+            if (!entry.mapper->getRef() && (victim < 0 || age > oldestAge)) {
+                victim = i;
+                oldestAge = age;
+            }
+        }
+        if (victim < 0) {
+            // everything is in use
+            return;
+        }
+        destroyMapper(mEntries.itemAt(victim).mapper);
+        mEntries.removeAt(victim);
+    }
+}
+
+void TTMMapperPool::destroyMapper(BufferMapper *mapper)
+{
+    VTRACE("unwrapping TTM buffer %p", mapper->getHandle());
+    mapper->unmap();
+    delete mapper;
+}
+
+void TTMMapperPool::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    size_t referenced = 0;
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        if (mEntries.itemAt(i).mapper->getRef())
+            referenced++;
+    }
+    d.append("TTM mapper pool: %d/%d mappers, %d referenced, hits %u, misses %u\n",
+             mEntries.size(), POOL_CAPACITY, referenced, mHits, mMisses);
+}
+
+} // namespace intel
+} // namespace android
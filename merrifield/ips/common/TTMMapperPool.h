@@ -0,0 +1,94 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef TTM_MAPPER_POOL_H
+#define TTM_MAPPER_POOL_H
+
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+#include <Dump.h>
+#include <BufferMapper.h>
+#include <common/Wsbm.h>
+
+namespace android {
+namespace intel {
+
+// TTM mappers of the rotation and scaling buffers shared by all overlay
+// planes. Unreferenced mappers stay wrapped until they are the least
+// recently used ones beyond the pool capacity, so a video moving from one
+// overlay to another, or a plane being reassigned, finds its ring wrapped.
+// Each user gets a view of the pooled mapping, so the crop a plane sets
+// is its own.
+class TTMMapperPool {
+public:
+    static TTMMapperPool& getInstance();
+
+public:
+    // reference counted, every overlay plane initializes the pool
+    bool initialize(int drmFd);
+    void deinitialize();
+
+    // lookup by kernel handle and geometry, the returned view holds a
+    // reference to be dropped with release(); a view referenced again by
+    // its user is deleted by the last release()
+    BufferMapper* acquire(buffer_handle_t khandle, uint32_t width,
+                          uint32_t height, uint32_t format);
+    // wraps the buffer if it is not pooled yet
+    BufferMapper* acquire(DataBuffer& buffer);
+    void release(BufferMapper *view);
+    // idle state of a mapper of the pool, isIdle() returns at once
+    bool isIdle(BufferMapper *mapper);
+    bool waitIdle(BufferMapper *mapper);
+
+    Wsbm* getWsbm() const { return mWsbm; }
+
+    void dump(Dump& d);
+
+private:
+    TTMMapperPool();
+    ~TTMMapperPool();
+
+    enum {
+        // rotation rings of two video streams
+        POOL_CAPACITY = 16,
+    };
+
+    struct Entry {
+        BufferMapper *mapper;
+        uint32_t lastUse;
+    };
+
+    int find(buffer_handle_t khandle, uint32_t width, uint32_t height,
+             uint32_t format) const;
+    void trim();
+    void destroyMapper(BufferMapper *mapper);
+    // a new view of the mapper of the entry, which takes a reference
+    BufferMapper* createView(Entry& entry);
+
+private:
+    Vector<Entry> mEntries;
+    uint32_t mClock;
+    uint32_t mHits;
+    uint32_t mMisses;
+    Wsbm *mWsbm;
+    int mUsers;
+    // overlay planes of different displays may be prepared in parallel
+    Mutex mLock;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* TTM_MAPPER_POOL_H */
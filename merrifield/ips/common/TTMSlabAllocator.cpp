@@ -0,0 +1,207 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <string.h>
+#include <HwcTrace.h>
+#include <MemoryAccounting.h>
+#include <common/TTMSlabAllocator.h>
+
+namespace android {
+namespace intel {
+
+// gtt offsets are in 4KB pages
+#define SLOT_PAGES (TTMSlabAllocator::SLOT_SIZE >> 12)
+
+TTMSlabAllocator& TTMSlabAllocator::getInstance()
+{
+    static TTMSlabAllocator sAllocator;
+    return sAllocator;
+}
+
+TTMSlabAllocator::TTMSlabAllocator()
+    : mWsbm(0),
+      mUsers(0)
+{
+    memset(mSlabs, 0, sizeof(mSlabs));
+}
+
+TTMSlabAllocator::~TTMSlabAllocator()
+{
+    if (mUsers) {
+        WTRACE("allocator still has %d users", mUsers);
+    }
+}
+
+bool TTMSlabAllocator::initialize(int drmFd)
+{
+    Mutex::Autolock _l(mLock);
+    if (mUsers++) {
+        return true;
+    }
+
+    mWsbm = new Wsbm(drmFd);
+    if (!mWsbm || !mWsbm->initialize()) {
+        ETRACE("failed to create wsbm");
+        delete mWsbm;
+        mWsbm = 0;
+        mUsers = 0;
+        return false;
+    }
+    memset(mSlabs, 0, sizeof(mSlabs));
+    return true;
+}
+
+void TTMSlabAllocator::deinitialize()
+{
+    Mutex::Autolock _l(mLock);
+    if (!mUsers || --mUsers) {
+        return;
+    }
+
+    for (int i = 0; i < MAX_SLABS; i++) {
+        if (mSlabs[i].usedSlots) {
+            WTRACE("slab %d still has slots %#x", i, mSlabs[i].usedSlots);
+        }
+        destroySlab(i);
+    }
+
+    mWsbm->deinitialize();
+    delete mWsbm;
+    mWsbm = 0;
+}
+
+bool TTMSlabAllocator::createSlab(int index)
+{
+    Slab& slab = mSlabs[index];
+    void *bufObject = 0;
+
+    bool ret = mWsbm->allocateTTMBuffer(SLOT_SIZE * SLOTS_PER_SLAB, SLOT_SIZE, &bufObject);
+    if (ret == false) {
+        ETRACE("failed to allocate slab %d", index);
+        return false;
+    }
+
+    slab.bufObject = bufObject;
+    slab.cpuAddress = (uint8_t *)mWsbm->getCPUAddress(bufObject);
+    slab.gttOffsetInPage = mWsbm->getGttOffset(bufObject);
+    slab.usedSlots = 0;
+    MemoryAccounting::add(MemoryAccounting::OVERLAY_BACK_BUFFER, SLOT_SIZE * SLOTS_PER_SLAB);
+    VTRACE("slab %d: cpu %p, gtt %d", index, slab.cpuAddress, slab.gttOffsetInPage);
+    return true;
+}
+
+void TTMSlabAllocator::destroySlab(int index)
+{
+    Slab& slab = mSlabs[index];
+    if (!slab.bufObject) {
+        return;
+    }
+
+    if (!mWsbm->destroyTTMBuffer(slab.bufObject)) {
+        WTRACE("failed to destroy slab %d", index);
+    }
+    MemoryAccounting::remove(MemoryAccounting::OVERLAY_BACK_BUFFER, SLOT_SIZE * SLOTS_PER_SLAB);
+    memset(&slab, 0, sizeof(slab));
+}
+
+int TTMSlabAllocator::allocate(void **cpuAddress, uint32_t *gttOffsetInPage)
+{
+    if (!cpuAddress || !gttOffsetInPage) {
+        ETRACE("invalid parameters");
+        return -1;
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (!mWsbm) {
+        ETRACE("allocator is not initialized");
+        return -1;
+    }
+
+    // fill existing slabs first, a new slab is created on demand
+    int empty = -1;
+    for (int i = 0; i < MAX_SLABS; i++) {
+        Slab& slab = mSlabs[i];
+        if (!slab.bufObject) {
+            if (empty < 0)
+                empty = i;
+            continue;
+        }
+        if (slab.usedSlots == (1UL << SLOTS_PER_SLAB) - 1) {
+            continue;
+        }
+
+        for (int j = 0; j < SLOTS_PER_SLAB; j++) {
+            if (!(slab.usedSlots & (1 << j))) {
+                slab.usedSlots |= (1 << j);
+                *cpuAddress = slab.cpuAddress + j * SLOT_SIZE;
+                *gttOffsetInPage = slab.gttOffsetInPage + j * SLOT_PAGES;
+                return i * SLOTS_PER_SLAB + j;
+            }
+        }
+    }
+
+    if (empty < 0 || !createSlab(empty)) {
+        return -1;
+    }
+
+    mSlabs[empty].usedSlots = 1;
+    *cpuAddress = mSlabs[empty].cpuAddress;
+    *gttOffsetInPage = mSlabs[empty].gttOffsetInPage;
+    return empty * SLOTS_PER_SLAB;
+}
+
+void TTMSlabAllocator::release(int slot)
+{
+    int index = slot / SLOTS_PER_SLAB;
+    if (slot < 0 || index >= MAX_SLABS) {
+        ETRACE("invalid slot %d", slot);
+        return;
+    }
+
+    Mutex::Autolock _l(mLock);
+    Slab& slab = mSlabs[index];
+    slab.usedSlots &= ~(1 << (slot % SLOTS_PER_SLAB));
+
+    // keep one slab around, overlays are reinitialized in bursts
+    if (!slab.usedSlots && index != 0) {
+        destroySlab(index);
+    }
+}
+
+void TTMSlabAllocator::trim()
+{
+    Mutex::Autolock _l(mLock);
+    for (int i = 0; i < MAX_SLABS; i++) {
+        if (mSlabs[i].bufObject && !mSlabs[i].usedSlots) {
+            destroySlab(i);
+        }
+    }
+}
+
+void TTMSlabAllocator::dump(Dump& d)
+{
+    Mutex::Autolock _l(mLock);
+    d.append("TTM slabs:");
+    for (int i = 0; i < MAX_SLABS; i++) {
+        if (mSlabs[i].bufObject) {
+            d.append(" [%d: gtt %d, slots %#x]", i, mSlabs[i].gttOffsetInPage,
+                     mSlabs[i].usedSlots);
+        }
+    }
+    d.append("\n");
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,80 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef TTM_SLAB_ALLOCATOR_H
+#define TTM_SLAB_ALLOCATOR_H
+
+#include <utils/Mutex.h>
+#include <Dump.h>
+#include <common/Wsbm.h>
+
+namespace android {
+namespace intel {
+
+// Carves fixed size slots out of a few large TTM buffers, for the small
+// objects every overlay plane allocates (the overlay register blocks).
+// A slot keeps the 64KB alignment of a dedicated allocation, so it is
+// exactly what the hardware would have been given, but a whole slab is
+// a single kernel object and allocation ioctl.
+class TTMSlabAllocator {
+public:
+    enum {
+        SLOT_SIZE = 64 * 1024,
+        SLOTS_PER_SLAB = 8,
+        MAX_SLABS = 4,
+    };
+
+    static TTMSlabAllocator& getInstance();
+
+public:
+    // reference counted like TTMMapperPool
+    bool initialize(int drmFd);
+    void deinitialize();
+
+    // returns a slot id, or -1 if all slabs are full or a new slab could
+    // not be allocated; the slot memory is not cleared
+    int allocate(void **cpuAddress, uint32_t *gttOffsetInPage);
+    void release(int slot);
+    // frees the empty slab release() keeps, once the overlays went idle
+    void trim();
+
+    void dump(Dump& d);
+
+private:
+    TTMSlabAllocator();
+    ~TTMSlabAllocator();
+
+    bool createSlab(int index);
+    void destroySlab(int index);
+
+private:
+    struct Slab {
+        void *bufObject;
+        uint8_t *cpuAddress;
+        uint32_t gttOffsetInPage;
+        // bit i set if slot i is allocated
+        uint32_t usedSlots;
+    };
+
+    Slab mSlabs[MAX_SLABS];
+    Wsbm *mWsbm;
+    int mUsers;
+    Mutex mLock;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* TTM_SLAB_ALLOCATOR_H */
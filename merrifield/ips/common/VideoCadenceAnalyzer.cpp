@@ -0,0 +1,124 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <HwcTrace.h>
+#include <common/VideoCadenceAnalyzer.h>
+
+namespace android {
+namespace intel {
+
+VideoCadenceAnalyzer::VideoCadenceAnalyzer()
+    : mStarted(false),
+      mLastTimestamp(0),
+      mLastPts(0),
+      mAnchorPts(0),
+      mAnchorTime(0),
+      mFrameInterval(0),
+      mFrames(0),
+      mRepeats(0),
+      mLateFrames(0),
+      mDroppedFrames(0),
+      mResyncs(0),
+      mMaxLateness(0)
+{
+}
+
+int VideoCadenceAnalyzer::analyze(int64_t timestamp, nsecs_t now)
+{
+    if (mStarted && timestamp == mLastTimestamp) {
+        mRepeats++;
+        return FRAME_REPEAT;
+    }
+
+    nsecs_t pts = us2ns(timestamp);
+    mFrames++;
+
+    if (!mStarted || pts < mLastPts || pts - mLastPts > RESYNC_TIME) {
+        // first frame, seek or pause
+        resync(timestamp, now);
+        return FRAME_NEW;
+    }
+
+    nsecs_t interval = pts - mLastPts;
+    if (mFrameInterval) {
+        // each more interval in the gap is a frame the decoder dropped
+        if (interval > mFrameInterval * 3 / 2) {
+            mDroppedFrames += (interval + mFrameInterval / 2) / mFrameInterval - 1;
+        }
+        mFrameInterval = (mFrameInterval * 7 + interval) / 8;
+    } else {
+        mFrameInterval = interval;
+    }
+    mLastTimestamp = timestamp;
+    mLastPts = pts;
+
+    nsecs_t lateness = (now - mAnchorTime) - (pts - mAnchorPts);
+    if (lateness < 0) {
+        // earlier than any frame so far, the stream is ahead of the anchor
+        mAnchorTime += lateness;
+        return FRAME_NEW;
+    }
+
+    if (lateness > RESYNC_TIME) {
+        resync(timestamp, now);
+        return FRAME_NEW;
+    }
+
+    if (lateness > mMaxLateness)
+        mMaxLateness = lateness;
+
+    if (lateness > LATE_TIME) {
+        VTRACE("frame %lld late by %lld ms", timestamp, ns2ms(lateness));
+        mLateFrames++;
+        return FRAME_LATE;
+    }
+    return FRAME_NEW;
+}
+
+void VideoCadenceAnalyzer::resync(int64_t timestamp, nsecs_t now)
+{
+    nsecs_t pts = us2ns(timestamp);
+
+    if (mStarted) {
+        VTRACE("resync after %lld ms of video", ns2ms(mLastPts - mAnchorPts));
+        mResyncs++;
+    }
+
+    mStarted = true;
+    mLastTimestamp = timestamp;
+    mLastPts = pts;
+    mAnchorPts = pts;
+    mAnchorTime = now;
+    mFrameInterval = 0;
+}
+
+void VideoCadenceAnalyzer::reset()
+{
+    mStarted = false;
+    mLastTimestamp = 0;
+    mLastPts = 0;
+    mFrameInterval = 0;
+}
+
+void VideoCadenceAnalyzer::dump(Dump& d)
+{
+    d.append("      video cadence: frames %u, repeats %u, late %u (max %lld ms), "
+             "dropped %u, resyncs %u\n",
+             mFrames, mRepeats, mLateFrames, ns2ms(mMaxLateness),
+             mDroppedFrames, mResyncs);
+}
+
+} // namespace intel
+} // namespace android
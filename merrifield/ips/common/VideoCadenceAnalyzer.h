@@ -0,0 +1,79 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef VIDEO_CADENCE_ANALYZER_H
+#define VIDEO_CADENCE_ANALYZER_H
+
+#include <utils/Timers.h>
+#include <Dump.h>
+
+namespace android {
+namespace intel {
+
+// Follows the presentation timestamps of the video frames shown by an
+// overlay against the time they reach the HWC. A frame with the timestamp
+// of the previous one is a repeat, its buffer holds the same picture. A
+// frame is late if it arrives later than the first frames of the stream
+// did relative to their timestamps; gaps in the timestamps are dropped
+// frames.
+class VideoCadenceAnalyzer {
+public:
+    enum {
+        FRAME_NEW = 0,
+        FRAME_REPEAT,
+        FRAME_LATE,
+    };
+
+    // lateness counted as a late frame
+    static const nsecs_t LATE_TIME = 20000000LL;
+    // lateness or timestamp jump taken as a pause or a seek
+    static const nsecs_t RESYNC_TIME = 500000000LL;
+
+public:
+    VideoCadenceAnalyzer();
+
+public:
+    // timestamp is the presentation timestamp of the payload, in us
+    int analyze(int64_t timestamp, nsecs_t now);
+    // a new video session
+    void reset();
+
+    void dump(Dump& d);
+
+private:
+    void resync(int64_t timestamp, nsecs_t now);
+
+private:
+    bool mStarted;
+    int64_t mLastTimestamp;
+    nsecs_t mLastPts;
+    // arrival time of a frame of timestamp mAnchorPts on time
+    nsecs_t mAnchorPts;
+    nsecs_t mAnchorTime;
+    // smoothed timestamp interval
+    nsecs_t mFrameInterval;
+    // statistics
+    uint32_t mFrames;
+    uint32_t mRepeats;
+    uint32_t mLateFrames;
+    uint32_t mDroppedFrames;
+    uint32_t mResyncs;
+    nsecs_t mMaxLateness;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* VIDEO_CADENCE_ANALYZER_H */
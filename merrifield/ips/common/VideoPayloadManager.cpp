@@ -14,6 +14,7 @@
 // limitations under the License.
 */
 
+#include <string.h>
 #include <HwcTrace.h>
 #include <BufferMapper.h>
 #include <common/GrallocSubBuffer.h>
@@ -24,27 +25,61 @@ namespace android {
 namespace intel {
 
 VideoPayloadManager::VideoPayloadManager()
-    : IVideoPayloadManager()
+    : IVideoPayloadManager(),
+      mVersion(0)
 {
+    memset(mEntries, 0, sizeof(mEntries));
 }
 
 VideoPayloadManager::~VideoPayloadManager()
 {
 }
 
-bool VideoPayloadManager::getMetaData(BufferMapper *mapper, MetaData *metadata)
+const IVideoPayloadManager::MetaData* VideoPayloadManager::getMetaData(BufferMapper *mapper)
 {
-    if (!mapper || !metadata) {
-        ETRACE("Null input params");
-        return false;
+    if (!mapper) {
+        ETRACE("Null mapper param");
+        return NULL;
     }
 
     VideoPayloadBuffer *p = (VideoPayloadBuffer*) mapper->getCpuAddress(SUB_BUFFER1);
     if (!p) {
         ETRACE("Got null payload from display buffer");
-        return false;
+        return NULL;
     }
 
+    Entry& entry = mEntries[((uintptr_t)p >> 12) % METADATA_CACHE_SIZE];
+    if (isCurrent(entry, p)) {
+        return &entry.metadata;
+    }
+
+    entry.payload = p;
+    entry.timestamp = p->timestamp;
+    entry.transform = p->metadata_transform;
+    entry.khandle = p->khandle;
+    entry.scalingKhandle = p->scaling_khandle;
+    entry.rotatedKhandle = p->rotated_buffer_handle;
+    entry.cropWidth = p->crop_width;
+    entry.cropHeight = p->crop_height;
+    buildMetaData(p, &entry.metadata);
+    entry.metadata.version = ++mVersion;
+    return &entry.metadata;
+}
+
+bool VideoPayloadManager::isCurrent(const Entry& entry, const VideoPayloadBuffer *p)
+{
+    return entry.payload == p &&
+           entry.timestamp == p->timestamp &&
+           entry.transform == p->metadata_transform &&
+           entry.khandle == p->khandle &&
+           entry.scalingKhandle == p->scaling_khandle &&
+           entry.rotatedKhandle == p->rotated_buffer_handle &&
+           entry.cropWidth == p->crop_width &&
+           entry.cropHeight == p->crop_height;
+}
+
+void VideoPayloadManager::buildMetaData(const VideoPayloadBuffer *p, MetaData *metadata)
+{
     metadata->format = p->format;
     metadata->transform = p->metadata_transform;
     metadata->timestamp = p->timestamp;
@@ -98,8 +133,6 @@ bool VideoPayloadManager::getMetaData(BufferMapper *mapper, MetaData *metadata)
     metadata->rotationBuffer.offsetX = (-metadata->rotationBuffer.width) & 0xf;
     metadata->rotationBuffer.offsetY = (-metadata->rotationBuffer.height) & 0xf;
     metadata->rotationBuffer.tiled = metadata->normalBuffer.tiled;
-
-    return true;
 }
 
 bool VideoPayloadManager::setRenderStatus(BufferMapper *mapper, bool renderStatus)
@@ -22,6 +22,7 @@ namespace android {
 namespace intel {
 
 class BufferMapper;
+struct VideoPayloadBuffer;
 
 class VideoPayloadManager : public IVideoPayloadManager {
 
@@ -31,9 +32,35 @@ public:
 
     // IVideoPayloadManager
 public:
-    virtual bool getMetaData(BufferMapper *mapper, MetaData *metadata);
+    virtual const MetaData* getMetaData(BufferMapper *mapper);
     virtual bool setRenderStatus(BufferMapper *mapper, bool renderStatus);
 
+private:
+    enum {
+        // direct mapped by payload address
+        METADATA_CACHE_SIZE = 16,
+    };
+
+    // payload fields a new frame or a reconfiguration does change
+    struct Entry {
+        const VideoPayloadBuffer *payload;
+        int64_t timestamp;
+        int transform;
+        buffer_handle_t khandle;
+        buffer_handle_t scalingKhandle;
+        buffer_handle_t rotatedKhandle;
+        uint32_t cropWidth;
+        uint32_t cropHeight;
+        MetaData metadata;
+    };
+
+    static bool isCurrent(const Entry& entry, const VideoPayloadBuffer *p);
+    static void buildMetaData(const VideoPayloadBuffer *p, MetaData *metadata);
+
+private:
+    Entry mEntries[METADATA_CACHE_SIZE];
+    uint32_t mVersion;
+
 }; // class VideoPayloadManager
 
 } // namespace intel
@@ -13,6 +13,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <errno.h>
 #include <HwcTrace.h>
 #include <common/Wsbm.h>
 
@@ -134,3 +135,17 @@ bool Wsbm::waitIdleTTMBuffer(void *buf)
 
     return true;
 }
+
+bool Wsbm::isIdleTTMBuffer(void *buf)
+{
+    int ret = psbWsbmPollIdle(buf);
+    if (ret == -EBUSY) {
+        return false;
+    }
+    if (ret) {
+        ETRACE("failed to poll ttm buffer, err = %d", ret);
+        return false;
+    }
+
+    return true;
+}
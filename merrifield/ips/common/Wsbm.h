@@ -39,6 +39,8 @@ public:
     bool wrapTTMBuffer(int64_t handle, void **buf);
     bool unreferenceTTMBuffer(void *buf);
     bool waitIdleTTMBuffer(void *buf);
+    // returns at once, false while the GPU, decoder or VSP uses the buffer
+    bool isIdleTTMBuffer(void *buf);
     uint64_t getKBufHandle(void *buf);
 private:
     bool mInitialized;
@@ -400,3 +400,22 @@ uint32_t psbWsbmWaitIdle(void *buf)
     wsbmBOWaitIdle(buf, 0);
     return 0;
 }
+
+int psbWsbmPollIdle(void *buf)
+{
+    int ret;
+
+    if (!buf) {
+        ETRACE("invalid ttm buffer");
+        return -EINVAL;
+    }
+
+    // fails with -EBUSY instead of sleeping on the buffer fence
+    ret = wsbmBOSyncForCpu(buf, WSBM_SYNCCPU_READ | WSBM_SYNCCPU_DONT_BLOCK);
+    if (ret) {
+        return ret;
+    }
+
+    wsbmBOReleaseFromCpu(buf, WSBM_SYNCCPU_READ);
+    return 0;
+}
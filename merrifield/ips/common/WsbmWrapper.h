@@ -32,6 +32,7 @@ extern int psbWsbmWrapTTMBuffer2(uint64_t handle, void **buf);
 extern int psbWsbmCreateFromUB(void *buf, uint32_t size, void *vaddr);
 extern int psbWsbmUnReference(void *buf);
 extern int psbWsbmWaitIdle(void *buf);
+extern int psbWsbmPollIdle(void *buf);
 uint32_t psbWsbmGetKBufHandle(void *buf);
 
 #if defined(__cplusplus)
@@ -21,27 +21,240 @@
 namespace android {
 namespace intel {
 
-PnwGrallocBufferMapper::PnwGrallocBufferMapper(DataBuffer& buffer)
-    : GrallocBufferMapperBase(buffer)
+PnwGrallocBufferMapper::PnwGrallocBufferMapper(gralloc_module_t const& module,
+                                               DataBuffer& buffer)
+    : GrallocBufferMapperBase(buffer),
+      mGrallocModule(module),
+      mClonedHandle(0),
+      mCpuMapped(false),
+      mGttDone(false)
 {
     CTRACE();
+
+    memset(mGttMapped, 0, sizeof(mGttMapped));
+
+    // a deferred unmap runs after the producer may have freed the buffer
+    const native_handle_t *h = (native_handle_t *)mHandle;
+    mClonedHandle = native_handle_create(h->numFds, h->numInts);
+    if (mClonedHandle == 0) {
+        ETRACE("failed to create handle, out of memory");
+        return;
+    }
+    for (int i = 0; i < h->numFds; i++) {
+        mClonedHandle->data[i] = (h->data[i] >= 0) ? dup(h->data[i]) : -1;
+    }
+    memcpy(mClonedHandle->data + h->numFds, h->data + h->numFds,
+           h->numInts * sizeof(int));
 }
 
 PnwGrallocBufferMapper::~PnwGrallocBufferMapper()
 {
     CTRACE();
+
+    if (mClonedHandle == 0)
+        return;
+    native_handle_close(mClonedHandle);
+    native_handle_delete(mClonedHandle);
 }
 
-bool PnwGrallocBufferMapper::map()
+bool PnwGrallocBufferMapper::gttMap(void *vaddr,
+                                    uint32_t size,
+                                    uint32_t gttAlign,
+                                    int *offset)
+{
+    struct psb_gtt_mapping_arg arg;
+    bool ret;
+
+    ATRACE("vaddr = %p, size = %d", vaddr, size);
+
+    if (!vaddr || !size || !offset) {
+        VTRACE("invalid parameters");
+        return false;
+    }
+
+    memset(&arg, 0, sizeof(arg));
+    arg.type = PSB_GTT_MAP_TYPE_VIRTUAL;
+    arg.page_align = gttAlign;
+    arg.vaddr = (unsigned long)vaddr;
+    arg.size = size;
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    ret = drm->writeReadIoctl(DRM_PSB_GTT_MAP, &arg, sizeof(arg));
+    if (ret == false) {
+        ETRACE("gtt mapping failed");
+        return false;
+    }
+
+    VTRACE("offset = %#x", arg.offset_pages);
+    *offset = arg.offset_pages;
+    return true;
+}
+
+bool PnwGrallocBufferMapper::gttUnmap(void *vaddr)
+{
+    struct psb_gtt_mapping_arg arg;
+    bool ret;
+
+    ATRACE("vaddr = %p", vaddr);
+
+    if (!vaddr) {
+        ETRACE("invalid parameter");
+        return false;
+    }
+
+    memset(&arg, 0, sizeof(arg));
+    arg.type = PSB_GTT_MAP_TYPE_VIRTUAL;
+    arg.vaddr = (unsigned long)vaddr;
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    ret = drm->writeIoctl(DRM_PSB_GTT_UNMAP, &arg, sizeof(arg));
+    if (ret == false) {
+        ETRACE("gtt unmapping failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool PnwGrallocBufferMapper::mapCpu()
+{
+    void *vaddr[SUB_BUFFER_MAX];
+    uint32_t size[SUB_BUFFER_MAX];
+
+    if (!mClonedHandle) {
+        return false;
+    }
+
+    // get virtual address
+    int err = mGrallocModule.perform(&mGrallocModule,
+                                     GRALLOC_MODULE_GET_BUFFER_CPU_ADDRESSES_IMG,
+                                     (buffer_handle_t)mClonedHandle,
+                                     vaddr,
+                                     size);
+    if (err) {
+        ETRACE("failed to map. err = %d", err);
+        return false;
+    }
+
+    for (int i = 0; i < SUB_BUFFER_MAX; i++) {
+        mCpuAddress[i] = vaddr[i];
+        mSize[i] = vaddr[i] ? size[i] : 0;
+    }
+    mCpuMapped = true;
+    return true;
+}
+
+void PnwGrallocBufferMapper::unmapCpu()
+{
+    for (int i = 0; i < SUB_BUFFER_MAX; i++) {
+        mCpuAddress[i] = 0;
+        mSize[i] = 0;
+    }
+    mCpuMapped = false;
+
+    int err = mGrallocModule.perform(&mGrallocModule,
+                                     GRALLOC_MODULE_PUT_BUFFER_CPU_ADDRESSES_IMG,
+                                     (buffer_handle_t)mClonedHandle);
+    if (err) {
+        ETRACE("failed to unmap. err = %d", err);
+    }
+}
+
+bool PnwGrallocBufferMapper::mapGtt()
 {
-    // TODO: implement map
+    int gttOffsetInPage = 0;
+    int i;
+
+    for (i = 0; i < SUB_BUFFER_MAX; i++) {
+        // skip gtt mapping for empty sub buffers
+        if (!mCpuAddress[i] || !mSize[i])
+            continue;
+
+        if (!gttMap(mCpuAddress[i], mSize[i], 0, &gttOffsetInPage)) {
+            VTRACE("failed to map %d into gtt", i);
+            break;
+        }
+        mGttMapped[i] = true;
+        mGttOffsetInPage[i] = gttOffsetInPage;
+    }
+
+    if (i == SUB_BUFFER_MAX) {
+        mGttDone = true;
+        return true;
+    }
+
+    unmapGtt();
     return false;
 }
 
+void PnwGrallocBufferMapper::unmapGtt()
+{
+    for (int i = 0; i < SUB_BUFFER_MAX; i++) {
+        if (mGttMapped[i])
+            gttUnmap(mCpuAddress[i]);
+
+        mGttMapped[i] = false;
+        mGttOffsetInPage[i] = 0;
+    }
+    mGttDone = false;
+}
+
+bool PnwGrallocBufferMapper::map()
+{
+    CTRACE();
+
+    // the planes need the GTT offsets, the layers only the CPU addresses
+    bool cpuMapped = mCpuMapped;
+    if (!mCpuMapped && !mapCpu()) {
+        return false;
+    }
+
+    bool ret = true;
+    if ((mProfile & PROFILE_GTT) && !mGttDone) {
+        ret = mapGtt();
+    }
+
+    // a failed map leaves the mapper as it was
+    if (!ret && !cpuMapped) {
+        unmapCpu();
+    }
+    return ret;
+}
+
 bool PnwGrallocBufferMapper::unmap()
 {
-    //TODO: implement unmap
-    return false;
+    CTRACE();
+
+    unmapGtt();
+    if (mCpuMapped) {
+        unmapCpu();
+    }
+    return true;
+}
+
+int PnwGrallocBufferMapper::getMappedProfile() const
+{
+    // no kernel handle is resolved on Penwell, getKHandle() stays 0
+    int profile = 0;
+    if (mCpuMapped) {
+        profile |= PROFILE_CPU;
+    }
+    if (mGttDone) {
+        profile |= PROFILE_GTT;
+    }
+    return profile;
+}
+
+buffer_handle_t PnwGrallocBufferMapper::getFbHandle(int subIndex)
+{
+    if (subIndex < 0 || subIndex >= SUB_BUFFER_MAX) {
+        return 0;
+    }
+    return (buffer_handle_t)mCpuAddress[subIndex];
+}
+
+void PnwGrallocBufferMapper::putFbHandle()
+{
 }
 
 } // namespace intel
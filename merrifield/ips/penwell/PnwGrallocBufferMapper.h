@@ -23,16 +23,39 @@
 namespace android {
 namespace intel {
 
+// maps the sub buffers of an IMG gralloc buffer for the Penwell display
+// controller, one GTT mapping per sub buffer. Like the Tangier mapper it
+// maps only the parts of its profile, so the pooling, deferred unmaps and
+// premapping of the BufferManager work the same on both.
 class PnwGrallocBufferMapper : public GrallocBufferMapperBase {
 public:
-    PnwGrallocBufferMapper(DataBuffer& buffer);
-    ~PnwGrallocBufferMapper();
+    PnwGrallocBufferMapper(gralloc_module_t const& module,
+                           DataBuffer& buffer);
+    virtual ~PnwGrallocBufferMapper();
 public:
+    // maps the parts of mProfile not mapped yet
     bool map();
     bool unmap();
+    int getMappedProfile() const;
+    buffer_handle_t getFbHandle(int subIndex);
+    void putFbHandle();
+private:
+    bool gttMap(void *vaddr, uint32_t size, uint32_t gttAlign, int *offset);
+    bool gttUnmap(void *vaddr);
+    bool mapCpu();
+    void unmapCpu();
+    bool mapGtt();
+    void unmapGtt();
+
+private:
+    gralloc_module_t const& mGrallocModule;
+    native_handle_t* mClonedHandle;
+    bool mGttMapped[SUB_BUFFER_MAX];
+    bool mCpuMapped;
+    bool mGttDone;
 };
 
 } // namespace intel
 } // namespace android
 
-#endif /* TNG_GRALLOC_BUFFER_MAPPER_H */
+#endif /* PNW_GRALLOC_BUFFER_MAPPER_H */
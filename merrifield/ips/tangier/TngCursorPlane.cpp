@@ -17,7 +17,6 @@
 #include <HwcTrace.h>
 #include <Hwcomposer.h>
 #include <BufferManager.h>
-#include <BufferManager.h>
 #include <tangier/TngCursorPlane.h>
 #include <tangier/TngGrallocBuffer.h>
 #include <hal_public.h>
@@ -26,7 +25,8 @@ namespace android {
 namespace intel {
 
 TngCursorPlane::TngCursorPlane(int index, int disp)
-    : DisplayPlane(index, PLANE_CURSOR, disp)
+    : DisplayPlane(index, PLANE_CURSOR, disp),
+      mCursorSize(0)
 {
     CTRACE();
     memset(&mContext, 0, sizeof(mContext));
@@ -81,108 +81,107 @@ bool TngCursorPlane::setDataBuffer(buffer_handle_t handle)
     return true;
 }
 
-bool TngCursorPlane::setDataBuffer(BufferMapper& mapper)
+void TngCursorPlane::deinitialize()
 {
-    int w = mapper.getWidth();
-    int h = mapper.getHeight();
-    int cursorSize = 0;
+    mImageCache.clear();
+    DisplayPlane::deinitialize();
+}
 
-    CTRACE();
+bool TngCursorPlane::postCursorPosition(int x, int y)
+{
+    toPipePosition(x, y);
+    mMailbox.post(x, y);
+    return true;
+}
 
-    // setup plane position
-    int dstX = mPosition.x;
-    int dstY = mPosition.y;
+void TngCursorPlane::toPipePosition(int& x, int& y) const
+{
+#if ENABLE_ROTATION_180
+    // the image, with the cursor in its top left corner, is rotated with
+    // the panel
+    if (mDevice == IDisplayDevice::DEVICE_PRIMARY && mCursorSize) {
+        x = mModeInfo.hdisplay - x - mCursorSize;
+        y = mModeInfo.vdisplay - y - mCursorSize;
+    }
+#else
+    (void)x;
+    (void)y;
+#endif
+}
 
-    if (h < w) {
-        cursorSize = h;
-    } else {
-        cursorSize = w;
+bool TngCursorPlane::applyCursorPosition()
+{
+    uint32_t pos;
+    if (!mMailbox.take(pos)) {
+        return false;
     }
 
-#if ENABLE_ROTATION_180
-    dstX = mModeInfo.hdisplay - dstX - cursorSize;
-    dstY = mModeInfo.vdisplay - dstY - cursorSize;
-#endif
+    // the next flip programs the same position
+    CursorPositionMailbox::publish(mContext.ctx.cs_ctx.pos, pos);
+
+    struct intel_dc_cursor_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.pipe = mDevice;
+    ctx.pos = pos;
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    return drm->writeIoctl(DRM_PSB_UPDATE_CURSOR_POS, &ctx, sizeof(ctx));
+}
+
+bool TngCursorPlane::setDataBuffer(BufferMapper& mapper)
+{
+    CTRACE();
+
+    // cursors of any size up to 256x256 are padded to the next plane size
+    int w = mSrcCrop.w ? mSrcCrop.w : (int)mapper.getWidth();
+    int h = mSrcCrop.h ? mSrcCrop.h : (int)mapper.getHeight();
+    int cursorSize = CursorImageCache::fitCursorSize(w, h);
+    if (!cursorSize) {
+        ETRACE("invalid cursor size %dx%d", w, h);
+        return false;
+    }
 
     uint32_t cntr = 0;
-    if (64 <= cursorSize && cursorSize < 128) {
-        cursorSize = 64;
+    if (cursorSize == 64) {
         cntr = 0x7;
-    } else if (128 <= cursorSize && cursorSize < 256) {
-        cursorSize = 128;
+    } else if (cursorSize == 128) {
         cntr = 0x2;
     } else {
-        cursorSize = 256;
         cntr = 0x3;
     }
 
-    if (mapper.getFormat() == HAL_PIXEL_FORMAT_RGBA_8888) {
-        cntr |= 1 << 5;
-    } else if (mapper.getFormat() == HAL_PIXEL_FORMAT_BGRA_8888) {
-        // swap color from BGRA to RGBA - alpha is MSB
-        uint8_t *p = (uint8_t *)(mapper.getCpuAddress(0));
-        uint8_t *srcPixel;
-        uint32_t stride = mapper.getStride().rgb.stride;
-        uint8_t temp;
-        if (!p) {
-            return false;
-        }
-
-        for (int i = 0; i < cursorSize; i++) {
-            for (int j = 0; j < cursorSize; j++) {
-                srcPixel = p + i*stride + j*4;
-                temp = srcPixel[0];
-                srcPixel[0] = srcPixel[2];
-                srcPixel[2] = temp;
-            }
-        }
+    if (mapper.getFormat() == HAL_PIXEL_FORMAT_RGBA_8888 ||
+        mapper.getFormat() == HAL_PIXEL_FORMAT_BGRA_8888) {
         cntr |= 1 << 5;
     } else {
         ETRACE("invalid color format");
         return false;
     }
 
-    // TODO: clean spare mem to be 0 in gralloc instead
-    uint8_t *p = (uint8_t *)(mapper.getCpuAddress(0));
-    uint8_t *srcPixel;
-    uint32_t stride = mapper.getStride().rgb.stride;
-    uint8_t temp;
-    if (!p) {
+    // scan out a converted copy, the application buffer is left untouched
+    BufferMapper *image = mImageCache.get(mapper, mSrcCrop, cursorSize,
+                                          mUpdateMasks & PLANE_BUFFER_CHANGED);
+    if (!image) {
+        ETRACE("failed to prepare cursor image");
         return false;
     }
 
-    if (mCrop.w == 0 && mCrop.h == 0) {
-        mCrop = mSrcCrop;
-        for (int i = 0; i < cursorSize; i++) {
-            for (int j = 0; j < cursorSize; j++) {
-                srcPixel = p + i*stride + j*4;
-                temp = srcPixel[0];
-                if (i >= mCrop.h || j >= mCrop.w) {
-                    if (srcPixel[0] == 0 &&
-                        srcPixel[3] == 0xff)
-                        srcPixel[3] = 0;
-                }
-            }
-        }
-    }
+    // spare memory outside the crop is cleared in the copy
+    mCrop = mSrcCrop;
 
     // update context
     mContext.type = DC_CURSOR_PLANE;
     mContext.ctx.cs_ctx.index = mIndex;
     mContext.ctx.cs_ctx.pipe = mDevice;
     mContext.ctx.cs_ctx.cntr = cntr | (mIndex << 28);
-    mContext.ctx.cs_ctx.surf = mapper.getGttOffsetInPage(0) << 12;
+    mContext.ctx.cs_ctx.surf = image->getGttOffsetInPage(0) << 12;
 
-    mContext.ctx.cs_ctx.pos = 0;
-    if (dstX < 0) {
-        mContext.ctx.cs_ctx.pos |= 1 << 15;
-        dstX = -dstX;
-    }
-    if (dstY < 0) {
-        mContext.ctx.cs_ctx.pos |= 1 << 31;
-        dstY = -dstY;
-    }
-    mContext.ctx.cs_ctx.pos |= (dstY & 0xfff) << 16 | (dstX & 0xfff);
+    // setup plane position
+    mCursorSize = cursorSize;
+    int dstX = mPosition.x;
+    int dstY = mPosition.y;
+    toPipePosition(dstX, dstY);
+    CursorPositionMailbox::publish(mContext.ctx.cs_ctx.pos,
+                                   CursorPositionMailbox::encode(dstX, dstY));
     return true;
 }
 
@@ -202,13 +201,14 @@ bool TngCursorPlane::enablePlane(bool enabled)
     arg.plane.index = mIndex;
     arg.plane.ctx = 0;
 
-    // issue ioctl
+    // issue ioctl, batched with the frame if prepare is running
     Drm *drm = Hwcomposer::getInstance().getDrm();
-    bool ret = drm->writeReadIoctl(DRM_PSB_REGISTER_RW, &arg, sizeof(arg));
+    bool ret = drm->updatePlane(arg, this);
     if (ret == false) {
         WTRACE("plane enabling (%d) failed with error code %d", enabled, ret);
         return false;
     }
+    recordPlaneState(arg.plane_enable_mask != 0);
 
     return true;
 }
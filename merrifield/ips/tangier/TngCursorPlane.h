@@ -22,6 +22,8 @@
 #include <Hwcomposer.h>
 #include <BufferCache.h>
 #include <DisplayPlane.h>
+#include <common/CursorImageCache.h>
+#include <common/CursorPositionMailbox.h>
 
 #include <linux/psb_drm.h>
 
@@ -43,13 +45,24 @@ public:
     void setZOrderConfig(ZOrderConfig& config, void *nativeConfig);
 
     bool setDataBuffer(buffer_handle_t handle);
+    void deinitialize();
+
+    bool postCursorPosition(int x, int y);
+    bool applyCursorPosition();
 protected:
     bool setDataBuffer(BufferMapper& mapper);
     bool enablePlane(bool enabled);
+    // position of the image on the pipe, the panel of the primary pipe
+    // may be mounted upside down
+    void toPipePosition(int& x, int& y) const;
 
 protected:
     struct intel_dc_plane_ctx mContext;
     crop_t mCrop;
+    CursorImageCache mImageCache;
+    // size of the padded image on the plane
+    int mCursorSize;
+    CursorPositionMailbox mMailbox;
 };
 
 } // namespace intel
@@ -13,14 +13,29 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sync/sync.h>
+#include <libsync/sw_sync.h>
+#include <cutils/properties.h>
 #include <HwcTrace.h>
 #include <Hwcomposer.h>
 #include <Drm.h>
 #include <DisplayPlane.h>
 #include <IDisplayDevice.h>
 #include <HwcLayerList.h>
+#include <BootTimeline.h>
+#include <EventLoop.h>
+#include <TuningPolicy.h>
 #include <tangier/TngDisplayContext.h>
 
+// in ms, fences that don't signal in time are reported. An acquire fence
+// is given up on, a release fence is waited for further.
+#define POST_FENCE_TIMEOUT_MS 500
+// in ms, a refresh switch waits that long for the frame it shows, rather
+// than blanking the screen until the post
+#define MODE_SWITCH_FENCE_TIMEOUT_MS 32
 
 namespace android {
 namespace intel {
@@ -28,7 +43,21 @@ namespace intel {
 TngDisplayContext::TngDisplayContext()
     : mIMGDisplayDevice(0),
       mInitialized(false),
-      mCount(0)
+      mCount(0),
+      mContentCount(0),
+      mAllIdle(true),
+      mQueuedFrame(-1),
+      mPostingFrame(-1),
+      mExitPostThread(false),
+      mPostTimeline(-1),
+      mNextPostPoint(0),
+      mAsyncFlipping(false),
+      mFlipTimeline(-1),
+      mNextFlipPoint(0),
+      mFlipPending(false),
+      mFlipRetireFence(-1),
+      mAsyncFlips(0),
+      mAsyncFlipFallbacks(0)
 {
     CTRACE();
 }
@@ -42,37 +71,489 @@ bool TngDisplayContext::initialize()
 {
     CTRACE();
 
+    mIMGDisplayDevice = openDisplayDevice();
+    if (!mIMGDisplayDevice) {
+        return false;
+    }
+
+    mCount = 0;
+    mContentCount = 0;
+    mAllIdle = true;
+
+    // opt-in: keep a blocking post off the SurfaceFlinger thread
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("hwc.post.async", prop, "0") > 0 && atoi(prop) &&
+        !startPostThread()) {
+        WTRACE("posting synchronously");
+    }
+
+    mInitialized = true;
+    return true;
+}
+
+bool TngDisplayContext::startPostThread()
+{
+    mPostTimeline = sw_sync_timeline_create();
+    if (mPostTimeline < 0) {
+        ETRACE("failed to create post timeline");
+        return false;
+    }
+
+    mNextPostPoint = 0;
+    mQueuedFrame = -1;
+    mPostingFrame = -1;
+    mExitPostThread = false;
+    mThread = new PostThread(this);
+    if (!mThread.get()) {
+        ETRACE("failed to create post thread");
+        close(mPostTimeline);
+        mPostTimeline = -1;
+        return false;
+    }
+    mThread->run("HwcPost", PRIORITY_URGENT_DISPLAY);
+    return true;
+}
+
+void TngDisplayContext::stopPostThread()
+{
+    if (mThread.get()) {
+        {
+            Mutex::Autolock _l(mPostLock);
+            mExitPostThread = true;
+            mPostCondition.broadcast();
+        }
+        mThread->requestExitAndWait();
+        mThread = NULL;
+    }
+    dropReleaseFences();
+
+    if (mQueuedFrame >= 0) {
+        PostFrame& frame = mPostFrames[mQueuedFrame];
+        for (size_t i = 0; i < frame.count; i++) {
+            if (frame.layers[i].acquireFenceFd != -1) {
+                close(frame.layers[i].acquireFenceFd);
+            }
+        }
+        mQueuedFrame = -1;
+    }
+
+    // fences of a frame left queued signal as the timeline goes away
+    if (mPostTimeline >= 0) {
+        close(mPostTimeline);
+        mPostTimeline = -1;
+    }
+}
+
+int TngDisplayContext::queuePost()
+{
+    int fenceFd = sw_sync_fence_create(mPostTimeline, "hwc_post",
+                                       mNextPostPoint + 1);
+    int slot;
+    {
+        Mutex::Autolock _l(mPostLock);
+        if (fenceFd < 0) {
+            // posted synchronously, once the thread is done with its posts
+            ETRACE("failed to create post fence");
+            while (mQueuedFrame >= 0 || mPostingFrame >= 0) {
+                mPostCondition.wait(mPostLock);
+            }
+            return -1;
+        }
+
+        // the previous frame must have been taken, the one being posted
+        // keeps its slot
+        while (mQueuedFrame >= 0) {
+            mPostCondition.wait(mPostLock);
+        }
+        slot = (mPostingFrame == 0) ? 1 : 0;
+    }
+    mNextPostPoint++;
+
+    PostFrame& frame = mPostFrames[slot];
+    for (size_t i = 0; i < mCount; i++) {
+        // the acquire fence goes with the copy, the post thread closes it
+        hwc_layer_1_t *layer = mImgLayers[i].psLayer;
+        frame.layers[i] = *layer;
+        layer->acquireFenceFd = -1;
+        frame.contexts[i] = *(struct intel_dc_plane_ctx *)mImgLayers[i].custom;
+        frame.imgLayers[i].psLayer = &frame.layers[i];
+        frame.imgLayers[i].custom = (unsigned long)&frame.contexts[i];
+    }
+    frame.count = mCount;
+
+    Mutex::Autolock _l(mPostLock);
+    mQueuedFrame = slot;
+    mPostCondition.broadcast();
+    return fenceFd;
+}
+
+void TngDisplayContext::drainPostThread()
+{
+    if (!mThread.get()) {
+        return;
+    }
+
+    Mutex::Autolock _l(mPostLock);
+    while (mQueuedFrame >= 0 || mPostingFrame >= 0) {
+        mPostCondition.wait(mPostLock);
+    }
+}
+
+void TngDisplayContext::waitPosted()
+{
+    // a post in flight reads the planes and the mappings of their buffers,
+    // which the next prepare updates and may unmap
+    drainPostThread();
+}
+
+bool TngDisplayContext::flipAsync()
+{
+    if (mContentCount != 1 || !TuningPolicy::isAsyncFlipAllowed()) {
+        return false;
+    }
+
+    HwcLayer *hwcLayer = mContents[0].layerList->getAsyncFlipLayer();
+    if (!hwcLayer || !showLayer(hwcLayer, false)) {
+        return false;
+    }
+
+    if (!mAsyncFlipping) {
+        ITRACE("async flips started");
+    }
+    mAsyncFlipping = true;
+    mAsyncFlips++;
+    return true;
+}
+
+bool TngDisplayContext::setPendingModes()
+{
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    bool shown = false;
+    for (int device = IDisplayDevice::DEVICE_PRIMARY;
+         device <= IDisplayDevice::DEVICE_EXTERNAL; device++) {
+        if (!drm->hasPendingMode(device)) {
+            continue;
+        }
+
+        // the primary switches scanning out the frame, if a single buffer
+        // makes it; the next post then ends the switch as it ends flips
+        HwcLayer *hwcLayer = NULL;
+        if (device == IDisplayDevice::DEVICE_PRIMARY && mContentCount == 1) {
+            hwcLayer = mContents[0].layerList->getScanoutLayer();
+        }
+        if (hwcLayer && showLayer(hwcLayer, true)) {
+            mAsyncFlipping = true;
+            shown = true;
+            continue;
+        }
+
+        // a full mode set, nothing may be posted meanwhile. The frame is
+        // posted over its blank frame buffer even if it is idle.
+        drainPostThread();
+        drm->setPendingMode(device, 0, 0, 0, 0, 0);
+        mAllIdle = false;
+    }
+    return shown;
+}
+
+bool TngDisplayContext::showLayer(HwcLayer *hwcLayer, bool setMode)
+{
+    hwc_display_contents_1_t *display = mContents[0].display;
+    HwcLayerList *layerList = mContents[0].layerList;
+
+    if (mFlipTimeline < 0) {
+        mFlipTimeline = sw_sync_timeline_create();
+        if (mFlipTimeline < 0) {
+            ETRACE_LIMITED("failed to create flip timeline");
+            return false;
+        }
+        mNextFlipPoint = 0;
+        mFlipPending = false;
+    }
+
+    int releaseFenceFd = sw_sync_fence_create(mFlipTimeline, "hwc_flip",
+                                              mNextFlipPoint + 1);
+    if (releaseFenceFd < 0) {
+        ETRACE_LIMITED("failed to create flip fence");
+        return false;
+    }
+
+    // a frame queued for the post thread must not land on top of the flip
+    if (!mAsyncFlipping) {
+        drainPostThread();
+    }
+
+    // the flip is immediate, the buffer has to be rendered by then; one
+    // still being rendered is posted, the post waits for its fence
+    hwc_layer_1_t *layer = hwcLayer->getLayer();
+    DisplayPlane *plane = hwcLayer->getPlane();
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    int timeout = setMode ? MODE_SWITCH_FENCE_TIMEOUT_MS : 0;
+    bool shown = layer->acquireFenceFd == -1 ||
+                 sync_wait(layer->acquireFenceFd, timeout) == 0;
+    if (shown && setMode) {
+        shown = drm->setPendingMode(IDisplayDevice::DEVICE_PRIMARY,
+                                    hwcLayer->getHandle(),
+                                    hwcLayer->getBufferWidth(),
+                                    hwcLayer->getBufferHeight(),
+                                    hwcLayer->getBufferStride().rgb.stride,
+                                    hwcLayer->getFormat());
+    } else if (shown) {
+        shown = drm->flipAsync(IDisplayDevice::DEVICE_PRIMARY,
+                               hwcLayer->getHandle(),
+                               hwcLayer->getBufferWidth(),
+                               hwcLayer->getBufferHeight(),
+                               hwcLayer->getBufferStride().rgb.stride,
+                               hwcLayer->getFormat());
+    }
+    if (!shown) {
+        VTRACE("%s not done, posting", setMode ? "mode switch" : "async flip");
+        if (!setMode) {
+            mAsyncFlipFallbacks++;
+        }
+        close(releaseFenceFd);
+        return false;
+    }
+    plane->flip(NULL);
+
+    // the buffer of the previous flip is off the screen, and so is the
+    // last one of the previous async flips if its post wasn't done yet
+    if (mFlipRetireFence >= 0) {
+        close(mFlipRetireFence);
+        mFlipRetireFence = -1;
+        mFlipPending = true;
+    }
+    if (mFlipPending && sw_sync_timeline_inc(mFlipTimeline, 1) < 0) {
+        ETRACE("failed to signal flip fence");
+    }
+    mFlipPending = true;
+    mNextFlipPoint++;
+
+    layerList->postFlip();
+    mContentCount = 0;
+
+    closeAcquireFences(1, &display);
+    for (size_t i = 0; i < display->numHwLayers; i++) {
+        display->hwLayers[i].releaseFenceFd = -1;
+    }
+    layer->releaseFenceFd = releaseFenceFd;
+    // the frame is on screen once the flip returned
+    display->retireFenceFd = -1;
+    return true;
+}
+
+void TngDisplayContext::endAsyncFlips(int releaseFenceFd)
+{
+    // a refresh switch that showed the frame ends the same way
+    if (mAsyncFlips) {
+        ITRACE("async flips ended, %u flips, %u posted instead",
+               mAsyncFlips, mAsyncFlipFallbacks);
+    }
+    mAsyncFlipping = false;
+    mAsyncFlips = 0;
+    mAsyncFlipFallbacks = 0;
+
+    // the frame buffers of the flips may go once the post has taken the
+    // pipe from the last one
+    drainPostThread();
+    Hwcomposer::getInstance().getDrm()->endAsyncFlips(
+        IDisplayDevice::DEVICE_PRIMARY);
+
+    if (!mFlipPending) {
+        return;
+    }
+
+    // the last flipped buffer is scanned out until the post is, its fence
+    // is signaled by retireLastFlip() rather than waited for here
+    mFlipPending = false;
+    if (releaseFenceFd != -1) {
+        mFlipRetireFence = dup(releaseFenceFd);
+    }
+    if (mFlipRetireFence < 0 && sw_sync_timeline_inc(mFlipTimeline, 1) < 0) {
+        ETRACE("failed to signal flip fence");
+    }
+}
+
+void TngDisplayContext::retireLastFlip()
+{
+    if (mFlipRetireFence < 0 || sync_wait(mFlipRetireFence, 0) < 0) {
+        return;
+    }
+
+    close(mFlipRetireFence);
+    mFlipRetireFence = -1;
+    if (sw_sync_timeline_inc(mFlipTimeline, 1) < 0) {
+        ETRACE("failed to signal flip fence");
+    }
+}
+
+bool TngDisplayContext::threadLoop()
+{
+    int slot;
+    {
+        Mutex::Autolock _l(mPostLock);
+        while (mQueuedFrame < 0 && !mExitPostThread) {
+            mPostCondition.wait(mPostLock);
+        }
+        if (mExitPostThread) {
+            return false;
+        }
+        slot = mQueuedFrame;
+        mQueuedFrame = -1;
+        mPostingFrame = slot;
+        mPostCondition.broadcast();
+    }
+
+    PostFrame& frame = mPostFrames[slot];
+    int releaseFenceFd = -1;
+    int err = mIMGDisplayDevice->post(mIMGDisplayDevice, frame.imgLayers,
+                                      frame.count, &releaseFenceFd);
+    if (err) {
+        ETRACE("post failed, err = %d", err);
+    } else {
+        BootTimeline::complete("first post");
+    }
+
+    for (size_t i = 0; i < frame.count; i++) {
+        if (frame.layers[i].acquireFenceFd != -1) {
+            close(frame.layers[i].acquireFenceFd);
+            frame.layers[i].acquireFenceFd = -1;
+        }
+    }
+
+    {
+        Mutex::Autolock _l(mPostLock);
+        mPostingFrame = -1;
+        mPostCondition.broadcast();
+    }
+
+    // the fence given out for this frame signals with the real one, or
+    // right away if the post failed. The next frame does not wait for it.
+    watchReleaseFence(releaseFenceFd);
+    return true;
+}
+
+void TngDisplayContext::watchReleaseFence(int releaseFenceFd)
+{
+    EventLoop *loop = Hwcomposer::getInstance().getEventLoop();
+    {
+        Mutex::Autolock _l(mReleaseLock);
+        mReleaseFences.push_back(releaseFenceFd);
+        // oneshot, a fence signaled ahead of an older one is picked up
+        // with that one
+        if (releaseFenceFd == -1 || (loop &&
+            loop->addFd(releaseFenceFd, EPOLLIN | EPOLLONESHOT,
+                        releaseFenceSignaled, this))) {
+            releaseFenceFd = -1;
+        }
+    }
+
+    if (releaseFenceFd != -1) {
+        // no event loop, the buffers are scanned out until the fence
+        // signals
+        WTRACE("waiting for the release fence of the post");
+        while (sync_wait(releaseFenceFd, POST_FENCE_TIMEOUT_MS) < 0 &&
+               errno == ETIME) {
+            WTRACE("release fence of the post did not signal yet");
+        }
+    }
+    signalReleasedPosts();
+}
+
+void TngDisplayContext::releaseFenceSignaled(int fd, uint32_t events, void *data)
+{
+    TngDisplayContext *context = (TngDisplayContext *)data;
+    context->signalReleasedPosts();
+}
+
+void TngDisplayContext::signalReleasedPosts()
+{
+    Vector<int> released;
+    {
+        Mutex::Autolock _l(mReleaseLock);
+        while (mReleaseFences.size()) {
+            int fenceFd = mReleaseFences.itemAt(0);
+            if (fenceFd != -1 && sync_wait(fenceFd, 0) < 0 && errno == ETIME) {
+                break;
+            }
+            mReleaseFences.removeAt(0);
+            released.push_back(fenceFd);
+            if (sw_sync_timeline_inc(mPostTimeline, 1) < 0) {
+                ETRACE("failed to signal post fence");
+            }
+        }
+    }
+
+    // removeFd() waits for a callback of the fence running on another
+    // thread, which takes mReleaseLock
+    EventLoop *loop = Hwcomposer::getInstance().getEventLoop();
+    for (size_t i = 0; i < released.size(); i++) {
+        int fenceFd = released.itemAt(i);
+        if (fenceFd == -1) {
+            continue;
+        }
+        if (loop) {
+            loop->removeFd(fenceFd);
+        }
+        close(fenceFd);
+    }
+}
+
+void TngDisplayContext::dropReleaseFences()
+{
+    Vector<int> fences;
+    {
+        Mutex::Autolock _l(mReleaseLock);
+        fences = mReleaseFences;
+        mReleaseFences.clear();
+    }
+
+    // closing the timeline afterwards signals the fences of these posts
+    EventLoop *loop = Hwcomposer::getInstance().getEventLoop();
+    for (size_t i = 0; i < fences.size(); i++) {
+        int fenceFd = fences.itemAt(i);
+        if (fenceFd == -1) {
+            continue;
+        }
+        if (loop) {
+            loop->removeFd(fenceFd);
+        }
+        close(fenceFd);
+    }
+}
+
+IMG_display_device_public_t* TngDisplayContext::openDisplayDevice()
+{
     // open frame buffer device
     gralloc_module_t const* module;
     int err = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, (hw_module_t const**)&module);
     if (err) {
         ETRACE("failed to load gralloc module, error = %d", err);
-        return false;
+        return NULL;
     }
+    BootTimeline::mark("gralloc module");
 
     // init IMG display device
-    err = module->perform(module, GRALLOC_MODULE_GET_DISPLAY_DEVICE_IMG, (void **)&mIMGDisplayDevice);
+    IMG_display_device_public_t *device = NULL;
+    err = module->perform(module, GRALLOC_MODULE_GET_DISPLAY_DEVICE_IMG, (void **)&device);
     if (err) {
         ETRACE("failed to get display device, error = %d", err);
-        return false;
+        return NULL;
     }
-
-    mCount = 0;
-    mInitialized = true;
-    return true;
+    return device;
 }
 
 bool TngDisplayContext::commitBegin(size_t numDisplays, hwc_display_contents_1_t **displays)
 {
     RETURN_FALSE_IF_NOT_INIT();
     mCount = 0;
+    mContentCount = 0;
+    mAllIdle = true;
     return true;
 }
 
 bool TngDisplayContext::commitContents(hwc_display_contents_1_t *display, HwcLayerList *layerList)
 {
-    bool ret;
-
     RETURN_FALSE_IF_NOT_INIT();
 
     if (!display || !layerList) {
@@ -80,16 +561,46 @@ bool TngDisplayContext::commitContents(hwc_display_contents_1_t *display, HwcLay
         return false;
     }
 
+    if (mContentCount >= IDisplayDevice::DEVICE_COUNT) {
+        ETRACE("too many displays");
+        return false;
+    }
+
+    if (!layerList->isIdle()) {
+        mAllIdle = false;
+    }
+
+    Contents& contents = mContents[mContentCount++];
+    contents.display = display;
+    contents.layerList = layerList;
+    return true;
+}
+
+bool TngDisplayContext::flipContents(hwc_display_contents_1_t *display, HwcLayerList *layerList)
+{
+    bool ret;
+
     IMG_hwc_layer_t *imgLayerList = (IMG_hwc_layer_t*)mImgLayers;
 
+    // native z order is shared by all planes of the display, resolve it
+    // once instead of per layer
+    struct intel_dc_plane_zorder zorder;
+    void *config = Hwcomposer::getInstance().getPlaneManager()->getZOrderConfig();
+    if (config) {
+        memcpy(&zorder, config, sizeof(zorder));
+    } else {
+        memset(&zorder, 0, sizeof(zorder));
+    }
+
     for (size_t i = 0; i < display->numHwLayers; i++) {
         if (mCount >= MAXIMUM_LAYER_NUMBER) {
-            ETRACE("layer count exceeds the limit");
+            ETRACE_LIMITED("layer count exceeds the limit");
             return false;
         }
 
         // check layer parameters
-        if (!display->hwLayers[i].handle) {
+        hwc_layer_1_t *layer = &display->hwLayers[i];
+        if (!layer->handle) {
             continue;
         }
 
@@ -104,61 +615,29 @@ bool TngDisplayContext::commitContents(hwc_display_contents_1_t *display, HwcLay
             continue;
         }
 
+        mPlanes[mCount] = plane;
         IMG_hwc_layer_t *imgLayer = &imgLayerList[mCount++];
         // update IMG layer
-        imgLayer->psLayer = &display->hwLayers[i];
+        imgLayer->psLayer = layer;
         imgLayer->custom = (unsigned long)plane->getContext();
         struct intel_dc_plane_ctx *ctx =
             (struct intel_dc_plane_ctx *)imgLayer->custom;
         // update z order
-        Hwcomposer& hwc = Hwcomposer::getInstance();
-        DisplayPlaneManager *pm = hwc.getPlaneManager();
-        void *config = pm->getZOrderConfig();
-        if (config) {
-            memcpy(&ctx->zorder, config, sizeof(ctx->zorder));
-        } else {
-            memset(&ctx->zorder, 0, sizeof(ctx->zorder));
-        }
-
-        VTRACE("count %p, handle %#x, trans %#x, blending %#x"
-              " sourceCrop %f,%f - %fx%f, dst %d,%d - %dx%d, custom %#x",
-              mCount,
-              imgLayer->psLayer->handle,
-              imgLayer->psLayer->transform,
-              imgLayer->psLayer->blending,
-              imgLayer->psLayer->sourceCropf.left,
-              imgLayer->psLayer->sourceCropf.top,
-              imgLayer->psLayer->sourceCropf.right - imgLayer->psLayer->sourceCropf.left,
-              imgLayer->psLayer->sourceCropf.bottom - imgLayer->psLayer->sourceCropf.top,
-              imgLayer->psLayer->displayFrame.left,
-              imgLayer->psLayer->displayFrame.top,
-              imgLayer->psLayer->displayFrame.right - imgLayer->psLayer->displayFrame.left,
-              imgLayer->psLayer->displayFrame.bottom - imgLayer->psLayer->displayFrame.top,
-              imgLayer->custom);
+        ctx->zorder = zorder;
+
+        VTRACE("count %d, layer %d, plane %d type %d, handle %#x, custom %#x",
+              mCount, i, plane->getIndex(), plane->getType(),
+              layer->handle, imgLayer->custom);
     }
 
     layerList->postFlip();
     return true;
 }
 
-bool TngDisplayContext::commitEnd(size_t numDisplays, hwc_display_contents_1_t **displays)
+void TngDisplayContext::closeAcquireFences(size_t numDisplays, hwc_display_contents_1_t **displays)
 {
-    int releaseFenceFd = -1;
-
-    VTRACE("count = %d", mCount);
-
-    if (mIMGDisplayDevice && mCount) {
-        int err = mIMGDisplayDevice->post(mIMGDisplayDevice,
-                                          mImgLayers,
-                                          mCount,
-                                          &releaseFenceFd);
-        if (err) {
-            ETRACE("post failed, err = %d", err);
-            return false;
-        }
-    }
-
-    // close acquire fence
+    // the fences are closed in a batch after the commit
+    FenceCloser *closer = Hwcomposer::getInstance().getFenceCloser();
     for (size_t i = 0; i < numDisplays; i++) {
         // Wait and close HWC_OVERLAY typed layer's acquire fence
         hwc_display_contents_1_t* display = displays[i];
@@ -169,30 +648,88 @@ bool TngDisplayContext::commitEnd(size_t numDisplays, hwc_display_contents_1_t *
         for (size_t j = 0; j < display->numHwLayers-1; j++) {
             hwc_layer_1_t& layer = display->hwLayers[j];
             if (layer.compositionType == HWC_OVERLAY) {
-                if (layer.acquireFenceFd != -1) {
-                    // sync_wait(layer.acquireFenceFd, 16ms);
-                    close(layer.acquireFenceFd);
-                    layer.acquireFenceFd = -1;
-                }
+                // sync_wait(layer.acquireFenceFd, 16ms);
+                closer->close(layer.acquireFenceFd);
             }
         }
 
         // Wait and close framebuffer target layer's acquire fence
         hwc_layer_1_t& fbt = display->hwLayers[display->numHwLayers-1];
-        if (fbt.acquireFenceFd != -1) {
-            // sync_wait(fbt.acquireFencdFd, 16ms);
-            close(fbt.acquireFenceFd);
-            fbt.acquireFenceFd = -1;
-        }
+        // sync_wait(fbt.acquireFencdFd, 16ms);
+        closer->close(fbt.acquireFenceFd);
 
         // Wait and close outbuf's acquire fence
-        if (display->outbufAcquireFenceFd != -1) {
-            // sync_wait(display->outbufAcquireFenceFd, 16ms);
-            close(display->outbufAcquireFenceFd);
-            display->outbufAcquireFenceFd = -1;
+        // sync_wait(display->outbufAcquireFenceFd, 16ms);
+        closer->close(display->outbufAcquireFenceFd);
+    }
+}
+
+bool TngDisplayContext::commitEnd(size_t numDisplays, hwc_display_contents_1_t **displays)
+{
+    STRACE();
+    int releaseFenceFd = -1;
+
+    retireLastFlip();
+
+    // refresh switches queued since the last commit are made with this
+    // frame, which may be on screen with them already
+    if (setPendingModes()) {
+        return true;
+    }
+
+    // every display shows the same frame as before, the planes still hold
+    // it so skip the post; with no new scan out nothing needs a fence
+    if (mContentCount && mAllIdle) {
+        VTRACE("idle frame, skipping post");
+        closeAcquireFences(numDisplays, displays);
+        for (size_t i = 0; i < mContentCount; i++) {
+            hwc_display_contents_1_t *display = mContents[i].display;
+            for (size_t j = 0; j < display->numHwLayers; j++) {
+                display->hwLayers[j].releaseFenceFd = -1;
+            }
+            display->retireFenceFd = -1;
+        }
+        mContentCount = 0;
+        return true;
+    }
+
+    // the single layer of a game allowed to tear skips the post
+    if (flipAsync()) {
+        return true;
+    }
+
+    for (size_t i = 0; i < mContentCount; i++) {
+        if (!flipContents(mContents[i].display, mContents[i].layerList)) {
+            ETRACE("failed to flip contents %d", i);
+        }
+    }
+    mContentCount = 0;
+
+    VTRACE("count = %d", mCount);
+
+    if (mIMGDisplayDevice && mCount && mThread.get()) {
+        releaseFenceFd = queuePost();
+    }
+
+    if (mIMGDisplayDevice && mCount && releaseFenceFd == -1) {
+        int err = mIMGDisplayDevice->post(mIMGDisplayDevice,
+                                          mImgLayers,
+                                          mCount,
+                                          &releaseFenceFd);
+        if (err) {
+            ETRACE("post failed, err = %d", err);
+            return false;
         }
+        BootTimeline::complete("first post");
+    }
+
+    if (mAsyncFlipping) {
+        endAsyncFlips(releaseFenceFd);
     }
 
+    // close acquire fence
+    closeAcquireFences(numDisplays, displays);
+
     // update release fence and retire fence
     if (mCount > 0) {
         // For physical displays, dup the releaseFenceFd only for
@@ -203,6 +740,7 @@ bool TngDisplayContext::commitEnd(size_t numDisplays, hwc_display_contents_1_t *
             IMG_hwc_layer_t *imgLayer = &imgLayerList[i];
             imgLayer->psLayer->releaseFenceFd =
                 (releaseFenceFd != -1) ? dup(releaseFenceFd) : -1;
+            mPlanes[i]->setRetireFence(releaseFenceFd);
         }
     }
 
@@ -231,9 +769,7 @@ bool TngDisplayContext::commitEnd(size_t numDisplays, hwc_display_contents_1_t *
     }
 
     // close original release fence fd
-    if (releaseFenceFd != -1) {
-        close(releaseFenceFd);
-    }
+    Hwcomposer::getInstance().getFenceCloser()->close(releaseFenceFd);
     return true;
 }
 
@@ -263,8 +799,21 @@ bool TngDisplayContext::setCursorPosition(int disp, int x, int y)
 
 void TngDisplayContext::deinitialize()
 {
+    stopPostThread();
     mIMGDisplayDevice = 0;
 
+    // fences of the flips signal as the timeline goes away
+    if (mFlipRetireFence >= 0) {
+        close(mFlipRetireFence);
+        mFlipRetireFence = -1;
+    }
+    if (mFlipTimeline >= 0) {
+        close(mFlipTimeline);
+        mFlipTimeline = -1;
+    }
+    mAsyncFlipping = false;
+    mFlipPending = false;
+
     mCount = 0;
     mInitialized = false;
 }
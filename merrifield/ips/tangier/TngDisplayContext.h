@@ -16,7 +16,11 @@
 #ifndef TNG_DISPLAY_CONTEXT_H
 #define TNG_DISPLAY_CONTEXT_H
 
+#include <utils/threads.h>
+#include <utils/Vector.h>
 #include <IDisplayContext.h>
+#include <IDisplayDevice.h>
+#include <SimpleThread.h>
 #include <hal_public.h>
 
 typedef struct
@@ -36,6 +40,9 @@ IMG_display_device_public_t;
 namespace android {
 namespace intel {
 
+class DisplayPlane;
+class HwcLayer;
+
 class TngDisplayContext : public IDisplayContext {
 public:
     TngDisplayContext();
@@ -48,15 +55,109 @@ public:
     bool commitEnd(size_t numDisplays, hwc_display_contents_1_t **displays);
     bool compositionComplete();
     bool setCursorPosition(int disp, int x, int y);
+    void waitPosted();
+
+protected:
+    // the IMG display device behind post(), from the gralloc module
+    virtual IMG_display_device_public_t* openDisplayDevice();
+
+private:
+    bool flipContents(hwc_display_contents_1_t *display, HwcLayerList *layerList);
+    void closeAcquireFences(size_t numDisplays, hwc_display_contents_1_t **displays);
+    bool startPostThread();
+    void stopPostThread();
+    // hands the flipped layers to the post thread, returns the release
+    // fence of the post or -1 if it has to be posted synchronously
+    int queuePost();
+    // waits until the post thread is done with the frames queued to it
+    void drainPostThread();
+    // the post fence of a posted frame signals with its release fence,
+    // watched on the event loop so that the next frame is posted at once
+    void watchReleaseFence(int releaseFenceFd);
+    static void releaseFenceSignaled(int fd, uint32_t events, void *data);
+    void signalReleasedPosts();
+    void dropReleaseFences();
+    // shows the only layer of the primary by an async flip, with the
+    // fences of the frame set; false if it has to be posted
+    bool flipAsync();
+    // sets the modes queued by refresh switches; true if the frame was
+    // shown by the switch of the primary and needs no post
+    bool setPendingModes();
+    // flips to the layer of the only contents, or sets the queued mode of
+    // the primary on its buffer, with the fences of the frame set
+    bool showLayer(HwcLayer *hwcLayer, bool setMode);
+    // the frame was posted after async flips, the buffer of the last flip
+    // is released once releaseFenceFd signals
+    void endAsyncFlips(int releaseFenceFd);
+    // signals the fence of the last flip if the post that replaced it is
+    // done, polled by every commit
+    void retireLastFlip();
 
 private:
     enum {
         MAXIMUM_LAYER_NUMBER = 20,
+        // one frame posted while the next one is queued
+        POST_FRAMES = 2,
+    };
+
+    // what post() reads of a frame, copied so that the next commit may
+    // reuse the layers of SurfaceFlinger and the plane contexts
+    struct PostFrame {
+        IMG_hwc_layer_t imgLayers[MAXIMUM_LAYER_NUMBER];
+        hwc_layer_1_t layers[MAXIMUM_LAYER_NUMBER];
+        struct intel_dc_plane_ctx contexts[MAXIMUM_LAYER_NUMBER];
+        size_t count;
     };
+
     IMG_display_device_public_t *mIMGDisplayDevice;
     IMG_hwc_layer_t mImgLayers[MAXIMUM_LAYER_NUMBER];
+    // planes behind mImgLayers, told about the release fence of the post
+    DisplayPlane *mPlanes[MAXIMUM_LAYER_NUMBER];
     bool mInitialized;
     size_t mCount;
+
+    // contents are flipped in commitEnd(), nothing is posted when every
+    // display is idle
+    struct Contents {
+        hwc_display_contents_1_t *display;
+        HwcLayerList *layerList;
+    };
+    Contents mContents[IDisplayDevice::DEVICE_COUNT];
+    size_t mContentCount;
+    bool mAllIdle;
+
+    // with hwc.post.async set, post() runs on its own thread and
+    // SurfaceFlinger gets a fence of mPostTimeline at once, signaled when
+    // the release fence of the post does
+    DECLARE_THREAD(PostThread, TngDisplayContext);
+    Mutex mPostLock;
+    Condition mPostCondition;
+    PostFrame mPostFrames[POST_FRAMES];
+    // frame queued for the thread and frame being posted, -1 if none
+    int mQueuedFrame;
+    int mPostingFrame;
+    bool mExitPostThread;
+    int mPostTimeline;
+    uint32_t mNextPostPoint;
+    // release fences of the posted frames in post order, the oldest is
+    // the next point of mPostTimeline; protected by mReleaseLock
+    Mutex mReleaseLock;
+    Vector<int> mReleaseFences;
+
+    // with the async flip policy a full-screen game layer is flipped to
+    // at once, rather than posted for the next vblank. The release fence
+    // of a flipped buffer is a point of mFlipTimeline, signaled by the
+    // flip that replaces it.
+    bool mAsyncFlipping;
+    int mFlipTimeline;
+    uint32_t mNextFlipPoint;
+    // the release fence of the last flip is not signaled yet
+    bool mFlipPending;
+    // release fence of the post that ended the async flips, the fence of
+    // the last flip is signaled with it
+    int mFlipRetireFence;
+    uint32_t mAsyncFlips;
+    uint32_t mAsyncFlipFallbacks;
 };
 
 } // namespace intel
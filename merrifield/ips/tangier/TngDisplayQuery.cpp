@@ -20,6 +20,7 @@
 #include <OMX_IVCommon.h>
 #include <OMX_IntelVideoExt.h>
 #include <DisplayQuery.h>
+#include <common/FormatTable.h>
 
 
 namespace android {
@@ -27,16 +28,9 @@ namespace intel {
 
 bool DisplayQuery::isVideoFormat(uint32_t format)
 {
-    switch (format) {
-    case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar:
-    case OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled:
-    // Expand format to support the case: Software decoder + HW rendering
-    // Only VP9 use this foramt now
-    case HAL_PIXEL_FORMAT_YV12:
-        return true;
-    default:
-        return false;
-    }
+    // YV12 is also there for software decoders with HW rendering, only
+    // VP9 uses it now
+    return FormatTable::hasFlags(format, FormatTable::FORMAT_VIDEO);
 }
 
 int DisplayQuery::getOverlayLumaStrideAlignment(uint32_t format)
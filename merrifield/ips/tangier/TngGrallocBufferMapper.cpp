@@ -26,10 +26,14 @@ TngGrallocBufferMapper::TngGrallocBufferMapper(gralloc_module_t const& module,
                                                     DataBuffer& buffer)
     : GrallocBufferMapperBase(buffer),
       mGrallocModule(module),
-      mBufferObject(0)
+      mBufferObject(0),
+      mCpuMapped(false),
+      mGttDone(false)
 {
     CTRACE();
 
+    memset(mGttMapped, 0, sizeof(mGttMapped));
+
 	const native_handle_t *h = (native_handle_t *)mHandle;
 
 	mClonedHandle = native_handle_create(h->numFds, h->numInts);
@@ -111,18 +115,26 @@ bool TngGrallocBufferMapper::gttUnmap(void *vaddr)
     return true;
 }
 
-bool TngGrallocBufferMapper::map()
+bool TngGrallocBufferMapper::isContiguous(void *vaddr[], uint32_t size[], int index)
+{
+    // sub buffer index + 1 starts on the page right after sub buffer index
+    if (index + 1 >= SUB_BUFFER_MAX || !vaddr[index + 1] || !size[index + 1]) {
+        return false;
+    }
+    if ((unsigned long)vaddr[index] & (GTT_PAGE_SIZE - 1)) {
+        return false;
+    }
+    return (uint8_t*)vaddr[index + 1] ==
+           (uint8_t*)vaddr[index] + align_to(size[index], GTT_PAGE_SIZE);
+}
+
+bool TngGrallocBufferMapper::mapCpu()
 {
     void *vaddr[SUB_BUFFER_MAX];
     uint32_t size[SUB_BUFFER_MAX];
-    int gttOffsetInPage = 0;
-    bool ret;
-    int err;
-    int i;
 
-    CTRACE();
     // get virtual address
-    err = mGrallocModule.perform(&mGrallocModule,
+    int err = mGrallocModule.perform(&mGrallocModule,
                                   GRALLOC_MODULE_GET_BUFFER_CPU_ADDRESSES_IMG,
                                   (buffer_handle_t)mClonedHandle,
                                   vaddr,
@@ -132,65 +144,142 @@ bool TngGrallocBufferMapper::map()
         return false;
     }
 
+    for (int i = 0; i < SUB_BUFFER_MAX; i++) {
+        mCpuAddress[i] = vaddr[i];
+        mSize[i] = vaddr[i] ? size[i] : 0;
+    }
+    mCpuMapped = true;
+    return true;
+}
+
+void TngGrallocBufferMapper::unmapCpu()
+{
+    for (int i = 0; i < SUB_BUFFER_MAX; i++) {
+        mCpuAddress[i] = 0;
+        mSize[i] = 0;
+        mKHandle[i] = 0;
+    }
+    mCpuMapped = false;
+
+    int err = mGrallocModule.perform(&mGrallocModule,
+                                  GRALLOC_MODULE_PUT_BUFFER_CPU_ADDRESSES_IMG,
+                                  (buffer_handle_t)mClonedHandle);
+    if (err) {
+        ETRACE("failed to unmap. err = %d", err);
+    }
+}
+
+bool TngGrallocBufferMapper::mapGtt()
+{
+    void **vaddr = mCpuAddress;
+    uint32_t *size = mSize;
+    int gttOffsetInPage = 0;
+    int i;
+
     for (i = 0; i < SUB_BUFFER_MAX; i++) {
         // skip gtt mapping for empty sub buffers
         if (!vaddr[i] || !size[i])
             continue;
 
-        // map to gtt
-        ret = gttMap(vaddr[i], size[i], 0, &gttOffsetInPage);
-        if (!ret) {
-            VTRACE("failed to map %d into gtt", i);
-            break;
+        // sub buffers laid out back to back are mapped with one ioctl
+        int last = i;
+        while (isContiguous(vaddr, size, last)) {
+            last++;
+        }
+        if (last > i) {
+            uint32_t runSize = (uint8_t*)vaddr[last] - (uint8_t*)vaddr[i] + size[last];
+            if (!gttMap(vaddr[i], runSize, 0, &gttOffsetInPage)) {
+                VTRACE("failed to map %d-%d into gtt, mapping separately", i, last);
+                last = i;
+            }
+        }
+        if (last == i) {
+            if (!gttMap(vaddr[i], size[i], 0, &gttOffsetInPage)) {
+                VTRACE("failed to map %d into gtt", i);
+                break;
+            }
         }
 
-        mCpuAddress[i] = vaddr[i];
-        mSize[i] = size[i];
-        mGttOffsetInPage[i] = gttOffsetInPage;
-        // TODO:  set kernel handle
-        mKHandle[i] = 0;
+        mGttMapped[i] = true;
+        for (int j = i; j <= last; j++) {
+            mGttOffsetInPage[j] = gttOffsetInPage +
+                ((uint8_t*)vaddr[j] - (uint8_t*)vaddr[i]) / GTT_PAGE_SIZE;
+        }
+        i = last;
     }
 
     if (i == SUB_BUFFER_MAX) {
+        mGttDone = true;
         return true;
     }
 
-    // error handling
-    for (i = 0; i < SUB_BUFFER_MAX; i++) {
-        if (mCpuAddress[i]) {
+    unmapGtt();
+    return false;
+}
+
+void TngGrallocBufferMapper::unmapGtt()
+{
+    for (int i = 0; i < SUB_BUFFER_MAX; i++) {
+        if (mGttMapped[i])
             gttUnmap(mCpuAddress[i]);
-        }
+
+        mGttMapped[i] = false;
+        mGttOffsetInPage[i] = 0;
     }
+    mGttDone = false;
+}
 
-    err = mGrallocModule.perform(&mGrallocModule,
-                                  GRALLOC_MODULE_PUT_BUFFER_CPU_ADDRESSES_IMG,
-                                  (buffer_handle_t)mClonedHandle);
-    return false;
+bool TngGrallocBufferMapper::map()
+{
+    CTRACE();
+
+    // the CPU addresses are needed by every part, GTT mapping and the
+    // kernel handle only by the users asking for them
+    bool cpuMapped = mCpuMapped;
+    if (!mCpuMapped && !mapCpu()) {
+        return false;
+    }
+
+    bool ret = true;
+    if ((mProfile & PROFILE_GTT) && !mGttDone) {
+        ret = mapGtt();
+    }
+    if (ret && (mProfile & PROFILE_KHANDLE) && !mKHandle[0]) {
+        ret = mapKhandle();
+    }
+
+    // a failed map leaves the mapper as it was
+    if (!ret && !cpuMapped) {
+        unmapGtt();
+        unmapCpu();
+    }
+    return ret;
 }
 
 bool TngGrallocBufferMapper::unmap()
 {
-    int i;
-    int err;
-
     CTRACE();
 
-    for (i = 0; i < SUB_BUFFER_MAX; i++) {
-        if (mCpuAddress[i])
-            gttUnmap(mCpuAddress[i]);
-
-        mGttOffsetInPage[i] = 0;
-        mCpuAddress[i] = 0;
-        mSize[i] = 0;
+    unmapGtt();
+    if (mCpuMapped) {
+        unmapCpu();
     }
+    return true;
+}
 
-    err = mGrallocModule.perform(&mGrallocModule,
-                                  GRALLOC_MODULE_PUT_BUFFER_CPU_ADDRESSES_IMG,
-                                  (buffer_handle_t)mClonedHandle);
-    if (err) {
-        ETRACE("failed to unmap. err = %d", err);
+int TngGrallocBufferMapper::getMappedProfile() const
+{
+    int profile = 0;
+    if (mCpuMapped) {
+        profile |= PROFILE_CPU;
+    }
+    if (mGttDone) {
+        profile |= PROFILE_GTT;
+    }
+    if (mKHandle[0]) {
+        profile |= PROFILE_KHANDLE;
     }
-    return err;
+    return profile;
 }
 
 buffer_handle_t TngGrallocBufferMapper::getKHandle(int subIndex)
@@ -30,20 +30,36 @@ public:
                                DataBuffer& buffer);
     virtual ~TngGrallocBufferMapper();
 public:
+    // maps the parts of mProfile not mapped yet
     bool map();
     bool unmap();
+    int getMappedProfile() const;
     buffer_handle_t getKHandle(int subIndex);
     buffer_handle_t getFbHandle(int subIndex);
     void putFbHandle();
 private:
+    enum {
+        GTT_PAGE_SIZE = 4096,
+    };
+
     bool gttMap(void *vaddr, uint32_t size, uint32_t gttAlign, int *offset);
     bool gttUnmap(void *vaddr);
+    static bool isContiguous(void *vaddr[], uint32_t size[], int index);
     bool mapKhandle();
+    bool mapCpu();
+    void unmapCpu();
+    bool mapGtt();
+    void unmapGtt();
 
 private:
     gralloc_module_t const& mGrallocModule;
     void* mBufferObject;
 	native_handle_t* mClonedHandle;
+    // set for the first sub buffer of each gtt mapping, a mapping may
+    // cover the following sub buffers too
+    bool mGttMapped[SUB_BUFFER_MAX];
+    bool mCpuMapped;
+    bool mGttDone;
 };
 
 } // namespace intel
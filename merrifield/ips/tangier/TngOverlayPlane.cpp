@@ -37,6 +37,12 @@ TngOverlayPlane::~TngOverlayPlane()
     CTRACE();
 }
 
+int TngOverlayPlane::getBackBufferCount() const
+{
+    // flip() always reuses the current back buffer
+    return 1;
+}
+
 bool TngOverlayPlane::flip(void *ctx)
 {
     RETURN_FALSE_IF_NOT_INIT();
@@ -44,6 +50,12 @@ bool TngOverlayPlane::flip(void *ctx)
     if (!DisplayPlane::flip(ctx))
         return false;
 
+    // wait for the rotated buffer queued in setDataBuffer
+    if (mRotationBufProvider && !mRotationBufProvider->syncRotationBuffer()) {
+        ETRACE("failed to wait for rotation buffer");
+        return false;
+    }
+
     mContext.type = DC_OVERLAY_PLANE;
     mContext.ctx.ov_ctx.ovadd = 0x0;
     mContext.ctx.ov_ctx.ovadd = (mBackBuffer[mCurrent]->gttOffsetInPage << 12);
@@ -83,6 +95,11 @@ bool TngOverlayPlane::setDataBuffer(BufferMapper& mapper)
         return false;
     }
 
+    // the back buffer on screen is flipped again as it is
+    if (mFrameRepeated) {
+        return true;
+    }
+
     if (mIsProtectedBuffer) {
         // Bit 0: Decryption request, only allowed to change on a synchronous flip
         // This request will be qualified with the separate decryption enable bit for OV
@@ -115,6 +132,11 @@ void TngOverlayPlane::deinitialize()
     OverlayPlaneBase::deinitialize();
 }
 
+bool TngOverlayPlane::isDeinterlaceSupported()
+{
+    return mRotationBufProvider && mRotationBufProvider->isDeinterlaceSupported();
+}
+
 bool TngOverlayPlane::rotatedBufferReady(BufferMapper& mapper, BufferMapper* &rotatedMapper)
 {
     struct VideoPayloadBuffer *payload;
@@ -172,6 +194,11 @@ bool TngOverlayPlane::rotatedBufferReady(BufferMapper& mapper, BufferMapper* &ro
         }
     }
 
+    // the rotated buffer holds progressive frames, no field mode
+    if (mBobDeinterlace && mRotationBufProvider->isDeinterlaced()) {
+        mBobDeinterlace = 0;
+    }
+
     rotatedMapper = getTTMMapper(mapper, payload);
 
     return true;
@@ -195,7 +222,9 @@ bool TngOverlayPlane::flush(uint32_t flags)
 
     arg.plane.type = DC_OVERLAY_PLANE;
     arg.plane.index = mIndex;
-    arg.plane.ctx = (mBackBuffer[mCurrent]->gttOffsetInPage << 12);
+    // the plane is disabled before its back buffers exist
+    if (mBackBuffer[mCurrent])
+        arg.plane.ctx = (mBackBuffer[mCurrent]->gttOffsetInPage << 12);
     // pipe select
     arg.plane.ctx |= mPipeConfig;
 
@@ -203,13 +232,14 @@ bool TngOverlayPlane::flush(uint32_t flags)
         DTRACE("disabling overlay %d on device %d", mIndex, mDevice);
     }
 
-    // issue ioctl
+    // issue ioctl, batched with the frame if prepare is running
     Drm *drm = Hwcomposer::getInstance().getDrm();
-    bool ret = drm->writeReadIoctl(DRM_PSB_REGISTER_RW, &arg, sizeof(arg));
+    bool ret = drm->updatePlane(arg, this);
     if (ret == false) {
         WTRACE("overlay update failed with error code %d", ret);
         return false;
     }
+    recordPlaneState(arg.plane_enable_mask != 0);
 
     return true;
 }
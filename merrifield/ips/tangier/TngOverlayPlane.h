@@ -40,9 +40,11 @@ public:
     virtual bool initialize(uint32_t bufferCount);
     virtual void deinitialize();
     virtual bool rotatedBufferReady(BufferMapper& mapper, BufferMapper* &rotatedMapper);
+    virtual bool isDeinterlaceSupported();
 protected:
     virtual bool setDataBuffer(BufferMapper& mapper);
     virtual bool flush(uint32_t flags);
+    virtual int getBackBufferCount() const;
 
 protected:
     struct intel_dc_plane_ctx mContext;
@@ -91,13 +91,14 @@ bool TngPrimaryPlane::enablePlane(bool enabled)
     arg.plane.index = mIndex;
     arg.plane.ctx = 0;
 
-    // issue ioctl
+    // issue ioctl, batched with the frame if prepare is running
     Drm *drm = Hwcomposer::getInstance().getDrm();
-    bool ret = drm->writeReadIoctl(DRM_PSB_REGISTER_RW, &arg, sizeof(arg));
+    bool ret = drm->updatePlane(arg, this);
     if (ret == false) {
         WTRACE("primary enabling (%d) failed with error code %d", enabled, ret);
         return false;
     }
+    recordPlaneState(arg.plane_enable_mask != 0);
 
     return true;
 
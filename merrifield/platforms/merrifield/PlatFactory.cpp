@@ -44,6 +44,12 @@ PlatFactory::~PlatFactory()
     CTRACE();
 }
 
+Drm* PlatFactory::createDrm()
+{
+    CTRACE();
+    return new Drm();
+}
+
 DisplayPlaneManager* PlatFactory::createDisplayPlaneManager()
 {
     CTRACE();
@@ -28,6 +28,7 @@ public:
     PlatFactory();
     virtual ~PlatFactory();
 
+    virtual Drm* createDrm();
     virtual DisplayPlaneManager* createDisplayPlaneManager();
     virtual BufferManager* createBufferManager();
     virtual IDisplayDevice* createDisplayDevice(int disp);
@@ -53,28 +53,22 @@ BufferMapper* PlatfBufferManager::createBufferMapper(DataBuffer& buffer)
     return new TngGrallocBufferMapper(*mGrallocModule, buffer);
 }
 
-bool PlatfBufferManager::blit(buffer_handle_t srcHandle, buffer_handle_t destHandle,
-                              const crop_t& destRect, bool filter, bool async)
-
+int PlatfBufferManager::blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                                  const crop_t& destRect, bool filter, int acquireFenceFd)
 {
-    int fenceFd;
+    int fenceFd = -1;
 
     if (mGrallocModule->perform(mGrallocModule,
                                 GRALLOC_MODULE_BLIT_HANDLE_TO_HANDLE_IMG,
                                 srcHandle,
                                 destHandle,
                                 destRect.w, destRect.h, destRect.x,
-                                destRect.y, 0, -1, &fenceFd)) {
+                                destRect.y, 0, acquireFenceFd, &fenceFd)) {
         ETRACE("Blit failed");
-        return false;
-    }
-
-    if (!async) {
-        sync_wait(fenceFd, -1);
+        return -1;
     }
-    close(fenceFd);
 
-    return true;
+    return fenceFd;
 }
 
 } // namespace intel
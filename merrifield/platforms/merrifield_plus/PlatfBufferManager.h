@@ -33,8 +33,8 @@ public:
 protected:
     DataBuffer* createDataBuffer(buffer_handle_t handle);
     BufferMapper* createBufferMapper(DataBuffer& buffer);
-    bool blit(buffer_handle_t srcHandle, buffer_handle_t destHandle,
-              const crop_t& destRect, bool filter, bool async);
+    int blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                  const crop_t& destRect, bool filter, int acquireFenceFd);
 };
 
 }
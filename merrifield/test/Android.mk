@@ -15,6 +15,7 @@ LOCAL_SHARED_LIBRARIES := \
 	libbinder \
 	libcutils \
 	libgui \
+	libsync \
 	libui \
 	libutils \
 
@@ -24,3 +25,67 @@ LOCAL_C_INCLUDES := \
 # Build the binary to $(TARGET_OUT_DATA_NATIVE_TESTS)/$(LOCAL_MODULE)
 # to integrate with auto-test framework.
 include $(BUILD_EXECUTABLE)
+
+# Replay of layer traces captured with debug.hwc.capture
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := hwc_replay
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    hwc_replay.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libhardware \
+	libui \
+	libutils \
+
+LOCAL_C_INCLUDES := \
+    $(LOCAL_PATH)/../include \
+
+include $(BUILD_EXECUTABLE)
+
+# Comparison of benchmark results with the baselines of each platform
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := bench_compare
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    bench_compare.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+	libutils \
+
+include $(BUILD_EXECUTABLE)
+
+# VSP pipeline benchmark of the WiDi path
+ifeq ($(INTEL_WIDI), true)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := widi_vsp_bench
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    widi_vsp_bench.cpp \
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libhwcwidi \
+	libui \
+	libutils \
+
+LOCAL_C_INCLUDES := \
+    vendor/intel/hardware/PRIVATE/widi/libhwcwidi/ \
+
+include $(BUILD_EXECUTABLE)
+endif
+
+# tools on the mock platform
+include $(LOCAL_PATH)/mock/Android.mk
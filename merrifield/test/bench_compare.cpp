@@ -0,0 +1,525 @@
+/*
+// Copyright (c) 2014 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Compares the results of a benchmark run with the baseline of a platform.
+// Results are the CSV files the tools write with -c (hwc_replay,
+// hwc_stress, plane_fuzzer, overlay_setup_bench, mapper_bench): a header
+// row naming the columns, then a row per sample.
+//
+//   bench_compare -p platform [-b dir] [-k keys] [-t percent] [-s] results.csv
+//
+// The baseline is <dir>/<platform>/<file name of the results>; -s stores
+// the results there as the new baseline instead of comparing. The
+// platform is one of merrifield, merrifield_plus or moorefield_hdmi.
+//
+// Rows are grouped by their key columns: the columns holding text, the
+// columns of -k (by default the case columns of the tools) and none of
+// the sample indices, loop and frame. Every other column is a metric. Its
+// median and p99 are compared per group, each with a 95% confidence
+// interval from the order statistics of the samples, so no distribution
+// is assumed. A metric regresses when its interval is clear of the
+// baseline one and it moves by more than -t percent, 5 by default. Groups
+// of fewer than MIN_SAMPLES rows, such as the per case averages of
+// overlay_setup_bench, are compared on the threshold alone.
+//
+// Latencies (_us, _ns), mapper churn (maps, unmaps, remaps) and bandwidth
+// (_mbps, _kb) are better lower, frame rates (fps) better higher; other
+// metrics are reported and never flagged. The exit status is 2 if a
+// metric regressed.
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+using namespace android;
+
+enum {
+    // fewer samples in a group leave the intervals out
+    MIN_SAMPLES = 8,
+    LINE_SIZE = 1024,
+};
+
+// two sided 95%
+static const double Z_95 = 1.96;
+
+static const char *sPlatforms[] = {
+    "merrifield", "merrifield_plus", "moorefield_hdmi",
+};
+
+// numeric columns describing the case rather than measuring it
+static const char *sDefaultKeys =
+    "plane,scale,transform,displays,layers,stack,size,ext";
+
+// sample indices, neither keys nor metrics
+static const char *sIndexColumns[] = { "loop", "frame" };
+
+enum Direction {
+    // reported only
+    DIRECTION_NONE = 0,
+    DIRECTION_LOWER,
+    DIRECTION_HIGHER,
+};
+
+struct Table {
+    Vector<String8> columns;
+    Vector<Vector<String8> > rows;
+};
+
+struct Estimate {
+    double value;
+    double low;
+    double high;
+    // the interval is known
+    bool bounded;
+};
+
+static bool endsWith(const String8& s, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return s.length() >= n && !strcmp(s.string() + s.length() - n, suffix);
+}
+
+static Direction getDirection(const String8& column)
+{
+    if (endsWith(column, "_us") || endsWith(column, "_ns") ||
+        endsWith(column, "maps") ||
+        endsWith(column, "_mbps") || endsWith(column, "_kb")) {
+        return DIRECTION_LOWER;
+    }
+    if (endsWith(column, "fps")) {
+        return DIRECTION_HIGHER;
+    }
+    return DIRECTION_NONE;
+}
+
+static bool inList(const char *list, const String8& name)
+{
+    const char *p = list;
+    size_t n = name.length();
+    while (p && *p) {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == n && !strncmp(p, name.string(), n)) {
+            return true;
+        }
+        p = end ? end + 1 : NULL;
+    }
+    return false;
+}
+
+static bool isIndex(const String8& name)
+{
+    for (size_t i = 0; i < sizeof(sIndexColumns) / sizeof(sIndexColumns[0]); i++) {
+        if (name == sIndexColumns[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isNumber(const String8& value, double *number)
+{
+    if (value.isEmpty()) {
+        return false;
+    }
+    char *end;
+    double v = strtod(value.string(), &end);
+    if (*end) {
+        return false;
+    }
+    if (number) {
+        *number = v;
+    }
+    return true;
+}
+
+static void split(const char *line, Vector<String8>& fields)
+{
+    fields.clear();
+    const char *p = line;
+    for (;;) {
+        const char *end = p + strcspn(p, ",\r\n");
+        fields.push_back(String8(p, end - p));
+        if (*end != ',') {
+            break;
+        }
+        p = end + 1;
+    }
+}
+
+static bool loadTable(const char *path, Table& table)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char line[LINE_SIZE];
+    bool header = true;
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '\n' || line[0] == '#') {
+            continue;
+        }
+        if (header) {
+            split(line, table.columns);
+            header = false;
+            continue;
+        }
+        Vector<String8> fields;
+        split(line, fields);
+        // a row cut short by a crash of the bench
+        if (fields.size() != table.columns.size()) {
+            continue;
+        }
+        table.rows.push_back(fields);
+    }
+    fclose(file);
+
+    if (header) {
+        printf("%s has no header row\n", path);
+        return false;
+    }
+    return true;
+}
+
+static int findColumn(const Table& table, const String8& name)
+{
+    for (size_t i = 0; i < table.columns.size(); i++) {
+        if (table.columns[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// key columns of the results, by name so the baseline may order them
+// differently
+static void getKeys(const Table& table, const char *keys, Vector<String8>& out)
+{
+    for (size_t c = 0; c < table.columns.size(); c++) {
+        const String8& name = table.columns[c];
+        if (isIndex(name)) {
+            continue;
+        }
+        bool key = inList(keys, name);
+        for (size_t r = 0; !key && r < table.rows.size(); r++) {
+            key = !isNumber(table.rows[r][c], NULL);
+        }
+        if (key) {
+            out.push_back(name);
+        }
+    }
+}
+
+static bool getGroup(const Table& table, size_t row,
+                     const Vector<String8>& keys, String8& group)
+{
+    group.clear();
+    for (size_t k = 0; k < keys.size(); k++) {
+        int c = findColumn(table, keys[k]);
+        if (c < 0) {
+            return false;
+        }
+        if (k) {
+            group.append("/");
+        }
+        group.append(table.rows[row][c]);
+    }
+    if (group.isEmpty()) {
+        group = "all";
+    }
+    return true;
+}
+
+static int compareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void collect(const Table& table, const Vector<String8>& keys,
+                    const String8& group, int column, Vector<double>& samples)
+{
+    String8 g;
+    for (size_t r = 0; r < table.rows.size(); r++) {
+        double v;
+        if (getGroup(table, r, keys, g) && g == group &&
+            isNumber(table.rows[r][column], &v)) {
+            samples.push_back(v);
+        }
+    }
+    if (samples.size()) {
+        qsort(samples.editArray(), samples.size(), sizeof(double), compareDouble);
+    }
+}
+
+// the q quantile of sorted samples, with the distribution free interval
+// between the order statistics n*q -/+ z*sqrt(n*q*(1-q))
+static Estimate estimate(const Vector<double>& sorted, double q)
+{
+    Estimate e;
+    size_t n = sorted.size();
+    size_t rank = (size_t)(q * (n - 1) + 0.5);
+    e.value = sorted[rank];
+    e.low = e.value;
+    e.high = e.value;
+    e.bounded = n >= MIN_SAMPLES;
+    if (e.bounded) {
+        double spread = Z_95 * sqrt(n * q * (1 - q));
+        double low = floor(n * q - spread);
+        double high = ceil(n * q + spread);
+        e.low = sorted[low < 0 ? 0 : (size_t)low];
+        e.high = sorted[high > (double)(n - 1) ? n - 1 : (size_t)high];
+    }
+    return e;
+}
+
+static double getDelta(const Estimate& base, const Estimate& cur)
+{
+    if (base.value == 0) {
+        return cur.value == 0 ? 0 : (cur.value > 0 ? HUGE_VAL : -HUGE_VAL);
+    }
+    return (cur.value - base.value) * 100 / fabs(base.value);
+}
+
+// 1 worse, -1 better, 0 no significant change
+static int judge(const Estimate& base, const Estimate& cur, Direction direction,
+                 double threshold)
+{
+    if (direction == DIRECTION_NONE) {
+        return 0;
+    }
+
+    double delta = getDelta(base, cur);
+    if (fabs(delta) <= threshold) {
+        return 0;
+    }
+    bool up = delta > 0;
+    if (base.bounded && cur.bounded) {
+        bool clear = up ? cur.low > base.high : cur.high < base.low;
+        if (!clear) {
+            return 0;
+        }
+    }
+    bool worse = (direction == DIRECTION_LOWER) == up;
+    return worse ? 1 : -1;
+}
+
+static const char* getVerdict(int verdict)
+{
+    return verdict > 0 ? "REGRESSED" : (verdict < 0 ? "improved" : "");
+}
+
+static bool makeDir(const char *path)
+{
+    if (mkdir(path, 0775) && errno != EEXIST) {
+        printf("failed to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool storeBaseline(const char *results, const char *dir,
+                          const String8& path)
+{
+    if (!makeDir(dir) || !makeDir(path.getPathDir().string())) {
+        return false;
+    }
+
+    FILE *in = fopen(results, "r");
+    if (!in) {
+        printf("failed to open %s: %s\n", results, strerror(errno));
+        return false;
+    }
+    FILE *out = fopen(path.string(), "w");
+    if (!out) {
+        printf("failed to create %s: %s\n", path.string(), strerror(errno));
+        fclose(in);
+        return false;
+    }
+
+    char buffer[LINE_SIZE];
+    size_t n;
+    bool ok = true;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        ok = ok && fwrite(buffer, 1, n, out) == n;
+    }
+    fclose(in);
+    if (fclose(out) || !ok) {
+        printf("failed to write %s\n", path.string());
+        return false;
+    }
+    printf("stored %s\n", path.string());
+    return true;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s -p platform [-b dir] [-k keys] [-t percent] [-s] results.csv\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *platform = NULL;
+    const char *dir = "/data/local/tmp/hwc_baselines";
+    const char *keys = sDefaultKeys;
+    double threshold = 5;
+    bool store = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:b:k:t:s")) != -1) {
+        switch (opt) {
+        case 'p':
+            platform = optarg;
+            break;
+        case 'b':
+            dir = optarg;
+            break;
+        case 'k':
+            keys = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 's':
+            store = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || !platform || threshold < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    bool known = false;
+    for (size_t i = 0; i < sizeof(sPlatforms) / sizeof(sPlatforms[0]); i++) {
+        known = known || !strcmp(platform, sPlatforms[i]);
+    }
+    if (!known) {
+        printf("unknown platform %s\n", platform);
+        return 1;
+    }
+
+    const char *results = argv[optind];
+    String8 path(dir);
+    path.appendPath(platform);
+    path.appendPath(String8(results).getPathLeaf());
+
+    if (store) {
+        return storeBaseline(results, dir, path) ? 0 : 1;
+    }
+
+    Table cur, base;
+    if (!loadTable(results, cur)) {
+        return 1;
+    }
+    if (!loadTable(path.string(), base)) {
+        printf("store a baseline with -s first\n");
+        return 1;
+    }
+
+    Vector<String8> keyColumns;
+    getKeys(cur, keys, keyColumns);
+
+    // groups in the order the results have them
+    Vector<String8> groups;
+    String8 group;
+    for (size_t r = 0; r < cur.rows.size(); r++) {
+        getGroup(cur, r, keyColumns, group);
+        bool found = false;
+        for (size_t i = 0; !found && i < groups.size(); i++) {
+            found = groups[i] == group;
+        }
+        if (!found) {
+            groups.push_back(group);
+        }
+    }
+
+    printf("%s: %d samples against %d of %s\n", results, cur.rows.size(),
+           base.rows.size(), path.string());
+    printf("%-24s %-20s %5s %12s %12s %8s %12s %12s %8s\n", "group", "metric",
+           "n", "base p50", "p50", "delta", "base p99", "p99", "delta");
+
+    uint32_t regressions = 0, improvements = 0;
+    for (size_t g = 0; g < groups.size(); g++) {
+        for (size_t c = 0; c < cur.columns.size(); c++) {
+            const String8& name = cur.columns[c];
+            bool key = isIndex(name);
+            for (size_t k = 0; !key && k < keyColumns.size(); k++) {
+                key = keyColumns[k] == name;
+            }
+            if (key) {
+                continue;
+            }
+
+            int bc = findColumn(base, name);
+            Vector<double> curSamples, baseSamples;
+            collect(cur, keyColumns, groups[g], c, curSamples);
+            if (bc >= 0) {
+                collect(base, keyColumns, groups[g], bc, baseSamples);
+            }
+            if (!curSamples.size() || !baseSamples.size()) {
+                printf("%-24s %-20s not in the baseline\n", groups[g].string(),
+                       name.string());
+                continue;
+            }
+
+            Direction direction = getDirection(name);
+            Estimate base50 = estimate(baseSamples, 0.5);
+            Estimate cur50 = estimate(curSamples, 0.5);
+            Estimate base99 = estimate(baseSamples, 0.99);
+            Estimate cur99 = estimate(curSamples, 0.99);
+            int verdict50 = judge(base50, cur50, direction, threshold);
+            int verdict99 = judge(base99, cur99, direction, threshold);
+            int verdict = verdict50 > 0 || verdict99 > 0 ? 1 :
+                          (verdict50 < 0 || verdict99 < 0 ? -1 : 0);
+            if (verdict > 0) {
+                regressions++;
+            } else if (verdict < 0) {
+                improvements++;
+            }
+
+            printf("%-24s %-20s %5d %12.1f %12.1f %+7.1f%% %12.1f %12.1f %+7.1f%% %s\n",
+                   groups[g].string(), name.string(), curSamples.size(),
+                   base50.value, cur50.value, getDelta(base50, cur50),
+                   base99.value, cur99.value, getDelta(base99, cur99),
+                   getVerdict(verdict));
+            if (verdict50 && cur50.bounded && base50.bounded) {
+                printf("%-24s %-20s       p50 95%% ci [%.1f, %.1f] was [%.1f, %.1f]\n",
+                       "", "", cur50.low, cur50.high, base50.low, base50.high);
+            }
+            if (verdict99 && cur99.bounded && base99.bounded) {
+                printf("%-24s %-20s       p99 95%% ci [%.1f, %.1f] was [%.1f, %.1f]\n",
+                       "", "", cur99.low, cur99.high, base99.low, base99.high);
+            }
+        }
+    }
+
+    printf("%u regressed, %u improved over %.1f%%\n", regressions, improvements,
+           threshold);
+    return regressions ? 2 : 0;
+}
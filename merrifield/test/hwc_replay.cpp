@@ -0,0 +1,543 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Replays a layer trace captured with debug.hwc.capture against the
+// hwcomposer module and reports the cost of each prepare and set. Stop
+// surfaceflinger before running it, the module is opened by this process.
+//
+//   hwc_replay [-l loops] [-c frames.csv] [-p] trace
+//
+// -p paces the frames as they were captured, otherwise they are replayed
+// back to back. The composition chosen for each layer is compared with
+// the captured one, so a change in plane assignment shows as mismatches.
+//
+// Built as hwc_replay_mock (test/mock) it runs against the mock platform
+// linked into it, with buffers of the mock allocator, and needs no board.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+#include <ui/GraphicBuffer.h>
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <LayerTraceFormat.h>
+#ifdef HWC_REPLAY_MOCK
+#include <MockBufferManager.h>
+#endif
+
+using namespace android;
+using namespace android::intel;
+
+#ifdef HWC_REPLAY_MOCK
+// defined by HwcModule.cpp of the mock platform
+extern hwc_module_t HAL_MODULE_INFO_SYM;
+#endif
+
+struct ReplayFrame {
+    TraceFrame header;
+    // a display's layers follow the layers of the displays before it
+    Vector<TraceDisplay> displays;
+    Vector<TraceLayer> layers;
+    // composition chosen by the captured prepare, same order as layers
+    Vector<uint32_t> expected;
+    int64_t prepareTime;
+    int64_t commitTime;
+};
+
+struct ReplayTrace {
+    KeyedVector<uint32_t, TraceBuffer> buffers;
+    Vector<ReplayFrame> frames;
+};
+
+struct FrameCost {
+    int64_t prepare;
+    int64_t set;
+    uint32_t mismatches;
+};
+
+static bool readPayload(FILE *fp, const TraceRecordHeader& header,
+                        Vector<uint8_t>& payload)
+{
+    payload.resize(header.size);
+    return header.size == 0 ||
+           fread(payload.editArray(), header.size, 1, fp) == 1;
+}
+
+template <typename T>
+static bool take(const Vector<uint8_t>& payload, size_t& offset, T& value)
+{
+    if (offset + sizeof(T) > payload.size()) {
+        return false;
+    }
+    memcpy(&value, payload.array() + offset, sizeof(T));
+    offset += sizeof(T);
+    return true;
+}
+
+static bool parseFrame(const Vector<uint8_t>& payload, ReplayFrame& frame)
+{
+    size_t offset = 0;
+    if (!take(payload, offset, frame.header)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < frame.header.numDisplays; i++) {
+        TraceDisplay display;
+        if (!take(payload, offset, display)) {
+            return false;
+        }
+        frame.displays.push_back(display);
+        for (uint32_t j = 0; j < display.numLayers; j++) {
+            TraceLayer layer;
+            if (!take(payload, offset, layer)) {
+                return false;
+            }
+            frame.layers.push_back(layer);
+        }
+    }
+    frame.prepareTime = 0;
+    frame.commitTime = 0;
+    return true;
+}
+
+static bool parseResult(const Vector<uint8_t>& payload, ReplayFrame& frame)
+{
+    size_t offset = 0;
+    TraceResult result;
+    if (!take(payload, offset, result) || result.frame != frame.header.frame) {
+        return false;
+    }
+    frame.prepareTime = result.prepareTime;
+    for (uint32_t i = 0; i < result.numDisplays; i++) {
+        uint32_t numLayers;
+        if (!take(payload, offset, numLayers)) {
+            return false;
+        }
+        for (uint32_t j = 0; j < numLayers; j++) {
+            uint32_t type;
+            if (!take(payload, offset, type)) {
+                return false;
+            }
+            frame.expected.push_back(type);
+        }
+    }
+    return true;
+}
+
+static bool loadTrace(const char *path, ReplayTrace& trace)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        printf("failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    TraceFileHeader fileHeader;
+    if (fread(&fileHeader, sizeof(fileHeader), 1, fp) != 1 ||
+        fileHeader.magic != LAYER_TRACE_MAGIC ||
+        fileHeader.version != LAYER_TRACE_VERSION) {
+        printf("%s is not a layer trace of version %d\n", path, LAYER_TRACE_VERSION);
+        fclose(fp);
+        return false;
+    }
+
+    TraceRecordHeader header;
+    Vector<uint8_t> payload;
+    ReplayFrame frame;
+    bool pending = false;
+    while (fread(&header, sizeof(header), 1, fp) == 1) {
+        if (!readPayload(fp, header, payload)) {
+            printf("truncated record at frame %d\n", trace.frames.size());
+            break;
+        }
+
+        size_t offset = 0;
+        switch (header.type) {
+        case TRACE_RECORD_BUFFER: {
+            TraceBuffer buffer;
+            if (take(payload, offset, buffer)) {
+                trace.buffers.replaceValueFor(buffer.id, buffer);
+            }
+            break;
+        }
+        case TRACE_RECORD_FRAME:
+            frame = ReplayFrame();
+            pending = parseFrame(payload, frame);
+            break;
+        case TRACE_RECORD_RESULT:
+            if (pending && !parseResult(payload, frame)) {
+                pending = false;
+            }
+            break;
+        case TRACE_RECORD_COMMIT: {
+            TraceCommit commit;
+            if (pending && take(payload, offset, commit) &&
+                commit.frame == frame.header.frame) {
+                frame.commitTime = commit.commitTime;
+                trace.frames.push_back(frame);
+            }
+            pending = false;
+            break;
+        }
+        default:
+            // records of later versions are skipped
+            break;
+        }
+    }
+
+    fclose(fp);
+    return true;
+}
+
+class HwcReplay {
+public:
+    HwcReplay() : mDevice(NULL) {}
+    ~HwcReplay();
+
+public:
+    bool open();
+    bool allocateBuffers(const ReplayTrace& trace);
+    bool replay(const ReplayFrame& frame, FrameCost& cost);
+
+private:
+    static void invalidate(const struct hwc_procs *procs) {}
+    static void vsync(const struct hwc_procs *procs, int disp, int64_t timestamp) {}
+    static void hotplug(const struct hwc_procs *procs, int disp, int connected) {}
+
+private:
+    hwc_composer_device_1_t *mDevice;
+    hwc_procs_t mProcs;
+    KeyedVector<uint32_t, buffer_handle_t> mHandles;
+#ifndef HWC_REPLAY_MOCK
+    // owners of mHandles
+    Vector<sp<GraphicBuffer> > mBuffers;
+#endif
+};
+
+HwcReplay::~HwcReplay()
+{
+    if (mDevice) {
+        hwc_close_1(mDevice);
+    }
+#ifdef HWC_REPLAY_MOCK
+    for (size_t i = 0; i < mHandles.size(); i++) {
+        MockBuffer::free(mHandles.valueAt(i));
+    }
+#endif
+}
+
+bool HwcReplay::open()
+{
+#ifdef HWC_REPLAY_MOCK
+    const hw_module_t *module = &HAL_MODULE_INFO_SYM.common;
+    int err;
+#else
+    const hw_module_t *module;
+    int err = hw_get_module(HWC_HARDWARE_MODULE_ID, &module);
+    if (err) {
+        printf("failed to get hwcomposer module: %d\n", err);
+        return false;
+    }
+#endif
+
+    err = hwc_open_1(module, &mDevice);
+    if (err) {
+        printf("failed to open hwcomposer: %d\n", err);
+        mDevice = NULL;
+        return false;
+    }
+
+    mProcs.invalidate = invalidate;
+    mProcs.vsync = vsync;
+    mProcs.hotplug = hotplug;
+    mDevice->registerProcs(mDevice, &mProcs);
+    return true;
+}
+
+bool HwcReplay::allocateBuffers(const ReplayTrace& trace)
+{
+    size_t failed = 0;
+    for (size_t i = 0; i < trace.buffers.size(); i++) {
+        const TraceBuffer& buffer = trace.buffers.valueAt(i);
+        // framebuffer targets are allocated as plain composer buffers
+        uint32_t usage = (buffer.usage & ~GRALLOC_USAGE_HW_FB) |
+                         GRALLOC_USAGE_HW_COMPOSER;
+#ifdef HWC_REPLAY_MOCK
+        buffer_handle_t handle = MockBuffer::allocate(buffer.width, buffer.height,
+                                                      buffer.format, usage);
+        if (!handle) {
+            failed++;
+            continue;
+        }
+#else
+        sp<GraphicBuffer> gb = new GraphicBuffer(buffer.width, buffer.height,
+                                                 buffer.format, usage);
+        if (gb == NULL || gb->initCheck() != NO_ERROR) {
+            failed++;
+            continue;
+        }
+        mBuffers.push_back(gb);
+        buffer_handle_t handle = gb->handle;
+#endif
+        mHandles.add(buffer.id, handle);
+    }
+
+    if (failed) {
+        printf("%d of %d buffers could not be allocated, their layers have no buffer\n",
+               failed, trace.buffers.size());
+    }
+    return mHandles.size() > 0 || trace.buffers.size() == 0;
+}
+
+bool HwcReplay::replay(const ReplayFrame& frame, FrameCost& cost)
+{
+    hwc_display_contents_1_t *displays[HWC_NUM_DISPLAY_TYPES];
+    Vector<hwc_rect_t> rects;
+    size_t numDisplays = frame.displays.size();
+    if (numDisplays > HWC_NUM_DISPLAY_TYPES) {
+        numDisplays = HWC_NUM_DISPLAY_TYPES;
+    }
+
+    // visible regions are replayed as the display frame
+    rects.resize(frame.layers.size());
+
+    size_t base = 0;
+    for (size_t i = 0; i < numDisplays; i++) {
+        const TraceDisplay& display = frame.displays[i];
+        displays[i] = NULL;
+        // a virtual display needs an output buffer, it is left out
+        if (!display.present || i >= HWC_DISPLAY_VIRTUAL) {
+            base += display.numLayers;
+            continue;
+        }
+
+        size_t size = sizeof(hwc_display_contents_1_t) +
+                      display.numLayers * sizeof(hwc_layer_1_t);
+        hwc_display_contents_1_t *contents =
+            (hwc_display_contents_1_t *)calloc(1, size);
+        contents->retireFenceFd = -1;
+        contents->flags = display.flags;
+        contents->numHwLayers = display.numLayers;
+        for (size_t j = 0; j < display.numLayers; j++) {
+            const TraceLayer& trace = frame.layers[base + j];
+            hwc_layer_1_t& layer = contents->hwLayers[j];
+            ssize_t index = mHandles.indexOfKey(trace.bufferId);
+            layer.handle = index >= 0 ? mHandles.valueAt(index) : NULL;
+            layer.compositionType = trace.compositionType;
+            layer.hints = trace.hints;
+            layer.flags = trace.flags;
+            layer.transform = trace.transform;
+            layer.blending = trace.blending;
+            layer.sourceCropf.left = trace.sourceCrop[0];
+            layer.sourceCropf.top = trace.sourceCrop[1];
+            layer.sourceCropf.right = trace.sourceCrop[2];
+            layer.sourceCropf.bottom = trace.sourceCrop[3];
+            layer.displayFrame.left = trace.displayFrame[0];
+            layer.displayFrame.top = trace.displayFrame[1];
+            layer.displayFrame.right = trace.displayFrame[2];
+            layer.displayFrame.bottom = trace.displayFrame[3];
+            layer.planeAlpha = trace.planeAlpha;
+            rects.editItemAt(base + j) = layer.displayFrame;
+            layer.visibleRegionScreen.numRects = 1;
+            layer.visibleRegionScreen.rects = &rects[base + j];
+            layer.acquireFenceFd = -1;
+            layer.releaseFenceFd = -1;
+        }
+        displays[i] = contents;
+        base += display.numLayers;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int err = mDevice->prepare(mDevice, numDisplays, displays);
+    nsecs_t prepared = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (!err) {
+        err = mDevice->set(mDevice, numDisplays, displays);
+    }
+    nsecs_t done = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    cost.prepare = prepared - start;
+    cost.set = done - prepared;
+    cost.mismatches = 0;
+
+    base = 0;
+    for (size_t i = 0; i < numDisplays; i++) {
+        hwc_display_contents_1_t *contents = displays[i];
+        if (!contents) {
+            base += frame.displays[i].numLayers;
+            continue;
+        }
+        for (size_t j = 0; j < contents->numHwLayers; j++) {
+            hwc_layer_1_t& layer = contents->hwLayers[j];
+            if (base + j < frame.expected.size() &&
+                layer.compositionType != frame.expected[base + j]) {
+                cost.mismatches++;
+            }
+            if (layer.releaseFenceFd >= 0) {
+                close(layer.releaseFenceFd);
+            }
+        }
+        if (contents->retireFenceFd >= 0) {
+            close(contents->retireFenceFd);
+        }
+        base += contents->numHwLayers;
+        free(contents);
+    }
+
+    if (err) {
+        printf("frame %d: hwc returned %d\n", frame.header.frame, err);
+        return false;
+    }
+    return true;
+}
+
+static int compareCost(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void printCost(const char *name, Vector<int64_t>& costs)
+{
+    if (costs.size() == 0) {
+        return;
+    }
+
+    int64_t total = 0;
+    for (size_t i = 0; i < costs.size(); i++) {
+        total += costs[i];
+    }
+    qsort(costs.editArray(), costs.size(), sizeof(int64_t), compareCost);
+    size_t n = costs.size();
+    printf("%-18s avg %7lld us  p50 %7lld us  p99 %7lld us  max %7lld us\n",
+           name, ns2us(total / n), ns2us(costs[n / 2]),
+           ns2us(costs[(n * 99) / 100]), ns2us(costs[n - 1]));
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-l loops] [-c frames.csv] [-p] trace\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int loops = 1;
+    bool pace = false;
+    const char *csvPath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:c:p")) != -1) {
+        switch (opt) {
+        case 'l':
+            loops = atoi(optarg);
+            break;
+        case 'c':
+            csvPath = optarg;
+            break;
+        case 'p':
+            pace = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || loops < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ReplayTrace trace;
+    if (!loadTrace(argv[optind], trace)) {
+        return 1;
+    }
+    printf("%d frames, %d buffers\n", trace.frames.size(), trace.buffers.size());
+    if (trace.frames.size() == 0) {
+        return 1;
+    }
+
+    HwcReplay replay;
+    if (!replay.open() || !replay.allocateBuffers(trace)) {
+        return 1;
+    }
+
+    FILE *csv = NULL;
+    if (csvPath) {
+        csv = fopen(csvPath, "w");
+        if (!csv) {
+            printf("failed to open %s\n", csvPath);
+            return 1;
+        }
+        fprintf(csv, "loop,frame,prepare_us,set_us,captured_prepare_us,"
+                "captured_commit_us,mismatches\n");
+    }
+
+    Vector<int64_t> prepareCosts, setCosts, capturedPrepare, capturedCommit;
+    uint32_t mismatches = 0, mismatchedFrames = 0, failures = 0;
+    for (int loop = 0; loop < loops; loop++) {
+        nsecs_t loopStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (size_t i = 0; i < trace.frames.size(); i++) {
+            const ReplayFrame& frame = trace.frames[i];
+            if (pace) {
+                nsecs_t due = loopStart + frame.header.timestamp -
+                              trace.frames[0].header.timestamp;
+                nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+                if (due > now) {
+                    usleep(ns2us(due - now));
+                }
+            }
+
+            FrameCost cost;
+            if (!replay.replay(frame, cost)) {
+                failures++;
+                continue;
+            }
+            prepareCosts.push_back(cost.prepare);
+            setCosts.push_back(cost.set);
+            if (loop == 0) {
+                capturedPrepare.push_back(frame.prepareTime);
+                capturedCommit.push_back(frame.commitTime);
+            }
+            mismatches += cost.mismatches;
+            if (cost.mismatches) {
+                mismatchedFrames++;
+            }
+            if (csv) {
+                fprintf(csv, "%d,%u,%lld,%lld,%lld,%lld,%u\n", loop,
+                        frame.header.frame, ns2us(cost.prepare),
+                        ns2us(cost.set), ns2us(frame.prepareTime),
+                        ns2us(frame.commitTime), cost.mismatches);
+            }
+        }
+    }
+
+    if (csv) {
+        fclose(csv);
+    }
+
+    printf("replayed %d frames x %d, %u failed\n", trace.frames.size(), loops, failures);
+    printCost("prepare", prepareCosts);
+    printCost("set", setCosts);
+    printCost("captured prepare", capturedPrepare);
+    printCost("captured commit", capturedCommit);
+    printf("composition mismatches: %u layers in %u frames\n",
+           mismatches, mismatchedFrames);
+    return failures ? 1 : 0;
+}
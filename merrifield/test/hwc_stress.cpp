@@ -0,0 +1,733 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Stress test of the primary, HDMI and WiDi displays composed together on
+// the mock platform. Each frame has a ramp of mixed format layers on the
+// primary display, a mirror on HDMI while it is connected and a virtual
+// display with an output buffer. HDMI is plugged and unplugged, and a
+// video session started and stopped, at fixed intervals.
+//
+//   hwc_stress [-f frames] [-n layers] [-g period] [-h period] [-e period]
+//              [-m modes] [-d displays] [-u] [-c frames.csv]
+//
+// -n is the most layers on the primary display, the count steps from one
+// to it at every geometry change (-g frames). HDMI toggles every -h frames
+// with the modes of -m, video playback every -e frames, 0 disables either.
+// -d is a mask of the displays, 1 primary, 2 HDMI and 4 WiDi. Frames are
+// paced to the primary vblank unless -u is given.
+//
+// Prepare and set latencies, layers falling back to GLES and GTT mappings
+// are reported per number of active displays and primary layers, which is
+// where a scaling cliff shows.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <hal_public.h>
+#include <Hwcomposer.h>
+#include <IDisplayDevice.h>
+#include <DisplayAnalyzer.h>
+#include <DrmConfig.h>
+#include <EventLoop.h>
+#include <UeventObserver.h>
+#include <MockBufferManager.h>
+#include <MockDrm.h>
+
+using namespace android;
+using namespace android::intel;
+
+// defined by HwcModule.cpp of the mock platform
+extern hwc_module_t HAL_MODULE_INFO_SYM;
+
+// playback states as the multi display service sends them
+enum {
+    VIDEO_STATE_STARTED = 2,
+    VIDEO_STATE_STOPPED = 4,
+};
+
+enum {
+    DISPLAY_MASK_PRIMARY = 1 << HWC_DISPLAY_PRIMARY,
+    DISPLAY_MASK_EXTERNAL = 1 << HWC_DISPLAY_EXTERNAL,
+    DISPLAY_MASK_VIRTUAL = 1 << HWC_DISPLAY_VIRTUAL,
+};
+
+enum {
+    BUFFERS_PER_SURFACE = 3,
+    MAX_LAYERS = 32,
+    VIRTUAL_WIDTH = 1280,
+    VIRTUAL_HEIGHT = 720,
+};
+
+struct StressSurface {
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    buffer_handle_t buffers[BUFFERS_PER_SURFACE];
+};
+
+// frames of one number of active displays and primary layers
+struct StressBucket {
+    StressBucket() : frames(0), layers(0), fallbacks(0), fallbackFrames(0),
+                     maps(0), unmaps(0) {}
+    Vector<int64_t> prepare;
+    Vector<int64_t> set;
+    uint32_t frames;
+    uint32_t layers;
+    uint32_t fallbacks;
+    uint32_t fallbackFrames;
+    uint32_t maps;
+    uint32_t unmaps;
+};
+
+struct StressOptions {
+    int frames;
+    int layers;
+    int geometryPeriod;
+    int hotplugPeriod;
+    int videoPeriod;
+    int displays;
+    bool paced;
+    const char *modes;
+    const char *csvPath;
+};
+
+class HwcStress {
+public:
+    HwcStress(const StressOptions& options);
+    ~HwcStress();
+
+public:
+    bool open();
+    bool allocate();
+    bool run();
+    void report();
+
+private:
+    static void invalidate(const struct hwc_procs *procs) {}
+    static void vsync(const struct hwc_procs *procs, int disp, int64_t timestamp) {}
+    static void hotplug(const struct hwc_procs *procs, int disp, int connected);
+    static void hotplugTimerExpired(int timer, void *data);
+
+    bool allocateSurface(StressSurface& surface, uint32_t format,
+                         uint32_t width, uint32_t height, uint32_t usage);
+    void freeSurface(StressSurface& surface);
+    void setLayer(hwc_layer_1_t& layer, const StressSurface& surface,
+                  int frame, const hwc_rect_t& frameRect);
+    hwc_display_contents_1_t* createContents(size_t numLayers);
+    hwc_display_contents_1_t* buildPrimary(int frame);
+    hwc_display_contents_1_t* buildExternal(int frame);
+    hwc_display_contents_1_t* buildVirtual(int frame);
+    void toggleHotplug();
+    void toggleVideo();
+    StressBucket* getBucket(int displays, int layers);
+
+private:
+    StressOptions mOptions;
+    hwc_composer_device_1_t *mDevice;
+    hwc_procs_t mProcs;
+    MockDrm *mDrm;
+
+    Vector<StressSurface> mSurfaces;
+    StressSurface mVideo;
+    StressSurface mTargets[HWC_NUM_DISPLAY_TYPES];
+    StressSurface mOutput;
+    uint32_t mPrimaryWidth;
+    uint32_t mPrimaryHeight;
+
+    int mLayerCount;
+    int mGeneration;
+    bool mGeometryChanged;
+    bool mVideoPlaying;
+    bool mPlugged;
+    int mHotplugTimer;
+    nsecs_t mHotplugStart;
+    Vector<int64_t> mHotplugLatency;
+    uint32_t mVideoExtFrames;
+    uint32_t mFailures;
+
+    KeyedVector<int, StressBucket*> mBuckets;
+    FILE *mCsv;
+
+    // written by the hotplug callback on the event loop thread
+    static volatile int32_t sExternalConnected;
+    static volatile int32_t sHotplugs;
+};
+
+volatile int32_t HwcStress::sExternalConnected = 0;
+volatile int32_t HwcStress::sHotplugs = 0;
+
+HwcStress::HwcStress(const StressOptions& options)
+    : mOptions(options),
+      mDevice(NULL),
+      mDrm(NULL),
+      mPrimaryWidth(0),
+      mPrimaryHeight(0),
+      mLayerCount(1),
+      mGeneration(0),
+      mGeometryChanged(true),
+      mVideoPlaying(false),
+      mPlugged(false),
+      mHotplugTimer(-1),
+      mHotplugStart(0),
+      mVideoExtFrames(0),
+      mFailures(0),
+      mCsv(NULL)
+{
+    memset(&mVideo, 0, sizeof(mVideo));
+    memset(mTargets, 0, sizeof(mTargets));
+    memset(&mOutput, 0, sizeof(mOutput));
+}
+
+HwcStress::~HwcStress()
+{
+    if (mHotplugTimer >= 0) {
+        Hwcomposer::getInstance().getEventLoop()->removeTimer(mHotplugTimer);
+    }
+    if (mDevice) {
+        hwc_close_1(mDevice);
+    }
+    for (size_t i = 0; i < mSurfaces.size(); i++) {
+        freeSurface(mSurfaces.editItemAt(i));
+    }
+    freeSurface(mVideo);
+    for (int i = 0; i < HWC_NUM_DISPLAY_TYPES; i++) {
+        freeSurface(mTargets[i]);
+    }
+    freeSurface(mOutput);
+    for (size_t i = 0; i < mBuckets.size(); i++) {
+        delete mBuckets.valueAt(i);
+    }
+    if (mCsv) {
+        fclose(mCsv);
+    }
+}
+
+void HwcStress::hotplug(const struct hwc_procs *procs, int disp, int connected)
+{
+    if (disp != HWC_DISPLAY_EXTERNAL) {
+        return;
+    }
+    android_atomic_release_store(connected ? 1 : 0, &sExternalConnected);
+    android_atomic_inc(&sHotplugs);
+}
+
+void HwcStress::hotplugTimerExpired(int timer, void *data)
+{
+    Hwcomposer::getInstance().getUeventObserver()->notify(
+        DrmConfig::getHotplugString());
+}
+
+bool HwcStress::open()
+{
+    int err = hwc_open_1(&HAL_MODULE_INFO_SYM.common, &mDevice);
+    if (err) {
+        printf("failed to open hwcomposer: %d\n", err);
+        mDevice = NULL;
+        return false;
+    }
+
+    mProcs.invalidate = invalidate;
+    mProcs.vsync = vsync;
+    mProcs.hotplug = hotplug;
+    mDevice->registerProcs(mDevice, &mProcs);
+
+    // the mock platform is linked in, its drm is a MockDrm
+    mDrm = static_cast<MockDrm *>(Hwcomposer::getInstance().getDrm());
+    drmModeModeInfo mode;
+    if (!mDrm->getModeInfo(IDisplayDevice::DEVICE_PRIMARY, mode)) {
+        printf("primary display is not connected\n");
+        return false;
+    }
+    mPrimaryWidth = mode.hdisplay;
+    mPrimaryHeight = mode.vdisplay;
+
+    if (mOptions.csvPath) {
+        mCsv = fopen(mOptions.csvPath, "w");
+        if (!mCsv) {
+            printf("failed to open %s\n", mOptions.csvPath);
+            return false;
+        }
+        fprintf(mCsv, "frame,displays,layers,prepare_us,set_us,fallbacks,"
+                "gtt_maps,gtt_unmaps,video_ext,ddr_mbps\n");
+    }
+    return true;
+}
+
+bool HwcStress::allocateSurface(StressSurface& surface, uint32_t format,
+                                uint32_t width, uint32_t height, uint32_t usage)
+{
+    surface.format = format;
+    surface.width = width;
+    surface.height = height;
+    for (int i = 0; i < BUFFERS_PER_SURFACE; i++) {
+        surface.buffers[i] = MockBuffer::allocate(width, height, format, usage);
+        if (!surface.buffers[i]) {
+            printf("failed to allocate a %ux%u buffer of format %#x\n",
+                   width, height, format);
+            return false;
+        }
+    }
+    return true;
+}
+
+void HwcStress::freeSurface(StressSurface& surface)
+{
+    for (int i = 0; i < BUFFERS_PER_SURFACE; i++) {
+        if (surface.buffers[i]) {
+            MockBuffer::free(surface.buffers[i]);
+            surface.buffers[i] = NULL;
+        }
+    }
+}
+
+bool HwcStress::allocate()
+{
+    // formats of the composer layers, cycled through by the ramp
+    static const uint32_t formats[] = {
+        HAL_PIXEL_FORMAT_RGBA_8888,
+        HAL_PIXEL_FORMAT_RGB_565,
+        HAL_PIXEL_FORMAT_NV12,
+        HAL_PIXEL_FORMAT_BGRA_8888,
+        HAL_PIXEL_FORMAT_YV12,
+        HAL_PIXEL_FORMAT_RGBX_8888,
+    };
+    const size_t numFormats = sizeof(formats) / sizeof(formats[0]);
+    const uint32_t usage = GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE;
+
+    mSurfaces.resize(mOptions.layers);
+    for (int i = 0; i < mOptions.layers; i++) {
+        StressSurface& surface = mSurfaces.editItemAt(i);
+        memset(&surface, 0, sizeof(surface));
+        // the first layer is a full screen wallpaper, the others windows
+        // of a quarter to half of the screen
+        uint32_t width = i ? mPrimaryWidth / (2 + (i & 1)) : mPrimaryWidth;
+        uint32_t height = i ? mPrimaryHeight / (2 + (i & 1)) : mPrimaryHeight;
+        if (!allocateSurface(surface, formats[i % numFormats], width, height, usage)) {
+            return false;
+        }
+    }
+
+    if (!allocateSurface(mVideo, HAL_PIXEL_FORMAT_NV12, 1920, 1080, usage)) {
+        return false;
+    }
+    for (int i = 0; i < HWC_NUM_DISPLAY_TYPES; i++) {
+        uint32_t width = i == HWC_DISPLAY_VIRTUAL ? VIRTUAL_WIDTH : mPrimaryWidth;
+        uint32_t height = i == HWC_DISPLAY_VIRTUAL ? VIRTUAL_HEIGHT : mPrimaryHeight;
+        if (i == HWC_DISPLAY_EXTERNAL) {
+            // HDMI targets are sized for the largest mode of -m
+            width = 1920;
+            height = 1080;
+        }
+        if (!allocateSurface(mTargets[i], HAL_PIXEL_FORMAT_RGBA_8888,
+                             width, height, usage | GRALLOC_USAGE_HW_RENDER)) {
+            return false;
+        }
+    }
+    return allocateSurface(mOutput, HAL_PIXEL_FORMAT_NV12, VIRTUAL_WIDTH,
+                           VIRTUAL_HEIGHT, usage | GRALLOC_USAGE_HW_VIDEO_ENCODER);
+}
+
+void HwcStress::setLayer(hwc_layer_1_t& layer, const StressSurface& surface,
+                         int frame, const hwc_rect_t& frameRect)
+{
+    memset(&layer, 0, sizeof(layer));
+    layer.compositionType = HWC_FRAMEBUFFER;
+    layer.handle = surface.buffers[frame % BUFFERS_PER_SURFACE];
+    layer.blending = surface.format == HAL_PIXEL_FORMAT_RGBA_8888 ||
+                     surface.format == HAL_PIXEL_FORMAT_BGRA_8888 ?
+                     HWC_BLENDING_PREMULT : HWC_BLENDING_NONE;
+    layer.sourceCropf.right = surface.width;
+    layer.sourceCropf.bottom = surface.height;
+    layer.displayFrame = frameRect;
+    layer.visibleRegionScreen.numRects = 1;
+    layer.visibleRegionScreen.rects = &layer.displayFrame;
+    layer.planeAlpha = 0xff;
+    layer.acquireFenceFd = -1;
+    layer.releaseFenceFd = -1;
+}
+
+hwc_display_contents_1_t* HwcStress::createContents(size_t numLayers)
+{
+    size_t size = sizeof(hwc_display_contents_1_t) +
+                  numLayers * sizeof(hwc_layer_1_t);
+    hwc_display_contents_1_t *contents =
+        (hwc_display_contents_1_t *)calloc(1, size);
+    contents->retireFenceFd = -1;
+    contents->outbufAcquireFenceFd = -1;
+    contents->flags = mGeometryChanged ? HWC_GEOMETRY_CHANGED : 0;
+    contents->numHwLayers = numLayers;
+    return contents;
+}
+
+hwc_display_contents_1_t* HwcStress::buildPrimary(int frame)
+{
+    size_t numLayers = mLayerCount + (mVideoPlaying ? 1 : 0) + 1;
+    hwc_display_contents_1_t *contents = createContents(numLayers);
+    size_t index = 0;
+
+    if (mVideoPlaying) {
+        hwc_rect_t rect = { 0, 0, (int)mPrimaryWidth, (int)mPrimaryHeight };
+        setLayer(contents->hwLayers[index++], mVideo, frame, rect);
+    }
+
+    for (int i = 0; i < mLayerCount; i++) {
+        const StressSurface& surface = mSurfaces[i];
+        // windows move to another corner at every geometry change
+        int corner = (i + mGeneration) & 3;
+        int x = (corner & 1) ? mPrimaryWidth - surface.width : 0;
+        int y = (corner & 2) ? mPrimaryHeight - surface.height : 0;
+        hwc_rect_t rect = { x, y, x + (int)surface.width, y + (int)surface.height };
+        setLayer(contents->hwLayers[index++], surface, frame, rect);
+    }
+
+    hwc_rect_t full = { 0, 0, (int)mPrimaryWidth, (int)mPrimaryHeight };
+    setLayer(contents->hwLayers[index], mTargets[HWC_DISPLAY_PRIMARY], frame, full);
+    contents->hwLayers[index].compositionType = HWC_FRAMEBUFFER_TARGET;
+    return contents;
+}
+
+hwc_display_contents_1_t* HwcStress::buildExternal(int frame)
+{
+    drmModeModeInfo mode;
+    if (!mDrm->getModeInfo(IDisplayDevice::DEVICE_EXTERNAL, mode)) {
+        return NULL;
+    }
+
+    // the primary content is mirrored by its framebuffer target, with the
+    // video on top while it plays
+    size_t numLayers = (mVideoPlaying ? 1 : 0) + 1;
+    hwc_display_contents_1_t *contents = createContents(numLayers);
+    hwc_rect_t full = { 0, 0, mode.hdisplay, mode.vdisplay };
+    size_t index = 0;
+    if (mVideoPlaying) {
+        setLayer(contents->hwLayers[index++], mVideo, frame, full);
+    }
+    setLayer(contents->hwLayers[index], mTargets[HWC_DISPLAY_EXTERNAL], frame, full);
+    contents->hwLayers[index].compositionType = HWC_FRAMEBUFFER_TARGET;
+    return contents;
+}
+
+hwc_display_contents_1_t* HwcStress::buildVirtual(int frame)
+{
+    size_t numLayers = (mVideoPlaying ? 1 : 0) + 2;
+    hwc_display_contents_1_t *contents = createContents(numLayers);
+    hwc_rect_t full = { 0, 0, VIRTUAL_WIDTH, VIRTUAL_HEIGHT };
+    size_t index = 0;
+    if (mVideoPlaying) {
+        setLayer(contents->hwLayers[index++], mVideo, frame, full);
+    }
+    // the top window of the primary display, scaled down
+    setLayer(contents->hwLayers[index++], mSurfaces[mLayerCount - 1], frame, full);
+    setLayer(contents->hwLayers[index], mTargets[HWC_DISPLAY_VIRTUAL], frame, full);
+    contents->hwLayers[index].compositionType = HWC_FRAMEBUFFER_TARGET;
+    contents->outbuf = mOutput.buffers[frame % BUFFERS_PER_SURFACE];
+    return contents;
+}
+
+void HwcStress::toggleHotplug()
+{
+    mPlugged = !mPlugged;
+    mDrm->setOutput(IDisplayDevice::DEVICE_EXTERNAL, mPlugged ? mOptions.modes : NULL);
+
+    // uevents are dispatched on the event loop, so is the injected one
+    EventLoop *loop = Hwcomposer::getInstance().getEventLoop();
+    if (mHotplugTimer < 0) {
+        mHotplugTimer = loop->addTimer(0, 0, hotplugTimerExpired, this);
+    } else {
+        loop->setTimer(mHotplugTimer, 0, 0);
+    }
+    mHotplugStart = systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+void HwcStress::toggleVideo()
+{
+    mVideoPlaying = !mVideoPlaying;
+    Hwcomposer::getInstance().getDisplayAnalyzer()->postVideoEvent(0,
+        mVideoPlaying ? VIDEO_STATE_STARTED : VIDEO_STATE_STOPPED);
+}
+
+StressBucket* HwcStress::getBucket(int displays, int layers)
+{
+    int key = displays * 1000 + layers;
+    ssize_t index = mBuckets.indexOfKey(key);
+    if (index >= 0) {
+        return mBuckets.valueAt(index);
+    }
+    StressBucket *bucket = new StressBucket;
+    mBuckets.add(key, bucket);
+    return bucket;
+}
+
+bool HwcStress::run()
+{
+    int32_t hotplugs = android_atomic_acquire_load(&sHotplugs);
+    for (int frame = 0; frame < mOptions.frames; frame++) {
+        if (frame && mOptions.geometryPeriod && frame % mOptions.geometryPeriod == 0) {
+            mGeneration++;
+            mLayerCount = 1 + mGeneration % mOptions.layers;
+            mGeometryChanged = true;
+        }
+        if (frame && mOptions.hotplugPeriod && frame % mOptions.hotplugPeriod == 0 &&
+            (mOptions.displays & DISPLAY_MASK_EXTERNAL)) {
+            toggleHotplug();
+        }
+        if (frame && mOptions.videoPeriod && frame % mOptions.videoPeriod == 0) {
+            toggleVideo();
+            mGeometryChanged = true;
+        }
+
+        int32_t seen = android_atomic_acquire_load(&sHotplugs);
+        if (seen != hotplugs) {
+            hotplugs = seen;
+            if (mHotplugStart) {
+                mHotplugLatency.push_back(systemTime(SYSTEM_TIME_MONOTONIC) - mHotplugStart);
+                mHotplugStart = 0;
+            }
+            mGeometryChanged = true;
+        }
+
+        hwc_display_contents_1_t *displays[HWC_NUM_DISPLAY_TYPES];
+        memset(displays, 0, sizeof(displays));
+        if (mOptions.displays & DISPLAY_MASK_PRIMARY) {
+            displays[HWC_DISPLAY_PRIMARY] = buildPrimary(frame);
+        }
+        if ((mOptions.displays & DISPLAY_MASK_EXTERNAL) &&
+            android_atomic_acquire_load(&sExternalConnected)) {
+            displays[HWC_DISPLAY_EXTERNAL] = buildExternal(frame);
+        }
+        if (mOptions.displays & DISPLAY_MASK_VIRTUAL) {
+            displays[HWC_DISPLAY_VIRTUAL] = buildVirtual(frame);
+        }
+        mGeometryChanged = false;
+
+        int active = 0;
+        for (int i = 0; i < HWC_NUM_DISPLAY_TYPES; i++) {
+            if (displays[i]) {
+                active++;
+            }
+        }
+
+        if (mOptions.paced) {
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            MockDrm::sleepUntil(mDrm->getNextVBlank(IDisplayDevice::DEVICE_PRIMARY, now));
+        }
+
+        uint32_t maps = mDrm->getGttMapCount();
+        uint32_t unmaps = mDrm->getGttUnmapCount();
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        int err = mDevice->prepare(mDevice, HWC_NUM_DISPLAY_TYPES, displays);
+        nsecs_t prepared = systemTime(SYSTEM_TIME_MONOTONIC);
+        uint32_t fallbacks = 0;
+        uint32_t layers = 0;
+        for (int i = 0; !err && i < HWC_NUM_DISPLAY_TYPES; i++) {
+            hwc_display_contents_1_t *contents = displays[i];
+            for (size_t j = 0; contents && j < contents->numHwLayers; j++) {
+                int type = contents->hwLayers[j].compositionType;
+                if (type == HWC_FRAMEBUFFER_TARGET) {
+                    continue;
+                }
+                layers++;
+                if (type == HWC_FRAMEBUFFER) {
+                    fallbacks++;
+                }
+            }
+        }
+        if (!err) {
+            err = mDevice->set(mDevice, HWC_NUM_DISPLAY_TYPES, displays);
+        }
+        nsecs_t done = systemTime(SYSTEM_TIME_MONOTONIC);
+        maps = mDrm->getGttMapCount() - maps;
+        unmaps = mDrm->getGttUnmapCount() - unmaps;
+
+        bool videoExt = Hwcomposer::getInstance().getDisplayAnalyzer()->isVideoExtModeActive();
+        if (videoExt) {
+            mVideoExtFrames++;
+        }
+
+        for (int i = 0; i < HWC_NUM_DISPLAY_TYPES; i++) {
+            hwc_display_contents_1_t *contents = displays[i];
+            if (!contents) {
+                continue;
+            }
+            for (size_t j = 0; j < contents->numHwLayers; j++) {
+                if (contents->hwLayers[j].releaseFenceFd >= 0) {
+                    close(contents->hwLayers[j].releaseFenceFd);
+                }
+            }
+            if (contents->retireFenceFd >= 0) {
+                close(contents->retireFenceFd);
+            }
+            free(contents);
+        }
+
+        if (err) {
+            printf("frame %d: hwc returned %d\n", frame, err);
+            mFailures++;
+            continue;
+        }
+
+        StressBucket *bucket = getBucket(active, mLayerCount);
+        bucket->prepare.push_back(prepared - start);
+        bucket->set.push_back(done - prepared);
+        bucket->frames++;
+        bucket->layers += layers;
+        bucket->fallbacks += fallbacks;
+        if (fallbacks) {
+            bucket->fallbackFrames++;
+        }
+        bucket->maps += maps;
+        bucket->unmaps += unmaps;
+
+        if (mCsv) {
+            uint64_t bandwidth =
+                Hwcomposer::getInstance().getBandwidthEstimator()->getBandwidth();
+            fprintf(mCsv, "%d,%d,%d,%lld,%lld,%u,%u,%u,%d,%llu\n", frame, active,
+                    mLayerCount, ns2us(prepared - start), ns2us(done - prepared),
+                    fallbacks, maps, unmaps, videoExt,
+                    (unsigned long long)(bandwidth >> 20));
+        }
+    }
+    return mFailures == 0;
+}
+
+static int compareCost(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// p50, p99 and max in us
+static void getPercentiles(Vector<int64_t>& costs, int64_t *p50, int64_t *p99, int64_t *max)
+{
+    *p50 = *p99 = *max = 0;
+    size_t n = costs.size();
+    if (n == 0) {
+        return;
+    }
+    qsort(costs.editArray(), n, sizeof(int64_t), compareCost);
+    *p50 = ns2us(costs[n / 2]);
+    *p99 = ns2us(costs[(n * 99) / 100]);
+    *max = ns2us(costs[n - 1]);
+}
+
+void HwcStress::report()
+{
+    printf("%-8s %-6s %6s %22s %22s %9s %9s %9s\n", "displays", "layers",
+           "frames", "prepare p50/p99/max", "set p50/p99/max", "fallback",
+           "fb frames", "maps/f");
+    for (size_t i = 0; i < mBuckets.size(); i++) {
+        StressBucket *bucket = mBuckets.valueAt(i);
+        int key = mBuckets.keyAt(i);
+        int64_t p50, p99, max, s50, s99, smax;
+        getPercentiles(bucket->prepare, &p50, &p99, &max);
+        getPercentiles(bucket->set, &s50, &s99, &smax);
+        char prepare[32], set[32];
+        snprintf(prepare, sizeof(prepare), "%lld/%lld/%lld", p50, p99, max);
+        snprintf(set, sizeof(set), "%lld/%lld/%lld", s50, s99, smax);
+        printf("%-8d %-6d %6u %22s %22s %8.1f%% %8.1f%% %9.2f\n",
+               key / 1000, key % 1000, bucket->frames, prepare, set,
+               bucket->layers ? 100.0 * bucket->fallbacks / bucket->layers : 0.0,
+               100.0 * bucket->fallbackFrames / bucket->frames,
+               (double)bucket->maps / bucket->frames);
+    }
+
+    int64_t p50, p99, max;
+    getPercentiles(mHotplugLatency, &p50, &p99, &max);
+    printf("hotplug: %u events, to callback p50 %lld us, max %lld us\n",
+           mHotplugLatency.size(), p50, max);
+    printf("video extended mode active in %u frames\n", mVideoExtFrames);
+    printf("GTT mappings: %u made, %u released\n",
+           mDrm->getGttMapCount(), mDrm->getGttUnmapCount());
+    printf("%u frames failed\n", mFailures);
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-f frames] [-n layers] [-g period] [-h period] [-e period]\n"
+           "       [-m modes] [-d displays] [-u] [-c frames.csv]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    StressOptions options;
+    options.frames = 3000;
+    options.layers = 6;
+    options.geometryPeriod = 60;
+    options.hotplugPeriod = 300;
+    options.videoPeriod = 200;
+    options.displays = DISPLAY_MASK_PRIMARY | DISPLAY_MASK_EXTERNAL | DISPLAY_MASK_VIRTUAL;
+    options.paced = true;
+    options.modes = "1920x1080@60,1280x720@60";
+    options.csvPath = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:g:h:e:m:d:uc:")) != -1) {
+        switch (opt) {
+        case 'f':
+            options.frames = atoi(optarg);
+            break;
+        case 'n':
+            options.layers = atoi(optarg);
+            break;
+        case 'g':
+            options.geometryPeriod = atoi(optarg);
+            break;
+        case 'h':
+            options.hotplugPeriod = atoi(optarg);
+            break;
+        case 'e':
+            options.videoPeriod = atoi(optarg);
+            break;
+        case 'm':
+            options.modes = optarg;
+            break;
+        case 'd':
+            options.displays = strtol(optarg, NULL, 0);
+            break;
+        case 'u':
+            options.paced = false;
+            break;
+        case 'c':
+            options.csvPath = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.frames < 1 || options.layers < 1 || options.layers > MAX_LAYERS ||
+        !(options.displays & DISPLAY_MASK_PRIMARY)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    HwcStress stress(options);
+    if (!stress.open() || !stress.allocate()) {
+        return 1;
+    }
+    bool ok = stress.run();
+    stress.report();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,406 @@
+/*
+// Copyright (c) 2014 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Times the mapping paths of the BufferManager with the gralloc mappers of
+// the Tangier and the Penwell IPs on the mock platform. Both map through
+// the mock gralloc module and the simulated GTT of MockDrm, so the numbers
+// compare the mapper code and the pool paths it goes through, not the
+// hardware.
+//
+//   mapper_bench [-n iterations] [-b buffers] [-c results.csv]
+//
+// Each workload runs n times per mapper with 1080p RGBA buffers:
+//   cold     a buffer not mapped before is mapped and unmapped
+//   remap    a swap chain of -b buffers (3 by default) is flipped in turn,
+//            every map is served by the pool or a deferred unmap
+//   upgrade  a layer maps a new buffer for CPU access, then a plane maps
+//            it for scanout
+//   premap   a frame of -b buffers is premapped, then flipped
+// map_ns and unmap_ns are per call, maps and unmaps the GTT ioctls per
+// iteration.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <hal_public.h>
+#include <Hwcomposer.h>
+#include <BufferManager.h>
+#include <MockBufferManager.h>
+#include <MockDrm.h>
+
+using namespace android;
+using namespace android::intel;
+
+// defined by HwcModule.cpp of the mock platform
+extern hwc_module_t HAL_MODULE_INFO_SYM;
+
+enum {
+    WORKLOAD_COLD = 0,
+    WORKLOAD_REMAP,
+    WORKLOAD_UPGRADE,
+    WORKLOAD_PREMAP,
+    WORKLOAD_COUNT,
+};
+
+static const char *sWorkloadNames[WORKLOAD_COUNT] = {
+    "cold", "remap", "upgrade", "premap",
+};
+
+struct BenchMapperType {
+    const char *name;
+    int type;
+};
+
+static const BenchMapperType sMappers[] = {
+    { "tng", MockBufferManager::MAPPER_TANGIER },
+    { "pnw", MockBufferManager::MAPPER_PENWELL },
+};
+
+struct BenchResult {
+    nsecs_t mapTime;
+    nsecs_t unmapTime;
+    uint32_t mapCalls;
+    uint32_t unmapCalls;
+    uint32_t gttMaps;
+    uint32_t gttUnmaps;
+};
+
+class MapperBench {
+public:
+    MapperBench(int iterations, int buffers);
+    ~MapperBench();
+
+    bool open();
+    bool run(int workload, BenchResult& result);
+
+private:
+    buffer_handle_t allocate();
+    BufferMapper* map(buffer_handle_t handle, int owner, BenchResult& result);
+    void unmap(BufferMapper *mapper, int owner, BenchResult& result);
+
+    bool runCold(BenchResult& result);
+    bool runRemap(BenchResult& result);
+    bool runUpgrade(BenchResult& result);
+    bool runPremap(BenchResult& result);
+
+private:
+    enum {
+        BUFFER_WIDTH = 1920,
+        BUFFER_HEIGHT = 1080,
+        BUFFERS_MAX = 16,
+    };
+
+    int mIterations;
+    int mBuffers;
+    hwc_composer_device_1_t *mDevice;
+    BufferManager *mBufferManager;
+    MockDrm *mDrm;
+    // freed at exit, deferred unmaps may still be pending on them
+    Vector<buffer_handle_t> mHandles;
+};
+
+MapperBench::MapperBench(int iterations, int buffers)
+    : mIterations(iterations),
+      mBuffers(buffers),
+      mDevice(NULL),
+      mBufferManager(NULL),
+      mDrm(NULL)
+{
+}
+
+MapperBench::~MapperBench()
+{
+    if (mDevice) {
+        hwc_close_1(mDevice);
+    }
+    for (size_t i = 0; i < mHandles.size(); i++) {
+        MockBuffer::free(mHandles.itemAt(i));
+    }
+}
+
+bool MapperBench::open()
+{
+    int err = hwc_open_1(&HAL_MODULE_INFO_SYM.common, &mDevice);
+    if (err) {
+        printf("failed to open hwcomposer: %d\n", err);
+        mDevice = NULL;
+        return false;
+    }
+
+    // the mock platform is linked in
+    mBufferManager = Hwcomposer::getInstance().getBufferManager();
+    mDrm = static_cast<MockDrm *>(Hwcomposer::getInstance().getDrm());
+    return mBufferManager && mDrm;
+}
+
+buffer_handle_t MapperBench::allocate()
+{
+    buffer_handle_t handle = MockBuffer::allocate(BUFFER_WIDTH, BUFFER_HEIGHT,
+        HAL_PIXEL_FORMAT_RGBA_8888,
+        GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE);
+    if (handle) {
+        mHandles.push_back(handle);
+    }
+    return handle;
+}
+
+BufferMapper* MapperBench::map(buffer_handle_t handle, int owner,
+                               BenchResult& result)
+{
+    DataBufferLocker locker(mBufferManager, handle);
+    if (!locker.get()) {
+        printf("failed to get data buffer\n");
+        return NULL;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    BufferMapper *mapper = mBufferManager->map(*locker.get(), owner);
+    result.mapTime += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    result.mapCalls++;
+    if (!mapper) {
+        printf("failed to map buffer\n");
+    }
+    return mapper;
+}
+
+void MapperBench::unmap(BufferMapper *mapper, int owner, BenchResult& result)
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    mBufferManager->unmap(mapper, owner);
+    result.unmapTime += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    result.unmapCalls++;
+}
+
+bool MapperBench::runCold(BenchResult& result)
+{
+    for (int i = 0; i < mIterations; i++) {
+        buffer_handle_t handle = allocate();
+        BufferMapper *mapper = handle ?
+            map(handle, BufferManager::MAPPING_OWNER_PLANE, result) : NULL;
+        if (!mapper) {
+            return false;
+        }
+        unmap(mapper, BufferManager::MAPPING_OWNER_PLANE, result);
+    }
+    return true;
+}
+
+bool MapperBench::runRemap(BenchResult& result)
+{
+    buffer_handle_t chain[BUFFERS_MAX];
+    for (int i = 0; i < mBuffers; i++) {
+        chain[i] = allocate();
+        if (!chain[i]) {
+            return false;
+        }
+    }
+
+    // the plane holds the buffer on screen until the next one is flipped
+    BufferMapper *shown = NULL;
+    for (int i = 0; i < mIterations; i++) {
+        BufferMapper *mapper = map(chain[i % mBuffers],
+                                   BufferManager::MAPPING_OWNER_PLANE, result);
+        if (!mapper) {
+            break;
+        }
+        if (shown) {
+            unmap(shown, BufferManager::MAPPING_OWNER_PLANE, result);
+        }
+        shown = mapper;
+    }
+    if (shown) {
+        unmap(shown, BufferManager::MAPPING_OWNER_PLANE, result);
+    }
+    return result.mapCalls == (uint32_t)mIterations;
+}
+
+bool MapperBench::runUpgrade(BenchResult& result)
+{
+    for (int i = 0; i < mIterations; i++) {
+        buffer_handle_t handle = allocate();
+        BufferMapper *layer = handle ?
+            map(handle, BufferManager::MAPPING_OWNER_LAYER, result) : NULL;
+        if (!layer) {
+            return false;
+        }
+        BufferMapper *plane = map(handle, BufferManager::MAPPING_OWNER_PLANE, result);
+        unmap(layer, BufferManager::MAPPING_OWNER_LAYER, result);
+        if (!plane) {
+            return false;
+        }
+        unmap(plane, BufferManager::MAPPING_OWNER_PLANE, result);
+    }
+    return true;
+}
+
+bool MapperBench::runPremap(BenchResult& result)
+{
+    for (int i = 0; i < mIterations; i++) {
+        buffer_handle_t frame[BUFFERS_MAX];
+        for (int j = 0; j < mBuffers; j++) {
+            frame[j] = allocate();
+            if (!frame[j]) {
+                return false;
+            }
+        }
+
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        mBufferManager->premap(frame, mBuffers);
+        result.mapTime += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+        BufferMapper *mappers[BUFFERS_MAX];
+        bool ok = true;
+        for (int j = 0; j < mBuffers; j++) {
+            mappers[j] = map(frame[j], BufferManager::MAPPING_OWNER_PLANE, result);
+            ok = ok && mappers[j];
+        }
+        mBufferManager->releasePremapped();
+        for (int j = 0; j < mBuffers; j++) {
+            if (mappers[j]) {
+                unmap(mappers[j], BufferManager::MAPPING_OWNER_PLANE, result);
+            }
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MapperBench::run(int workload, BenchResult& result)
+{
+    memset(&result, 0, sizeof(result));
+    uint32_t maps = mDrm->getGttMapCount();
+    uint32_t unmaps = mDrm->getGttUnmapCount();
+
+    bool ok;
+    switch (workload) {
+    case WORKLOAD_COLD:
+        ok = runCold(result);
+        break;
+    case WORKLOAD_REMAP:
+        ok = runRemap(result);
+        break;
+    case WORKLOAD_UPGRADE:
+        ok = runUpgrade(result);
+        break;
+    case WORKLOAD_PREMAP:
+        ok = runPremap(result);
+        break;
+    default:
+        ok = false;
+        break;
+    }
+
+    result.gttMaps = mDrm->getGttMapCount() - maps;
+    result.gttUnmaps = mDrm->getGttUnmapCount() - unmaps;
+    return ok;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-n iterations] [-b buffers] [-c results.csv]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 200;
+    int buffers = 3;
+    const char *csvPath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:c:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'b':
+            buffers = atoi(optarg);
+            break;
+        case 'c':
+            csvPath = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1 || buffers < 1 || buffers > 16) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *csv = NULL;
+    if (csvPath) {
+        csv = fopen(csvPath, "w");
+        if (!csv) {
+            printf("failed to open %s\n", csvPath);
+            return 1;
+        }
+        fprintf(csv, "mapper,workload,map_ns,unmap_ns,maps,unmaps\n");
+    }
+
+    MapperBench bench(iterations, buffers);
+    if (!bench.open()) {
+        if (csv) {
+            fclose(csv);
+        }
+        return 1;
+    }
+
+    MockBufferManager *bm = static_cast<MockBufferManager *>(
+        Hwcomposer::getInstance().getBufferManager());
+
+    printf("%-4s %-8s %10s %10s %8s %8s\n", "", "workload", "map_ns",
+           "unmap_ns", "maps", "unmaps");
+    int status = 0;
+    for (size_t m = 0; m < sizeof(sMappers) / sizeof(sMappers[0]); m++) {
+        // new buffers for every workload, no mapper of another class is
+        // found in the pool
+        bm->setMapperType(sMappers[m].type);
+        for (int w = 0; w < WORKLOAD_COUNT; w++) {
+            BenchResult result;
+            if (!bench.run(w, result)) {
+                printf("%-4s %-8s failed\n", sMappers[m].name, sWorkloadNames[w]);
+                status = 1;
+                continue;
+            }
+            nsecs_t mapNs = result.mapCalls ? result.mapTime / result.mapCalls : 0;
+            nsecs_t unmapNs = result.unmapCalls ? result.unmapTime / result.unmapCalls : 0;
+            double maps = (double)result.gttMaps / iterations;
+            double unmaps = (double)result.gttUnmaps / iterations;
+            printf("%-4s %-8s %10lld %10lld %8.2f %8.2f\n", sMappers[m].name,
+                   sWorkloadNames[w], (long long)mapNs, (long long)unmapNs,
+                   maps, unmaps);
+            if (csv) {
+                fprintf(csv, "%s,%s,%lld,%lld,%.2f,%.2f\n", sMappers[m].name,
+                        sWorkloadNames[w], (long long)mapNs,
+                        (long long)unmapNs, maps, unmaps);
+            }
+        }
+    }
+    bm->setMapperType(MockBufferManager::MAPPER_MOCK);
+
+    if (csv) {
+        fclose(csv);
+    }
+    return status;
+}
@@ -0,0 +1,199 @@
+# Copyright (C) 2008 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+include $(LOCAL_PATH)/../../common/engine.mk
+
+# The Tangier HWC on the mock platform: the kernel driver, the IMG display
+# device and the gralloc allocator are simulated (see MockPlatFactory.h) so
+# that the composition logic can be benchmarked on targets without the
+# display hardware, e.g. the x86 emulator. Linked whole into the tools
+# below, they open the HWC through HAL_MODULE_INFO_SYM.
+MOCK_SRC_FILES := $(addprefix ../../, $(HWC_ENGINE_SRC_FILES))
+
+# the Penwell mapper, selected with hwc.mock.mapper
+MOCK_SRC_FILES += \
+    ../../ips/penwell/PnwGrallocBufferMapper.cpp
+
+MOCK_SRC_FILES += \
+    MockDrm.cpp \
+    MockBufferManager.cpp \
+    MockDisplayContext.cpp \
+    MockHdcpControl.cpp \
+    MockPlatFactory.cpp
+
+MOCK_C_INCLUDES := $(HWC_ENGINE_C_INCLUDES) \
+    $(LOCAL_PATH)
+
+# the display planes of each platform
+MOCK_TANGIER_SRC_FILES := \
+    ../../ips/common/PlaneCapabilities.cpp \
+    ../../ips/tangier/TngOverlayPlane.cpp \
+    ../../ips/tangier/TngPrimaryPlane.cpp \
+    ../../ips/tangier/TngSpritePlane.cpp \
+    ../../ips/tangier/TngPlaneManager.cpp \
+    ../../ips/tangier/TngCursorPlane.cpp
+
+MOCK_ANNIEDALE_SRC_FILES := \
+    ../../ips/anniedale/AnnPlaneManager.cpp \
+    ../../ips/anniedale/AnnOverlayPlane.cpp \
+    ../../ips/anniedale/AnnRGBPlane.cpp \
+    ../../ips/anniedale/AnnCursorPlane.cpp \
+    ../../ips/anniedale/PlaneCapabilities.cpp
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(MOCK_SRC_FILES) $(MOCK_TANGIER_SRC_FILES)
+LOCAL_C_INCLUDES := $(MOCK_C_INCLUDES)
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_C_INCLUDES)
+
+LOCAL_MODULE_TAGS := tests
+LOCAL_MODULE := libhwcmock
+LOCAL_CFLAGS += -DLINUX
+
+include $(BUILD_STATIC_LIBRARY)
+
+# the same with the Anniedale planes of Moorefield
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := $(MOCK_SRC_FILES) $(MOCK_ANNIEDALE_SRC_FILES)
+LOCAL_C_INCLUDES := $(MOCK_C_INCLUDES)
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_C_INCLUDES)
+
+LOCAL_MODULE_TAGS := tests
+LOCAL_MODULE := libhwcmock_ann
+LOCAL_CFLAGS += -DLINUX -DHWC_MOCK_ANNIEDALE
+
+include $(BUILD_STATIC_LIBRARY)
+
+# hwc_replay against the mock platform
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := hwc_replay_mock
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../hwc_replay.cpp \
+
+LOCAL_CFLAGS += -DLINUX -DHWC_REPLAY_MOCK
+
+LOCAL_WHOLE_STATIC_LIBRARIES := libhwcmock
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libdrm \
+                          libwsbm libutils libhardware \
+                          libva libva-tpi libva-android libsync libz
+
+include $(BUILD_EXECUTABLE)
+
+# overlay register setup microbenchmark
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := overlay_setup_bench
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../overlay_setup_bench.cpp \
+    ../../ips/anniedale/AnnOverlayPlane.cpp \
+
+LOCAL_CFLAGS += -DLINUX
+
+LOCAL_STATIC_LIBRARIES := libhwcmock
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libdrm \
+                          libwsbm libutils libhardware \
+                          libva libva-tpi libva-android libsync libz
+
+include $(BUILD_EXECUTABLE)
+
+# mapping paths of the Tangier and the Penwell buffer mappers
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := mapper_bench
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../mapper_bench.cpp \
+
+LOCAL_CFLAGS += -DLINUX
+
+LOCAL_WHOLE_STATIC_LIBRARIES := libhwcmock
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libdrm \
+                          libwsbm libutils libhardware \
+                          libva libva-tpi libva-android libsync libz
+
+include $(BUILD_EXECUTABLE)
+
+# primary, HDMI and WiDi stress test
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := hwc_stress
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../hwc_stress.cpp \
+
+LOCAL_CFLAGS += -DLINUX
+
+LOCAL_WHOLE_STATIC_LIBRARIES := libhwcmock
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libdrm \
+                          libwsbm libutils libhardware \
+                          libva libva-tpi libva-android libsync libz
+
+include $(BUILD_EXECUTABLE)
+
+# plane assignment fuzzer, on the planes of either platform
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := plane_fuzzer
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../plane_fuzzer.cpp \
+
+LOCAL_CFLAGS += -DLINUX
+
+LOCAL_WHOLE_STATIC_LIBRARIES := libhwcmock
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libdrm \
+                          libwsbm libutils libhardware \
+                          libva libva-tpi libva-android libsync libz
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := plane_fuzzer_ann
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+    ../plane_fuzzer.cpp \
+
+LOCAL_CFLAGS += -DLINUX
+
+LOCAL_WHOLE_STATIC_LIBRARIES := libhwcmock_ann
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libdrm \
+                          libwsbm libutils libhardware \
+                          libva libva-tpi libva-android libsync libz
+
+include $(BUILD_EXECUTABLE)
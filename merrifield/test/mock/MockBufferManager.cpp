@@ -0,0 +1,411 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+#include <cutils/native_handle.h>
+#include <cutils/properties.h>
+#include <libsync/sw_sync.h>
+#include <sync/sync.h>
+#include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <hal_public.h>
+#include <tangier/TngGrallocBuffer.h>
+#include <tangier/TngGrallocBufferMapper.h>
+#include <penwell/PnwGrallocBufferMapper.h>
+#include <MockBufferManager.h>
+
+namespace android {
+namespace intel {
+
+// tells the handles of the mock allocator apart in the stamps
+static const uint64_t MOCK_STAMP_TAG = 0x4d4f434b00000000ULL;
+static volatile int32_t gMockStamp = 0;
+
+// CPU mappings of the mock gralloc module by buffer stamp, the mappers
+// pass clones of the handles SurfaceFlinger sees
+struct MockCpuMapping {
+    void *vaddr;
+    uint32_t size;
+    int refs;
+};
+
+static Mutex gCpuMappingLock;
+static KeyedVector<uint64_t, MockCpuMapping> gCpuMappings;
+static gralloc_module_t gMockGralloc;
+
+uint32_t MockBuffer::getBpp(uint32_t format)
+{
+    switch (format) {
+    case HAL_PIXEL_FORMAT_RGB_565:
+    case HAL_PIXEL_FORMAT_YUY2:
+    case HAL_PIXEL_FORMAT_UYVY:
+        return 16;
+    case HAL_PIXEL_FORMAT_YV12:
+    case HAL_PIXEL_FORMAT_I420:
+    case HAL_PIXEL_FORMAT_NV12:
+    case HAL_PIXEL_FORMAT_NV12_VED:
+    case HAL_PIXEL_FORMAT_NV12_VEDT:
+        return 12;
+    default:
+        return 32;
+    }
+}
+
+buffer_handle_t MockBuffer::allocate(uint32_t width, uint32_t height,
+                                     uint32_t format, uint32_t usage)
+{
+    if (!width || !height) {
+        ETRACE("invalid input parameter");
+        return 0;
+    }
+
+    // no fds to pass on, the fd slots are counted as ints
+    native_handle_t *base = native_handle_create(0,
+        IMG_NATIVE_HANDLE_NUMFDS + IMG_NATIVE_HANDLE_NUMINTS);
+    if (!base) {
+        ETRACE("failed to create native handle");
+        return 0;
+    }
+
+    IMG_native_handle_t *handle = (IMG_native_handle_t *)base;
+    for (int i = 0; i < IMG_NATIVE_HANDLE_NUMFDS; i++) {
+        handle->fd[i] = -1;
+    }
+    handle->ui64Stamp = MOCK_STAMP_TAG |
+        (uint32_t)android_atomic_inc(&gMockStamp);
+    handle->usage = usage;
+    handle->iWidth = width;
+    handle->iHeight = height;
+    handle->iFormat = format;
+    handle->uiBpp = getBpp(format);
+    handle->iPlanes = 1;
+    handle->aiStride[0] = align_to(width, 32);
+    handle->aiVStride[0] = align_to(height, 32);
+    handle->iNumSubAllocs = 1;
+    return (buffer_handle_t)handle;
+}
+
+void MockBuffer::free(buffer_handle_t handle)
+{
+    if (handle) {
+        native_handle_delete((native_handle_t *)handle);
+    }
+}
+
+uint32_t MockBuffer::getSize(buffer_handle_t handle)
+{
+    const IMG_native_handle_t *img = (const IMG_native_handle_t *)handle;
+    if (!img) {
+        return 0;
+    }
+
+    // planar formats get two bytes per pixel, enough for their chroma
+    uint32_t bpp = img->uiBpp > 16 ? img->uiBpp : 16;
+    uint32_t stride = align_to(align_to(img->iWidth, 32) * bpp / 8, 64);
+    return align_to(stride * align_to(img->iHeight, 32), 4096);
+}
+
+int MockBuffer::perform(gralloc_module_t const *module, int operation, ...)
+{
+    va_list args;
+    va_start(args, operation);
+    const IMG_native_handle_t *img =
+        (const IMG_native_handle_t *)va_arg(args, buffer_handle_t);
+    int err = 0;
+
+    Mutex::Autolock _l(gCpuMappingLock);
+    switch (operation) {
+    case GRALLOC_MODULE_GET_BUFFER_CPU_ADDRESSES_IMG: {
+        void **vaddr = va_arg(args, void **);
+        uint32_t *size = va_arg(args, uint32_t *);
+        if (!img || !vaddr || !size) {
+            err = -EINVAL;
+            break;
+        }
+        ssize_t index = gCpuMappings.indexOfKey(img->ui64Stamp);
+        if (index < 0) {
+            MockCpuMapping mapping;
+            mapping.size = getSize((buffer_handle_t)img);
+            mapping.vaddr = mmap(NULL, mapping.size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            mapping.refs = 0;
+            if (mapping.vaddr == MAP_FAILED) {
+                ETRACE("failed to allocate %u bytes", mapping.size);
+                err = -ENOMEM;
+                break;
+            }
+            index = gCpuMappings.add(img->ui64Stamp, mapping);
+        }
+        MockCpuMapping& mapping = gCpuMappings.editValueAt(index);
+        mapping.refs++;
+        memset(vaddr, 0, sizeof(void *) * SUB_BUFFER_MAX);
+        memset(size, 0, sizeof(uint32_t) * SUB_BUFFER_MAX);
+        vaddr[0] = mapping.vaddr;
+        size[0] = mapping.size;
+        break;
+    }
+    case GRALLOC_MODULE_PUT_BUFFER_CPU_ADDRESSES_IMG: {
+        ssize_t index = img ? gCpuMappings.indexOfKey(img->ui64Stamp) : -1;
+        if (index < 0) {
+            err = -EINVAL;
+            break;
+        }
+        MockCpuMapping& mapping = gCpuMappings.editValueAt(index);
+        if (--mapping.refs == 0) {
+            munmap(mapping.vaddr, mapping.size);
+            gCpuMappings.removeItemsAt(index);
+        }
+        break;
+    }
+    default:
+        err = -EINVAL;
+        break;
+    }
+
+    va_end(args);
+    return err;
+}
+
+gralloc_module_t const& MockBuffer::getGrallocModule()
+{
+    gMockGralloc.perform = perform;
+    return gMockGralloc;
+}
+
+MockBufferMapper::MockBufferMapper(DataBuffer& buffer)
+    : GrallocBufferMapperBase(buffer)
+{
+    CTRACE();
+}
+
+MockBufferMapper::~MockBufferMapper()
+{
+    CTRACE();
+}
+
+bool MockBufferMapper::map()
+{
+    CTRACE();
+
+    uint32_t size = MockBuffer::getSize(mHandle);
+    if (!size) {
+        ETRACE("invalid buffer %p", mHandle);
+        return false;
+    }
+
+    void *vaddr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (vaddr == MAP_FAILED) {
+        ETRACE("failed to allocate %u bytes", size);
+        return false;
+    }
+
+    struct psb_gtt_mapping_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.type = PSB_GTT_MAP_TYPE_VIRTUAL;
+    arg.vaddr = (unsigned long)vaddr;
+    arg.size = size;
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    if (!drm->writeReadIoctl(DRM_PSB_GTT_MAP, &arg, sizeof(arg))) {
+        ETRACE("gtt mapping failed");
+        munmap(vaddr, size);
+        return false;
+    }
+
+    mCpuAddress[0] = vaddr;
+    mSize[0] = size;
+    mGttOffsetInPage[0] = arg.offset_pages;
+    return true;
+}
+
+bool MockBufferMapper::unmap()
+{
+    CTRACE();
+
+    if (!mCpuAddress[0]) {
+        return true;
+    }
+
+    struct psb_gtt_mapping_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.type = PSB_GTT_MAP_TYPE_VIRTUAL;
+    arg.vaddr = (unsigned long)mCpuAddress[0];
+
+    Drm *drm = Hwcomposer::getInstance().getDrm();
+    bool ret = drm->writeIoctl(DRM_PSB_GTT_UNMAP, &arg, sizeof(arg));
+    munmap(mCpuAddress[0], mSize[0]);
+
+    mCpuAddress[0] = 0;
+    mSize[0] = 0;
+    mGttOffsetInPage[0] = 0;
+    return ret;
+}
+
+buffer_handle_t MockBufferMapper::getKHandle(int subIndex)
+{
+    // the stamp stands in for the kernel buffer
+    if (subIndex == 0) {
+        return (buffer_handle_t)(unsigned long)mKey;
+    }
+    return 0;
+}
+
+buffer_handle_t MockBufferMapper::getFbHandle(int subIndex)
+{
+    return (buffer_handle_t)getCpuAddress(subIndex);
+}
+
+void MockBufferMapper::putFbHandle()
+{
+}
+
+MockBufferManager::MockBufferManager()
+    : BufferManager(),
+      mBlitCostPerMB(0),
+      mMapperType(MAPPER_MOCK),
+      mBlitTimeline(-1),
+      mBlitPoint(0)
+{
+}
+
+MockBufferManager::~MockBufferManager()
+{
+}
+
+bool MockBufferManager::initialize()
+{
+    char prop[PROPERTY_VALUE_MAX];
+    mBlitCostPerMB = 1000;
+    if (property_get("hwc.mock.blit_us_per_mb", prop, NULL) > 0) {
+        mBlitCostPerMB = atoi(prop);
+    }
+    if (property_get("hwc.mock.mapper", prop, NULL) > 0) {
+        if (!strcmp(prop, "tng")) {
+            setMapperType(MAPPER_TANGIER);
+        } else if (!strcmp(prop, "pnw")) {
+            setMapperType(MAPPER_PENWELL);
+        }
+    }
+
+    mBlitTimeline = sw_sync_timeline_create();
+    mBlitPoint = 0;
+    if (mBlitTimeline < 0) {
+        ETRACE("failed to create blit timeline");
+        return false;
+    }
+    return BufferManager::initialize();
+}
+
+void MockBufferManager::deinitialize()
+{
+    BufferManager::deinitialize();
+    if (mBlitTimeline >= 0) {
+        close(mBlitTimeline);
+        mBlitTimeline = -1;
+    }
+}
+
+buffer_handle_t MockBufferManager::allocFrameBuffer(int width, int height, int *stride)
+{
+    if (!stride) {
+        ETRACE("invalid input parameter");
+        return 0;
+    }
+
+    buffer_handle_t handle = MockBuffer::allocate(width, height,
+        HAL_PIXEL_FORMAT_BGRX_8888, GRALLOC_USAGE_HW_FB);
+    if (handle) {
+        *stride = align_to(width, 32);
+    }
+    return handle;
+}
+
+void MockBufferManager::freeFrameBuffer(buffer_handle_t fbHandle)
+{
+    invalidateBufferAttributes(fbHandle);
+    MockBuffer::free(fbHandle);
+}
+
+buffer_handle_t MockBufferManager::allocGrallocBuffer(uint32_t width, uint32_t height,
+                                                      uint32_t format, uint32_t usage)
+{
+    return MockBuffer::allocate(width, height, format, usage);
+}
+
+void MockBufferManager::freeGrallocBuffer(buffer_handle_t handle)
+{
+    invalidateBufferAttributes(handle);
+    MockBuffer::free(handle);
+}
+
+DataBuffer* MockBufferManager::createDataBuffer(buffer_handle_t handle)
+{
+    return new TngGrallocBuffer(handle);
+}
+
+void MockBufferManager::setMapperType(int type)
+{
+    android_atomic_release_store(type, &mMapperType);
+}
+
+BufferMapper* MockBufferManager::createBufferMapper(DataBuffer& buffer)
+{
+    switch (android_atomic_acquire_load(&mMapperType)) {
+    case MAPPER_TANGIER:
+        return new TngGrallocBufferMapper(MockBuffer::getGrallocModule(), buffer);
+    case MAPPER_PENWELL:
+        return new PnwGrallocBufferMapper(MockBuffer::getGrallocModule(), buffer);
+    default:
+        return new MockBufferMapper(buffer);
+    }
+}
+
+int MockBufferManager::blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                                 const crop_t& destRect, bool filter, int acquireFenceFd)
+{
+    if (!srcHandle || !destHandle) {
+        ETRACE("invalid blit buffers");
+        return -1;
+    }
+
+    if (acquireFenceFd >= 0 && sync_wait(acquireFenceFd, BLIT_FENCE_TIMEOUT_MS)) {
+        ETRACE("source of blit is not ready");
+        return -1;
+    }
+
+    // the cost follows the pixels written
+    uint64_t bytes = (uint64_t)destRect.w * destRect.h * 4;
+    uint64_t cost = bytes * mBlitCostPerMB / (1 << 20);
+    if (cost) {
+        usleep(cost);
+    }
+
+    Mutex::Autolock _l(mBlitLock);
+    int fenceFd = sw_sync_fence_create(mBlitTimeline, "mock_blit", ++mBlitPoint);
+    sw_sync_timeline_inc(mBlitTimeline, 1);
+    return fenceFd;
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,109 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef MOCK_BUFFER_MANAGER_H
+#define MOCK_BUFFER_MANAGER_H
+
+#include <BufferManager.h>
+#include <common/GrallocBufferMapperBase.h>
+
+namespace android {
+namespace intel {
+
+// gralloc handles laid out like those of the IMG allocator, so that the
+// Tangier buffer classes decode them. They have no memory until mapped.
+class MockBuffer {
+public:
+    static buffer_handle_t allocate(uint32_t width, uint32_t height,
+                                    uint32_t format, uint32_t usage);
+    static void free(buffer_handle_t handle);
+    // bytes the buffer takes in display memory
+    static uint32_t getSize(buffer_handle_t handle);
+    // an IMG gralloc module whose perform() hands out the CPU addresses
+    // of mock buffers, for the mappers of the IPs
+    static gralloc_module_t const& getGrallocModule();
+
+private:
+    static uint32_t getBpp(uint32_t format);
+    static int perform(gralloc_module_t const *module, int operation, ...);
+};
+
+// maps a mock buffer into the simulated GTT, the pages of the CPU mapping
+// are only backed once they are touched
+class MockBufferMapper : public GrallocBufferMapperBase {
+public:
+    MockBufferMapper(DataBuffer& buffer);
+    virtual ~MockBufferMapper();
+public:
+    bool map();
+    bool unmap();
+    buffer_handle_t getKHandle(int subIndex);
+    buffer_handle_t getFbHandle(int subIndex);
+    void putFbHandle();
+};
+
+// buffer manager of the mock platform, a blit costs hwc.mock.blit_us_per_mb
+// (1000us per MB of destination if not set)
+class MockBufferManager : public BufferManager {
+public:
+    // mapper classes createBufferMapper() can hand out
+    enum {
+        MAPPER_MOCK = 0,
+        MAPPER_TANGIER,
+        MAPPER_PENWELL,
+    };
+
+public:
+    MockBufferManager();
+    virtual ~MockBufferManager();
+
+public:
+    bool initialize();
+    void deinitialize();
+
+    // class of the mappers created from now on, MAPPER_MOCK by default or
+    // as set by hwc.mock.mapper ("tng" or "pnw")
+    void setMapperType(int type);
+
+    buffer_handle_t allocFrameBuffer(int width, int height, int *stride);
+    void freeFrameBuffer(buffer_handle_t fbHandle);
+    buffer_handle_t allocGrallocBuffer(uint32_t width, uint32_t height,
+                                       uint32_t format, uint32_t usage);
+    void freeGrallocBuffer(buffer_handle_t handle);
+
+protected:
+    DataBuffer* createDataBuffer(buffer_handle_t handle);
+    BufferMapper* createBufferMapper(DataBuffer& buffer);
+    int blitAsync(buffer_handle_t srcHandle, buffer_handle_t destHandle,
+                  const crop_t& destRect, bool filter, int acquireFenceFd);
+
+private:
+    enum {
+        // a blit waits this long for the acquire fence of its source
+        BLIT_FENCE_TIMEOUT_MS = 500,
+    };
+
+    uint32_t mBlitCostPerMB;
+    volatile int32_t mMapperType;
+    // blits finish before blitAsync() returns, their fences are signalled
+    int mBlitTimeline;
+    uint32_t mBlitPoint;
+    Mutex mBlitLock;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* MOCK_BUFFER_MANAGER_H */
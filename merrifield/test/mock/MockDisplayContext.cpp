@@ -0,0 +1,159 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <cutils/properties.h>
+#include <libsync/sw_sync.h>
+#include <HwcTrace.h>
+#include <Hwcomposer.h>
+#include <IDisplayDevice.h>
+#include <MockDrm.h>
+#include <MockDisplayContext.h>
+
+namespace android {
+namespace intel {
+
+MockDisplayContext::MockDisplayContext()
+    : TngDisplayContext(),
+      mPostCost(0),
+      mTimeline(-1),
+      mPostPoint(0),
+      mSignaledPoint(0),
+      mLastPostTime(0),
+      mPosts(0),
+      mExitThread(false)
+{
+    mDevice.base.post = post;
+    mDevice.context = this;
+}
+
+MockDisplayContext::~MockDisplayContext()
+{
+}
+
+IMG_display_device_public_t* MockDisplayContext::openDisplayDevice()
+{
+    char prop[PROPERTY_VALUE_MAX];
+    mPostCost = 300;
+    if (property_get("hwc.mock.post_us", prop, NULL) > 0) {
+        mPostCost = atoi(prop);
+    }
+
+    mTimeline = sw_sync_timeline_create();
+    if (mTimeline < 0) {
+        ETRACE("failed to create post timeline");
+        return NULL;
+    }
+
+    mPostPoint = 0;
+    mSignaledPoint = 0;
+    mPosts = 0;
+    mExitThread = false;
+    mThread = new VBlankThread(this);
+    if (!mThread.get()) {
+        ETRACE("failed to create vblank thread");
+        close(mTimeline);
+        mTimeline = -1;
+        return NULL;
+    }
+    mThread->run("MockVBlank", PRIORITY_URGENT_DISPLAY);
+    return &mDevice.base;
+}
+
+void MockDisplayContext::stopThread()
+{
+    if (!mThread.get()) {
+        return;
+    }
+
+    {
+        Mutex::Autolock _l(mLock);
+        mExitThread = true;
+        mCondition.signal();
+    }
+    mThread->requestExitAndWait();
+    mThread = NULL;
+}
+
+void MockDisplayContext::deinitialize()
+{
+    stopThread();
+    TngDisplayContext::deinitialize();
+    if (mTimeline >= 0) {
+        // fences still pending signal as the timeline goes away
+        close(mTimeline);
+        mTimeline = -1;
+    }
+}
+
+int MockDisplayContext::post(IMG_display_device_public_t *dev,
+                             IMG_hwc_layer_t *layers, int num_layers,
+                             int *releaseFenceFd)
+{
+    MockDevice *device = (MockDevice *)dev;
+    return device->context->post(layers, num_layers, releaseFenceFd);
+}
+
+int MockDisplayContext::post(IMG_hwc_layer_t *layers, int numLayers,
+                             int *releaseFenceFd)
+{
+    if (!layers || numLayers <= 0 || !releaseFenceFd) {
+        return -1;
+    }
+
+    if (mPostCost) {
+        usleep(mPostCost);
+    }
+
+    Mutex::Autolock _l(mLock);
+    *releaseFenceFd = sw_sync_fence_create(mTimeline, "mock_post", ++mPostPoint);
+    mLastPostTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    mPosts++;
+    mCondition.signal();
+    return 0;
+}
+
+bool MockDisplayContext::threadLoop()
+{
+    uint32_t point;
+    nsecs_t postTime;
+    {
+        Mutex::Autolock _l(mLock);
+        while (!mExitThread && mSignaledPoint == mPostPoint) {
+            mCondition.wait(mLock);
+        }
+        if (mExitThread) {
+            return false;
+        }
+        point = mPostPoint;
+        postTime = mLastPostTime;
+    }
+
+    // the frame is scanned out from the vblank after the post
+    MockDrm *drm = static_cast<MockDrm*>(Hwcomposer::getInstance().getDrm());
+    nsecs_t vblank = drm->getNextVBlank(IDisplayDevice::DEVICE_PRIMARY, postTime);
+    if (vblank) {
+        MockDrm::sleepUntil(vblank);
+    }
+
+    Mutex::Autolock _l(mLock);
+    sw_sync_timeline_inc(mTimeline, point - mSignaledPoint);
+    mSignaledPoint = point;
+    return true;
+}
+
+} // namespace intel
+} // namespace android
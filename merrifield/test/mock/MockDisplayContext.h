@@ -0,0 +1,73 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef MOCK_DISPLAY_CONTEXT_H
+#define MOCK_DISPLAY_CONTEXT_H
+
+#include <SimpleThread.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+#include <tangier/TngDisplayContext.h>
+
+namespace android {
+namespace intel {
+
+// Tangier display context posting to a simulated IMG display device. A
+// post takes hwc.mock.post_us (300us if not set) and its release fence
+// signals at the next vblank of the primary display.
+class MockDisplayContext : public TngDisplayContext {
+public:
+    MockDisplayContext();
+    virtual ~MockDisplayContext();
+public:
+    void deinitialize();
+
+    uint32_t getPostCount() const { return mPosts; }
+
+protected:
+    IMG_display_device_public_t* openDisplayDevice();
+
+private:
+    struct MockDevice {
+        IMG_display_device_public_t base;
+        MockDisplayContext *context;
+    };
+
+    static int post(IMG_display_device_public_t *dev,
+                    IMG_hwc_layer_t *layers, int num_layers, int *releaseFenceFd);
+    int post(IMG_hwc_layer_t *layers, int numLayers, int *releaseFenceFd);
+    void stopThread();
+
+private:
+    MockDevice mDevice;
+    uint32_t mPostCost;
+    int mTimeline;
+    // protected by mLock
+    uint32_t mPostPoint;
+    uint32_t mSignaledPoint;
+    nsecs_t mLastPostTime;
+    uint32_t mPosts;
+    bool mExitThread;
+    Mutex mLock;
+    Condition mCondition;
+
+    DECLARE_THREAD(VBlankThread, MockDisplayContext);
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* MOCK_DISPLAY_CONTEXT_H */
@@ -0,0 +1,664 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+#include <HwcTrace.h>
+#include <IDisplayDevice.h>
+#include <MockDrm.h>
+
+namespace android {
+namespace intel {
+
+MockDrm::MockDrm()
+    : Drm(),
+      mNextGttPage(0),
+      mGttPages(0),
+      mMapCostPerMB(0),
+      mIoctls(0),
+      mInitialized(false)
+{
+    memset(mOutputs, 0, sizeof(mOutputs));
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+MockDrm::~MockDrm()
+{
+    WARN_IF_NOT_DEINIT();
+}
+
+bool MockDrm::initialize()
+{
+    if (mInitialized) {
+        WTRACE("object has been initialized");
+        return true;
+    }
+
+    char prop[PROPERTY_VALUE_MAX];
+    property_get("hwc.mock.primary", prop, "1920x1080@60");
+    setOutput(IDisplayDevice::DEVICE_PRIMARY, prop);
+    if (property_get("hwc.mock.external", prop, NULL) > 0) {
+        setOutput(IDisplayDevice::DEVICE_EXTERNAL, prop);
+    }
+
+    mMapCostPerMB = 200;
+    if (property_get("hwc.mock.map_us_per_mb", prop, NULL) > 0) {
+        mMapCostPerMB = atoi(prop);
+    }
+
+    mNextGttPage = 0;
+    mGttPages = 0;
+    mInitialized = true;
+
+    // the panel is there from boot, like with the real driver
+    if (!detect(IDisplayDevice::DEVICE_PRIMARY) ||
+        !isConnected(IDisplayDevice::DEVICE_PRIMARY)) {
+        DEINIT_AND_RETURN_FALSE("invalid primary modes");
+    }
+    return true;
+}
+
+void MockDrm::deinitialize()
+{
+    Mutex::Autolock _l(mLock);
+    memset(mOutputs, 0, sizeof(mOutputs));
+    mEnabledPlanes.clear();
+    mGttMappings.clear();
+    mInitialized = false;
+}
+
+int MockDrm::getOutputIndex(int device)
+{
+    switch (device) {
+    case IDisplayDevice::DEVICE_PRIMARY:
+        return OUTPUT_PRIMARY;
+    case IDisplayDevice::DEVICE_EXTERNAL:
+        return OUTPUT_EXTERNAL;
+    default:
+        return -1;
+    }
+}
+
+int MockDrm::parseModes(const char *spec, drmModeModeInfo *modes, int max)
+{
+    int count = 0;
+    const char *p = spec;
+    while (p && *p && count < max) {
+        int width, height, hz;
+        if (sscanf(p, "%dx%d@%d", &width, &height, &hz) != 3 ||
+            width <= 0 || height <= 0 || hz <= 0) {
+            ETRACE("invalid mode %s", p);
+            return 0;
+        }
+
+        drmModeModeInfo& mode = modes[count];
+        memset(&mode, 0, sizeof(mode));
+        mode.hdisplay = width;
+        mode.hsync_start = width + 48;
+        mode.hsync_end = width + 80;
+        mode.htotal = width + 160;
+        mode.vdisplay = height;
+        mode.vsync_start = height + 3;
+        mode.vsync_end = height + 8;
+        mode.vtotal = height + 45;
+        mode.vrefresh = hz;
+        mode.clock = (uint64_t)mode.htotal * mode.vtotal * hz / 1000;
+        mode.type = DRM_MODE_TYPE_DRIVER;
+        if (count == 0) {
+            mode.type |= DRM_MODE_TYPE_PREFERRED;
+        }
+        snprintf(mode.name, sizeof(mode.name), "%dx%d", width, height);
+        count++;
+
+        p = strchr(p, ',');
+        if (p) {
+            p++;
+        }
+    }
+    return count;
+}
+
+void MockDrm::setOutput(int device, const char *modes)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0) {
+        return;
+    }
+
+    MockOutput& output = mOutputs[index];
+    if (modes) {
+        strncpy(output.pendingModes, modes, sizeof(output.pendingModes) - 1);
+        output.pendingModes[sizeof(output.pendingModes) - 1] = '\0';
+    } else {
+        output.pendingModes[0] = '\0';
+    }
+    output.pending = true;
+}
+
+void MockDrm::setMode(MockOutput& output, const drmModeModeInfo& mode)
+{
+    output.mode = mode;
+    // as with the real driver, a mode set supersedes a queued switch
+    output.modePending = false;
+    output.epoch = systemTime(SYSTEM_TIME_MONOTONIC);
+    output.period = seconds_to_nanoseconds(1) / mode.vrefresh;
+    output.modeSets++;
+}
+
+bool MockDrm::detect(int device)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int index = getOutputIndex(device);
+    if (index < 0) {
+        return false;
+    }
+
+    MockOutput& output = mOutputs[index];
+    if (!output.pending) {
+        // a repeated hotplug keeps the output as it is
+        return true;
+    }
+    output.pending = false;
+    output.connected = false;
+    output.modePending = false;
+    output.modeCount = parseModes(output.pendingModes, output.modes, MAX_MODES);
+    if (output.modeCount == 0) {
+        ITRACE("device %d is not connected", device);
+        return true;
+    }
+
+    output.connected = true;
+    output.dpms = DRM_MODE_DPMS_ON;
+    setMode(output, output.modes[0]);
+    ITRACE("mode is: %dx%d@%dHz", output.mode.hdisplay, output.mode.vdisplay,
+           output.mode.vrefresh);
+    return true;
+}
+
+bool MockDrm::setDrmMode(int device, drmModeModeInfo& value)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        ETRACE("device %d is not connected", device);
+        return false;
+    }
+
+    MockOutput& output = mOutputs[index];
+    int match = 0;
+    for (int i = 0; i < output.modeCount; i++) {
+        if (isSameDrmMode(&value, &output.modes[i])) {
+            match = i;
+            break;
+        }
+    }
+    setMode(output, output.modes[match]);
+    return true;
+}
+
+bool MockDrm::setRefreshRate(int device, int hz)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        ETRACE("device %d is not connected", device);
+        return false;
+    }
+
+    MockOutput& output = mOutputs[index];
+    for (int i = 0; i < output.modeCount; i++) {
+        drmModeModeInfoPtr mode = &output.modes[i];
+        if (mode->hdisplay == output.mode.hdisplay &&
+            mode->vdisplay == output.mode.vdisplay &&
+            mode->vrefresh == (uint32_t)hz) {
+            setMode(output, *mode);
+            return true;
+        }
+    }
+    // the real driver falls back to the preferred mode
+    setMode(output, output.modes[0]);
+    return true;
+}
+
+bool MockDrm::queueRefreshRate(int device, int hz)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        ETRACE("device %d is not connected", device);
+        return false;
+    }
+
+    MockOutput& output = mOutputs[index];
+    for (int i = 0; i < output.modeCount; i++) {
+        drmModeModeInfoPtr mode = &output.modes[i];
+        if (mode->hdisplay == output.mode.hdisplay &&
+            mode->vdisplay == output.mode.vdisplay &&
+            mode->vrefresh == (uint32_t)hz) {
+            output.modePending = !isSameDrmMode(mode, &output.mode);
+            output.pendingMode = *mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MockDrm::hasPendingMode(int device)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    return index >= 0 && mOutputs[index].modePending;
+}
+
+bool MockDrm::setPendingMode(int device, buffer_handle_t handle, int width,
+                             int height, int stride, int format)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].modePending) {
+        return false;
+    }
+
+    MockOutput& output = mOutputs[index];
+    if (!output.connected) {
+        output.modePending = false;
+        return false;
+    }
+    if (handle && (width != output.pendingMode.hdisplay ||
+                   height != output.pendingMode.vdisplay || stride < width)) {
+        return false;
+    }
+
+    setMode(output, output.pendingMode);
+    if (handle) {
+        output.seamlessSwitches++;
+    }
+    return handle != 0;
+}
+
+bool MockDrm::hasRefreshRate(int device, int hz)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        return false;
+    }
+
+    MockOutput& output = mOutputs[index];
+    for (int i = 0; i < output.modeCount; i++) {
+        drmModeModeInfoPtr mode = &output.modes[i];
+        if (mode->hdisplay == output.mode.hdisplay &&
+            mode->vdisplay == output.mode.vdisplay &&
+            mode->vrefresh == (uint32_t)hz) {
+            return true;
+        }
+    }
+    return false;
+}
+
+nsecs_t MockDrm::getNextVBlank(int device, nsecs_t after)
+{
+    Mutex::Autolock _l(mLock);
+
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        return 0;
+    }
+
+    MockOutput& output = mOutputs[index];
+    if (after < output.epoch) {
+        return output.epoch;
+    }
+    nsecs_t frames = (after - output.epoch) / output.period + 1;
+    return output.epoch + frames * output.period;
+}
+
+void MockDrm::sleepUntil(nsecs_t time)
+{
+    struct timespec ts;
+    ts.tv_sec = time / seconds_to_nanoseconds(1);
+    ts.tv_nsec = time % seconds_to_nanoseconds(1);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        continue;
+    }
+}
+
+bool MockDrm::sleepToVBlank(int pipe, uint64_t& timestamp)
+{
+    // pipe equals to disp
+    nsecs_t vblank = getNextVBlank(pipe, systemTime(SYSTEM_TIME_MONOTONIC));
+    if (!vblank) {
+        return false;
+    }
+
+    sleepUntil(vblank);
+    timestamp = vblank;
+    Mutex::Autolock _l(mLock);
+    mOutputs[getOutputIndex(pipe)].vblankWaits++;
+    return true;
+}
+
+bool MockDrm::registerRw(struct drm_psb_register_rw_arg& arg)
+{
+    Mutex::Autolock _l(mLock);
+    uint32_t key = ((uint32_t)arg.plane.type << 16) | arg.plane.index;
+
+    if (arg.get_plane_state_mask) {
+        mStats.planeQueries++;
+        if (mEnabledPlanes.indexOfKey(key) < 0) {
+            arg.plane.ctx = PSB_DC_PLANE_DISABLED;
+        }
+        return true;
+    }
+
+    mStats.planeUpdates++;
+    if (arg.plane_enable_mask) {
+        mEnabledPlanes.add(key, arg.plane.ctx);
+    } else if (arg.plane_disable_mask) {
+        mEnabledPlanes.removeItem(key);
+    }
+    return true;
+}
+
+bool MockDrm::gttMap(struct psb_gtt_mapping_arg& arg)
+{
+    if (!arg.vaddr || !arg.size) {
+        return false;
+    }
+
+    // the driver pins and writes the page table entries one page at a time
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint64_t cost = (uint64_t)arg.size * mMapCostPerMB / (1 << 20);
+    if (cost) {
+        usleep(cost);
+    }
+
+    Mutex::Autolock _l(mLock);
+    uint32_t pages = align_to(arg.size, GTT_PAGE_SIZE) / GTT_PAGE_SIZE;
+    arg.offset_pages = mNextGttPage;
+    mNextGttPage += pages;
+    mGttMappings.add(arg.vaddr, pages);
+    mGttPages += pages;
+    mStats.gttMaps++;
+    mStats.gttMapTime += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    return true;
+}
+
+bool MockDrm::gttUnmap(struct psb_gtt_mapping_arg& arg)
+{
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mGttMappings.indexOfKey(arg.vaddr);
+    if (index < 0) {
+        ETRACE("%#lx is not mapped", (unsigned long)arg.vaddr);
+        return false;
+    }
+
+    mGttPages -= mGttMappings.valueAt(index);
+    mGttMappings.removeItemsAt(index);
+    mStats.gttUnmaps++;
+    return true;
+}
+
+bool MockDrm::writeReadIoctl(unsigned long cmd, void *data,
+                           unsigned long size)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (!data || !size) {
+        ETRACE("invalid parameters");
+        return false;
+    }
+
+    android_atomic_inc(&mIoctls);
+
+    switch (cmd) {
+    case DRM_PSB_VSYNC_SET: {
+        struct drm_psb_vsync_set_arg *arg = (struct drm_psb_vsync_set_arg *)data;
+        if (arg->vsync_operation_mask & VSYNC_WAIT) {
+            uint64_t timestamp = 0;
+            bool ret = sleepToVBlank(arg->vsync.pipe, timestamp);
+            arg->vsync.timestamp = timestamp;
+            return ret;
+        }
+        return true;
+    }
+    case DRM_PSB_REGISTER_RW:
+        return registerRw(*(struct drm_psb_register_rw_arg *)data);
+    case DRM_PSB_GTT_MAP:
+        return gttMap(*(struct psb_gtt_mapping_arg *)data);
+    default:
+        VTRACE("ioctl %ld is not simulated", cmd);
+        return true;
+    }
+}
+
+bool MockDrm::writeIoctl(unsigned long cmd, void *data,
+                       unsigned long size)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (!data || !size) {
+        ETRACE("invalid parameters");
+        return false;
+    }
+
+    android_atomic_inc(&mIoctls);
+
+    switch (cmd) {
+    case DRM_PSB_GTT_UNMAP:
+        return gttUnmap(*(struct psb_gtt_mapping_arg *)data);
+    default:
+        VTRACE("ioctl %ld is not simulated", cmd);
+        return true;
+    }
+}
+
+bool MockDrm::readIoctl(unsigned long cmd, void *data,
+                      unsigned long size)
+{
+    RETURN_FALSE_IF_NOT_INIT();
+
+    if (!data || !size) {
+        ETRACE("invalid parameters");
+        return false;
+    }
+
+    android_atomic_inc(&mIoctls);
+
+    // queries read back zero, e.g. a command mode panel
+    memset(data, 0, size);
+    return true;
+}
+
+bool MockDrm::isConnected(int device)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    return index >= 0 && mOutputs[index].connected;
+}
+
+bool MockDrm::setDpmsMode(int device, int mode)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        return false;
+    }
+    mOutputs[index].dpms = mode;
+    return true;
+}
+
+int MockDrm::getDrmFd() const
+{
+    // nothing in the mock platform opens the device
+    return -1;
+}
+
+bool MockDrm::getModeInfo(int device, drmModeModeInfo& mode)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        return false;
+    }
+    mode = mOutputs[index].mode;
+    return true;
+}
+
+bool MockDrm::getPhysicalSize(int device, uint32_t& width, uint32_t& height)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        return false;
+    }
+    width = mOutputs[index].mode.hdisplay * 10 / PIXELS_PER_CM;
+    height = mOutputs[index].mode.vdisplay * 10 / PIXELS_PER_CM;
+    return true;
+}
+
+int MockDrm::getPanelOrientation(int device)
+{
+    return PANEL_ORIENTATION_0;
+}
+
+int MockDrm::getGammaSize(int device)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        return 0;
+    }
+    return GAMMA_SIZE;
+}
+
+bool MockDrm::setGamma(int device, uint16_t *red, uint16_t *green,
+                       uint16_t *blue, int size)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected || size != GAMMA_SIZE ||
+        !red || !green || !blue) {
+        return false;
+    }
+    mOutputs[index].gammaSets++;
+    return true;
+}
+
+bool MockDrm::flipAsync(int device, buffer_handle_t handle, int width,
+                        int height, int stride, int format)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected || !handle ||
+        width != mOutputs[index].mode.hdisplay ||
+        height != mOutputs[index].mode.vdisplay || stride < width) {
+        return false;
+    }
+    mOutputs[index].asyncFlips++;
+    return true;
+}
+
+void MockDrm::endAsyncFlips(int device)
+{
+}
+
+bool MockDrm::setPanelFitter(int device, int scaling, int hBorder, int vBorder)
+{
+    Mutex::Autolock _l(mLock);
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        return false;
+    }
+
+    // the fitter can't shrink the frame to nothing
+    MockOutput& output = mOutputs[index];
+    if (hBorder < 0 || vBorder < 0 ||
+        2 * hBorder >= output.mode.hdisplay ||
+        2 * vBorder >= output.mode.vdisplay) {
+        return false;
+    }
+    output.scaling = scaling;
+    output.hBorder = hBorder;
+    output.vBorder = vBorder;
+    return true;
+}
+
+drmModeModeInfoPtr MockDrm::detectAllConfigs(int device, int *modeCount)
+{
+    RETURN_NULL_IF_NOT_INIT();
+    Mutex::Autolock _l(mLock);
+
+    if (modeCount == NULL) {
+        return NULL;
+    }
+    *modeCount = 0;
+
+    int index = getOutputIndex(device);
+    if (index < 0 || !mOutputs[index].connected) {
+        ETRACE("device is not connected");
+        return NULL;
+    }
+
+    *modeCount = mOutputs[index].modeCount;
+    return mOutputs[index].modes;
+}
+
+void MockDrm::dump(Dump& d)
+{
+    Drm::dump(d);
+
+    Mutex::Autolock _l(mLock);
+    d.append("Mock DRM: ioctls %d, plane updates %u, plane queries %u\n",
+             mIoctls, mStats.planeUpdates, mStats.planeQueries);
+    d.append("  GTT: %u maps, %u unmaps, %u pages mapped, map time %lldus\n",
+             mStats.gttMaps, mStats.gttUnmaps, mGttPages,
+             nanoseconds_to_microseconds(mStats.gttMapTime));
+    for (int i = 0; i < OUTPUT_MAX; i++) {
+        MockOutput& output = mOutputs[i];
+        if (!output.connected) {
+            d.append("  output %d: disconnected\n", i);
+            continue;
+        }
+        d.append("  output %d: %dx%d@%d, %d modes, dpms %d, %u mode sets, "
+                 "%u seamless, %u vblank waits, %u gamma sets, "
+                 "%u async flips, fitter scaling %d borders %dx%d\n",
+                 i, output.mode.hdisplay, output.mode.vdisplay,
+                 output.mode.vrefresh, output.modeCount, output.dpms,
+                 output.modeSets, output.seamlessSwitches,
+                 output.vblankWaits, output.gammaSets,
+                 output.asyncFlips, output.scaling, output.hBorder,
+                 output.vBorder);
+    }
+}
+
+} // namespace intel
+} // namespace android
@@ -0,0 +1,166 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef MOCK_DRM_H
+#define MOCK_DRM_H
+
+#include <cutils/properties.h>
+#include <Drm.h>
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace intel {
+
+// A simulated kernel display driver. The outputs are described by
+// properties, "WxH@hz" modes separated by commas with the preferred one
+// first:
+//
+//   hwc.mock.primary      modes of the panel, 1920x1080@60 if not set
+//   hwc.mock.external     modes of the HDMI sink, disconnected if not set
+//   hwc.mock.map_us_per_mb  cost of a GTT mapping, 200us per MB if not set
+//
+// Vblanks of an output are a fixed grid from the time it was attached,
+// vsync waits sleep to the next one. Plane enables are remembered so that
+// state queries see what the planes last asked for.
+class MockDrm : public Drm {
+public:
+    MockDrm();
+    virtual ~MockDrm();
+
+public:
+    bool initialize();
+    void deinitialize();
+    bool detect(int device);
+    bool setDrmMode(int device, drmModeModeInfo& value);
+    bool setRefreshRate(int device, int hz);
+    bool queueRefreshRate(int device, int hz);
+    bool hasPendingMode(int device);
+    bool setPendingMode(int device, buffer_handle_t handle, int width,
+                        int height, int stride, int format);
+    bool hasRefreshRate(int device, int hz);
+    bool writeReadIoctl(unsigned long cmd, void *data,
+                      unsigned long size);
+    bool writeIoctl(unsigned long cmd, void *data,
+                      unsigned long size);
+    bool readIoctl(unsigned long cmd, void *data,
+                      unsigned long size);
+
+    bool isConnected(int device);
+    bool setDpmsMode(int device, int mode);
+    int getDrmFd() const;
+    bool getModeInfo(int device, drmModeModeInfo& mode);
+    bool getPhysicalSize(int device, uint32_t& width, uint32_t& height);
+    int getPanelOrientation(int device);
+    int getGammaSize(int device);
+    bool setGamma(int device, uint16_t *red, uint16_t *green,
+                  uint16_t *blue, int size);
+    bool flipAsync(int device, buffer_handle_t handle, int width,
+                   int height, int stride, int format);
+    void endAsyncFlips(int device);
+    bool setPanelFitter(int device, int scaling, int hBorder, int vBorder);
+    drmModeModeInfoPtr detectAllConfigs(int device, int *modeCount);
+
+    // the first vblank of device after the given time, 0 if the output
+    // is not connected
+    nsecs_t getNextVBlank(int device, nsecs_t after);
+    static void sleepUntil(nsecs_t time);
+    // connects an output with the given modes or disconnects it if modes
+    // is NULL, seen by the next detect()
+    void setOutput(int device, const char *modes);
+    // GTT mappings made and released so far
+    uint32_t getGttMapCount() const { return mStats.gttMaps; }
+    uint32_t getGttUnmapCount() const { return mStats.gttUnmaps; }
+
+    void dump(Dump& d);
+
+private:
+    enum {
+        MAX_MODES = 16,
+        GAMMA_SIZE = 256,
+        // pixels per centimetre of the simulated outputs, about 240 dpi
+        PIXELS_PER_CM = 95,
+    };
+
+    struct MockOutput {
+        // set by setOutput(), taken by detect()
+        char pendingModes[PROPERTY_VALUE_MAX];
+        bool pending;
+        bool connected;
+        drmModeModeInfo modes[MAX_MODES];
+        int modeCount;
+        drmModeModeInfo mode;
+        int dpms;
+        nsecs_t epoch;
+        nsecs_t period;
+        uint32_t vblankWaits;
+        uint32_t modeSets;
+        // mode sets that scanned out the committed frame
+        uint32_t seamlessSwitches;
+        drmModeModeInfo pendingMode;
+        bool modePending;
+        uint32_t gammaSets;
+        uint32_t asyncFlips;
+        // last panel fitter setting
+        int scaling;
+        int hBorder;
+        int vBorder;
+    };
+
+    int getOutputIndex(int device);
+    static int parseModes(const char *spec, drmModeModeInfo *modes, int max);
+    void setMode(MockOutput& output, const drmModeModeInfo& mode);
+    bool sleepToVBlank(int pipe, uint64_t& timestamp);
+    bool registerRw(struct drm_psb_register_rw_arg& arg);
+    bool gttMap(struct psb_gtt_mapping_arg& arg);
+    bool gttUnmap(struct psb_gtt_mapping_arg& arg);
+
+private:
+    enum {
+        OUTPUT_PRIMARY = 0,
+        OUTPUT_EXTERNAL,
+        OUTPUT_MAX,
+    };
+
+    enum {
+        GTT_PAGE_SIZE = 4096,
+    };
+
+    MockOutput mOutputs[OUTPUT_MAX];
+    // plane context of every plane last enabled, keyed by type and index
+    KeyedVector<uint32_t, uint32_t> mEnabledPlanes;
+    // pages of each GTT mapping, keyed by virtual address
+    KeyedVector<unsigned long, uint32_t> mGttMappings;
+    uint32_t mNextGttPage;
+    uint32_t mGttPages;
+    uint32_t mMapCostPerMB;
+
+    volatile int32_t mIoctls;
+    struct {
+        uint32_t planeUpdates;
+        uint32_t planeQueries;
+        uint32_t gttMaps;
+        uint32_t gttUnmaps;
+        nsecs_t gttMapTime;
+    } mStats;
+
+    Mutex mLock;
+    bool mInitialized;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* MOCK_DRM_H */
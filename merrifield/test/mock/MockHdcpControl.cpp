@@ -0,0 +1,81 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <HwcTrace.h>
+#include <MockHdcpControl.h>
+
+namespace android {
+namespace intel {
+
+MockHdcpControl::MockHdcpControl()
+    : HdcpControl(),
+      mAuthTime(100),
+      mAuthenticated(0)
+{
+    char prop[PROPERTY_VALUE_MAX];
+    if (property_get("hwc.mock.hdcp_ms", prop, NULL) > 0) {
+        mAuthTime = atoi(prop);
+    }
+}
+
+MockHdcpControl::~MockHdcpControl()
+{
+}
+
+bool MockHdcpControl::enableAuthentication()
+{
+    // the driver returns once the sink has answered
+    if (mAuthTime < 0) {
+        usleep(-mAuthTime * 1000);
+        ETRACE("failed to enable HDCP authentication");
+        return false;
+    }
+    usleep(mAuthTime * 1000);
+    android_atomic_release_store(1, &mAuthenticated);
+    return true;
+}
+
+bool MockHdcpControl::disableAuthentication()
+{
+    android_atomic_release_store(0, &mAuthenticated);
+    return true;
+}
+
+bool MockHdcpControl::enableDisplayIED()
+{
+    return true;
+}
+
+bool MockHdcpControl::disableDisplayIED()
+{
+    return true;
+}
+
+bool MockHdcpControl::isHdcpSupported()
+{
+    return true;
+}
+
+bool MockHdcpControl::checkAuthenticated()
+{
+    return android_atomic_acquire_load(&mAuthenticated) != 0;
+}
+
+} // namespace intel
+} // namespace android
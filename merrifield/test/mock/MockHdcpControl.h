@@ -0,0 +1,48 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#ifndef MOCK_HDCP_CONTROL_H
+#define MOCK_HDCP_CONTROL_H
+
+#include <common/HdcpControl.h>
+
+namespace android {
+namespace intel {
+
+// HDCP state machine of the platform against a simulated sink. An
+// authentication takes hwc.mock.hdcp_ms (100ms if not set), with a
+// negative value it fails after as long.
+class MockHdcpControl : public HdcpControl {
+public:
+    MockHdcpControl();
+    virtual ~MockHdcpControl();
+
+protected:
+    bool enableAuthentication();
+    bool disableAuthentication();
+    bool enableDisplayIED();
+    bool disableDisplayIED();
+    bool isHdcpSupported();
+    bool checkAuthenticated();
+
+private:
+    int mAuthTime;
+    volatile int32_t mAuthenticated;
+};
+
+} // namespace intel
+} // namespace android
+
+#endif /* MOCK_HDCP_CONTROL_H */
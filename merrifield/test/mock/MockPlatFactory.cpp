@@ -0,0 +1,117 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <HwcTrace.h>
+#ifdef HWC_MOCK_ANNIEDALE
+#include <anniedale/AnnPlaneManager.h>
+#else
+#include <tangier/TngPlaneManager.h>
+#endif
+#include <IDisplayDevice.h>
+#include <PrimaryDevice.h>
+#include <ExternalDevice.h>
+#include <VirtualDevice.h>
+#include <Hwcomposer.h>
+#include <common/VsyncControl.h>
+#include <common/BlankControl.h>
+#include <common/VideoPayloadManager.h>
+#include <MockDrm.h>
+#include <MockBufferManager.h>
+#include <MockDisplayContext.h>
+#include <MockHdcpControl.h>
+#include <MockPlatFactory.h>
+
+namespace android {
+namespace intel {
+
+MockPlatFactory::MockPlatFactory()
+{
+    CTRACE();
+}
+
+MockPlatFactory::~MockPlatFactory()
+{
+    CTRACE();
+}
+
+Drm* MockPlatFactory::createDrm()
+{
+    CTRACE();
+    return new MockDrm();
+}
+
+DisplayPlaneManager* MockPlatFactory::createDisplayPlaneManager()
+{
+    CTRACE();
+#ifdef HWC_MOCK_ANNIEDALE
+    return (new AnnPlaneManager());
+#else
+    return (new TngPlaneManager());
+#endif
+}
+
+BufferManager* MockPlatFactory::createBufferManager()
+{
+    CTRACE();
+    return (new MockBufferManager());
+}
+
+IDisplayDevice* MockPlatFactory::createDisplayDevice(int disp)
+{
+    CTRACE();
+    //when createDisplayDevice is called, Hwcomposer has already finished construction.
+    Hwcomposer &hwc = Hwcomposer::getInstance();
+
+    // vsync and blank of the platform go through MockDrm
+    class MockDeviceControlFactory: public DeviceControlFactory {
+    public:
+        virtual IVsyncControl* createVsyncControl()       {return new VsyncControl();}
+        virtual IBlankControl* createBlankControl()       {return new BlankControl();}
+        virtual IHdcpControl* createHdcpControl()         {return new MockHdcpControl();}
+    };
+
+    switch (disp) {
+        case IDisplayDevice::DEVICE_PRIMARY:
+            return new PrimaryDevice(hwc, new MockDeviceControlFactory());
+        case IDisplayDevice::DEVICE_EXTERNAL:
+            return new ExternalDevice(hwc, new MockDeviceControlFactory());
+        case IDisplayDevice::DEVICE_VIRTUAL:
+            return new VirtualDevice(hwc);
+        default:
+            ETRACE("invalid display device %d", disp);
+            return NULL;
+    }
+}
+
+IDisplayContext* MockPlatFactory::createDisplayContext()
+{
+    CTRACE();
+    return new MockDisplayContext();
+}
+
+IVideoPayloadManager *MockPlatFactory::createVideoPayloadManager()
+{
+    return new VideoPayloadManager();
+}
+
+Hwcomposer* Hwcomposer::createHwcomposer()
+{
+    CTRACE();
+    Hwcomposer *hwc = new Hwcomposer(new MockPlatFactory());
+    return hwc;
+}
+
+} //namespace intel
+} //namespace android
@@ -13,8 +13,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+// Shows /data/my_640x480.nv12 on a video surface, or with -b runs a
+// playback benchmark of the overlay paths:
+//
+//   nv12_ved_test -b [-r WxH,...] [-f fps,...] [-t rotation,...]
+//                    [-s surfaces] [-d seconds] [-p] [-T]
+//
+// Every combination of resolution, frame rate and rotation (0, 90, 180 or
+// 270) is played for the given seconds on the given number of surfaces,
+// with -p protected and -T tiled NV12 buffers. The release fence of a
+// buffer signals when the next frame replaces it on screen, which gives
+// the present time of each frame: achieved fps, frames shown for less than
+// half a refresh period (dropped) and queue-to-present latency are
+// reported per case.
 #include <gtest/gtest.h>
 
+#include <stdlib.h>
+#include <unistd.h>
+
 #include <binder/IMemory.h>
 
 #include <gui/ISurfaceComposer.h>
@@ -22,11 +38,20 @@
 #include <gui/SurfaceComposerClient.h>
 #include <private/gui/ComposerService.h>
 
+#include <hardware/gralloc.h>
+#include <sync/sync.h>
+#include <ui/DisplayInfo.h>
+#include <ui/GraphicBuffer.h>
+
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
 
 using namespace android;
 const char * filename = "/data/my_640x480.nv12";
 #define PIXEL_FORMAT_NV12 0x7FA00E00
+#define PIXEL_FORMAT_NV12_TILED 0x7FA00F00
 
 // Fill a YV12 buffer with a multi-colored checkerboard pattern
 void fillYUVBuffer(uint8_t* buf, int w, int h, int stride) {
@@ -83,7 +108,7 @@ void loadYUVBufferFromFile(uint8_t* buf, int w, int h, int stride) {
 	fclose(fp);
 }
 
-int main(int argc, char **argv) {
+static int displayImage() {
 	sp < SurfaceControl > sc;
 	sp < Surface > s;
 	sp < ANativeWindow > anw;
@@ -145,3 +170,403 @@ int main(int argc, char **argv) {
 	return 0;
 }
 
+
+// NV12 checkerboard with a vertical bar at phase, so that consecutive
+// buffers differ
+void fillNV12Buffer(uint8_t* buf, int w, int h, int stride, int phase) {
+	const int blockWidth = w > 16 ? w / 16 : 1;
+	const int blockHeight = h > 16 ? h / 16 : 1;
+	const int barWidth = w > 32 ? w / 32 : 1;
+	const int barX = (phase * barWidth) % w;
+	for (int y = 0; y < h; y++) {
+		uint8_t *line = buf + y * stride;
+		for (int x = 0; x < w; x++) {
+			int parityX = (x / blockWidth) & 1;
+			int parityY = (y / blockHeight) & 1;
+			line[x] = (parityX ^ parityY) ? 63 : 191;
+			if (x >= barX && x < barX + barWidth)
+				line[x] = 235;
+		}
+	}
+	memset(buf + h * stride, 128, stride * h / 2);
+}
+
+struct BenchCase {
+	int width;
+	int height;
+	int fps;
+	int rotation;
+	int surfaces;
+	int seconds;
+	bool isProtected;
+	bool tiled;
+};
+
+struct BenchSurface {
+	sp < SurfaceControl > sc;
+	sp < Surface > s;
+	ANativeWindow *anw;
+	// frame last queued with each buffer
+	KeyedVector<ANativeWindowBuffer*, int> lastFrame;
+	Vector<nsecs_t> queued;
+	Vector<nsecs_t> released;
+};
+
+struct BenchResult {
+	int frames;
+	int presented;
+	int dropped;
+	double fps;
+	nsecs_t latencyAvg;
+	nsecs_t latencyP95;
+	nsecs_t latencyMax;
+};
+
+static nsecs_t getSignalTime(int fenceFd) {
+	struct sync_fence_info_data *info = sync_fence_info(fenceFd);
+	if (!info)
+		return 0;
+
+	// the fence is signaled by its last point
+	nsecs_t signalTime = 0;
+	struct sync_pt_info *pt = NULL;
+	while ((pt = sync_pt_info(info, pt)) != NULL) {
+		if (pt->status == 1 && (nsecs_t)pt->timestamp_ns > signalTime)
+			signalTime = pt->timestamp_ns;
+	}
+	sync_fence_info_free(info);
+	return signalTime;
+}
+
+static int compareTime(const void *lhs, const void *rhs) {
+	nsecs_t l = *(const nsecs_t *)lhs;
+	nsecs_t r = *(const nsecs_t *)rhs;
+	return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+static uint32_t getTransform(int rotation) {
+	switch (rotation) {
+	case 90:
+		return NATIVE_WINDOW_TRANSFORM_ROT_90;
+	case 180:
+		return NATIVE_WINDOW_TRANSFORM_ROT_180;
+	case 270:
+		return NATIVE_WINDOW_TRANSFORM_ROT_270;
+	default:
+		return 0;
+	}
+}
+
+static bool createBenchSurface(const sp<SurfaceComposerClient>& client,
+		const BenchCase& bench, int index, const DisplayInfo& display,
+		BenchSurface& surface) {
+	// surfaces are tiled across the display in a grid
+	int columns = 1;
+	while (columns * columns < bench.surfaces)
+		columns++;
+	int rows = (bench.surfaces + columns - 1) / columns;
+	int tileWidth = display.w / columns;
+	int tileHeight = display.h / rows;
+
+	surface.sc = client->createSurface(String8("Video Bench Surface"),
+			tileWidth, tileHeight, PIXEL_FORMAT_RGBA_8888, 0);
+	if (surface.sc == NULL || !surface.sc->isValid())
+		return false;
+
+	surface.s = surface.sc->getSurface();
+	surface.anw = surface.s.get();
+
+	int usage = bench.isProtected ? GRALLOC_USAGE_PROTECTED :
+			(GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN);
+	if (native_window_set_buffers_geometry(surface.anw, bench.width,
+			bench.height, bench.tiled ? PIXEL_FORMAT_NV12_TILED :
+			PIXEL_FORMAT_NV12) != NO_ERROR)
+		return false;
+	if (native_window_set_usage(surface.anw, usage) != NO_ERROR)
+		return false;
+	if (native_window_set_scaling_mode(surface.anw,
+			NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW) != NO_ERROR)
+		return false;
+	if (native_window_set_buffers_transform(surface.anw,
+			getTransform(bench.rotation)) != NO_ERROR)
+		return false;
+
+	SurfaceComposerClient::openGlobalTransaction();
+	surface.sc->setLayer(INT_MAX - 1 - index);
+	surface.sc->setPosition((index % columns) * tileWidth,
+			(index / columns) * tileHeight);
+	surface.sc->show();
+	SurfaceComposerClient::closeGlobalTransaction();
+
+	int frames = bench.fps * bench.seconds;
+	surface.queued.insertAt(0, 0, frames);
+	surface.released.insertAt(0, 0, frames);
+	return true;
+}
+
+// dequeues a buffer, records when the frame it last held was released
+// and queues it as frame
+static bool queueFrame(BenchSurface& surface, const BenchCase& bench,
+		int frame, nsecs_t presentTime) {
+	ANativeWindowBuffer *anb;
+	int fenceFd = -1;
+	if (surface.anw->dequeueBuffer(surface.anw, &anb, &fenceFd) != NO_ERROR)
+		return false;
+
+	ssize_t index = surface.lastFrame.indexOfKey(anb);
+	if (fenceFd >= 0) {
+		sync_wait(fenceFd, -1);
+		if (index >= 0)
+			surface.released.editItemAt(surface.lastFrame.valueAt(index)) =
+					getSignalTime(fenceFd);
+		close(fenceFd);
+	}
+
+	if (index < 0) {
+		// content is only written on the first use of a buffer, a
+		// protected or tiled buffer is left as gralloc allocated it
+		if (!bench.isProtected && !bench.tiled) {
+			sp < GraphicBuffer > buf(new GraphicBuffer(anb, false));
+			uint8_t* img = NULL;
+			buf->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, (void**) (&img));
+			if (img) {
+				fillNV12Buffer(img, bench.width, bench.height,
+						buf->getStride(), surface.lastFrame.size());
+				buf->unlock();
+			}
+		}
+		surface.lastFrame.add(anb, frame);
+	} else {
+		surface.lastFrame.replaceValueAt(index, frame);
+	}
+
+	native_window_set_buffers_timestamp(surface.anw, presentTime);
+	surface.queued.editItemAt(frame) = systemTime(SYSTEM_TIME_MONOTONIC);
+	return surface.anw->queueBuffer(surface.anw, anb, -1) == NO_ERROR;
+}
+
+// frame f is on screen from the release of frame f - 1 to its own release
+static void collectResult(Vector<BenchSurface*>& surfaces,
+		nsecs_t refreshPeriod, BenchResult& result) {
+	Vector<nsecs_t> latencies;
+	nsecs_t first = 0;
+	nsecs_t last = 0;
+	memset(&result, 0, sizeof(result));
+
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		BenchSurface *surface = surfaces[i];
+		for (size_t f = 1; f < surface->released.size(); f++) {
+			nsecs_t shown = surface->released[f - 1];
+			nsecs_t replaced = surface->released[f];
+			if (!shown || !replaced)
+				continue;
+
+			result.frames++;
+			if (replaced - shown < refreshPeriod / 2) {
+				result.dropped++;
+				continue;
+			}
+			result.presented++;
+			latencies.add(shown - surface->queued[f]);
+			if (!first || shown < first)
+				first = shown;
+			if (replaced > last)
+				last = replaced;
+		}
+	}
+
+	if (latencies.size() == 0)
+		return;
+
+	qsort(latencies.editArray(), latencies.size(), sizeof(nsecs_t),
+			compareTime);
+	nsecs_t total = 0;
+	for (size_t i = 0; i < latencies.size(); i++)
+		total += latencies[i];
+	result.latencyAvg = total / latencies.size();
+	result.latencyP95 = latencies[latencies.size() * 95 / 100];
+	result.latencyMax = latencies[latencies.size() - 1];
+	if (last > first)
+		result.fps = (double)result.presented * 1000000000.0 /
+				(last - first) / surfaces.size();
+}
+
+static bool runBenchCase(const sp<SurfaceComposerClient>& client,
+		const BenchCase& bench, const DisplayInfo& display,
+		BenchResult& result) {
+	Vector<BenchSurface*> surfaces;
+	bool ok = true;
+	for (int i = 0; ok && i < bench.surfaces; i++) {
+		BenchSurface *surface = new BenchSurface;
+		surfaces.add(surface);
+		ok = createBenchSurface(client, bench, i, display, *surface);
+	}
+
+	nsecs_t interval = 1000000000LL / bench.fps;
+	int frames = bench.fps * bench.seconds;
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC) + interval;
+	for (int f = 0; ok && f < frames; f++) {
+		nsecs_t due = start + f * interval;
+		nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+		if (due > now)
+			usleep(ns2us(due - now));
+		for (size_t i = 0; ok && i < surfaces.size(); i++)
+			ok = queueFrame(*surfaces[i], bench, f, due);
+	}
+
+	if (ok)
+		collectResult(surfaces, (nsecs_t)(1000000000.0 / display.fps),
+				result);
+
+	SurfaceComposerClient::openGlobalTransaction();
+	for (size_t i = 0; i < surfaces.size(); i++) {
+		if (surfaces[i]->sc != NULL)
+			surfaces[i]->sc->hide();
+	}
+	SurfaceComposerClient::closeGlobalTransaction();
+	for (size_t i = 0; i < surfaces.size(); i++)
+		delete surfaces[i];
+	return ok;
+}
+
+static bool parseList(const char *arg, Vector<int>& values) {
+	values.clear();
+	const char *p = arg;
+	while (*p) {
+		char *end;
+		int value = strtol(p, &end, 10);
+		if (end == p)
+			return false;
+		values.add(value);
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return values.size() > 0;
+}
+
+static bool parseResolutions(const char *arg, Vector<int>& widths,
+		Vector<int>& heights) {
+	widths.clear();
+	heights.clear();
+	const char *p = arg;
+	while (*p) {
+		int w, h, n = 0;
+		if (sscanf(p, "%dx%d%n", &w, &h, &n) != 2 || w <= 0 || h <= 0)
+			return false;
+		widths.add(w);
+		heights.add(h);
+		p += n;
+		if (*p == ',')
+			p++;
+	}
+	return widths.size() > 0;
+}
+
+static void usage(const char *name) {
+	printf("usage: %s [-b [-r WxH,...] [-f fps,...] [-t rotation,...]\n"
+			"          [-s surfaces] [-d seconds] [-p] [-T]]\n", name);
+}
+
+int main(int argc, char **argv) {
+	Vector<int> widths, heights, rates, rotations;
+	BenchCase bench;
+	bool benchmark = false;
+	int opt;
+
+	parseResolutions("640x480,1280x720,1920x1080,3840x2160", widths, heights);
+	parseList("30", rates);
+	parseList("0", rotations);
+	memset(&bench, 0, sizeof(bench));
+	bench.surfaces = 1;
+	bench.seconds = 5;
+
+	while ((opt = getopt(argc, argv, "br:f:t:s:d:pT")) != -1) {
+		bool ok = true;
+		switch (opt) {
+		case 'b':
+			benchmark = true;
+			break;
+		case 'r':
+			ok = parseResolutions(optarg, widths, heights);
+			break;
+		case 'f':
+			ok = parseList(optarg, rates);
+			break;
+		case 't':
+			ok = parseList(optarg, rotations);
+			break;
+		case 's':
+			bench.surfaces = atoi(optarg);
+			ok = bench.surfaces > 0;
+			break;
+		case 'd':
+			bench.seconds = atoi(optarg);
+			ok = bench.seconds > 0;
+			break;
+		case 'p':
+			bench.isProtected = true;
+			break;
+		case 'T':
+			bench.tiled = true;
+			break;
+		default:
+			ok = false;
+			break;
+		}
+		if (!ok) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!benchmark)
+		return displayImage();
+
+	sp < SurfaceComposerClient > composerClient = new SurfaceComposerClient;
+	if (composerClient->initCheck() != NO_ERROR)
+		return 1;
+
+	DisplayInfo display;
+	sp < IBinder > token = SurfaceComposerClient::getBuiltInDisplay(
+			ISurfaceComposer::eDisplayIdMain);
+	if (SurfaceComposerClient::getDisplayInfo(token, &display) != NO_ERROR) {
+		printf("failed to query the display\n");
+		return 1;
+	}
+
+	printf("display %ux%u@%.0f, %d surface(s)%s%s, %ds per case\n",
+			display.w, display.h, display.fps, bench.surfaces,
+			bench.isProtected ? ", protected" : "",
+			bench.tiled ? ", tiled" : "", bench.seconds);
+	printf("%-10s %4s %4s %7s %7s %7s %7s %8s %8s %8s\n", "size", "fps",
+			"rot", "frames", "shown", "dropped", "fps", "lat(ms)",
+			"p95(ms)", "max(ms)");
+
+	for (size_t r = 0; r < widths.size(); r++)
+	for (size_t f = 0; f < rates.size(); f++)
+	for (size_t t = 0; t < rotations.size(); t++) {
+		bench.width = widths[r];
+		bench.height = heights[r];
+		bench.fps = rates[f];
+		bench.rotation = rotations[t];
+		if (bench.fps <= 0)
+			continue;
+
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", bench.width, bench.height);
+		printf("%-10s %4d %4d", size, bench.fps, bench.rotation);
+
+		BenchResult result;
+		if (!runBenchCase(composerClient, bench, display, result)) {
+			printf(" failed\n");
+			continue;
+		}
+		printf(" %7d %7d %7d %7.1f %8.2f %8.2f %8.2f\n", result.frames,
+				result.presented, result.dropped, result.fps,
+				ns2us(result.latencyAvg) / 1000.0,
+				ns2us(result.latencyP95) / 1000.0,
+				ns2us(result.latencyMax) / 1000.0);
+	}
+
+	composerClient->dispose();
+	return 0;
+}
@@ -0,0 +1,393 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Times the overlay register setup of OverlayPlaneBase and of the
+// AnnOverlayPlane overrides on a back buffer in plain memory, over a matrix
+// of formats, crops, scale ratios and transforms. No display hardware is
+// needed, the planes are never initialized.
+//
+//   overlay_setup_bench [-n iterations] [-c results.csv]
+//
+// Each routine is called n times per case and reported in ns per call.
+// "rescale" alternates between two destination widths so that every call
+// rewrites the filter coefficients, "scale" repeats the same one.
+// "geometry" is the per frame plane update of HwcLayer::update(), the
+// position, crop, transform and alpha set through a DisplayPlane pointer.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/hwcomposer.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <hal_public.h>
+#include <OMX_IVCommon.h>
+#include <OMX_IntelVideoExt.h>
+#include <BufferMapper.h>
+#include <common/GrallocSubBuffer.h>
+#include <common/VideoPayloadBuffer.h>
+#include <tangier/TngOverlayPlane.h>
+#include <anniedale/AnnOverlayPlane.h>
+
+using namespace android;
+using namespace android::intel;
+
+enum {
+    ROUTINE_OFFSET = 0,
+    ROUTINE_COORDINATE,
+    ROUTINE_SCALE,
+    ROUTINE_RESCALE,
+    ROUTINE_COLOR,
+    ROUTINE_GEOMETRY,
+    ROUTINE_COUNT,
+};
+
+static const char *sRoutineNames[ROUTINE_COUNT] = {
+    "offset", "coord", "scale", "rescale", "color", "geometry",
+};
+
+// a mapped buffer as the planes see it, at a fixed GTT offset
+class BenchMapper : public BufferMapper {
+public:
+    BenchMapper(DataBuffer& buffer, VideoPayloadBuffer *payload)
+        : BufferMapper(buffer), mPayload(payload) {}
+    virtual ~BenchMapper() {}
+public:
+    bool map() { return true; }
+    bool unmap() { return true; }
+    uint32_t getGttOffsetInPage(int subIndex) const { return 0x1000; }
+    void* getCpuAddress(int subIndex) const {
+        return subIndex == SUB_BUFFER1 ? mPayload : NULL;
+    }
+    uint32_t getSize(int subIndex) const { return 0; }
+    buffer_handle_t getKHandle(int subIndex) { return 0; }
+    buffer_handle_t getFbHandle(int subIndex) { return 0; }
+    void putFbHandle() {}
+private:
+    VideoPayloadBuffer *mPayload;
+};
+
+class SetupBench {
+public:
+    virtual ~SetupBench() {}
+    virtual const char* getName() const = 0;
+    virtual void setCase(int modeWidth, int modeHeight, int transform,
+                         int x, int y, int w, int h) = 0;
+    virtual bool run(int routine, BufferMapper& mapper, int iteration) = 0;
+};
+
+// the setup routines of Plane with the back buffer and display mode
+// they expect, the plane itself is never initialized
+template <class Plane>
+class PlaneSetupBench : public Plane, public SetupBench {
+public:
+    PlaneSetupBench(const char *name)
+        : Plane(0, 0),
+          mName(name)
+    {
+        OverlayBackBuffer *backBuffer =
+            (OverlayBackBuffer *)calloc(1, sizeof(OverlayBackBuffer));
+        backBuffer->buf = (OverlayBackBufferBlk *)
+            memalign(64, sizeof(OverlayBackBufferBlk));
+        backBuffer->gttOffsetInPage = 0;
+        backBuffer->slot = -1;
+        this->mBackBuffer[0] = backBuffer;
+        this->mCurrent = 0;
+        this->mBackBufferCount = 1;
+        this->resetBackBuffer(0);
+    }
+
+    virtual ~PlaneSetupBench()
+    {
+        free(this->mBackBuffer[0]->buf);
+        free(this->mBackBuffer[0]);
+        this->mBackBuffer[0] = 0;
+    }
+
+    const char* getName() const { return mName; }
+
+    void setCase(int modeWidth, int modeHeight, int transform,
+                 int x, int y, int w, int h)
+    {
+        memset(&this->mModeInfo, 0, sizeof(this->mModeInfo));
+        this->mModeInfo.hdisplay = modeWidth;
+        this->mModeInfo.vdisplay = modeHeight;
+        this->setTransform(transform);
+        this->setPosition(x, y, w, h);
+        mCaseTransform = transform;
+        mWidth = w;
+        mHeight = h;
+    }
+
+    bool run(int routine, BufferMapper& mapper, int iteration)
+    {
+        switch (routine) {
+        case ROUTINE_OFFSET:
+            return this->bufferOffsetSetup(mapper);
+        case ROUTINE_COORDINATE:
+            return this->coordinateSetup(mapper);
+        case ROUTINE_SCALE:
+            return this->scalingSetup(mapper);
+        case ROUTINE_RESCALE:
+            this->mPosition.w = mWidth - (iteration & 1) * 2;
+            return this->scalingSetup(mapper);
+        case ROUTINE_COLOR:
+            return this->colorSetup(mapper);
+        case ROUTINE_GEOMETRY:
+            return updateGeometry(iteration);
+        default:
+            return false;
+        }
+    }
+
+    // cost of a coefficient set computed from scratch and from the cache
+    void timeCoeff(int iterations, nsecs_t& computed, nsecs_t& cached)
+    {
+        coeffRec coeff[MAX_TAPS * N_PHASES];
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < iterations; i++) {
+            this->computeCoeff(N_HORIZ_Y_TAPS, 1.5, true, true, coeff);
+        }
+        computed = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / iterations;
+
+        this->updateCoeff(N_HORIZ_Y_TAPS, 1.5, true, true, coeff);
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < iterations; i++) {
+            this->updateCoeff(N_HORIZ_Y_TAPS, 1.5, true, true, coeff);
+        }
+        cached = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / iterations;
+    }
+
+private:
+    // as HwcLayer::update() does it, every other call moves the plane
+    bool updateGeometry(int iteration)
+    {
+        DisplayPlane *plane = this;
+        int x = iteration & 1;
+        plane->setPosition(x, 0, mWidth, mHeight);
+        plane->setSourceCrop(x, 0, mWidth, mHeight);
+        plane->setTransform(mCaseTransform);
+        plane->setPlaneAlpha(0xff, HWC_BLENDING_NONE);
+        return true;
+    }
+
+    const char *mName;
+    int mWidth;
+    int mHeight;
+    int mCaseTransform;
+};
+
+struct BenchFormat {
+    const char *name;
+    uint32_t format;
+};
+
+static const BenchFormat sFormats[] = {
+    { "NV12", HAL_PIXEL_FORMAT_NV12 },
+    { "YV12", HAL_PIXEL_FORMAT_YV12 },
+    { "YUY2", HAL_PIXEL_FORMAT_YUY2 },
+    { "NV12v", OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar },
+    { "NV12t", OMX_INTEL_COLOR_FormatYUV420PackedSemiPlanar_Tiled },
+};
+
+struct BenchCrop {
+    const char *name;
+    int x, y, w, h;
+};
+
+// of a 1920x1080 source
+static const BenchCrop sCrops[] = {
+    { "full", 0, 0, 1920, 1080 },
+    { "inset", 64, 36, 1792, 1008 },
+    { "odd", 3, 5, 1277, 719 },
+};
+
+static const float sScales[] = { 0.5f, 1.0f, 1.5f, 2.0f };
+
+static const int sTransforms[] = {
+    0, HWC_TRANSFORM_ROT_90, HWC_TRANSFORM_ROT_180, HWC_TRANSFORM_ROT_270,
+};
+
+// same strides as GrallocBufferBase
+static void setStride(DataBuffer& buffer, uint32_t format, uint32_t width)
+{
+    stride_t stride;
+    memset(&stride, 0, sizeof(stride));
+    switch (format) {
+    case HAL_PIXEL_FORMAT_YV12:
+        stride.yuv.yStride = align_to(align_to(width, 32), 64);
+        stride.yuv.uvStride = align_to(stride.yuv.yStride >> 1, 64);
+        break;
+    case HAL_PIXEL_FORMAT_YUY2:
+        stride.yuv.yStride = align_to(align_to(width, 32) << 1, 64);
+        break;
+    default:
+        stride.yuv.yStride = align_to(align_to(width, 32), 64);
+        stride.yuv.uvStride = stride.yuv.yStride;
+        break;
+    }
+    buffer.setStride(stride);
+}
+
+static nsecs_t timeRoutine(SetupBench& bench, int routine,
+                           BufferMapper& mapper, int iterations, bool& ok)
+{
+    // the first call fills the back buffer the way the later ones find it
+    ok = bench.run(routine, mapper, 0);
+    if (!ok) {
+        return 0;
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 1; i <= iterations; i++) {
+        bench.run(routine, mapper, i);
+    }
+    return (systemTime(SYSTEM_TIME_MONOTONIC) - start) / iterations;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-n iterations] [-c results.csv]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+    const char *csvPath = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'c':
+            csvPath = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *csv = NULL;
+    if (csvPath) {
+        csv = fopen(csvPath, "w");
+        if (!csv) {
+            printf("failed to open %s\n", csvPath);
+            return 1;
+        }
+        fprintf(csv, "plane,format,crop,scale,transform");
+        for (int r = 0; r < ROUTINE_COUNT; r++) {
+            fprintf(csv, ",%s_ns", sRoutineNames[r]);
+        }
+        fprintf(csv, "\n");
+    }
+
+    PlaneSetupBench<TngOverlayPlane> tangier("tng");
+    PlaneSetupBench<AnnOverlayPlane> anniedale("ann");
+    SetupBench *benches[] = { &tangier, &anniedale };
+
+    VideoPayloadBuffer payload;
+    memset(&payload, 0, sizeof(payload));
+
+    printf("%-4s %-6s %-6s %-5s %-4s", "", "format", "crop", "scale", "rot");
+    for (int r = 0; r < ROUTINE_COUNT; r++) {
+        printf(" %8s", sRoutineNames[r]);
+    }
+    printf("   (ns per call)\n");
+
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        SetupBench& bench = *benches[b];
+        nsecs_t total[ROUTINE_COUNT];
+        int cases[ROUTINE_COUNT];
+        memset(total, 0, sizeof(total));
+        memset(cases, 0, sizeof(cases));
+
+        for (size_t f = 0; f < sizeof(sFormats) / sizeof(sFormats[0]); f++)
+        for (size_t c = 0; c < sizeof(sCrops) / sizeof(sCrops[0]); c++)
+        for (size_t s = 0; s < sizeof(sScales) / sizeof(sScales[0]); s++)
+        for (size_t t = 0; t < sizeof(sTransforms) / sizeof(sTransforms[0]); t++) {
+            const BenchCrop& crop = sCrops[c];
+            DataBuffer buffer(0);
+            buffer.setFormat(sFormats[f].format);
+            buffer.setWidth(1920);
+            buffer.setHeight(1080);
+            buffer.setCrop(crop.x, crop.y, crop.w, crop.h);
+            setStride(buffer, sFormats[f].format, 1920);
+            BenchMapper mapper(buffer, &payload);
+
+            bool rotated = sTransforms[t] == HWC_TRANSFORM_ROT_90 ||
+                           sTransforms[t] == HWC_TRANSFORM_ROT_270;
+            int w = (int)((rotated ? crop.h : crop.w) * sScales[s]);
+            int h = (int)((rotated ? crop.w : crop.h) * sScales[s]);
+            // large enough that the position is never clipped
+            bench.setCase(4096, 4096, sTransforms[t], 0, 0, w, h);
+
+            printf("%-4s %-6s %-6s %-5.1f %-4d", bench.getName(),
+                   sFormats[f].name, crop.name, sScales[s], sTransforms[t]);
+            if (csv) {
+                fprintf(csv, "%s,%s,%s,%.1f,%d", bench.getName(),
+                        sFormats[f].name, crop.name, sScales[s], sTransforms[t]);
+            }
+            for (int r = 0; r < ROUTINE_COUNT; r++) {
+                bool ok;
+                nsecs_t cost = timeRoutine(bench, r, mapper, iterations, ok);
+                if (ok) {
+                    printf(" %8lld", cost);
+                    total[r] += cost;
+                    cases[r]++;
+                } else {
+                    printf(" %8s", "-");
+                }
+                if (csv) {
+                    if (ok) {
+                        fprintf(csv, ",%lld", cost);
+                    } else {
+                        fprintf(csv, ",");
+                    }
+                }
+            }
+            printf("\n");
+            if (csv) {
+                fprintf(csv, "\n");
+            }
+        }
+
+        printf("%s average:", bench.getName());
+        for (int r = 0; r < ROUTINE_COUNT; r++) {
+            printf(" %s %lld ns", sRoutineNames[r],
+                   cases[r] ? total[r] / cases[r] : 0);
+        }
+        printf("\n\n");
+    }
+
+    nsecs_t computed, cached;
+    tangier.timeCoeff(iterations, computed, cached);
+    printf("coefficients: %lld ns computed, %lld ns from the cache\n",
+           computed, cached);
+
+    if (csv) {
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,854 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Fuzzer of the plane assignment on the mock platform. Random layer stacks
+// go through HwcLayerList::initialize() against the plane manager of the
+// platform, and every assignment is checked:
+//
+//   - a plane is attached to one layer at most
+//   - overlay and cursor layers have a plane, the frame buffer target one
+//     as soon as a layer is left to GLES
+//   - YUV layers are only on overlay planes, cursor planes only hold
+//     cursor layers
+//   - overlapping layers keep their order once on planes, the frame buffer
+//     target standing in for the GLES layers
+//   - the final z order config is accepted by the plane manager
+//   - a memoized assignment replays to the same composition
+//   - every plane is back with the manager once the list is gone
+//
+//   plane_fuzzer [-n stacks] [-l layers] [-s seed] [-d display] [-v]
+//                [-c stacks.csv]
+//
+// Stacks have one to -l layers plus the frame buffer target. -d 1 fuzzes
+// the HDMI pipe, connected at 1920x1080. The seed is printed so that a
+// failure can be replayed, -v prints every failing stack instead of the
+// first ones. Initialize time and the share of layers offloaded to planes
+// are reported per number of layers; the exit status is non zero if any
+// check failed.
+//
+// plane_fuzzer runs the Tangier planes, plane_fuzzer_ann the Anniedale
+// ones.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <hardware/hardware.h>
+#include <hardware/hwcomposer.h>
+#include <utils/KeyedVector.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <hal_public.h>
+#include <Hwcomposer.h>
+#include <IDisplayDevice.h>
+#include <DisplayPlane.h>
+#include <DisplayPlaneManager.h>
+#include <DisplayQuery.h>
+#include <DrmConfig.h>
+#include <HwcLayerList.h>
+#include <PlaneAssignmentCache.h>
+#include <UeventObserver.h>
+#include <MockBufferManager.h>
+#include <MockDrm.h>
+
+using namespace android;
+using namespace android::intel;
+
+// defined by HwcModule.cpp of the mock platform
+extern hwc_module_t HAL_MODULE_INFO_SYM;
+
+enum {
+    MAX_LAYERS = 32,
+    // failing stacks printed without -v
+    MAX_REPORTED = 10,
+    HOTPLUG_TIMEOUT_MS = 1000,
+};
+
+// stacks of one number of layers
+struct FuzzBucket {
+    FuzzBucket() : stacks(0), layers(0), offloaded(0), fallbackStacks(0) {}
+    Vector<int64_t> initialize;
+    Vector<int64_t> replay;
+    uint32_t stacks;
+    uint32_t layers;
+    uint32_t offloaded;
+    uint32_t fallbackStacks;
+};
+
+struct FuzzOptions {
+    int stacks;
+    int layers;
+    uint32_t seed;
+    int display;
+    bool verbose;
+    const char *csvPath;
+};
+
+class PlaneFuzzer {
+public:
+    PlaneFuzzer(const FuzzOptions& options);
+    ~PlaneFuzzer();
+
+public:
+    bool open();
+    bool run();
+    void report();
+
+private:
+    static void invalidate(const struct hwc_procs *procs) {}
+    static void vsync(const struct hwc_procs *procs, int disp, int64_t timestamp) {}
+    static void hotplug(const struct hwc_procs *procs, int disp, int connected);
+
+    uint32_t random();
+    uint32_t random(uint32_t range) { return random() % range; }
+    bool connectExternal();
+    buffer_handle_t getBuffer(uint32_t format, uint32_t width, uint32_t height);
+    bool setLayer(hwc_layer_1_t& layer);
+    hwc_display_contents_1_t* buildStack(int numLayers);
+    void resetStack(hwc_display_contents_1_t *list);
+    void getFreePlanes(int *planes);
+    int check(int stack, hwc_display_contents_1_t *list, HwcLayerList& layerList);
+    int checkReplay(int stack, hwc_display_contents_1_t *list, HwcLayerList& layerList,
+                    const Vector<int32_t>& composition);
+    void getComposition(hwc_display_contents_1_t *list, HwcLayerList& layerList,
+                        Vector<int32_t>& composition);
+    void fail(int stack, const char *fmt, ...);
+    void dumpStack(hwc_display_contents_1_t *list, HwcLayerList& layerList);
+    static bool isOverlapping(const hwc_rect_t& a, const hwc_rect_t& b);
+    static void getPercentiles(Vector<int64_t>& costs,
+                               int64_t *p50, int64_t *p99, int64_t *max);
+
+private:
+    FuzzOptions mOptions;
+    hwc_composer_device_1_t *mDevice;
+    hwc_procs_t mProcs;
+    MockDrm *mDrm;
+    DisplayPlaneManager *mPlaneManager;
+    PlaneAssignmentCache mCache;
+    uint32_t mState;
+    int mWidth;
+    int mHeight;
+    // mock buffers by format and size
+    KeyedVector<uint64_t, buffer_handle_t> mBuffers;
+    buffer_handle_t mTarget;
+    KeyedVector<int, FuzzBucket*> mBuckets;
+    uint32_t mPlaneUse[DisplayPlane::PLANE_MAX];
+    uint32_t mFailures;
+    uint32_t mFailedStacks;
+    int mLastFailedStack;
+    FILE *mCsv;
+
+    static volatile int32_t sExternalConnected;
+};
+
+volatile int32_t PlaneFuzzer::sExternalConnected = 0;
+
+PlaneFuzzer::PlaneFuzzer(const FuzzOptions& options)
+    : mOptions(options),
+      mDevice(NULL),
+      mDrm(NULL),
+      mPlaneManager(NULL),
+      mState(options.seed ? options.seed : 1),
+      mWidth(0),
+      mHeight(0),
+      mTarget(NULL),
+      mFailures(0),
+      mFailedStacks(0),
+      mLastFailedStack(-1),
+      mCsv(NULL)
+{
+    memset(&mProcs, 0, sizeof(mProcs));
+    memset(mPlaneUse, 0, sizeof(mPlaneUse));
+}
+
+PlaneFuzzer::~PlaneFuzzer()
+{
+    if (mDevice) {
+        hwc_close_1(mDevice);
+    }
+    for (size_t i = 0; i < mBuffers.size(); i++) {
+        MockBuffer::free(mBuffers.valueAt(i));
+    }
+    if (mTarget) {
+        MockBuffer::free(mTarget);
+    }
+    for (size_t i = 0; i < mBuckets.size(); i++) {
+        delete mBuckets.valueAt(i);
+    }
+    if (mCsv) {
+        fclose(mCsv);
+    }
+}
+
+void PlaneFuzzer::hotplug(const struct hwc_procs *procs, int disp, int connected)
+{
+    if (disp == HWC_DISPLAY_EXTERNAL) {
+        android_atomic_release_store(connected ? 1 : 0, &sExternalConnected);
+    }
+}
+
+uint32_t PlaneFuzzer::random()
+{
+    // xorshift32, the same stacks for a seed on every target
+    mState ^= mState << 13;
+    mState ^= mState >> 17;
+    mState ^= mState << 5;
+    return mState;
+}
+
+bool PlaneFuzzer::connectExternal()
+{
+    mDrm->setOutput(IDisplayDevice::DEVICE_EXTERNAL, "1920x1080@60");
+    Hwcomposer::getInstance().getUeventObserver()->notify(
+        DrmConfig::getHotplugString());
+
+    for (int i = 0; i < HOTPLUG_TIMEOUT_MS; i++) {
+        if (android_atomic_acquire_load(&sExternalConnected)) {
+            return true;
+        }
+        usleep(1000);
+    }
+    printf("HDMI did not connect\n");
+    return false;
+}
+
+bool PlaneFuzzer::open()
+{
+    int err = hwc_open_1(&HAL_MODULE_INFO_SYM.common, &mDevice);
+    if (err) {
+        printf("failed to open hwcomposer: %d\n", err);
+        mDevice = NULL;
+        return false;
+    }
+
+    mProcs.invalidate = invalidate;
+    mProcs.vsync = vsync;
+    mProcs.hotplug = hotplug;
+    mDevice->registerProcs(mDevice, &mProcs);
+
+    // the mock platform is linked in, its drm is a MockDrm
+    Hwcomposer& hwc = Hwcomposer::getInstance();
+    mDrm = static_cast<MockDrm *>(hwc.getDrm());
+    mPlaneManager = hwc.getPlaneManager();
+    if (mOptions.display == IDisplayDevice::DEVICE_EXTERNAL && !connectExternal()) {
+        return false;
+    }
+
+    drmModeModeInfo mode;
+    if (!mDrm->getModeInfo(mOptions.display, mode)) {
+        printf("display %d is not connected\n", mOptions.display);
+        return false;
+    }
+    mWidth = mode.hdisplay;
+    mHeight = mode.vdisplay;
+
+    mTarget = MockBuffer::allocate(mWidth, mHeight, HAL_PIXEL_FORMAT_RGBA_8888,
+                                   GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_RENDER);
+    if (!mTarget) {
+        printf("failed to allocate the frame buffer target\n");
+        return false;
+    }
+
+    if (mOptions.csvPath) {
+        mCsv = fopen(mOptions.csvPath, "w");
+        if (!mCsv) {
+            printf("failed to open %s\n", mOptions.csvPath);
+            return false;
+        }
+        fprintf(mCsv, "stack,layers,initialize_us,replay_us,offloaded,"
+                "sprite,overlay,primary,cursor,failures\n");
+    }
+    return true;
+}
+
+buffer_handle_t PlaneFuzzer::getBuffer(uint32_t format, uint32_t width, uint32_t height)
+{
+    uint64_t key = ((uint64_t)format << 32) | (width << 16) | height;
+    ssize_t index = mBuffers.indexOfKey(key);
+    if (index >= 0) {
+        return mBuffers.valueAt(index);
+    }
+
+    buffer_handle_t handle = MockBuffer::allocate(width, height, format,
+        GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE);
+    if (!handle) {
+        printf("failed to allocate a %ux%u buffer of format %#x\n",
+               width, height, format);
+        return NULL;
+    }
+    mBuffers.add(key, handle);
+    return handle;
+}
+
+bool PlaneFuzzer::setLayer(hwc_layer_1_t& layer)
+{
+    static const uint32_t rgbFormats[] = {
+        HAL_PIXEL_FORMAT_RGBA_8888,
+        HAL_PIXEL_FORMAT_RGBA_8888,
+        HAL_PIXEL_FORMAT_BGRA_8888,
+        HAL_PIXEL_FORMAT_RGBX_8888,
+        HAL_PIXEL_FORMAT_RGB_565,
+    };
+    static const uint32_t yuvFormats[] = {
+        HAL_PIXEL_FORMAT_NV12,
+        HAL_PIXEL_FORMAT_YV12,
+    };
+    static const uint32_t videoSizes[][2] = {
+        { 1920, 1080 }, { 1280, 720 }, { 720, 480 }, { 320, 240 },
+    };
+    static const uint32_t transforms[] = {
+        HAL_TRANSFORM_FLIP_H, HAL_TRANSFORM_FLIP_V, HAL_TRANSFORM_ROT_90,
+        HAL_TRANSFORM_ROT_180, HAL_TRANSFORM_ROT_270,
+    };
+    const uint32_t numRgb = sizeof(rgbFormats) / sizeof(rgbFormats[0]);
+    const uint32_t numVideo = sizeof(videoSizes) / sizeof(videoSizes[0]);
+
+    // one layer in six a video, one in eight a cursor, the others windows
+    uint32_t format, width, height;
+    uint32_t kind = random(48);
+    if (kind < 8) {
+        uint32_t size = random(numVideo);
+        format = yuvFormats[random(2)];
+        width = videoSizes[size][0];
+        height = videoSizes[size][1];
+    } else if (kind < 14) {
+        format = HAL_PIXEL_FORMAT_RGBA_8888;
+        width = height = random(2) ? 64 : 128;
+    } else if (kind < 20) {
+        format = rgbFormats[random(numRgb)];
+        width = mWidth;
+        height = mHeight;
+    } else {
+        format = rgbFormats[random(numRgb)];
+        width = 16 << random(5);
+        height = 16 << random(5);
+        width = width > (uint32_t)mWidth ? mWidth : width;
+        height = height > (uint32_t)mHeight ? mHeight : height;
+    }
+
+    buffer_handle_t handle = getBuffer(format, width, height);
+    if (!handle) {
+        return false;
+    }
+
+    memset(&layer, 0, sizeof(layer));
+    layer.compositionType = HWC_FRAMEBUFFER;
+    layer.handle = handle;
+    if (format == HAL_PIXEL_FORMAT_RGBA_8888 || format == HAL_PIXEL_FORMAT_BGRA_8888) {
+        layer.blending = random(4) ? HWC_BLENDING_PREMULT : HWC_BLENDING_COVERAGE;
+    } else {
+        layer.blending = HWC_BLENDING_NONE;
+    }
+    layer.planeAlpha = random(8) ? 0xff : random(0xff);
+    layer.transform = random(8) ? 0 : transforms[random(5)];
+
+    // the whole buffer or a part of at least 16x16
+    uint32_t cropWidth = width, cropHeight = height;
+    uint32_t cropX = 0, cropY = 0;
+    if (!random(3) && width > 16 && height > 16) {
+        cropWidth = 16 + random(width - 16);
+        cropHeight = 16 + random(height - 16);
+        cropX = random(width - cropWidth + 1);
+        cropY = random(height - cropHeight + 1);
+    }
+    layer.sourceCropf.left = cropX;
+    layer.sourceCropf.top = cropY;
+    layer.sourceCropf.right = cropX + cropWidth;
+    layer.sourceCropf.bottom = cropY + cropHeight;
+
+    // scaled by a quarter to twice, full screen now and then, and a few
+    // windows hanging off the screen
+    int frameWidth, frameHeight;
+    if (!random(8)) {
+        frameWidth = mWidth;
+        frameHeight = mHeight;
+    } else {
+        frameWidth = cropWidth * (1 + random(8)) / 4;
+        frameHeight = cropHeight * (1 + random(8)) / 4;
+        frameWidth = frameWidth < 1 ? 1 : (frameWidth > mWidth ? mWidth : frameWidth);
+        frameHeight = frameHeight < 1 ? 1 : (frameHeight > mHeight ? mHeight : frameHeight);
+    }
+    int x = random(mWidth - frameWidth + 1);
+    int y = random(mHeight - frameHeight + 1);
+    if (!random(16)) {
+        x -= frameWidth / 2;
+        y += frameHeight / 2;
+    }
+    layer.displayFrame.left = x;
+    layer.displayFrame.top = y;
+    layer.displayFrame.right = x + frameWidth;
+    layer.displayFrame.bottom = y + frameHeight;
+    layer.visibleRegionScreen.numRects = 1;
+    layer.visibleRegionScreen.rects = &layer.displayFrame;
+    layer.acquireFenceFd = -1;
+    layer.releaseFenceFd = -1;
+    return true;
+}
+
+hwc_display_contents_1_t* PlaneFuzzer::buildStack(int numLayers)
+{
+    size_t size = sizeof(hwc_display_contents_1_t) +
+                  (numLayers + 1) * sizeof(hwc_layer_1_t);
+    hwc_display_contents_1_t *list = (hwc_display_contents_1_t *)calloc(1, size);
+    if (!list) {
+        return NULL;
+    }
+    list->retireFenceFd = -1;
+    list->outbufAcquireFenceFd = -1;
+    list->flags = HWC_GEOMETRY_CHANGED;
+    list->numHwLayers = numLayers + 1;
+
+    for (int i = 0; i < numLayers; i++) {
+        if (!setLayer(list->hwLayers[i])) {
+            free(list);
+            return NULL;
+        }
+    }
+
+    hwc_layer_1_t& target = list->hwLayers[numLayers];
+    memset(&target, 0, sizeof(target));
+    target.compositionType = HWC_FRAMEBUFFER_TARGET;
+    target.handle = mTarget;
+    target.blending = HWC_BLENDING_PREMULT;
+    target.planeAlpha = 0xff;
+    target.sourceCropf.right = mWidth;
+    target.sourceCropf.bottom = mHeight;
+    target.displayFrame.right = mWidth;
+    target.displayFrame.bottom = mHeight;
+    target.visibleRegionScreen.numRects = 1;
+    target.visibleRegionScreen.rects = &target.displayFrame;
+    target.acquireFenceFd = -1;
+    target.releaseFenceFd = -1;
+    return list;
+}
+
+void PlaneFuzzer::resetStack(hwc_display_contents_1_t *list)
+{
+    // as SurfaceFlinger hands the same stack again
+    for (size_t i = 0; i + 1 < list->numHwLayers; i++) {
+        list->hwLayers[i].compositionType = HWC_FRAMEBUFFER;
+        list->hwLayers[i].hints = 0;
+    }
+}
+
+void PlaneFuzzer::getFreePlanes(int *planes)
+{
+    for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+        planes[i] = mPlaneManager->getFreePlanes(mOptions.display, i);
+    }
+}
+
+bool PlaneFuzzer::isOverlapping(const hwc_rect_t& a, const hwc_rect_t& b)
+{
+    return a.left < b.right && b.left < a.right &&
+           a.top < b.bottom && b.top < a.bottom;
+}
+
+void PlaneFuzzer::fail(int stack, const char *fmt, ...)
+{
+    mFailures++;
+    if (stack != mLastFailedStack) {
+        mFailedStacks++;
+        mLastFailedStack = stack;
+    }
+    if (!mOptions.verbose && mFailedStacks > MAX_REPORTED) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    printf("stack %d: ", stack);
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+}
+
+void PlaneFuzzer::dumpStack(hwc_display_contents_1_t *list, HwcLayerList& layerList)
+{
+    if (!mOptions.verbose && mFailedStacks > MAX_REPORTED) {
+        return;
+    }
+
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        const hwc_layer_1_t& layer = list->hwLayers[i];
+        BufferAttributes attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        Hwcomposer::getInstance().getBufferManager()->getBufferAttributes(layer.handle,
+                                                                          attributes);
+        printf("  layer %2u: type %d, format %#x, crop (%d,%d %dx%d), frame (%d,%d %dx%d), "
+               "transform %d, blending %#x, alpha %d\n",
+               i, layer.compositionType, attributes.format,
+               (int)layer.sourceCropf.left, (int)layer.sourceCropf.top,
+               (int)(layer.sourceCropf.right - layer.sourceCropf.left),
+               (int)(layer.sourceCropf.bottom - layer.sourceCropf.top),
+               layer.displayFrame.left, layer.displayFrame.top,
+               layer.displayFrame.right - layer.displayFrame.left,
+               layer.displayFrame.bottom - layer.displayFrame.top,
+               layer.transform, layer.blending, layer.planeAlpha);
+    }
+
+    char buf[4096];
+    memset(buf, 0, sizeof(buf));
+    Dump d(buf, sizeof(buf));
+    layerList.dump(d);
+    printf("%s", buf);
+}
+
+int PlaneFuzzer::check(int stack, hwc_display_contents_1_t *list, HwcLayerList& layerList)
+{
+    uint32_t failures = mFailures;
+    size_t numLayers = list->numHwLayers - 1;
+    DisplayPlane *target = layerList.getPlane(numLayers);
+    bool hasFBLayers = false;
+
+    for (size_t i = 0; i < numLayers; i++) {
+        const hwc_layer_1_t& layer = list->hwLayers[i];
+        DisplayPlane *plane = layerList.getPlane(i);
+
+        if (layer.compositionType == HWC_FRAMEBUFFER) {
+            hasFBLayers = true;
+            if (plane) {
+                fail(stack, "GLES layer %u has plane %d type %d",
+                     i, plane->getIndex(), plane->getType());
+            }
+            continue;
+        }
+
+        if (layer.compositionType != HWC_OVERLAY &&
+            layer.compositionType != HWC_CURSOR_OVERLAY) {
+            fail(stack, "layer %u has composition type %d", i, layer.compositionType);
+            continue;
+        }
+        if (!plane) {
+            fail(stack, "layer %u is composed by a plane but has none", i);
+            continue;
+        }
+
+        for (size_t j = i + 1; j <= numLayers; j++) {
+            if (layerList.getPlane(j) == plane) {
+                fail(stack, "plane %d type %d is attached to layers %u and %u",
+                     plane->getIndex(), plane->getType(), i, j);
+            }
+        }
+
+        BufferAttributes attributes;
+        if (Hwcomposer::getInstance().getBufferManager()->getBufferAttributes(layer.handle,
+                                                                              attributes) &&
+            DisplayQuery::isVideoFormat(attributes.format) &&
+            plane->getType() != DisplayPlane::PLANE_OVERLAY) {
+            fail(stack, "YUV layer %u is on plane type %d", i, plane->getType());
+        }
+        if ((plane->getType() == DisplayPlane::PLANE_CURSOR) !=
+            (layer.compositionType == HWC_CURSOR_OVERLAY)) {
+            fail(stack, "layer %u of type %d is on plane type %d",
+                 i, layer.compositionType, plane->getType());
+        }
+    }
+
+    if (hasFBLayers && !target) {
+        fail(stack, "GLES layers but no plane for the frame buffer target");
+        return mFailures - failures;
+    }
+
+    // overlapping layers must stack in list order, GLES layers at the z
+    // order of the frame buffer target
+    for (size_t i = 0; i < numLayers; i++) {
+        DisplayPlane *lower = layerList.getPlane(i);
+        bool lowerFB = list->hwLayers[i].compositionType == HWC_FRAMEBUFFER;
+        if (!lower && !lowerFB) {
+            continue;
+        }
+        for (size_t j = i + 1; j < numLayers; j++) {
+            DisplayPlane *upper = layerList.getPlane(j);
+            bool upperFB = list->hwLayers[j].compositionType == HWC_FRAMEBUFFER;
+            if ((lowerFB && upperFB) || (!upper && !upperFB) ||
+                !isOverlapping(list->hwLayers[i].displayFrame,
+                               list->hwLayers[j].displayFrame)) {
+                continue;
+            }
+            int lowerZ = (lowerFB ? target : lower)->getZOrder();
+            int upperZ = (upperFB ? target : upper)->getZOrder();
+            if (lowerZ >= upperZ) {
+                fail(stack, "layer %u at z %d is not below overlapping layer %u at z %d",
+                     i, lowerZ, j, upperZ);
+            }
+        }
+    }
+
+    // the hardware sees the planes by z order, whatever path assigned them
+    ZOrderConfig config;
+    ZOrderLayer zlayers[MAX_LAYERS + 1];
+    for (size_t i = 0; i <= numLayers; i++) {
+        DisplayPlane *plane = layerList.getPlane(i);
+        if (!plane) {
+            continue;
+        }
+        ZOrderLayer& zlayer = zlayers[config.size()];
+        zlayer.planeType = plane->getType();
+        zlayer.zorder = plane->getZOrder();
+        zlayer.plane = plane;
+        config.add(&zlayer);
+    }
+    if (config.size() && !mPlaneManager->isValidZOrder(mOptions.display, config)) {
+        fail(stack, "z order config of %u planes rejected by the plane manager",
+             config.size());
+    }
+
+    return mFailures - failures;
+}
+
+void PlaneFuzzer::getComposition(hwc_display_contents_1_t *list, HwcLayerList& layerList,
+                                 Vector<int32_t>& composition)
+{
+    composition.clear();
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        DisplayPlane *plane = layerList.getPlane(i);
+        composition.push_back(list->hwLayers[i].compositionType);
+        composition.push_back(plane ? plane->getType() : -1);
+        composition.push_back(plane ? plane->getZOrder() : -1);
+    }
+}
+
+int PlaneFuzzer::checkReplay(int stack, hwc_display_contents_1_t *list, HwcLayerList& layerList,
+                             const Vector<int32_t>& composition)
+{
+    Vector<int32_t> replayed;
+    getComposition(list, layerList, replayed);
+    for (size_t i = 0; i < list->numHwLayers; i++) {
+        if (composition[i * 3] != replayed[i * 3] ||
+            composition[i * 3 + 1] != replayed[i * 3 + 1] ||
+            composition[i * 3 + 2] != replayed[i * 3 + 2]) {
+            fail(stack, "replay puts layer %u on plane type %d at z %d (type %d), "
+                 "first on plane type %d at z %d (type %d)", i,
+                 replayed[i * 3 + 1], replayed[i * 3 + 2], replayed[i * 3],
+                 composition[i * 3 + 1], composition[i * 3 + 2], composition[i * 3]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool PlaneFuzzer::run()
+{
+    for (int stack = 0; stack < mOptions.stacks; stack++) {
+        int numLayers = 1 + random(mOptions.layers);
+        hwc_display_contents_1_t *list = buildStack(numLayers);
+        if (!list) {
+            return false;
+        }
+
+        int freeBefore[DisplayPlane::PLANE_MAX];
+        int freeAfter[DisplayPlane::PLANE_MAX];
+        getFreePlanes(freeBefore);
+
+        // cold, then replayed from the assignment cache
+        int failures = 0;
+        int64_t costs[2] = { 0, 0 };
+        Vector<int32_t> composition;
+        uint32_t offloaded = 0;
+        uint32_t planeUse[DisplayPlane::PLANE_MAX];
+        memset(planeUse, 0, sizeof(planeUse));
+        for (int pass = 0; pass < 2; pass++) {
+            resetStack(list);
+            HwcLayerList layerList(list, mOptions.display, &mCache);
+            nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+            bool ok = layerList.initialize();
+            costs[pass] = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+            if (!ok) {
+                fail(stack, "initialize failed");
+                failures++;
+            } else if (pass == 0) {
+                failures += check(stack, list, layerList);
+                getComposition(list, layerList, composition);
+                for (int i = 0; i < numLayers; i++) {
+                    DisplayPlane *plane = layerList.getPlane(i);
+                    if (plane) {
+                        offloaded++;
+                        planeUse[plane->getType()]++;
+                    }
+                }
+            } else {
+                failures += checkReplay(stack, list, layerList, composition);
+            }
+            if (failures) {
+                dumpStack(list, layerList);
+            }
+            layerList.deinitialize();
+            if (failures) {
+                break;
+            }
+        }
+
+        getFreePlanes(freeAfter);
+        for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+            if (freeAfter[i] != freeBefore[i]) {
+                fail(stack, "%d free planes of type %d, %d before the stack",
+                     freeAfter[i], i, freeBefore[i]);
+                failures++;
+            }
+        }
+
+        ssize_t index = mBuckets.indexOfKey(numLayers);
+        FuzzBucket *bucket;
+        if (index < 0) {
+            bucket = new FuzzBucket();
+            mBuckets.add(numLayers, bucket);
+        } else {
+            bucket = mBuckets.valueAt(index);
+        }
+        bucket->initialize.push_back(costs[0]);
+        bucket->replay.push_back(costs[1]);
+        bucket->stacks++;
+        bucket->layers += numLayers;
+        bucket->offloaded += offloaded;
+        if (offloaded < (uint32_t)numLayers) {
+            bucket->fallbackStacks++;
+        }
+        for (int i = 0; i < DisplayPlane::PLANE_MAX; i++) {
+            mPlaneUse[i] += planeUse[i];
+        }
+
+        if (mCsv) {
+            fprintf(mCsv, "%d,%d,%lld,%lld,%u,%u,%u,%u,%u,%d\n", stack, numLayers,
+                    ns2us(costs[0]), ns2us(costs[1]), offloaded,
+                    planeUse[DisplayPlane::PLANE_SPRITE],
+                    planeUse[DisplayPlane::PLANE_OVERLAY],
+                    planeUse[DisplayPlane::PLANE_PRIMARY],
+                    planeUse[DisplayPlane::PLANE_CURSOR], failures);
+        }
+        free(list);
+    }
+    return mFailures == 0;
+}
+
+static int compareCost(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void PlaneFuzzer::getPercentiles(Vector<int64_t>& costs,
+                                 int64_t *p50, int64_t *p99, int64_t *max)
+{
+    *p50 = *p99 = *max = 0;
+    size_t n = costs.size();
+    if (n == 0) {
+        return;
+    }
+    qsort(costs.editArray(), n, sizeof(int64_t), compareCost);
+    *p50 = ns2us(costs[n / 2]);
+    *p99 = ns2us(costs[(n * 99) / 100]);
+    *max = ns2us(costs[n - 1]);
+}
+
+void PlaneFuzzer::report()
+{
+    printf("display %d (%dx%d), seed %u\n", mOptions.display, mWidth, mHeight,
+           mOptions.seed);
+    printf("%-6s %6s %22s %22s %9s %9s\n", "layers", "stacks",
+           "initialize p50/p99/max", "replay p50/p99/max", "offload", "fb stacks");
+    for (size_t i = 0; i < mBuckets.size(); i++) {
+        FuzzBucket *bucket = mBuckets.valueAt(i);
+        int64_t p50, p99, max, r50, r99, rmax;
+        getPercentiles(bucket->initialize, &p50, &p99, &max);
+        getPercentiles(bucket->replay, &r50, &r99, &rmax);
+        char initialize[32], replay[32];
+        snprintf(initialize, sizeof(initialize), "%lld/%lld/%lld", p50, p99, max);
+        snprintf(replay, sizeof(replay), "%lld/%lld/%lld", r50, r99, rmax);
+        printf("%-6d %6u %22s %22s %8.1f%% %8.1f%%\n",
+               mBuckets.keyAt(i), bucket->stacks, initialize, replay,
+               100.0 * bucket->offloaded / bucket->layers,
+               100.0 * bucket->fallbackStacks / bucket->stacks);
+    }
+
+    printf("layers on planes: %u sprite, %u overlay, %u primary, %u cursor\n",
+           mPlaneUse[DisplayPlane::PLANE_SPRITE],
+           mPlaneUse[DisplayPlane::PLANE_OVERLAY],
+           mPlaneUse[DisplayPlane::PLANE_PRIMARY],
+           mPlaneUse[DisplayPlane::PLANE_CURSOR]);
+
+    char buf[1024];
+    memset(buf, 0, sizeof(buf));
+    Dump d(buf, sizeof(buf));
+    mCache.dump(d);
+    printf("%s", buf);
+    printf("%u checks failed in %u stacks\n", mFailures, mFailedStacks);
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-n stacks] [-l layers] [-s seed] [-d display] [-v]\n"
+           "       [-c stacks.csv]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    FuzzOptions options;
+    options.stacks = 10000;
+    options.layers = 8;
+    options.seed = (uint32_t)systemTime(SYSTEM_TIME_MONOTONIC);
+    options.display = IDisplayDevice::DEVICE_PRIMARY;
+    options.verbose = false;
+    options.csvPath = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:l:s:d:vc:")) != -1) {
+        switch (opt) {
+        case 'n':
+            options.stacks = atoi(optarg);
+            break;
+        case 'l':
+            options.layers = atoi(optarg);
+            break;
+        case 's':
+            options.seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            options.display = atoi(optarg);
+            break;
+        case 'v':
+            options.verbose = true;
+            break;
+        case 'c':
+            options.csvPath = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.stacks < 1 || options.layers < 1 || options.layers > MAX_LAYERS ||
+        (options.display != IDisplayDevice::DEVICE_PRIMARY &&
+         options.display != IDisplayDevice::DEVICE_EXTERNAL)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!options.seed) {
+        options.seed = 1;
+    }
+
+    PlaneFuzzer fuzzer(options);
+    if (!fuzzer.open()) {
+        return 1;
+    }
+    bool ok = fuzzer.run();
+    fuzzer.report();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,561 @@
+/*
+// Copyright (c) 2014 Intel Corporation 
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+// Drives the WiDi path of VirtualDevice with a synthetic sink and reports
+// the throughput of the VSP pipeline. The sink registers with the hwc.widi
+// frame server of surfaceflinger, a virtual display is created for it and
+// content is animated on the primary display:
+//
+//   widi_vsp_bench [-d seconds] [-s WxH,...] [-m modes]
+//
+// Each size (720p and 1080p by default) runs with video extended mode off
+// and on, -m 0 or -m 1 runs only one of them. With extended mode a full
+// screen NV12 surface is played at 30 fps, the RGB surface always updates
+// at 60 fps. The sink returns every frame as soon as it arrives.
+//
+// Reported per case: frames received and their rate, render to sink
+// latency, CPU use of surfaceflinger and of the system, and the stage
+// costs VirtualDevice keeps for its dump (VA map, fence wait, compose,
+// CPU time of the compose thread and the notification of the sink).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+#include <binder/IPCThreadState.h>
+
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <gui/BufferItemConsumer.h>
+#include <gui/BufferQueue.h>
+#include <gui/ISurfaceComposer.h>
+#include <gui/Surface.h>
+#include <gui/SurfaceComposerClient.h>
+#include <ui/DisplayInfo.h>
+#include <ui/GraphicBuffer.h>
+
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include "IFrameServer.h"
+
+using namespace android;
+
+#define PIXEL_FORMAT_NV12 0x7FA00E00
+
+enum {
+    STAGE_COUNT = 5,
+};
+
+// as VirtualDevice::dump() names its stages
+static const char *sStageNames[STAGE_COUNT] = {
+    "map", "fence wait", "compose", "render cpu", "notify",
+};
+
+struct StageSample {
+    uint32_t count;
+    int64_t totalUs;
+    int64_t maxUs;
+};
+
+struct CpuSample {
+    uint64_t systemTotal;
+    uint64_t systemIdle;
+    uint64_t processTicks;
+};
+
+static int compareTime(const void *lhs, const void *rhs)
+{
+    nsecs_t l = *(const nsecs_t *)lhs;
+    nsecs_t r = *(const nsecs_t *)rhs;
+    return (l < r) ? -1 : ((l > r) ? 1 : 0);
+}
+
+// the synthetic sink, frames are returned as soon as they are ready
+class BenchFrameListener : public BnFrameListener {
+public:
+    BenchFrameListener(const sp<IFrameServer>& server)
+        : mServer(server), mFrames(0), mKernelBuffers(0) {}
+
+    status_t onFramePrepare(int64_t renderTimestamp, int64_t mediaTimestamp) {
+        return NO_ERROR;
+    }
+
+    status_t onFrameReady(int32_t handle, HWCBufferHandleType handleType,
+                          int64_t renderTimestamp, int64_t mediaTimestamp) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        {
+            Mutex::Autolock _l(mLock);
+            mFrames++;
+            if (handleType == HWC_HANDLE_TYPE_KBUF)
+                mKernelBuffers++;
+            mLatencies.push_back(now - renderTimestamp);
+            if (mFrames == 1)
+                mFirstFrame = now;
+            mLastFrame = now;
+        }
+        mServer->notifyBufferReturned(handle);
+        return NO_ERROR;
+    }
+
+    void reset() {
+        Mutex::Autolock _l(mLock);
+        mFrames = 0;
+        mKernelBuffers = 0;
+        mFirstFrame = mLastFrame = 0;
+        mLatencies.clear();
+    }
+
+    // fps over the received frames, latencies in us
+    void report() {
+        Mutex::Autolock _l(mLock);
+        double fps = 0;
+        if (mFrames > 1 && mLastFrame > mFirstFrame)
+            fps = (mFrames - 1) * 1000000000.0 / (mLastFrame - mFirstFrame);
+        printf(" %6u %6.1f", mFrames, fps);
+        size_t n = mLatencies.size();
+        if (!n) {
+            printf(" %7s %7s %7s", "-", "-", "-");
+            return;
+        }
+        qsort(mLatencies.editArray(), n, sizeof(nsecs_t), compareTime);
+        printf(" %7lld %7lld %7lld", ns2us(mLatencies[n / 2]),
+               ns2us(mLatencies[(n * 99) / 100]), ns2us(mLatencies[n - 1]));
+        printf(" %5u%%", mKernelBuffers * 100 / mFrames);
+    }
+
+private:
+    sp<IFrameServer> mServer;
+    Mutex mLock;
+    uint32_t mFrames;
+    uint32_t mKernelBuffers;
+    nsecs_t mFirstFrame;
+    nsecs_t mLastFrame;
+    Vector<nsecs_t> mLatencies;
+};
+
+class BenchTypeListener : public BnFrameTypeChangeListener {
+public:
+    BenchTypeListener() : mTypeChanges(0), mBufferChanges(0) {}
+
+    status_t frameTypeChanged(const FrameInfo& frameInfo) {
+        android_atomic_inc(&mTypeChanges);
+        return NO_ERROR;
+    }
+    status_t bufferInfoChanged(const FrameInfo& frameInfo) {
+        android_atomic_inc(&mBufferChanges);
+        return NO_ERROR;
+    }
+    status_t shutdownVideo() {
+        return NO_ERROR;
+    }
+
+    volatile int32_t mTypeChanges;
+    volatile int32_t mBufferChanges;
+};
+
+// releases what surfaceflinger renders into the virtual display
+class OutputDrainThread : public Thread {
+public:
+    OutputDrainThread(const sp<BufferItemConsumer>& consumer)
+        : Thread(false), mConsumer(consumer) {}
+private:
+    virtual bool threadLoop() {
+        BufferItemConsumer::BufferItem item;
+        if (mConsumer->acquireBuffer(&item, 0) == NO_ERROR) {
+            mConsumer->releaseBuffer(item);
+        } else {
+            usleep(2000);
+        }
+        return true;
+    }
+    sp<BufferItemConsumer> mConsumer;
+};
+
+struct BenchSurface {
+    sp<SurfaceControl> sc;
+    sp<Surface> s;
+    int format;
+    int width;
+    int height;
+};
+
+static bool createSurface(const sp<SurfaceComposerClient>& client,
+                          BenchSurface& surface, int layer, int x, int y,
+                          int width, int height, int format)
+{
+    surface.sc = client->createSurface(String8("WiDi Bench Surface"),
+                                       width, height, PIXEL_FORMAT_RGBA_8888, 0);
+    if (surface.sc == NULL || !surface.sc->isValid())
+        return false;
+    surface.s = surface.sc->getSurface();
+    surface.format = format;
+    surface.width = width;
+    surface.height = height;
+
+    ANativeWindow *anw = surface.s.get();
+    if (native_window_set_buffers_geometry(anw, width, height, format) != NO_ERROR ||
+        native_window_set_usage(anw, GRALLOC_USAGE_SW_WRITE_OFTEN) != NO_ERROR)
+        return false;
+
+    SurfaceComposerClient::openGlobalTransaction();
+    surface.sc->setLayer(layer);
+    surface.sc->setPosition(x, y);
+    surface.sc->show();
+    SurfaceComposerClient::closeGlobalTransaction();
+    return true;
+}
+
+// queues a frame of a flat color that changes every frame
+static bool queueFrame(BenchSurface& surface, int frame)
+{
+    ANativeWindow *anw = surface.s.get();
+    ANativeWindowBuffer *anb;
+    if (native_window_dequeue_buffer_and_wait(anw, &anb) != NO_ERROR)
+        return false;
+
+    sp<GraphicBuffer> buf(new GraphicBuffer(anb, false));
+    uint8_t *img = NULL;
+    buf->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, (void **)&img);
+    if (img) {
+        if (surface.format == PIXEL_FORMAT_NV12) {
+            size_t luma = buf->getStride() * surface.height;
+            memset(img, 16 + (frame * 4) % 220, luma);
+            memset(img + luma, 128, luma / 2);
+        } else {
+            uint32_t color = 0xff000000 | ((frame * 0x010305) & 0xffffff);
+            uint32_t *pixels = (uint32_t *)img;
+            for (int i = 0; i < buf->getStride() * surface.height; i++)
+                pixels[i] = color;
+        }
+        buf->unlock();
+    }
+    native_window_set_buffers_timestamp(anw, systemTime(SYSTEM_TIME_MONOTONIC));
+    return anw->queueBuffer(anw, anb, -1) == NO_ERROR;
+}
+
+static pid_t findProcess(const char *name)
+{
+    DIR *dir = opendir("/proc");
+    if (!dir)
+        return -1;
+    pid_t pid = -1;
+    struct dirent *entry;
+    while (pid < 0 && (entry = readdir(dir)) != NULL) {
+        int candidate = atoi(entry->d_name);
+        if (candidate <= 0)
+            continue;
+        char path[64], comm[64];
+        snprintf(path, sizeof(path), "/proc/%d/comm", candidate);
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+            continue;
+        if (fgets(comm, sizeof(comm), fp)) {
+            comm[strcspn(comm, "\n")] = '\0';
+            if (!strcmp(comm, name))
+                pid = candidate;
+        }
+        fclose(fp);
+    }
+    closedir(dir);
+    return pid;
+}
+
+static void sampleCpu(pid_t pid, CpuSample& sample)
+{
+    memset(&sample, 0, sizeof(sample));
+    FILE *fp = fopen("/proc/stat", "r");
+    if (fp) {
+        unsigned long long v[8];
+        memset(v, 0, sizeof(v));
+        if (fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) >= 4) {
+            for (int i = 0; i < 8; i++)
+                sample.systemTotal += v[i];
+            // idle and iowait
+            sample.systemIdle = v[3] + v[4];
+        }
+        fclose(fp);
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    fp = fopen(path, "r");
+    if (fp) {
+        char line[1024];
+        if (fgets(line, sizeof(line), fp)) {
+            // utime and stime are fields 14 and 15, after the command
+            const char *p = strrchr(line, ')');
+            unsigned long long utime = 0, stime = 0;
+            if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                            &utime, &stime) == 2)
+                sample.processTicks = utime + stime;
+        }
+        fclose(fp);
+    }
+}
+
+// the stage costs from the VirtualDevice part of the hwc dump
+static bool sampleStages(StageSample *stages)
+{
+    memset(stages, 0, sizeof(StageSample) * STAGE_COUNT);
+    FILE *fp = popen("dumpsys SurfaceFlinger", "r");
+    if (!fp)
+        return false;
+
+    char line[256];
+    bool inStages = false;
+    bool found = false;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strstr(line, "VSP stages:")) {
+            inStages = true;
+            continue;
+        }
+        if (!inStages)
+            continue;
+        const char *colon = strchr(line, ':');
+        if (line[0] != ' ' || !colon) {
+            inStages = false;
+            continue;
+        }
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            const char *name = line + strspn(line, " ");
+            if (strncmp(name, sStageNames[i], strlen(sStageNames[i])))
+                continue;
+            StageSample& s = stages[i];
+            if (sscanf(colon + 1, " count %u, total %lld us, avg %*d us, max %lld us",
+                       &s.count, &s.totalUs, &s.maxUs) == 3)
+                found = true;
+        }
+    }
+    pclose(fp);
+    return found;
+}
+
+static bool parseSizes(const char *arg, Vector<int>& widths, Vector<int>& heights)
+{
+    widths.clear();
+    heights.clear();
+    const char *p = arg;
+    while (*p) {
+        int w, h, n = 0;
+        if (sscanf(p, "%dx%d%n", &w, &h, &n) != 2 || w <= 0 || h <= 0)
+            return false;
+        widths.push_back(w);
+        heights.push_back(h);
+        p += n;
+        if (*p == ',')
+            p++;
+    }
+    return widths.size() > 0;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s [-d seconds] [-s WxH,...] [-m modes]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = 10;
+    int modes = 3;
+    Vector<int> widths, heights;
+    parseSizes("1280x720,1920x1080", widths, heights);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:m:")) != -1) {
+        switch (opt) {
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 's':
+            if (!parseSizes(optarg, widths, heights)) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            // bit 0 of modes runs without extended mode, bit 1 with it
+            modes = atoi(optarg) ? 2 : 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (seconds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ProcessState::self()->startThreadPool();
+
+    sp<IFrameServer> server = interface_cast<IFrameServer>(
+        defaultServiceManager()->checkService(String16("hwc.widi")));
+    if (server == NULL) {
+        printf("hwc.widi is not running, the hwc must be built with INTEL_WIDI\n");
+        return 1;
+    }
+
+    sp<SurfaceComposerClient> client = new SurfaceComposerClient;
+    if (client->initCheck() != NO_ERROR)
+        return 1;
+
+    DisplayInfo mainInfo;
+    sp<IBinder> mainDisplay = SurfaceComposerClient::getBuiltInDisplay(
+        ISurfaceComposer::eDisplayIdMain);
+    if (SurfaceComposerClient::getDisplayInfo(mainDisplay, &mainInfo) != NO_ERROR) {
+        printf("failed to query the display\n");
+        return 1;
+    }
+
+    pid_t flinger = findProcess("surfaceflinger");
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+
+    char savedExtMode[PROPERTY_VALUE_MAX];
+    property_get("hwc.video.extmode.enable", savedExtMode, "1");
+
+    printf("%-10s %-4s %6s %6s %7s %7s %7s %6s %6s %6s", "size", "ext", "frames",
+           "fps", "p50(us)", "p99(us)", "max(us)", "kbuf", "sf cpu", "cpu");
+    for (int i = 0; i < STAGE_COUNT; i++)
+        printf(" %10s", sStageNames[i]);
+    printf("   (stages: avg us)\n");
+
+    for (size_t c = 0; c < widths.size(); c++)
+    for (int ext = 0; ext < 2; ext++) {
+        if (!(modes & (1 << ext)))
+            continue;
+        int width = widths[c];
+        int height = heights[c];
+
+        // read by VirtualDevice::start()
+        property_set("hwc.video.extmode.enable", ext ? "1" : "0");
+
+        // the virtual display surfaceflinger composes for the sink
+        sp<IGraphicBufferProducer> producer;
+        sp<IGraphicBufferConsumer> consumer;
+        BufferQueue::createBufferQueue(&producer, &consumer);
+        sp<BufferItemConsumer> output = new BufferItemConsumer(consumer,
+            GRALLOC_USAGE_HW_VIDEO_ENCODER, 3);
+        output->setDefaultBufferSize(width, height);
+        sp<OutputDrainThread> drain = new OutputDrainThread(output);
+        drain->run("WiDiBenchDrain");
+
+        sp<IBinder> display = SurfaceComposerClient::createDisplay(
+            String8("widi_vsp_bench"), false);
+        Rect layerStack(mainInfo.w, mainInfo.h);
+        Rect outputRect(width, height);
+        SurfaceComposerClient::openGlobalTransaction();
+        SurfaceComposerClient::setDisplaySurface(display, producer);
+        SurfaceComposerClient::setDisplayProjection(display, 0, layerStack, outputRect);
+        SurfaceComposerClient::setDisplayLayerStack(display, 0);
+        SurfaceComposerClient::closeGlobalTransaction();
+
+        sp<BenchTypeListener> typeListener = new BenchTypeListener;
+        sp<BenchFrameListener> frameListener = new BenchFrameListener(server);
+        FrameProcessingPolicy policy;
+        memset(&policy, 0, sizeof(policy));
+        policy.scaledWidth = width;
+        policy.scaledHeight = height;
+        policy.xdpi = 96;
+        policy.ydpi = 96;
+        policy.refresh = 60;
+        server->start(typeListener);
+        server->setResolution(policy, frameListener);
+
+        BenchSurface ui, video;
+        bool ok = createSurface(client, ui, INT_MAX - 1, 0, 0,
+                                mainInfo.w / 2, mainInfo.h / 2, PIXEL_FORMAT_RGBA_8888);
+        if (ok && ext)
+            ok = createSurface(client, video, INT_MAX - 2, 0, 0,
+                               mainInfo.w, mainInfo.h, PIXEL_FORMAT_NV12);
+
+        // a second to settle the VSP configuration, then measured
+        StageSample before[STAGE_COUNT], after[STAGE_COUNT];
+        CpuSample cpuBefore, cpuAfter;
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t measureStart = start + s2ns(1);
+        nsecs_t end = measureStart + s2ns(seconds);
+        nsecs_t measureTime = 0;
+        bool measuring = false;
+        for (int frame = 0; ok; frame++) {
+            nsecs_t due = start + frame * s2ns(1) / 60;
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (due > now)
+                usleep(ns2us(due - now));
+            if (!measuring && due >= measureStart) {
+                frameListener->reset();
+                sampleStages(before);
+                sampleCpu(flinger, cpuBefore);
+                measureTime = systemTime(SYSTEM_TIME_MONOTONIC);
+                measuring = true;
+            }
+            if (due >= end)
+                break;
+            ok = queueFrame(ui, frame);
+            if (ok && ext && !(frame & 1))
+                ok = queueFrame(video, frame / 2);
+        }
+
+        char size[32];
+        snprintf(size, sizeof(size), "%dx%d", width, height);
+        printf("%-10s %-4s", size, ext ? "on" : "off");
+        if (!ok) {
+            printf(" failed\n");
+        } else {
+            sampleCpu(flinger, cpuAfter);
+            bool haveStages = sampleStages(after);
+            double elapsed = (systemTime(SYSTEM_TIME_MONOTONIC) - measureTime) / 1000000000.0;
+            frameListener->report();
+            double flingerCpu = (cpuAfter.processTicks - cpuBefore.processTicks) * 100.0 /
+                                (elapsed * ticksPerSecond);
+            uint64_t total = cpuAfter.systemTotal - cpuBefore.systemTotal;
+            uint64_t idle = cpuAfter.systemIdle - cpuBefore.systemIdle;
+            printf(" %5.1f%% %5.1f%%", flinger > 0 ? flingerCpu : 0.0,
+                   total ? 100.0 * (total - idle) / total : 0.0);
+            for (int i = 0; i < STAGE_COUNT; i++) {
+                uint32_t count = after[i].count - before[i].count;
+                if (!haveStages || !count) {
+                    printf(" %10s", "-");
+                    continue;
+                }
+                printf(" %10lld", (after[i].totalUs - before[i].totalUs) / count);
+            }
+            printf("\n");
+        }
+
+        server->stop(false);
+        SurfaceComposerClient::openGlobalTransaction();
+        if (ui.sc != NULL)
+            ui.sc->hide();
+        if (video.sc != NULL)
+            video.sc->hide();
+        SurfaceComposerClient::closeGlobalTransaction();
+        SurfaceComposerClient::destroyDisplay(display);
+        drain->requestExitAndWait();
+    }
+
+    property_set("hwc.video.extmode.enable", savedExtMode);
+    client->dispose();
+    return 0;
+}
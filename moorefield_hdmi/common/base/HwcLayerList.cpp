@@ -139,37 +139,7 @@ bool HwcLayerList::checkRgbOverlaySupported(HwcLayer *hwcLayer)
         return false;
     }
 
-    uint32_t format = hwcLayer->getFormat();
-    if (format != HAL_PIXEL_FORMAT_BGRA_8888 &&
-        format != HAL_PIXEL_FORMAT_BGRX_8888) {
-        return false;
-    }
-
-    const stride_t& stride = hwcLayer->getBufferStride();
-    if (stride.rgb.stride > 4096) {
-        return false;
-    }
-
-    uint32_t blending = (uint32_t)hwcLayer->getLayer()->blending;
-    if (blending != HWC_BLENDING_NONE) {
-        return false;
-    }
-
-    uint32_t trans = hwcLayer->getLayer()->transform;
-    if (trans != 0) {
-        return false;
-    }
-
-    hwc_frect_t& src = hwcLayer->getLayer()->sourceCropf;
-    hwc_rect_t& dest = hwcLayer->getLayer()->displayFrame;
-    int srcW = (int)src.right - (int)src.left;
-    int srcH = (int)src.bottom - (int)src.top;
-    int dstW = dest.right - dest.left;
-    int dstH = dest.bottom - dest.top;
-    if (srcW != dstW || srcH != dstH) {
-        return false;
-    }
-    return true;
+    return PlaneCapabilities::isRgbOverlaySupported(hwcLayer);
 }
 
 bool HwcLayerList::checkCursorSupported(HwcLayer *hwcLayer)
@@ -258,9 +228,6 @@ bool HwcLayerList::initialize()
     mCursorCandidates.setCapacity(mLayerCount);
     mZOrderConfig.setCapacity(mLayerCount);
 
-    PriorityVector rgbOverlayLayers;
-    rgbOverlayLayers.setCapacity(mLayerCount);
-
     for (int i = 0; i < mLayerCount; i++) {
         hwc_layer_1_t *layer = &mList->hwLayers[i];
         if (!layer) {
@@ -290,14 +257,17 @@ bool HwcLayerList::initialize()
             if (!DisplayQuery::forceFbScaling(mDisplayIndex)) {
                 if (checkCursorSupported(hwcLayer)) {
                     mCursorCandidates.add(hwcLayer);
-                } else if (checkRgbOverlaySupported(hwcLayer)) {
-                    rgbOverlayLayers.add(hwcLayer);
-                } else if (checkSupported(DisplayPlane::PLANE_SPRITE, hwcLayer)) {
-                    mSpriteCandidates.add(hwcLayer);
-                } else if (checkSupported(DisplayPlane::PLANE_OVERLAY, hwcLayer)) {
-                    mOverlayCandidates.add(hwcLayer);
                 } else {
-                    // noncandidate layer
+                    // an RGB layer may go to either plane type, the overlay is
+                    // tried first and takes the largest ones after the video
+                    bool sprite = checkSupported(DisplayPlane::PLANE_SPRITE, hwcLayer);
+                    if (sprite) {
+                        mSpriteCandidates.add(hwcLayer);
+                    }
+                    if (checkRgbOverlaySupported(hwcLayer) ||
+                        (!sprite && checkSupported(DisplayPlane::PLANE_OVERLAY, hwcLayer))) {
+                        mOverlayCandidates.add(hwcLayer);
+                    }
                 }
             } else {
                 if (checkSupported(DisplayPlane::PLANE_SPRITE, hwcLayer) &&
@@ -334,17 +304,6 @@ bool HwcLayerList::initialize()
         return true;
     }
 
-    bool hasOverlay = mOverlayCandidates.size() != 0;
-    while (rgbOverlayLayers.size()) {
-        HwcLayer *hwcLayer = rgbOverlayLayers.top();
-        if (hasOverlay) {
-            mSpriteCandidates.add(hwcLayer);
-        } else {
-            mOverlayCandidates.add(hwcLayer);
-        }
-        rgbOverlayLayers.removeItemsAt(0);
-    }
-
     allocatePlanes();
     //dump();
     return true;
@@ -529,6 +488,10 @@ bool HwcLayerList::assignSpritePlanes(int index, int planeNumber)
 
     int spriteCandidates = (int)mSpriteCandidates.size();
     for (int i = index; i <= spriteCandidates - planeNumber; i++) {
+        // RGB layer already on an overlay
+        if (mSpriteCandidates[i]->mPlaneCandidate) {
+            continue;
+        }
         ZOrderLayer *zlayer = addZOrderLayer(DisplayPlane::PLANE_SPRITE, mSpriteCandidates[i]);
         if (assignSpritePlanes(i + 1, planeNumber - 1)) {
             return true;
@@ -16,7 +16,6 @@
 #include <common/utils/HwcTrace.h>
 #include <Hwcomposer.h>
 #include <DisplayQuery.h>
-#include <common/observers/SoftVsyncObserver.h>
 #include <DummyDevice.h>
 
 namespace android {
@@ -27,7 +26,7 @@ DummyDevice::DummyDevice(uint32_t disp, Hwcomposer& hwc)
       mBlank(false),
       mDisp(disp),
       mHwc(hwc),
-      mVsyncObserver(NULL),
+      mDroppedFrames(0),
       mName("Dummy")
 {
     CTRACE();
@@ -58,13 +57,17 @@ bool DummyDevice::prepare(hwc_display_contents_1_t *display)
         return true;
     }
 
-    // skip all layers composition on dummy display
-    if (display->flags & HWC_GEOMETRY_CHANGED) {
-        for (size_t i=0; i < display->numHwLayers-1; i++) {
-            hwc_layer_1 * player = &display->hwLayers[i];
-            player->compositionType = HWC_OVERLAY;
-            player->flags &= ~HWC_SKIP_LAYER;
-        }
+    // skip all layers composition on dummy display, the marks stay
+    // until the next geometry change
+    if (!(display->flags & HWC_GEOMETRY_CHANGED)) {
+        return true;
+    }
+
+    hwc_layer_1 *layer = display->hwLayers;
+    hwc_layer_1 *end = layer + display->numHwLayers - 1;
+    for (; layer < end; layer++) {
+        layer->compositionType = HWC_OVERLAY;
+        layer->flags &= ~HWC_SKIP_LAYER;
     }
 
     return true;
@@ -78,13 +81,18 @@ bool DummyDevice::commit(hwc_display_contents_1_t *display, IDisplayContext *con
         return true;
 
     // nothing need to do for dummy display
+    mDroppedFrames++;
     return true;
 }
 
 bool DummyDevice::vsyncControl(bool enabled)
 {
     RETURN_FALSE_IF_NOT_INIT();
-    return mVsyncObserver->control(enabled);
+
+    // there is no vsync source, a display that never connects gets no
+    // vsync event anyway
+    VLOGTRACE("vsync %d ignored on dummy display %d", enabled, mDisp);
+    return true;
 }
 
 bool DummyDevice::blank(bool blank)
@@ -182,15 +190,9 @@ bool DummyDevice::compositionComplete()
 
 bool DummyDevice::initialize()
 {
+    mDroppedFrames = 0;
     mInitialized = true;
-
-    mVsyncObserver = new SoftVsyncObserver(*this);
-    if (!mVsyncObserver || !mVsyncObserver->initialize()) {
-        DEINIT_AND_RETURN_FALSE("Failed to create Soft Vsync Observer");
-        mInitialized = false;
-    }
-
-    return mInitialized;
+    return true;
 }
 
 bool DummyDevice::isConnected() const
@@ -221,11 +223,11 @@ void DummyDevice::dump(Dump& d)
     d.append("-------------------------------------------------------------\n");
     d.append("Device Name: %s (%s)\n", mName,
             mConnected ? "connected" : "disconnected");
+    d.append("  headless, dropped frames: %u\n", mDroppedFrames);
 }
 
 void DummyDevice::deinitialize()
 {
-    DEINIT_AND_DELETE_OBJ(mVsyncObserver);
     mInitialized = false;
 }
 
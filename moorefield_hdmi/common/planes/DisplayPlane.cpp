@@ -112,18 +112,17 @@ void DisplayPlane::setPosition(int x, int y, int w, int h)
     ALOGTRACE("Position = %d, %d - %dx%d", x, y, w, h);
 
     if (mForceScaling) {
-        // set in assignToDevice
-        mPosition.x = (int) (((float)x/DEFAULT_DRM_FB_WIDTH)*mDisplayWidth);
-        mPosition.y = (int) (((float)y/DEFAULT_DRM_FB_HEIGHT)*mDisplayHeight);
-        mPosition.w = (int) (((float)w/DEFAULT_DRM_FB_WIDTH)*mDisplayWidth);
-        mPosition.h = (int) (((float)h/DEFAULT_DRM_FB_HEIGHT)*mDisplayHeight);
+        // the frame buffer is smaller than the mode, scale the position
+        // from frame buffer to display coordinates (set in assignToDevice)
+        x = (int) (((float)x/DEFAULT_DRM_FB_WIDTH)*mDisplayWidth);
+        y = (int) (((float)y/DEFAULT_DRM_FB_HEIGHT)*mDisplayHeight);
+        w = (int) (((float)w/DEFAULT_DRM_FB_WIDTH)*mDisplayWidth);
+        h = (int) (((float)h/DEFAULT_DRM_FB_HEIGHT)*mDisplayHeight);
 
         mDisplayCrop.x = 0;
         mDisplayCrop.y = 0;
         mDisplayCrop.w = mDisplayWidth;
         mDisplayCrop.h = mDisplayHeight;
-
-        return;
     }
 
     if (mPosition.x != x || mPosition.y != y ||
@@ -22,8 +22,9 @@ namespace android {
 namespace intel {
 
 class Hwcomposer;
-class SoftVsyncObserver;
 
+// Placeholder for a display that doesn't exist. It has no vsync source
+// and starts no thread, frames given to it are only counted.
 class DummyDevice : public IDisplayDevice {
 public:
     DummyDevice(uint32_t disp, Hwcomposer& hwc);
@@ -63,7 +64,8 @@ protected:
     bool mBlank;
     uint32_t mDisp;
     Hwcomposer& mHwc;
-    SoftVsyncObserver *mVsyncObserver;
+    // frames committed to the dummy display and never shown
+    uint32_t mDroppedFrames;
 
     const char *mName;
 };
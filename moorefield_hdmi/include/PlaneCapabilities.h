@@ -30,6 +30,8 @@ public:
     static bool isBlendingSupported(int planeType, HwcLayer *hwcLayer);
     static bool isScalingSupported(int planeType, HwcLayer *hwcLayer);
     static bool isTransformSupported(int planeType,  HwcLayer *hwcLayer);
+    // RGB layer scanned out by the overlay plane
+    static bool isRgbOverlaySupported(HwcLayer *hwcLayer);
 };
 
 } // namespace intel
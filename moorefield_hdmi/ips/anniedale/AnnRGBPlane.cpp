@@ -24,7 +24,8 @@ namespace android {
 namespace intel {
 
 AnnRGBPlane::AnnRGBPlane(int index, int type, int disp)
-    : DisplayPlane(index, type, disp)
+    : DisplayPlane(index, type, disp),
+      mBlitSource(0)
 {
     CTRACE();
     memset(&mContext, 0, sizeof(mContext));
@@ -52,6 +53,7 @@ bool AnnRGBPlane::reset()
         Hwcomposer::getInstance().getBufferManager()->freeGrallocBuffer(handle);
         mScalingBufferMap.removeItemsAt(0);
     }
+    mBlitSource = 0;
 
     return DisplayPlane::reset();
 }
@@ -59,11 +61,20 @@ bool AnnRGBPlane::reset()
 bool AnnRGBPlane::flip(void*)
 {
     if (mForceScaling) {
+        // the same frame buffer target handle twice in a row was not
+        // rendered again, its upscaled copy is still good
+        if (mScalingSource == mBlitSource) {
+            VLOGTRACE("frame buffer target %#x is unchanged", mScalingSource);
+            return true;
+        }
+
         BufferManager *bm = Hwcomposer::getInstance().getBufferManager();
         if (!bm->blitGrallocBuffer(mScalingSource, mScalingTarget, mDisplayCrop, 0)) {
             ELOGTRACE("Failed to blit RGB buffer.");
+            mBlitSource = 0;
             return false;
         }
+        mBlitSource = mScalingSource;
     }
 
     return true;
@@ -105,6 +116,7 @@ bool AnnRGBPlane::setDataBuffer(uint32_t handle)
                 ELOGTRACE("Failed to allocate gralloc buffer.");
                 return false;
             }
+            mBlitSource = 0;
 
             if (mScalingBufferMap.size() >= MAX_SCALING_BUF_COUNT) {
                 while (!mScalingBufferMap.isEmpty()) {
@@ -57,6 +57,9 @@ private:
         MAX_SCALING_BUF_COUNT = 3,
     };
     KeyedVector<uint32_t, uint32_t> mScalingBufferMap;
+    // source whose upscaled copy is current, the frame buffer target
+    // flipped again without a new render is not blitted again
+    uint32_t mBlitSource;
 };
 
 } // namespace intel
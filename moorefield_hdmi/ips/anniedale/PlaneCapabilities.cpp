@@ -246,6 +246,60 @@ bool PlaneCapabilities::isTransformSupported(int planeType, HwcLayer *hwcLayer)
     return trans ? false : true;
 }
 
+bool PlaneCapabilities::isRgbOverlaySupported(HwcLayer *hwcLayer)
+{
+    hwc_layer_1_t *layer = hwcLayer->getLayer();
+
+    // the overlay only reads XRGB, RGBA/RGBX would need a swizzle and 565
+    // has no source format
+    uint32_t format = hwcLayer->getFormat();
+    if (format != HAL_PIXEL_FORMAT_BGRA_8888 &&
+        format != HAL_PIXEL_FORMAT_BGRX_8888) {
+        return false;
+    }
+
+    const stride_t& stride = hwcLayer->getBufferStride();
+    if (stride.rgb.stride > OVERLAY_PLANE_MAX_STRIDE_LINEAR) {
+        VLOGTRACE("stride %d is too large", stride.rgb.stride);
+        return false;
+    }
+
+    // the overlay doesn't blend. A premultiplied layer at the bottom of
+    // the stack is only blended with black, which leaves its colors as
+    // they are.
+    switch (layer->blending) {
+    case HWC_BLENDING_NONE:
+        break;
+    case HWC_BLENDING_PREMULT:
+        if (hwcLayer->getIndex() != 0 || layer->planeAlpha != 0xff) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    if (layer->transform != 0) {
+        return false;
+    }
+
+    hwc_frect_t& src = layer->sourceCropf;
+    hwc_rect_t& dest = layer->displayFrame;
+    int srcW = (int)src.right - (int)src.left;
+    int srcH = (int)src.bottom - (int)src.top;
+    int dstW = dest.right - dest.left;
+    int dstH = dest.bottom - dest.top;
+    if (srcW != dstW || srcH != dstH) {
+        return false;
+    }
+
+    if (srcW <= 1 || srcH <= 1 ||
+        srcW > INTEL_OVERLAY_MAX_WIDTH - 1 || srcH > INTEL_OVERLAY_MAX_HEIGHT - 1) {
+        return false;
+    }
+    return true;
+}
+
 } // namespace intel
 } // namespace android
 